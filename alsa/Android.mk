@@ -21,16 +21,32 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 LOCAL_MODULE := audio.primary.$(TARGET_BOARD_PLATFORM)
 LOCAL_MODULE_RELATIVE_PATH := hw
-LOCAL_SRC_FILES := tinyalsa_hal.c control.c pcm_ext.c
+LOCAL_SRC_FILES := tinyalsa_hal.c control.c pcm_ext.c audio_convert.c audio_stats.c iec61937.c audio_ring.c
 LOCAL_VENDOR_MODULE := true
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
 	system/media/audio_utils/include \
-	system/media/audio_effects/include
+	system/media/audio_effects/include \
+	$(IMX_PATH)/imx/include
 LOCAL_SHARED_LIBRARIES := liblog libcutils libtinyalsa libaudioutils libdl
 LOCAL_MODULE_TAGS := optional
 include $(BUILD_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+LOCAL_MODULE := audio_convert_bench
+LOCAL_VENDOR_MODULE := true
+LOCAL_SRC_FILES := audio_convert_bench.c audio_convert.c
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := audio_hal_bench
+LOCAL_VENDOR_MODULE := true
+LOCAL_SRC_FILES := audio_hal_bench.c
+LOCAL_SHARED_LIBRARIES := libhardware
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
 endif
 
 
@@ -42,11 +58,12 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := audio.primary.$(soc_name)
 LOCAL_VENDOR_MODULE := true
 LOCAL_MODULE_RELATIVE_PATH := hw
-LOCAL_SRC_FILES := tinyalsa_hal.c control.c
+LOCAL_SRC_FILES := tinyalsa_hal.c control.c audio_convert.c audio_stats.c iec61937.c audio_ring.c
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
 	system/media/audio_utils/include \
-	system/media/audio_effects/include
+	system/media/audio_effects/include \
+	$(IMX_PATH)/imx/include
 LOCAL_SHARED_LIBRARIES := liblog libcutils libtinyalsa libaudioutils libdl
 LOCAL_MODULE_TAGS := optional
 LOCAL_CFLAGS += -DBRILLO
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audio_convert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_HAVE_NEON 1
+#else
+#define AUDIO_HAVE_NEON 0
+#endif
+
+static bool neon_enabled = AUDIO_HAVE_NEON;
+
+void audio_convert_set_neon(bool enable)
+{
+    neon_enabled = enable && AUDIO_HAVE_NEON;
+}
+
+/* ESAI slot of each android channel: FL FR C LFE BL BR (SL SR) */
+static const uint8_t esai_map_6[6] = { 0, 3, 2, 5, 1, 4 };
+static const uint8_t esai_map_8[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+static void remap_scalar(int16_t *buf, size_t start, size_t end,
+                         const uint8_t *map, int channels)
+{
+    int16_t frame[8];
+    size_t i;
+    int c;
+
+    for (i = start; i < end; i++) {
+        int16_t *p = buf + i * channels;
+        for (c = 0; c < channels; c++)
+            frame[map[c]] = p[c];
+        for (c = 0; c < channels; c++)
+            p[c] = frame[c];
+    }
+}
+
+/* channel pairs are moved as 32 bit lanes, vtrn picks samples of pairs */
+static void remap_esai_6(int16_t *buf, size_t frames)
+{
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        static const uint16_t even[8] = { 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 };
+        uint16x8_t mask = vld1q_u16(even);
+        for (; i + 4 <= frames; i += 4) {
+            uint32_t *p = (uint32_t *)(buf + i * 6);
+            uint32x4x3_t in = vld3q_u32(p);
+            int16x8_t front = vreinterpretq_s16_u32(in.val[0]);   /* FL FR */
+            int16x8_t center = vreinterpretq_s16_u32(in.val[1]);  /* C LFE */
+            int16x8_t back = vreinterpretq_s16_u32(in.val[2]);    /* BL BR */
+            int16x8x2_t fb = vtrnq_s16(front, back);
+            int16x8x2_t bc = vtrnq_s16(back, center);
+            uint32x4x3_t out;
+            out.val[0] = vreinterpretq_u32_s16(fb.val[0]);        /* FL BL */
+            out.val[1] = vreinterpretq_u32_s16(vbslq_s16(mask, center, front)); /* C FR */
+            out.val[2] = vreinterpretq_u32_s16(bc.val[1]);        /* BR LFE */
+            vst3q_u32(p, out);
+        }
+    }
+#endif
+    remap_scalar(buf, i, frames, esai_map_6, 6);
+}
+
+static void remap_esai_8(int16_t *buf, size_t frames)
+{
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        for (; i + 4 <= frames; i += 4) {
+            uint32_t *p = (uint32_t *)(buf + i * 8);
+            uint32x4x4_t in = vld4q_u32(p);
+            int16x8x2_t fb = vtrnq_s16(vreinterpretq_s16_u32(in.val[0]),   /* FL FR */
+                                       vreinterpretq_s16_u32(in.val[2]));  /* BL BR */
+            int16x8x2_t cs = vtrnq_s16(vreinterpretq_s16_u32(in.val[1]),   /* C LFE */
+                                       vreinterpretq_s16_u32(in.val[3]));  /* SL SR */
+            uint32x4x4_t out;
+            out.val[0] = vreinterpretq_u32_s16(fb.val[0]);    /* FL BL */
+            out.val[1] = vreinterpretq_u32_s16(cs.val[0]);    /* C SL */
+            out.val[2] = vreinterpretq_u32_s16(fb.val[1]);    /* FR BR */
+            out.val[3] = vreinterpretq_u32_s16(cs.val[1]);    /* LFE SR */
+            vst4q_u32(p, out);
+        }
+    }
+#endif
+    remap_scalar(buf, i, frames, esai_map_8, 8);
+}
+
+channel_remap_t get_esai_remap(int channels)
+{
+    if (channels == 6)
+        return remap_esai_6;
+    if (channels == 8)
+        return remap_esai_8;
+    return NULL;
+}
+
+/* 24 bit stereo to 16 bit stereo */
+static void convert_24_16(const void *src, void *dst, size_t frames)
+{
+    const int32_t *s = (const int32_t *)src;
+    int16_t *d = (int16_t *)dst;
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        for (; i + 4 <= frames; i += 4) {
+            int32x4_t a = vld1q_s32(s + i * 2);
+            int32x4_t b = vld1q_s32(s + i * 2 + 4);
+            vst1q_s16(d + i * 2, vcombine_s16(vshrn_n_s32(a, 8), vshrn_n_s32(b, 8)));
+        }
+    }
+#endif
+    for (i *= 2; i < frames * 2; i++)
+        d[i] = (int16_t)(s[i] >> 8);
+}
+
+/* 24 bit mono to 16 bit stereo */
+static void convert_24_16_mono2stereo(const void *src, void *dst, size_t frames)
+{
+    const int32_t *s = (const int32_t *)src;
+    int16_t *d = (int16_t *)dst;
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        for (; i + 4 <= frames; i += 4) {
+            int16x4x2_t out;
+            out.val[0] = vshrn_n_s32(vld1q_s32(s + i), 8);
+            out.val[1] = out.val[0];
+            vst2_s16(d + i * 2, out);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        int16_t v = (int16_t)(s[i] >> 8);
+        d[i * 2] = v;
+        d[i * 2 + 1] = v;
+    }
+}
+
+/* 24 bit stereo to 16 bit mono, half of each sign extended channel */
+static void convert_24_16_stereo2mono(const void *src, void *dst, size_t frames)
+{
+    const int32_t *s = (const int32_t *)src;
+    int16_t *d = (int16_t *)dst;
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        for (; i + 4 <= frames; i += 4) {
+            int32x4x2_t in = vld2q_s32(s + i * 2);
+            int32x4_t l = vshrq_n_s32(vshlq_n_s32(in.val[0], 8), 17);
+            int32x4_t r = vshrq_n_s32(vshlq_n_s32(in.val[1], 8), 17);
+            vst1_s16(d + i, vmovn_s32(vaddq_s32(l, r)));
+        }
+    }
+#endif
+    for (; i < frames; i++)
+        d[i] = (int16_t)(((s[i * 2] << 8) >> 17) + ((s[i * 2 + 1] << 8) >> 17));
+}
+
+/* 16 bit mono to 16 bit stereo */
+static void convert_16_mono2stereo(const void *src, void *dst, size_t frames)
+{
+    const int16_t *s = (const int16_t *)src;
+    int16_t *d = (int16_t *)dst;
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t out;
+            out.val[0] = vld1q_s16(s + i);
+            out.val[1] = out.val[0];
+            vst2q_s16(d + i * 2, out);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        d[i * 2] = s[i];
+        d[i * 2 + 1] = s[i];
+    }
+}
+
+/* 16 bit stereo to 16 bit mono */
+static void convert_16_stereo2mono(const void *src, void *dst, size_t frames)
+{
+    const int16_t *s = (const int16_t *)src;
+    int16_t *d = (int16_t *)dst;
+    size_t i = 0;
+#if AUDIO_HAVE_NEON
+    if (neon_enabled) {
+        for (; i + 8 <= frames; i += 8) {
+            int16x8x2_t in = vld2q_s16(s + i * 2);
+            vst1q_s16(d + i, vaddq_s16(vshrq_n_s16(in.val[0], 1),
+                                       vshrq_n_s16(in.val[1], 1)));
+        }
+    }
+#endif
+    for (; i < frames; i++)
+        d[i] = (int16_t)((s[i * 2] >> 1) + (s[i * 2 + 1] >> 1));
+}
+
+record_convert_t get_record_convert(bool bit_24b_2_16b, bool mono2stereo, bool stereo2mono)
+{
+    if (mono2stereo && stereo2mono)
+        return NULL;
+
+    if (bit_24b_2_16b) {
+        if (mono2stereo)
+            return convert_24_16_mono2stereo;
+        if (stereo2mono)
+            return convert_24_16_stereo2mono;
+        return convert_24_16;
+    }
+
+    if (mono2stereo)
+        return convert_16_mono2stereo;
+    if (stereo2mono)
+        return convert_16_stereo2mono;
+    return NULL;
+}
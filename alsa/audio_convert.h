@@ -0,0 +1,42 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_CONVERT_H
+#define _AUDIO_CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* capture conversion of frames from pcm buffer to client buffer */
+typedef void (*record_convert_t)(const void *src, void *dst, size_t frames);
+/* in place channel permutation of 16 bit frames */
+typedef void (*channel_remap_t)(int16_t *buf, size_t frames);
+
+/* kernel of capture conversion, NULL if pcm data needs none.
+ * 24 bit samples are S24_LE in 32 bit containers.
+ */
+record_convert_t get_record_convert(bool bit_24b_2_16b, bool mono2stereo, bool stereo2mono);
+
+/* kernel reordering android 5.1/7.1 frames to ESAI slot order,
+ * NULL if channels need no reorder.
+ */
+channel_remap_t get_esai_remap(int channels);
+
+/* use NEON kernels if built in, false for scalar code */
+void audio_convert_set_neon(bool enable);
+
+#endif
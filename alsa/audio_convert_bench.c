@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* audio conversion throughput, usage: audio_convert_bench [iterations] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audio_convert.h"
+
+#define BENCH_ITERATIONS 200
+/* one second at 48kHz */
+#define BENCH_FRAMES 48000
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* MB/s of source bytes */
+static double get_rate(size_t bytes, int iterations, int64_t time)
+{
+    if (time <= 0)
+        return 0;
+    return (double)bytes * iterations * 1000.0 / time;
+}
+
+static void bench_remap(int channels, int iterations, bool neon)
+{
+    size_t bytes = BENCH_FRAMES * channels * sizeof(int16_t);
+    int16_t *buf = (int16_t *)malloc(bytes);
+    channel_remap_t remap = get_esai_remap(channels);
+    int64_t start, time;
+    size_t i;
+    int n;
+
+    if (buf == NULL || remap == NULL) {
+        free(buf);
+        return;
+    }
+    for (i = 0; i < bytes / sizeof(int16_t); i++)
+        buf[i] = (int16_t)(i * 7);
+
+    audio_convert_set_neon(neon);
+    remap(buf, BENCH_FRAMES);
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++)
+        remap(buf, BENCH_FRAMES);
+    time = now_ns() - start;
+
+    printf("esai %dch  %-6s %8.1f MB/s %6.3f ms\n", channels,
+           neon ? "neon" : "scalar", get_rate(bytes, iterations, time),
+           time / 1000000.0 / iterations);
+    free(buf);
+}
+
+static void bench_record(const char *name, bool bit_24b_2_16b, bool mono2stereo,
+                         bool stereo2mono, int iterations, bool neon)
+{
+    int in_channels = mono2stereo ? 1 : 2;
+    size_t bytes = BENCH_FRAMES * in_channels * (bit_24b_2_16b ? 4 : 2);
+    uint8_t *src = (uint8_t *)malloc(bytes);
+    int16_t *dst = (int16_t *)malloc(BENCH_FRAMES * 2 * sizeof(int16_t));
+    record_convert_t convert = get_record_convert(bit_24b_2_16b, mono2stereo, stereo2mono);
+    int64_t start, time;
+    size_t i;
+    int n;
+
+    if (src == NULL || dst == NULL || convert == NULL) {
+        free(src);
+        free(dst);
+        return;
+    }
+    for (i = 0; i < bytes; i++)
+        src[i] = (uint8_t)(i * 7);
+
+    audio_convert_set_neon(neon);
+    convert(src, dst, BENCH_FRAMES);
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++)
+        convert(src, dst, BENCH_FRAMES);
+    time = now_ns() - start;
+
+    printf("%-9s %-6s %8.1f MB/s %6.3f ms\n", name, neon ? "neon" : "scalar",
+           get_rate(bytes, iterations, time), time / 1000000.0 / iterations);
+    free(src);
+    free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = BENCH_ITERATIONS;
+    int neon;
+
+    if (argc > 1)
+        iterations = atoi(argv[1]);
+    if (iterations <= 0)
+        iterations = BENCH_ITERATIONS;
+
+    for (neon = 0; neon <= 1; neon++) {
+        bench_remap(6, iterations, neon);
+        bench_remap(8, iterations, neon);
+    }
+
+    for (neon = 0; neon <= 1; neon++) {
+        bench_record("s24->s16", true, false, false, iterations, neon);
+        bench_record("s24 1->2", true, true, false, iterations, neon);
+        bench_record("s24 2->1", true, false, true, iterations, neon);
+        bench_record("s16 1->2", false, true, false, iterations, neon);
+        bench_record("s16 2->1", false, false, true, iterations, neon);
+    }
+
+    return 0;
+}
@@ -0,0 +1,407 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* audio HAL latency and throughput through the HAL API, one key=value result
+ * per line so runs before and after a change can be diffed.
+ * usage: audio_hal_bench [-n writes] [-s standby_loops] [-l] [-i]
+ *   -l  round trip latency, needs speaker to mic or line loopback
+ *   -i  skip input stream tests
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+#include <system/audio.h>
+
+#define BENCH_WRITES        500
+#define BENCH_STANDBY_LOOPS 20
+/* silence played before impulse, lets both streams settle */
+#define LOOPBACK_LEAD_MS    1000
+#define LOOPBACK_TAIL_MS    1000
+/* impulse detected when capture crosses this, -12 dBFS */
+#define LOOPBACK_THRESHOLD  8192
+
+struct bench_result {
+    int64_t *samples_ns;
+    int count;
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_result(const char *name, struct bench_result *result)
+{
+    int n = result->count;
+
+    if (n == 0) {
+        printf("%s.count=0\n", name);
+        return;
+    }
+    qsort(result->samples_ns, n, sizeof(int64_t), cmp_int64);
+    printf("%s.count=%d\n", name, n);
+    printf("%s.p50_us=%lld\n", name, (long long)result->samples_ns[n / 2] / 1000);
+    printf("%s.p90_us=%lld\n", name, (long long)result->samples_ns[n * 9 / 10] / 1000);
+    printf("%s.p99_us=%lld\n", name, (long long)result->samples_ns[n * 99 / 100] / 1000);
+    printf("%s.max_us=%lld\n", name, (long long)result->samples_ns[n - 1] / 1000);
+}
+
+static int result_init(struct bench_result *result, int count)
+{
+    result->samples_ns = (int64_t *)calloc(count, sizeof(int64_t));
+    result->count = 0;
+    return result->samples_ns ? 0 : -ENOMEM;
+}
+
+static struct audio_stream_out *open_output(struct audio_hw_device *dev)
+{
+    struct audio_config config;
+    struct audio_stream_out *out = NULL;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                &config, &out, "") != 0) {
+        /* HAL proposed its own config, retry with it */
+        if (dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                    &config, &out, "") != 0)
+            return NULL;
+    }
+    return out;
+}
+
+static struct audio_stream_in *open_input(struct audio_hw_device *dev)
+{
+    struct audio_config config;
+    struct audio_stream_in *in = NULL;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 48000;
+    config.channel_mask = AUDIO_CHANNEL_IN_MONO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (dev->open_input_stream(dev, 1, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in,
+                               AUDIO_INPUT_FLAG_NONE, "", AUDIO_SOURCE_MIC) != 0) {
+        if (dev->open_input_stream(dev, 1, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in,
+                                   AUDIO_INPUT_FLAG_NONE, "", AUDIO_SOURCE_MIC) != 0)
+            return NULL;
+    }
+    return in;
+}
+
+/* write call latency and rate of steady state playback */
+static void bench_write(struct audio_stream_out *out, int writes)
+{
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    size_t frame_size = audio_stream_out_frame_size(out);
+    uint32_t rate = out->common.get_sample_rate(&out->common);
+    void *buf = calloc(1, bytes);
+    struct bench_result result;
+    int64_t start, begin, end;
+    int i;
+
+    if (buf == NULL || result_init(&result, writes) != 0) {
+        free(buf);
+        return;
+    }
+
+    printf("out.rate=%u\n", rate);
+    printf("out.buffer_frames=%zu\n", bytes / frame_size);
+    printf("out.latency_ms=%u\n", out->get_latency(out));
+
+    /* first write leaves standby, not part of steady state */
+    out->write(out, buf, bytes);
+    start = now_ns();
+    for (i = 0; i < writes; i++) {
+        begin = now_ns();
+        if (out->write(out, buf, bytes) < 0)
+            break;
+        end = now_ns();
+        result.samples_ns[result.count++] = end - begin;
+    }
+    end = now_ns();
+
+    print_result("out.write", &result);
+    if (end > start)
+        printf("out.throughput_ratio=%.4f\n",
+               (double)(bytes / frame_size) * result.count * 1000000000.0 / rate / (end - start));
+    free(result.samples_ns);
+    free(buf);
+}
+
+/* time of first write after standby, pcm open or resume of idle pcm */
+static void bench_standby(struct audio_stream_out *out, int loops)
+{
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    void *buf = calloc(1, bytes);
+    struct bench_result result;
+    int64_t begin;
+    int i;
+
+    if (buf == NULL || result_init(&result, loops) != 0) {
+        free(buf);
+        return;
+    }
+
+    for (i = 0; i < loops; i++) {
+        out->common.standby(&out->common);
+        begin = now_ns();
+        if (out->write(out, buf, bytes) < 0)
+            break;
+        result.samples_ns[result.count++] = now_ns() - begin;
+    }
+
+    print_result("out.standby_exit", &result);
+    out->common.standby(&out->common);
+    free(result.samples_ns);
+    free(buf);
+}
+
+static void bench_read(struct audio_stream_in *in, int reads)
+{
+    size_t bytes = in->common.get_buffer_size(&in->common);
+    size_t frame_size = audio_stream_in_frame_size(in);
+    uint32_t rate = in->common.get_sample_rate(&in->common);
+    void *buf = malloc(bytes);
+    struct bench_result result;
+    int64_t start, begin, end;
+    int64_t standby_exit;
+    int i;
+
+    if (buf == NULL || result_init(&result, reads) != 0) {
+        free(buf);
+        return;
+    }
+
+    printf("in.rate=%u\n", rate);
+    printf("in.buffer_frames=%zu\n", bytes / frame_size);
+
+    in->common.standby(&in->common);
+    begin = now_ns();
+    in->read(in, buf, bytes);
+    standby_exit = now_ns() - begin;
+    printf("in.standby_exit_us=%lld\n", (long long)standby_exit / 1000);
+
+    start = now_ns();
+    for (i = 0; i < reads; i++) {
+        begin = now_ns();
+        if (in->read(in, buf, bytes) < 0)
+            break;
+        end = now_ns();
+        result.samples_ns[result.count++] = end - begin;
+    }
+    end = now_ns();
+
+    print_result("in.read", &result);
+    if (end > start)
+        printf("in.throughput_ratio=%.4f\n",
+               (double)(bytes / frame_size) * result.count * 1000000000.0 / rate / (end - start));
+    printf("in.frames_lost=%u\n", in->get_input_frames_lost(in));
+    in->common.standby(&in->common);
+    free(result.samples_ns);
+    free(buf);
+}
+
+struct loopback {
+    struct audio_stream_in *in;
+    volatile bool done;
+    int64_t detect_frame;       /* capture frame of impulse, -1 if not found */
+    int64_t frames;
+};
+
+static void *loopback_capture(void *context)
+{
+    struct loopback *lb = (struct loopback *)context;
+    struct audio_stream_in *in = lb->in;
+    size_t bytes = in->common.get_buffer_size(&in->common);
+    size_t channels = audio_channel_count_from_in_mask(in->common.get_channels(&in->common));
+    int16_t *buf = (int16_t *)malloc(bytes);
+    size_t frames = bytes / audio_stream_in_frame_size(in);
+    size_t i;
+
+    if (buf == NULL)
+        return NULL;
+    while (!lb->done) {
+        if (in->read(in, buf, bytes) < 0)
+            break;
+        for (i = 0; i < frames && lb->detect_frame < 0; i++) {
+            if (abs(buf[i * channels]) >= LOOPBACK_THRESHOLD)
+                lb->detect_frame = lb->frames + i;
+        }
+        lb->frames += frames;
+    }
+    free(buf);
+    return NULL;
+}
+
+/* impulse render time from presentation position, its capture time from
+ * capture position, both at CLOCK_MONOTONIC.
+ */
+static void bench_loopback(struct audio_stream_out *out, struct audio_stream_in *in)
+{
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    size_t frame_size = audio_stream_out_frame_size(out);
+    size_t frames = bytes / frame_size;
+    uint32_t out_rate = out->common.get_sample_rate(&out->common);
+    uint32_t in_rate = in->common.get_sample_rate(&in->common);
+    int16_t *buf = (int16_t *)calloc(1, bytes);
+    struct loopback lb;
+    pthread_t thread;
+    uint64_t written = 0, impulse_frame = 0;
+    uint64_t presented;
+    int64_t captured, capture_ns;
+    struct timespec ts;
+    int64_t render_ns = 0;
+    bool sent = false;
+    size_t lead = (size_t)out_rate * LOOPBACK_LEAD_MS / 1000;
+    size_t total = lead + (size_t)out_rate * LOOPBACK_TAIL_MS / 1000;
+
+    if (buf == NULL)
+        return;
+
+    memset(&lb, 0, sizeof(lb));
+    lb.in = in;
+    lb.detect_frame = -1;
+    if (pthread_create(&thread, NULL, loopback_capture, &lb) != 0) {
+        free(buf);
+        return;
+    }
+
+    while (written < total) {
+        memset(buf, 0, bytes);
+        if (!sent && written + frames > lead) {
+            impulse_frame = written;
+            buf[0] = buf[1] = 32767;
+            sent = true;
+        }
+        if (out->write(out, buf, bytes) < 0)
+            break;
+        written += frames;
+
+        /* position is sampled while impulse is queued, accurate to a period */
+        if (sent && render_ns == 0 &&
+                out->get_presentation_position(out, &presented, &ts) == 0)
+            render_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec +
+                        ((int64_t)impulse_frame - (int64_t)presented) * 1000000000LL / out_rate;
+    }
+
+    lb.done = true;
+    pthread_join(thread, NULL);
+
+    if (lb.detect_frame < 0 || render_ns == 0 ||
+            in->get_capture_position(in, &captured, &capture_ns) != 0) {
+        printf("loopback.detected=0\n");
+    } else {
+        capture_ns += (lb.detect_frame - captured) * 1000000000LL / in_rate;
+        printf("loopback.detected=1\n");
+        printf("loopback.round_trip_us=%lld\n", (long long)(capture_ns - render_ns) / 1000);
+    }
+    out->common.standby(&out->common);
+    in->common.standby(&in->common);
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    const hw_module_t *module;
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct audio_stream_in *in = NULL;
+    int writes = BENCH_WRITES;
+    int loops = BENCH_STANDBY_LOOPS;
+    bool loopback = false;
+    bool input = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:li")) != -1) {
+        switch (opt) {
+        case 'n':
+            writes = atoi(optarg);
+            break;
+        case 's':
+            loops = atoi(optarg);
+            break;
+        case 'l':
+            loopback = true;
+            break;
+        case 'i':
+            input = false;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n writes] [-s standby_loops] [-l] [-i]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (writes <= 0)
+        writes = BENCH_WRITES;
+    if (loops <= 0)
+        loops = BENCH_STANDBY_LOOPS;
+
+    if (hw_get_module_by_class(AUDIO_HARDWARE_MODULE_ID, AUDIO_HARDWARE_MODULE_ID_PRIMARY,
+                               &module) != 0) {
+        fprintf(stderr, "cannot load primary audio module\n");
+        return 1;
+    }
+    if (audio_hw_device_open(module, &dev) != 0 || dev->init_check(dev) != 0) {
+        fprintf(stderr, "cannot open audio device\n");
+        return 1;
+    }
+
+    out = open_output(dev);
+    if (out == NULL) {
+        fprintf(stderr, "cannot open output stream\n");
+        audio_hw_device_close(dev);
+        return 1;
+    }
+    bench_standby(out, loops);
+    bench_write(out, writes);
+    out->common.standby(&out->common);
+
+    if (input || loopback) {
+        in = open_input(dev);
+        if (in == NULL)
+            fprintf(stderr, "cannot open input stream\n");
+    }
+    if (in != NULL && input)
+        bench_read(in, writes);
+    if (in != NULL && loopback)
+        bench_loopback(out, in);
+
+    if (in != NULL)
+        dev->close_input_stream(dev, in);
+    dev->close_output_stream(dev, out);
+    audio_hw_device_close(dev);
+    return 0;
+}
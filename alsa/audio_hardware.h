@@ -18,11 +18,17 @@
 #ifndef ANDROID_INCLUDE_IMX_AUDIO_HARDWARE_H
 #define ANDROID_INCLUDE_IMX_AUDIO_HARDWARE_H
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <tinyalsa/asoundlib.h>
 
 #include <hardware/hardware.h>
 
+#include "audio_convert.h"
+#include "audio_ring.h"
+#include "audio_stats.h"
+#include "iec61937.h"
+
 
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
 
@@ -45,6 +51,8 @@ enum output_type {
     OUTPUT_PRIMARY,   // low latency output stream
     OUTPUT_HDMI,
     OUTPUT_ESAI,
+    OUTPUT_MMAP,      // AAudio mmap no-irq stream
+    OUTPUT_HIRES,     // direct PCM at card native rate and sample format
     OUTPUT_TOTAL
 };
 
@@ -53,9 +61,15 @@ struct route_setting
     char *ctl_name;
     int intval;
     char *strval;
+    /* control of ctl_name in mixer, resolved when card is scanned */
+    struct mixer *mixer;
+    struct mixer_ctl *ctl;
 };
 
 
+/* rates of direct hi-res profile, 0 terminated */
+#define MAX_HIRES_RATE_NUM   8
+
 struct audio_card{
     char * name;
     char * driver_name;
@@ -76,6 +90,11 @@ struct audio_card{
     unsigned int  out_rate;
     int  out_channels;
     int  out_format;
+    /* direct hi-res profile probed at scan, rate 0 if card takes only 16 bit */
+    unsigned int  hires_rate;
+    int  hires_format;
+    /* all standard rates card runs hi-res profile at, hires_rate among them */
+    unsigned int  hires_rates[MAX_HIRES_RATE_NUM];
     unsigned int  in_rate;
     int  in_channels;
     int  in_format;
@@ -87,6 +106,48 @@ struct audio_card{
 #define MAX_SUP_CHANNEL_NUM  20
 #define MAX_SUP_RATE_NUM     20
 
+/* channel masks of HDMI sink: stereo, 5.1 and 7.1 */
+#define HDMI_MAX_CHANNEL_MASKS 3
+
+/* EDID audio capabilities of HDMI sink */
+struct hdmi_caps {
+    bool valid;
+    audio_channel_mask_t channel_masks[HDMI_MAX_CHANNEL_MASKS];
+    int channel_masks_num;
+    int rates[MAX_SUP_RATE_NUM];
+    int rates_num;
+};
+
+/* input streams reading capture PCM at a time */
+#define MAX_CAPTURE_CLIENTS 4
+
+struct imx_stream_in;
+
+/* capture PCM shared by input streams: reader thread queues each period to
+ * ring of every client, clients resample, convert and preprocess on their own.
+ */
+struct capture_engine {
+    pthread_t thread;
+    pthread_mutex_t lock;       /* client list, snapshot and wakeup */
+    pthread_cond_t cond;        /* period queued */
+    bool started;
+    bool exit;
+    struct pcm *pcm;
+    struct pcm_config config;
+    int read_flags;             /* PCM_MMAP if capture ring is mapped */
+    int device;
+    size_t frame_bytes;
+    size_t period_bytes;
+    void *buffer;               /* one period, read by thread only */
+    struct imx_stream_in *clients[MAX_CAPTURE_CLIENTS];
+    int clients_num;            /* changed with hw device and engine mutexes locked */
+    /* kernel frames and time of last read, for capture position of clients */
+    size_t avail;
+    struct timespec tstamp;
+    int fail_count;
+    struct stream_stats stats;
+};
+
 struct imx_audio_device {
     struct audio_hw_device hw_device;
 
@@ -99,13 +160,27 @@ struct imx_audio_device {
     struct pcm *pcm_modem_ul;
     int in_call;
     float voice_volume;
-    struct imx_stream_in  *active_input;                /*1 input stream, 2 outout stream*/
+    /* input routing the mic: mmap stream or latest started capture client */
+    struct imx_stream_in  *active_input;
     struct imx_stream_out *active_output[OUTPUT_TOTAL];
     bool mic_mute;
     int tty_mode;
-    struct echo_reference_itfe *echo_reference;
+    struct echo_ring *echo_reference;
     bool bluetooth_nrec;
     bool support_multichannel;
+    /* card runs small periods of AUDIO_OUTPUT_FLAG_FAST output */
+    bool support_fast_output;
+    /* card keeps AUDIO_OUTPUT_FLAG_DEEP_BUFFER output in a multi-second ring */
+    bool support_deep_buffer;
+    /* playback PCM of speaker card deep buffer output runs on, -1 if none */
+    int deep_port;
+    int resampler_quality;                   /*RESAMPLER_QUALITY_* of all streams*/
+    /* delayed standby of primary output, see standby_thread_loop() */
+    int standby_delay_ms;
+    pthread_t standby_thread;
+    pthread_cond_t standby_cond;
+    bool standby_thread_started;
+    bool standby_exit;
     int  wb_amr;
     bool low_power;
     struct audio_card *card_list[MAX_AUDIO_CARD_NUM];
@@ -114,6 +189,65 @@ struct imx_audio_device {
     unsigned int default_rate;               /*HAL input samplerate*/
     unsigned int mm_rate;                    /*HAL hardware output samplerate*/
     char usb_card_name[128];
+    struct hdmi_caps hdmi_caps;
+    struct capture_engine capture;
+    /* SPDIF receiver rate followed by spdif thread, 0 if no signal */
+    struct mixer *spdif_mixer;
+    struct mixer_ctl *spdif_rate_ctl;
+    unsigned int spdif_in_rate;
+    pthread_t spdif_thread;
+    bool spdif_thread_started;
+    bool spdif_exit;
+};
+
+/* writer thread of one PCM when a stream plays on several PCMs, the stream
+ * write queues data and returns, a stalled sink only drops its own data.
+ */
+struct pcm_fanout {
+    struct audio_ring ring;
+    pthread_t thread;
+    pthread_mutex_t lock;       /* wakeup only, ring itself is lock free */
+    pthread_cond_t cond;
+    bool started;
+    bool exit;
+    struct pcm *pcm;
+    int write_flags;
+    size_t chunk_bytes;         /* one period, largest single pcm write */
+    unsigned int rate;
+    int fail_count;
+    uint32_t overruns;          /* stream writes dropped, ring was full */
+    /* clock of sink drifts from first PCM, frames queued for it are kept at
+     * fill_target by resampling to 1 + drift_ppm / 1000000 of input rate.
+     */
+    int16_t *adjust_buffer;     /* rate adjusted chunk, thread only */
+    int16_t adjust_last[2];     /* last input frame, start of interpolation */
+    uint64_t adjust_phase;      /* Q32 position of next output after it */
+    int drift_ppm;
+    int64_t fill_avg;           /* Q8 frames */
+    int64_t fill_target;        /* Q8 frames */
+    size_t drift_frames;        /* written since last fill measure */
+    int drift_measures;
+    struct stream_stats stats;
+};
+
+/* playback reference of AEC, blocks of frames with render time written by
+ * primary output and read by active input, neither side locks or waits.
+ */
+struct echo_ring {
+    struct audio_ring ring;
+    unsigned int rate;          /* of output frames */
+    unsigned int channels;
+    uint32_t drops;             /* blocks dropped, input fell behind */
+};
+
+/* presentation position published by stream write under seqlock, seq is
+ * odd while it is updated, readers retry instead of taking stream mutex.
+ */
+struct position_snapshot {
+    uint32_t seq;
+    bool valid;
+    uint64_t frames;
+    struct timespec tstamp;
 };
 
 struct imx_stream_out {
@@ -123,11 +257,18 @@ struct imx_stream_out {
     struct pcm_config config[PCM_TOTAL];
     struct pcm *pcm[PCM_TOTAL];
     int writeContiFailCount[PCM_TOTAL];
+    struct stream_stats stats;
     struct resampler_itfe *resampler[PCM_TOTAL];
+    /* PCMs not at default rate, written from resampled buffer */
+    bool resampled[PCM_TOTAL];
+    /* PCM whose resampler fills buffer, -1 if none */
+    int resample_pcm;
+    /* PCMs other than first opened one are written by fanout threads */
+    struct pcm_fanout fanout[PCM_TOTAL];
     char *buffer;
     int standby;
     int card_index;
-    struct echo_reference_itfe *echo_reference;
+    struct echo_ring *echo_reference;
     struct imx_audio_device *dev;
     int write_threshold[PCM_TOTAL];
     bool low_power;
@@ -135,8 +276,27 @@ struct imx_stream_out {
     int device;
     size_t buffer_frames;
     uint64_t written;
+    struct position_snapshot position;
+    /* low latency profile: small periods, mmap ring without period irq */
+    bool fast;
+    /* low power profile: large periods, writer wakes once per write */
+    bool deep;
+    /* hi-res direct profile: frames go to codec without conversion */
+    bool hires;
+    /* AAudio exclusive stream, DMA ring is shared with client */
+    bool mmap;
+    /* standby keeps PCMs opened and stopped until idle_deadline_ns */
+    bool delay_standby;
+    bool idle;
+    int64_t idle_deadline_ns;
+    /* compressed format sent to HDMI sink as IEC61937 bursts */
+    enum iec61937_format passthrough;
+    audio_format_t format;
+    struct iec61937_packer iec;
+    /* reorders multichannel frames to ESAI slots, NULL if not needed */
+    channel_remap_t esai_remap;
     audio_channel_mask_t channel_mask;
-    audio_channel_mask_t sup_channel_masks[3];
+    audio_channel_mask_t sup_channel_masks[HDMI_MAX_CHANNEL_MASKS];
     int sup_rates[MAX_SUP_RATE_NUM];
 };
 
@@ -160,7 +320,14 @@ struct imx_stream_in {
 
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
     struct pcm_config config;
+    /* own PCM of mmap stream, others read from capture engine */
     struct pcm *pcm;
+    /* periods queued by capture engine */
+    struct audio_ring capture_ring;
+    bool attached;
+    /* set by engine when a period was lost: ring full or PCM xrun */
+    bool capture_xrun;
+    uint32_t capture_drops;
     int device;
     struct resampler_itfe *resampler;
     struct resampler_buffer_provider buf_provider;
@@ -170,13 +337,15 @@ struct imx_stream_in {
     int32_t *read_tmp_buf;
     size_t read_tmp_buf_size;
     size_t read_tmp_buf_frames;
+    /* pcm to requested format/channels, NULL if read directly */
+    record_convert_t record_convert;
 
     unsigned int requested_rate;
     unsigned int requested_format;
     unsigned int requested_channel;
     int standby;
     int source;
-    struct echo_reference_itfe *echo_reference;
+    struct echo_ring *echo_reference;
     bool need_echo_reference;
     struct effect_info_s preprocessors[MAX_PREPROCESSORS];
     int num_preprocessors;
@@ -189,13 +358,29 @@ struct imx_stream_in {
     int16_t *ref_buf;
     size_t ref_buf_size;
     size_t ref_frames_in;
+    /* render time of first frame in ref_buf */
+    int64_t ref_render_ns;
+    /* block read from echo ring, converted to requested rate/channels */
+    int16_t *ref_tmp;
+    size_t ref_tmp_size;
+    struct resampler_itfe *ref_resampler;
     int read_status;
     size_t mute_500ms;
     struct imx_audio_device *dev;
-    int last_time_of_xrun;
+    /* frames delivered, lost or dropped at standby, at requested rate */
+    int64_t frames_read;
+    /* last (frames, CLOCK_MONOTONIC time) pair of get_capture_position */
+    int64_t capture_frames;
+    int64_t capture_time_ns;
+    /* frames lost in xruns since last get_input_frames_lost */
+    uint32_t frames_lost;
+    bool xrun_pending;
+    struct stream_stats stats;
     bool aux_channels_changed;
     uint32_t main_channels;
     uint32_t aux_channels;
+    /* AAudio exclusive stream, DMA ring is shared with client */
+    bool mmap;
 };
 #define STRING_TO_ENUM(string) { #string, string }
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
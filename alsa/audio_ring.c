@@ -0,0 +1,138 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_ring.h"
+
+int audio_ring_init(struct audio_ring *ring, size_t min_bytes)
+{
+    uint32_t size = 1;
+
+    while (size < min_bytes)
+        size <<= 1;
+
+    ring->data = malloc(size);
+    if (ring->data == NULL) {
+        ring->size = 0;
+        return -ENOMEM;
+    }
+    ring->size = size;
+    audio_ring_reset(ring);
+    return 0;
+}
+
+void audio_ring_release(struct audio_ring *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+void audio_ring_reset(struct audio_ring *ring)
+{
+    atomic_store_explicit(&ring->write_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->read_pos, 0, memory_order_relaxed);
+}
+
+/* copy at pos, wrapping to start of ring */
+static void ring_copy_in(struct audio_ring *ring, uint32_t pos, const void *data, size_t bytes)
+{
+    uint32_t offset = pos & (ring->size - 1);
+    size_t first = ring->size - offset;
+
+    if (first > bytes)
+        first = bytes;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const uint8_t *)data + first, bytes - first);
+}
+
+static void ring_copy_out(struct audio_ring *ring, uint32_t pos, void *data, size_t bytes)
+{
+    uint32_t offset = pos & (ring->size - 1);
+    size_t first = ring->size - offset;
+
+    if (first > bytes)
+        first = bytes;
+    memcpy(data, ring->data + offset, first);
+    memcpy((uint8_t *)data + first, ring->data, bytes - first);
+}
+
+bool audio_ring_write(struct audio_ring *ring, const void *data, size_t bytes)
+{
+    return audio_ring_write_block(ring, NULL, 0, data, bytes);
+}
+
+bool audio_ring_write_block(struct audio_ring *ring, const void *head, size_t head_bytes,
+                            const void *data, size_t bytes)
+{
+    uint32_t wpos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    /* acquire: consumer is done with the bytes it released */
+    uint32_t rpos = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+
+    if (head_bytes + bytes > ring->size - (wpos - rpos))
+        return false;
+
+    ring_copy_in(ring, wpos, head, head_bytes);
+    ring_copy_in(ring, wpos + head_bytes, data, bytes);
+
+    /* release: data is visible before new position */
+    atomic_store_explicit(&ring->write_pos, wpos + head_bytes + bytes, memory_order_release);
+    return true;
+}
+
+size_t audio_ring_queued(struct audio_ring *ring)
+{
+    uint32_t rpos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    uint32_t wpos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+
+    return wpos - rpos;
+}
+
+size_t audio_ring_peek(struct audio_ring *ring, const void **data)
+{
+    uint32_t rpos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    uint32_t wpos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    uint32_t offset = rpos & (ring->size - 1);
+    size_t avail = wpos - rpos;
+
+    if (avail > ring->size - offset)
+        avail = ring->size - offset;
+    *data = ring->data + offset;
+    return avail;
+}
+
+void audio_ring_consume(struct audio_ring *ring, size_t bytes)
+{
+    uint32_t rpos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->read_pos, rpos + bytes, memory_order_release);
+}
+
+bool audio_ring_read(struct audio_ring *ring, void *data, size_t bytes)
+{
+    uint32_t rpos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    uint32_t wpos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+
+    if (wpos - rpos < bytes)
+        return false;
+
+    ring_copy_out(ring, rpos, data, bytes);
+    atomic_store_explicit(&ring->read_pos, rpos + bytes, memory_order_release);
+    return true;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_RING_H
+#define _AUDIO_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* single producer, single consumer byte ring, no lock on either side.
+ * size is a power of 2, positions run free and wrap as uint32_t.
+ */
+struct audio_ring {
+    uint8_t *data;
+    uint32_t size;
+    atomic_uint write_pos;      /* written by producer only */
+    atomic_uint read_pos;       /* written by consumer only */
+};
+
+/* allocate at least min_bytes, rounded up to power of 2 */
+int audio_ring_init(struct audio_ring *ring, size_t min_bytes);
+void audio_ring_release(struct audio_ring *ring);
+/* drop queued data, neither side may run */
+void audio_ring_reset(struct audio_ring *ring);
+
+/* producer: queue all bytes or nothing, returns false if ring is too full */
+bool audio_ring_write(struct audio_ring *ring, const void *data, size_t bytes);
+/* producer: queue head and data as one block, consumer sees both or none */
+bool audio_ring_write_block(struct audio_ring *ring, const void *head, size_t head_bytes,
+                            const void *data, size_t bytes);
+
+/* consumer: all queued bytes, producer may add more meanwhile */
+size_t audio_ring_queued(struct audio_ring *ring);
+/* consumer: contiguous queued bytes at *data, 0 if empty */
+size_t audio_ring_peek(struct audio_ring *ring, const void **data);
+void audio_ring_consume(struct audio_ring *ring, size_t bytes);
+/* consumer: copy out and consume bytes, false if fewer are queued */
+bool audio_ring_read(struct audio_ring *ring, void *data, size_t bytes);
+
+#endif
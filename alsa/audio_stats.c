@@ -0,0 +1,88 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "audio_stats.h"
+
+int64_t stats_transfer_begin(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void stats_transfer_end(struct stream_stats *stats, int64_t begin_ns)
+{
+    int64_t us = (stats_transfer_begin() - begin_ns) / 1000;
+
+    if (us < 0)
+        us = 0;
+    if (us > UINT32_MAX)
+        us = UINT32_MAX;
+
+    stats->durations_us[stats->duration_pos] = (uint32_t)us;
+    stats->duration_pos = (stats->duration_pos + 1) % STATS_DURATION_NUM;
+    stats->transfers++;
+    if ((uint32_t)us > stats->duration_max_us)
+        stats->duration_max_us = (uint32_t)us;
+}
+
+void stats_fail_streak(struct stream_stats *stats, int count)
+{
+    if (count <= 0)
+        return;
+
+    stats->fail_streaks++;
+    if ((uint32_t)count > stats->fail_streak_max)
+        stats->fail_streak_max = (uint32_t)count;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void stats_dump(const struct stream_stats *stats, int fd, const char *name)
+{
+    uint32_t sorted[STATS_DURATION_NUM];
+    size_t num = stats->transfers < STATS_DURATION_NUM ?
+                     (size_t)stats->transfers : STATS_DURATION_NUM;
+
+    dprintf(fd, "  %s:\n", name);
+    dprintf(fd, "    xruns %u, prepares %u, prepare errors %u, transfer errors %u\n",
+            stats->xruns, stats->prepares, stats->prepare_errors, stats->transfer_errors);
+    dprintf(fd, "    fail streaks %u, longest %u, standby by failure %u\n",
+            stats->fail_streaks, stats->fail_streak_max, stats->fail_standbys);
+    dprintf(fd, "    standbys %u, transfers %llu\n", stats->standbys,
+            (unsigned long long)stats->transfers);
+
+    if (num == 0)
+        return;
+
+    /* percentiles of last transfers, ring order doesn't matter */
+    memcpy(sorted, stats->durations_us, num * sizeof(sorted[0]));
+    qsort(sorted, num, sizeof(sorted[0]), compare_u32);
+    dprintf(fd, "    transfer us of last %zu: p50 %u, p90 %u, p99 %u, max %u (all time %u)\n",
+            num, sorted[num / 2], sorted[num * 9 / 10], sorted[num * 99 / 100],
+            sorted[num - 1], stats->duration_max_us);
+}
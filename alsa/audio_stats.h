@@ -0,0 +1,52 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AUDIO_STATS_H
+#define _AUDIO_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* recent pcm write/read durations kept for percentiles */
+#define STATS_DURATION_NUM 512
+
+/* per stream xrun and transfer telemetry, updated with stream mutex locked */
+struct stream_stats {
+    uint32_t xruns;                 /* xrun state seen by write/read wrapper */
+    uint32_t prepares;              /* pcm_prepare recoveries */
+    uint32_t prepare_errors;        /* pcm_prepare failed */
+    uint32_t transfer_errors;       /* write/read failed after recovery */
+    uint32_t fail_streaks;          /* runs of consecutive failed writes */
+    uint32_t fail_streak_max;       /* longest run of consecutive failed writes */
+    uint32_t fail_standbys;         /* standby forced by failed writes */
+    uint32_t standbys;              /* active to standby transitions */
+    uint64_t transfers;
+    uint32_t duration_max_us;
+    uint32_t durations_us[STATS_DURATION_NUM];
+    uint32_t duration_pos;
+};
+
+/* time of pcm transfer, stats_transfer_end() records it */
+int64_t stats_transfer_begin(void);
+void stats_transfer_end(struct stream_stats *stats, int64_t begin_ns);
+
+/* consecutive fail count of a pcm went back to 0 from count */
+void stats_fail_streak(struct stream_stats *stats, int count);
+
+/* print stats with header name to dumpsys fd */
+void stats_dump(const struct stream_stats *stats, int fd, const char *name);
+
+#endif
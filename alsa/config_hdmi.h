@@ -41,6 +41,8 @@ static struct audio_card  hdmi_card = {
     .out_rate            = 0,
     .out_channels        = 0,
     .out_format          = 0,
+    .hires_rate          = 0,
+    .hires_format        = 0,
     .in_rate             = 0,
     .in_channels         = 0,
     .in_format           = 0,
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iec61937.h"
+
+/* burst preamble, IEC 61937-1 */
+#define IEC61937_PA          0xF872
+#define IEC61937_PB          0x4E1F
+#define IEC61937_PREAMBLE_BYTES 8
+
+/* data type of Pc */
+#define IEC61937_TYPE_AC3    1
+#define IEC61937_TYPE_DTS1   11
+#define IEC61937_TYPE_DTS2   12
+#define IEC61937_TYPE_DTS3   13
+#define IEC61937_TYPE_EAC3   21
+
+#define AC3_SAMPLES          1536
+#define AC3_BLOCK_SAMPLES    256
+#define EAC3_BLOCKS          6
+#define HEADER_BYTES         8
+
+/* AC3 frame words by frmsizecod / 2, for fscod 48k, 44.1k and 32k */
+static const uint16_t ac3_frame_words[3][19] = {
+    { 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640,
+      768, 896, 1024, 1152, 1280 },
+    { 69, 87, 104, 121, 139, 174, 208, 243, 278, 348, 417, 487, 557, 696,
+      835, 975, 1114, 1253, 1393 },
+    { 96, 120, 144, 168, 192, 240, 288, 336, 384, 480, 576, 672, 768, 960,
+      1152, 1344, 1536, 1728, 1920 },
+};
+
+static const uint8_t eac3_blocks[4] = { 1, 2, 3, 6 };
+
+struct frame_info {
+    size_t bytes;
+    unsigned int samples;
+    /* E-AC3 dependent substream, no audio blocks of its own */
+    bool dependent;
+};
+
+unsigned int iec61937_rate_multiplier(enum iec61937_format format)
+{
+    return format == IEC61937_EAC3 ? 4 : 1;
+}
+
+/* size of frame starting at h, 0 if h is not a supported sync header */
+static size_t parse_ac3(const uint8_t *h, struct frame_info *info)
+{
+    unsigned int bsid, fscod, frmsizecod;
+
+    if (h[0] != 0x0B || h[1] != 0x77)
+        return 0;
+
+    bsid = h[5] >> 3;
+    if (bsid <= 10) {
+        fscod = h[4] >> 6;
+        frmsizecod = h[4] & 0x3F;
+        if (fscod == 3 || frmsizecod >= 38)
+            return 0;
+        info->bytes = ac3_frame_words[fscod][frmsizecod >> 1] * 2;
+        /* 44.1k frames with odd frmsizecod carry one more word */
+        if (fscod == 1 && (frmsizecod & 1))
+            info->bytes += 2;
+        info->samples = AC3_SAMPLES;
+        info->dependent = false;
+        return info->bytes;
+    }
+
+    if (bsid <= 16) {
+        unsigned int strmtyp = h[2] >> 6;
+        unsigned int frmsiz = ((h[2] & 0x07) << 8) | h[3];
+        unsigned int blocks = (h[4] >> 6) == 3 ? EAC3_BLOCKS : eac3_blocks[(h[4] >> 4) & 3];
+
+        if (strmtyp == 3)
+            return 0;
+        info->bytes = (frmsiz + 1) * 2;
+        info->samples = blocks * AC3_BLOCK_SAMPLES;
+        info->dependent = strmtyp == 1;
+        return info->bytes;
+    }
+
+    return 0;
+}
+
+/* 16 bit big endian DTS core only */
+static size_t parse_dts(const uint8_t *h, struct frame_info *info)
+{
+    unsigned int nblks, fsize;
+
+    if (h[0] != 0x7F || h[1] != 0xFE || h[2] != 0x80 || h[3] != 0x01)
+        return 0;
+
+    nblks = ((h[4] & 0x01) << 6) | (h[5] >> 2);
+    fsize = ((h[5] & 0x03) << 12) | (h[6] << 4) | (h[7] >> 4);
+    if (fsize < 95)
+        return 0;
+
+    info->bytes = fsize + 1;
+    info->samples = (nblks + 1) * 32;
+    info->dependent = false;
+    return info->bytes;
+}
+
+static size_t parse_header(struct iec61937_packer *packer, const uint8_t *h,
+                           struct frame_info *info)
+{
+    if (packer->format == IEC61937_DTS)
+        return parse_dts(h, info);
+    return parse_ac3(h, info);
+}
+
+/* repetition period in PCM frames of burst holding samples */
+static unsigned int burst_frames(struct iec61937_packer *packer, unsigned int samples)
+{
+    if (packer->format == IEC61937_EAC3)
+        return AC3_SAMPLES * 4;
+    return samples;
+}
+
+static int emit_burst(struct iec61937_packer *packer, iec61937_burst_fn emit, void *context)
+{
+    unsigned int frames = burst_frames(packer, packer->payload_samples);
+    size_t bytes = frames * 4;
+    size_t words = (packer->payload_len + 1) / 2;
+    uint16_t type;
+    uint16_t length;
+    size_t i;
+    int ret;
+
+    if (packer->payload_len == 0)
+        return 0;
+
+    switch (packer->format) {
+    case IEC61937_AC3:
+        type = IEC61937_TYPE_AC3;
+        length = packer->payload_len * 8;
+        break;
+    case IEC61937_EAC3:
+        type = IEC61937_TYPE_EAC3;
+        length = packer->payload_len;
+        break;
+    default:
+        type = packer->payload_samples == 512 ? IEC61937_TYPE_DTS1 :
+               packer->payload_samples == 1024 ? IEC61937_TYPE_DTS2 : IEC61937_TYPE_DTS3;
+        length = packer->payload_len * 8;
+        break;
+    }
+
+    if (bytes > IEC61937_MAX_BURST_BYTES ||
+            packer->payload_len + IEC61937_PREAMBLE_BYTES > bytes) {
+        packer->dropped++;
+        packer->payload_len = 0;
+        return 0;
+    }
+
+    packer->burst[0] = IEC61937_PA;
+    packer->burst[1] = IEC61937_PB;
+    packer->burst[2] = type;
+    packer->burst[3] = length;
+    /* bitstream is big endian 16 bit words, PCM samples are little endian */
+    if (packer->payload_len & 1)
+        packer->payload[packer->payload_len] = 0;
+    for (i = 0; i < words; i++)
+        packer->burst[4 + i] = (packer->payload[i * 2] << 8) | packer->payload[i * 2 + 1];
+    memset(packer->burst + 4 + words, 0, bytes - IEC61937_PREAMBLE_BYTES - words * 2);
+
+    packer->payload_len = 0;
+    packer->payload_blocks = 0;
+    packer->payload_samples = 0;
+
+    ret = emit(context, packer->burst, bytes);
+    return ret < 0 ? ret : 0;
+}
+
+static int add_frame(struct iec61937_packer *packer, const struct frame_info *info,
+                     iec61937_burst_fn emit, void *context)
+{
+    size_t room = IEC61937_MAX_BURST_BYTES - IEC61937_PREAMBLE_BYTES;
+    int ret;
+
+    if (packer->format != IEC61937_EAC3) {
+        memcpy(packer->payload, packer->frame, info->bytes);
+        packer->payload_len = info->bytes;
+        packer->payload_samples = info->samples;
+        return emit_burst(packer, emit, context);
+    }
+
+    /* independent frame after 6 blocks starts next burst */
+    if (!info->dependent && packer->payload_blocks >= EAC3_BLOCKS) {
+        ret = emit_burst(packer, emit, context);
+        if (ret)
+            return ret;
+    }
+    if (packer->payload_len + info->bytes > room) {
+        packer->dropped++;
+        return 0;
+    }
+
+    memcpy(packer->payload + packer->payload_len, packer->frame, info->bytes);
+    packer->payload_len += info->bytes;
+    if (!info->dependent) {
+        packer->payload_blocks += info->samples / AC3_BLOCK_SAMPLES;
+        packer->payload_samples += info->samples;
+    }
+    return 0;
+}
+
+int iec61937_init(struct iec61937_packer *packer, enum iec61937_format format)
+{
+    memset(packer, 0, sizeof(*packer));
+    if (format != IEC61937_AC3 && format != IEC61937_EAC3 && format != IEC61937_DTS)
+        return -EINVAL;
+
+    packer->format = format;
+    packer->frame = (uint8_t *)malloc(IEC61937_MAX_FRAME_BYTES);
+    packer->payload = (uint8_t *)malloc(IEC61937_MAX_BURST_BYTES);
+    packer->burst = (uint16_t *)malloc(IEC61937_MAX_BURST_BYTES);
+    if (!packer->frame || !packer->payload || !packer->burst) {
+        iec61937_release(packer);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void iec61937_release(struct iec61937_packer *packer)
+{
+    free(packer->frame);
+    free(packer->payload);
+    free(packer->burst);
+    packer->frame = NULL;
+    packer->payload = NULL;
+    packer->burst = NULL;
+}
+
+void iec61937_reset(struct iec61937_packer *packer)
+{
+    packer->frame_len = 0;
+    packer->frame_size = 0;
+    packer->payload_len = 0;
+    packer->payload_blocks = 0;
+    packer->payload_samples = 0;
+}
+
+int iec61937_write(struct iec61937_packer *packer, const void *data, size_t bytes,
+                   iec61937_burst_fn emit, void *context)
+{
+    const uint8_t *src = (const uint8_t *)data;
+    struct frame_info info = { 0, 0, false };
+    size_t n;
+    int ret;
+
+    while (bytes > 0) {
+        if (packer->frame_size == 0) {
+            n = HEADER_BYTES - packer->frame_len;
+            if (n > bytes)
+                n = bytes;
+            memcpy(packer->frame + packer->frame_len, src, n);
+            packer->frame_len += n;
+            src += n;
+            bytes -= n;
+            if (packer->frame_len < HEADER_BYTES)
+                break;
+
+            /* resync byte by byte until a valid header */
+            if (parse_header(packer, packer->frame, &info) == 0 ||
+                    info.bytes > IEC61937_MAX_FRAME_BYTES) {
+                memmove(packer->frame, packer->frame + 1, HEADER_BYTES - 1);
+                packer->frame_len--;
+                continue;
+            }
+            packer->frame_size = info.bytes;
+        }
+
+        n = packer->frame_size - packer->frame_len;
+        if (n > bytes)
+            n = bytes;
+        memcpy(packer->frame + packer->frame_len, src, n);
+        packer->frame_len += n;
+        src += n;
+        bytes -= n;
+
+        if (packer->frame_len == packer->frame_size) {
+            parse_header(packer, packer->frame, &info);
+            packer->frame_len = 0;
+            packer->frame_size = 0;
+            ret = add_frame(packer, &info, emit, context);
+            if (ret)
+                return ret;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _IEC61937_H
+#define _IEC61937_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* bitstreams carried in IEC61937 bursts over 2ch 16 bit PCM */
+enum iec61937_format {
+    IEC61937_NONE = 0,
+    IEC61937_AC3,
+    IEC61937_EAC3,
+    IEC61937_DTS,
+};
+
+/* largest compressed frame accepted, DTS core */
+#define IEC61937_MAX_FRAME_BYTES   16384
+/* E-AC3 repetition period is 6144 PCM frames of 4 bytes */
+#define IEC61937_MAX_BURST_BYTES   (6144 * 4)
+
+/* called for each burst, bytes is a whole number of 2ch 16 bit frames */
+typedef int (*iec61937_burst_fn)(void *context, const void *burst, size_t bytes);
+
+struct iec61937_packer {
+    enum iec61937_format format;
+    /* frame being collected from client writes */
+    uint8_t *frame;
+    size_t frame_len;
+    size_t frame_size;
+    /* payload of next burst, E-AC3 packs frames of 1536 samples */
+    uint8_t *payload;
+    size_t payload_len;
+    unsigned int payload_blocks;
+    unsigned int payload_samples;
+    uint16_t *burst;
+    /* frames dropped as unsupported or too big for their burst */
+    uint32_t dropped;
+};
+
+/* PCM rate of bursts is content rate times this */
+unsigned int iec61937_rate_multiplier(enum iec61937_format format);
+
+int iec61937_init(struct iec61937_packer *packer, enum iec61937_format format);
+void iec61937_release(struct iec61937_packer *packer);
+/* drop partial frame and payload, e.g. at standby or flush */
+void iec61937_reset(struct iec61937_packer *packer);
+
+/* consume bitstream bytes, emit is called for complete bursts.
+ * returns error of emit or 0.
+ */
+int iec61937_write(struct iec61937_packer *packer, const void *data, size_t bytes,
+                   iec61937_burst_fn emit, void *context);
+
+#endif
@@ -17,25 +17,28 @@
 /* Copyright 2017 NXP */
 
 #define LOG_TAG "audio_hw_primary"
+#define ATRACE_TAG ATRACE_TAG_AUDIO
 //#define LOG_NDEBUG 0
 
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
 #include <cutils/properties.h>
+#include <cutils/trace.h>
 
 #include <hardware/hardware.h>
 #include <system/audio.h>
 #include <hardware/audio.h>
 
 #include <tinyalsa/asoundlib.h>
+#include <sound/asound.h>
 #include <audio_utils/resampler.h>
-#include <audio_utils/echo_reference.h>
 #include <hardware/audio_effect.h>
 #include <audio_effects/effect_aec.h>
 
@@ -53,12 +56,18 @@
 #include "config_cdnhdmi.h"
 #include "control.h"
 #include "pcm_ext.h"
+#include "audio_convert.h"
+#include "audio_stats.h"
+#include "iec61937.h"
+#include <hal_config_ext.h>
 
 /* ALSA ports for IMX */
 #define PORT_MM     0
 #define PORT_MM2_UL 0
 #define PORT_SPDIF  6 /*not used*/
 #define PORT_HDMI   0
+/* playback PCMs of speaker card probed for deep buffer output */
+#define PORT_DEEP_MAX   8
 
 /*align the definition in kernel for hdmi audio*/
 #define HDMI_PERIOD_SIZE       192
@@ -67,6 +76,40 @@
 #define ESAI_PERIOD_SIZE       192
 #define PLAYBACK_ESAI_PERIOD_COUNT      8
 
+/* number of frames per period of fast output (AUDIO_OUTPUT_FLAG_FAST) */
+#define FAST_PERIOD_SIZE        96
+/* number of periods of fast output, about 8ms of buffering */
+#define PLAYBACK_FAST_PERIOD_COUNT  4
+
+/* deep buffer output of rpmsg cards (AUDIO_OUTPUT_FLAG_DEEP_BUFFER), M4 core
+ * plays from a ring of about 3s and A core wakes once per write.
+ */
+#define DEEP_BUFFER_PERIOD_SIZE     8192
+#define PLAYBACK_DEEP_BUFFER_PERIOD_COUNT   16
+/* periods per write and per wakeup of writer */
+#define DEEP_BUFFER_WRITE_PERIODS   2
+/* deep buffer output of other cards, A core plays from 4 periods of 100ms
+ * in DMA ring of card, shrunk at open if the ring can't take them.
+ */
+#define DEEP_BUFFER_LOCAL_PERIOD_SIZE   4800
+#define PLAYBACK_DEEP_BUFFER_LOCAL_PERIOD_COUNT 4
+/* shorter periods save too few wakeups over low latency output */
+#define DEEP_BUFFER_MIN_PERIOD_MS   80
+
+/* hi-res direct output (AUDIO_OUTPUT_FLAG_DIRECT, 24/32 bit PCM), runs at
+ * highest rate and widest format of card, about 40ms at 96kHz.
+ */
+#define HIRES_PERIOD_SIZE       1024
+#define PLAYBACK_HIRES_PERIOD_COUNT 4
+/* rate asked at scan, card answers its nearest supported one */
+#define HIRES_PROBE_RATE        192000
+
+/* number of frames per period of AAudio mmap streams, 1ms at 48kHz */
+#define MMAP_PERIOD_SIZE        48
+/* periods of mmap ring, client keeps its own latency inside it */
+#define MMAP_PERIOD_COUNT_MIN   32
+#define MMAP_PERIOD_COUNT_MAX   512
+
 /* number of frames per short period (low latency) */
 /* align other card with hdmi, same latency*/
 #define SHORT_PERIOD_SIZE       384
@@ -97,6 +140,34 @@
 #define PRODUCT_NAME_PROPERTY   "ro.product.name"
 #define PRODUCT_DEVICE_IMX      "imx"
 #define PRODUCT_DEVICE_AUTO     "sabreauto"
+/* speex quality of output and input resamplers, 0 (lowest latency) to 10 */
+#define RESAMPLER_QUALITY_PROPERTY "ro.audio.resampler.quality"
+/* ms primary output PCMs stay opened and stopped after standby, 0 closes at once */
+#define STANDBY_DELAY_PROPERTY  "ro.audio.standby_delay_ms"
+#define STANDBY_DELAY_DEFAULT_MS    3000
+/* 1 runs deep buffer output on a second playback PCM of the speaker card,
+ * so low latency output keeps playing next to it. cards with one playback
+ * PCM don't run it. rpmsg cards play it from their own ring on M4 core,
+ * other cards are sized by probe.
+ */
+#define DEEP_BUFFER_PROPERTY    "ro.audio.deep_buffer"
+/* product config of periods, "<key>_size" in frames and "<key>_count",
+ * unset keeps the defaults above and the ones cards set at scan.
+ */
+#define PRIMARY_PERIOD_CONFIG   "ro.audio.primary.period"
+#define FAST_PERIOD_CONFIG      "ro.audio.fast.period"
+#define DEEP_BUFFER_PERIOD_CONFIG   "ro.audio.deep_buffer.period"
+#define CAPTURE_PERIOD_CONFIG   "ro.audio.capture.period"
+/* playback queued for AEC while input catches up, drops beyond it */
+#define ECHO_RING_MS            250
+/* fill of fanout PCMs is measured this often, first measures set its target */
+#define FANOUT_DRIFT_INTERVAL_MS    500
+#define FANOUT_DRIFT_SETTLE         4
+/* fill error is corrected over this many seconds, up to max ppm of rate */
+#define FANOUT_DRIFT_CORRECT_S      10
+#define FANOUT_DRIFT_MAX_PPM        1000
+/* SPDIF receiver rate is read again at least this often */
+#define SPDIF_EVENT_TIMEOUT_MS  500
 #define SUPPORT_CARD_NUM        11
 
 /*"null_card" must be in the end of this array*/
@@ -125,6 +196,53 @@ struct pcm_config pcm_config_mm_out = {
     .avail_min = 0,
 };
 
+/* writer sleeps until a whole write fits, started after first period */
+struct pcm_config pcm_config_deep_out = {
+    .channels = 2,
+    .rate = MM_FULL_POWER_SAMPLING_RATE,
+    .period_size = DEEP_BUFFER_PERIOD_SIZE,
+    .period_count = PLAYBACK_DEEP_BUFFER_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = DEEP_BUFFER_PERIOD_SIZE,
+    .avail_min = DEEP_BUFFER_PERIOD_SIZE * DEEP_BUFFER_WRITE_PERIODS,
+};
+
+/* rate and format are taken from card when the stream is opened */
+struct pcm_config pcm_config_hires_out = {
+    .channels = 2,
+    .rate = MM_FULL_POWER_SAMPLING_RATE,
+    .period_size = HIRES_PERIOD_SIZE,
+    .period_count = PLAYBACK_HIRES_PERIOD_COUNT,
+    .format = PCM_FORMAT_S24_LE,
+    .start_threshold = 0,
+    .avail_min = 0,
+};
+
+/* mmap ring of fast output, started as soon as one period is written */
+struct pcm_config pcm_config_fast_out = {
+    .channels = 2,
+    .rate = MM_FULL_POWER_SAMPLING_RATE,
+    .period_size = FAST_PERIOD_SIZE,
+    .period_count = PLAYBACK_FAST_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = FAST_PERIOD_SIZE,
+    .avail_min = FAST_PERIOD_SIZE,
+};
+
+/* DMA ring shared with AAudio client, started and stopped explicitly
+ * and never stopped by xrun: client reads and writes it directly.
+ */
+struct pcm_config pcm_config_mmap = {
+    .channels = 2,
+    .rate = MM_FULL_POWER_SAMPLING_RATE,
+    .period_size = MMAP_PERIOD_SIZE,
+    .period_count = MMAP_PERIOD_COUNT_MIN,
+    .format = PCM_FORMAT_S16_LE,
+    .start_threshold = MMAP_PERIOD_SIZE * 8,
+    .stop_threshold = INT32_MAX,
+    .avail_min = MMAP_PERIOD_SIZE,
+};
+
 struct pcm_config pcm_config_hdmi_multi = {
     .channels = 8, /* changed when the stream is opened */
     .rate = MM_FULL_POWER_SAMPLING_RATE, /* changed when the stream is opened */
@@ -160,6 +278,14 @@ const struct string_to_enum out_channels_name_to_enum_table[] = {
     STRING_TO_ENUM(AUDIO_CHANNEL_OUT_7POINT1),
 };
 
+/* formats of HDMI direct output, bitstreams are sent as IEC61937 */
+const struct string_to_enum out_formats_name_to_enum_table[] = {
+    STRING_TO_ENUM(AUDIO_FORMAT_PCM_16_BIT),
+    STRING_TO_ENUM(AUDIO_FORMAT_AC3),
+    STRING_TO_ENUM(AUDIO_FORMAT_E_AC3),
+    STRING_TO_ENUM(AUDIO_FORMAT_DTS),
+};
+
 
 /**
  * NOTE: when multiple mutexes have to be acquired, always respect the following order:
@@ -170,6 +296,9 @@ static void select_input_device(struct imx_audio_device *adev);
 static int adev_set_voice_volume(struct audio_hw_device *dev, float volume);
 static int do_input_standby(struct imx_stream_in *in);
 static int do_output_standby(struct imx_stream_out *out, int force_standby);
+static bool output_holds_pcm(struct imx_stream_out *out);
+static void publish_position(struct imx_stream_out *out, bool valid, uint64_t frames,
+                             const struct timespec *tstamp);
 static int scan_available_device(struct imx_audio_device *adev, bool queryInput, bool queryOutput);
 static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
                                    struct resampler_buffer* buffer);
@@ -179,102 +308,79 @@ static int adev_get_rate_for_device(struct imx_audio_device *adev, uint32_t devi
 static int adev_get_channels_for_device(struct imx_audio_device *adev, uint32_t devices, unsigned int flag);
 static int adev_get_format_for_device(struct imx_audio_device *adev, uint32_t devices, unsigned int flag);
 static void in_update_aux_channels(struct imx_stream_in *in, effect_handle_t effect);
-static int pcm_read_wrapper(struct pcm *pcm, const void * buffer, size_t bytes);
+static int pcm_read_wrapper(struct stream_stats *stats, struct pcm *pcm,
+                            const void * buffer, size_t bytes, int flags);
+static int pcm_write_wrapper(struct stream_stats *stats, struct pcm *pcm,
+                             const void * buffer, size_t bytes, int flags);
 
 extern int pcm_state(struct pcm *pcm);
 
-static int convert_record_data(void *src, void *dst, unsigned int frames, bool bit_24b_2_16b, bool mono2stereo, bool stereo2mono)
+/* resolve controls of route array in mixer, once per card */
+static void resolve_route(struct mixer *mixer, struct route_setting *route)
 {
-     unsigned int i;
-     short *dst_t = (short *)dst;
-     if (bit_24b_2_16b && mono2stereo && !stereo2mono) {
-        int data;
-        int *src_t = (int *)src;
-        for(i = 0; i < frames; i++)
-        {
-            data   = *src_t++;
-            *dst_t++ = (short)(data >> 8);
-            *dst_t++ = (short)(data >> 8);
-        }
-     }
-
-     if (bit_24b_2_16b && !mono2stereo && stereo2mono) {
-        int data1=0, data2=0;
-        int *src_t = (int *)src;
-        for(i = 0; i < frames; i++)
-        {
-            data1   = *src_t++;
-            data2   = *src_t++;
-            *dst_t++ = (short)(((data1 << 8) >> 17) + ((data2 << 8) >> 17));
-        }
-     }
+    unsigned int i;
 
-     if (bit_24b_2_16b && !mono2stereo && !stereo2mono) {
-        int data1, data2;
-        int *src_t = (int *)src;
-        for(i = 0; i < frames; i++)
-        {
-            data1   = *src_t++;
-            data2   = *src_t++;
-            *dst_t++ = (short)(data1 >> 8);
-            *dst_t++ = (short)(data2 >> 8);
-        }
-     }
-
-     if (!bit_24b_2_16b && mono2stereo && !stereo2mono ) {
-        short data;
-        short *src_t = (short *)src;
-        for(i = 0; i < frames; i++)
-        {
-            data   = *src_t++;
-            *dst_t++ = data;
-            *dst_t++ = data;
-        }
-     }
+    if (!mixer || !route)
+        return;
 
-     if (!bit_24b_2_16b && !mono2stereo && stereo2mono) {
-        short data1, data2;
-        short *src_t = (short *)src;
-        for(i = 0; i < frames; i++)
-        {
-            data1   = *src_t++;
-            data2   = *src_t++;
-            *dst_t++ = (data1 >> 1) + (data2 >> 1);
-        }
-     }
+    for (i = 0; route[i].ctl_name; i++) {
+        route[i].mixer = mixer;
+        route[i].ctl = mixer_get_ctl_by_name(mixer, route[i].ctl_name);
+        if (!route[i].ctl)
+            ALOGW("mixer control %s not found", route[i].ctl_name);
+    }
+}
 
-     return 0;
+static void resolve_card_routes(struct mixer *mixer, struct audio_card *card)
+{
+    resolve_route(mixer, card->defaults);
+    resolve_route(mixer, card->bt_output);
+    resolve_route(mixer, card->speaker_output);
+    resolve_route(mixer, card->hs_output);
+    resolve_route(mixer, card->earpiece_output);
+    resolve_route(mixer, card->vx_hs_mic_input);
+    resolve_route(mixer, card->mm_main_mic_input);
+    resolve_route(mixer, card->vx_main_mic_input);
+    resolve_route(mixer, card->mm_hs_mic_input);
+    resolve_route(mixer, card->vx_bt_mic_input);
+    resolve_route(mixer, card->mm_bt_mic_input);
 }
 
 /* The enable flag when 0 makes the assumption that enums are disabled by
- * "Off" and integers/booleans by 0 */
+ * "Off" and integers/booleans by 0. Controls already at their value are
+ * not written, writes may power codec widgets up and down. */
 static int set_route_by_array(struct mixer *mixer, struct route_setting *route,
                               int enable)
 {
     struct mixer_ctl *ctl = NULL;
     unsigned int i, j;
+    const char *strval;
+    int intval;
 
     if(!mixer) return 0;
     if(!route) return 0;
     /* Go through the route array and set each value */
     i = 0;
     while (route[i].ctl_name) {
-        ctl = mixer_get_ctl_by_name(mixer, route[i].ctl_name);
+        if (route[i].mixer != mixer)
+            resolve_route(mixer, route);
+        ctl = route[i].ctl;
         if (!ctl)
             return -EINVAL;
 
         if (route[i].strval) {
-            if (enable)
-                mixer_ctl_set_enum_by_string(ctl, route[i].strval);
-            else
-                mixer_ctl_set_enum_by_string(ctl, "Off");
+            const char *cur;
+
+            strval = enable ? route[i].strval : "Off";
+            cur = mixer_ctl_get_enum_string(ctl, mixer_ctl_get_value(ctl, 0));
+            if (!cur || strcmp(cur, strval))
+                mixer_ctl_set_enum_by_string(ctl, strval);
         } else {
+            intval = enable ? route[i].intval : 0;
             /* This ensures multiple (i.e. stereo) values are set jointly */
             for (j = 0; j < mixer_ctl_get_num_values(ctl); j++) {
-                if (enable)
-                    mixer_ctl_set_value(ctl, j, route[i].intval);
-                else
-                    mixer_ctl_set_value(ctl, j, 0);
+                if (mixer_ctl_get_value(ctl, j) != intval)
+                    mixer_ctl_set_value(ctl, j, intval);
             }
         }
         i++;
@@ -283,8 +389,6 @@ static int set_route_by_array(struct mixer *mixer, struct route_setting *route,
     return 0;
 }
 
-
-
 static void force_all_standby(struct imx_audio_device *adev)
 {
     struct imx_stream_in *in;
@@ -299,11 +403,14 @@ static void force_all_standby(struct imx_audio_device *adev)
             pthread_mutex_unlock(&out->lock);
         }
 
-    if (adev->active_input) {
+    /* standby moves routing to remaining client, mmap stream is the last */
+    while (adev->active_input) {
         in = adev->active_input;
         pthread_mutex_lock(&in->lock);
         do_input_standby(in);
         pthread_mutex_unlock(&in->lock);
+        if (adev->active_input == in)
+            break;
     }
 }
 
@@ -509,6 +616,227 @@ static int get_card_for_device(struct imx_audio_device *adev, int device, unsign
         *card_index = i;
     return card;
 }
+/* linear interpolation of stereo 16 bit frames to 1 + drift_ppm / 1000000
+ * output frames per input frame, returns output frames.
+ */
+static size_t fanout_adjust_rate(struct pcm_fanout *fanout, const int16_t *in,
+                                 size_t frames, int16_t *out)
+{
+    uint64_t step = (1ULL << 32) * 1000000 / (uint64_t)(1000000 + fanout->drift_ppm);
+    uint64_t phase = fanout->adjust_phase;
+    int16_t *dst = out;
+    int32_t last, next;
+    size_t i;
+    int c;
+
+    for (i = 0; i < frames; i++) {
+        while (phase < (1ULL << 32)) {
+            for (c = 0; c < 2; c++) {
+                last = fanout->adjust_last[c];
+                next = in[i * 2 + c];
+                *dst++ = last + (int32_t)(((int64_t)(next - last) * (int64_t)phase) >> 32);
+            }
+            phase += step;
+        }
+        phase -= 1ULL << 32;
+        fanout->adjust_last[0] = in[i * 2];
+        fanout->adjust_last[1] = in[i * 2 + 1];
+    }
+    fanout->adjust_phase = phase;
+
+    return (dst - out) / 2;
+}
+
+/* measures frames not yet played by sink, in ring and kernel buffer, and sets
+ * rate correction pulling their average back to fill at start.
+ */
+static void fanout_track_drift(struct pcm_fanout *fanout, size_t frames)
+{
+    struct timespec tstamp;
+    unsigned int avail;
+    int64_t fill, error;
+    int ppm;
+
+    fanout->drift_frames += frames;
+    if (fanout->drift_frames < fanout->rate * FANOUT_DRIFT_INTERVAL_MS / 1000)
+        return;
+    fanout->drift_frames = 0;
+    if (pcm_get_htimestamp(fanout->pcm, &avail, &tstamp) != 0)
+        return;
+
+    fill = ((int64_t)pcm_get_buffer_size(fanout->pcm) - avail +
+            audio_ring_queued(&fanout->ring) / 4) << 8;
+    if (fanout->drift_measures == 0)
+        fanout->fill_avg = fill;
+    else
+        fanout->fill_avg += (fill - fanout->fill_avg) / 8;
+    if (fanout->drift_measures < FANOUT_DRIFT_SETTLE) {
+        if (++fanout->drift_measures == FANOUT_DRIFT_SETTLE)
+            fanout->fill_target = fanout->fill_avg;
+        return;
+    }
+
+    /* fill growing above target means sink is slower, drop frames */
+    error = (fanout->fill_avg - fanout->fill_target) >> 8;
+    ppm = (int)(-error * 1000000 / ((int64_t)fanout->rate * FANOUT_DRIFT_CORRECT_S));
+    if (ppm > FANOUT_DRIFT_MAX_PPM)
+        ppm = FANOUT_DRIFT_MAX_PPM;
+    else if (ppm < -FANOUT_DRIFT_MAX_PPM)
+        ppm = -FANOUT_DRIFT_MAX_PPM;
+    if (ppm != fanout->drift_ppm)
+        ALOGV("fanout drift %d ppm, fill error %lld frames", ppm, (long long)error);
+    fanout->drift_ppm = ppm;
+}
+
+/* drains ring of one fanout PCM, keeps stream write off a stalled sink */
+static void *fanout_thread_loop(void *context)
+{
+    struct pcm_fanout *fanout = (struct pcm_fanout *)context;
+    const void *data;
+    size_t bytes, frames;
+    int ret;
+
+    pthread_mutex_lock(&fanout->lock);
+    while (!fanout->exit) {
+        bytes = audio_ring_peek(&fanout->ring, &data);
+        if (bytes == 0) {
+            pthread_cond_wait(&fanout->cond, &fanout->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&fanout->lock);
+
+        if (bytes > fanout->chunk_bytes)
+            bytes = fanout->chunk_bytes;
+        frames = fanout_adjust_rate(fanout, (const int16_t *)data, bytes / 4,
+                                    fanout->adjust_buffer);
+        audio_ring_consume(&fanout->ring, bytes);
+        ret = pcm_write_wrapper(&fanout->stats, fanout->pcm, fanout->adjust_buffer,
+                                frames * 4, fanout->write_flags);
+        if (ret) {
+            /* data is dropped, don't spin on a dead pcm */
+            fanout->fail_count++;
+            usleep(bytes * 1000000 / 4 / fanout->rate);
+        } else {
+            stats_fail_streak(&fanout->stats, fanout->fail_count);
+            fanout->fail_count = 0;
+            fanout_track_drift(fanout, frames);
+        }
+
+        pthread_mutex_lock(&fanout->lock);
+    }
+    pthread_mutex_unlock(&fanout->lock);
+
+    return NULL;
+}
+
+/* queue write for fanout PCM, dropped if its thread is behind */
+static void fanout_write(struct pcm_fanout *fanout, const void *buffer, size_t bytes)
+{
+    if (!audio_ring_write(&fanout->ring, buffer, bytes))
+        fanout->overruns++;
+
+    pthread_mutex_lock(&fanout->lock);
+    pthread_cond_signal(&fanout->cond);
+    pthread_mutex_unlock(&fanout->lock);
+}
+
+/* must be called with output stream mutex locked, after PCMs are opened.
+ * first opened PCM is written by stream write, others get a thread when
+ * more than one is opened. thread inherits scheduling of audio thread.
+ */
+static void start_output_fanout(struct imx_stream_out *out)
+{
+    struct pcm_fanout *fanout;
+    bool first = true;
+    int i;
+
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (!out->pcm[i])
+            continue;
+        if (first) {
+            first = false;
+            continue;
+        }
+
+        fanout = &out->fanout[i];
+        if (fanout->ring.data == NULL) {
+            /* a whole kernel buffer of slack before the sink drops data */
+            if (audio_ring_init(&fanout->ring, out->config[i].period_size *
+                                out->config[i].period_count * 4) != 0) {
+                ALOGE("no memory for fanout ring of pcm %d", i);
+                continue;
+            }
+            pthread_mutex_init(&fanout->lock, NULL);
+            pthread_cond_init(&fanout->cond, NULL);
+        }
+        /* chunk grows by at most one frame in 1000 after rate correction */
+        free(fanout->adjust_buffer);
+        fanout->adjust_buffer = malloc(out->config[i].period_size * 4 * 2);
+        if (fanout->adjust_buffer == NULL) {
+            ALOGE("no memory for fanout buffer of pcm %d", i);
+            continue;
+        }
+
+        audio_ring_reset(&fanout->ring);
+        fanout->pcm = out->pcm[i];
+        fanout->write_flags = out->write_flags[i];
+        fanout->chunk_bytes = out->config[i].period_size * 4;
+        fanout->rate = out->config[i].rate;
+        fanout->fail_count = 0;
+        fanout->adjust_last[0] = 0;
+        fanout->adjust_last[1] = 0;
+        fanout->adjust_phase = 0;
+        fanout->drift_ppm = 0;
+        fanout->drift_frames = 0;
+        fanout->drift_measures = 0;
+        fanout->exit = false;
+        if (pthread_create(&fanout->thread, NULL, fanout_thread_loop, fanout) != 0) {
+            ALOGE("cannot create fanout thread of pcm %d", i);
+            continue;
+        }
+        fanout->started = true;
+    }
+}
+
+/* must be called with output stream mutex locked, before PCMs are stopped */
+static void stop_output_fanout(struct imx_stream_out *out)
+{
+    struct pcm_fanout *fanout;
+    int i;
+
+    for (i = 0; i < PCM_TOTAL; i++) {
+        fanout = &out->fanout[i];
+        if (!fanout->started)
+            continue;
+
+        pthread_mutex_lock(&fanout->lock);
+        fanout->exit = true;
+        pthread_cond_signal(&fanout->cond);
+        pthread_mutex_unlock(&fanout->lock);
+        pthread_join(fanout->thread, NULL);
+
+        stats_fail_streak(&fanout->stats, fanout->fail_count);
+        fanout->fail_count = 0;
+        fanout->started = false;
+        fanout->pcm = NULL;
+    }
+}
+
+static void release_output_fanout(struct imx_stream_out *out)
+{
+    int i;
+
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (out->fanout[i].ring.data == NULL)
+            continue;
+        audio_ring_release(&out->fanout[i].ring);
+        free(out->fanout[i].adjust_buffer);
+        out->fanout[i].adjust_buffer = NULL;
+        pthread_mutex_destroy(&out->fanout[i].lock);
+        pthread_cond_destroy(&out->fanout[i].cond);
+    }
+}
+
 /* must be called with hw device and output stream mutexes locked */
 static int start_output_stream_primary(struct imx_stream_out *out)
 {
@@ -519,6 +847,22 @@ static int start_output_stream_primary(struct imx_stream_out *out)
     int pcm_device;
     bool success = false;
 
+    /* PCMs kept from a short standby, routing hasn't changed since */
+    if (out->idle) {
+        ALOGV("start_output_stream_primary... %d resume idle", (uintptr_t)out);
+        for (i = 0; i < PCM_TOTAL; i++) {
+            if (out->pcm[i])
+                pcm_prepare(out->pcm[i]);
+            if (out->resampled[i])
+                out->resampler[i]->reset(out->resampler[i]);
+        }
+        if (adev->echo_reference != NULL)
+            out->echo_reference = adev->echo_reference;
+        out->idle = false;
+        start_output_fanout(out);
+        return 0;
+    }
+
     ALOGI("start_output_stream_primary... %d, device %d",(uintptr_t)out, out->device);
 
     if (adev->mode != AUDIO_MODE_IN_CALL) {
@@ -527,14 +871,39 @@ static int start_output_stream_primary(struct imx_stream_out *out)
     }
 
     pcm_device = out->device & (AUDIO_DEVICE_OUT_ALL & ~AUDIO_DEVICE_OUT_AUX_DIGITAL);
-    if (pcm_device && (adev->active_output[OUTPUT_ESAI] == NULL || adev->active_output[OUTPUT_ESAI]->standby)) {
-        out->write_flags[PCM_NORMAL]            = PCM_OUT | PCM_MMAP | PCM_MONOTONIC;
-        out->write_threshold[PCM_NORMAL]        = PLAYBACK_LONG_PERIOD_COUNT * LONG_PERIOD_SIZE;
-        out->config[PCM_NORMAL] = pcm_config_mm_out;
+    if (pcm_device && (adev->active_output[OUTPUT_ESAI] == NULL || adev->active_output[OUTPUT_ESAI]->standby) &&
+            (adev->active_output[OUTPUT_HIRES] == NULL ||
+             adev->active_output[OUTPUT_HIRES]->standby)) {
+        if (out->deep) {
+            out->write_flags[PCM_NORMAL]        = PCM_OUT | PCM_MONOTONIC;
+            out->write_threshold[PCM_NORMAL]    = pcm_config_deep_out.period_count *
+                                                  pcm_config_deep_out.period_size;
+            out->config[PCM_NORMAL] = pcm_config_deep_out;
+        } else if (out->fast) {
+            /* no period interrupts, tinyalsa wakes the writer by timer */
+            out->write_flags[PCM_NORMAL]        = PCM_OUT | PCM_MMAP | PCM_NOIRQ | PCM_MONOTONIC;
+            out->write_threshold[PCM_NORMAL]    = pcm_config_fast_out.period_count *
+                                                  pcm_config_fast_out.period_size;
+            out->config[PCM_NORMAL] = pcm_config_fast_out;
+        } else {
+            out->write_flags[PCM_NORMAL]        = PCM_OUT | PCM_MMAP | PCM_MONOTONIC;
+            out->write_threshold[PCM_NORMAL]    = pcm_config_mm_out.period_count *
+                                                  pcm_config_mm_out.period_size;
+            out->config[PCM_NORMAL] = pcm_config_mm_out;
+        }
 
 
         card = get_card_for_device(adev, pcm_device, PCM_OUT, &out->card_index);
+        /* deep buffer output has its own PCM, low latency output plays next to it */
+        port = out->deep ? adev->deep_port : PORT_MM;
         out->pcm[PCM_NORMAL] = pcm_open(card, port,out->write_flags[PCM_NORMAL], &out->config[PCM_NORMAL]);
+        if (out->fast && !pcm_is_ready(out->pcm[PCM_NORMAL])) {
+            /* driver can't run without period wakeup, keep small periods */
+            ALOGW("fast output no-irq mode refused: %s", pcm_get_error(out->pcm[PCM_NORMAL]));
+            pcm_close(out->pcm[PCM_NORMAL]);
+            out->write_flags[PCM_NORMAL] &= ~PCM_NOIRQ;
+            out->pcm[PCM_NORMAL] = pcm_open(card, port,out->write_flags[PCM_NORMAL], &out->config[PCM_NORMAL]);
+        }
         ALOGW("card %d, port %d device 0x%x", card, port, out->device);
         ALOGW("rate %d, channel %d period_size 0x%x", out->config[PCM_NORMAL].rate, out->config[PCM_NORMAL].channels, out->config[PCM_NORMAL].period_size);
         success = true;
@@ -546,6 +915,7 @@ static int start_output_stream_primary(struct imx_stream_out *out)
         out->write_threshold[PCM_HDMI]        = HDMI_PERIOD_SIZE * PLAYBACK_HDMI_PERIOD_COUNT;
         out->config[PCM_HDMI] = pcm_config_mm_out;
         card = get_card_for_device(adev, pcm_device, PCM_OUT, &out->card_index);
+        port = PORT_HDMI;
         out->pcm[PCM_HDMI] = pcm_open(card, port,out->write_flags[PCM_HDMI], &out->config[PCM_HDMI]);
         ALOGW("card %d, port %d device 0x%x", card, port, out->device);
         ALOGW("rate %d, channel %d period_size 0x%x", out->config[PCM_HDMI].rate, out->config[PCM_HDMI].channels, out->config[PCM_HDMI].period_size);
@@ -566,24 +936,71 @@ static int start_output_stream_primary(struct imx_stream_out *out)
     }
 
     if (success) {
-        out->buffer_frames = pcm_config_mm_out.period_size * 2;
+        if (out->deep)
+            out->buffer_frames = pcm_config_deep_out.period_size * DEEP_BUFFER_WRITE_PERIODS * 2;
+        else
+            out->buffer_frames = pcm_config_mm_out.period_size * 2;
         if (out->buffer == NULL)
             out->buffer = malloc(out->buffer_frames * audio_stream_frame_size(&out->stream.common));
 
         if (adev->echo_reference != NULL)
             out->echo_reference = adev->echo_reference;
 
+        /* pick the resampled PCM once, writes don't look for it */
+        out->resample_pcm = -1;
         for(i = 0; i < PCM_TOTAL; i++) {
-            if (out->resampler[i])
-                out->resampler[i]->reset(out->resampler[i]);
+            out->resampled[i] = out->pcm[i] && (out->config[i].rate != adev->default_rate);
+            if (!out->resampled[i])
+                continue;
+
+            if (out->resampler[i] == NULL &&
+                    create_resampler(adev->default_rate, out->config[i].rate, 2,
+                                     adev->resampler_quality, NULL, &out->resampler[i]) != 0) {
+                ALOGE("cannot create resampler %d -> %d", adev->default_rate, out->config[i].rate);
+                out->resampler[i] = NULL;
+                out->resampled[i] = false;
+                continue;
+            }
+            out->resampler[i]->reset(out->resampler[i]);
+            if (out->resample_pcm < 0)
+                out->resample_pcm = i;
         }
 
+        start_output_fanout(out);
         return 0;
     }
 
     return -ENOMEM;
 }
 
+/* IEC958 channel status of HDMI card: non-audio for IEC61937 bursts,
+ * so the sink decodes them instead of playing them as PCM.
+ */
+static void set_hdmi_nonaudio(struct imx_audio_device *adev, int card_index, bool nonaudio)
+{
+    struct snd_aes_iec958 iec958;
+    struct mixer_ctl *ctl;
+
+    if (card_index < 0 || card_index >= MAX_AUDIO_CARD_NUM || !adev->mixer[card_index])
+        return;
+
+    ctl = mixer_get_ctl_by_name(adev->mixer[card_index], "IEC958 Playback Default");
+    if (!ctl) {
+        if (nonaudio)
+            ALOGW("no IEC958 channel status control, sink detects bursts by preamble");
+        return;
+    }
+
+    memset(&iec958, 0, sizeof(iec958));
+    if (mixer_ctl_get_array(ctl, &iec958, 1) != 0)
+        return;
+    if (nonaudio)
+        iec958.status[0] |= IEC958_AES0_NONAUDIO;
+    else
+        iec958.status[0] &= ~IEC958_AES0_NONAUDIO;
+    mixer_ctl_set_array(ctl, &iec958, 1);
+}
+
 static int start_output_stream_hdmi(struct imx_stream_out *out)
 {
     struct imx_audio_device *adev = out->dev;
@@ -594,7 +1011,7 @@ static int start_output_stream_hdmi(struct imx_stream_out *out)
     ALOGI("start_output_stream_hdmi, out %d, device 0x%x", (uintptr_t)out, out->device);
     /* force standby on low latency output stream to close HDMI driver in case it was in use */
     if (adev->active_output[OUTPUT_PRIMARY] != NULL &&
-            !adev->active_output[OUTPUT_PRIMARY]->standby) {
+            output_holds_pcm(adev->active_output[OUTPUT_PRIMARY])) {
         struct imx_stream_out *p_out = adev->active_output[OUTPUT_PRIMARY];
         pthread_mutex_lock(&p_out->lock);
         do_output_standby(p_out, true);
@@ -605,6 +1022,7 @@ static int start_output_stream_hdmi(struct imx_stream_out *out)
     ALOGW("card %d, port %d device 0x%x", card, port, out->device);
     ALOGW("rate %d, channel %d period_size 0x%x", out->config[PCM_HDMI].rate, out->config[PCM_HDMI].channels, out->config[PCM_HDMI].period_size);
 
+    set_hdmi_nonaudio(adev, out->card_index, out->passthrough != IEC61937_NONE);
     out->pcm[PCM_HDMI] = pcm_open(card, port, PCM_OUT | PCM_MONOTONIC, &out->config[PCM_HDMI]);
 
     if (out->pcm[PCM_HDMI] && !pcm_is_ready(out->pcm[PCM_HDMI])) {
@@ -614,6 +1032,8 @@ static int start_output_stream_hdmi(struct imx_stream_out *out)
         return -ENOMEM;
     }
 
+    if (out->passthrough != IEC61937_NONE)
+        iec61937_reset(&out->iec);
     out->written = 0;
 
     return 0;
@@ -629,7 +1049,7 @@ static int start_output_stream_esai(struct imx_stream_out *out)
     ALOGI("start_output_stream_esai, out %d, device 0x%x", (uintptr_t)out, out->device);
     /* force standby on low latency output stream to close HDMI driver in case it was in use */
     if (adev->active_output[OUTPUT_PRIMARY] != NULL &&
-            !adev->active_output[OUTPUT_PRIMARY]->standby) {
+            output_holds_pcm(adev->active_output[OUTPUT_PRIMARY])) {
         struct imx_stream_out *p_out = adev->active_output[OUTPUT_PRIMARY];
         pthread_mutex_lock(&p_out->lock);
         do_output_standby(p_out, true);
@@ -652,6 +1072,60 @@ static int start_output_stream_esai(struct imx_stream_out *out)
     return 0;
 }
 
+/* AudioFlinger format of frames written as pcm format without conversion */
+static audio_format_t hires_audio_format(int format)
+{
+    switch (format) {
+    case PCM_FORMAT_S32_LE:
+        return AUDIO_FORMAT_PCM_32_BIT;
+    case PCM_FORMAT_S24_LE:
+        return AUDIO_FORMAT_PCM_8_24_BIT;
+    default:
+        return AUDIO_FORMAT_INVALID;
+    }
+}
+
+static int start_output_stream_hires(struct imx_stream_out *out)
+{
+    struct imx_audio_device *adev = out->dev;
+    unsigned int card = -1;
+    unsigned int port = 0;
+    int i;
+
+    ALOGI("start_output_stream_hires, out %d, device 0x%x", (uintptr_t)out, out->device);
+    /* other outputs of the card are forced to standby to free the PCM */
+    for (i = 0; i < OUTPUT_TOTAL; i++) {
+        struct imx_stream_out *p_out = adev->active_output[i];
+        if ((i == OUTPUT_PRIMARY || i == OUTPUT_DEEP_BUF) && p_out != NULL &&
+                output_holds_pcm(p_out)) {
+            pthread_mutex_lock(&p_out->lock);
+            do_output_standby(p_out, true);
+            pthread_mutex_unlock(&p_out->lock);
+        }
+    }
+
+    if (adev->mode != AUDIO_MODE_IN_CALL)
+        select_output_device(adev);
+
+    card = get_card_for_device(adev, out->device & ~AUDIO_DEVICE_OUT_AUX_DIGITAL,
+                               PCM_OUT, &out->card_index);
+    ALOGW("card %d, port %d device 0x%x", card, port, out->device);
+    ALOGW("rate %d, format %d period_size 0x%x", out->config[PCM_NORMAL].rate,
+          out->config[PCM_NORMAL].format, out->config[PCM_NORMAL].period_size);
+
+    out->write_flags[PCM_NORMAL] = PCM_OUT | PCM_MONOTONIC;
+    out->pcm[PCM_NORMAL] = pcm_open(card, port, out->write_flags[PCM_NORMAL],
+                                    &out->config[PCM_NORMAL]);
+    if (out->pcm[PCM_NORMAL] && !pcm_is_ready(out->pcm[PCM_NORMAL])) {
+        ALOGE("cannot open pcm_out driver: %s", pcm_get_error(out->pcm[PCM_NORMAL]));
+        pcm_close(out->pcm[PCM_NORMAL]);
+        out->pcm[PCM_NORMAL] = NULL;
+        return -ENOMEM;
+    }
+    out->written = 0;
+    return 0;
+}
+
 static int check_input_parameters(uint32_t sample_rate, int format, int channel_count)
 {
     if (format != AUDIO_FORMAT_PCM_16_BIT)
@@ -695,8 +1169,14 @@ static size_t get_input_buffer_size(uint32_t sample_rate, int format, int channe
     return size * channel_count * sizeof(short);
 }
 
+/* block header of echo ring, frames of ring format follow */
+struct echo_block {
+    int64_t render_ns;          /* render time of first frame */
+    uint32_t frames;
+};
+
 static void add_echo_reference(struct imx_stream_out *out,
-                               struct echo_reference_itfe *reference)
+                               struct echo_ring *reference)
 {
     pthread_mutex_lock(&out->lock);
     out->echo_reference = reference;
@@ -704,19 +1184,18 @@ static void add_echo_reference(struct imx_stream_out *out,
 }
 
 static void remove_echo_reference(struct imx_stream_out *out,
-                                  struct echo_reference_itfe *reference)
+                                  struct echo_ring *reference)
 {
     pthread_mutex_lock(&out->lock);
     if (out->echo_reference == reference) {
         /* stop writing to echo reference */
-        reference->write(reference, NULL);
         out->echo_reference = NULL;
     }
     pthread_mutex_unlock(&out->lock);
 }
 
 static void put_echo_reference(struct imx_audio_device *adev,
-                          struct echo_reference_itfe *reference)
+                          struct echo_ring *reference)
 {
     if (adev->echo_reference != NULL &&
             reference == adev->echo_reference) {
@@ -724,74 +1203,84 @@ static void put_echo_reference(struct imx_audio_device *adev,
         if (adev->active_output[OUTPUT_PRIMARY] != NULL &&
              !adev->active_output[OUTPUT_PRIMARY]->standby )
                 remove_echo_reference(adev->active_output[OUTPUT_PRIMARY], reference);
-        release_echo_reference(reference);
+        if (reference->drops)
+            ALOGW("echo reference dropped %u playback blocks", reference->drops);
+        audio_ring_release(&reference->ring);
+        free(reference);
         adev->echo_reference = NULL;
     }
 }
 
-static struct echo_reference_itfe *get_echo_reference(struct imx_audio_device *adev,
-                                               audio_format_t format,
-                                               uint32_t channel_count,
-                                               uint32_t sampling_rate)
+static struct echo_ring *get_echo_reference(struct imx_audio_device *adev)
 {
+    struct echo_ring *echo;
+
     put_echo_reference(adev, adev->echo_reference);
     /*only for mixer output, only one output*/
     if (adev->active_output[OUTPUT_PRIMARY] != NULL &&
              !adev->active_output[OUTPUT_PRIMARY]->standby){
         struct audio_stream *stream = &adev->active_output[OUTPUT_PRIMARY]->stream.common;
-        uint32_t wr_channel_count = popcount(stream->get_channels(stream));
-        uint32_t wr_sampling_rate = stream->get_sample_rate(stream);
 
-        int status = create_echo_reference(AUDIO_FORMAT_PCM_16_BIT,
-                                           channel_count,
-                                           sampling_rate,
-                                           AUDIO_FORMAT_PCM_16_BIT,
-                                           wr_channel_count,
-                                           wr_sampling_rate,
-                                           &adev->echo_reference);
-        if (status == 0)
-            add_echo_reference(adev->active_output[OUTPUT_PRIMARY], adev->echo_reference);
+        echo = (struct echo_ring *)calloc(1, sizeof(struct echo_ring));
+        if (echo == NULL)
+            return NULL;
+        echo->channels = popcount(stream->get_channels(stream));
+        echo->rate = stream->get_sample_rate(stream);
+        if (audio_ring_init(&echo->ring, (size_t)echo->rate * echo->channels *
+                            sizeof(int16_t) * ECHO_RING_MS / 1000) != 0) {
+            free(echo);
+            return NULL;
+        }
+        adev->echo_reference = echo;
+        add_echo_reference(adev->active_output[OUTPUT_PRIMARY], adev->echo_reference);
     }
 
     return adev->echo_reference;
 }
 
-static int get_playback_delay(struct imx_stream_out *out,
-                       size_t frames,
-                       struct echo_reference_buffer *buffer)
+/* render time of next frame written, first active PCM is the primary one */
+static int get_playback_delay(struct imx_stream_out *out, int64_t *render_ns)
 {
     size_t kernel_frames;
+    struct timespec tstamp;
     int status;
     int primary_pcm = 0;
-    struct imx_audio_device *adev = out->dev;
 
-    /* Find the first active PCM to act as primary */
     for (primary_pcm = 0; primary_pcm < PCM_TOTAL; primary_pcm++) {
         if (out->pcm[primary_pcm]) {
-            status = pcm_get_htimestamp(out->pcm[primary_pcm], &kernel_frames, &buffer->time_stamp);
+            status = pcm_get_htimestamp(out->pcm[primary_pcm], &kernel_frames, &tstamp);
             if (status < 0) {
-                buffer->time_stamp.tv_sec  = 0;
-                buffer->time_stamp.tv_nsec = 0;
-                buffer->delay_ns           = 0;
-                ALOGV("get_playback_delay(): pcm_get_htimestamp error,"
-                        "setting playbackTimestamp to 0");
+                ALOGV("get_playback_delay(): pcm_get_htimestamp error");
                 return status;
             }
 
+            /* frames queued in driver play before this write */
             kernel_frames = pcm_get_buffer_size(out->pcm[primary_pcm]) - kernel_frames;
-
-            /* adjust render time stamp with delay added by current driver buffer.
-             * Add the duration of current frame as we want the render time of the last
-             * sample being written. */
-            buffer->delay_ns = (long)(((int64_t)(kernel_frames + frames)* 1000000000)/
-                                    adev->mm_rate);
-
+            *render_ns = (int64_t)tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec +
+                         (int64_t)kernel_frames * 1000000000LL / out->config[primary_pcm].rate;
             return 0;
         }
     }
     return -1;
 }
 
+/* must be called with output stream mutex locked, never blocks: block is
+ * dropped if input doesn't keep up.
+ */
+static void write_echo_reference(struct imx_stream_out *out, const void *buffer, size_t frames)
+{
+    struct echo_ring *echo = out->echo_reference;
+    struct echo_block block;
+
+    if (get_playback_delay(out, &block.render_ns) != 0)
+        return;
+
+    block.frames = frames;
+    if (!audio_ring_write_block(&echo->ring, &block, sizeof(block), buffer,
+                                frames * echo->channels * sizeof(int16_t)))
+        echo->drops++;
+}
+
 static uint32_t out_get_sample_rate(const struct audio_stream *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
@@ -804,12 +1293,25 @@ static uint32_t out_get_sample_rate_hdmi(const struct audio_stream *stream)
     return out->config[PCM_HDMI].rate;
 }
 
+/* content rate, bursts run at multiple of it */
+static uint32_t out_get_sample_rate_passthrough(const struct audio_stream *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    return out->config[PCM_HDMI].rate / iec61937_rate_multiplier(out->passthrough);
+}
+
 static uint32_t out_get_sample_rate_esai(const struct audio_stream *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
     return out->config[PCM_ESAI].rate;
 }
 
+static uint32_t out_get_sample_rate_hires(const struct audio_stream *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    return out->config[PCM_NORMAL].rate;
+}
+
 static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 {
     ALOGW("out_set_sample_rate %d", rate);
@@ -829,6 +1331,25 @@ static size_t out_get_buffer_size_primary(const struct audio_stream *stream)
     return size * audio_stream_frame_size((struct audio_stream *)stream);
 }
 
+static size_t out_get_buffer_size_deep(const struct audio_stream *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    struct imx_audio_device *adev = out->dev;
+
+    /* one write per wakeup of writer, see avail_min of pcm_config_deep_out */
+    size_t size = (pcm_config_deep_out.period_size * DEEP_BUFFER_WRITE_PERIODS *
+                   adev->default_rate) / pcm_config_deep_out.rate;
+    size = ((size + 15) / 16) * 16;
+    return size * audio_stream_frame_size((struct audio_stream *)stream);
+}
+
+static size_t out_get_buffer_size_fast(const struct audio_stream *stream)
+{
+    /* one period, fast output runs at hardware rate without resampler */
+    size_t size = ((pcm_config_fast_out.period_size + 15) / 16) * 16;
+    return size * audio_stream_frame_size((struct audio_stream *)stream);
+}
+
 static size_t out_get_buffer_size_hdmi(const struct audio_stream *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
@@ -841,6 +1362,15 @@ static size_t out_get_buffer_size_hdmi(const struct audio_stream *stream)
     return size * audio_stream_frame_size((struct audio_stream *)stream);
 }
 
+/* bytes of bitstream, about one burst of PCM data */
+static size_t out_get_buffer_size_passthrough(const struct audio_stream *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+
+    return out->passthrough == IEC61937_EAC3 ? IEC61937_MAX_BURST_BYTES :
+                                               IEC61937_MAX_BURST_BYTES / 4;
+}
+
 static size_t out_get_buffer_size_esai(const struct audio_stream *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
@@ -853,6 +1383,13 @@ static size_t out_get_buffer_size_esai(const struct audio_stream *stream)
     return size * audio_stream_frame_size((struct audio_stream *)stream);
 }
 
+static size_t out_get_buffer_size_hires(const struct audio_stream *stream)
+{
+    /* one period, hi-res output runs at hardware rate without resampler */
+    size_t size = ((pcm_config_hires_out.period_size + 15) / 16) * 16;
+    return size * audio_stream_frame_size((struct audio_stream *)stream);
+}
+
 static uint32_t out_get_channels(const struct audio_stream *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
@@ -861,6 +1398,10 @@ static uint32_t out_get_channels(const struct audio_stream *stream)
 
 static audio_format_t out_get_format(const struct audio_stream *stream)
 {
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+
+    if (out->passthrough != IEC61937_NONE || out->hires)
+        return out->format;
     return AUDIO_FORMAT_PCM_16_BIT;
 }
 
@@ -870,28 +1411,77 @@ static int out_set_format(struct audio_stream *stream, audio_format_t format)
     return 0;
 }
 
-/* must be called with hw device and output stream mutexes locked */
-static int do_output_standby(struct imx_stream_out *out, int force_standby)
+static int64_t standby_now_ns(void)
 {
-    struct imx_audio_device *adev = out->dev;
-    int i;
+    struct timespec ts;
 
-    if (!force_standby && !strcmp(adev->card_list[out->card_index]->driver_name, "wm8962-audio")) {
-        ALOGW("no standby");
-        return 0;
-    }
-    if (!out->standby) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-        for (i = 0; i < PCM_TOTAL; i++) {
-            if (out->pcm[i]) {
-                pcm_close(out->pcm[i]);
-                out->pcm[i] = NULL;
-            }
+/* stream has PCMs opened, running or kept idle after standby */
+static bool output_holds_pcm(struct imx_stream_out *out)
+{
+    return !out->standby || out->idle;
+}
 
-            out->writeContiFailCount[i] = 0;
-        }
+static void close_output_pcms(struct imx_stream_out *out)
+{
+    int i;
 
-        ALOGW("do_out_standby... %d",(uintptr_t)out);
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (out->pcm[i]) {
+            pcm_close(out->pcm[i]);
+            out->pcm[i] = NULL;
+        }
+
+        stats_fail_streak(&out->stats, out->writeContiFailCount[i]);
+        out->writeContiFailCount[i] = 0;
+    }
+    out->idle = false;
+
+    if (out->passthrough != IEC61937_NONE)
+        set_hdmi_nonaudio(out->dev, out->card_index, false);
+}
+
+/* must be called with hw device and output stream mutexes locked */
+static int do_output_standby(struct imx_stream_out *out, int force_standby)
+{
+    struct imx_audio_device *adev = out->dev;
+    int i;
+
+    /* client maps the ring until the stream is closed, only stop it */
+    if (out->mmap && out->pcm[PCM_NORMAL] != NULL) {
+        pcm_stop(out->pcm[PCM_NORMAL]);
+        return 0;
+    }
+
+    if (!force_standby && !strcmp(adev->card_list[out->card_index]->driver_name, "wm8962-audio")) {
+        ALOGW("no standby");
+        return 0;
+    }
+    if (!out->standby) {
+        stop_output_fanout(out);
+        /* short pause: stop PCMs but keep them opened and routed, the
+         * standby thread closes them when delay expires.
+         */
+        if (!force_standby && out->delay_standby && adev->standby_delay_ms > 0) {
+            for (i = 0; i < PCM_TOTAL; i++) {
+                if (out->pcm[i])
+                    pcm_stop(out->pcm[i]);
+
+                stats_fail_streak(&out->stats, out->writeContiFailCount[i]);
+                out->writeContiFailCount[i] = 0;
+            }
+            out->idle = true;
+            out->idle_deadline_ns = standby_now_ns() +
+                                    (int64_t)adev->standby_delay_ms * 1000000LL;
+            pthread_cond_signal(&adev->standby_cond);
+            ALOGV("do_out_standby... %d idle", (uintptr_t)out);
+        } else {
+            close_output_pcms(out);
+            ALOGW("do_out_standby... %d",(uintptr_t)out);
+        }
 
         /* if in call, don't turn off the output stage. This will
         be done when the call is ended */
@@ -900,16 +1490,60 @@ static int do_output_standby(struct imx_stream_out *out, int force_standby)
         }
 
         /* stop writing to echo reference */
-        if (out->echo_reference != NULL) {
-            out->echo_reference->write(out->echo_reference, NULL);
-            out->echo_reference = NULL;
-        }
+        out->echo_reference = NULL;
+        /* position of stopped PCMs is not reported */
+        publish_position(out, false, 0, NULL);
 
         out->standby = 1;
+        out->stats.standbys++;
+    } else if (out->idle && force_standby) {
+        close_output_pcms(out);
+        ALOGW("do_out_standby... %d idle closed", (uintptr_t)out);
     }
     return 0;
 }
 
+/* closes PCMs of idle outputs whose standby delay expired */
+static void *standby_thread_loop(void *context)
+{
+    struct imx_audio_device *adev = (struct imx_audio_device *)context;
+    struct imx_stream_out *out;
+    struct timespec ts;
+    int64_t now, next;
+    int i;
+
+    pthread_mutex_lock(&adev->lock);
+    while (!adev->standby_exit) {
+        now = standby_now_ns();
+        next = 0;
+        for (i = 0; i < OUTPUT_TOTAL; i++) {
+            out = adev->active_output[i];
+            if (out == NULL)
+                continue;
+
+            pthread_mutex_lock(&out->lock);
+            if (out->idle) {
+                if (out->idle_deadline_ns <= now)
+                    do_output_standby(out, true);
+                else if (next == 0 || out->idle_deadline_ns < next)
+                    next = out->idle_deadline_ns;
+            }
+            pthread_mutex_unlock(&out->lock);
+        }
+
+        if (next == 0) {
+            pthread_cond_wait(&adev->standby_cond, &adev->lock);
+        } else {
+            ts.tv_sec = next / 1000000000LL;
+            ts.tv_nsec = next % 1000000000LL;
+            pthread_cond_timedwait(&adev->standby_cond, &adev->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    return NULL;
+}
+
 static int out_standby(struct audio_stream *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
@@ -923,8 +1557,30 @@ static int out_standby(struct audio_stream *stream)
     return status;
 }
 
+/* counters are read without stream mutex, dump must not wait a stalled write */
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    int i;
+
+    dprintf(fd, "  imx output %p: %s, device 0x%x, written %llu\n", out,
+            out->standby ? (out->idle ? "idle" : "standby") : "active", out->device,
+            (unsigned long long)out->written);
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (out->pcm[i])
+            dprintf(fd, "    pcm %d: rate %u, channels %u, period %u x %u, fail count %d\n",
+                    i, out->config[i].rate, out->config[i].channels,
+                    out->config[i].period_size, out->config[i].period_count,
+                    out->writeContiFailCount[i]);
+        if (out->fanout[i].ring.data) {
+            dprintf(fd, "    pcm %d fanout: %s, ring %u bytes, dropped writes %u, fail count %d, "
+                    "drift %d ppm\n",
+                    i, out->fanout[i].started ? "running" : "stopped", out->fanout[i].ring.size,
+                    out->fanout[i].overruns, out->fanout[i].fail_count, out->fanout[i].drift_ppm);
+            stats_dump(&out->fanout[i].stats, fd, "fanout write stats");
+        }
+    }
+    stats_dump(&out->stats, fd, "write stats");
     return 0;
 }
 
@@ -952,7 +1608,9 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
         pthread_mutex_lock(&out->lock);
 
         if (adev->out_device != val) {
-            if (out == adev->active_output[OUTPUT_PRIMARY] && !out->standby) {
+            if ((out == adev->active_output[OUTPUT_PRIMARY] ||
+                    out == adev->active_output[OUTPUT_DEEP_BUF] ||
+                    out == adev->active_output[OUTPUT_HIRES]) && !out->standby) {
                 /* a change in output device may change the microphone selection */
                 if (adev->active_input &&
                         adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION) {
@@ -967,6 +1625,9 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
                         ALOGI("out_set_parameters, old 0x%x, new 0x%x do_output_standby", adev->out_device, val);
                     do_output_standby(out, true);
                 }
+            } else if (out->idle) {
+                /* PCMs kept for short standby are routed to old device */
+                do_output_standby(out, true);
             }
             if ((out != adev->active_output[OUTPUT_HDMI]) && val) {
                 adev->out_device = val;
@@ -1049,6 +1710,24 @@ static char * out_get_parameters(const struct audio_stream *stream, const char *
         checked = true;
     }
 
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_FORMATS, value, sizeof(value));
+    if (ret >= 0) {
+        value[0] = '\0';
+        if (str != NULL)
+            free(str);
+        /* bitstreams only on HDMI direct output, sink decodes them */
+        j = (out->device & AUDIO_DEVICE_OUT_AUX_DIGITAL) ?
+                ARRAY_SIZE(out_formats_name_to_enum_table) : 1;
+        for (i = 0; i < j; i++) {
+            if (i > 0)
+                strcat(value, "|");
+            strcat(value, out_formats_name_to_enum_table[i].name);
+        }
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_FORMATS, value);
+        str = strdup(str_parms_to_str(reply));
+        checked = true;
+    }
+
     if (!checked) {
         str = strdup("");
     }
@@ -1066,6 +1745,16 @@ static uint32_t out_get_latency_primary(const struct audio_stream_out *stream)
     return (pcm_config_mm_out.period_size * pcm_config_mm_out.period_count * 1000) / pcm_config_mm_out.rate;
 }
 
+static uint32_t out_get_latency_deep(const struct audio_stream_out *stream)
+{
+    return (pcm_config_deep_out.period_size * pcm_config_deep_out.period_count * 1000) / pcm_config_deep_out.rate;
+}
+
+static uint32_t out_get_latency_fast(const struct audio_stream_out *stream)
+{
+    return (pcm_config_fast_out.period_size * pcm_config_fast_out.period_count * 1000) / pcm_config_fast_out.rate;
+}
+
 static uint32_t out_get_latency_hdmi(const struct audio_stream_out *stream)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
@@ -1080,27 +1769,30 @@ static uint32_t out_get_latency_esai(const struct audio_stream_out *stream)
     return (pcm_config_esai_multi.period_size * pcm_config_esai_multi.period_count * 1000) / pcm_config_esai_multi.rate;
 }
 
+static uint32_t out_get_latency_hires(const struct audio_stream_out *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+
+    return (out->config[PCM_NORMAL].period_size * out->config[PCM_NORMAL].period_count * 1000) /
+           out->config[PCM_NORMAL].rate;
+}
+
 static int out_set_volume(struct audio_stream_out *stream, float left,
                           float right)
 {
     return -ENOSYS;
 }
 
-static int pcm_read_convert(struct imx_stream_in *in, struct pcm *pcm, void *data, unsigned int count)
+static int capture_read(struct imx_stream_in *in, void *buffer, size_t bytes);
+
+static int pcm_read_convert(struct imx_stream_in *in, void *data, unsigned int count)
 {
-    bool bit_24b_2_16b = false;
-    bool mono2stereo = false;
-    bool stereo2mono = false;
     size_t frames_rq = count / audio_stream_frame_size(&in->stream.common);
 
-    if (in->config.format == PCM_FORMAT_S24_LE && in->requested_format == PCM_FORMAT_S16_LE) bit_24b_2_16b = true;
-    if (in->config.channels == 2 && in->requested_channel == 1) stereo2mono = true;
-    if (in->config.channels == 1 && in->requested_channel == 2) mono2stereo = true;
-
-    if (bit_24b_2_16b || mono2stereo || stereo2mono) {
-        size_t size_in_bytes_tmp = pcm_frames_to_bytes(in->pcm, frames_rq);
-        if (in->read_tmp_buf_size < in->config.period_size) {
-            in->read_tmp_buf_size = in->config.period_size;
+    if (in->record_convert) {
+        size_t size_in_bytes_tmp = frames_rq * in->dev->capture.frame_bytes;
+        if (in->read_tmp_buf_size < frames_rq) {
+            in->read_tmp_buf_size = frames_rq;
             in->read_tmp_buf = (int32_t *) realloc(in->read_tmp_buf, size_in_bytes_tmp);
             ALOG_ASSERT((in->read_tmp_buf != NULL),
                         "get_next_buffer() failed to reallocate read_tmp_buf");
@@ -1108,48 +1800,81 @@ static int pcm_read_convert(struct imx_stream_in *in, struct pcm *pcm, void *dat
                      in->read_tmp_buf, size_in_bytes_tmp);
         }
 
-        in->read_status = pcm_read_wrapper(pcm, (void*)in->read_tmp_buf, size_in_bytes_tmp);
+        in->read_status = capture_read(in, (void*)in->read_tmp_buf, size_in_bytes_tmp);
 
         if (in->read_status != 0) {
-            ALOGE("get_next_buffer() pcm_read_wrapper error %d", in->read_status);
+            ALOGE("get_next_buffer() capture_read error %d", in->read_status);
             return in->read_status;
         }
-        convert_record_data((void *)in->read_tmp_buf, (void *)data, frames_rq, bit_24b_2_16b, mono2stereo, stereo2mono);
+        in->record_convert(in->read_tmp_buf, data, frames_rq);
     }
     else {
-        in->read_status = pcm_read_wrapper(pcm, (void*)data, count);
+        in->read_status = capture_read(in, (void*)data, count);
     }
 
     return in->read_status;
 }
 
-static int pcm_read_wrapper(struct pcm *pcm, const void * buffer, size_t bytes)
+/* frames queued in kernel buffer as counter track, ioctl only while tracing */
+static void trace_pcm_queue(const char *name, struct pcm *pcm, bool playback)
+{
+    unsigned int avail;
+    struct timespec tstamp;
+
+    if (!ATRACE_ENABLED() || pcm_get_htimestamp(pcm, &avail, &tstamp) != 0)
+        return;
+    ATRACE_INT(name, playback ? pcm_get_buffer_size(pcm) - avail : avail);
+}
+
+static int pcm_read_wrapper(struct stream_stats *stats, struct pcm *pcm,
+                            const void * buffer, size_t bytes, int flags)
 {
     int ret = 0;
-    ret = pcm_read(pcm, (void *)buffer, bytes);
+    int64_t begin = stats_transfer_begin();
+    if (flags & PCM_MMAP)
+        ret = pcm_mmap_read(pcm, (void *)buffer, bytes);
+    else
+        ret = pcm_read(pcm, (void *)buffer, bytes);
 
     if(ret !=0) {
          ALOGV("ret %d, pcm read %d error %s.", ret, bytes, pcm_get_error(pcm));
 
          switch(pcm_state(pcm)) {
-              case PCM_STATE_SETUP:
               case PCM_STATE_XRUN:
+                   /* frames lost until restart are counted by clients at next timestamp */
+                   stats->xruns++;
+                   /* fall through */
+              case PCM_STATE_SETUP:
                    ret = pcm_prepare(pcm);
-                   if(ret != 0) return ret;
+                   if(ret != 0) {
+                       stats->prepare_errors++;
+                       return ret;
+                   }
+                   stats->prepares++;
                    break;
               default:
+                   stats->transfer_errors++;
                    return ret;
          }
 
-         ret = pcm_read(pcm, (void *)buffer, bytes);
+         if (flags & PCM_MMAP)
+             ret = pcm_mmap_read(pcm, (void *)buffer, bytes);
+         else
+             ret = pcm_read(pcm, (void *)buffer, bytes);
+         if (ret != 0)
+             stats->transfer_errors++;
     }
 
+    stats_transfer_end(stats, begin);
+    trace_pcm_queue("audio in queued", pcm, false);
     return ret;
 }
 
-static int pcm_write_wrapper(struct pcm *pcm, const void * buffer, size_t bytes, int flags)
+static int pcm_write_wrapper(struct stream_stats *stats, struct pcm *pcm,
+                             const void * buffer, size_t bytes, int flags)
 {
     int ret = 0;
+    int64_t begin = stats_transfer_begin();
     if(flags & PCM_MMAP)
          ret = pcm_mmap_write(pcm, (void *)buffer, bytes);
     else
@@ -1159,12 +1884,19 @@ static int pcm_write_wrapper(struct pcm *pcm, const void * buffer, size_t bytes,
          ALOGW("ret %d, pcm write %d error %s", ret, bytes, pcm_get_error(pcm));
 
          switch(pcm_state(pcm)) {
-              case PCM_STATE_SETUP:
               case PCM_STATE_XRUN:
+                   stats->xruns++;
+                   /* fall through */
+              case PCM_STATE_SETUP:
                    ret = pcm_prepare(pcm);
-                   if(ret != 0) return ret;
+                   if(ret != 0) {
+                       stats->prepare_errors++;
+                       return ret;
+                   }
+                   stats->prepares++;
                    break;
               default:
+                   stats->transfer_errors++;
                    return ret;
          }
 
@@ -1172,11 +1904,70 @@ static int pcm_write_wrapper(struct pcm *pcm, const void * buffer, size_t bytes,
             ret = pcm_mmap_write(pcm, (void *)buffer, bytes);
          else
             ret = pcm_write(pcm, (void *)buffer, bytes);
+         if (ret != 0)
+             stats->transfer_errors++;
     }
 
+    stats_transfer_end(stats, begin);
+    trace_pcm_queue("audio out queued", pcm, true);
     return ret;
 }
 
+/* must be called with output stream mutex locked, the only writer */
+static void publish_position(struct imx_stream_out *out, bool valid, uint64_t frames,
+                             const struct timespec *tstamp)
+{
+    struct position_snapshot *pos = &out->position;
+    uint32_t seq = pos->seq;
+
+    __atomic_store_n(&pos->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&pos->valid, valid, __ATOMIC_RELAXED);
+    if (valid) {
+        __atomic_store_n(&pos->frames, frames, __ATOMIC_RELAXED);
+        __atomic_store_n(&pos->tstamp.tv_sec, tstamp->tv_sec, __ATOMIC_RELAXED);
+        __atomic_store_n(&pos->tstamp.tv_nsec, tstamp->tv_nsec, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&pos->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* must be called with output stream mutex locked, after each pcm write */
+static void update_presentation_position(struct imx_stream_out *out)
+{
+    struct timespec tstamp;
+    int64_t signed_frames;
+    size_t kernel_buffer_size;
+    size_t avail;
+    uint32_t rate;
+    int i;
+
+    if (out->passthrough != IEC61937_NONE) {
+        if (!out->pcm[PCM_HDMI] || pcm_get_htimestamp(out->pcm[PCM_HDMI], &avail, &tstamp) != 0)
+            return;
+        kernel_buffer_size = out->config[PCM_HDMI].period_size *
+                             out->config[PCM_HDMI].period_count;
+        signed_frames = out->written - (kernel_buffer_size - avail) /
+                                       iec61937_rate_multiplier(out->passthrough);
+        if (signed_frames >= 0)
+            publish_position(out, true, signed_frames, &tstamp);
+        return;
+    }
+
+    for (i = 0; i < PCM_TOTAL; i++)
+        if (out->pcm[i]) {
+            if (pcm_get_htimestamp(out->pcm[i], &avail, &tstamp) == 0) {
+                kernel_buffer_size = out->config[i].period_size * out->config[i].period_count;
+                /* written counts frames at stream rate, hi-res and ESAI run at pcm rate */
+                rate = out->stream.common.get_sample_rate(&out->stream.common);
+                signed_frames = out->written - (kernel_buffer_size - avail) * rate / out->config[i].rate;
+
+                if (signed_frames >= 0)
+                    publish_position(out, true, signed_frames, &tstamp);
+                break;
+            }
+        }
+}
+
 static ssize_t out_write_primary(struct audio_stream_out *stream, const void* buffer,
                          size_t bytes)
 {
@@ -1189,64 +1980,71 @@ static ssize_t out_write_primary(struct audio_stream_out *stream, const void* bu
     bool force_input_standby = false;
     struct imx_stream_in *in;
     int i;
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
+
+    ATRACE_BEGIN(__func__);
+    ret = 0;
+    /* steady state writes take only the stream mutex, so a routing or mode
+     * change holding the hw device mutex can't stall playback. hw device
+     * mutex is taken to leave standby, respecting lock order.
      */
-    pthread_mutex_lock(&adev->lock);
     pthread_mutex_lock(&out->lock);
     if (out->standby) {
-        ret = start_output_stream_primary(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        pthread_mutex_lock(&out->lock);
+        if (out->standby) {
+            ret = start_output_stream_primary(out);
+            if (ret != 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
+            /* a change in output device may change the microphone selection */
+            if (adev->active_input &&
+                    adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
+                force_input_standby = true;
         }
-        out->standby = 0;
-        /* a change in output device may change the microphone selection */
-        if (adev->active_input &&
-                adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
-            force_input_standby = true;
+        pthread_mutex_unlock(&adev->lock);
     }
-    pthread_mutex_unlock(&adev->lock);
 
     /* only use resampler if required */
-    for (i = 0; i < PCM_TOTAL; i++) {
-        /* only use resampler if required */
-        if (out->pcm[i] && out->resampler[i] && (out->config[i].rate != adev->default_rate)) {
-            out_frames = out->buffer_frames;
-            out->resampler[i]->resample_from_input(out->resampler[i],
-                                                (int16_t *)buffer,
-                                                &in_frames,
-                                                (int16_t *)out->buffer,
-                                                &out_frames);
-            break;
-        }
+    if (ret == 0 && out->resample_pcm >= 0) {
+        struct resampler_itfe *resampler = out->resampler[out->resample_pcm];
+        out_frames = out->buffer_frames;
+        resampler->resample_from_input(resampler,
+                                       (int16_t *)buffer,
+                                       &in_frames,
+                                       (int16_t *)out->buffer,
+                                       &out_frames);
     }
 
-    if (out->echo_reference != NULL) {
-        struct echo_reference_buffer b;
-        b.raw = (void *)buffer;
-        b.frame_count = in_frames;
-
-        get_playback_delay(out, out_frames, &b);
-        out->echo_reference->write(out->echo_reference, &b);
-    }
+    if (out->echo_reference != NULL)
+        write_echo_reference(out, buffer, in_frames);
     /* do not allow more than out->write_threshold frames in kernel pcm driver buffer */
     /* Write to all active PCMs */
     for (i = 0; i < PCM_TOTAL; i++) {
         if (out->pcm[i]) {
-            if (out->config[i].rate == adev->default_rate) {
+            if (out->fanout[i].started) {
+                if (!out->resampled[i])
+                    fanout_write(&out->fanout[i], buffer, bytes);
+                else
+                    fanout_write(&out->fanout[i], out->buffer, out_frames * frame_size);
+                continue;
+            }
+
+            if (!out->resampled[i]) {
                 /* PCM uses native sample rate */
-                ret = pcm_write_wrapper(out->pcm[i], (void *)buffer, bytes, out->write_flags[i]);
+                ret = pcm_write_wrapper(&out->stats, out->pcm[i], (void *)buffer, bytes, out->write_flags[i]);
             } else {
                 /* PCM needs resampler */
-                ret = pcm_write_wrapper(out->pcm[i], (void *)out->buffer, out_frames * frame_size, out->write_flags[i]);
+                ret = pcm_write_wrapper(&out->stats, out->pcm[i], (void *)out->buffer, out_frames * frame_size, out->write_flags[i]);
             }
 
             if (ret) {
                 out->writeContiFailCount[i]++;
                 break;
             } else {
+                stats_fail_streak(&out->stats, out->writeContiFailCount[i]);
                 out->writeContiFailCount[i] = 0;
             }
         }
@@ -1256,6 +2054,7 @@ static ssize_t out_write_primary(struct audio_stream_out *stream, const void* bu
     for (i = 0; i < PCM_TOTAL; i++) {
         if(out->writeContiFailCount[i] > 100) {
             ALOGW("pcm_write_wrapper continues failed for pcm %d, standby", i);
+            out->stats.fail_standbys++;
             do_output_standby(out, true);
             break;
         }
@@ -1263,6 +2062,7 @@ static ssize_t out_write_primary(struct audio_stream_out *stream, const void* bu
 
 exit:
     out->written += bytes / frame_size;
+    update_presentation_position(out);
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
@@ -1281,6 +2081,99 @@ exit:
         }
         pthread_mutex_unlock(&adev->lock);
     }
+    ATRACE_END();
+    return bytes;
+}
+
+/* write of fast output, runs in SCHED_FIFO fast mixer thread. hw device
+ * mutex is only taken to leave standby, never for steady state writes.
+ */
+static ssize_t out_write_fast(struct audio_stream_out *stream, const void* buffer,
+                         size_t bytes)
+{
+    int ret = 0;
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    struct imx_audio_device *adev = out->dev;
+    size_t frame_size = audio_stream_frame_size(&out->stream.common);
+    bool force_input_standby = false;
+    struct imx_stream_in *in;
+    int i;
+
+    ATRACE_BEGIN(__func__);
+    pthread_mutex_lock(&out->lock);
+    if (out->standby) {
+        /* respect lock order: hw device > out stream */
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        pthread_mutex_lock(&out->lock);
+        if (out->standby) {
+            ret = start_output_stream_primary(out);
+            if (ret == 0) {
+                out->standby = 0;
+                /* a change in output device may change the microphone selection */
+                if (adev->active_input &&
+                        adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
+                    force_input_standby = true;
+            }
+        }
+        pthread_mutex_unlock(&adev->lock);
+        if (ret != 0)
+            goto exit;
+    }
+
+    if (out->echo_reference != NULL)
+        write_echo_reference(out, buffer, bytes / frame_size);
+
+    /* fast output is opened at hardware rate, no resampler */
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (out->fanout[i].started) {
+            fanout_write(&out->fanout[i], buffer, bytes);
+            continue;
+        }
+        if (out->pcm[i]) {
+            ret = pcm_write_wrapper(&out->stats, out->pcm[i], (void *)buffer, bytes, out->write_flags[i]);
+            if (ret) {
+                out->writeContiFailCount[i]++;
+                break;
+            } else {
+                stats_fail_streak(&out->stats, out->writeContiFailCount[i]);
+                out->writeContiFailCount[i] = 0;
+            }
+        }
+    }
+
+    //If continue fail, probably th fd is invalid.
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if(out->writeContiFailCount[i] > 100) {
+            ALOGW("pcm_write_wrapper continues failed for pcm %d, standby", i);
+            out->stats.fail_standbys++;
+            do_output_standby(out, true);
+            break;
+        }
+    }
+
+exit:
+    out->written += bytes / frame_size;
+    update_presentation_position(out);
+    pthread_mutex_unlock(&out->lock);
+
+    if (ret != 0) {
+        ALOGV("write error, sleep few ms");
+        usleep(bytes * 1000000 / frame_size /
+               out_get_sample_rate(&stream->common));
+    }
+
+    if (force_input_standby) {
+        pthread_mutex_lock(&adev->lock);
+        if (adev->active_input) {
+            in = adev->active_input;
+            pthread_mutex_lock(&in->lock);
+            do_input_standby(in);
+            pthread_mutex_unlock(&in->lock);
+        }
+        pthread_mutex_unlock(&adev->lock);
+    }
+    ATRACE_END();
     return bytes;
 }
 
@@ -1293,6 +2186,8 @@ static ssize_t out_write_hdmi(struct audio_stream_out *stream, const void* buffe
     size_t frame_size = audio_stream_frame_size(&out->stream.common);
     size_t in_frames = bytes / frame_size;
 
+    ATRACE_BEGIN(__func__);
+
     /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
      * on the output stream mutex - e.g. executing select_mode() while holding the hw device
      * mutex
@@ -1311,10 +2206,11 @@ static ssize_t out_write_hdmi(struct audio_stream_out *stream, const void* buffe
 
     /* do not allow more than out->write_threshold frames in kernel pcm driver buffer */
 
-    ret = pcm_write_wrapper(out->pcm[PCM_HDMI], (void *)buffer, bytes, out->write_flags[PCM_HDMI]);
+    ret = pcm_write_wrapper(&out->stats, out->pcm[PCM_HDMI], (void *)buffer, bytes, out->write_flags[PCM_HDMI]);
 
 exit:
     out->written += bytes / frame_size;
+    update_presentation_position(out);
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
@@ -1323,58 +2219,56 @@ exit:
                out_get_sample_rate(&stream->common));
     }
 
+    ATRACE_END();
     return bytes;
 }
 
-/********************************************************************************************************
-For esai, it will use the first channels/2 for Left channels, use second half channels for Right channels.
-So we need to transform channel map in HAL for multichannel.
-when input is "FL, FR, C, LFE, BL, BR, SL, SR", output is "FL,BL,C,FR,BR,LFE".
-when input is "FL, FR, C, LFE, BL, BR, SL, SR", output is "FL,BL,C,SL,FR,BR,LFE,SR"
-*********************************************************************************************************/
-static void convert_output_for_esai(const void* buffer, size_t bytes, int channels)
+static int write_iec61937_burst(void *context, const void *burst, size_t bytes)
 {
-    short *data_src = (short *)buffer;
-    short *data_dst = (short *)buffer;
-    short dataFL,dataFR,dataC,dataLFE,dataBL,dataBR,dataSL,dataSR;
-    int i;
+    struct imx_stream_out *out = (struct imx_stream_out *)context;
+    int ret;
 
-    if (channels == 6) {
-        for (i = 0; i < (int)bytes/(2*channels); i++ ) {
-           dataFL  = *data_src++;
-           dataFR  = *data_src++;
-           dataC   = *data_src++;
-           dataLFE = *data_src++;
-           dataBL  = *data_src++;
-           dataBR  = *data_src++;
-           *data_dst++ = dataFL;
-           *data_dst++ = dataBL;
-           *data_dst++ = dataC;
-           *data_dst++ = dataFR;
-           *data_dst++ = dataBR;
-           *data_dst++ = dataLFE;
-        }
-    }
-    else if (channels == 8) {
-        for (i = 0; i < (int)bytes/(2*channels); i++ ) {
-           dataFL  = *data_src++;
-           dataFR  = *data_src++;
-           dataC   = *data_src++;
-           dataLFE = *data_src++;
-           dataBL  = *data_src++;
-           dataBR  = *data_src++;
-           dataSL  = *data_src++;
-           dataSR  = *data_src++;
-           *data_dst++ = dataFL;
-           *data_dst++ = dataBL;
-           *data_dst++ = dataC;
-           *data_dst++ = dataSL;
-           *data_dst++ = dataFR;
-           *data_dst++ = dataBR;
-           *data_dst++ = dataLFE;
-           *data_dst++ = dataSR;
+    ret = pcm_write_wrapper(&out->stats, out->pcm[PCM_HDMI], burst, bytes,
+                            out->write_flags[PCM_HDMI]);
+    /* position counts content frames, bursts run at multiple of content rate */
+    out->written += bytes / 4 / iec61937_rate_multiplier(out->passthrough);
+    return ret;
+}
+
+static ssize_t out_write_passthrough(struct audio_stream_out *stream, const void* buffer,
+                         size_t bytes)
+{
+    int ret;
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    struct imx_audio_device *adev = out->dev;
+
+    ATRACE_BEGIN(__func__);
+    pthread_mutex_lock(&adev->lock);
+    pthread_mutex_lock(&out->lock);
+    if (out->standby) {
+        ret = start_output_stream_hdmi(out);
+        if (ret != 0) {
+            pthread_mutex_unlock(&adev->lock);
+            goto exit;
         }
+        out->standby = 0;
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    /* bitstream goes to sink untouched, wrapped in bursts */
+    ret = iec61937_write(&out->iec, buffer, bytes, write_iec61937_burst, out);
+
+exit:
+    update_presentation_position(out);
+    pthread_mutex_unlock(&out->lock);
+
+    if (ret != 0) {
+        ALOGV("write error, sleep few ms");
+        usleep(MIN_WRITE_SLEEP_US);
     }
+
+    ATRACE_END();
+    return bytes;
 }
 
 static ssize_t out_write_esai(struct audio_stream_out *stream, const void* buffer,
@@ -1386,6 +2280,8 @@ static ssize_t out_write_esai(struct audio_stream_out *stream, const void* buffe
     size_t frame_size = audio_stream_frame_size(&out->stream.common);
     size_t in_frames = bytes / frame_size;
 
+    ATRACE_BEGIN(__func__);
+
     /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
      * on the output stream mutex - e.g. executing select_mode() while holding the hw device
      * mutex
@@ -1404,11 +2300,13 @@ static ssize_t out_write_esai(struct audio_stream_out *stream, const void* buffe
 
     /* do not allow more than out->write_threshold frames in kernel pcm driver buffer */
 
-    convert_output_for_esai(buffer, bytes, out->config[PCM_ESAI].channels);
-    ret = pcm_write_wrapper(out->pcm[PCM_ESAI], (void *)buffer, bytes, out->write_flags[PCM_ESAI]);
+    if (out->esai_remap)
+        out->esai_remap((int16_t *)buffer, in_frames);
+    ret = pcm_write_wrapper(&out->stats, out->pcm[PCM_ESAI], (void *)buffer, bytes, out->write_flags[PCM_ESAI]);
 
 exit:
     out->written += bytes / frame_size;
+    update_presentation_position(out);
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
@@ -1417,6 +2315,48 @@ exit:
                out_get_sample_rate(&stream->common));
     }
 
+    ATRACE_END();
+    return bytes;
+}
+
+static ssize_t out_write_hires(struct audio_stream_out *stream, const void* buffer,
+                         size_t bytes)
+{
+    int ret;
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    struct imx_audio_device *adev = out->dev;
+    size_t frame_size = audio_stream_frame_size(&out->stream.common);
+
+    ATRACE_BEGIN(__func__);
+
+    pthread_mutex_lock(&adev->lock);
+    pthread_mutex_lock(&out->lock);
+    if (out->standby) {
+        ret = start_output_stream_hires(out);
+        if (ret != 0) {
+            pthread_mutex_unlock(&adev->lock);
+            goto exit;
+        }
+        out->standby = 0;
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    /* frames are in pcm format already, no mixer, resampler or downmix */
+    ret = pcm_write_wrapper(&out->stats, out->pcm[PCM_NORMAL], buffer, bytes,
+                            out->write_flags[PCM_NORMAL]);
+
+exit:
+    out->written += bytes / frame_size;
+    update_presentation_position(out);
+    pthread_mutex_unlock(&out->lock);
+
+    if (ret != 0) {
+        ALOGV("write error, sleep few ms");
+        usleep(bytes * 1000000 / frame_size /
+               out_get_sample_rate_hires(&stream->common));
+    }
+
+    ATRACE_END();
     return bytes;
 }
 
@@ -1462,208 +2402,543 @@ static int out_remove_audio_effect(const struct audio_stream *stream, effect_han
     return 0;
 }
 
+/* lock free, returns last position published by stream write */
 static int out_get_presentation_position(const struct audio_stream_out *stream,
                                    uint64_t *frames, struct timespec *timestamp)
 {
     struct imx_stream_out *out = (struct imx_stream_out *)stream;
-    struct imx_audio_device *adev = out->dev;
-    int ret = -ENODATA;
+    struct position_snapshot *pos = &out->position;
+    uint32_t seq;
+    bool valid;
+
+    do {
+        seq = __atomic_load_n(&pos->seq, __ATOMIC_ACQUIRE);
+        valid = __atomic_load_n(&pos->valid, __ATOMIC_RELAXED);
+        *frames = __atomic_load_n(&pos->frames, __ATOMIC_RELAXED);
+        timestamp->tv_sec = __atomic_load_n(&pos->tstamp.tv_sec, __ATOMIC_RELAXED);
+        timestamp->tv_nsec = __atomic_load_n(&pos->tstamp.tv_nsec, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&pos->seq, __ATOMIC_RELAXED));
+
+    return valid ? 0 : -ENODATA;
+}
+
+/** audio_stream_in implementation **/
+/* resamples capture rate to requested rate, no resampler if they match */
+static int update_input_resampler(struct imx_stream_in *in)
+{
+    int ret = 0;
+
+    if (in->resampler) {
+        release_resampler(in->resampler);
+        in->resampler = NULL;
+    }
+    if (in->requested_rate != in->config.rate) {
+        in->buf_provider.get_next_buffer = get_next_buffer;
+        in->buf_provider.release_buffer = release_buffer;
+
+        ret = create_resampler(in->config.rate,
+                               in->requested_rate,
+                               in->requested_channel,
+                               in->dev->resampler_quality,
+                               &in->buf_provider,
+                               &in->resampler);
+    }
+
+    /* if no supported sample rate is available, use the resampler */
+    if (in->resampler) {
+        in->resampler->reset(in->resampler);
+    }
+    return ret;
+}
+
+static const unsigned int spdif_in_rates[] = {
+    8000, 11025, 16000, 22050, 32000, 44100, 48000,
+    64000, 88200, 96000, 176400, 192000,
+};
+
+/* standard rate nearest to measured receiver rate, 0 if no signal */
+static unsigned int spdif_in_nearest_rate(unsigned int measured)
+{
+    size_t i;
+
+    if (measured <= spdif_in_rates[0] / 2)
+        return 0;
+    for (i = 0; i + 1 < ARRAY_SIZE(spdif_in_rates); i++) {
+        if (measured <= (spdif_in_rates[i] + spdif_in_rates[i + 1]) / 2)
+            return spdif_in_rates[i];
+    }
+    return spdif_in_rates[i];
+}
+
+static void spdif_in_update_rate(struct imx_audio_device *adev)
+{
+    unsigned int rate;
+
+    rate = spdif_in_nearest_rate(mixer_ctl_get_value(adev->spdif_rate_ctl, 0));
+    if (rate != __atomic_load_n(&adev->spdif_in_rate, __ATOMIC_RELAXED)) {
+        ALOGI("spdif receiver rate %u", rate);
+        __atomic_store_n(&adev->spdif_in_rate, rate, __ATOMIC_RELEASE);
+    }
+}
+
+/* follows receiver rate on control events of SPDIF mixer, timeout also
+ * reads it in case driver changes the rate without notification.
+ */
+static void *spdif_thread_loop(void *context)
+{
+    struct imx_audio_device *adev = (struct imx_audio_device *)context;
+    int ret;
+
+    while (!__atomic_load_n(&adev->spdif_exit, __ATOMIC_ACQUIRE)) {
+        ret = mixer_wait_event(adev->spdif_mixer, SPDIF_EVENT_TIMEOUT_MS);
+        if (ret > 0)
+            mixer_consume_event(adev->spdif_mixer);
+        else if (ret < 0)
+            usleep(SPDIF_EVENT_TIMEOUT_MS * 1000);
+        spdif_in_update_rate(adev);
+    }
+
+    return NULL;
+}
+
+/* resolves rate control on own mixer of SPDIF card, events of it are
+ * consumed by spdif thread only.
+ */
+static void spdif_in_monitor_start(struct imx_audio_device *adev, int card)
+{
+    adev->spdif_mixer = mixer_open(card);
+    if (!adev->spdif_mixer)
+        return;
+
+    adev->spdif_rate_ctl = mixer_get_ctl_by_name(adev->spdif_mixer, "RX Sample Rate");
+    if (!adev->spdif_rate_ctl) {
+        ALOGW("spdif receiver has no rate control");
+        goto fail;
+    }
+    if (mixer_subscribe_events(adev->spdif_mixer, 1) < 0)
+        ALOGW("spdif mixer events unavailable, rate is polled");
+
+    spdif_in_update_rate(adev);
+    if (pthread_create(&adev->spdif_thread, NULL, spdif_thread_loop, adev) == 0) {
+        adev->spdif_thread_started = true;
+        return;
+    }
+    mixer_subscribe_events(adev->spdif_mixer, 0);
+
+fail:
+    adev->spdif_rate_ctl = NULL;
+    mixer_close(adev->spdif_mixer);
+    adev->spdif_mixer = NULL;
+}
+
+static void spdif_in_monitor_stop(struct imx_audio_device *adev)
+{
+    if (adev->spdif_thread_started) {
+        __atomic_store_n(&adev->spdif_exit, true, __ATOMIC_RELEASE);
+        pthread_join(adev->spdif_thread, NULL);
+        adev->spdif_thread_started = false;
+        mixer_subscribe_events(adev->spdif_mixer, 0);
+    }
+    if (adev->spdif_mixer) {
+        mixer_close(adev->spdif_mixer);
+        adev->spdif_mixer = NULL;
+    }
+}
+
+/* must be called with input stream mutex locked */
+/* capture goes on at new receiver rate, only resampler is rebuilt */
+static int spdif_in_rate_check(struct imx_stream_in *in)
+{
+    struct imx_audio_device *adev = in->dev;
+    unsigned int rate;
+    int ret;
+
+    if (!adev->spdif_rate_ctl || adev->card_list[adev->in_card_idx] != &spdif_card)
+        return 0;
+
+    rate = __atomic_load_n(&adev->spdif_in_rate, __ATOMIC_ACQUIRE);
+    if (rate == 0 || rate == in->config.rate)
+        return 0;
+
+    ALOGW("spdif input rate changed to %d", rate);
+    in->config.rate = rate;
+    ret = update_input_resampler(in);
+    if (ret != 0)
+        ALOGE("spdif input resampler failed %d", ret);
+    return ret;
+}
+
+/* must be called with hw device and input stream mutexes locked */
+/* reads periods of capture PCM and queues them to ring of every client,
+ * a client behind by a whole kernel buffer loses the period.
+ */
+static void *capture_thread_loop(void *context)
+{
+    struct capture_engine *engine = (struct capture_engine *)context;
+    struct imx_stream_in *client;
+    struct timespec tstamp;
+    unsigned int avail = 0;
+    uint32_t xruns;
+    bool timed;
+    int ret;
     int i;
 
-    pthread_mutex_lock(&out->lock);
+    pthread_mutex_lock(&engine->lock);
+    while (!engine->exit) {
+        pthread_mutex_unlock(&engine->lock);
 
-    for (i = 0; i < PCM_TOTAL; i++)
-        if (out->pcm[i]) {
-            size_t avail;
-            if (pcm_get_htimestamp(out->pcm[i], &avail, timestamp) == 0) {
-                size_t kernel_buffer_size = out->config[i].period_size * out->config[i].period_count;
-		/*Actually we have no case for adev->default_rate != out->config[i].rate */
-                int64_t signed_frames = out->written - (kernel_buffer_size - avail) * adev->default_rate / out->config[i].rate;
-
-                if (signed_frames >= 0) {
-                    *frames = signed_frames;
-                    ret = 0;
+        xruns = engine->stats.xruns;
+        ret = pcm_read_wrapper(&engine->stats, engine->pcm, engine->buffer,
+                               engine->period_bytes, engine->read_flags);
+        timed = (ret == 0 && pcm_get_htimestamp(engine->pcm, &avail, &tstamp) == 0);
+
+        pthread_mutex_lock(&engine->lock);
+        if (ret == 0) {
+            for (i = 0; i < engine->clients_num; i++) {
+                client = engine->clients[i];
+                if (!audio_ring_write(&client->capture_ring, engine->buffer,
+                                      engine->period_bytes)) {
+                    client->capture_drops++;
+                    client->capture_xrun = true;
+                } else if (xruns != engine->stats.xruns) {
+                    client->capture_xrun = true;
                 }
-                break;
             }
+            if (timed) {
+                engine->avail = avail;
+                engine->tstamp = tstamp;
+            }
+            stats_fail_streak(&engine->stats, engine->fail_count);
+            engine->fail_count = 0;
+        } else {
+            engine->fail_count++;
         }
+        pthread_cond_broadcast(&engine->cond);
 
-    pthread_mutex_unlock(&out->lock);
+        if (ret != 0) {
+            /* period is lost, don't spin on a dead pcm */
+            pthread_mutex_unlock(&engine->lock);
+            usleep(engine->config.period_size * 1000000LL / engine->config.rate);
+            pthread_mutex_lock(&engine->lock);
+        }
+    }
+    pthread_mutex_unlock(&engine->lock);
 
-    return ret;
+    return NULL;
 }
 
-/** audio_stream_in implementation **/
-#define MID_RATE_0_8000  4000
-#define MID_RATE_8000_11025  ((8000+11025)/2)
-#define MID_RATE_11025_16000 ((11025+16000)/2)
-#define MID_RATE_16000_22050  ((16000+22050)/2)
-#define MID_RATE_22050_32000  ((22050+32000)/2)
-#define MID_RATE_32000_44100  ((32000+44100)/2)
-#define MID_RATE_44100_48000  ((44100+48000)/2)
-#define MID_RATE_48000_64000  ((48000+64000)/2)
-#define MID_RATE_64000_88200  ((64000+88200)/2)
-#define MID_RATE_88200_96000  ((88200+96000)/2)
-#define MID_RATE_96000_176400  ((96000+176400)/2)
-#define MID_RATE_176400_196000  ((176400+196000)/2)
+/* must be called with hw device mutex locked, opens PCM for first client.
+ * this assumes routing is done previously. mmap capture saves the copy
+ * of read syscall, fall back to read for cards that can't map the ring.
+ */
+static int capture_engine_start(struct imx_audio_device *adev, unsigned int card,
+                                unsigned int port, const struct pcm_config *config,
+                                int device)
+{
+    struct capture_engine *engine = &adev->capture;
+
+    engine->config = *config;
+    engine->read_flags = PCM_IN | PCM_MMAP | PCM_MONOTONIC;
+    engine->pcm = pcm_open(card, port, engine->read_flags, &engine->config);
+    if (!pcm_is_ready(engine->pcm)) {
+        ALOGW("mmap capture refused: %s", pcm_get_error(engine->pcm));
+        pcm_close(engine->pcm);
+        engine->read_flags &= ~PCM_MMAP;
+        engine->pcm = pcm_open(card, port, engine->read_flags, &engine->config);
+    }
+    if (!pcm_is_ready(engine->pcm)) {
+        ALOGE("cannot open pcm_in driver: %s", pcm_get_error(engine->pcm));
+        pcm_close(engine->pcm);
+        engine->pcm = NULL;
+        return -ENOMEM;
+    }
 
-static int spdif_in_rate_check(struct imx_stream_in *in)
+    engine->device = device;
+    engine->frame_bytes = pcm_frames_to_bytes(engine->pcm, 1);
+    engine->period_bytes = engine->config.period_size * engine->frame_bytes;
+    engine->buffer = malloc(engine->period_bytes);
+    engine->avail = 0;
+    memset(&engine->tstamp, 0, sizeof(engine->tstamp));
+    engine->fail_count = 0;
+    engine->exit = false;
+    if (engine->buffer == NULL ||
+            pthread_create(&engine->thread, NULL, capture_thread_loop, engine) != 0) {
+        ALOGE("cannot create capture thread");
+        free(engine->buffer);
+        engine->buffer = NULL;
+        pcm_close(engine->pcm);
+        engine->pcm = NULL;
+        return -ENOMEM;
+    }
+    engine->started = true;
+
+    return 0;
+}
+
+/* must be called with hw device mutex locked, after last client is gone */
+static void capture_engine_stop(struct imx_audio_device *adev)
+{
+    struct capture_engine *engine = &adev->capture;
+
+    if (!engine->started)
+        return;
+
+    pthread_mutex_lock(&engine->lock);
+    engine->exit = true;
+    pthread_mutex_unlock(&engine->lock);
+    pthread_join(engine->thread, NULL);
+
+    stats_fail_streak(&engine->stats, engine->fail_count);
+    engine->fail_count = 0;
+    pcm_close(engine->pcm);
+    engine->pcm = NULL;
+    free(engine->buffer);
+    engine->buffer = NULL;
+    engine->started = false;
+}
+
+/* must be called with hw device and input stream mutexes locked */
+static int capture_engine_attach(struct imx_stream_in *in)
+{
+    struct capture_engine *engine = &in->dev->capture;
+    /* a whole kernel buffer of slack before the client loses periods */
+    size_t size = engine->config.period_size * engine->config.period_count *
+                  engine->frame_bytes;
+
+    if (engine->clients_num >= MAX_CAPTURE_CLIENTS)
+        return -EBUSY;
+
+    if (in->capture_ring.data != NULL && in->capture_ring.size < size)
+        audio_ring_release(&in->capture_ring);
+    if (in->capture_ring.data == NULL &&
+            audio_ring_init(&in->capture_ring, size) != 0)
+        return -ENOMEM;
+    audio_ring_reset(&in->capture_ring);
+
+    pthread_mutex_lock(&engine->lock);
+    in->capture_xrun = false;
+    engine->clients[engine->clients_num++] = in;
+    pthread_mutex_unlock(&engine->lock);
+    in->attached = true;
+
+    return 0;
+}
+
+/* must be called with hw device and input stream mutexes locked */
+static void capture_engine_detach(struct imx_stream_in *in)
 {
     struct imx_audio_device *adev = in->dev;
-    int i = adev->in_card_idx;
-    int ret = 0;
+    struct capture_engine *engine = &adev->capture;
+    int i;
 
-    if(!strcmp(adev->card_list[i]->driver_name, "imx-spdif")) {
-        struct mixer_ctl *ctl;
-        unsigned int rate = 0;
-        struct mixer *mixer_spdif = adev->mixer[i];
-        ctl = mixer_get_ctl_by_name(mixer_spdif, "RX Sample Rate");
-        if (ctl) {
-            rate = mixer_ctl_get_value(ctl, 0);
-        }
-
-	if (rate <= MID_RATE_0_8000)
-		rate = 0;
-	else if (MID_RATE_0_8000 < rate && rate <= MID_RATE_8000_11025)
-		rate = 8000;
-	else if (MID_RATE_8000_11025 < rate && rate <= MID_RATE_11025_16000)
-		rate = 11025;
-	else if (MID_RATE_11025_16000 < rate && rate <= MID_RATE_16000_22050)
-		rate = 16000;
-	else if (MID_RATE_16000_22050 < rate && rate <= MID_RATE_22050_32000)
-		rate = 22050;
-	else if (MID_RATE_22050_32000 < rate && rate <= MID_RATE_32000_44100)
-		rate = 32000;
-	else if (MID_RATE_32000_44100 < rate && rate <= MID_RATE_44100_48000)
-		rate = 44100;
-	else if (MID_RATE_44100_48000 < rate && rate <= MID_RATE_48000_64000)
-		rate = 48000;
-	else if (MID_RATE_48000_64000 < rate && rate <= MID_RATE_64000_88200)
-		rate = 64000;
-	else if (MID_RATE_64000_88200 < rate && rate <= MID_RATE_88200_96000)
-		rate = 88200;
-	else if (MID_RATE_88200_96000 < rate && rate <= MID_RATE_96000_176400)
-		rate = 96000;
-	else if (MID_RATE_96000_176400 < rate && rate <= MID_RATE_176400_196000)
-		rate = 176400;
-	else
-		rate = 196000;
-
-	if (rate > 0 && rate != in->config.rate) {
-            in->config.rate = rate;
-            ALOGW("spdif input rate changed to %d", rate);
-
-            if (in->resampler) {
-                release_resampler(in->resampler);
-            }
+    if (!in->attached)
+        return;
 
-            if (in->requested_rate != in->config.rate) {
-                in->buf_provider.get_next_buffer = get_next_buffer;
-                in->buf_provider.release_buffer = release_buffer;
+    pthread_mutex_lock(&engine->lock);
+    for (i = 0; i < engine->clients_num; i++) {
+        if (engine->clients[i] == in) {
+            engine->clients[i] = engine->clients[--engine->clients_num];
+            engine->clients[engine->clients_num] = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&engine->lock);
+    in->attached = false;
 
-                ret = create_resampler(in->config.rate,
-                               in->requested_rate,
-                               in->requested_channel,
-                               RESAMPLER_QUALITY_DEFAULT,
-                               &in->buf_provider,
-                               &in->resampler);
-            }
+    if (engine->clients_num == 0)
+        capture_engine_stop(adev);
+}
+
+/* client waits for engine at most a few periods, then reads fail */
+#define CAPTURE_WAIT_NS  200000000LL
+
+/* copy captured frames of client ring, waits while engine reads more */
+static int capture_read(struct imx_stream_in *in, void *buffer, size_t bytes)
+{
+    struct capture_engine *engine = &in->dev->capture;
+    uint8_t *dst = (uint8_t *)buffer;
+    int64_t begin = stats_transfer_begin();
+    struct timespec ts;
+    const void *data;
+    size_t avail;
+    int ret = 0;
 
-            /* if no supported sample rate is available, use the resampler */
-            if (in->resampler) {
-                in->resampler->reset(in->resampler);
+    if (!in->attached)
+        return -ENODEV;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += (ts.tv_nsec + CAPTURE_WAIT_NS) / 1000000000LL;
+    ts.tv_nsec = (ts.tv_nsec + CAPTURE_WAIT_NS) % 1000000000LL;
+
+    while (bytes > 0) {
+        avail = audio_ring_peek(&in->capture_ring, &data);
+        if (avail == 0) {
+            pthread_mutex_lock(&engine->lock);
+            while (audio_ring_queued(&in->capture_ring) == 0 && ret == 0)
+                ret = pthread_cond_timedwait(&engine->cond, &engine->lock, &ts);
+            pthread_mutex_unlock(&engine->lock);
+            if (ret != 0) {
+                in->stats.transfer_errors++;
+                return -ret;
             }
+            continue;
         }
+
+        if (avail > bytes)
+            avail = bytes;
+        memcpy(dst, data, avail);
+        audio_ring_consume(&in->capture_ring, avail);
+        dst += avail;
+        bytes -= avail;
     }
 
+    stats_transfer_end(&in->stats, begin);
     return 0;
 }
 
-/* must be called with hw device and input stream mutexes locked */
+/* frames captured and not yet read by client, at time of last engine read */
+static int capture_get_htimestamp(struct imx_stream_in *in, size_t *frames,
+                                  struct timespec *tstamp)
+{
+    struct capture_engine *engine = &in->dev->capture;
+    int ret = -ENODATA;
+
+    if (!in->attached)
+        return -ENODEV;
+
+    pthread_mutex_lock(&engine->lock);
+    if (in->capture_xrun) {
+        /* frames lost are counted at this timestamp */
+        in->capture_xrun = false;
+        in->xrun_pending = true;
+        in->stats.xruns++;
+    }
+    if (engine->tstamp.tv_sec != 0 || engine->tstamp.tv_nsec != 0) {
+        *frames = engine->avail +
+                  audio_ring_queued(&in->capture_ring) / engine->frame_bytes;
+        *tstamp = engine->tstamp;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    return ret;
+}
+
+/* must be called with hw device mutex locked */
+static void update_active_input(struct imx_audio_device *adev)
+{
+    struct capture_engine *engine = &adev->capture;
+
+    adev->active_input = engine->clients_num > 0 ?
+                         engine->clients[engine->clients_num - 1] : NULL;
+}
+
 static int start_input_stream(struct imx_stream_in *in)
 {
     int ret = 0;
     int i;
     struct imx_audio_device *adev = in->dev;
+    struct capture_engine *engine = &adev->capture;
     unsigned int card = -1;
     unsigned int port = 0;
-    struct mixer *mixer;
-    int rate = 0, channels = 0, format = 0;
+    struct pcm_config config;
+    int format = 0;
 
     ALOGW("start_input_stream....");
 
+    /* mmap stream keeps capture PCM to itself */
+    if (adev->active_input != NULL && adev->active_input->mmap) {
+        ALOGW("capture pcm is held by mmap stream");
+        return -EBUSY;
+    }
+    /* clients of running engine share its device and pcm config */
+    if (engine->started && engine->device != in->device) {
+        ALOGW("capture engine runs device 0x%x, device 0x%x can't join",
+              engine->device, in->device);
+        return -EBUSY;
+    }
+
     adev->active_input = in;
     if (adev->mode != AUDIO_MODE_IN_CALL) {
         adev->in_device = in->device;
         select_input_device(adev);
     }
 
-    for(i = 0; i < MAX_AUDIO_CARD_NUM; i++) {
-        if(adev->in_device & adev->card_list[i]->supported_in_devices) {
-            card = adev->card_list[i]->card;
-            adev->in_card_idx = i;
-            port = 0;
-            break;
-        }
-        if(i == MAX_AUDIO_CARD_NUM-1) {
-            ALOGE("can not find supported device for %d",in->device);
-            return -EINVAL;
+    if (!engine->started) {
+        for(i = 0; i < MAX_AUDIO_CARD_NUM; i++) {
+            if(adev->in_device & adev->card_list[i]->supported_in_devices) {
+                card = adev->card_list[i]->card;
+                adev->in_card_idx = i;
+                port = 0;
+                break;
+            }
+            if(i == MAX_AUDIO_CARD_NUM-1) {
+                ALOGE("can not find supported device for %d",in->device);
+                update_active_input(adev);
+                return -EINVAL;
+            }
         }
-    }
 
-    /*Error handler for usb mic plug in/plug out when recording. */
-    memcpy(&in->config, &pcm_config_mm_in, sizeof(pcm_config_mm_in));
+        /*Error handler for usb mic plug in/plug out when recording. */
+        memcpy(&config, &pcm_config_mm_in, sizeof(pcm_config_mm_in));
 
-    in->config.stop_threshold = in->config.period_size * in->config.period_count;
+        config.stop_threshold = config.period_size * config.period_count;
 
-    if (in->device & AUDIO_DEVICE_IN_AUX_DIGITAL) {
-        format     = adev_get_format_for_device(adev, in->device, PCM_IN);
-        in->config.format  = format;
-    }
+        if (in->device & AUDIO_DEVICE_IN_AUX_DIGITAL) {
+            format     = adev_get_format_for_device(adev, in->device, PCM_IN);
+            config.format  = format;
+        }
 
-    ALOGW("card %d, port %d device 0x%x", card, port, in->device);
-    ALOGW("rate %d, channel %d format %d, period_size 0x%x", in->config.rate, in->config.channels, 
-                                 in->config.format, in->config.period_size);
+        ALOGW("card %d, port %d device 0x%x", card, port, in->device);
+        ALOGW("rate %d, channel %d format %d, period_size 0x%x", config.rate, config.channels,
+                                     config.format, config.period_size);
 
-    if (in->need_echo_reference && in->echo_reference == NULL)
-        in->echo_reference = get_echo_reference(adev,
-                                        AUDIO_FORMAT_PCM_16_BIT,
-                                        in->requested_channel,
-                                        in->requested_rate);
+        ret = capture_engine_start(adev, card, port, &config, in->device);
+        if (ret != 0) {
+            update_active_input(adev);
+            return ret;
+        }
+    }
 
-    /* this assumes routing is done previously */
-    in->pcm = pcm_open(card, port, PCM_IN, &in->config);
-    if (!pcm_is_ready(in->pcm)) {
-        ALOGE("cannot open pcm_in driver: %s", pcm_get_error(in->pcm));
-        pcm_close(in->pcm);
-        adev->active_input = NULL;
-        return -ENOMEM;
+    ret = capture_engine_attach(in);
+    if (ret != 0) {
+        ALOGE("cannot join capture engine: %d", ret);
+        if (engine->clients_num == 0)
+            capture_engine_stop(adev);
+        update_active_input(adev);
+        return ret;
+    }
+    in->config = engine->config;
+
+    /* one client at a time takes playback reference of AEC */
+    if (in->need_echo_reference && in->echo_reference == NULL &&
+            adev->echo_reference == NULL) {
+        in->echo_reference = get_echo_reference(adev);
+        in->ref_frames_in = 0;
+        if (in->echo_reference != NULL && in->echo_reference->rate != in->requested_rate &&
+                create_resampler(in->echo_reference->rate, in->requested_rate,
+                                 in->requested_channel, adev->resampler_quality,
+                                 NULL, &in->ref_resampler) != 0)
+            in->ref_resampler = NULL;
     }
 
+    /* conversion from pcm config to requested one, chosen once per start */
+    in->record_convert = get_record_convert(
+            in->config.format == PCM_FORMAT_S24_LE && in->requested_format == PCM_FORMAT_S16_LE,
+            in->config.channels == 1 && in->requested_channel == 2,
+            in->config.channels == 2 && in->requested_channel == 1);
+
+    /* position goes on from last reported one, frames buffered at standby are dropped */
+    in->frames_read = in->capture_frames;
+    in->xrun_pending = false;
+
     in->read_buf_frames = 0;
     in->read_buf_size   = 0;
     in->proc_buf_frames = 0;
     in->proc_buf_size = 0;
 
-    if (in->resampler) {
-        release_resampler(in->resampler);
-    }
-    if (in->requested_rate != in->config.rate) {
-        in->buf_provider.get_next_buffer = get_next_buffer;
-        in->buf_provider.release_buffer = release_buffer;
-
-        ret = create_resampler(in->config.rate,
-                               in->requested_rate,
-                               in->requested_channel,
-                               RESAMPLER_QUALITY_DEFAULT,
-                               &in->buf_provider,
-                               &in->resampler);
-    }
-
-    /* if no supported sample rate is available, use the resampler */
-    if (in->resampler) {
-        in->resampler->reset(in->resampler);
-    }
+    update_input_resampler(in);
     return 0;
 }
 
@@ -1725,26 +3000,39 @@ static int do_input_standby(struct imx_stream_in *in)
 {
     struct imx_audio_device *adev = in->dev;
 
+    /* client maps the ring until the stream is closed, only stop it */
+    if (in->mmap && in->pcm != NULL) {
+        pcm_stop(in->pcm);
+        return 0;
+    }
+
     if (!in->standby) {
         ALOGW("do_in_standby..");
-        pcm_close(in->pcm);
-        in->pcm = NULL;
-        in->last_time_of_xrun = 0;
-
-        adev->active_input = 0;
-        if (adev->mode != AUDIO_MODE_IN_CALL) {
-            adev->in_device = AUDIO_DEVICE_NONE;
-            select_input_device(adev);
+        if (!in->mmap)
+            capture_engine_detach(in);
+
+        /* other clients of capture engine keep the mic routed */
+        if (adev->active_input == in || adev->active_input == NULL) {
+            update_active_input(adev);
+            if (adev->mode != AUDIO_MODE_IN_CALL) {
+                adev->in_device = adev->active_input != NULL ?
+                                  adev->active_input->device : AUDIO_DEVICE_NONE;
+                select_input_device(adev);
+            }
         }
 
         if (in->echo_reference != NULL) {
             /* stop reading from echo reference */
-            in->echo_reference->read(in->echo_reference, NULL);
             put_echo_reference(adev, in->echo_reference);
             in->echo_reference = NULL;
         }
+        if (in->ref_resampler) {
+            release_resampler(in->ref_resampler);
+            in->ref_resampler = NULL;
+        }
 
         in->standby = 1;
+        in->stats.standbys++;
     }
     return 0;
 }
@@ -1762,8 +3050,20 @@ static int in_standby(struct audio_stream *stream)
     return status;
 }
 
+/* counters are read without stream mutex, as in out_dump */
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+    struct imx_stream_in *in = (struct imx_stream_in *)stream;
+
+    dprintf(fd, "  imx input %p: %s, device 0x%x, source %d\n", in,
+            in->standby ? "standby" : "active", in->device, in->source);
+    dprintf(fd, "    pcm rate %u, channels %u, period %u x %u, requested rate %u, channels %u\n",
+            in->config.rate, in->config.channels, in->config.period_size,
+            in->config.period_count, in->requested_rate, in->requested_channel);
+    dprintf(fd, "    position %lld at %lld ns, pending lost frames %u, engine drops %u\n",
+            (long long)in->capture_frames, (long long)in->capture_time_ns,
+            in->frames_lost, in->capture_drops);
+    stats_dump(&in->stats, fd, "read stats");
     return 0;
 }
 
@@ -1826,33 +3126,26 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
     return 0;
 }
 
-static void get_capture_delay(struct imx_stream_in *in,
-                       size_t frames,
-                       struct echo_reference_buffer *buffer)
+/* capture time of first frame buffered in HAL, 0 if unknown */
+static int64_t get_capture_time(struct imx_stream_in *in)
 {
 
     /* read frames available in kernel driver buffer */
     size_t kernel_frames;
     struct timespec tstamp;
-    long buf_delay;
-    long rsmp_delay;
-    long kernel_delay;
-    long delay_ns;
-
-    if (pcm_get_htimestamp(in->pcm, &kernel_frames, &tstamp) < 0) {
-        buffer->time_stamp.tv_sec  = 0;
-        buffer->time_stamp.tv_nsec = 0;
-        buffer->delay_ns           = 0;
-        ALOGW("read get_capture_delay(): pcm_htimestamp error");
-        return;
+    int64_t buf_delay;
+    int64_t rsmp_delay;
+    int64_t kernel_delay;
+
+    if (capture_get_htimestamp(in, &kernel_frames, &tstamp) < 0) {
+        ALOGW("read get_capture_time(): capture timestamp error");
+        return 0;
     }
 
-    /* read frames available in audio HAL input buffer
-     * add number of frames being read as we want the capture time of first sample
-     * in current buffer */
-    buf_delay = (long)(((int64_t)(in->read_buf_frames) * 1000000000) / in->config.rate +
-                       ((int64_t)(in->proc_buf_frames) * 1000000000) /
-                           in->requested_rate);
+    /* read frames available in audio HAL input buffer, these are older
+     * than the ones still in kernel */
+    buf_delay = ((int64_t)(in->read_buf_frames) * 1000000000) / in->config.rate +
+                ((int64_t)(in->proc_buf_frames) * 1000000000) / in->requested_rate;
 
     /* add delay introduced by resampler */
     rsmp_delay = 0;
@@ -1860,52 +3153,85 @@ static void get_capture_delay(struct imx_stream_in *in,
         rsmp_delay = in->resampler->delay_ns(in->resampler);
     }
 
-    kernel_delay = (long)(((int64_t)kernel_frames * 1000000000) / in->config.rate);
-
-    delay_ns = kernel_delay + buf_delay + rsmp_delay;
-
-    buffer->time_stamp = tstamp;
-    buffer->delay_ns   = delay_ns;
-    ALOGV("get_capture_delay time_stamp = [%ld].[%ld], delay_ns: [%d],"
-         " kernel_delay:[%ld], buf_delay:[%ld], rsmp_delay:[%ld], kernel_frames:[%d], "
-         "in->read_buf_frames:[%d], in->proc_buf_frames:[%d], frames:[%d]",
-         buffer->time_stamp.tv_sec , buffer->time_stamp.tv_nsec, buffer->delay_ns,
-         kernel_delay, buf_delay, rsmp_delay, kernel_frames,
-         in->read_buf_frames, in->proc_buf_frames, frames);
+    kernel_delay = ((int64_t)kernel_frames * 1000000000) / in->config.rate;
 
+    ALOGV("get_capture_time time_stamp = [%ld].[%ld], kernel_delay:[%lld], buf_delay:[%lld], "
+          "rsmp_delay:[%lld]", tstamp.tv_sec, tstamp.tv_nsec, (long long)kernel_delay,
+          (long long)buf_delay, (long long)rsmp_delay);
+    return (int64_t)tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec -
+           kernel_delay - buf_delay - rsmp_delay;
 }
 
+/* move playback blocks from echo ring to ref_buf until frames are buffered,
+ * returns echo delay of first frame in ref_buf.
+ */
 static int32_t update_echo_reference(struct imx_stream_in *in, size_t frames)
 {
-    struct echo_reference_buffer b;
-    b.delay_ns = 0;
+    struct echo_ring *echo = in->echo_reference;
+    struct echo_block block;
+    size_t block_bytes;
+    size_t in_frames, out_frames, room;
+    int64_t capture_ns = get_capture_time(in);
+    int64_t delay_ns;
+    size_t i;
+
+    while (in->ref_frames_in < frames &&
+            audio_ring_read(&echo->ring, &block, sizeof(block))) {
+        block_bytes = block.frames * echo->channels * sizeof(int16_t);
+        if (in->ref_tmp_size < block.frames) {
+            in->ref_tmp_size = block.frames;
+            in->ref_tmp = (int16_t *)realloc(in->ref_tmp, block_bytes);
+        }
+        if (!audio_ring_read(&echo->ring, in->ref_tmp, block_bytes))
+            break;
+
+        /* played out before first captured frame, its echo is gone */
+        if (capture_ns > 0 && block.render_ns +
+                (int64_t)block.frames * 1000000000LL / echo->rate < capture_ns)
+            continue;
+
+        if (echo->channels == 2 && in->requested_channel == 1) {
+            for (i = 0; i < block.frames; i++)
+                in->ref_tmp[i] = (in->ref_tmp[2 * i] + in->ref_tmp[2 * i + 1]) / 2;
+        } else if (echo->channels != in->requested_channel) {
+            continue;
+        }
 
-    ALOGV("update_echo_reference, frames = [%d], in->ref_frames_in = [%d],  "
-          "b.frame_count = [%d]",
-         frames, in->ref_frames_in, frames - in->ref_frames_in);
-    if (in->ref_frames_in < frames) {
-        if (in->ref_buf_size < frames) {
-            in->ref_buf_size = frames;
+        room = (size_t)((int64_t)block.frames * in->requested_rate / echo->rate) + 16;
+        if (in->ref_buf_size < in->ref_frames_in + room) {
+            in->ref_buf_size = in->ref_frames_in + room;
             in->ref_buf = (int16_t *)realloc(in->ref_buf,
                                              in->ref_buf_size *
                                                  in->requested_channel * sizeof(int16_t));
         }
 
-        b.frame_count = frames - in->ref_frames_in;
-        b.raw = (void *)(in->ref_buf + in->ref_frames_in * in->requested_channel);
+        in_frames = block.frames;
+        out_frames = room;
+        if (in->ref_resampler) {
+            in->ref_resampler->resample_from_input(in->ref_resampler, in->ref_tmp, &in_frames,
+                    in->ref_buf + in->ref_frames_in * in->requested_channel, &out_frames);
+        } else {
+            out_frames = in_frames;
+            memcpy(in->ref_buf + in->ref_frames_in * in->requested_channel, in->ref_tmp,
+                   out_frames * in->requested_channel * sizeof(int16_t));
+        }
 
-        get_capture_delay(in, frames, &b);
+        if (in->ref_frames_in == 0)
+            in->ref_render_ns = block.render_ns;
+        in->ref_frames_in += out_frames;
+    }
 
-        if (in->echo_reference->read(in->echo_reference, &b) == 0)
-        {
-            in->ref_frames_in += b.frame_count;
-            ALOGV("update_echo_reference: in->ref_frames_in:[%d], "
-                    "in->ref_buf_size:[%d], frames:[%d], b.frame_count:[%d]",
-                 in->ref_frames_in, in->ref_buf_size, frames, b.frame_count);
-        }
-    } else
-        ALOGV("update_echo_reference: NOT enough frames to read ref buffer");
-    return b.delay_ns;
+    ALOGV("update_echo_reference: in->ref_frames_in:[%d], frames:[%d]",
+          in->ref_frames_in, frames);
+    if (in->ref_frames_in == 0 || capture_ns == 0)
+        return 0;
+
+    /* reference is handed to AEC with capture of capture_ns, its echo
+     * shows up in capture after this delay */
+    delay_ns = in->ref_render_ns - capture_ns;
+    if (delay_ns < 0)
+        delay_ns = 0;
+    return (int32_t)delay_ns;
 }
 
 static int set_preprocessor_param(effect_handle_t handle,
@@ -1966,10 +3292,11 @@ static void push_echo_reference(struct imx_stream_in *in, size_t frames)
     }
 
     in->ref_frames_in -= buf.frameCount;
+    in->ref_render_ns += (int64_t)buf.frameCount * 1000000000LL / in->requested_rate;
     if (in->ref_frames_in) {
-        memcpy(in->ref_buf,
-               in->ref_buf + buf.frameCount * in->requested_channel,
-               in->ref_frames_in * in->requested_channel * sizeof(int16_t));
+        memmove(in->ref_buf,
+                in->ref_buf + buf.frameCount * in->requested_channel,
+                in->ref_frames_in * in->requested_channel * sizeof(int16_t));
     }
 }
 
@@ -1984,7 +3311,7 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
     in = (struct imx_stream_in *)((char *)buffer_provider -
                                    offsetof(struct imx_stream_in, buf_provider));
 
-    if (in->pcm == NULL) {
+    if (!in->attached) {
         buffer->raw = NULL;
         buffer->frame_count = 0;
         in->read_status = -ENODEV;
@@ -2002,7 +3329,7 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
                   in->read_buf, size_in_bytes);
         }
 
-        in->read_status = pcm_read_convert(in, in->pcm, (void*)in->read_buf, size_in_bytes);
+        in->read_status = pcm_read_convert(in, (void*)in->read_buf, size_in_bytes);
 
         if (in->read_status != 0) {
             ALOGE("get_next_buffer() pcm_read_convert error %d", in->read_status);
@@ -2049,6 +3376,12 @@ static ssize_t read_frames(struct imx_stream_in *in, void *buffer, ssize_t frame
                     (int16_t *)((char *)buffer +
                             frames_wr * audio_stream_frame_size(&in->stream.common)),
                     &frames_rd);
+        } else if (in->read_buf_frames == 0) {
+            /* nothing left over in read_buf, convert or read straight
+             * into caller buffer */
+            in->read_status = pcm_read_convert(in,
+                    (char *)buffer + frames_wr * audio_stream_frame_size(&in->stream.common),
+                    frames_rd * audio_stream_frame_size(&in->stream.common));
         } else {
             struct resampler_buffer buf = {
                     { raw : NULL, },
@@ -2151,9 +3484,9 @@ static ssize_t process_frames(struct imx_stream_in *in, void* buffer, ssize_t fr
          * move remaining frames to the beginning of in->proc_buf */
         in->proc_buf_frames -= in_buf.frameCount;
         if (in->proc_buf_frames) {
-            memcpy(in->proc_buf_in,
-                   in->proc_buf_in + in_buf.frameCount * in->requested_channel,
-                   in->proc_buf_frames * in->requested_channel * sizeof(int16_t));
+            memmove(in->proc_buf_in,
+                    in->proc_buf_in + in_buf.frameCount * in->requested_channel,
+                    in->proc_buf_frames * in->requested_channel * sizeof(int16_t));
         }
 
         /* if not enough frames were passed to process(), read more and retry. */
@@ -2200,6 +3533,63 @@ static ssize_t process_frames(struct imx_stream_in *in, void* buffer, ssize_t fr
     return frames_wr;
 }
 
+/* must be called with input stream mutex locked */
+static void update_capture_position(struct imx_stream_in *in)
+{
+    size_t kernel_frames;
+    struct timespec tstamp;
+    int64_t buffered;
+    int64_t frames;
+
+    if (capture_get_htimestamp(in, &kernel_frames, &tstamp) < 0)
+        return;
+
+    /* frames captured at tstamp: delivered, kernel, engine and HAL buffered ones */
+    buffered = (int64_t)(kernel_frames + in->read_buf_frames) * in->requested_rate /
+                   in->config.rate + in->proc_buf_frames;
+    frames = in->frames_read + buffered;
+
+    if (in->xrun_pending && in->capture_time_ns > 0) {
+        int64_t time_ns = (int64_t)tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec;
+        int64_t expected = in->capture_frames +
+                (time_ns - in->capture_time_ns) * in->requested_rate / 1000000000LL;
+
+        if (expected > frames) {
+            ALOGW("capture xrun, %lld frames lost", (long long)(expected - frames));
+            in->frames_lost += expected - frames;
+            in->frames_read += expected - frames;
+            frames = expected;
+        }
+    }
+    in->xrun_pending = false;
+
+    if (frames < in->capture_frames)
+        return;
+
+    in->capture_frames = frames;
+    in->capture_time_ns = (int64_t)tstamp.tv_sec * 1000000000LL + tstamp.tv_nsec;
+}
+
+static int in_get_capture_position(const struct audio_stream_in *stream,
+                                   int64_t *frames, int64_t *time)
+{
+    struct imx_stream_in *in = (struct imx_stream_in *)stream;
+    int ret = -ENOSYS;
+
+    if (frames == NULL || time == NULL)
+        return -EINVAL;
+
+    pthread_mutex_lock(&in->lock);
+    if (!in->standby && in->attached && in->capture_time_ns > 0) {
+        *frames = in->capture_frames;
+        *time = in->capture_time_ns;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&in->lock);
+
+    return ret;
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
                        size_t bytes)
 {
@@ -2208,6 +3598,8 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     struct imx_audio_device *adev = in->dev;
     size_t frames_rq = bytes / audio_stream_frame_size(&stream->common);
 
+    ATRACE_BEGIN(__func__);
+
     /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
      * on the input stream mutex - e.g. executing select_mode() while holding the hw device
      * mutex
@@ -2233,13 +3625,18 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     else if (in->resampler != NULL)
         ret = read_frames(in, buffer, frames_rq);
     else
-        ret = pcm_read_convert(in, in->pcm, buffer, bytes);
+        ret = pcm_read_convert(in, buffer, bytes);
 
-    if(ret < 0) ALOGW("ret %d, pcm read error %s.", ret, pcm_get_error(in->pcm));
+    if(ret < 0) ALOGW("ret %d, capture read error.", ret);
 
     if (ret > 0)
         ret = 0;
 
+    if (ret == 0) {
+        in->frames_read += frames_rq;
+        update_capture_position(in);
+    }
+
     if (ret == 0 && adev->mic_mute)
         memset(buffer, 0, bytes);
 
@@ -2261,25 +3658,22 @@ exit:
     }
     pthread_mutex_unlock(&in->lock);
 
+    ATRACE_END();
     return bytes;
 }
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-    int times, diff;
     struct imx_stream_in *in = (struct imx_stream_in *)stream;
-    if (in->pcm == NULL)  return 0;
+    uint32_t lost;
 
-    if(pcm_get_time_of_xrun == NULL) {
-        times = 0;
-    } else {
-        times = pcm_get_time_of_xrun(in->pcm);
-    }
+    pthread_mutex_lock(&in->lock);
+    lost = in->frames_lost;
+    in->frames_lost = 0;
+    pthread_mutex_unlock(&in->lock);
 
-    diff = times - in->last_time_of_xrun;
-    ALOGW_IF((diff != 0), "in_get_input_frames_lost %d ms total %d ms\n",diff, times);
-    in->last_time_of_xrun = times;
-    return diff * in->requested_rate / 1000;
+    ALOGW_IF((lost != 0), "in_get_input_frames_lost %u frames", lost);
+    return lost;
 }
 
 #define GET_COMMAND_STATUS(status, fct_status, cmd_status) \
@@ -2568,112 +3962,409 @@ static int in_add_audio_effect(const struct audio_stream *stream,
     int status;
     effect_descriptor_t desc;
 
-    pthread_mutex_lock(&in->dev->lock);
+    pthread_mutex_lock(&in->dev->lock);
+    pthread_mutex_lock(&in->lock);
+    if (in->num_preprocessors >= MAX_PREPROCESSORS) {
+        status = -ENOSYS;
+        goto exit;
+    }
+
+    status = (*effect)->get_descriptor(effect, &desc);
+    if (status != 0)
+        goto exit;
+
+    in->preprocessors[in->num_preprocessors].effect_itfe = effect;
+    /* add the supported channel of the effect in the channel_configs */
+    in_read_audio_effect_channel_configs(in, &in->preprocessors[in->num_preprocessors]);
+
+    in->num_preprocessors++;
+
+    /* check compatibility between main channel supported and possible auxiliary channels */
+    in_update_aux_channels(in, effect);
+
+    ALOGV("in_add_audio_effect(), effect type: %08x", desc.type.timeLow);
+
+    if (memcmp(&desc.type, FX_IID_AEC, sizeof(effect_uuid_t)) == 0) {
+        in->need_echo_reference = true;
+        do_input_standby(in);
+        in_configure_reverse(in);
+    }
+
+exit:
+
+    ALOGW_IF(status != 0, "in_add_audio_effect() error %d", status);
+    pthread_mutex_unlock(&in->lock);
+    pthread_mutex_unlock(&in->dev->lock);
+    return status;
+}
+
+static int in_remove_audio_effect(const struct audio_stream *stream,
+                                  effect_handle_t effect)
+{
+    struct imx_stream_in *in = (struct imx_stream_in *)stream;
+    int i;
+    int status = -EINVAL;
+    effect_descriptor_t desc;
+
+    pthread_mutex_lock(&in->dev->lock);
+    pthread_mutex_lock(&in->lock);
+    if (in->num_preprocessors <= 0) {
+        status = -ENOSYS;
+        goto exit;
+    }
+
+    for (i = 0; i < in->num_preprocessors; i++) {
+        if (status == 0) { /* status == 0 means an effect was removed from a previous slot */
+            in->preprocessors[i - 1].effect_itfe = in->preprocessors[i].effect_itfe;
+            in->preprocessors[i - 1].channel_configs = in->preprocessors[i].channel_configs;
+            in->preprocessors[i - 1].num_channel_configs = in->preprocessors[i].num_channel_configs;
+            ALOGV("in_remove_audio_effect moving fx from %d to %d", i, i - 1);
+            continue;
+        }
+        if (in->preprocessors[i].effect_itfe == effect) {
+            ALOGV("in_remove_audio_effect found fx at index %d", i);
+            free(in->preprocessors[i].channel_configs);
+            status = 0;
+        }
+    }
+
+    if (status != 0)
+        goto exit;
+
+    in->num_preprocessors--;
+    /* if we remove one effect, at least the last preproc should be reset */
+    in->preprocessors[in->num_preprocessors].num_channel_configs = 0;
+    in->preprocessors[in->num_preprocessors].effect_itfe = NULL;
+    in->preprocessors[in->num_preprocessors].channel_configs = NULL;
+
+
+    /* check compatibility between main channel supported and possible auxiliary channels */
+    in_update_aux_channels(in, NULL);
+
+    status = (*effect)->get_descriptor(effect, &desc);
+    if (status != 0)
+        goto exit;
+
+    ALOGV("in_remove_audio_effect(), effect type: %08x", desc.type.timeLow);
+
+    if (memcmp(&desc.type, FX_IID_AEC, sizeof(effect_uuid_t)) == 0) {
+        in->need_echo_reference = false;
+        do_input_standby(in);
+    }
+
+exit:
+
+    ALOGW_IF(status != 0, "in_remove_audio_effect() error %d", status);
+    pthread_mutex_unlock(&in->lock);
+    pthread_mutex_unlock(&in->dev->lock);
+    return status;
+}
+
+/** AAudio mmap no-irq streams **/
+/* cards whose DMA buffer is exported to AAudio clients */
+static bool mmap_card_supported(struct imx_audio_device *adev, int card_index)
+{
+    const char *name;
+
+    if (card_index < 0 || card_index >= MAX_AUDIO_CARD_NUM || adev->card_list[card_index] == NULL)
+        return false;
+
+    name = adev->card_list[card_index]->driver_name;
+    return !strcmp(name, "wm8960-audio") || !strcmp(name, "wm8962-audio");
+}
+
+/* open pcm of mmap stream and describe its ring for the client, the
+ * pcm fd is shared and client maps the DMA buffer through it.
+ */
+static int mmap_buffer_open(struct pcm **pcm, unsigned int card, unsigned int flags,
+                            struct pcm_config *config, int32_t min_size_frames,
+                            struct audio_mmap_buffer_info *info)
+{
+    unsigned int offset = 0;
+    unsigned int frames = 0;
+    unsigned int count;
+    int ret;
+
+    count = (min_size_frames + config->period_size - 1) / config->period_size;
+    if (count < MMAP_PERIOD_COUNT_MIN)
+        count = MMAP_PERIOD_COUNT_MIN;
+    if (count > MMAP_PERIOD_COUNT_MAX)
+        count = MMAP_PERIOD_COUNT_MAX;
+    config->period_count = count;
+
+    *pcm = pcm_open(card, PORT_MM, flags | PCM_MMAP | PCM_NOIRQ | PCM_MONOTONIC, config);
+    if (!pcm_is_ready(*pcm)) {
+        ALOGE("%s: cannot open pcm: %s", __func__, pcm_get_error(*pcm));
+        pcm_close(*pcm);
+        *pcm = NULL;
+        return -ENODEV;
+    }
+
+    ret = pcm_prepare(*pcm);
+    if (ret == 0) {
+        frames = pcm_get_buffer_size(*pcm);
+        ret = pcm_mmap_begin(*pcm, &info->shared_memory_address, &offset, &frames);
+    }
+    if (ret < 0) {
+        ALOGE("%s: mmap of pcm failed: %s", __func__, pcm_get_error(*pcm));
+        pcm_close(*pcm);
+        *pcm = NULL;
+        return -ENODEV;
+    }
+
+    info->buffer_size_frames = pcm_get_buffer_size(*pcm);
+    info->burst_size_frames = config->period_size;
+    info->shared_memory_fd = pcm_get_poll_fd(*pcm);
+    if (!(flags & PCM_IN))
+        memset(info->shared_memory_address, 0,
+               pcm_frames_to_bytes(*pcm, info->buffer_size_frames));
+
+    ALOGI("%s: card %d, %d frames, burst %d", __func__, card,
+          info->buffer_size_frames, info->burst_size_frames);
+    return 0;
+}
+
+/* DMA position in frames since start, with its monotonic time */
+static int mmap_get_position(struct pcm *pcm, struct audio_mmap_position *position)
+{
+    struct timespec ts = { 0, 0 };
+    unsigned int hw_ptr = 0;
+    int ret;
+
+    if (pcm == NULL)
+        return -ENOSYS;
+
+    ret = pcm_mmap_get_hw_ptr(pcm, &hw_ptr, &ts);
+    if (ret < 0) {
+        ALOGE("%s: %s", __func__, pcm_get_error(pcm));
+        return ret;
+    }
+
+    position->position_frames = hw_ptr;
+    position->time_nanoseconds = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return 0;
+}
+
+static int out_create_mmap_buffer(const struct audio_stream_out *stream,
+                                  int32_t min_size_frames,
+                                  struct audio_mmap_buffer_info *info)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    struct imx_audio_device *adev = out->dev;
+    int card;
+    int ret;
+
+    if (info == NULL || min_size_frames <= 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&adev->lock);
+    pthread_mutex_lock(&out->lock);
+    if (out->pcm[PCM_NORMAL] != NULL) {
+        ret = -ENOSYS;
+        goto exit;
+    }
+
+    card = get_card_for_device(adev, out->device, PCM_OUT, &out->card_index);
+    if (!mmap_card_supported(adev, out->card_index)) {
+        ALOGW("%s: card of device 0x%x has no mmap support", __func__, out->device);
+        ret = -ENOSYS;
+        goto exit;
+    }
+
+    if (adev->mode != AUDIO_MODE_IN_CALL)
+        select_output_device(adev);
+
+    out->config[PCM_NORMAL] = pcm_config_mmap;
+    out->write_flags[PCM_NORMAL] = PCM_OUT | PCM_MMAP | PCM_NOIRQ | PCM_MONOTONIC;
+    ret = mmap_buffer_open(&out->pcm[PCM_NORMAL], card, PCM_OUT,
+                           &out->config[PCM_NORMAL], min_size_frames, info);
+    if (ret == 0)
+        out->standby = 0;
+
+exit:
+    pthread_mutex_unlock(&out->lock);
+    pthread_mutex_unlock(&adev->lock);
+    return ret;
+}
+
+static int out_get_mmap_position(const struct audio_stream_out *stream,
+                                 struct audio_mmap_position *position)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    int ret;
+
+    if (position == NULL)
+        return -EINVAL;
+
+    /* pcm is closed with the stream, read it under the stream lock */
+    pthread_mutex_lock(&out->lock);
+    ret = mmap_get_position(out->pcm[PCM_NORMAL], position);
+    pthread_mutex_unlock(&out->lock);
+    return ret;
+}
+
+static int out_start(const struct audio_stream_out *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    int ret = -ENOSYS;
+
+    pthread_mutex_lock(&out->lock);
+    if (out->pcm[PCM_NORMAL] != NULL)
+        ret = pcm_start(out->pcm[PCM_NORMAL]);
+    pthread_mutex_unlock(&out->lock);
+    return ret;
+}
+
+static int out_stop(const struct audio_stream_out *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
+    int ret = -ENOSYS;
+
+    pthread_mutex_lock(&out->lock);
+    if (out->pcm[PCM_NORMAL] != NULL)
+        ret = pcm_stop(out->pcm[PCM_NORMAL]);
+    pthread_mutex_unlock(&out->lock);
+    return ret;
+}
+
+/* shared buffer belongs to the client until the stream is closed */
+static int out_standby_mmap(struct audio_stream *stream)
+{
+    return out_stop((struct audio_stream_out *)stream);
+}
+
+static ssize_t out_write_mmap(struct audio_stream_out *stream, const void* buffer,
+                         size_t bytes)
+{
+    ALOGE("%s: mmap stream is not written", __func__);
+    return -ENOSYS;
+}
+
+static int in_create_mmap_buffer(const struct audio_stream_in *stream,
+                                 int32_t min_size_frames,
+                                 struct audio_mmap_buffer_info *info)
+{
+    struct imx_stream_in *in = (struct imx_stream_in *)stream;
+    struct imx_audio_device *adev = in->dev;
+    int card;
+    int card_index;
+    int ret;
+
+    if (info == NULL || min_size_frames <= 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&adev->lock);
     pthread_mutex_lock(&in->lock);
-    if (in->num_preprocessors >= MAX_PREPROCESSORS) {
-        status = -ENOSYS;
+    if (in->pcm != NULL || (adev->active_input != NULL && adev->active_input != in)) {
+        ret = -ENOSYS;
         goto exit;
     }
 
-    status = (*effect)->get_descriptor(effect, &desc);
-    if (status != 0)
+    card = get_card_for_device(adev, in->device, PCM_IN, &card_index);
+    if (!mmap_card_supported(adev, card_index)) {
+        ALOGW("%s: card of device 0x%x has no mmap support", __func__, in->device);
+        ret = -ENOSYS;
         goto exit;
+    }
 
-    in->preprocessors[in->num_preprocessors].effect_itfe = effect;
-    /* add the supported channel of the effect in the channel_configs */
-    in_read_audio_effect_channel_configs(in, &in->preprocessors[in->num_preprocessors]);
-
-    in->num_preprocessors++;
-
-    /* check compatibility between main channel supported and possible auxiliary channels */
-    in_update_aux_channels(in, effect);
-
-    ALOGV("in_add_audio_effect(), effect type: %08x", desc.type.timeLow);
-
-    if (memcmp(&desc.type, FX_IID_AEC, sizeof(effect_uuid_t)) == 0) {
-        in->need_echo_reference = true;
-        do_input_standby(in);
-        in_configure_reverse(in);
+    adev->active_input = in;
+    if (adev->mode != AUDIO_MODE_IN_CALL) {
+        adev->in_device = in->device;
+        select_input_device(adev);
     }
+    adev->in_card_idx = card_index;
 
-exit:
+    in->config = pcm_config_mmap;
+    in->config.rate = pcm_config_mm_in.rate;
+    ret = mmap_buffer_open(&in->pcm, card, PCM_IN, &in->config, min_size_frames, info);
+    if (ret == 0)
+        in->standby = 0;
+    else
+        adev->active_input = NULL;
 
-    ALOGW_IF(status != 0, "in_add_audio_effect() error %d", status);
+exit:
     pthread_mutex_unlock(&in->lock);
-    pthread_mutex_unlock(&in->dev->lock);
-    return status;
+    pthread_mutex_unlock(&adev->lock);
+    return ret;
 }
 
-static int in_remove_audio_effect(const struct audio_stream *stream,
-                                  effect_handle_t effect)
+static int in_get_mmap_position(const struct audio_stream_in *stream,
+                                struct audio_mmap_position *position)
 {
     struct imx_stream_in *in = (struct imx_stream_in *)stream;
-    int i;
-    int status = -EINVAL;
-    effect_descriptor_t desc;
+    int ret;
 
-    pthread_mutex_lock(&in->dev->lock);
-    pthread_mutex_lock(&in->lock);
-    if (in->num_preprocessors <= 0) {
-        status = -ENOSYS;
-        goto exit;
-    }
+    if (position == NULL)
+        return -EINVAL;
 
-    for (i = 0; i < in->num_preprocessors; i++) {
-        if (status == 0) { /* status == 0 means an effect was removed from a previous slot */
-            in->preprocessors[i - 1].effect_itfe = in->preprocessors[i].effect_itfe;
-            in->preprocessors[i - 1].channel_configs = in->preprocessors[i].channel_configs;
-            in->preprocessors[i - 1].num_channel_configs = in->preprocessors[i].num_channel_configs;
-            ALOGV("in_remove_audio_effect moving fx from %d to %d", i, i - 1);
-            continue;
-        }
-        if (in->preprocessors[i].effect_itfe == effect) {
-            ALOGV("in_remove_audio_effect found fx at index %d", i);
-            free(in->preprocessors[i].channel_configs);
-            status = 0;
-        }
-    }
+    pthread_mutex_lock(&in->lock);
+    ret = mmap_get_position(in->pcm, position);
+    pthread_mutex_unlock(&in->lock);
+    return ret;
+}
 
-    if (status != 0)
-        goto exit;
+static int in_start(const struct audio_stream_in *stream)
+{
+    struct imx_stream_in *in = (struct imx_stream_in *)stream;
+    int ret = -ENOSYS;
 
-    in->num_preprocessors--;
-    /* if we remove one effect, at least the last preproc should be reset */
-    in->preprocessors[in->num_preprocessors].num_channel_configs = 0;
-    in->preprocessors[in->num_preprocessors].effect_itfe = NULL;
-    in->preprocessors[in->num_preprocessors].channel_configs = NULL;
+    pthread_mutex_lock(&in->lock);
+    if (in->pcm != NULL)
+        ret = pcm_start(in->pcm);
+    pthread_mutex_unlock(&in->lock);
+    return ret;
+}
 
+static int in_stop(const struct audio_stream_in *stream)
+{
+    struct imx_stream_in *in = (struct imx_stream_in *)stream;
+    int ret = -ENOSYS;
 
-    /* check compatibility between main channel supported and possible auxiliary channels */
-    in_update_aux_channels(in, NULL);
+    pthread_mutex_lock(&in->lock);
+    if (in->pcm != NULL)
+        ret = pcm_stop(in->pcm);
+    pthread_mutex_unlock(&in->lock);
+    return ret;
+}
 
-    status = (*effect)->get_descriptor(effect, &desc);
-    if (status != 0)
-        goto exit;
+static int in_standby_mmap(struct audio_stream *stream)
+{
+    return in_stop((struct audio_stream_in *)stream);
+}
 
-    ALOGV("in_remove_audio_effect(), effect type: %08x", desc.type.timeLow);
+static ssize_t in_read_mmap(struct audio_stream_in *stream, void* buffer,
+                       size_t bytes)
+{
+    ALOGE("%s: mmap stream is not read", __func__);
+    return -ENOSYS;
+}
 
-    if (memcmp(&desc.type, FX_IID_AEC, sizeof(effect_uuid_t)) == 0) {
-        in->need_echo_reference = false;
-        do_input_standby(in);
-    }
+static size_t out_get_buffer_size_mmap(const struct audio_stream *stream)
+{
+    return pcm_config_mmap.period_size * audio_stream_frame_size((struct audio_stream *)stream);
+}
 
-exit:
+static uint32_t out_get_latency_mmap(const struct audio_stream_out *stream)
+{
+    struct imx_stream_out *out = (struct imx_stream_out *)stream;
 
-    ALOGW_IF(status != 0, "in_remove_audio_effect() error %d", status);
-    pthread_mutex_unlock(&in->lock);
-    pthread_mutex_unlock(&in->dev->lock);
-    return status;
+    return (out->config[PCM_NORMAL].period_size * out->config[PCM_NORMAL].period_count * 1000) /
+           out->config[PCM_NORMAL].rate;
 }
 
-static int out_read_hdmi_channel_masks(struct imx_audio_device *adev, struct imx_stream_out *out) {
-
-    int count = 0;
+/* must be called with hw device mutex locked */
+static void hdmi_caps_read(struct imx_audio_device *adev)
+{
+    struct hdmi_caps *caps = &adev->hdmi_caps;
     int sup_channels[MAX_SUP_CHANNEL_NUM]; //temp buffer for supported channels
+    int count = 0;
     int card = -1;
     int i = 0;
-    int j = 0;
     struct mixer *mixer_hdmi = NULL;
+    struct mixer_ctl *ctl;
+
+    memset(caps, 0, sizeof(*caps));
+    caps->valid = true;
 
     for (i = 0; i < MAX_AUDIO_CARD_NUM; i ++) {
          if(!strcmp(adev->card_list[i]->driver_name, hdmi_card.driver_name)) {
@@ -2683,67 +4374,65 @@ static int out_read_hdmi_channel_masks(struct imx_audio_device *adev, struct imx
          }
     }
 
-    if (mixer_hdmi) {
-        struct mixer_ctl *ctl;
-        ctl = mixer_get_ctl_by_name(mixer_hdmi, "HDMI Support Channels");
-        if (ctl) {
-            count = mixer_ctl_get_num_values(ctl);
-            for(i = 0; i < count; i ++) {
-                sup_channels[i] = mixer_ctl_get_value(ctl, i);
-                ALOGW("out_read_hdmi_channel_masks() card %d got %d sup channels", card, sup_channels[i]);
-            }
+    if (!mixer_hdmi)
+        return;
+
+    ctl = mixer_get_ctl_by_name(mixer_hdmi, "HDMI Support Channels");
+    if (ctl) {
+        count = mixer_ctl_get_num_values(ctl);
+        if (count > MAX_SUP_CHANNEL_NUM)
+            count = MAX_SUP_CHANNEL_NUM;
+        for(i = 0; i < count; i ++) {
+            sup_channels[i] = mixer_ctl_get_value(ctl, i);
+            ALOGW("hdmi_caps_read() card %d got %d sup channels", card, sup_channels[i]);
         }
     }
 
     /*when channel is 6, the mask is 5.1,when channel is 8, the mask is 7.1*/
-    for(i = 0; i < count; i++ ) {
-       if(sup_channels[i] == 2) {
-          out->sup_channel_masks[j]   = AUDIO_CHANNEL_OUT_STEREO;
-          j++;
-       }
-       if(sup_channels[i] == 6) {
-          out->sup_channel_masks[j]   = AUDIO_CHANNEL_OUT_5POINT1;
-          j++;
-       }
-       if(sup_channels[i] == 8) {
-          out->sup_channel_masks[j]   = AUDIO_CHANNEL_OUT_7POINT1;
-          j++;
-       }
+    for(i = 0; i < count && caps->channel_masks_num < HDMI_MAX_CHANNEL_MASKS; i++ ) {
+       if(sup_channels[i] == 2)
+          caps->channel_masks[caps->channel_masks_num++] = AUDIO_CHANNEL_OUT_STEREO;
+       if(sup_channels[i] == 6)
+          caps->channel_masks[caps->channel_masks_num++] = AUDIO_CHANNEL_OUT_5POINT1;
+       if(sup_channels[i] == 8)
+          caps->channel_masks[caps->channel_masks_num++] = AUDIO_CHANNEL_OUT_7POINT1;
     }
-    /*if HDMI device does not support 2,6,8 channels, then return error*/
-    if (j == 0) return -ENOSYS;
 
-    return 0;
+    ctl = mixer_get_ctl_by_name(mixer_hdmi, "HDMI Support Rates");
+    if (ctl) {
+        count = mixer_ctl_get_num_values(ctl);
+        if (count > MAX_SUP_RATE_NUM)
+            count = MAX_SUP_RATE_NUM;
+        for(i = 0; i < count; i ++) {
+            caps->rates[i] = mixer_ctl_get_value(ctl, i);
+            ALOGW("hdmi_caps_read() card %d got %d sup rates", card, caps->rates[i]);
+        }
+        caps->rates_num = count;
+    }
 }
 
-static int out_read_hdmi_rates(struct imx_audio_device *adev, struct imx_stream_out *out) {
-
-    int count = 0;
-    int card = -1;
-    int i = 0;
-    struct mixer *mixer_hdmi = NULL;
+/* EDID capabilities are read once per HDMI connection, see adev_set_parameters() */
+static int out_read_hdmi_caps(struct imx_audio_device *adev, struct imx_stream_out *out)
+{
+    struct hdmi_caps *caps = &adev->hdmi_caps;
+    int ret = 0;
 
-    for (i = 0; i < MAX_AUDIO_CARD_NUM; i ++) {
-         if(!strcmp(adev->card_list[i]->driver_name, hdmi_card.driver_name)) {
-             mixer_hdmi = adev->mixer[i];
-             card = adev->card_list[i]->card;
-             break;
-         }
-    }
+    pthread_mutex_lock(&adev->lock);
+    if (!caps->valid)
+        hdmi_caps_read(adev);
 
-    if (mixer_hdmi) {
-        struct mixer_ctl *ctl;
-        ctl = mixer_get_ctl_by_name(mixer_hdmi, "HDMI Support Rates");
-        if (ctl) {
-            count = mixer_ctl_get_num_values(ctl);
-            for(i = 0; i < count; i ++) {
-                out->sup_rates[i] = mixer_ctl_get_value(ctl, i);
-                ALOGW("out_read_hdmi_rates() card %d got %d sup rates", card, out->sup_rates[i]);
-            }
-        }
+    /*if HDMI device does not support 2,6,8 channels, then return error*/
+    if (caps->channel_masks_num == 0) {
+        ret = -ENOSYS;
+    } else {
+        memcpy(out->sup_channel_masks, caps->channel_masks,
+               caps->channel_masks_num * sizeof(caps->channel_masks[0]));
+        if (caps->rates_num > 0)
+            memcpy(out->sup_rates, caps->rates, caps->rates_num * sizeof(caps->rates[0]));
     }
+    pthread_mutex_unlock(&adev->lock);
 
-    return 0;
+    return ret;
 }
 
 static int adev_open_output_stream(struct audio_hw_device *dev,
@@ -2757,7 +4446,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     struct imx_stream_out *out;
     int ret;
     int output_type;
-    int i;
+    int i, j;
+    unsigned int rate;
 
     ALOGI("%s: enter: sample_rate(%d) channel_mask(%#x) format(%#x) devices(%#x) flags(%#x)",
               __func__, config->sample_rate, config->channel_mask, config->format, devices, flags);
@@ -2769,19 +4459,50 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->sup_channel_masks[0] = AUDIO_CHANNEL_OUT_STEREO;
     out->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
 
+    /* HDMI direct output carries multichannel PCM or IEC61937 bitstream */
     if (flags & AUDIO_OUTPUT_FLAG_DIRECT &&
                    devices == AUDIO_DEVICE_OUT_AUX_DIGITAL) {
-        ALOGW("adev_open_output_stream() HDMI multichannel");
         if (ladev->active_output[OUTPUT_HDMI] != NULL) {
             ret = -ENOSYS;
             goto err_open;
         }
-        ret = out_read_hdmi_channel_masks(ladev, out);
+        ret = out_read_hdmi_caps(ladev, out);
         if (ret != 0)
             goto err_open;
 
-        ret = out_read_hdmi_rates(ladev, out);
+        if (config->format == AUDIO_FORMAT_AC3)
+            out->passthrough = IEC61937_AC3;
+        else if (config->format == AUDIO_FORMAT_E_AC3)
+            out->passthrough = IEC61937_EAC3;
+        else if (config->format == AUDIO_FORMAT_DTS)
+            out->passthrough = IEC61937_DTS;
+    }
+
+    if (out->passthrough != IEC61937_NONE) {
+        ALOGW("adev_open_output_stream() HDMI IEC61937 passthrough format %#x", config->format);
+        ret = iec61937_init(&out->iec, out->passthrough);
+        if (ret != 0)
+            goto err_open;
 
+        output_type = OUTPUT_HDMI;
+        out->format = config->format;
+        if (config->sample_rate == 0)
+            config->sample_rate = ladev->mm_rate;
+        if (config->channel_mask == 0)
+            config->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+        out->channel_mask = config->channel_mask;
+        out->stream.common.get_buffer_size = out_get_buffer_size_passthrough;
+        out->stream.common.get_sample_rate = out_get_sample_rate_passthrough;
+        out->stream.get_latency = out_get_latency_hdmi;
+        out->stream.write = out_write_passthrough;
+        /* bursts are 2ch 16 bit PCM, E-AC3 at 4 times content rate */
+        out->config[PCM_HDMI] = pcm_config_hdmi_multi;
+        out->config[PCM_HDMI].rate = config->sample_rate *
+                                     iec61937_rate_multiplier(out->passthrough);
+        out->config[PCM_HDMI].channels = 2;
+    } else if (flags & AUDIO_OUTPUT_FLAG_DIRECT &&
+                   devices == AUDIO_DEVICE_OUT_AUX_DIGITAL) {
+        ALOGW("adev_open_output_stream() HDMI multichannel");
         output_type = OUTPUT_HDMI;
         if (config->sample_rate == 0)
             config->sample_rate = ladev->mm_rate;
@@ -2795,6 +4516,39 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         out->config[PCM_HDMI] = pcm_config_hdmi_multi;
         out->config[PCM_HDMI].rate = config->sample_rate;
         out->config[PCM_HDMI].channels = popcount(config->channel_mask);
+    } else if (flags & AUDIO_OUTPUT_FLAG_DIRECT &&
+                   audio_is_linear_pcm(config->format) &&
+                   config->format != AUDIO_FORMAT_PCM_16_BIT &&
+                   !(devices & AUDIO_DEVICE_OUT_AUX_DIGITAL) &&
+                   get_card_for_device(ladev, devices, PCM_OUT, &i) >= 0 &&
+                   ladev->card_list[i]->hires_rate > 0) {
+        ALOGW("adev_open_output_stream() hi-res direct");
+        if (ladev->active_output[OUTPUT_HIRES] != NULL) {
+            ret = -ENOSYS;
+            goto err_open;
+        }
+
+        /* profile of card, AudioFlinger reopens with it if config differs */
+        output_type = OUTPUT_HIRES;
+        out->hires = true;
+        out->format = hires_audio_format(ladev->card_list[i]->hires_format);
+        /* requested rate is kept when the card runs it as is */
+        rate = ladev->card_list[i]->hires_rate;
+        for (j = 0; ladev->card_list[i]->hires_rates[j] != 0; j++) {
+            out->sup_rates[j] = ladev->card_list[i]->hires_rates[j];
+            if (out->sup_rates[j] == (int)config->sample_rate)
+                rate = config->sample_rate;
+        }
+        out->sup_rates[j] = 0;
+        if (config->sample_rate == 0)
+            config->sample_rate = rate;
+        out->stream.common.get_buffer_size = out_get_buffer_size_hires;
+        out->stream.common.get_sample_rate = out_get_sample_rate_hires;
+        out->stream.get_latency = out_get_latency_hires;
+        out->stream.write = out_write_hires;
+        out->config[PCM_NORMAL] = pcm_config_hires_out;
+        out->config[PCM_NORMAL].rate = rate;
+        out->config[PCM_NORMAL].format = ladev->card_list[i]->hires_format;
     } else if (flags & AUDIO_OUTPUT_FLAG_DIRECT &&
                    devices == AUDIO_DEVICE_OUT_SPEAKER && ladev->support_multichannel) {
         ALOGW("adev_open_output_stream() ESAI multichannel");
@@ -2816,6 +4570,39 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         out->config[PCM_ESAI] = pcm_config_esai_multi;
         out->config[PCM_ESAI].rate = config->sample_rate;
         out->config[PCM_ESAI].channels = popcount(config->channel_mask);
+        out->esai_remap = get_esai_remap(out->config[PCM_ESAI].channels);
+    } else if (flags & AUDIO_OUTPUT_FLAG_MMAP_NOIRQ) {
+        ALOGW("adev_open_output_stream() mmap no-irq");
+        if (ladev->active_output[OUTPUT_MMAP] != NULL) {
+            ret = -ENOSYS;
+            goto err_open;
+        }
+
+        output_type = OUTPUT_MMAP;
+        out->mmap = true;
+        out->stream.common.get_buffer_size = out_get_buffer_size_mmap;
+        out->stream.common.get_sample_rate = out_get_sample_rate;
+        out->stream.common.standby = out_standby_mmap;
+        out->stream.get_latency = out_get_latency_mmap;
+        out->stream.write = out_write_mmap;
+        out->stream.start = out_start;
+        out->stream.stop = out_stop;
+        out->stream.create_mmap_buffer = out_create_mmap_buffer;
+        out->stream.get_mmap_position = out_get_mmap_position;
+        out->config[PCM_NORMAL] = pcm_config_mmap;
+    } else if ((flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) && ladev->support_deep_buffer) {
+        ALOGI("adev_open_output_stream() deep buffer");
+        if (ladev->active_output[OUTPUT_DEEP_BUF] != NULL) {
+            ret = -ENOSYS;
+            goto err_open;
+        }
+        output_type = OUTPUT_DEEP_BUF;
+        out->deep = true;
+        out->delay_standby = true;
+        out->stream.common.get_sample_rate = out_get_sample_rate;
+        out->stream.common.get_buffer_size = out_get_buffer_size_deep;
+        out->stream.get_latency = out_get_latency_deep;
+        out->stream.write = out_write_primary;
     } else {
         ALOGV("adev_open_output_stream() normal buffer");
         if (ladev->active_output[OUTPUT_PRIMARY] != NULL) {
@@ -2823,29 +4610,29 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
             goto err_open;
         }
         output_type = OUTPUT_PRIMARY;
-        out->stream.common.get_buffer_size = out_get_buffer_size_primary;
         out->stream.common.get_sample_rate = out_get_sample_rate;
-        out->stream.get_latency = out_get_latency_primary;
-        out->stream.write = out_write_primary;
+        out->delay_standby = true;
+        if ((flags & AUDIO_OUTPUT_FLAG_FAST) && ladev->support_fast_output) {
+            ALOGI("adev_open_output_stream() fast output");
+            out->fast = true;
+            out->stream.common.get_buffer_size = out_get_buffer_size_fast;
+            out->stream.get_latency = out_get_latency_fast;
+            out->stream.write = out_write_fast;
+        } else {
+            out->stream.common.get_buffer_size = out_get_buffer_size_primary;
+            out->stream.get_latency = out_get_latency_primary;
+            out->stream.write = out_write_primary;
+        }
     }
 
-
-    for(i = 0; i < PCM_TOTAL; i++) {
-         ret = create_resampler(ladev->default_rate,
-                               ladev->mm_rate,
-                               2,
-                               RESAMPLER_QUALITY_DEFAULT,
-                               NULL,
-                               &out->resampler[i]);
-        if (ret != 0)
-            goto err_open;
-    }
+    /* resamplers are created at stream start for PCMs not at default rate */
 
     out->stream.common.set_sample_rate  = out_set_sample_rate;
     out->stream.common.get_channels     = out_get_channels;
     out->stream.common.get_format       = out_get_format;
     out->stream.common.set_format       = out_set_format;
-    out->stream.common.standby          = out_standby;
+    if (!out->mmap)
+        out->stream.common.standby      = out_standby;
     out->stream.common.dump             = out_dump;
     out->stream.common.set_parameters   = out_set_parameters;
     out->stream.common.get_parameters   = out_get_parameters;
@@ -2853,7 +4640,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.common.remove_audio_effect  = out_remove_audio_effect;
     out->stream.set_volume                  = out_set_volume;
     out->stream.get_render_position         = out_get_render_position;
-    out->stream.get_presentation_position   = out_get_presentation_position;
+    out->stream.get_presentation_position = out_get_presentation_position;
 
     out->dev = ladev;
     out->standby = 1;
@@ -2889,6 +4676,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     return 0;
 
 err_open:
+    iec61937_release(&out->iec);
     free(out);
     *stream_out = NULL;
     ALOGW("%s: exit: ret %d", __func__, ret);
@@ -2905,19 +4693,27 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
 
     pthread_mutex_lock(&out->dev->lock);
     pthread_mutex_lock(&out->lock);
+    /* client unmapped the mmap ring, standby keeps it otherwise */
+    if (out->mmap && out->pcm[PCM_NORMAL] != NULL) {
+        pcm_close(out->pcm[PCM_NORMAL]);
+        out->pcm[PCM_NORMAL] = NULL;
+    }
     do_output_standby(out, true);
     pthread_mutex_unlock(&out->lock);
-    pthread_mutex_unlock(&out->dev->lock);
 
+    /* standby thread looks up outputs with hw device mutex locked */
     for (i = 0; i < OUTPUT_TOTAL; i++) {
         if (ladev->active_output[i] == out) {
             ladev->active_output[i] = NULL;
             break;
         }
     }
+    pthread_mutex_unlock(&out->dev->lock);
 
     if (out->buffer)
         free(out->buffer);
+    iec61937_release(&out->iec);
+    release_output_fanout(out);
 
     for (i = 0; i < PCM_TOTAL; i++) {
         if (out->resampler[i]) {
@@ -2967,6 +4763,17 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
         pthread_mutex_unlock(&adev->lock);
     }
 
+    /* HDMI sink changed, EDID capabilities are read again at next open */
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_DEVICE_CONNECT, value, sizeof(value));
+    if (ret < 0)
+        ret = str_parms_get_str(parms, AUDIO_PARAMETER_DEVICE_DISCONNECT, value, sizeof(value));
+    if (ret >= 0 && ((uint32_t)strtoul(value, NULL, 0) & AUDIO_DEVICE_OUT_AUX_DIGITAL) &&
+            !((uint32_t)strtoul(value, NULL, 0) & AUDIO_DEVICE_BIT_IN)) {
+        pthread_mutex_lock(&adev->lock);
+        adev->hdmi_caps.valid = false;
+        pthread_mutex_unlock(&adev->lock);
+    }
+
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_NREC, value, sizeof(value));
     if (ret >= 0) {
         if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
@@ -3060,7 +4867,10 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
                                   audio_io_handle_t handle,
                                   audio_devices_t devices,
                                   struct audio_config *config,
-                                  struct audio_stream_in **stream_in)
+                                  struct audio_stream_in **stream_in,
+                                  audio_input_flags_t flags,
+                                  const char *address,
+                                  audio_source_t source)
 {
     struct imx_audio_device *ladev = (struct imx_audio_device *)dev;
     struct imx_stream_in *in;
@@ -3071,6 +4881,14 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     if (check_input_parameters(config->sample_rate, config->format, channel_count) != 0)
         return -EINVAL;
 
+    /* mmap client reads DMA ring directly, no resampler or remix */
+    if ((flags & AUDIO_INPUT_FLAG_MMAP_NOIRQ) &&
+            (config->sample_rate != pcm_config_mm_in.rate || channel_count != 2)) {
+        config->sample_rate = pcm_config_mm_in.rate;
+        config->channel_mask = AUDIO_CHANNEL_IN_STEREO;
+        return -EINVAL;
+    }
+
     in = (struct imx_stream_in *)calloc(1, sizeof(struct imx_stream_in));
     if (!in)
         return -ENOMEM;
@@ -3090,6 +4908,17 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->stream.set_gain = in_set_gain;
     in->stream.read = in_read;
     in->stream.get_input_frames_lost = in_get_input_frames_lost;
+    in->stream.get_capture_position = in_get_capture_position;
+    if (flags & AUDIO_INPUT_FLAG_MMAP_NOIRQ) {
+        ALOGW("adev_open_input_stream() mmap no-irq");
+        in->mmap = true;
+        in->stream.common.standby = in_standby_mmap;
+        in->stream.read = in_read_mmap;
+        in->stream.start = in_start;
+        in->stream.stop = in_stop;
+        in->stream.create_mmap_buffer = in_create_mmap_buffer;
+        in->stream.get_mmap_position = in_get_mmap_position;
+    }
 
     in->requested_rate    = config->sample_rate;
     in->requested_format  = PCM_FORMAT_S16_LE;
@@ -3117,6 +4946,15 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 {
     struct imx_stream_in *in = (struct imx_stream_in *)stream;
 
+    /* close pcm, mmap streams only stop in standby */
+    if (in->mmap) {
+        pthread_mutex_lock(&in->lock);
+        if (in->pcm != NULL) {
+            pcm_close(in->pcm);
+            in->pcm = NULL;
+        }
+        pthread_mutex_unlock(&in->lock);
+    }
     in_standby(&stream->common);
 
     if (in->read_buf)
@@ -3131,6 +4969,9 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
         free(in->proc_buf_out);
     if (in->ref_buf)
         free(in->ref_buf);
+    if (in->ref_tmp)
+        free(in->ref_tmp);
+    audio_ring_release(&in->capture_ring);
 
     free(stream);
     return;
@@ -3138,6 +4979,48 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 
 static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct imx_audio_device *adev = (struct imx_audio_device *)device;
+    int i;
+
+    dprintf(fd, "imx audio hal: mode %d, out device 0x%x, in device 0x%x, mic mute %d\n",
+            adev->mode, adev->out_device, adev->in_device, adev->mic_mute);
+    dprintf(fd, "  mm rate %u, default rate %u, resampler quality %d, fast output %d, deep buffer %d\n",
+            adev->mm_rate, adev->default_rate, adev->resampler_quality,
+            adev->support_fast_output, adev->support_deep_buffer);
+    dprintf(fd, "  standby delay %d ms\n", adev->standby_delay_ms);
+    for (i = 0; i < adev->audio_card_num; i++) {
+        if (adev->card_list[i])
+            dprintf(fd, "  card %d: %s, hi-res rate %u format %d\n", adev->card_list[i]->card,
+                    adev->card_list[i]->driver_name, adev->card_list[i]->hires_rate,
+                    adev->card_list[i]->hires_format);
+    }
+
+    /* streams are closed under these locks, don't block a stuck HAL */
+    if (pthread_mutex_trylock(&adev->lock) != 0) {
+        dprintf(fd, "  hw device is busy, streams not dumped\n");
+        return 0;
+    }
+    if (pthread_mutex_trylock(&adev->capture.lock) != 0) {
+        pthread_mutex_unlock(&adev->lock);
+        dprintf(fd, "  capture engine is busy, streams not dumped\n");
+        return 0;
+    }
+
+    for (i = 0; i < OUTPUT_TOTAL; i++) {
+        if (adev->active_output[i])
+            out_dump(&adev->active_output[i]->stream.common, fd);
+    }
+    dprintf(fd, "  capture engine: %s, device 0x%x, clients %d, fail count %d\n",
+            adev->capture.started ? "running" : "stopped", adev->capture.device,
+            adev->capture.clients_num, adev->capture.fail_count);
+    stats_dump(&adev->capture.stats, fd, "capture stats");
+    for (i = 0; i < adev->capture.clients_num; i++)
+        in_dump(&adev->capture.clients[i]->stream.common, fd);
+    if (adev->active_input && adev->active_input->mmap)
+        in_dump(&adev->active_input->stream.common, fd);
+
+    pthread_mutex_unlock(&adev->capture.lock);
+    pthread_mutex_unlock(&adev->lock);
     return 0;
 }
 
@@ -3145,6 +5028,19 @@ static int adev_close(hw_device_t *device)
 {
     struct imx_audio_device *adev = (struct imx_audio_device *)device;
     int i;
+
+    if (adev->standby_thread_started) {
+        pthread_mutex_lock(&adev->lock);
+        adev->standby_exit = true;
+        pthread_cond_signal(&adev->standby_cond);
+        pthread_mutex_unlock(&adev->lock);
+        pthread_join(adev->standby_thread, NULL);
+    }
+    pthread_cond_destroy(&adev->standby_cond);
+    spdif_in_monitor_stop(adev);
+    pthread_cond_destroy(&adev->capture.cond);
+    pthread_mutex_destroy(&adev->capture.lock);
+
     for(i = 0; i < MAX_AUDIO_CARD_NUM; i++)
         if(adev->mixer[i])
             mixer_close(adev->mixer[i]);
@@ -3214,6 +5110,104 @@ static int pcm_get_near_param_wrap(unsigned int card, unsigned int device,
 #endif
 }
 
+/* standard rates near param keeps untouched, so the card runs them as
+ * they are. probed rate of card is kept when none of them is.
+ */
+static void probe_hires_rates(unsigned int card, struct audio_card *audio_card)
+{
+    static const unsigned int rates[] = { 44100, 48000, 88200, 96000, 176400, 192000 };
+    unsigned int i;
+    int n = 0;
+    int rate;
+
+    for (i = 0; i < ARRAY_SIZE(rates) && n < MAX_HIRES_RATE_NUM - 1; i++) {
+        rate = rates[i];
+        if (pcm_get_near_param_wrap(card, 0, PCM_OUT, PCM_HW_PARAM_RATE, &rate) == 0 &&
+                (unsigned int)rate == rates[i])
+            audio_card->hires_rates[n++] = rates[i];
+    }
+    if (n == 0)
+        audio_card->hires_rates[n++] = audio_card->hires_rate;
+    audio_card->hires_rates[n] = 0;
+}
+
+/* playback PCM of speaker card next to the one of low latency output,
+ * -1 if the card has only one.
+ */
+static int probe_deep_port(struct imx_audio_device *adev)
+{
+    int card = get_card_for_device(adev, AUDIO_DEVICE_OUT_SPEAKER, PCM_OUT, NULL);
+    int port;
+    int rate;
+
+    if (card < 0)
+        return -1;
+    for (port = PORT_MM + 1; port < PORT_DEEP_MAX; port++) {
+        if (pcm_get_near_param_wrap(card, port, PCM_OUT, PCM_HW_PARAM_RATE, &rate) == 0)
+            return port;
+    }
+
+    ALOGI("no deep buffer output, card %d has one playback pcm", card);
+    return -1;
+}
+
+/* sizes deep buffer output for card of speaker when it is not a rpmsg card,
+ * false if its DMA ring is too small to save wakeups.
+ */
+static bool probe_deep_buffer(struct imx_audio_device *adev)
+{
+    int card = get_card_for_device(adev, AUDIO_DEVICE_OUT_SPEAKER, PCM_OUT, NULL);
+    int frames = DEEP_BUFFER_LOCAL_PERIOD_SIZE * PLAYBACK_DEEP_BUFFER_LOCAL_PERIOD_COUNT;
+    unsigned int period_size;
+
+    if (card < 0)
+        return false;
+    if (pcm_get_near_param_wrap(card, adev->deep_port, PCM_OUT, PCM_HW_PARAM_BUFFER_SIZE,
+                                &frames) != 0)
+        return false;
+
+    period_size = frames / PLAYBACK_DEEP_BUFFER_LOCAL_PERIOD_COUNT;
+    if (period_size > DEEP_BUFFER_LOCAL_PERIOD_SIZE)
+        period_size = DEEP_BUFFER_LOCAL_PERIOD_SIZE;
+    period_size &= ~15U;
+    if (period_size * 1000 < DEEP_BUFFER_MIN_PERIOD_MS * adev->mm_rate) {
+        ALOGI("no deep buffer output, card %d ring holds %d frames", card, frames);
+        return false;
+    }
+
+    pcm_config_deep_out.period_size = period_size;
+    pcm_config_deep_out.period_count = PLAYBACK_DEEP_BUFFER_LOCAL_PERIOD_COUNT;
+    pcm_config_deep_out.start_threshold = period_size;
+    pcm_config_deep_out.avail_min = period_size * DEEP_BUFFER_WRITE_PERIODS;
+    ALOGI("deep buffer output, period %u x %d on card %d", period_size,
+          PLAYBACK_DEEP_BUFFER_LOCAL_PERIOD_COUNT, card);
+    return true;
+}
+
+/* periods of config from product config, thresholds keep their ratio to
+ * period size, so a start or wakeup after N periods stays after N.
+ */
+static void config_periods(struct pcm_config *config, const char *name)
+{
+    char key[PROPERTY_KEY_MAX];
+    int64_t size, count;
+
+    snprintf(key, sizeof(key), "%s_size", name);
+    size = hal_config_get_int(key, 0);
+    snprintf(key, sizeof(key), "%s_count", name);
+    count = hal_config_get_int(key, 0);
+
+    if (size > 0 && size <= INT32_MAX / 16) {
+        config->start_threshold = config->start_threshold / config->period_size * size;
+        config->avail_min = config->avail_min / config->period_size * size;
+        config->period_size = size;
+    }
+    if (count >= 2 && count <= MMAP_PERIOD_COUNT_MAX)
+        config->period_count = count;
+    if (size > 0 || count > 0)
+        ALOGI("%s: period %u x %u", name, config->period_size, config->period_count);
+}
+
 static int scan_available_device(struct imx_audio_device *adev, bool queryInput, bool queryOutput)
 {
     int i,j,k;
@@ -3254,12 +5248,15 @@ static int scan_available_device(struct imx_audio_device *adev, bool queryInput,
                 if(strcmp(audio_card_list[j]->driver_name, "sii902x-audio") == 0) {
                     ALOGI("sii902x audio, set period_size to 768");
                     pcm_config_mm_out.period_size = 768;
+                    adev->support_fast_output = false;
                 }
 
                 if(strcmp(audio_card_list[j]->driver_name, "rpmsg-audio") == 0) {
-                    ALOGI("rpmsg-audio, set period_size to 1024");
+                    ALOGI("rpmsg-audio, set period_size to 1024, can run deep buffer output");
                     pcm_config_mm_out.period_size = 1024;
                     pcm_config_mm_out.period_count = 4;
+                    adev->support_fast_output = false;
+                    adev->support_deep_buffer = true;
                 }
 
                 if(strcmp(audio_card_list[j]->driver_name, "cs42888-audio") == 0) {
@@ -3288,6 +5285,7 @@ static int scan_available_device(struct imx_audio_device *adev, bool queryInput,
                      control_close(imx_control);
                      return -EINVAL;
                 }
+                resolve_card_routes(adev->mixer[n], adev->card_list[n]);
 
                 if(queryOutput) {
                     rate = 44100;
@@ -3301,6 +5299,25 @@ static int scan_available_device(struct imx_audio_device *adev, bool queryInput,
                     channels = 2;
                     if( pcm_get_near_param_wrap(i, 0, PCM_OUT, PCM_HW_PARAM_CHANNELS, &channels) == 0)
                             adev->card_list[n]->out_channels = channels;
+
+#ifndef BRILLO
+                    /* hi-res direct profile needs more than 16 bit from card */
+                    format = PCM_FORMAT_S24_LE;
+                    if (!pcm_check_param_mask(i, 0, PCM_OUT, PCM_HW_PARAM_FORMAT, format)) {
+                        format = PCM_FORMAT_S32_LE;
+                        if (!pcm_check_param_mask(i, 0, PCM_OUT, PCM_HW_PARAM_FORMAT, format))
+                            format = PCM_FORMAT_S16_LE;
+                    }
+                    rate = HIRES_PROBE_RATE;
+                    if (format != PCM_FORMAT_S16_LE &&
+                            pcm_get_near_param_wrap(i, 0, PCM_OUT, PCM_HW_PARAM_RATE, &rate) == 0 &&
+                            rate > 0) {
+                        adev->card_list[n]->hires_rate = rate;
+                        adev->card_list[n]->hires_format = format;
+                        ALOGW("out hi-res rate %d format %d", rate, format);
+                        probe_hires_rates(i, adev->card_list[n]);
+                    }
+#endif
                 }
 
                 if(queryInput) {
@@ -3364,6 +5381,7 @@ static int adev_open(const hw_module_t* module, const char* name,
                      hw_device_t** device)
 {
     struct imx_audio_device *adev;
+    pthread_condattr_t attr;
     int ret = 0;
     int i,j,k;
     bool found;
@@ -3396,6 +5414,14 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->hw_device.dump                    = adev_dump;
     adev->mm_rate                           = 44100;
     adev->support_multichannel              = false;
+    adev->support_fast_output               = true;
+    adev->support_deep_buffer               = false;
+    adev->deep_port                         = -1;
+    adev->resampler_quality                 = hal_config_get_int(RESAMPLER_QUALITY_PROPERTY,
+                                                                 RESAMPLER_QUALITY_DEFAULT);
+    if (adev->resampler_quality < RESAMPLER_QUALITY_MIN ||
+            adev->resampler_quality > RESAMPLER_QUALITY_MAX)
+        adev->resampler_quality = RESAMPLER_QUALITY_DEFAULT;
 
     ret = scan_available_device(adev, true, true);
     if (ret != 0) {
@@ -3403,8 +5429,24 @@ static int adev_open(const hw_module_t* module, const char* name,
         return ret;
     }
 
+    /* rpmsg card marks it at scan, product still opts in */
+    if (hal_config_get_bool(DEEP_BUFFER_PROPERTY, 0))
+        adev->deep_port = probe_deep_port(adev);
+    if (adev->deep_port < 0)
+        adev->support_deep_buffer = false;
+    else if (!adev->support_deep_buffer)
+        adev->support_deep_buffer = probe_deep_buffer(adev);
+
+    config_periods(&pcm_config_mm_out, PRIMARY_PERIOD_CONFIG);
+    config_periods(&pcm_config_fast_out, FAST_PERIOD_CONFIG);
+    config_periods(&pcm_config_deep_out, DEEP_BUFFER_PERIOD_CONFIG);
+    config_periods(&pcm_config_mm_in, CAPTURE_PERIOD_CONFIG);
+
     adev->default_rate                      = adev->mm_rate;
     pcm_config_mm_out.rate                  = adev->mm_rate;
+    pcm_config_fast_out.rate                = adev->mm_rate;
+    pcm_config_deep_out.rate                = adev->mm_rate;
+    pcm_config_mmap.rate                    = adev->mm_rate;
     pcm_config_mm_in.rate                   = adev->mm_rate;
     pcm_config_hdmi_multi.rate              = adev->mm_rate;
     pcm_config_esai_multi.rate              = adev->mm_rate;
@@ -3426,6 +5468,29 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->wb_amr = 0;
     pthread_mutex_unlock(&adev->lock);
 
+    adev->standby_delay_ms = hal_config_get_int(STANDBY_DELAY_PROPERTY,
+                                                STANDBY_DELAY_DEFAULT_MS);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&adev->standby_cond, &attr);
+    /* capture clients wait engine with CLOCK_MONOTONIC deadline */
+    pthread_cond_init(&adev->capture.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&adev->capture.lock, NULL);
+    if (adev->standby_delay_ms > 0) {
+        if (pthread_create(&adev->standby_thread, NULL, standby_thread_loop, adev) == 0)
+            adev->standby_thread_started = true;
+        else
+            adev->standby_delay_ms = 0;
+    }
+
+    for (i = 0; i < MAX_AUDIO_CARD_NUM; i++) {
+        if (adev->card_list[i] == &spdif_card) {
+            spdif_in_monitor_start(adev, spdif_card.card);
+            break;
+        }
+    }
+
     *device = &adev->hw_device.common;
 
     return 0;
@@ -27,7 +27,10 @@ LOCAL_SRC_FILES := Display.cpp \
                    MemoryDesc.cpp \
                    MemoryManager.cpp \
                    IonManager.cpp \
-                   Composer.cpp
+                   Composer.cpp \
+                   Tunables.cpp \
+                   FrameStats.cpp \
+                   SidebandStream.cpp
 
 LOCAL_C_INCLUDES += $(FSL_PROPRIETARY_PATH)/fsl-proprietary/include \
                     $(IMX_PATH)/imx/include \
@@ -57,3 +60,23 @@ endif
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := compose_bench.cpp
+
+LOCAL_C_INCLUDES += $(FSL_PROPRIETARY_PATH)/fsl-proprietary/include \
+                    $(IMX_PATH)/imx/include \
+                    frameworks/native/libs/nativewindow/include  \
+                    external/libdrm \
+                    external/libdrm/include/drm
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libui \
+                          libhardware_legacy libfsldisplay
+
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE := compose_bench
+LOCAL_CFLAGS:= -DLOG_TAG=\"compose_bench\" -D_LINUX
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
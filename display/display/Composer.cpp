@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include <dlfcn.h>
+#include "Tunables.h"
 #include "Composer.h"
 #include "MemoryManager.h"
 #include <system/window.h>
@@ -31,11 +32,51 @@
 
 namespace fsl {
 
+void Composer::closeContext(G2dContext* context)
+{
+    if (context->handle != NULL && context->closeEngine != NULL) {
+        (*context->closeEngine)(context->handle);
+    }
+    delete context;
+}
+
+void Composer::releaseContext(void* data)
+{
+    G2dContext* context = (G2dContext*)data;
+    if (context == NULL) {
+        return;
+    }
+
+    Composer* owner = context->owner;
+    {
+        Mutex::Autolock _l(owner->mContextLock);
+        for (size_t i=0; i<owner->mContexts.size(); i++) {
+            if (owner->mContexts[i] == context) {
+                owner->mContexts.removeAt(i);
+                break;
+            }
+        }
+    }
+    closeContext(context);
+}
+
 Composer::Composer()
 {
     mTarget = NULL;
     mDimBuffer = NULL;
+    mDimColor = 0;
+    mStageBuffer = NULL;
+    mOutput = NULL;
+    mRenderWidth = 0;
+    mRenderHeight = 0;
     mHandle = NULL;
+    mContext = NULL;
+    mValid = false;
+    pthread_key_create(&mContextKey, releaseContext);
+    mBatchMode = false;
+    mBatchCount = 0;
+    memset(mBatchPairs, 0, sizeof(mBatchPairs));
+    MemoryManager::getInstance()->addListener(this);
 
     char path[PATH_MAX] = {0};
 	getModule(path, GPUHELPER);
@@ -66,6 +107,7 @@ Composer::Composer()
         ALOGI("no %s found, switch to 3D composite", path);
         mSetClipping = NULL;
         mBlitFunction = NULL;
+        mMultiBlitFunction = NULL;
         mOpenEngine = NULL;
         mCloseEngine = NULL;
         mClearFunction = NULL;
@@ -87,7 +129,16 @@ Composer::Composer()
         mDisableFunction = (hwc_func2)dlsym(handle, "g2d_disable");
         mFinishEngine = (hwc_func1)dlsym(handle, "g2d_finish");
         mQueryFeature = (hwc_func3)dlsym(handle, "g2d_query_feature");
-        openEngine(&mHandle);
+        mMultiBlitFunction = (hwc_func3)dlsym(handle, "g2d_multi_blit");
+        mValid = (getContext()->handle != NULL);
+    }
+
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    if (tunables.mG2dBatch && mMultiBlitFunction != NULL &&
+        isFeatureSupported(G2D_MULTI_SOURCE_BLT)) {
+        ALOGI("g2d multi-source blit enabled");
+        mBatchMode = true;
     }
 }
 
@@ -97,15 +148,55 @@ Composer::~Composer()
     if (mDimBuffer != NULL) {
         pManager->releaseMemory(mDimBuffer);
     }
-
-    if (mHandle != NULL) {
-        closeEngine(mHandle);
+    if (mStageBuffer != NULL) {
+        pManager->releaseMemory(mStageBuffer);
     }
+    pManager->removeListener(this);
+
+    // deleted key runs no destructor at thread exit, so contexts of
+    // threads still alive are closed here.
+    pthread_key_delete(mContextKey);
+    Mutex::Autolock _l(mContextLock);
+    for (size_t i=0; i<mContexts.size(); i++) {
+        closeContext(mContexts[i]);
+    }
+    mContexts.clear();
 }
 
 bool Composer::isValid()
 {
-    return (mHandle != NULL && mBlitFunction != NULL);
+    return (mValid && mBlitFunction != NULL);
+}
+
+G2dContext* Composer::getContext()
+{
+    G2dContext* context = (G2dContext*)pthread_getspecific(mContextKey);
+    if (context != NULL) {
+        return context;
+    }
+
+    context = new G2dContext();
+    context->handle = NULL;
+    context->blending = false;
+    context->colorspace = -1;
+    context->closeEngine = mCloseEngine;
+    context->owner = this;
+    if (openEngine(&context->handle) != 0) {
+        ALOGE("open g2d engine failed");
+        context->handle = NULL;
+    }
+    pthread_setspecific(mContextKey, context);
+    Mutex::Autolock _l(mContextLock);
+    mContexts.add(context);
+
+    return context;
+}
+
+int Composer::bindContext()
+{
+    mContext = getContext();
+    mHandle = mContext->handle;
+    return (mHandle != NULL) ? 0 : -EINVAL;
 }
 
 void Composer::getModule(char *path, const char *name)
@@ -121,15 +212,24 @@ void Composer::getModule(char *path, const char *name)
     return;
 }
 
-int Composer::checkDimBuffer()
+int Composer::checkDimBuffer(uint32_t color)
 {
     if (mTarget == NULL) {
         return 0;
     }
 
+    Rect rect;
+    rect.left = rect.top = 0;
+    rect.right = mTarget->width;
+    rect.bottom = mTarget->height;
     if ((mDimBuffer != NULL) && (mTarget->width == mDimBuffer->width &&
         mTarget->height == mDimBuffer->height &&
         mTarget->fslFormat == mDimBuffer->fslFormat)) {
+        if (mDimColor != color) {
+            // refill only when dim color changes.
+            clearRect(mDimBuffer, rect, color);
+            mDimColor = color;
+        }
         return 0;
     }
 
@@ -148,46 +248,404 @@ int Composer::checkDimBuffer()
     desc.checkFormat();
     int ret = pManager->allocMemory(desc, &mDimBuffer);
     if (ret == 0) {
-        Rect rect;
-        rect.left = rect.top = 0;
-        rect.right = mTarget->width;
-        rect.bottom = mTarget->height;
-        clearRect(mDimBuffer, rect);
+        clearRect(mDimBuffer, rect, color);
+        mDimColor = color;
+    }
+    else {
+        mDimBuffer = NULL;
+    }
+
+    return ret;
+}
+
+int Composer::checkStageBuffer(Memory* output)
+{
+    if ((mStageBuffer != NULL) && (output->width == mStageBuffer->width &&
+        output->height == mStageBuffer->height)) {
+        return 0;
+    }
+
+    MemoryManager* pManager = MemoryManager::getInstance();
+    if (mStageBuffer != NULL) {
+        pManager->releaseMemory(mStageBuffer);
+        mStageBuffer = NULL;
+    }
+
+    MemoryDesc desc;
+    desc.mWidth = output->width;
+    desc.mHeight = output->height;
+    desc.mFormat = FORMAT_RGBX8888;
+    desc.mFslFormat = FORMAT_RGBX8888;
+    desc.mProduceUsage |= USAGE_HW_COMPOSER |
+                          USAGE_HW_2D | USAGE_HW_RENDER;
+    desc.checkFormat();
+    int ret = pManager->allocMemory(desc, &mStageBuffer);
+    if (ret != 0) {
+        mStageBuffer = NULL;
     }
 
     return ret;
 }
 
+// effective alpha of solid color layer.
+static inline uint32_t getSolidAlpha(Layer* layer)
+{
+    return ((layer->color >> 24) & 0xff) * layer->planeAlpha / 0xff;
+}
+
+// scale rgb of layer color with alpha, color is in RGBA8888 order.
+static uint32_t premultiplyColor(uint32_t color, uint32_t alpha)
+{
+    uint32_t r = (color & 0xff) * alpha / 0xff;
+    uint32_t g = ((color >> 8) & 0xff) * alpha / 0xff;
+    uint32_t b = ((color >> 16) & 0xff) * alpha / 0xff;
+    return alpha << 24 | b << 16 | g << 8 | r;
+}
+
+int Composer::fillSolidColor(Layer* layer, uint32_t color)
+{
+    size_t count = 0;
+    Region region = layer->visibleRegion.intersect(mDirty);
+    const Rect* visible = region.getArray(&count);
+    for (size_t i=0; i<count; i++) {
+        Rect clip = visible[i];
+        clip.intersect(layer->displayFrame, &clip);
+        Rect rect = toTarget(clip);
+        clearRect(mTarget, rect, color);
+    }
+
+    return 0;
+}
+
+static inline bool isYuvSurface(enum g2d_format format)
+{
+    switch (format) {
+        case G2D_NV12:
+        case G2D_NV21:
+        case G2D_NV16:
+        case G2D_I420:
+        case G2D_YV12:
+        case G2D_YUYV:
+        case G2D_UYVY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// matrix of layer dataspace, unknown standard takes BT.709 for HD
+// and BT.601 below it, unknown range is limited.
+static enum g2d_cap_mode getColorspace(int dataspace, int height)
+{
+    int standard = dataspace & HAL_DATASPACE_STANDARD_MASK;
+    int range = dataspace & HAL_DATASPACE_RANGE_MASK;
+    switch (dataspace) {
+        case HAL_DATASPACE_JFIF:
+            standard = HAL_DATASPACE_STANDARD_BT601_625;
+            range = HAL_DATASPACE_RANGE_FULL;
+            break;
+        case HAL_DATASPACE_BT601_625:
+            standard = HAL_DATASPACE_STANDARD_BT601_625;
+            range = HAL_DATASPACE_RANGE_LIMITED;
+            break;
+        case HAL_DATASPACE_BT601_525:
+            standard = HAL_DATASPACE_STANDARD_BT601_525;
+            range = HAL_DATASPACE_RANGE_LIMITED;
+            break;
+        case HAL_DATASPACE_BT709:
+            standard = HAL_DATASPACE_STANDARD_BT709;
+            range = HAL_DATASPACE_RANGE_LIMITED;
+            break;
+        default:
+            break;
+    }
+
+    bool bt709 = height >= 720;
+    switch (standard) {
+        case HAL_DATASPACE_STANDARD_BT601_625:
+        case HAL_DATASPACE_STANDARD_BT601_625_UNADJUSTED:
+        case HAL_DATASPACE_STANDARD_BT601_525:
+        case HAL_DATASPACE_STANDARD_BT601_525_UNADJUSTED:
+            bt709 = false;
+            break;
+        // engine has no BT.2020 matrix, BT.709 is the nearest one.
+        case HAL_DATASPACE_STANDARD_BT709:
+        case HAL_DATASPACE_STANDARD_BT2020:
+        case HAL_DATASPACE_STANDARD_BT2020_CONSTANT_LUMINANCE:
+            bt709 = true;
+            break;
+        default:
+            break;
+    }
+
+    if (range == HAL_DATASPACE_RANGE_FULL) {
+        return bt709 ? G2D_YUV_BT_709FR : G2D_YUV_BT_601FR;
+    }
+    return bt709 ? G2D_YUV_BT_709 : G2D_YUV_BT_601;
+}
+
 int Composer::finishComposite()
 {
+    flushBatch();
+    if (mOutput != NULL) {
+        // convert stage buffer into yuv target in one blit.
+        Rect rect = toTarget(Rect(mOutput->width, mOutput->height));
+        struct g2d_surfaceEx sSurfaceX, dSurfaceX;
+        memset(&sSurfaceX, 0, sizeof(sSurfaceX));
+        memset(&dSurfaceX, 0, sizeof(dSurfaceX));
+        setG2dSurface(sSurfaceX, mStageBuffer, rect);
+        setG2dSurface(dSurfaceX, mOutput, rect);
+        setBlending(false);
+        setColorspace(getColorspace(0, mOutput->height));
+        blitSurface(&sSurfaceX, &dSurfaceX);
+        mTarget = mOutput;
+        mOutput = NULL;
+    }
     finishEngine(mHandle);
     return 0;
 }
 
+int Composer::flushBatch()
+{
+    if (mBatchCount == 0 || mTarget == NULL) {
+        return 0;
+    }
+
+    struct g2d_surface_pair* pairs[G2D_BATCH_LAYERS];
+    for (int i=0; i<mBatchCount; i++) {
+        pairs[i] = &mBatchPairs[i];
+    }
+
+    // every pair carries its own rects, reset clip to whole target.
+    Rect full(mTarget->width, mTarget->height);
+    setClipping(full, full, full, 0);
+    setBlending(true);
+
+    int ret = (*mMultiBlitFunction)(mHandle, (void*)pairs,
+                                    (void*)(intptr_t)mBatchCount);
+    if (ret != 0) {
+        ALOGE("%s multi blit %d layers failed:%d", __func__, mBatchCount, ret);
+    }
+    mBatchCount = 0;
+
+    return ret;
+}
+
+int Composer::setColorspace(enum g2d_cap_mode mode)
+{
+    if (mContext->colorspace == (int)mode) {
+        return 0;
+    }
+
+    // queued blits are converted with matrix at submit time.
+    flushBatch();
+    if (mContext->colorspace >= 0) {
+        enableFunction(mHandle, (enum g2d_cap_mode)mContext->colorspace,
+                       false);
+    }
+    enableFunction(mHandle, mode, true);
+    mContext->colorspace = mode;
+
+    return 0;
+}
+
+int Composer::setBlending(bool enable)
+{
+    if (mContext->blending == enable) {
+        return 0;
+    }
+
+    if (enable) {
+        enableFunction(mHandle, G2D_GLOBAL_ALPHA, true);
+        enableFunction(mHandle, G2D_BLEND, true);
+    }
+    else {
+        enableFunction(mHandle, G2D_BLEND, false);
+        enableFunction(mHandle, G2D_GLOBAL_ALPHA, false);
+    }
+    mContext->blending = enable;
+
+    return 0;
+}
+
+static inline bool isYuvFormat(int format)
+{
+    switch (format) {
+        case FORMAT_RGBA8888:
+        case FORMAT_RGBX8888:
+        case FORMAT_RGB888:
+        case FORMAT_RGB565:
+        case FORMAT_BGRA8888:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool Composer::canBatch(Layer* layer, Rect& clip, struct g2d_surfaceEx& srcEx)
+{
+    // batch blends even opaque layers, yuv target takes plain blit.
+    if (!mBatchMode || isYuvFormat(mTarget->fslFormat)) {
+        return false;
+    }
+
+    // multi-source blit takes linear g2d_surface only.
+    if (srcEx.tiling != G2D_LINEAR || layer->transform != 0) {
+        return false;
+    }
+
+    // clip must be expressed by source rect without rounding error.
+    Rect& srect = layer->sourceCrop;
+    Rect& drect = layer->displayFrame;
+    if (clip == drect) {
+        return true;
+    }
+
+    return (srect.width() == drect.width() &&
+            srect.height() == drect.height());
+}
+
+int Composer::queueBlit(struct g2d_surfaceEx *srcEx, struct g2d_surfaceEx *dstEx)
+{
+    if (mBatchCount >= G2D_BATCH_LAYERS) {
+        flushBatch();
+    }
+
+    struct g2d_surface_pair& pair = mBatchPairs[mBatchCount];
+    pair.s = srcEx->base;
+    pair.d = dstEx->base;
+    mBatchCount++;
+
+    return 0;
+}
+
 int Composer::setRenderTarget(Memory* memory)
 {
+    // composition runs in thread of caller, binder or present thread.
+    bindContext();
     mTarget = memory;
+    mDirty.clear();
+    mRenderWidth = 0;
+    mRenderHeight = 0;
+    if (memory != NULL) {
+        mDirty.set(Rect(memory->width, memory->height));
+    }
     return 0;
 }
 
-int Composer::clearRect(Memory* target, Rect& rect)
+int Composer::setRenderSize(int width, int height)
+{
+    if (mTarget == NULL || width <= 0 || height <= 0 ||
+        width > mTarget->width || height > mTarget->height) {
+        mRenderWidth = 0;
+        mRenderHeight = 0;
+        return 0;
+    }
+
+    mRenderWidth = width;
+    mRenderHeight = height;
+    return 0;
+}
+
+Rect Composer::toTarget(const Rect& rect)
+{
+    if (mRenderWidth == 0 || mTarget == NULL) {
+        return rect;
+    }
+
+    // edges are mapped alone, so adjacent rects stay adjacent.
+    int w = mTarget->width, h = mTarget->height;
+    return Rect(rect.left * mRenderWidth / w, rect.top * mRenderHeight / h,
+                rect.right * mRenderWidth / w,
+                rect.bottom * mRenderHeight / h);
+}
+
+int Composer::prepareTarget(LayerVector& layers)
+{
+    mOutput = NULL;
+    if (mTarget == NULL || !isYuvFormat(mTarget->fslFormat)) {
+        return 0;
+    }
+
+    if (layers.size() == 1) {
+        // scale and convert the only layer into target directly.
+        Layer* layer = layers[0];
+        Region covered = layer->visibleRegion.intersect(layer->displayFrame);
+        if (!layer->isSolidColor() && layer->handle != NULL &&
+            layer->type != LAYER_TYPE_SIDEBAND &&
+            mDirty.subtract(covered).isEmpty()) {
+            return 0;
+        }
+    }
+
+    if (checkStageBuffer(mTarget) != 0) {
+        ALOGE("prepareTarget: no stage buffer");
+        return -ENOMEM;
+    }
+
+    // stage content doesn't match target, compose whole of it.
+    mOutput = mTarget;
+    mTarget = mStageBuffer;
+    mDirty.set(Rect(mOutput->width, mOutput->height));
+    return 0;
+}
+
+int Composer::setDirtyRegion(Region& dirty)
+{
+    mDirty = dirty;
+    return 0;
+}
+
+int Composer::clearRect(Memory* target, Rect& rect, uint32_t color)
 {
     if (target == NULL || rect.isEmpty()) {
         return 0;
     }
 
+    flushBatch();
     struct g2d_surfaceEx surfaceX;
     memset(&surfaceX, 0, sizeof(surfaceX));
     struct g2d_surface& surface = surfaceX.base;
     ALOGV("clearRect: rect(l:%d,t:%d,r:%d,b:%d)",
             rect.left, rect.top, rect.right, rect.bottom);
     setG2dSurface(surfaceX, target, rect);
-    surface.clrcolor = 0xff << 24;
+    surface.clrcolor = color;
     clearFunction(mHandle, &surface);
 
     return 0;
 }
 
+// layer overwrites all pixels of its visible region.
+static bool isOpaqueLayer(Layer* layer, bool bypass)
+{
+    if (layer->type == LAYER_TYPE_SIDEBAND ||
+        (!layer->isSolidColor() && layer->handle == NULL)) {
+        return false;
+    }
+
+    // bottom layer is copied without blending.
+    if (bypass || layer->blendMode == BLENDING_NONE) {
+        return true;
+    }
+
+    if (layer->blendMode == BLENDING_DIM) {
+        return getSolidAlpha(layer) == 0xff;
+    }
+
+    if (layer->planeAlpha != 0xff) {
+        return false;
+    }
+
+    // buffer formats without alpha channel.
+    switch (layer->handle->fslFormat) {
+        case FORMAT_RGBA8888:
+        case FORMAT_BGRA8888:
+            return false;
+        default:
+            return true;
+    }
+}
+
 int Composer::clearWormHole(LayerVector& layers)
 {
     if (mTarget == NULL) {
@@ -195,30 +653,32 @@ int Composer::clearWormHole(LayerVector& layers)
         return -EINVAL;
     }
 
-    // calculate opaque region.
-    Region opaque;
+    // subtract opaque layers from dirty area, bottom layer first since
+    // full screen wallpaper usually covers the whole target alone.
+    Region screen(mDirty);
     size_t count = layers.size();
-    for (size_t i=0; i<count; i++) {
+    for (size_t i=0; i<count && !screen.isEmpty(); i++) {
         Layer* layer = layers[i];
         if (!layer->busy){
             ALOGE("clearWormHole: compose invalid layer");
             continue;
         }
 
-        if ((layer->blendMode == BLENDING_NONE) ||
-             (i==0 && layer->blendMode == BLENDING_PREMULT) ||
-             ((i!=0) && (layer->blendMode == BLENDING_DIM) &&
-              ((layer->color >> 24)&0xff) == 0xff)) {
-            opaque.orSelf(layer->visibleRegion);
+        if (isOpaqueLayer(layer, i==0)) {
+            screen.subtractSelf(layer->visibleRegion);
         }
     }
 
-    // calculate worm hole.
-    Region screen(Rect(mTarget->width, mTarget->height));
-    screen.subtractSelf(opaque);
+    if (screen.isEmpty()) {
+        ALOGV("clearWormHole: target covered by opaque layers");
+        return 0;
+    }
+
+    // calculate worm hole in dirty area.
     const Rect *holes = NULL;
     size_t numRect = 0;
     holes = screen.getArray(&numRect);
+    flushBatch();
     // clear worm hole.
     struct g2d_surfaceEx surfaceX;
     memset(&surfaceX, 0, sizeof(surfaceX));
@@ -228,7 +688,7 @@ int Composer::clearWormHole(LayerVector& layers)
             continue;
         }
 
-        Rect& rect = (Rect&)holes[i];
+        Rect rect = toTarget(holes[i]);
         ALOGV("clearhole: hole(l:%d,t:%d,r:%d,b:%d)",
                 rect.left, rect.top, rect.right, rect.bottom);
         setG2dSurface(surfaceX, mTarget, rect);
@@ -246,11 +706,6 @@ int Composer::composeLayer(Layer* layer, bool bypass)
         return -EINVAL;
     }
 
-    if (bypass && layer->isSolidColor()) {
-        ALOGV("composeLayer dim layer bypassed");
-        return 0;
-    }
-
     Rect srect = layer->sourceCrop;
     Rect drect = layer->displayFrame;
     struct g2d_surfaceEx dSurfaceX;
@@ -263,14 +718,53 @@ int Composer::composeLayer(Layer* layer, bool bypass)
     }
 
     if (layer->isSolidColor()) {
-        checkDimBuffer();
+        uint32_t alpha = getSolidAlpha(layer);
+        if (bypass || alpha == 0xff || layer->blendMode == BLENDING_NONE) {
+            // opaque color or bottom color over black, fill target directly.
+            uint32_t color = premultiplyColor(layer->color,
+                        layer->blendMode == BLENDING_NONE ? 0xff : alpha);
+            return fillSolidColor(layer, color | 0xff << 24);
+        }
+        if (alpha == 0) {
+            return 0;
+        }
+        // color with alpha, planeAlpha is applied by global alpha.
+        uint32_t colorAlpha = (layer->color >> 24) & 0xff;
+        if (checkDimBuffer(premultiplyColor(layer->color, colorAlpha)) != 0) {
+            ALOGE("composeLayer: no dim buffer");
+            return -ENOMEM;
+        }
     }
 
-    memset(&dSurfaceX, 0, sizeof(dSurfaceX));
+    bool blend = layer->blendMode != BLENDING_NONE && !bypass;
     size_t count = 0;
-    const Rect* visible = layer->visibleRegion.getArray(&count);
+    Region region = layer->visibleRegion.intersect(mDirty);
+    const Rect* visible = region.getArray(&count);
+    if (count == 0) {
+        return 0;
+    }
+
+    // surface descriptors are set up once per layer, clip rects of a
+    // fragmented visible region only patch their own coordinates.
+    struct g2d_surfaceEx layerSurfaceX, frameSurfaceX;
+    memset(&layerSurfaceX, 0, sizeof(layerSurfaceX));
+    memset(&frameSurfaceX, 0, sizeof(frameSurfaceX));
+    if (!layer->isSolidColor()) {
+        setG2dSurface(layerSurfaceX, layer->handle, srect);
+        // tiled and 10-bit sources are yuv after alterFormat too.
+        if (isYuvSurface(layerSurfaceX.base.format)) {
+            setColorspace(getColorspace(layer->dataspace,
+                                        layer->handle->height));
+        }
+    }
+    else {
+        setG2dSurface(layerSurfaceX, mDimBuffer, drect);
+    }
+    Rect dframe = toTarget(drect);
+    setG2dSurface(frameSurfaceX, mTarget, dframe);
+    convertRotation(layer->transform, layerSurfaceX.base, frameSurfaceX.base);
+
     for (size_t i=0; i<count; i++) {
-        Rect srect = layer->sourceCrop;
         Rect clip = visible[i];
         if (clip.isEmpty()) {
             ALOGV("composeLayer: invalid clip");
@@ -283,7 +777,6 @@ int Composer::composeLayer(Layer* layer, bool bypass)
             continue;
         }
 
-        setClipping(srect, drect, clip, layer->transform);
         ALOGV("index:%d, i:%d sourceCrop(l:%d,t:%d,r:%d,b:%d), "
              "visible(l:%d,t:%d,r:%d,b:%d), "
              "display(l:%d,t:%d,r:%d,b:%d)", layer->index, (int)i,
@@ -295,65 +788,93 @@ int Composer::composeLayer(Layer* layer, bool bypass)
         ALOGV("transform:0x%x, blend:0x%x, alpha:0x%x",
                 layer->transform, layer->blendMode, layer->planeAlpha);
 
-        setG2dSurface(dSurfaceX, mTarget, drect);
-
-        struct g2d_surfaceEx sSurfaceX;
-        memset(&sSurfaceX, 0, sizeof(sSurfaceX));
+        struct g2d_surfaceEx sSurfaceX = layerSurfaceX;
         struct g2d_surface& sSurface = sSurfaceX.base;
-
-        if (!layer->isSolidColor()) {
-            setG2dSurface(sSurfaceX, layer->handle, srect);
-        }
-        else {
-            setG2dSurface(sSurfaceX, mDimBuffer, drect);
+        dSurfaceX = frameSurfaceX;
+
+        if (canBatch(layer, clip, sSurfaceX)) {
+            // express clip by surface rects instead of engine clipping.
+            if (!layer->isSolidColor() && clip != drect) {
+                sSurface.left = srect.left + clip.left - drect.left;
+                sSurface.top = srect.top + clip.top - drect.top;
+                sSurface.right = sSurface.left + clip.width();
+                sSurface.bottom = sSurface.top + clip.height();
+            }
+            else if (layer->isSolidColor()) {
+                sSurface.left = clip.left;
+                sSurface.top = clip.top;
+                sSurface.right = clip.right;
+                sSurface.bottom = clip.bottom;
+            }
+            Rect dclip = toTarget(clip);
+            dSurface.left = dclip.left;
+            dSurface.top = dclip.top;
+            dSurface.right = dclip.right;
+            dSurface.bottom = dclip.bottom;
+            if (blend) {
+                convertBlending(layer->blendMode, sSurface, dSurface);
+                sSurface.global_alpha = layer->planeAlpha;
+            }
+            else {
+                // whole batch runs with blending on, so copy opaque layer.
+                sSurface.blendfunc = G2D_ONE;
+                dSurface.blendfunc = G2D_ZERO;
+                sSurface.global_alpha = 0xff;
+            }
+            queueBlit(&sSurfaceX, &dSurfaceX);
+            continue;
         }
 
-        convertRotation(layer->transform, sSurface, dSurface);
+        flushBatch();
+        Rect dclip = toTarget(clip);
+        setClipping(srect, dframe, dclip, layer->transform);
         if (!bypass) {
             convertBlending(layer->blendMode, sSurface, dSurface);
         }
         sSurface.global_alpha = layer->planeAlpha;
 
-        if (layer->blendMode != BLENDING_NONE && !bypass) {
-            enableFunction(mHandle, G2D_GLOBAL_ALPHA, true);
-            enableFunction(mHandle, G2D_BLEND, true);
-        }
-
+        setBlending(blend);
         blitSurface(&sSurfaceX, &dSurfaceX);
-
-        if (layer->blendMode != BLENDING_NONE && !bypass) {
-            enableFunction(mHandle, G2D_BLEND, false);
-            enableFunction(mHandle, G2D_GLOBAL_ALPHA, false);
-        }
     }
 
     return 0;
 }
 
-int Composer::setG2dSurface(struct g2d_surfaceEx& surfaceX, Memory *handle, Rect& rect)
+void Composer::onMemoryRelease(Memory* handle)
 {
-    int alignWidth = 0, alignHeight = 0;
-    struct g2d_surface& surface = surfaceX.base;
+    Mutex::Autolock _l(mSurfaceLock);
+    mSurfaces.removeItem(handle);
+}
+
+void Composer::getSurfaceDesc(Memory *handle, G2dSurfaceDesc& desc)
+{
+    {
+        Mutex::Autolock _l(mSurfaceLock);
+        ssize_t index = mSurfaces.indexOfKey(handle);
+        if (index >= 0) {
+            desc = mSurfaces.valueAt(index);
+            return;
+        }
+    }
 
+    int alignWidth = 0, alignHeight = 0;
     int ret = getAlignedSize(handle, NULL, &alignHeight);
     if (ret != 0) {
         alignHeight = handle->height;
     }
 
+    memset(&desc, 0, sizeof(desc));
     alignWidth = handle->stride;
-    surface.format = convertFormat(handle->fslFormat, handle);
-    surface.stride = alignWidth;
-    enum g2d_tiling tile = G2D_LINEAR;
-    getTiling(handle, &tile);
-    surfaceX.tiling = tile;
+    desc.format = convertFormat(handle->fslFormat, handle);
+    desc.stride = alignWidth;
+    desc.tiling = G2D_LINEAR;
+    getTiling(handle, &desc.tiling);
+    desc.planes[0] = (int)handle->phys;
 
-    int offset = 0;
-    getFlipOffset(handle, &offset);
-    surface.planes[0] = (int)handle->phys + offset;
-
-    switch (surface.format) {
+    switch (desc.format) {
         case G2D_RGB565:
         case G2D_YUYV:
+        case G2D_UYVY:
         case G2D_RGBA8888:
         case G2D_BGRA8888:
         case G2D_RGBX8888:
@@ -363,7 +884,7 @@ int Composer::setG2dSurface(struct g2d_surfaceEx& surfaceX, Memory *handle, Rect
         case G2D_NV16:
         case G2D_NV12:
         case G2D_NV21:
-            surface.planes[1] = surface.planes[0] + surface.stride * alignHeight;
+            desc.planes[1] = desc.planes[0] + desc.stride * alignHeight;
             break;
 
         case G2D_I420:
@@ -371,27 +892,52 @@ int Composer::setG2dSurface(struct g2d_surfaceEx& surfaceX, Memory *handle, Rect
             int c_stride = (alignWidth/2+15)/16*16;
             int stride = alignWidth;
 
-            surface.stride = alignWidth;
-            if (surface.format == G2D_I420) {
-                surface.planes[1] = surface.planes[0] + stride * handle->height;
-                surface.planes[2] = surface.planes[1] + c_stride * handle->height/2;
+            desc.stride = alignWidth;
+            if (desc.format == G2D_I420) {
+                desc.planes[1] = desc.planes[0] + stride * handle->height;
+                desc.planes[2] = desc.planes[1] + c_stride * handle->height/2;
             }
             else {
-                surface.planes[2] = surface.planes[0] + stride * handle->height;
-                surface.planes[1] = surface.planes[2] + c_stride * handle->height/2;
+                desc.planes[2] = desc.planes[0] + stride * handle->height;
+                desc.planes[1] = desc.planes[2] + c_stride * handle->height/2;
             }
             } break;
 
         default:
-            ALOGI("does not support format:%d", surface.format);
+            ALOGI("does not support format:%d", desc.format);
             break;
     }
+    desc.width = handle->width;
+    desc.height = handle->height;
+
+    // released buffers are dropped in onMemoryRelease, others stay.
+    Mutex::Autolock _l(mSurfaceLock);
+    mSurfaces.add(handle, desc);
+}
+
+int Composer::setG2dSurface(struct g2d_surfaceEx& surfaceX, Memory *handle, Rect& rect)
+{
+    struct g2d_surface& surface = surfaceX.base;
+    G2dSurfaceDesc desc;
+    getSurfaceDesc(handle, desc);
+
+    // flip offset moves with buffer shown, so it is queried every time.
+    int offset = 0;
+    getFlipOffset(handle, &offset);
+
+    surface.format = desc.format;
+    surface.stride = desc.stride;
+    surfaceX.tiling = desc.tiling;
+    surface.planes[0] = desc.planes[0] + offset;
+    for (int i=1; i<3; i++) {
+        surface.planes[i] = desc.planes[i] != 0 ? desc.planes[i] + offset : 0;
+    }
     surface.left = rect.left;
     surface.top = rect.top;
     surface.right = rect.right;
     surface.bottom = rect.bottom;
-    surface.width = handle->width;
-    surface.height = handle->height;
+    surface.width = desc.width;
+    surface.height = desc.height;
 
     return 0;
 }
@@ -433,6 +979,9 @@ enum g2d_format Composer::convertFormat(int format, Memory *handle)
         case FORMAT_YUYV:
             halFormat = G2D_YUYV;
             break;
+        case FORMAT_UYVY:
+            halFormat = G2D_UYVY;
+            break;
 
         default:
             ALOGE("unsupported format:0x%x", format);
@@ -444,6 +993,26 @@ enum g2d_format Composer::convertFormat(int format, Memory *handle)
     return halFormat;
 }
 
+bool Composer::isFormatSupported(int format)
+{
+    switch (format) {
+        case FORMAT_RGBA8888:
+        case FORMAT_RGBX8888:
+        case FORMAT_RGB565:
+        case FORMAT_BGRA8888:
+        case FORMAT_NV21:
+        case FORMAT_NV12:
+        case FORMAT_I420:
+        case FORMAT_YV12:
+        case FORMAT_NV16:
+        case FORMAT_YUYV:
+        case FORMAT_UYVY:
+            return true;
+        default:
+            return false;
+    }
+}
+
 int Composer::convertRotation(int transform, struct g2d_surface& src,
                         struct g2d_surface& dst)
 {
@@ -531,6 +1100,11 @@ int Composer::getFlipOffset(Memory *handle, int *offset)
 
 int Composer::getTiling(Memory *handle, enum g2d_tiling* tile)
 {
+    if (handle->flags & FLAGS_SUPERTILED) {
+        *tile = G2D_SUPERTILED;
+        return 0;
+    }
+
     if (mGetTiling == NULL) {
         return -EINVAL;
     }
@@ -640,12 +1214,14 @@ int Composer::finishEngine(void* handle)
 
 bool Composer::isFeatureSupported(g2d_feature feature)
 {
-    if (mQueryFeature == NULL || mHandle == NULL) {
+    // may run beside composition in other thread, so don't bind.
+    void* handle = getContext()->handle;
+    if (mQueryFeature == NULL || handle == NULL) {
         return false;
     }
 
     int enable = 0;
-    (*mQueryFeature)(mHandle, (void*)feature, (void*)&enable);
+    (*mQueryFeature)(handle, (void*)feature, (void*)&enable);
     return (enable != 0);
 }
 
@@ -17,8 +17,12 @@
 #ifndef _FSL_COMPOSER_H_
 #define _FSL_COMPOSER_H_
 
+#include <pthread.h>
 #include <g2dExt.h>
+#include <utils/KeyedVector.h>
+#include <utils/Vector.h>
 #include "Memory.h"
+#include "MemoryManager.h"
 #include "Layer.h"
 
 namespace fsl {
@@ -29,55 +33,146 @@ typedef int (*hwc_func3)(void* handle, void* arg1, void* arg2);
 typedef int (*hwc_func4)(void* handle, void* arg1, void* arg2, void* arg3);
 typedef int (*hwc_func5)(void* handle, void* arg1, void* arg2, void* arg3, void* arg4);
 
-class Composer
+class Composer;
+// g2d engine handle of one thread, handle is bound to thread opened it,
+// so that displays composed in their own present threads run in parallel.
+struct G2dContext
+{
+    void* handle;
+    // blend state currently programmed to this handle.
+    bool blending;
+    // yuv colorspace currently programmed, -1 before first yuv source.
+    int colorspace;
+    hwc_func1 closeEngine;
+    // composer which tracks this context.
+    Composer* owner;
+};
+
+// max source number of one g2d multi-source blit.
+#define G2D_BATCH_LAYERS 8
+
+using android::KeyedVector;
+
+// buffer layout queried from GPU module, planes without flip offset.
+struct G2dSurfaceDesc
+{
+    enum g2d_format format;
+    enum g2d_tiling tiling;
+    int planes[3];
+    int stride;
+    int width;
+    int height;
+};
+
+class Composer : public MemoryListener
 {
 public:
     Composer();
     ~Composer();
 
+    // drop cached surface of buffer.
+    virtual void onMemoryRelease(Memory* handle);
+
     bool isValid();
     // set composite target buffer.
     int setRenderTarget(Memory* memory);
+    // compose layers scaled into top-left width x height of render
+    // target, 0 for the whole target.
+    int setRenderSize(int width, int height);
+    // limit composition to dirty area of render target.
+    int setDirtyRegion(Region& dirty);
+    // yuv target can't be blended, stage layers in rgb buffer unless
+    // one opaque layer covers the dirty area.
+    int prepareTarget(LayerVector& layers);
     // clear worm hole introduced by layers not cover whole screen.
     int clearWormHole(LayerVector& layers);
     // compose display layer.
     int composeLayer(Layer* layer, bool bypass);
     // sync 2D blit engine.
     int finishComposite();
+    // submit blits collected in batch mode.
+    int flushBatch();
     // lock surface to get GPU specific resource.
     int lockSurface(Memory *handle);
     // unlock surface to release resource.
     int unlockSurface(Memory *handle);
     bool isFeatureSupported(g2d_feature feature);
+    // 2D engine reads buffer of this fsl format.
+    bool isFormatSupported(int format);
+    // get tiling layout of memory.
+    int getTiling(Memory *handle, enum g2d_tiling* tile);
 
 private:
     int setG2dSurface(struct g2d_surfaceEx& surfaceX, Memory *handle, Rect& rect);
+    // layout of buffer, from cache after first query.
+    void getSurfaceDesc(Memory *handle, G2dSurfaceDesc& desc);
     enum g2d_format convertFormat(int format, Memory *handle);
     int convertRotation(int transform, struct g2d_surface& src,
                         struct g2d_surface& dst);
     int convertBlending(int blending, struct g2d_surface& src,
                         struct g2d_surface& dst);
 	void getModule(char *path, const char *name);
-    int checkDimBuffer();
-    int clearRect(Memory* target, Rect& rect);
+    // dim buffer filled with premultiplied color for translucent dim.
+    int checkDimBuffer(uint32_t color);
+    int clearRect(Memory* target, Rect& rect, uint32_t color);
+    // map rect of layer coordinates to render area of target.
+    Rect toTarget(const Rect& rect);
+    // rgb buffer of yuv target size to blend layers in.
+    int checkStageBuffer(Memory* output);
+    // fill visible area of solid color layer with g2d clear.
+    int fillSolidColor(Layer* layer, uint32_t color);
 
     int getAlignedSize(Memory *handle, int *width, int *height);
     int getFlipOffset(Memory *handle, int *offset);
-    int getTiling(Memory *handle, enum g2d_tiling* tile);
     enum g2d_format alterFormat(Memory *handle, enum g2d_format format);
 
     int setClipping(Rect& src, Rect& dst, Rect& clip, int rotation);
+    int setBlending(bool enable);
+    // select yuv to rgb matrix, pending batch is flushed on change.
+    int setColorspace(enum g2d_cap_mode mode);
+    bool canBatch(Layer* layer, Rect& clip, struct g2d_surfaceEx& srcEx);
+    int queueBlit(struct g2d_surfaceEx *srcEx, struct g2d_surfaceEx *dstEx);
     int blitSurface(struct g2d_surfaceEx *srcEx, struct g2d_surfaceEx *dstEx);
     int openEngine(void** handle);
     int closeEngine(void* handle);
     int clearFunction(void* handle, struct g2d_surface* area);
     int enableFunction(void* handle, enum g2d_cap_mode cap, bool enable);
     int finishEngine(void* handle);
+    // get g2d context of calling thread, opened on first use.
+    G2dContext* getContext();
+    // use context of calling thread for this composition.
+    int bindContext();
+    // thread exit drops context from composer and closes it.
+    static void releaseContext(void* data);
+    static void closeContext(G2dContext* context);
 
 private:
+    pthread_key_t mContextKey;
+    // contexts of all threads, closed with composer.
+    Mutex mContextLock;
+    android::Vector<G2dContext*> mContexts;
+    G2dContext* mContext;
+    // handle of bound context.
     void* mHandle;
+    bool mValid;
     Memory* mTarget;
     Memory* mDimBuffer;
+    uint32_t mDimColor;
+    // yuv target written from stage buffer in finishComposite.
+    Memory* mStageBuffer;
+    Memory* mOutput;
+    Region mDirty;
+    int mRenderWidth;
+    int mRenderHeight;
+
+    // collect blits and submit them with one multi-source blit.
+    bool mBatchMode;
+    int mBatchCount;
+    struct g2d_surface_pair mBatchPairs[G2D_BATCH_LAYERS];
+
+    // surface layout of each buffer composed, kept until it's released.
+    Mutex mSurfaceLock;
+    KeyedVector<Memory*, G2dSurfaceDesc> mSurfaces;
 
     hwc_func3 mGetAlignedSize;
     hwc_func2 mGetFlipOffset;
@@ -88,6 +183,7 @@ private:
 
     hwc_func5 mSetClipping;
     hwc_func3 mBlitFunction;
+    hwc_func3 mMultiBlitFunction;
     hwc_func1 mOpenEngine;
     hwc_func1 mCloseEngine;
     hwc_func2 mClearFunction;
@@ -14,20 +14,26 @@
  * limitations under the License.
  */
 
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #include <cutils/log.h>
+#include <poll.h>
 #include <sync/sync.h>
 #include <system/window.h>
+#include <utils/JenkinsHash.h>
+#include <utils/Trace.h>
 
 #include "Memory.h"
+#include "MemoryDesc.h"
 #include <g2dExt.h>
 #include "Display.h"
+#include "SidebandStream.h"
 
 namespace fsl {
 
 static inline int compare_type(const DisplayConfig& lhs, const DisplayConfig& rhs)
 {
     if (lhs.mXres == rhs.mXres && lhs.mYres == rhs.mYres) {
-        return 0;
+        return lhs.mModeIndex - rhs.mModeIndex;
     }
     else if (lhs.mXres > rhs.mXres || lhs.mYres > rhs.mYres) {
         return 1;
@@ -44,14 +50,44 @@ Display::Display()
     for (size_t i=0; i<MAX_LAYERS; i++) {
         mLayers[i] = new Layer();
         mLayers[i]->index = i;
+        mActivePos[i] = -1;
+        mFreeSlots[i] = MAX_LAYERS - 1 - i;
     }
-
+    mActiveCount = 0;
+    mFreeCount = MAX_LAYERS;
+    memset(mPrivLayers, 0, sizeof(mPrivLayers));
+
+    mClientLayer = new Layer();
+    mClientLayer->index = MAX_LAYERS;
+    mClientMixed = false;
+    mPresentThread = NULL;
+    mPresentPending = false;
+    TunableManager::getInstance()->getTunables(&mTunables);
     invalidLayers();
     mConnected = false;
     mType = DISPLAY_INVALID;
     mRenderTarget = NULL;
     mAcquireFence = -1;
+    mPresentFence = -1;
     mIndex = -1;
+    mFrameCount = 0;
+    mLayerHash = 0;
+    mCacheHit = false;
+    mPresentStart = 0;
+    mIdle = false;
+    mRenderWidth = 0;
+    mRenderHeight = 0;
+    mComposeTime = 0;
+    mVsyncTime = 0;
+    memset(mLatchCosts, 0, sizeof(mLatchCosts));
+    mLatchCostIndex = 0;
+    memset(mContentHandles, 0, sizeof(mContentHandles));
+    mContentLayer = -1;
+    memset(mContentTimes, 0, sizeof(mContentTimes));
+    mContentCount = 0;
+    mContentPeriod = 0;
+    mContentHash = 0;
+    resetDamageLocked();
 }
 
 Display::~Display()
@@ -66,6 +102,9 @@ Display::~Display()
             mLayers[i] = NULL;
         }
     }
+    resetLayerLocked(mClientLayer);
+    delete mClientLayer;
+    mClientLayer = NULL;
 
     mRenderTarget = NULL;
     if (mAcquireFence != -1) {
@@ -83,6 +122,12 @@ void Display::setVsyncEnabled(bool enabled)
 {
 }
 
+int Display::setColorTransform(const float* matrix)
+{
+    // no color pipeline, only identity is handled.
+    return (matrix == NULL) ? 0 : -EINVAL;
+}
+
 void Display::setFakeVSync(bool)
 {
 }
@@ -138,6 +183,7 @@ int Display::setConfig(int width, int height, int* format)
     DisplayConfig config;
     config.mXres = width;
     config.mYres = height;
+    config.mModeIndex = 0;
     if (format) {
         config.mFormat = *format;
     }
@@ -181,24 +227,159 @@ int Display::getActiveId()
     return mActiveConfig;
 }
 
+void Display::prepareOverlay()
+{
+}
+
 bool Display::checkOverlay(Layer* layer)
 {
     return false;
 }
 
+bool Display::checkPlaneTransform(Layer* layer)
+{
+    return false;
+}
+
+Layer* Display::testOverlay()
+{
+    return NULL;
+}
+
+bool Display::checkCursor(Layer* layer)
+{
+    return false;
+}
+
+int Display::updateCursorLocked(Layer* layer)
+{
+    return -EINVAL;
+}
+
+int Display::setCursorPosition(Layer* layer, int x, int y)
+{
+    Mutex::Autolock _l(mLock);
+    if (layer == NULL || layer->type != LAYER_TYPE_CURSOR) {
+        return -EINVAL;
+    }
+
+    layer->displayFrame.offsetTo(x, y);
+    return updateCursorLocked(layer);
+}
+
+int Display::setSidebandStream(Layer* layer, const native_handle_t* stream)
+{
+    Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
+    if (layer == NULL) {
+        return -EINVAL;
+    }
+
+    if (layer->sideband != NULL && layer->sideband->handle() == stream) {
+        return 0;
+    }
+
+    if (layer->sideband != NULL) {
+        delete layer->sideband;
+        layer->sideband = NULL;
+        layer->handle = NULL;
+    }
+
+    if (stream == NULL) {
+        return 0;
+    }
+
+    layer->sideband = SidebandStream::create(stream);
+    return (layer->sideband != NULL) ? 0 : -EINVAL;
+}
+
 int Display::performOverlay()
 {
     return 0;
 }
 
+int Display::getPresentFence(int32_t* outPresentFence)
+{
+    Mutex::Autolock _l(mLock);
+    if (outPresentFence != NULL) {
+        *outPresentFence = mPresentFence;
+        mPresentFence = -1;
+    }
+
+    return 0;
+}
+
 int Display::updateScreen()
 {
     return -EINVAL;
 }
 
+int Display::queueWriteback(Memory* /*buffer*/, int /*acquireFence*/)
+{
+    return -EINVAL;
+}
+
+int Display::takeWriteback(Memory* /*buffer*/, int* /*outFence*/)
+{
+    return -EINVAL;
+}
+
+bool Display::isMirrorLocked(Display* other)
+{
+    if (other == NULL || other == this) {
+        return false;
+    }
+
+    LayerVector layers;
+    for (size_t i=0; i<mActiveCount; i++) {
+        if (mActiveLayers[i]->type == LAYER_TYPE_CLIENT) {
+            return false;
+        }
+        layers.add(mActiveLayers[i]);
+    }
+
+    Mutex::Autolock _l(other->mLock);
+    if (layers.size() == 0 || other->mActiveCount != layers.size()) {
+        return false;
+    }
+
+    LayerVector others;
+    for (size_t i=0; i<other->mActiveCount; i++) {
+        others.add(other->mActiveLayers[i]);
+    }
+
+    for (size_t i=0; i<layers.size(); i++) {
+        Layer* layer = layers[i];
+        Layer* peer = others[i];
+        if (peer->type == LAYER_TYPE_CLIENT ||
+            layer->handle != peer->handle ||
+            layer->transform != peer->transform ||
+            layer->blendMode != peer->blendMode ||
+            layer->planeAlpha != peer->planeAlpha ||
+            layer->color != peer->color ||
+            layer->sourceCrop != peer->sourceCrop ||
+            layer->displayFrame != peer->displayFrame) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int Display::setRenderTarget(Memory* buffer, int acquireFence)
 {
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
+    if (mClientMixed) {
+        // client target is one layer of device composition.
+        if (mClientLayer->acquireFence != -1) {
+            close(mClientLayer->acquireFence);
+        }
+        mClientLayer->handle = buffer;
+        mClientLayer->acquireFence = acquireFence;
+        return 0;
+    }
+
     if (mAcquireFence != -1) {
         close(mAcquireFence);
     }
@@ -215,6 +396,16 @@ void Display::resetLayerLocked(Layer* layer)
         return;
     }
 
+    // area of composed layer needs to be recomposed.
+    if (layer->composed) {
+        mRemovedDamage.orSelf(layer->lastState.displayFrame);
+        layer->composed = false;
+    }
+    if (layer->busy && layer != mClientLayer) {
+        removePrivLocked(layer);
+        removeActiveLocked(layer);
+    }
+
     layer->busy = false;
     layer->zorder = 0;
     layer->origType = LAYER_TYPE_INVALID;
@@ -223,15 +414,22 @@ void Display::resetLayerLocked(Layer* layer)
     layer->transform = 0;
     layer->blendMode = 0;
     layer->color = 0;
+    layer->dataspace = 0;
     layer->sourceCrop.clear();
     layer->displayFrame.clear();
     layer->visibleRegion.clear();
+    layer->surfaceDamage.clear();
+    layer->damageState = DAMAGE_UNKNOWN;
     if (layer->acquireFence != -1) {
         close(layer->acquireFence);
     }
     layer->acquireFence = -1;
     layer->releaseFence = -1;
     layer->priv = NULL;
+    if (layer->sideband != NULL) {
+        delete layer->sideband;
+        layer->sideband = NULL;
+    }
 }
 
 void Display::releaseLayer(int index)
@@ -242,6 +440,7 @@ void Display::releaseLayer(int index)
     }
 
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
     if (mLayers[index] == NULL) {
         return;
     }
@@ -257,43 +456,146 @@ Layer* Display::getLayer(int index)
         return NULL;
     }
 
+    // layer is changed by caller after it's returned.
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
+    if (mActivePos[index] < 0) {
+        ALOGE("%s layer:%d is not created", __func__, index);
+        return NULL;
+    }
+
     return mLayers[index];
 }
 
 Layer* Display::getLayerByPriv(void* priv)
 {
+    if (priv == NULL) {
+        return NULL;
+    }
+
     Mutex::Autolock _l(mLock);
-    Layer* layer = NULL;
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            continue;
+    waitPresentIdleLocked();
+    size_t mask = LAYER_PRIV_SLOTS - 1;
+    for (size_t i=privSlot(priv); mPrivLayers[i] != NULL; i=(i+1)&mask) {
+        if (mPrivLayers[i]->priv == priv) {
+            return mPrivLayers[i];
         }
+    }
 
-        if (mLayers[i]->priv == priv) {
-            layer = mLayers[i];
-            break;
-        }
+    return NULL;
+}
+
+void Display::setLayerPriv(Layer* layer, void* priv)
+{
+    if (layer == NULL || layer->index >= MAX_LAYERS) {
+        return;
     }
 
-    return layer;
+    Mutex::Autolock _l(mLock);
+    if (!layer->busy) {
+        ALOGE("%s layer:%d is not created", __func__, layer->index);
+        return;
+    }
+
+    removePrivLocked(layer);
+    layer->priv = priv;
+    addPrivLocked(layer);
 }
 
 Layer* Display::getFreeLayer()
 {
     Mutex::Autolock _l(mLock);
-    Layer* layer = NULL;
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            mLayers[i]->busy = true;
-            layer = mLayers[i];
-            break;
-        }
+    waitPresentIdleLocked();
+    if (mFreeCount == 0) {
+        return NULL;
     }
 
+    Layer* layer = mLayers[mFreeSlots[--mFreeCount]];
+    layer->busy = true;
+    addActiveLocked(layer);
+
     return layer;
 }
 
+void Display::addActiveLocked(Layer* layer)
+{
+    mActivePos[layer->index] = mActiveCount;
+    mActiveLayers[mActiveCount++] = layer;
+}
+
+void Display::removeActiveLocked(Layer* layer)
+{
+    int32_t pos = mActivePos[layer->index];
+    if (pos < 0) {
+        return;
+    }
+
+    // move last active layer into the hole.
+    Layer* last = mActiveLayers[--mActiveCount];
+    mActiveLayers[pos] = last;
+    mActivePos[last->index] = pos;
+    mActivePos[layer->index] = -1;
+    mFreeSlots[mFreeCount++] = layer->index;
+}
+
+size_t Display::privSlot(void* priv)
+{
+    // drop alignment bits of pointer before multiplicative hash.
+    uint32_t key = (uint32_t)((uintptr_t)priv >> 3);
+    return (key * 2654435761U) & (LAYER_PRIV_SLOTS - 1);
+}
+
+void Display::addPrivLocked(Layer* layer)
+{
+    if (layer->priv == NULL) {
+        return;
+    }
+
+    // table has twice slots of layers, so it's never full.
+    size_t mask = LAYER_PRIV_SLOTS - 1;
+    size_t i = privSlot(layer->priv);
+    while (mPrivLayers[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    mPrivLayers[i] = layer;
+}
+
+void Display::removePrivLocked(Layer* layer)
+{
+    if (layer->priv == NULL) {
+        return;
+    }
+
+    size_t mask = LAYER_PRIV_SLOTS - 1;
+    size_t i = privSlot(layer->priv);
+    while (mPrivLayers[i] != NULL && mPrivLayers[i] != layer) {
+        i = (i + 1) & mask;
+    }
+    if (mPrivLayers[i] == NULL) {
+        return;
+    }
+
+    // shift following entries back, so lookup never stops at a hole
+    // before the entry it's probing for.
+    size_t j = i;
+    mPrivLayers[i] = NULL;
+    while (true) {
+        j = (j + 1) & mask;
+        if (mPrivLayers[j] == NULL) {
+            break;
+        }
+
+        size_t k = privSlot(mPrivLayers[j]->priv);
+        bool inRange = (i <= j) ? (k > i && k <= j) : (k > i || k <= j);
+        if (inRange) {
+            continue;
+        }
+        mPrivLayers[i] = mPrivLayers[j];
+        mPrivLayers[j] = NULL;
+        i = j;
+    }
+}
+
 int Display::getRequests(int32_t* outDisplayRequests, uint32_t* outNumRequests,
                          uint64_t* outLayers, int32_t* outLayerRequests)
 {
@@ -319,15 +621,14 @@ int Display::getReleaseFences(uint32_t* outNumElements, uint64_t* outLayers,
     uint32_t numElements = 0;
 
     Mutex::Autolock _l(mLock);
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            continue;
-        }
-
-        if (mLayers[i]->releaseFence != -1) {
+    for (size_t i=0; i<mActiveCount; i++) {
+        Layer* layer = mActiveLayers[i];
+        if (layer->releaseFence != -1) {
             if (outLayers != NULL && outFences != NULL) {
-                outLayers[numElements] = (uint64_t)mLayers[i]->index;
-                outFences[numElements] = (int32_t)mLayers[i]->releaseFence;
+                outLayers[numElements] = (uint64_t)layer->index;
+                outFences[numElements] = (int32_t)layer->releaseFence;
+                // fence is owned by caller now.
+                layer->releaseFence = -1;
             }
             numElements++;
         }
@@ -346,15 +647,12 @@ int Display::getChangedTypes(uint32_t* outNumTypes, uint64_t* outLayers,
     uint32_t numTypes = 0;
 
     Mutex::Autolock _l(mLock);
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            continue;
-        }
-
-        if (mLayers[i]->type != mLayers[i]->origType) {
+    for (size_t i=0; i<mActiveCount; i++) {
+        Layer* layer = mActiveLayers[i];
+        if (layer->type != layer->origType) {
             if (outLayers != NULL && outTypes != NULL) {
-                outLayers[numTypes] = (uint64_t)mLayers[i]->index;
-                outTypes[numTypes] = (int32_t)mLayers[i]->type;
+                outLayers[numTypes] = (uint64_t)layer->index;
+                outTypes[numTypes] = (int32_t)layer->type;
             }
             numTypes++;
         }
@@ -371,47 +669,67 @@ bool Display::verifyLayers()
 {
     bool deviceCompose = true;
     bool rotationCap = mComposer.isFeatureSupported(G2D_ROTATION);
+    nsecs_t start = systemTime(CLOCK_MONOTONIC);
+    bool needClient[MAX_LAYERS];
+    bool planeOnly[MAX_LAYERS];
+    int verifiedType[MAX_LAYERS];
 
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
+    TunableManager::getInstance()->getTunables(&mTunables);
     mLayerVector.clear();
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            continue;
-        }
-
-        if (mLayers[i]->transform != 0 && !rotationCap) {
-            deviceCompose = false;
-            ALOGV("g2d can't support rotation");
-            break;
+    mClientMixed = false;
+    resetLayerLocked(mClientLayer);
+    memset(needClient, 0, sizeof(needClient));
+    memset(planeOnly, 0, sizeof(planeOnly));
+    for (size_t i=0; i<mActiveCount; i++) {
+        Layer* layer = mActiveLayers[i];
+        if (layer->transform != 0 && !rotationCap) {
+            if (checkPlaneTransform(layer)) {
+                planeOnly[layer->index] = true;
+            }
+            else {
+                needClient[layer->index] = true;
+                ALOGV("g2d can't support rotation");
+            }
         }
 
-        switch (mLayers[i]->origType) {
+        switch (layer->origType) {
             case LAYER_TYPE_CLIENT:
                 ALOGV("client type detected");
-                deviceCompose = false;
+                needClient[layer->index] = true;
                 break;
 
             case LAYER_TYPE_SOLID_COLOR:
                 ALOGV("solid color type detected");
-                mLayers[i]->blendMode = BLENDING_DIM;
-                mLayers[i]->type = LAYER_TYPE_SOLID_COLOR;
+                layer->blendMode = BLENDING_DIM;
+                layer->type = LAYER_TYPE_SOLID_COLOR;
                 break;
 
             case LAYER_TYPE_SIDEBAND:
-                //set side band parameters.
-                mLayers[i]->type = LAYER_TYPE_SIDEBAND;
+                // newest frame goes to overlay plane, or is composed by
+                // 2D engine when no plane is free.
+                layer->handle = (layer->sideband != NULL) ?
+                        layer->sideband->latchFrame() : NULL;
+                layer->damageState = DAMAGE_ALL;
+                layer->type = LAYER_TYPE_SIDEBAND;
                 break;
 
             case LAYER_TYPE_DEVICE:
-                mLayers[i]->type = LAYER_TYPE_DEVICE;
+                layer->type = LAYER_TYPE_DEVICE;
+                // format 2D engine can't read may still be scanned out.
+                if (layer->handle != NULL &&
+                    !mComposer.isFormatSupported(layer->handle->fslFormat)) {
+                    planeOnly[layer->index] = true;
+                }
                 break;
 
             case LAYER_TYPE_CURSOR:
-                mLayers[i]->type = LAYER_TYPE_DEVICE;
+                layer->type = LAYER_TYPE_DEVICE;
                 break;
 
             default:
-                ALOGE("verifyLayers: invalid type:%d", mLayers[i]->origType);
+                ALOGE("verifyLayers: invalid type:%d", layer->origType);
                 break;
         }
     }
@@ -420,23 +738,124 @@ bool Display::verifyLayers()
         deviceCompose = false;
     }
 
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            continue;
+    LayerVector layers;
+    for (size_t i=0; i<mActiveCount; i++) {
+        layers.add(mActiveLayers[i]);
+        verifiedType[mActiveLayers[i]->index] = mActiveLayers[i]->type;
+    }
+
+    // layer rotated by plane can't fall back to 2D engine, layers are
+    // assigned again with it as client layer when no plane takes it.
+    ssize_t clientLow = -1, clientHigh = -1;
+    Region clientRegion;
+    bool retry = true;
+    while (retry) {
+        retry = false;
+        mLayerVector.clear();
+        for (size_t i=0; i<layers.size(); i++) {
+            layers[i]->type = verifiedType[layers[i]->index];
         }
 
-        // handle overlay.
-        if (checkOverlay(mLayers[i])) {
-            mLayers[i]->type = LAYER_TYPE_DEVICE;
-            continue;
+        // client target takes the z-range from the lowest to the highest
+        // layer which needs GPU, layers out of the range stay on device.
+        clientLow = -1;
+        clientHigh = -1;
+        for (size_t i=0; i<layers.size(); i++) {
+            if (needClient[layers[i]->index]) {
+                if (clientLow < 0) {
+                    clientLow = i;
+                }
+                clientHigh = i;
+            }
+        }
+        // virtual display output is client target itself.
+        if (clientLow >= 0 && mType == DISPLAY_VIRTUAL) {
+            deviceCompose = false;
         }
 
-        if (!deviceCompose) {
-            mLayers[i]->type = LAYER_TYPE_CLIENT;
-            continue;
+        // handle overlay from top to bottom, layer covered by
+        // one in render target can't be put on overlay plane.
+        Region covered;
+        clientRegion.clear();
+        prepareOverlay();
+        for (ssize_t i=layers.size()-1; i>=0; i--) {
+            Layer* layer = layers[i];
+            // cursor plane is above all other planes.
+            if (layer->origType == LAYER_TYPE_CURSOR &&
+                i == (ssize_t)layers.size() - 1 &&
+                !needClient[layer->index] && checkCursor(layer)) {
+                layer->type = LAYER_TYPE_CURSOR;
+                continue;
+            }
+
+            if (!needClient[layer->index] &&
+                covered.intersect(layer->displayFrame).isEmpty() &&
+                checkOverlay(layer)) {
+                if (layer->origType != LAYER_TYPE_SIDEBAND) {
+                    layer->type = LAYER_TYPE_DEVICE;
+                }
+                continue;
+            }
+            covered.orSelf(layer->displayFrame);
+
+            if (!deviceCompose || (i >= clientLow && i <= clientHigh)) {
+                layer->type = LAYER_TYPE_CLIENT;
+                clientRegion.orSelf(layer->displayFrame);
+                continue;
+            }
+            mLayerVector.add(layer);
+        }
+
+        // fall back overlay layers one by one until the assignment
+        // is committable.
+        Layer* layer = NULL;
+        while ((layer = testOverlay()) != NULL) {
+            if (!deviceCompose) {
+                layer->type = LAYER_TYPE_CLIENT;
+                continue;
+            }
+            if (layer->origType != LAYER_TYPE_SIDEBAND) {
+                layer->type = LAYER_TYPE_DEVICE;
+            }
+            mLayerVector.add(layer);
+        }
+
+        for (size_t i=0; i<mLayerVector.size(); i++) {
+            int index = mLayerVector[i]->index;
+            if (planeOnly[index]) {
+                planeOnly[index] = false;
+                needClient[index] = true;
+                retry = true;
+            }
+        }
+    }
+
+    if (deviceCompose && clientLow >= 0 && mLayerVector.size() > 0) {
+        // client target is blended by G2D at z-order of client range.
+        Rect bounds = clientRegion.getBounds();
+        mClientLayer->busy = true;
+        mClientLayer->origType = LAYER_TYPE_DEVICE;
+        mClientLayer->type = LAYER_TYPE_DEVICE;
+        mClientLayer->zorder = layers[clientLow]->zorder;
+        mClientLayer->blendMode = BLENDING_PREMULT;
+        mClientLayer->planeAlpha = 0xff;
+        mClientLayer->sourceCrop = bounds;
+        mClientLayer->displayFrame = bounds;
+        mClientLayer->visibleRegion = clientRegion;
+        mClientLayer->damageState = DAMAGE_ALL;
+        mLayerVector.add(mClientLayer);
+        mClientMixed = true;
+    }
+
+    int client = 0;
+    for (size_t i=0; i<layers.size(); i++) {
+        if (layers[i]->type == LAYER_TYPE_CLIENT) {
+            client++;
         }
-        mLayerVector.add(mLayers[i]);
     }
+    int device = mLayerVector.size() - (mClientMixed ? 1 : 0);
+    mStats.setLayers(client, device, layers.size() - client - device);
+    mStats.addTime(STAT_VALIDATE, systemTime(CLOCK_MONOTONIC) - start);
 
     return deviceCompose;
 }
@@ -444,9 +863,13 @@ bool Display::verifyLayers()
 int Display::invalidLayers()
 {
     Mutex::Autolock _l(mLock);
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        resetLayerLocked(mLayers[i]);
+    waitPresentIdleLocked();
+    // reset moves the last active layer, so take layers from the end.
+    while (mActiveCount > 0) {
+        resetLayerLocked(mActiveLayers[mActiveCount - 1]);
     }
+    resetLayerLocked(mClientLayer);
+    mClientMixed = false;
     mLayerVector.clear();
 
     return 0;
@@ -459,52 +882,674 @@ int Display::composeLayers()
     return composeLayersLocked();
 }
 
+bool Display::canPresentAsyncLocked()
+{
+    // only frame composed by G2D into own targets has nothing
+    // to fence, so it needn't present fence from commit.
+    // client target is released by present fence.
+    return mType != DISPLAY_VIRTUAL && mLayerVector.size() > 0 &&
+           !mClientMixed;
+}
+
+void Display::waitPresentIdleLocked()
+{
+    while (mPresentPending) {
+        mPresentCondition.wait(mLock);
+    }
+}
+
+int Display::presentFrame(int32_t* outPresentFence)
+{
+    bool async = false;
+    {
+        Mutex::Autolock _l(mLock);
+        waitPresentIdleLocked();
+        mPresentStart = systemTime(CLOCK_MONOTONIC);
+        bool repeat = updateContentRateLocked(mPresentStart);
+        if (mIdle) {
+            // full refresh rate is back with this frame.
+            mIdle = false;
+            exitIdleLocked();
+            repeat = false;
+        }
+
+        if (repeat) {
+            // display runs at content rate, same frame stays on screen.
+            ATRACE_NAME("HWC repeated frame");
+            if (outPresentFence != NULL) {
+                *outPresentFence = -1;
+            }
+            return 0;
+        }
+
+        if (mTunables.mPresentAsync && canPresentAsyncLocked()) {
+            if (mPresentThread == NULL) {
+                mPresentThread = new PresentThread(this);
+            }
+            mPresentPending = true;
+            async = true;
+        }
+        ATRACE_INT("HWC present pending", mPresentPending ? 1 : 0);
+    }
+
+    if (async) {
+        // composition and commit overlap with next frame preparation.
+        if (outPresentFence != NULL) {
+            *outPresentFence = -1;
+        }
+        mPresentThread->present();
+        return 0;
+    }
+
+    presentLayers();
+    return getPresentFence(outPresentFence);
+}
+
+void Display::presentLayers()
+{
+    nsecs_t compose = systemTime(CLOCK_MONOTONIC);
+    composeLayers();
+
+    nsecs_t start = systemTime(CLOCK_MONOTONIC);
+    updateScreen();
+    nsecs_t end = systemTime(CLOCK_MONOTONIC);
+
+    Mutex::Autolock _l(mLock);
+    // commit may wait flip of last frame, so only composition is taken.
+    mLatchCosts[mLatchCostIndex] = start - compose;
+    mLatchCostIndex = (mLatchCostIndex + 1) % LATCH_COST_NUM;
+    mStats.addTime(STAT_COMMIT, end - start);
+    mStats.addTime(STAT_FRAME, end - mPresentStart);
+    nsecs_t period = 0;
+    if (mActiveConfig >= 0) {
+        period = mConfigs[mActiveConfig].mVsyncPeriod;
+    }
+    mStats.finishFrame(period);
+}
+
+void Display::checkIdle(nsecs_t now)
+{
+    {
+        Mutex::Autolock _l(mLock);
+        if (mIdle || mPresentPending || mPresentStart == 0 ||
+            mActiveConfig < 0 || mTunables.mIdleFrames <= 0) {
+            return;
+        }
+
+        nsecs_t period = mConfigs[mActiveConfig].mVsyncPeriod;
+        if (now - mPresentStart < period * mTunables.mIdleFrames) {
+            return;
+        }
+
+        mIdle = true;
+        if (!enterIdleLocked()) {
+            return;
+        }
+        // hold off presentFrame while last frame is committed again.
+        mPresentPending = true;
+    }
+
+    ALOGV("display %d enters idle", mIndex);
+    updateScreen();
+
+    Mutex::Autolock _l(mLock);
+    mPresentPending = false;
+    mPresentCondition.broadcast();
+}
+
+extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
+                           const struct timespec *request,
+                           struct timespec *remain);
+
+void Display::setVsyncTime(nsecs_t timestamp)
+{
+    Mutex::Autolock _l(mLock);
+    if (timestamp > mVsyncTime) {
+        mVsyncTime = timestamp;
+    }
+}
+
+nsecs_t Display::getLatchTimeLocked(nsecs_t now)
+{
+    if (!mTunables.mPresentLatch || mVsyncTime == 0 || mActiveConfig < 0) {
+        return 0;
+    }
+
+    nsecs_t period = getRefreshPeriodLocked();
+    if (period <= 0 || now - mVsyncTime > LATCH_VSYNC_STALE) {
+        return 0;
+    }
+
+    // slowest recent composition keeps frames from missing vblank.
+    nsecs_t budget = 0;
+    for (size_t i=0; i<LATCH_COST_NUM; i++) {
+        if (mLatchCosts[i] > budget) {
+            budget = mLatchCosts[i];
+        }
+    }
+    budget += LATCH_COMMIT_MARGIN;
+    if (budget >= period) {
+        return 0;
+    }
+
+    // first vblank this frame can make, and latest start for it.
+    nsecs_t earliest = now + budget;
+    nsecs_t vblank = mVsyncTime;
+    if (earliest > vblank) {
+        vblank += (earliest - vblank + period - 1) / period * period;
+    }
+    nsecs_t start = vblank - budget;
+
+    return (start > now) ? start : 0;
+}
+
+void Display::waitLatchTime()
+{
+    nsecs_t start = 0;
+    {
+        Mutex::Autolock _l(mLock);
+        start = getLatchTimeLocked(systemTime(CLOCK_MONOTONIC));
+    }
+    if (start == 0) {
+        return;
+    }
+
+    ATRACE_NAME("HWC late latch");
+    struct timespec spec;
+    spec.tv_sec = start / 1000000000;
+    spec.tv_nsec = start % 1000000000;
+    int err = 0;
+    do {
+        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+    } while (err == EINTR);
+
+    Mutex::Autolock _l(mLock);
+    latchSidebandLocked();
+}
+
+void Display::latchSidebandLocked()
+{
+    size_t count = mLayerVector.size();
+    for (size_t i=0; i<count; i++) {
+        Layer* layer = mLayerVector[i];
+        if (layer->type == LAYER_TYPE_SIDEBAND && layer->sideband != NULL) {
+            layer->handle = layer->sideband->latchFrame();
+        }
+    }
+}
+
+bool Display::enterIdleLocked()
+{
+    return false;
+}
+
+void Display::exitIdleLocked()
+{
+}
+
+void Display::setContentPeriodLocked(nsecs_t /*period*/)
+{
+}
+
+nsecs_t Display::getRefreshPeriodLocked()
+{
+    if (mActiveConfig < 0) {
+        return 0;
+    }
+
+    return mConfigs[mActiveConfig].mVsyncPeriod;
+}
+
+static inline bool isVideoBuffer(Memory* handle)
+{
+    if (handle == NULL) {
+        return false;
+    }
+    if (handle->flags & FLAGS_VIDEO) {
+        return true;
+    }
+
+    switch (handle->fslFormat) {
+        case FORMAT_RGBA8888:
+        case FORMAT_RGBX8888:
+        case FORMAT_RGB888:
+        case FORMAT_RGB565:
+        case FORMAT_BGRA8888:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static inline uint32_t hashRect(uint32_t hash, const Rect& rect)
+{
+    hash = android::JenkinsHashMix(hash, rect.left);
+    hash = android::JenkinsHashMix(hash, rect.top);
+    hash = android::JenkinsHashMix(hash, rect.right);
+    return android::JenkinsHashMix(hash, rect.bottom);
+}
+
+static uint32_t hashLayer(uint32_t hash, Layer* layer)
+{
+    uint64_t handle = (uint64_t)(uintptr_t)layer->handle;
+    size_t numRect = 0;
+    layer->visibleRegion.getArray(&numRect);
+    hash = android::JenkinsHashMix(hash, layer->index);
+    hash = android::JenkinsHashMix(hash, layer->type);
+    hash = android::JenkinsHashMix(hash, (uint32_t)handle);
+    hash = android::JenkinsHashMix(hash, (uint32_t)(handle >> 32));
+    hash = android::JenkinsHashMix(hash, layer->zorder);
+    hash = android::JenkinsHashMix(hash, layer->transform);
+    hash = android::JenkinsHashMix(hash, layer->blendMode);
+    hash = android::JenkinsHashMix(hash, layer->planeAlpha);
+    hash = android::JenkinsHashMix(hash, layer->color);
+    hash = hashRect(hash, layer->sourceCrop);
+    hash = hashRect(hash, layer->displayFrame);
+    hash = hashRect(hash, layer->visibleRegion.getBounds());
+    return android::JenkinsHashMix(hash, numRect);
+}
+
+bool Display::updateContentRateLocked(nsecs_t now)
+{
+    // only new buffer of one full screen video layer is content.
+    Layer* video = NULL;
+    size_t changed = 0;
+    bool other = !mTunables.mContentRate || mActiveConfig < 0;
+    uint32_t hash = android::JenkinsHashMix(0, mActiveCount);
+    for (size_t i=0; i<mActiveCount; i++) {
+        Layer* layer = mActiveLayers[i];
+        if (layer->type == LAYER_TYPE_CLIENT ||
+            layer->type == LAYER_TYPE_SIDEBAND) {
+            other = true;
+        }
+        if (layer->handle != mContentHandles[layer->index]) {
+            mContentHandles[layer->index] = layer->handle;
+            changed++;
+            video = layer;
+        }
+        hash = hashLayer(hash, layer);
+    }
+    hash = android::JenkinsHashWhiten(hash);
+    bool sameFrame = (hash == mContentHash);
+    mContentHash = hash;
+
+    if (!other && changed == 1) {
+        const DisplayConfig& config = mConfigs[mActiveConfig];
+        bool fullScreen = video->displayFrame.width() >= config.mXres ||
+                          video->displayFrame.height() >= config.mYres;
+        other = !fullScreen || !isVideoBuffer(video->handle);
+    }
+
+    if (other || changed > 1) {
+        mContentLayer = -1;
+        mContentCount = 0;
+        mContentPeriod = 0;
+    }
+    else if (changed == 1) {
+        size_t slot = mContentCount % (CONTENT_RATE_FRAMES + 1);
+        size_t prev = (slot + CONTENT_RATE_FRAMES) % (CONTENT_RATE_FRAMES + 1);
+        if (video->index != mContentLayer || mContentCount == 0 ||
+            now - mContentTimes[prev] > CONTENT_RATE_GAP) {
+            // new video or pause, cadence is measured again.
+            mContentLayer = video->index;
+            mContentCount = 0;
+            mContentPeriod = 0;
+            slot = 0;
+        }
+        mContentTimes[slot] = now;
+        mContentCount++;
+        if (mContentCount > CONTENT_RATE_FRAMES) {
+            // present times are quantized to vsync, average over frames.
+            size_t first = mContentCount % (CONTENT_RATE_FRAMES + 1);
+            mContentPeriod = (now - mContentTimes[first]) /
+                             CONTENT_RATE_FRAMES;
+        }
+    }
+
+    setContentPeriodLocked(mContentPeriod);
+
+    // nothing changed while display follows content.
+    return mContentPeriod > 0 && changed == 0 && sameFrame;
+}
+
+void Display::dump(String8& out)
+{
+    {
+        Mutex::Autolock _l(mLock);
+        out.appendFormat("  display %d type:%d connected:%d\n",
+                         mIndex, mType, mConnected);
+    }
+    mStats.dump(out);
+}
+
+Display::PresentThread::PresentThread(Display *ctx)
+    : Thread(false), mCtx(ctx), mPending(false)
+{
+}
+
+void Display::PresentThread::onFirstRef()
+{
+    run("HWC-Present-Thread", android::PRIORITY_URGENT_DISPLAY);
+}
+
+int32_t Display::PresentThread::readyToRun()
+{
+    return 0;
+}
+
+void Display::PresentThread::present()
+{
+    Mutex::Autolock _l(mLock);
+    mPending = true;
+    mCondition.signal();
+}
+
+bool Display::PresentThread::threadLoop()
+{
+    { // scope for lock
+        Mutex::Autolock _l(mLock);
+        while (!mPending) {
+            mCondition.wait(mLock);
+        }
+        mPending = false;
+    }
+
+    ATRACE_NAME("HWC async present");
+    mCtx->waitLatchTime();
+    mCtx->presentLayers();
+
+    Mutex::Autolock _l(mCtx->mLock);
+    // nobody waits present fence of this frame.
+    if (mCtx->mPresentFence != -1) {
+        close(mCtx->mPresentFence);
+        mCtx->mPresentFence = -1;
+    }
+    mCtx->mPresentPending = false;
+    mCtx->mPresentCondition.broadcast();
+    ATRACE_INT("HWC present pending", 0);
+
+    return true;
+}
+
+static void waitFences(int* fences, size_t count)
+{
+    struct pollfd fds[MAX_LAYERS + 2];
+    for (size_t i=0; i<count; i++) {
+        fds[i].fd = fences[i];
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+    size_t pending = count;
+    while (pending > 0) {
+        int ret = poll(fds, count, FENCE_WAIT_TIMEOUT);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            ALOGE("%s poll failed:%d", __func__, errno);
+            break;
+        }
+
+        if (ret == 0) {
+            ALOGW("%s %zu fences not signaled in %d ms",
+                    __func__, pending, FENCE_WAIT_TIMEOUT);
+            continue;
+        }
+
+        for (size_t i=0; i<count; i++) {
+            if (fds[i].fd >= 0 && fds[i].revents != 0) {
+                // negative fd is ignored by poll.
+                fds[i].fd = -1;
+                pending--;
+            }
+        }
+    }
+}
+
 void Display::waitOnFenceLocked()
 {
-    // release target fence.
+    int fences[MAX_LAYERS + 2];
+    size_t count = 0;
+
+    // take target fence.
     if (mAcquireFence != -1) {
-        sync_wait(mAcquireFence, -1);
-        close(mAcquireFence);
+        fences[count++] = mAcquireFence;
         mAcquireFence = -1;
     }
 
-    // release all layer fence.
-    for (size_t i=0; i<MAX_LAYERS; i++) {
-        if (!mLayers[i]->busy) {
-            continue;
+    // take all layer fence.
+    for (size_t i=0; i<mActiveCount; i++) {
+        Layer* layer = mActiveLayers[i];
+        if (layer->acquireFence != -1) {
+            fences[count++] = layer->acquireFence;
+            layer->acquireFence = -1;
         }
+    }
+
+    if (mClientLayer->acquireFence != -1) {
+        fences[count++] = mClientLayer->acquireFence;
+        mClientLayer->acquireFence = -1;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    // wait all fences at once without mLock, so that vsync
+    // and hotplug are not blocked by slow producer.
+    nsecs_t start = systemTime(CLOCK_MONOTONIC);
+    mLock.unlock();
+    waitFences(fences, count);
+    mLock.lock();
+    mStats.addTime(STAT_FENCE_WAIT, systemTime(CLOCK_MONOTONIC) - start);
+
+    for (size_t i=0; i<count; i++) {
+        close(fences[i]);
+    }
+}
 
-        if (mLayers[i]->acquireFence != -1) {
-            sync_wait(mLayers[i]->acquireFence, -1);
-            close(mLayers[i]->acquireFence);
-            mLayers[i]->acquireFence = -1;
+void Display::resetDamageLocked()
+{
+    for (size_t i=0; i<MAX_DAMAGE_HISTORY; i++) {
+        mDamageHistory[i].clear();
+        mDamageTargets[i] = NULL;
+    }
+    mRemovedDamage.clear();
+    mCachedTarget = NULL;
+}
+
+uint32_t Display::computeLayerHashLocked(bool* damaged)
+{
+    uint32_t hash = 0;
+    *damaged = false;
+    size_t count = mLayerVector.size();
+    hash = android::JenkinsHashMix(hash, count);
+    for (size_t i=0; i<count; i++) {
+        Layer* layer = mLayerVector[i];
+        if (layer->damageState == DAMAGE_ALL ||
+            (layer->damageState == DAMAGE_REGION &&
+             !layer->surfaceDamage.isEmpty())) {
+            *damaged = true;
         }
+
+        hash = hashLayer(hash, layer);
     }
+
+    return android::JenkinsHashWhiten(hash);
+}
+
+Memory* Display::getCachedTargetLocked()
+{
+    bool damaged = false;
+    uint32_t hash = computeLayerHashLocked(&damaged);
+    mCacheHit = (mCachedTarget != NULL && !damaged && hash == mLayerHash);
+    mLayerHash = hash;
+
+    return mCacheHit ? mCachedTarget : NULL;
+}
+
+Rect Display::getLayerDamageLocked(Layer* layer)
+{
+    Rect& src = layer->sourceCrop;
+    Rect& dst = layer->displayFrame;
+    if (layer->damageState != DAMAGE_REGION || layer->transform != 0 ||
+        src.isEmpty() || layer->isSolidColor()) {
+        return dst;
+    }
+
+    Rect bounds;
+    if (!layer->surfaceDamage.getBounds().intersect(src, &bounds)) {
+        return Rect();
+    }
+
+    // map damage from source crop to display frame.
+    int sw = src.width(), sh = src.height();
+    int dw = dst.width(), dh = dst.height();
+    Rect damage;
+    damage.left = dst.left + (bounds.left - src.left) * dw / sw;
+    damage.top = dst.top + (bounds.top - src.top) * dh / sh;
+    damage.right = dst.left + ((bounds.right - src.left) * dw + sw - 1) / sw;
+    damage.bottom = dst.top + ((bounds.bottom - src.top) * dh + sh - 1) / sh;
+    if (sw != dw || sh != dh) {
+        // scaler filter also touches the neighbour pixels.
+        damage.left -= 1;
+        damage.top -= 1;
+        damage.right += 1;
+        damage.bottom += 1;
+        damage.intersect(dst, &damage);
+    }
+
+    return damage;
+}
+
+void Display::computeDirtyLocked(Region& dirty)
+{
+    Rect screen(mRenderTarget->width, mRenderTarget->height);
+    Region damage(mRemovedDamage);
+    mRemovedDamage.clear();
+
+    bool current[MAX_LAYERS + 1];
+    memset(current, 0, sizeof(current));
+    size_t count = mLayerVector.size();
+    for (size_t i=0; i<count; i++) {
+        Layer* layer = mLayerVector[i];
+        current[layer->index] = true;
+        if (!layer->composed || layer->isGeometryChanged()) {
+            damage.orSelf(layer->displayFrame);
+            if (layer->composed) {
+                damage.orSelf(layer->lastState.displayFrame);
+            }
+        }
+        else if (layer->handle != layer->lastState.handle ||
+                 layer->damageState != DAMAGE_UNKNOWN) {
+            Rect rect = (layer->handle != layer->lastState.handle &&
+                         layer->damageState == DAMAGE_UNKNOWN)
+                      ? layer->displayFrame : getLayerDamageLocked(layer);
+            damage.orSelf(rect);
+        }
+
+        layer->saveState();
+        layer->composed = true;
+        layer->surfaceDamage.clear();
+        layer->damageState = DAMAGE_UNKNOWN;
+    }
+
+    // layers moved to overlay or client leave their area dirty.
+    for (size_t i=0; i<=mActiveCount; i++) {
+        Layer* layer = (i < mActiveCount) ? mActiveLayers[i] : mClientLayer;
+        if (layer->composed && !current[layer->index]) {
+            damage.orSelf(layer->lastState.displayFrame);
+            layer->composed = false;
+        }
+    }
+
+    // render target holds content of its last frame,
+    // so it needs damage of all frames composed after that.
+    bool found = false;
+    dirty = damage;
+    if (mType != DISPLAY_VIRTUAL) {
+        for (uint64_t k=1; k<MAX_DAMAGE_HISTORY && k<=mFrameCount; k++) {
+            size_t prev = (mFrameCount - k) % MAX_DAMAGE_HISTORY;
+            if (mDamageTargets[prev] == mRenderTarget) {
+                found = true;
+                break;
+            }
+            dirty.orSelf(mDamageHistory[prev]);
+        }
+    }
+
+    if (!found) {
+        dirty = Region(screen);
+    }
+    dirty.andSelf(screen);
+
+    size_t slot = mFrameCount % MAX_DAMAGE_HISTORY;
+    mDamageHistory[slot] = damage;
+    mDamageTargets[slot] = mRenderTarget;
+    mFrameCount++;
 }
 
 int Display::composeLayersLocked()
 {
+    ATRACE_CALL();
     int ret = 0;
 
-    waitOnFenceLocked();
-
     if (!mConnected && mIndex != DISPLAY_PRIMARY) {
+        waitOnFenceLocked();
         ALOGE("composeLayersLocked display plugout");
         return -EINVAL;
     }
 
+    // overlay planes take acquire fences of their layers.
     performOverlay();
+    // mLock is released while waiting fences.
+    waitOnFenceLocked();
 
     if (mLayerVector.size() <= 0) {
+        // render targets are not updated by client composition.
+        resetDamageLocked();
         return ret;
     }
 
+    if (mRenderTarget == NULL) {
+        ALOGE("composeLayersLocked invalid render target");
+        return -EINVAL;
+    }
+
+    if (mCacheHit) {
+        // layer stack unchanged, last composed target is displayed again.
+        ALOGV("composition cache hit, bypass composition");
+        mCacheHit = false;
+        return ret;
+    }
+
+    ATRACE_INT("HWC client layers", mLayerVector.size());
+    Region dirty;
+    computeDirtyLocked(dirty);
+    if (dirty.isEmpty()) {
+        ALOGV("no dirty area, bypass composition");
+        return ret;
+    }
+
+    nsecs_t start = systemTime(CLOCK_MONOTONIC);
     mComposer.lockSurface(mRenderTarget);
     mComposer.setRenderTarget(mRenderTarget);
+    mComposer.setRenderSize(mRenderWidth, mRenderHeight);
+    mComposer.setDirtyRegion(dirty);
+    mComposer.prepareTarget(mLayerVector);
     mComposer.clearWormHole(mLayerVector);
 
     // to do composite.
+    // layer surfaces keep locked until the whole frame is submitted,
+    // composer may collect blits of several layers into one batch.
     size_t count = mLayerVector.size();
+    for (size_t i=0; i<count; i++) {
+        Layer* layer = mLayerVector[i];
+        if (layer->busy && layer->handle != NULL)
+            mComposer.lockSurface(layer->handle);
+    }
+
     for (size_t i=0; i<count; i++) {
         Layer* layer = mLayerVector[i];
         if (!layer->busy){
@@ -512,28 +1557,36 @@ int Display::composeLayersLocked()
             continue;
         }
 
-        if (layer->type == LAYER_TYPE_SIDEBAND) {
-            //set side band parameters.
+        if (layer->type == LAYER_TYPE_SIDEBAND &&
+            (layer->handle == NULL || layer->handle->phys == 0)) {
+            // no frame yet, or frame 2D engine can't read.
             continue;
         }
 
-        if (layer->handle != NULL)
-            mComposer.lockSurface(layer->handle);
+        if (layer == mClientLayer && layer->handle == NULL) {
+            ALOGE("client target is not set");
+            continue;
+        }
 
         ret = mComposer.composeLayer(layer, i==0);
-
-        if (layer->handle != NULL)
-            mComposer.unlockSurface(layer->handle);
-
         if (ret != 0) {
             ALOGE("compose layer %zu failed", i);
             break;
         }
     }
 
-    mComposer.unlockSurface(mRenderTarget);
     mComposer.finishComposite();
 
+    for (size_t i=0; i<count; i++) {
+        Layer* layer = mLayerVector[i];
+        if (layer->busy && layer->handle != NULL)
+            mComposer.unlockSurface(layer->handle);
+    }
+    mComposer.unlockSurface(mRenderTarget);
+    mCachedTarget = (ret == 0) ? mRenderTarget : NULL;
+    mComposeTime = systemTime(CLOCK_MONOTONIC) - start;
+    mStats.addTime(STAT_COMPOSE, mComposeTime);
+
     return ret;
 }
 
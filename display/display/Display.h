@@ -21,14 +21,33 @@
 #include "Memory.h"
 #include "Layer.h"
 #include "Composer.h"
+#include "Tunables.h"
+#include "FrameStats.h"
 
 namespace fsl {
 
 using android::Mutex;
+using android::Condition;
 using android::Thread;
 using android::sp;
 
 #define DISPLAY_PRIMARY 0
+// frames of damage history to support render target ring.
+#define MAX_DAMAGE_HISTORY 4
+// warning interval of waiting acquire fences in ms.
+#define FENCE_WAIT_TIMEOUT 3000
+// frames of composition time to predict late latch budget.
+#define LATCH_COST_NUM 16
+// time kept for commit after composition in ns.
+#define LATCH_COMMIT_MARGIN 2000000
+// vblank timestamp is too old to predict next vblank in ns.
+#define LATCH_VSYNC_STALE 1000000000
+// video frames averaged to find content period.
+#define CONTENT_RATE_FRAMES 24
+// video frame gap which restarts content period detection in ns.
+#define CONTENT_RATE_GAP 200000000
+// priv table size, twice of layers to keep probing short.
+#define LAYER_PRIV_SLOTS (MAX_LAYERS * 2)
 
 class EventListener
 {
@@ -66,6 +85,8 @@ struct DisplayConfig
     int mVsyncPeriod;
     int mXdpi;
     int mYdpi;
+    // tells apart configs of one size, index of kms connector mode.
+    int mModeIndex;
 };
 
 class Display
@@ -80,6 +101,8 @@ public:
     // get layer with index.
     Layer* getLayer(int index);
     Layer* getLayerByPriv(void* priv);
+    // bind layer to caller private data found by getLayerByPriv.
+    void setLayerPriv(Layer* layer, void* priv);
     // get empty layer.
     Layer* getFreeLayer();
     // clean and invalidate all layers.
@@ -95,9 +118,17 @@ public:
     // verify all layers and marks if device can handle.
     bool verifyLayers();
     // set display composite target buffer.
-    int setRenderTarget(Memory* buffer, int acquireFence);
+    virtual int setRenderTarget(Memory* buffer, int acquireFence);
     // to do composite all layers.
     virtual int composeLayers();
+    // compose and update screen, in present thread when possible.
+    int presentFrame(int32_t* outPresentFence);
+    // dump display state and frame statistics.
+    void dump(String8& out);
+    // enter idle when no frame is presented for idle frames.
+    void checkIdle(nsecs_t now);
+    // vblank timestamp which late latch predicts next vblank from.
+    void setVsyncTime(nsecs_t timestamp);
 
     // display property.
     // set display power on/off.
@@ -119,10 +150,30 @@ public:
     // get display index of array.
     int index();
 
+    // reset overlay assignment before layers are verified.
+    virtual void prepareOverlay();
     virtual bool checkOverlay(Layer* layer);
+    // check whether overlay plane can rotate layer instead of 2D engine.
+    virtual bool checkPlaneTransform(Layer* layer);
+    // test overlay assignment, return layer taken off overlay if test fails.
+    virtual Layer* testOverlay();
     virtual int performOverlay();
+    // check whether cursor layer can be put on cursor plane.
+    virtual bool checkCursor(Layer* layer);
+    // move cursor layer without composition.
+    int setCursorPosition(Layer* layer, int x, int y);
+    // attach producer stream to sideband layer, NULL detaches it.
+    int setSidebandStream(Layer* layer, const native_handle_t* stream);
     // update composite buffer to screen.
     virtual int updateScreen();
+    // get fence signaled when last frame is on screen.
+    int getPresentFence(int32_t* outPresentFence);
+    // write output of next commit into buffer as well, acquireFence is
+    // kept by caller.
+    virtual int queueWriteback(Memory* buffer, int acquireFence);
+    // fence of writeback queued into buffer, error when no commit took
+    // it, which cancels it.
+    virtual int takeWriteback(Memory* buffer, int* outFence);
     // set display active config.
     virtual int setActiveConfig(int configId);
     // set display specified config parameters.
@@ -137,26 +188,141 @@ public:
     int getActiveId();
     // get display config number.
     int getConfigNum();
+    // apply 4x4 color matrix on output, NULL for identity.
+    virtual int setColorTransform(const float* matrix);
 
 protected:
     int composeLayersLocked();
     void resetLayerLocked(Layer* layer);
+    // keep active list, free list and priv table of layer slots.
+    void addActiveLocked(Layer* layer);
+    void removeActiveLocked(Layer* layer);
+    size_t privSlot(void* priv);
+    void addPrivLocked(Layer* layer);
+    void removePrivLocked(Layer* layer);
     void waitOnFenceLocked();
+    // drop damage history when render targets content is unknown.
+    void resetDamageLocked();
+    // calculate area of render target which needs recompose.
+    void computeDirtyLocked(Region& dirty);
+    Rect getLayerDamageLocked(Layer* layer);
+    // hash layer stack to find out frame without any change.
+    uint32_t computeLayerHashLocked(bool* damaged);
+    // get last composed target when layer stack is unchanged.
+    Memory* getCachedTargetLocked();
+    // frame can be presented in present thread.
+    virtual bool canPresentAsyncLocked();
+    // wait present thread to finish pending frame.
+    void waitPresentIdleLocked();
+    // show cursor at new position of its display frame.
+    virtual int updateCursorLocked(Layer* layer);
+    // compose, update screen and close frame statistics.
+    void presentLayers();
+    // sleep until composition can start and still make next vblank.
+    void waitLatchTime();
+    nsecs_t getLatchTimeLocked(nsecs_t now);
+    // take newest frames of sideband layers composed by 2D engine.
+    void latchSidebandLocked();
+    // lower refresh rate on idle, return true if screen must be updated.
+    virtual bool enterIdleLocked();
+    // restore full refresh rate applied by next update.
+    virtual void exitIdleLocked();
+    // follow period of video content, 0 when content has no cadence.
+    virtual void setContentPeriodLocked(nsecs_t period);
+    // vsync period which display currently runs at.
+    virtual nsecs_t getRefreshPeriodLocked();
+    // detect cadence of video-only frames, return true if frame
+    // repeats last presented one and needn't be presented.
+    bool updateContentRateLocked(nsecs_t now);
+    // layer stack is the same as stack of other display.
+    bool isMirrorLocked(Display* other);
 
 protected:
     Mutex mLock;
     int mIndex;
     bool mConnected;
     int mType;
+    // tunables snapshot taken when layers are verified.
+    Tunables mTunables;
 
     int mActiveConfig;
     SortedVector<DisplayConfig> mConfigs;
 
     LayerVector mLayerVector;
     Layer* mLayers[MAX_LAYERS];
+    // busy layers and position of each slot in it, -1 if free.
+    Layer* mActiveLayers[MAX_LAYERS];
+    int32_t mActivePos[MAX_LAYERS];
+    size_t mActiveCount;
+    // free slots, lowest index is taken first.
+    int32_t mFreeSlots[MAX_LAYERS];
+    size_t mFreeCount;
+    // open addressing table from priv to busy layer.
+    Layer* mPrivLayers[LAYER_PRIV_SLOTS];
     Composer mComposer;
     Memory* mRenderTarget;
     int mAcquireFence;
+    int mPresentFence;
+
+    // damage of each frame and the render target it composed to.
+    uint64_t mFrameCount;
+    Region mDamageHistory[MAX_DAMAGE_HISTORY];
+    Memory* mDamageTargets[MAX_DAMAGE_HISTORY];
+    // area of layers removed since last composition.
+    Region mRemovedDamage;
+
+    // composition result cache.
+    uint32_t mLayerHash;
+    Memory* mCachedTarget;
+    bool mCacheHit;
+
+    // client target blended with device layers in mixed composition.
+    Layer* mClientLayer;
+    bool mClientMixed;
+
+    FrameStats mStats;
+    // time when frame is handed to present.
+    nsecs_t mPresentStart;
+    // no frame presented for idle frames.
+    bool mIdle;
+    // size 2D engine renders target at, 0 for whole target.
+    int mRenderWidth;
+    int mRenderHeight;
+    // time of last 2D composition, 0 after it's consumed.
+    nsecs_t mComposeTime;
+    // last vblank timestamp and recent composition times.
+    nsecs_t mVsyncTime;
+    nsecs_t mLatchCosts[LATCH_COST_NUM];
+    size_t mLatchCostIndex;
+    // buffers last presented, times of recent frames of video layer.
+    Memory* mContentHandles[MAX_LAYERS];
+    int mContentLayer;
+    nsecs_t mContentTimes[CONTENT_RATE_FRAMES + 1];
+    size_t mContentCount;
+    nsecs_t mContentPeriod;
+    uint32_t mContentHash;
+
+protected:
+    class PresentThread : public Thread {
+    public:
+        explicit PresentThread(Display *ctx);
+        void present();
+
+    private:
+        virtual void onFirstRef();
+        virtual int32_t readyToRun();
+        virtual bool threadLoop();
+
+        Display *mCtx;
+        mutable Mutex mLock;
+        Condition mCondition;
+        bool mPending;
+    };
+
+    sp<PresentThread> mPresentThread;
+    // frame handed to present thread and not composed yet.
+    bool mPresentPending;
+    Condition mPresentCondition;
 };
 
 }
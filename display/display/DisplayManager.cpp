@@ -16,8 +16,10 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <poll.h>
 #include <cutils/log.h>
 #include <cutils/properties.h>
+#include <rearview_ext.h>
 
 #include "FbDisplay.h"
 #include "KmsDisplay.h"
@@ -36,13 +38,20 @@ Mutex DisplayManager::sLock(Mutex::PRIVATE);
 
 DisplayManager* DisplayManager::getInstance()
 {
+    // instance is published once constructed, later calls take no lock.
+    DisplayManager* instance = __atomic_load_n(&sInstance, __ATOMIC_ACQUIRE);
+    if (instance != NULL) {
+        return instance;
+    }
+
     Mutex::Autolock _l(sLock);
     if (sInstance != NULL) {
         return sInstance;
     }
 
-    sInstance = new DisplayManager();
-    return sInstance;
+    instance = new DisplayManager();
+    __atomic_store_n(&sInstance, instance, __ATOMIC_RELEASE);
+    return instance;
 }
 
 DisplayManager::DisplayManager()
@@ -69,6 +78,10 @@ DisplayManager::DisplayManager()
         enumFbDisplays();
     }
 
+    // instance is published after constructor, which orders the table
+    // for readers of other threads.
+    buildTable();
+
     // now only main display vsync valid.
     if (mDrmMode) {
         mKmsDisplays[DISPLAY_PRIMARY]->enableVsync();
@@ -119,23 +132,34 @@ DisplayManager::~DisplayManager()
     }
 }
 
-Display* DisplayManager::getDisplay(int id)
+void DisplayManager::buildTable()
 {
-    Display* pDisplay = NULL;
-    Mutex::Autolock _l(mLock);
-    if (id >= 0 && id < MAX_PHYSICAL_DISPLAY) {
+    for (int i=0; i<MAX_PHYSICAL_DISPLAY; i++) {
         if (mDrmMode) {
-            pDisplay = (Display*)mKmsDisplays[id];
+            mTable.displays[i] = mKmsDisplays[i];
         }
         else {
-            pDisplay = (Display*)mFbDisplays[id];
+            mTable.displays[i] = mFbDisplays[i];
         }
     }
-    else if (id >= MAX_PHYSICAL_DISPLAY &&
-             id < MAX_PHYSICAL_DISPLAY + MAX_VIRTUAL_DISPLAY) {
-        pDisplay = (Display*)mVirtualDisplays[id-MAX_PHYSICAL_DISPLAY];
+    for (int i=0; i<MAX_VIRTUAL_DISPLAY; i++) {
+        mTable.displays[i+MAX_PHYSICAL_DISPLAY] = mVirtualDisplays[i];
     }
-    else {
+}
+
+Display* DisplayManager::lookup(int id)
+{
+    if (id < 0 || id >= MAX_PHYSICAL_DISPLAY + MAX_VIRTUAL_DISPLAY) {
+        return NULL;
+    }
+
+    return mTable.displays[id];
+}
+
+Display* DisplayManager::getDisplay(int id)
+{
+    Display* pDisplay = lookup(id);
+    if (pDisplay == NULL) {
         ALOGE("%s invalid display id:%d", __func__, id);
     }
 
@@ -144,29 +168,25 @@ Display* DisplayManager::getDisplay(int id)
 
 Display* DisplayManager::getPhysicalDisplay(int id)
 {
-    Mutex::Autolock _l(mLock);
     if (id < 0 || id >= MAX_PHYSICAL_DISPLAY) {
-        ALOGE("%s invalid id %d", __func__, __LINE__);
+        ALOGE("%s invalid id %d", __func__, id);
         return NULL;
     }
 
-    if (mDrmMode) {
-        return mKmsDisplays[id];
-    }
-    return mFbDisplays[id];
+    return lookup(id);
 }
 
 VirtualDisplay* DisplayManager::getVirtualDisplay(int id)
 {
-    Mutex::Autolock _l(mLock);
     if (id < MAX_PHYSICAL_DISPLAY ||
         id >= MAX_PHYSICAL_DISPLAY + MAX_VIRTUAL_DISPLAY) {
         ALOGE("%s invalid id %d", __func__, id);
         return NULL;
     }
 
-    mVirtualDisplays[id]->setConnected(true);
-    return mVirtualDisplays[id];
+    VirtualDisplay* display = (VirtualDisplay*)lookup(id);
+    display->setConnected(true);
+    return display;
 }
 
 VirtualDisplay* DisplayManager::createVirtualDisplay()
@@ -189,17 +209,17 @@ VirtualDisplay* DisplayManager::createVirtualDisplay()
 
 int DisplayManager::destroyVirtualDisplay(int id)
 {
-    Mutex::Autolock _l(mLock);
     if (id < MAX_PHYSICAL_DISPLAY ||
         id >= MAX_PHYSICAL_DISPLAY + MAX_VIRTUAL_DISPLAY) {
         ALOGE("%s invalid id %d", __func__, id);
         return -EINVAL;
     }
 
-    mVirtualDisplays[id]->setConnected(false);
-    mVirtualDisplays[id]->reset();
-    mVirtualDisplays[id]->clearConfigs();
-    mVirtualDisplays[id]->setBusy(false);
+    VirtualDisplay* display = (VirtualDisplay*)lookup(id);
+    display->setConnected(false);
+    display->reset();
+    display->clearConfigs();
+    display->setBusy(false);
     return 0;
 }
 
@@ -244,9 +264,18 @@ bool DisplayManager::isOverlay(int fb)
 
 int DisplayManager::enumKmsDisplay(const char *path)
 {
-    mDrmFd = open(path, O_RDWR);
+    // early rear view is drm master of path and lights its screen, its
+    // open file is taken over so the screen isn't blanked.
+    int earlyView = -1;
+    mDrmFd = rearview_take_drm(path, &earlyView);
+    if (mDrmFd < 0) {
+        mDrmFd = open(path, O_RDWR);
+    }
     if(mDrmFd <= 0) {
         ALOGE("Failed to open dri-%s, error:%s", path, strerror(-errno));
+        if (earlyView >= 0) {
+            close(earlyView);
+        }
         return -ENODEV;
     }
 
@@ -255,6 +284,9 @@ int DisplayManager::enumKmsDisplay(const char *path)
         ALOGE("Failed to set universal plane cap %d", ret);
         close(mDrmFd);
         mDrmFd = -1;
+        if (earlyView >= 0) {
+            close(earlyView);
+        }
         return ret;
     }
 
@@ -263,21 +295,49 @@ int DisplayManager::enumKmsDisplay(const char *path)
         ALOGE("Failed to set atomic cap %d", ret);
         close(mDrmFd);
         mDrmFd = -1;
+        if (earlyView >= 0) {
+            close(earlyView);
+        }
         return ret;
     }
 
+    // writeback connectors are listed only to clients asking for them.
+    bool writeback = drmSetClientCap(mDrmFd,
+                        DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) == 0;
+
     drmModeResPtr res = drmModeGetResources(mDrmFd);
     if (!res) {
         ALOGE("Failed to get DrmResources resources");
         close(mDrmFd);
         mDrmFd = -1;
+        if (earlyView >= 0) {
+            close(earlyView);
+        }
         return -ENODEV;
     }
 
     int id = 1;
     bool foundPrimary = false;
     KmsDisplay* display = NULL;
+    uint32_t writebackId = 0;
     for (int i = 0; i < res->count_connectors; i++) {
+        if (writeback) {
+            drmModeConnectorPtr pConnector =
+                drmModeGetConnectorCurrent(mDrmFd, res->connectors[i]);
+            bool isWriteback = pConnector != NULL &&
+                pConnector->connector_type == DRM_MODE_CONNECTOR_WRITEBACK;
+            if (pConnector != NULL) {
+                drmModeFreeConnector(pConnector);
+            }
+            // writeback connector is not a display.
+            if (isWriteback) {
+                if (writebackId == 0) {
+                    writebackId = res->connectors[i];
+                }
+                continue;
+            }
+        }
+
         display = mKmsDisplays[id];
 
         if (display->setDrm(mDrmFd, res->connectors[i]) != 0) {
@@ -310,12 +370,23 @@ int DisplayManager::enumKmsDisplay(const char *path)
     drmModeFreeResources(res);
 
     if (foundPrimary) {
+        if (writebackId != 0) {
+            mKmsDisplays[0]->setWriteback(writebackId);
+        }
+        // rear view drives the first connected connector as well.
+        if (earlyView >= 0) {
+            mKmsDisplays[0]->setEarlyView(earlyView);
+            earlyView = -1;
+        }
         mDrmMode = true;
         ret = 0;
     }
     else {
         ret = -ENODEV;
     }
+    if (earlyView >= 0) {
+        close(earlyView);
+    }
 
     return ret;
 }
@@ -326,10 +397,10 @@ int DisplayManager::enumKmsDisplays()
     struct dirent *dirEntry;
     char path[HWC_PATH_LENGTH];
     int ret = 0;
-    char dri[PROPERTY_VALUE_MAX];
-    property_get("hwc.drm.device", dri, "/dev/dri");
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
 
-    dir = opendir(dri);
+    dir = opendir(tunables.mDrmDevice);
     if (dir == NULL) {
         ALOGE("%s open %s failed", __func__, SYS_GRAPHICS);
         return -EINVAL;
@@ -340,7 +411,8 @@ int DisplayManager::enumKmsDisplays()
             continue;
         }
         memset(path, 0, sizeof(path));
-        snprintf(path, HWC_PATH_LENGTH, "/dev/dri/%s", dirEntry->d_name);
+        snprintf(path, HWC_PATH_LENGTH, "%s/%s",
+                 tunables.mDrmDevice, dirEntry->d_name);
         ALOGI("try dev:%s", path);
         ret = enumKmsDisplay(path);
         if (ret == 0) {
@@ -461,18 +533,13 @@ void DisplayManager::handleHotplugEvent()
     }
 }
 
-void DisplayManager::handleKmsHotplug()
+void DisplayManager::handleKmsHotplug(uint32_t connectorId)
 {
     if (mDrmFd < 0) {
         return;
     }
 
-    drmModeResPtr res = drmModeGetResources(mDrmFd);
-    if (!res) {
-        ALOGE("Failed to get DrmResources resources");
-        return;
-    }
-
+    drmModeResPtr res = NULL;
     for (uint32_t i=0; i<MAX_PHYSICAL_DISPLAY; i++) {
         KmsDisplay* display = NULL;
         {
@@ -480,8 +547,12 @@ void DisplayManager::handleKmsHotplug()
             display = mKmsDisplays[i];
         }
 
+        if (connectorId != 0 && display->connectorId() != connectorId) {
+            continue;
+        }
+
         bool connected = display->connected();
-        display->readConnection();
+        display->readCurrentConnection();
         if (display->connected() == connected) {
             continue;
         }
@@ -493,6 +564,13 @@ void DisplayManager::handleKmsHotplug()
         }
 
         if (display->connected()) {
+            if (res == NULL) {
+                res = drmModeGetResources(mDrmFd);
+            }
+            if (res == NULL) {
+                ALOGE("Failed to get DrmResources resources");
+                continue;
+            }
             display->openKms(res);
         }
 
@@ -509,59 +587,113 @@ void DisplayManager::handleKmsHotplug()
             display->closeKms();
         }
     }
+
+    if (res != NULL) {
+        drmModeFreeResources(res);
+    }
 }
 
 //------------------------------------------------------------
 DisplayManager::HotplugThread::HotplugThread(DisplayManager *ctx)
-   : Thread(false), mCtx(ctx)
+   : Thread(false), mCtx(ctx), mFbPending(false), mKmsPending(false),
+     mKmsConnector(0), mDeadline(0)
 {
 }
 
 void DisplayManager::HotplugThread::onFirstRef()
 {
-    run("HWC-UEvent-Thread", android::PRIORITY_URGENT_DISPLAY);
+    // hotplug isn't frame critical, it stays at normal priority.
+    run("HWC-UEvent-Thread", android::PRIORITY_NORMAL);
 }
 
 int32_t DisplayManager::HotplugThread::readyToRun()
 {
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    setThreadPolicy(0, tunables.mHotplugCpus);
     uevent_init();
     return 0;
 }
 
-bool DisplayManager::HotplugThread::threadLoop()
+void DisplayManager::HotplugThread::readEvent()
 {
     char uevent_desc[4096];
     const char *pSii902 = HDMI_SII902_PLUG_EVENT;
 
-    bool kms = false;
     memset(uevent_desc, 0, sizeof(uevent_desc));
     int len = uevent_next_event(uevent_desc, sizeof(uevent_desc) - 2);
-    int type = -1;
-    if (strstr(uevent_desc, HDMI_PLUG_EVENT) != NULL &&
-         strstr(uevent_desc, HDMI_PLUG_CHANGE) != NULL &&
-         strstr(uevent_desc, HDMI_EXTCON) == NULL) {
-        type = DISPLAY_HDMI;
+    if (len <= 0) {
+        return;
     }
-    else if (!strncmp(uevent_desc, pSii902, strlen(pSii902))) {
-        type = DISPLAY_HDMI_ON_BOARD;
+
+    // uevent is a list of null terminated key=value strings.
+    bool drmMinor = false, hotplug = false;
+    uint32_t connector = 0;
+    for (const char* p = uevent_desc; p < uevent_desc + len && *p;
+         p += strlen(p) + 1) {
+        if (!strcmp(p, "DEVTYPE=drm_minor")) {
+            drmMinor = true;
+        }
+        else if (!strcmp(p, "HOTPLUG=1")) {
+            hotplug = true;
+        }
+        else if (!strncmp(p, "CONNECTOR=", strlen("CONNECTOR="))) {
+            connector = strtoul(p + strlen("CONNECTOR="), NULL, 10);
+        }
     }
-    else if (strstr(uevent_desc, "DEVTYPE=drm_minor") &&
-             strstr(uevent_desc, "HOTPLUG=1")) {
-        kms = true;
+
+    if ((strstr(uevent_desc, HDMI_PLUG_EVENT) != NULL &&
+         strstr(uevent_desc, HDMI_PLUG_CHANGE) != NULL &&
+         strstr(uevent_desc, HDMI_EXTCON) == NULL) ||
+        !strncmp(uevent_desc, pSii902, strlen(pSii902))) {
+        mFbPending = true;
     }
-    else if (strstr(uevent_desc, HDMI_DRM_EVENT)) {
-        ALOGV("%s kms uevent %s", __func__, uevent_desc);
-        kms = true;
+    else if ((drmMinor && hotplug) || strstr(uevent_desc, HDMI_DRM_EVENT)) {
+        ALOGV("%s kms uevent %s connector %u", __func__,
+              uevent_desc, connector);
+        // events of different connectors re-probe all displays.
+        if (mKmsPending && mKmsConnector != connector) {
+            connector = 0;
+        }
+        mKmsPending = true;
+        mKmsConnector = connector;
     }
     else {
         ALOGV("%s invalid uevent %s", __func__, uevent_desc);
+        return;
+    }
+
+    mDeadline = systemTime(CLOCK_MONOTONIC) + ms2ns(HOTPLUG_DEBOUNCE);
+}
+
+bool DisplayManager::HotplugThread::threadLoop()
+{
+    int timeout = -1;
+    if (mKmsPending || mFbPending) {
+        nsecs_t now = systemTime(CLOCK_MONOTONIC);
+        timeout = (mDeadline > now) ? (int)ns2ms(mDeadline - now) + 1 : 0;
+    }
+
+    struct pollfd fds;
+    fds.fd = uevent_get_fd();
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int ret = poll(&fds, 1, timeout);
+    if (ret > 0 && (fds.revents & POLLIN)) {
+        readEvent();
+        return true;
+    }
+    else if (ret != 0) {
         return true;
     }
 
-    if (kms) {
-        mCtx->handleKmsHotplug();
+    // state settled, re-probe only displays with events.
+    if (mKmsPending) {
+        mKmsPending = false;
+        mCtx->handleKmsHotplug(mKmsConnector);
     }
-    else {
+    if (mFbPending) {
+        mFbPending = false;
         mCtx->handleHotplugEvent();
     }
 
@@ -24,12 +24,21 @@
 
 #define MAX_PHYSICAL_DISPLAY 10
 #define MAX_VIRTUAL_DISPLAY  16
+// hotplug events closer than this in ms are merged as link flap.
+#define HOTPLUG_DEBOUNCE 200
 
 namespace fsl {
 
 class FbDisplay;
 class KmsDisplay;
 
+// displays by id, built once at start and never changed, so hwc2 entry
+// points look displays up without lock.
+struct DisplayTable
+{
+    Display* displays[MAX_PHYSICAL_DISPLAY + MAX_VIRTUAL_DISPLAY];
+};
+
 class DisplayManager
 {
 public:
@@ -48,10 +57,14 @@ public:
     int enumKmsDisplays();
     void setCallback(EventListener* callback);
     void handleHotplugEvent();
-    void handleKmsHotplug();
+    // re-probe display of connector, or all displays when it is 0.
+    void handleKmsHotplug(uint32_t connectorId);
 
 private:
     DisplayManager();
+    // fill table from display arrays once enumeration picked backend.
+    void buildTable();
+    Display* lookup(int id);
     /* This class mainly handle all uevent in hwc, currently only hdmi
      * hotplugin event needs to be care. */
     class HotplugThread : public Thread {
@@ -62,8 +75,15 @@ private:
         virtual void onFirstRef();
         virtual int32_t readyToRun();
         virtual bool threadLoop();
+        // parse one uevent and record pending hotplug.
+        void readEvent();
 
         DisplayManager *mCtx;
+        // hotplug is handled when no event comes in debounce time.
+        bool mFbPending;
+        bool mKmsPending;
+        uint32_t mKmsConnector;
+        nsecs_t mDeadline;
     };
 
     sp<HotplugThread> mHotplugThread;
@@ -73,6 +93,7 @@ private:
     static DisplayManager* sInstance;
 
     Mutex mLock;
+    DisplayTable mTable;
     FbDisplay* mFbDisplays[MAX_PHYSICAL_DISPLAY];
     KmsDisplay* mKmsDisplays[MAX_PHYSICAL_DISPLAY];
     VirtualDisplay* mVirtualDisplays[MAX_VIRTUAL_DISPLAY];
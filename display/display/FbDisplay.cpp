@@ -17,8 +17,10 @@
 #include <inttypes.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #include <cutils/log.h>
 #include <cutils/properties.h>
+#include <utils/Trace.h>
 #include <sync/sync.h>
 
 #include <linux/fb.h>
@@ -39,12 +41,14 @@ FbDisplay::FbDisplay()
     mFb = -1;
     mFd = -1;
     mVsyncThread = NULL;
+    mVsyncTrace = 0;
     mOpened = false;
     mTargetIndex = 0;
     memset(&mTargets[0], 0, sizeof(mTargets));
     mOvFd  = -1;
     memset(&mOvInfo, 0, sizeof(mOvInfo));
     mOverlay = NULL;
+    mPanPending = false;
 }
 
 FbDisplay::~FbDisplay()
@@ -65,6 +69,7 @@ FbDisplay::~FbDisplay()
 int FbDisplay::setPowerMode(int mode)
 {
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
 
     switch (mode) {
         case POWER_ON:
@@ -183,10 +188,7 @@ int FbDisplay::convertFormatInfo(int format, int* bpp)
 
 bool FbDisplay::checkOverlay(Layer* layer)
 {
-    char value[PROPERTY_VALUE_MAX];
-    property_get("hwc.enable.overlay", value, "1");
-    int useOverlay = atoi(value);
-    if (useOverlay == 0) {
+    if (!mTunables.mEnableOverlay) {
         return false;
     }
 
@@ -207,13 +209,15 @@ bool FbDisplay::checkOverlay(Layer* layer)
         return false;
     }
 
-    // overlay only needs on imx8mq.
-    if (!(memory->usage & USAGE_PADDING_BUFFER)) {
+    // overlay only needs on imx8mq, for video and camera preview.
+    bool camera = (memory->usage & USAGE_CAMERA_SCANOUT) == USAGE_CAMERA_SCANOUT;
+    if (!(memory->usage & USAGE_PADDING_BUFFER) && !camera) {
         return false;
     }
 
     // work around to GPU composite if video < 720x576.
-    if (memory->width <= 720 || memory->height <= 576) {
+    // camera preview is scanned out at any size, it is drawn every frame.
+    if (!camera && (memory->width <= 720 || memory->height <= 576)) {
         ALOGV("work around to GPU composite");
         return false;
     }
@@ -228,6 +232,16 @@ bool FbDisplay::checkOverlay(Layer* layer)
     return true;
 }
 
+bool FbDisplay::canPresentAsyncLocked()
+{
+    // release fence of overlay layer comes from pan display.
+    if (mOverlay != NULL) {
+        return false;
+    }
+
+    return Display::canPresentAsyncLocked();
+}
+
 int FbDisplay::performOverlay()
 {
     Layer* layer = mOverlay;
@@ -281,59 +295,107 @@ int FbDisplay::performOverlay()
 
 int FbDisplay::updateScreen()
 {
-    Mutex::Autolock _l(mLock);
+    ATRACE_CALL();
+    struct mxcfb_buffer mxcbuf;
+    sp<VSyncThread> vsync = NULL;
+    nsecs_t period = 0;
+    int fd = -1;
+    uint64_t phys = 0;
+    {
+        Mutex::Autolock _l(mLock);
 
-    if (!mConnected && mFb != 0) {
-        ALOGE("updateScreen display plugout");
-        return -EINVAL;
-    }
+        if (!mConnected && mFb != 0) {
+            ALOGE("updateScreen display plugout");
+            return -EINVAL;
+        }
 
-    if (mPowerMode != POWER_ON) {
-        ALOGE("can't update screen power mode:%d", mPowerMode);
-        return -EINVAL;
-    }
+        if (mPowerMode != POWER_ON) {
+            ALOGE("can't update screen power mode:%d", mPowerMode);
+            return -EINVAL;
+        }
 
-    Memory* buffer = mRenderTarget;
-    if (!buffer || !(buffer->flags & FLAGS_FRAMEBUFFER)) {
-        ALOGV("%s buffer is invalid", __func__);
-        return -EINVAL;
-    }
+        Memory* buffer = mRenderTarget;
+        if (!buffer || !(buffer->flags & FLAGS_FRAMEBUFFER)) {
+            ALOGV("%s buffer is invalid", __func__);
+            return -EINVAL;
+        }
 
-    const DisplayConfig& config = mConfigs[mActiveConfig];
-    if (buffer->width != config.mXres || buffer->height != config.mYres ||
-        buffer->fslFormat != config.mFormat) {
-        ALOGE("%s buffer not match: w:%d, h:%d, f:%d, xres:%d, yres:%d, mf:%d",
-              __func__, buffer->width, buffer->height, buffer->fslFormat,
-              config.mXres, config.mYres, config.mFormat);
-        return -EINVAL;
+        const DisplayConfig& config = mConfigs[mActiveConfig];
+        if (buffer->width != config.mXres || buffer->height != config.mYres ||
+            buffer->fslFormat != config.mFormat) {
+            ALOGE("%s buffer not match: w:%d, h:%d, f:%d, xres:%d, yres:%d, mf:%d",
+                  __func__, buffer->width, buffer->height, buffer->fslFormat,
+                  config.mXres, config.mYres, config.mFormat);
+            return -EINVAL;
+        }
+
+        mxcbuf.xoffset = mxcbuf.yoffset = 0;
+        mxcbuf.stride = config.mStride;
+        mxcbuf.phys = buffer->phys;
+        phys = buffer->phys;
+        fd = mFd;
+        period = config.mVsyncPeriod;
+        // only vsync thread can tell when pan is on screen.
+        vsync = mVsyncThread;
     }
 
-    struct mxcfb_buffer mxcbuf;
-    mxcbuf.xoffset = mxcbuf.yoffset = 0;
-    mxcbuf.stride = config.mStride;
-    mxcbuf.phys = buffer->phys;
+    // ioctls run without mLock, so next frame can be composed meanwhile.
+    if (vsync != NULL) {
+        waitPanDone(period * 2);
+    }
 
-    if (ioctl(mFd, MXCFB_UPDATE_SCREEN, &mxcbuf) < 0) {
+    if (ioctl(fd, MXCFB_UPDATE_SCREEN, &mxcbuf) < 0) {
         ALOGV("MXCFB_UPDATE_SCREEN failed: %s", strerror(errno));
         struct fb_var_screeninfo info;
-        if (ioctl(mFd, FBIOGET_VSCREENINFO, &info) < 0) {
+        if (ioctl(fd, FBIOGET_VSCREENINFO, &info) < 0) {
             ALOGE("updateScreen: FBIOGET_VSCREENINFO failed");
             return -errno;
         }
 
         info.xoffset = info.yoffset = 0;
-        info.reserved[0] = static_cast<uint32_t>(buffer->phys);
-        info.reserved[1] = static_cast<uint32_t>(buffer->phys >> 32);
-        info.activate = FB_ACTIVATE_VBL;
-        if (ioctl(mFd, FBIOPAN_DISPLAY, &info) < 0) {
+        info.reserved[0] = static_cast<uint32_t>(phys);
+        info.reserved[1] = static_cast<uint32_t>(phys >> 32);
+        info.activate = (vsync != NULL) ? FB_ACTIVATE_NOW : FB_ACTIVATE_VBL;
+        if (ioctl(fd, FBIOPAN_DISPLAY, &info) < 0) {
             ALOGE("updateScreen: FBIOPAN_DISPLAY failed errno:%d", errno);
             return -errno;
         }
     }
 
+    if (vsync != NULL) {
+        {
+            Mutex::Autolock _l(mPanLock);
+            mPanPending = true;
+        }
+        vsync->setPanPending();
+        // the other target may still be on screen.
+        if (MAX_FRAMEBUFFERS <= FB_PAN_PENDING_MAX + 1) {
+            waitPanDone(period * 2);
+        }
+    }
+
     return 0;
 }
 
+void FbDisplay::waitPanDone(nsecs_t timeout)
+{
+    Mutex::Autolock _l(mPanLock);
+    while (mPanPending) {
+        if (mPanCondition.waitRelative(mPanLock, timeout) != 0) {
+            ALOGW("wait pan done timeout");
+            mPanPending = false;
+            break;
+        }
+    }
+}
+
+void FbDisplay::handlePanDone()
+{
+    Mutex::Autolock _l(mPanLock);
+    mPanPending = false;
+    mPanCondition.broadcast();
+}
+
 int FbDisplay::readConfigLocked()
 {
     struct fb_var_screeninfo info;
@@ -523,7 +585,7 @@ void FbDisplay::prepareTargetsLocked()
     desc.mFslFormat = config.mFormat;
     desc.mProduceUsage |= USAGE_HW_COMPOSER |
                           USAGE_HW_2D | USAGE_HW_RENDER;
-    desc.mFlag = FLAGS_FRAMEBUFFER;
+    desc.mFlag = FLAGS_FRAMEBUFFER | FLAGS_PRIVATE;
     desc.checkFormat();
 
     MemoryManager* pManager = MemoryManager::getInstance();
@@ -547,6 +609,7 @@ void FbDisplay::releaseTargetsLocked()
         mTargets[i] = NULL;
     }
     mTargetIndex = 0;
+    resetDamageLocked();
 }
 
 int FbDisplay::getConfigIdLocked(int width, int height)
@@ -555,6 +618,7 @@ int FbDisplay::getConfigIdLocked(int width, int height)
     DisplayConfig config;
     config.mXres = width;
     config.mYres = height;
+    config.mModeIndex = 0;
 
     index = mConfigs.indexOf(config);
     if (index < 0) {
@@ -628,6 +692,7 @@ int FbDisplay::setDefaultFormatLocked()
 int FbDisplay::setActiveConfig(int configId)
 {
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
     if (mActiveConfig == configId) {
         ALOGI("the same config, no need to change");
         return 0;
@@ -676,6 +741,12 @@ int FbDisplay::composeLayers()
     // mLayerVector's size > 0 means 2D composite.
     // only this case needs override mRenderTarget.
     if (mLayerVector.size() > 0) {
+        Memory* cached = getCachedTargetLocked();
+        if (cached != NULL) {
+            mRenderTarget = cached;
+            return composeLayersLocked();
+        }
+
         mTargetIndex = mTargetIndex % MAX_FRAMEBUFFERS;
         mRenderTarget = mTargets[mTargetIndex];
         mTargetIndex++;
@@ -686,6 +757,11 @@ int FbDisplay::composeLayers()
 
 void FbDisplay::handleVsyncEvent(nsecs_t timestamp)
 {
+    ATRACE_CALL();
+    // called by vsync thread only.
+    mVsyncTrace = !mVsyncTrace;
+    ATRACE_INT("HW_VSYNC", mVsyncTrace);
+
     EventListener* callback = NULL;
     {
         Mutex::Autolock _l(mLock);
@@ -816,7 +892,7 @@ extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
                            struct timespec *remain);
 
 FbDisplay::VSyncThread::VSyncThread(FbDisplay *ctx)
-    : Thread(false), mCtx(ctx), mEnabled(false),
+    : Thread(false), mCtx(ctx), mEnabled(false), mPanPending(false),
       mFakeVSync(false), mNextFakeVSync(0), mFd(-1)
 {
     mRefreshPeriod = 0;
@@ -829,6 +905,10 @@ void FbDisplay::VSyncThread::onFirstRef()
 
 int32_t FbDisplay::VSyncThread::readyToRun()
 {
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    setThreadPolicy(tunables.mVsyncPriority, tunables.mVsyncCpus);
+
     char fb_path[HWC_PATH_LENGTH];
     memset(fb_path, 0, sizeof(fb_path));
     snprintf(fb_path, HWC_PATH_LENGTH, HWC_FB_SYS"%d""/vsync", DISPLAY_PRIMARY);
@@ -854,11 +934,41 @@ void FbDisplay::VSyncThread::setFakeVSync(bool enable)
     mFakeVSync = enable;
 }
 
+void FbDisplay::VSyncThread::setPanPending()
+{
+    Mutex::Autolock _l(mLock);
+    mPanPending = true;
+    mCondition.signal();
+}
+
+void FbDisplay::VSyncThread::onVSync(nsecs_t timestamp)
+{
+    bool enabled, pan;
+    {
+        Mutex::Autolock _l(mLock);
+        enabled = mEnabled;
+        pan = mPanPending;
+        mPanPending = false;
+    }
+
+    if (mCtx == NULL) {
+        return;
+    }
+
+    if (pan) {
+        mCtx->handlePanDone();
+    }
+    if (enabled) {
+        mCtx->handleVsyncEvent(timestamp);
+    }
+}
+
 bool FbDisplay::VSyncThread::threadLoop()
 {
     { // scope for lock
         Mutex::Autolock _l(mLock);
-        while (!mEnabled) {
+        // also run for pan completion while vsync is off.
+        while (!mEnabled && !mPanPending) {
             mCondition.wait(mLock);
         }
     }
@@ -897,8 +1007,8 @@ void FbDisplay::VSyncThread::performFakeVSync()
         err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
     } while (err<0 && errno == EINTR);
 
-    if (err == 0 && mCtx != NULL) {
-        mCtx->handleVsyncEvent(next_vsync);
+    if (err == 0) {
+        onVSync(next_vsync);
     }
 }
 
@@ -924,9 +1034,7 @@ void FbDisplay::VSyncThread::performVSync()
     }
 
     lasttime = timestamp;
-    if (mCtx != NULL) {
-        mCtx->handleVsyncEvent(timestamp);
-    }
+    onVSync(timestamp);
 }
 
 }
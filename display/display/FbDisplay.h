@@ -37,6 +37,8 @@ namespace fsl {
 #define SYS_GRAPHICS "/sys/class/graphics"
 #define HWC_FB_SYS "/sys/class/graphics/fb"
 #define HWC_FB_DEV "/dev/graphics/fb"
+// pans in flight, at least three targets needed to let two overlap.
+#define FB_PAN_PENDING_MAX 1
 
 using android::Condition;
 
@@ -59,6 +61,7 @@ public:
 
     virtual bool checkOverlay(Layer* layer);
     virtual int performOverlay();
+    virtual bool canPresentAsyncLocked();
     // compose all layers.
     virtual int composeLayers();
     // set display active config.
@@ -88,6 +91,9 @@ private:
     void prepareTargetsLocked();
     void releaseTargetsLocked();
     int convertFormatInfo(int format, int* bpp);
+    // wait pan on screen so that its target can be composed again.
+    void waitPanDone(nsecs_t timeout);
+    void handlePanDone();
 
 protected:
     int mFb;
@@ -103,6 +109,11 @@ protected:
     int mOvPowerMode;
     Layer* mOverlay;
 
+    // pan submitted without waiting vblank, completed by vsync thread.
+    Mutex mPanLock;
+    Condition mPanCondition;
+    bool mPanPending;
+
 protected:
     void handleVsyncEvent(nsecs_t timestamp);
     class VSyncThread : public Thread {
@@ -110,6 +121,8 @@ protected:
         explicit VSyncThread(FbDisplay *ctx);
         void setEnabled(bool enabled);
         void setFakeVSync(bool enable);
+        // notify pan completion at next vsync.
+        void setPanPending();
 
     private:
         virtual void onFirstRef();
@@ -117,11 +130,13 @@ protected:
         virtual bool threadLoop();
         void performFakeVSync();
         void performVSync();
+        void onVSync(nsecs_t timestamp);
 
         FbDisplay *mCtx;
         mutable Mutex mLock;
         Condition mCondition;
         bool mEnabled;
+        bool mPanPending;
 
         bool mFakeVSync;
         mutable nsecs_t mNextFakeVSync;
@@ -131,6 +146,8 @@ protected:
 
     sp<VSyncThread> mVsyncThread;
     EventListener* mListener;
+    // HW_VSYNC counter track, toggled on each vsync.
+    int mVsyncTrace;
 };
 
 }
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FrameStats.h"
+
+namespace fsl {
+
+static const char* sStageNames[STAT_NUM] = {
+    "validate", "fence wait", "compose", "commit", "frame",
+};
+
+FrameStats::FrameStats()
+    : mLock(Mutex::PRIVATE)
+{
+    memset(&mCurrent, 0, sizeof(mCurrent));
+    memset(mRecords, 0, sizeof(mRecords));
+    mIndex = 0;
+    mCount = 0;
+    mFrames = 0;
+    mMissed = 0;
+    memset(mLatency, 0, sizeof(mLatency));
+    mLatencyIndex = 0;
+    mLatencyCount = 0;
+    mLatencyFrames = 0;
+}
+
+void FrameStats::addTime(int stage, nsecs_t time)
+{
+    if (stage < 0 || stage >= STAT_NUM) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mCurrent.mTimes[stage] += time;
+}
+
+void FrameStats::setLayers(int client, int device, int overlay)
+{
+    Mutex::Autolock _l(mLock);
+    mCurrent.mClientLayers = client;
+    mCurrent.mDeviceLayers = device;
+    mCurrent.mOverlayLayers = overlay;
+}
+
+void FrameStats::finishFrame(nsecs_t period)
+{
+    Mutex::Autolock _l(mLock);
+    if (period > 0 && mCurrent.mTimes[STAT_FRAME] > period) {
+        mMissed += mCurrent.mTimes[STAT_FRAME] / period;
+    }
+
+    mRecords[mIndex] = mCurrent;
+    mIndex = (mIndex + 1) % FRAME_STATS_NUM;
+    if (mCount < FRAME_STATS_NUM) {
+        mCount++;
+    }
+    mFrames++;
+    memset(&mCurrent, 0, sizeof(mCurrent));
+}
+
+void FrameStats::addLatency(nsecs_t latency)
+{
+    Mutex::Autolock _l(mLock);
+    mLatency[mLatencyIndex] = latency;
+    mLatencyIndex = (mLatencyIndex + 1) % FRAME_STATS_NUM;
+    if (mLatencyCount < FRAME_STATS_NUM) {
+        mLatencyCount++;
+    }
+    mLatencyFrames++;
+}
+
+static int compareTime(const void* lhs, const void* rhs)
+{
+    nsecs_t l = *(const nsecs_t*)lhs;
+    nsecs_t r = *(const nsecs_t*)rhs;
+    return (l > r) - (l < r);
+}
+
+void FrameStats::dump(String8& out)
+{
+    Mutex::Autolock _l(mLock);
+    out.appendFormat("    frames:%" PRIu64 " missed vsync:%" PRIu64
+                     " last %zu frames (us):\n", mFrames, mMissed, mCount);
+    if (mCount == 0) {
+        return;
+    }
+
+    nsecs_t times[FRAME_STATS_NUM];
+    for (int stage=0; stage<STAT_NUM; stage++) {
+        for (size_t i=0; i<mCount; i++) {
+            times[i] = mRecords[i].mTimes[stage];
+        }
+        qsort(times, mCount, sizeof(times[0]), compareTime);
+        out.appendFormat("      %-10s p50:%6" PRId64 " p90:%6" PRId64
+                         " p99:%6" PRId64 " max:%6" PRId64 "\n",
+                         sStageNames[stage],
+                         (int64_t)ns2us(times[mCount * 50 / 100]),
+                         (int64_t)ns2us(times[mCount * 90 / 100]),
+                         (int64_t)ns2us(times[mCount * 99 / 100]),
+                         (int64_t)ns2us(times[mCount - 1]));
+    }
+
+    int client = 0, device = 0, overlay = 0;
+    for (size_t i=0; i<mCount; i++) {
+        client += mRecords[i].mClientLayers;
+        device += mRecords[i].mDeviceLayers;
+        overlay += mRecords[i].mOverlayLayers;
+    }
+    out.appendFormat("      layers avg client:%.1f device:%.1f overlay:%.1f\n",
+                     (float)client / mCount, (float)device / mCount,
+                     (float)overlay / mCount);
+
+    if (mLatencyCount == 0) {
+        return;
+    }
+
+    memcpy(times, mLatency, mLatencyCount * sizeof(times[0]));
+    qsort(times, mLatencyCount, sizeof(times[0]), compareTime);
+    out.appendFormat("    camera frames:%" PRIu64 " glass to glass"
+                     " last %zu frames (us):\n", mLatencyFrames, mLatencyCount);
+    out.appendFormat("      %-10s p50:%6" PRId64 " p90:%6" PRId64
+                     " p99:%6" PRId64 " max:%6" PRId64 "\n",
+                     "latency",
+                     (int64_t)ns2us(times[mLatencyCount * 50 / 100]),
+                     (int64_t)ns2us(times[mLatencyCount * 90 / 100]),
+                     (int64_t)ns2us(times[mLatencyCount * 99 / 100]),
+                     (int64_t)ns2us(times[mLatencyCount - 1]));
+}
+
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FSL_FRAME_STATS_H_
+#define _FSL_FRAME_STATS_H_
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+namespace fsl {
+
+using android::Mutex;
+using android::String8;
+
+// number of recent frames for percentiles.
+#define FRAME_STATS_NUM 128
+
+enum {
+    STAT_VALIDATE = 0,
+    STAT_FENCE_WAIT,
+    STAT_COMPOSE,
+    STAT_COMMIT,
+    STAT_FRAME,
+    STAT_NUM,
+};
+
+struct FrameRecord
+{
+    nsecs_t mTimes[STAT_NUM];
+    int mClientLayers;
+    int mDeviceLayers;
+    int mOverlayLayers;
+};
+
+// rolling composition statistics of one display.
+class FrameStats
+{
+public:
+    FrameStats();
+
+    // add time of stage to current frame.
+    void addTime(int stage, nsecs_t time);
+    void setLayers(int client, int device, int overlay);
+    // close current frame, it misses vsync when it takes longer than period.
+    void finishFrame(nsecs_t period);
+    // time from camera capture to scanout of a frame showing it.
+    void addLatency(nsecs_t latency);
+    void dump(String8& out);
+
+private:
+    Mutex mLock;
+    FrameRecord mCurrent;
+    FrameRecord mRecords[FRAME_STATS_NUM];
+    size_t mIndex;
+    size_t mCount;
+    uint64_t mFrames;
+    uint64_t mMissed;
+    // glass-to-glass latency of recent camera frames.
+    nsecs_t mLatency[FRAME_STATS_NUM];
+    size_t mLatencyIndex;
+    size_t mLatencyCount;
+    uint64_t mLatencyFrames;
+};
+
+}
+#endif
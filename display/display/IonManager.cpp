@@ -15,22 +15,73 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <inttypes.h>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <cutils/log.h>
 #include <ion/ion.h>
 #include <linux/mxc_ion.h>
 #include <ion_ext.h>
+#include <dma_heap_ext.h>
 #include "IonManager.h"
+#include "Tunables.h"
 
 namespace fsl {
 
+#define ION_ALLOC_ALIGN 8
+// physically contiguous heap of imx ion device.
+#define ION_CMA_HEAP_MASK 1
+#define ION_ALLOC_FLAGS 0
+
 inline size_t roundUpToPageSize(size_t x) {
     return (x + (PAGE_SIZE-1)) & ~(PAGE_SIZE-1);
 }
 
+inline size_t roundUpToPoolSize(size_t x) {
+    return (x + (ION_POOL_ALIGN-1)) & ~(ION_POOL_ALIGN-1);
+}
+
+// display, 2D, VPU and camera take physical address,
+// GPU and CPU only users work on scatter-gather memory.
+static bool needsContiguous(const MemoryDesc& desc)
+{
+    if (desc.mFlag & (FLAGS_FRAMEBUFFER | FLAGS_CAMERA | FLAGS_VIDEO)) {
+        return true;
+    }
+
+    int64_t usage = desc.mProduceUsage | desc.mConsumeUsage;
+    return (usage & ~(int64_t)(USAGE_SW_READ_OFTEN | USAGE_SW_WRITE_OFTEN |
+                               USAGE_HW_TEXTURE | USAGE_HW_RENDER)) != 0;
+}
+
+// names of imx heaps first, then of upstream CMA heap.
+static const char* const sDmaHeapNames[DMA_HEAP_NUM][2] = {
+    {"reserved", "linux,cma"},
+    {"reserved-uncached", "linux,cma-uncached"},
+    {"system", NULL},
+    {"system-uncached", NULL},
+};
+
 IonManager::IonManager()
+    : mMapLock(Mutex::PRIVATE), mPoolLock(Mutex::PRIVATE)
 {
+    mPoolSize = 0;
+    mIonFd = -1;
+    mDmaHeap = false;
+    for (int i=0; i<DMA_HEAP_NUM; i++) {
+        mHeapFds[i] = -1;
+    }
+
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    if (tunables.mDmaHeap) {
+        openDmaHeaps();
+    }
+    if (mDmaHeap) {
+        return;
+    }
+
     mIonFd = ion_open();
     if (mIonFd <= 0) {
         ALOGE("%s ion open failed", __func__);
@@ -39,14 +90,67 @@ IonManager::IonManager()
 
 IonManager::~IonManager()
 {
+    trimPool(0);
     if (mIonFd > 0) {
         close(mIonFd);
     }
+    for (int i=0; i<DMA_HEAP_NUM; i++) {
+        if (mHeapFds[i] >= 0) {
+            close(mHeapFds[i]);
+        }
+    }
+}
+
+void IonManager::openDmaHeaps()
+{
+    char path[64];
+    for (int i=0; i<DMA_HEAP_NUM; i++) {
+        for (int j=0; j<2 && mHeapFds[i] < 0; j++) {
+            if (sDmaHeapNames[i][j] == NULL) {
+                break;
+            }
+            snprintf(path, sizeof(path), DMA_HEAP_PATH "%s", sDmaHeapNames[i][j]);
+            mHeapFds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        }
+    }
+
+    // contiguous memory is a must for display and camera.
+    mDmaHeap = mHeapFds[DMA_HEAP_CMA] >= 0 ||
+               mHeapFds[DMA_HEAP_CMA_UNCACHED] >= 0;
+    if (!mDmaHeap) {
+        for (int i=0; i<DMA_HEAP_NUM; i++) {
+            if (mHeapFds[i] >= 0) {
+                close(mHeapFds[i]);
+                mHeapFds[i] = -1;
+            }
+        }
+        return;
+    }
+
+    ALOGI("dma-buf heaps: cma %d/%d system %d/%d",
+          mHeapFds[DMA_HEAP_CMA] >= 0, mHeapFds[DMA_HEAP_CMA_UNCACHED] >= 0,
+          mHeapFds[DMA_HEAP_SYSTEM] >= 0, mHeapFds[DMA_HEAP_SYSTEM_UNCACHED] >= 0);
+}
+
+int IonManager::selectDmaHeap(const MemoryDesc& desc)
+{
+    // memory never touched by CPU needs no cache maintenance.
+    bool uncached = ((desc.mProduceUsage | desc.mConsumeUsage) &
+                     (USAGE_SW_READ_OFTEN | USAGE_SW_WRITE_OFTEN)) == 0;
+    int heap = needsContiguous(desc) ? DMA_HEAP_CMA : DMA_HEAP_SYSTEM;
+    if (mHeapFds[heap] < 0 && mHeapFds[heap + 1] < 0) {
+        heap = DMA_HEAP_CMA;
+    }
+    if ((uncached && mHeapFds[heap + 1] >= 0) || mHeapFds[heap] < 0) {
+        heap++;
+    }
+
+    return heap;
 }
 
 int IonManager::allocMemory(MemoryDesc& desc, Memory** out)
 {
-    if (mIonFd <= 0 || out == NULL) {
+    if (!isReady() || out == NULL) {
         ALOGE("%s invalid parameters", __func__);
         return -EINVAL;
     }
@@ -58,13 +162,71 @@ int IonManager::allocMemory(MemoryDesc& desc, Memory** out)
         return -EINVAL;
     }
 
-    unsigned char *ptr = NULL;
     int sharedFd;
     ion_user_handle_t ion_hnd = -1;
     Memory* memory = NULL;
 
+    // keep CMA for users that need it, it fragments on small memory boards.
+    // heap mask of dma-buf heap backend is bit of its heap index.
+    int heap = -1;
+    unsigned int heapMask = ION_CMA_HEAP_MASK;
+    desc.mFlag &= ~FLAGS_SCATTER_GATHER;
+    if (mDmaHeap) {
+        heap = selectDmaHeap(desc);
+        heapMask = 1U << heap;
+        if (heap == DMA_HEAP_CMA_UNCACHED || heap == DMA_HEAP_SYSTEM_UNCACHED) {
+            desc.mFlag |= FLAGS_UNCACHED;
+        }
+        if (heap == DMA_HEAP_SYSTEM || heap == DMA_HEAP_SYSTEM_UNCACHED) {
+            desc.mFlag |= FLAGS_SCATTER_GATHER;
+        }
+    }
+    else if (!needsContiguous(desc)) {
+        Tunables tunables;
+        TunableManager::getInstance()->getTunables(&tunables);
+        if (tunables.mIonSgHeapMask != 0) {
+            heapMask = tunables.mIonSgHeapMask;
+            desc.mFlag |= FLAGS_SCATTER_GATHER;
+        }
+    }
+
     desc.mSize = (desc.mSize + PAGE_SIZE) & (~(PAGE_SIZE - 1));
-    int err = ion_alloc(mIonFd, desc.mSize, 8, 1, 0, &ion_hnd);
+    if (desc.mFlag & FLAGS_PRIVATE) {
+        // reuse memory of the same size class.
+        IonPoolEntry entry;
+        desc.mSize = roundUpToPoolSize(desc.mSize);
+        Mutex::Autolock _l(mPoolLock);
+        if (getPooledLocked(desc.mSize, heapMask,
+                            ION_ALLOC_FLAGS, &entry) == 0) {
+            memory = new Memory(&desc, entry.fd);
+            memory->phys = entry.phys;
+            close(entry.fd);
+            *out = memory;
+            return 0;
+        }
+    }
+
+    if (mDmaHeap) {
+        return allocDmaHeap(desc, heap, out);
+    }
+
+    int err = ion_alloc(mIonFd, desc.mSize, ION_ALLOC_ALIGN,
+                        heapMask, ION_ALLOC_FLAGS, &ion_hnd);
+    if (err && heapMask != ION_CMA_HEAP_MASK) {
+        // no scatter-gather heap on this kernel, use CMA.
+        ALOGW("ion_alloc from heap 0x%x failed, use CMA", heapMask);
+        heapMask = ION_CMA_HEAP_MASK;
+        desc.mFlag &= ~FLAGS_SCATTER_GATHER;
+        err = ion_alloc(mIonFd, desc.mSize, ION_ALLOC_ALIGN,
+                        heapMask, ION_ALLOC_FLAGS, &ion_hnd);
+    }
+    if (err) {
+        // memory pressure, drop pooled memory and try again.
+        ALOGW("ion_alloc failed, trim pool and retry");
+        trimPool(0);
+        err = ion_alloc(mIonFd, desc.mSize, ION_ALLOC_ALIGN,
+                        heapMask, ION_ALLOC_FLAGS, &ion_hnd);
+    }
     if (err) {
         ALOGE("ion_alloc failed");
         return err;
@@ -78,7 +240,11 @@ int IonManager::allocMemory(MemoryDesc& desc, Memory** out)
     }
 
     memory = new Memory(&desc, sharedFd);
-    getPhys(memory);
+    // scatter-gather memory has no physical address, overlay and 2D
+    // composition skip layers with phys 0.
+    if (heapMask == ION_CMA_HEAP_MASK) {
+        getPhys(memory);
+    }
 
     *out = memory;
     ion_free(mIonFd, ion_hnd);
@@ -87,16 +253,127 @@ int IonManager::allocMemory(MemoryDesc& desc, Memory** out)
     return 0;
 }
 
+int IonManager::allocDmaHeap(MemoryDesc& desc, int heap, Memory** out)
+{
+    // single ioctl returns shareable dma-buf fd.
+    int fd = dma_heap_alloc(mHeapFds[heap], desc.mSize);
+    if (fd < 0) {
+        // memory pressure, drop pooled memory and try again.
+        ALOGW("dma heap alloc failed, trim pool and retry");
+        trimPool(0);
+        fd = dma_heap_alloc(mHeapFds[heap], desc.mSize);
+    }
+    if (fd < 0) {
+        ALOGE("dma heap alloc of %zu bytes failed", (size_t)desc.mSize);
+        return -ENOMEM;
+    }
+
+    Memory* memory = new Memory(&desc, fd);
+    if (heap == DMA_HEAP_CMA || heap == DMA_HEAP_CMA_UNCACHED) {
+        getPhys(memory);
+    }
+    close(fd);
+
+    *out = memory;
+    return 0;
+}
+
+int IonManager::getPooledLocked(size_t size, unsigned int heapMask,
+                                unsigned int flags, IonPoolEntry* out)
+{
+    for (ssize_t i=mPool.size()-1; i>=0; i--) {
+        const IonPoolEntry& entry = mPool[i];
+        if (entry.size == size && entry.heapMask == heapMask &&
+            entry.flags == flags) {
+            *out = entry;
+            mPoolSize -= entry.size;
+            mPool.removeAt(i);
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+bool IonManager::recycleMemory(Memory* memory)
+{
+    if (memory == NULL || !(memory->flags & FLAGS_ALLOCATION_ION) ||
+        !(memory->flags & FLAGS_PRIVATE) || memory->pid != getpid()) {
+        return false;
+    }
+
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    if ((size_t)memory->size > tunables.mIonPoolSize) {
+        return false;
+    }
+
+    // CMA memory whose physical address lookup failed would be handed
+    // out again without one.
+    bool sg = (memory->flags & FLAGS_SCATTER_GATHER) != 0;
+    if (!sg && memory->phys == 0) {
+        return false;
+    }
+
+    unsigned int heapMask = sg ? tunables.mIonSgHeapMask : ION_CMA_HEAP_MASK;
+    if (mDmaHeap) {
+        int heap = sg ? DMA_HEAP_SYSTEM : DMA_HEAP_CMA;
+        if (memory->flags & FLAGS_UNCACHED) {
+            heap++;
+        }
+        heapMask = 1U << heap;
+    }
+    if (heapMask == 0) {
+        return false;
+    }
+
+    IonPoolEntry entry;
+    entry.fd = memory->fd;
+    entry.size = memory->size;
+    entry.phys = memory->phys;
+    entry.heapMask = heapMask;
+    entry.flags = ION_ALLOC_FLAGS;
+
+    Mutex::Autolock _l(mPoolLock);
+    mPool.add(entry);
+    mPoolSize += entry.size;
+    trimPoolLocked(tunables.mIonPoolSize);
+
+    return true;
+}
+
+void IonManager::trimPool(size_t limit)
+{
+    Mutex::Autolock _l(mPoolLock);
+    trimPoolLocked(limit);
+}
+
+void IonManager::trimPoolLocked(size_t limit)
+{
+    // release the least recently pooled memory first.
+    while (mPoolSize > limit && mPool.size() > 0) {
+        const IonPoolEntry& entry = mPool[0];
+        mPoolSize -= entry.size;
+        close(entry.fd);
+        mPool.removeAt(0);
+    }
+}
+
 int IonManager::getPhys(Memory* memory)
 {
-    if (mIonFd <= 0 || memory == NULL || memory->fd < 0) {
+    if (!isReady() || memory == NULL || memory->fd < 0) {
         ALOGE("%s invalid parameters", __func__);
         return -EINVAL;
     }
 
     uint64_t phyAddr = 0;
 
-    phyAddr = ion_phys(mIonFd, memory->size, memory->fd);
+    if (mDmaHeap) {
+        phyAddr = dma_buf_phys(memory->fd);
+    }
+    else {
+        phyAddr = ion_phys(mIonFd, memory->size, memory->fd);
+    }
     if (phyAddr == 0) {
         ALOGE("ion_phys failed");
         return -EINVAL;
@@ -108,7 +385,7 @@ int IonManager::getPhys(Memory* memory)
 
 int IonManager::getVaddrs(Memory* memory)
 {
-    if (mIonFd <= 0 || memory == NULL || memory->fd < 0) {
+    if (!isReady() || memory == NULL || memory->fd < 0) {
         ALOGE("%s invalid parameters", __func__);
         return -EINVAL;
     }
@@ -126,32 +403,158 @@ int IonManager::getVaddrs(Memory* memory)
 
 int IonManager::flushCache(Memory* memory)
 {
-    if (mIonFd <= 0 || memory == NULL || memory->fd < 0) {
+    if (!isReady() || memory == NULL || memory->fd < 0) {
         ALOGE("%s invalid parameters", __func__);
         return -EINVAL;
     }
 
-    ion_sync_fd(mIonFd, memory->fd);
+    if (memory->flags & FLAGS_UNCACHED) {
+        return 0;
+    }
+    if (mDmaHeap) {
+        dma_buf_sync(memory->fd);
+    }
+    else {
+        ion_sync_fd(mIonFd, memory->fd);
+    }
 
     return 0;
 }
 
-int IonManager::lock(Memory* handle, int /*usage*/,
-        int /*l*/, int /*t*/, int /*w*/, int /*h*/, void** vaddr)
+#if defined(__aarch64__)
+static void syncCacheRange(uintptr_t start, size_t size, bool invalidate)
 {
-    if (handle->base == 0) {
-        getVaddrs(handle);
+    uint64_t ctr;
+    asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    uintptr_t line = 4 << ((ctr >> 16) & 0xf);
+    uintptr_t end = start + size;
+
+    for (start &= ~(line - 1); start < end; start += line) {
+        if (invalidate) {
+            asm volatile("dc civac, %0" : : "r"(start) : "memory");
+        }
+        else {
+            asm volatile("dc cvac, %0" : : "r"(start) : "memory");
+        }
+    }
+    asm volatile("dsb sy" : : : "memory");
+}
+#endif
+
+int IonManager::syncCache(Memory* memory, size_t offset,
+                          size_t size, bool invalidate)
+{
+    if (memory == NULL || memory->base == 0 ||
+        offset + size > (size_t)memory->size) {
+        ALOGE("%s invalid parameters", __func__);
+        return -EINVAL;
+    }
+
+    // CPU mapping of uncached memory is coherent.
+    if (memory->flags & FLAGS_UNCACHED) {
+        return 0;
+    }
+
+#if defined(__aarch64__)
+    // cache maintenance by VA is allowed in user space.
+    syncCacheRange(memory->base + offset, size, invalidate);
+    return 0;
+#else
+    return flushCache(memory);
+#endif
+}
+
+static inline bool isCpuUsage(int usage)
+{
+    return (usage & (USAGE_SW_READ_OFTEN | USAGE_SW_WRITE_OFTEN)) != 0;
+}
+
+static size_t getRowBytes(Memory* handle)
+{
+    switch (handle->fslFormat) {
+        case FORMAT_RGBA8888:
+        case FORMAT_RGBX8888:
+        case FORMAT_BGRA8888:
+            return handle->stride * 4;
+        case FORMAT_RGB888:
+            return handle->stride * 3;
+        case FORMAT_RGB565:
+            return handle->stride * 2;
+        default:
+            // planes of yuv memory are not contiguous in rows.
+            return 0;
+    }
+}
+
+int IonManager::lockRangeLocked(Memory* handle, int usage,
+                                size_t offset, size_t size)
+{
+    if (handle->base == 0 && getVaddrs(handle) != 0) {
+        return -EINVAL;
+    }
+
+    // device may write memory after last CPU access.
+    if (usage & USAGE_SW_READ_OFTEN) {
+        syncCache(handle, offset, size, true);
+    }
+
+    ssize_t index = mLockRanges.indexOfKey(handle);
+    if (handle->mapCount > 0 && index >= 0) {
+        // nested lock, sync union of all locked ranges on unlock.
+        IonLockRange& range = mLockRanges.editValueAt(index);
+        size_t end = range.offset + range.size;
+        if (end < offset + size) {
+            end = offset + size;
+        }
+        if (range.offset > offset) {
+            range.offset = offset;
+        }
+        range.size = end - range.offset;
+        range.usage |= usage;
+    }
+    else {
+        IonLockRange range;
+        range.usage = usage;
+        range.offset = offset;
+        range.size = size;
+        mLockRanges.add(handle, range);
+    }
+    handle->mapCount++;
+
+    return 0;
+}
+
+int IonManager::lock(Memory* handle, int usage,
+        int l, int t, int w, int h, void** vaddr)
+{
+    Mutex::Autolock _l(mMapLock);
+    // hardware only users never map memory or sync cache.
+    if (isCpuUsage(usage)) {
+        size_t offset = 0, size = handle->size;
+        size_t rowBytes = getRowBytes(handle);
+        if (rowBytes > 0 && w > 0 && h > 0 && l >= 0 && t >= 0 &&
+            t + h <= handle->height) {
+            // only rows of locked rect.
+            offset = t * rowBytes;
+            size = h * rowBytes;
+        }
+
+        int ret = lockRangeLocked(handle, usage, offset, size);
+        if (ret != 0) {
+            return ret;
+        }
     }
     *vaddr = (void *)handle->base;
 
     return 0;
 }
 
-int IonManager::lockYCbCr(Memory* handle, int /*usage*/,
+int IonManager::lockYCbCr(Memory* handle, int usage,
         int /*l*/, int /*t*/, int /*w*/, int /*h*/, android_ycbcr* ycbcr)
 {
-    if (handle->base == 0) {
-        getVaddrs(handle);
+    Mutex::Autolock _l(mMapLock);
+    if (isCpuUsage(usage)) {
+        return lockRangeLocked(handle, usage, 0, handle->size);
     }
 
     return 0;
@@ -159,8 +562,26 @@ int IonManager::lockYCbCr(Memory* handle, int /*usage*/,
 
 int IonManager::unlock(Memory* handle)
 {
-    if (handle->flags & FLAGS_CPU) {
-        flushCache(handle);
+    Mutex::Autolock _l(mMapLock);
+    if (handle->mapCount > 0) {
+        handle->mapCount--;
+    }
+
+    ssize_t index = mLockRanges.indexOfKey(handle);
+    if (handle->mapCount == 0 && index >= 0) {
+        // device may read memory after CPU write.
+        const IonLockRange& range = mLockRanges.valueAt(index);
+        if (range.usage & USAGE_SW_WRITE_OFTEN) {
+            syncCache(handle, range.offset, range.size, false);
+        }
+        mLockRanges.removeItemsAt(index);
+    }
+
+    // keep mapping of memory often accessed by CPU.
+    if (handle->mapCount == 0 && handle->base != 0 &&
+        !isCpuUsage(handle->usage)) {
+        munmap((void*)handle->base, handle->size);
+        handle->base = 0;
     }
 
     return 0;
@@ -19,11 +19,47 @@
 #define _FSL_ION_MANAGER_H_
 
 #include <hardware/gralloc.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <utils/KeyedVector.h>
 #include "Memory.h"
 #include "MemoryDesc.h"
 
 namespace fsl {
 
+using android::Mutex;
+using android::Vector;
+using android::KeyedVector;
+
+// pooled memory size is aligned to its size class.
+#define ION_POOL_ALIGN (64 * 1024)
+
+struct IonPoolEntry
+{
+    int fd;
+    size_t size;
+    uint64_t phys;
+    unsigned int heapMask;
+    unsigned int flags;
+};
+
+// heaps of dma-buf heap backend, uncached variant follows cached one.
+enum {
+    DMA_HEAP_CMA = 0,
+    DMA_HEAP_CMA_UNCACHED,
+    DMA_HEAP_SYSTEM,
+    DMA_HEAP_SYSTEM_UNCACHED,
+    DMA_HEAP_NUM,
+};
+
+// byte range and CPU usage of locked memory, synced again on unlock.
+struct IonLockRange
+{
+    int usage;
+    size_t offset;
+    size_t size;
+};
+
 class IonManager
 {
 public:
@@ -33,6 +69,10 @@ public:
     int allocMemory(MemoryDesc& desc, Memory** out);
 
     int flushCache(Memory* memory);
+    // sync CPU cache of memory range, invalidate before CPU read,
+    // clean after CPU write.
+    int syncCache(Memory* memory, size_t offset,
+                  size_t size, bool invalidate);
     int getPhys(Memory* memory);
     int getVaddrs(Memory* memory);
 
@@ -44,8 +84,35 @@ public:
             android_ycbcr* ycbcr);
     int unlock(Memory* handle);
 
+    // take private memory back to pool, return false if it's not pooled.
+    bool recycleMemory(Memory* memory);
+    // release pooled memory until pool size is under limit.
+    void trimPool(size_t limit);
+
+private:
+    bool isReady() {return mDmaHeap || mIonFd > 0;}
+    void openDmaHeaps();
+    // heap of dma-buf heap backend for memory usage.
+    int selectDmaHeap(const MemoryDesc& desc);
+    int allocDmaHeap(MemoryDesc& desc, int heap, Memory** out);
+    int getPooledLocked(size_t size, unsigned int heapMask,
+                        unsigned int flags, IonPoolEntry* out);
+    void trimPoolLocked(size_t limit);
+    int lockRangeLocked(Memory* handle, int usage,
+                        size_t offset, size_t size);
+
 private:
     int mIonFd;
+    // memory comes from dma-buf heaps instead of /dev/ion.
+    bool mDmaHeap;
+    int mHeapFds[DMA_HEAP_NUM];
+    Mutex mMapLock;
+    KeyedVector<Memory*, IonLockRange> mLockRanges;
+
+    // free memory in LRU order, newest at the end.
+    Mutex mPoolLock;
+    Vector<IonPoolEntry> mPool;
+    size_t mPoolSize;
 };
 
 }
@@ -16,10 +16,18 @@
 
 #include <inttypes.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
 #include <cutils/log.h>
 #include <sync/sync.h>
 #include <cutils/properties.h>
+#include <utils/Trace.h>
+#include <power_workload_ext.h>
+#include <latency_mark_ext.h>
+#include <rearview_ext.h>
 
 #include <linux/fb.h>
 #include <linux/mxcfb.h>
@@ -30,37 +38,107 @@
 #include "Memory.h"
 #include "MemoryManager.h"
 #include "KmsDisplay.h"
+#include "SidebandStream.h"
 
 namespace fsl {
 
+bool KmsDisplay::sFlipEvents = false;
+Mutex KmsDisplay::sWorkloadLock;
+uint32_t KmsDisplay::s4kDisplays = 0;
+
 KmsDisplay::KmsDisplay()
 {
     mDrmFd = -1;
     mVsyncThread = NULL;
+    mSidebandThread = NULL;
+    mVsyncTrace = 0;
     mTargetIndex = 0;
     memset(&mTargets[0], 0, sizeof(mTargets));
+    memset(mTargetWidths, 0, sizeof(mTargetWidths));
+    memset(mTargetHeights, 0, sizeof(mTargetHeights));
+    mComposeLoad = 0;
+    mNoRenderScale = false;
     mMemoryManager = MemoryManager::getInstance();
     mModeset = true;
+    mSeamless = false;
+    mNoSeamless = false;
+    mIdleConfig = -1;
+    mContentConfig = -1;
+    memset(mModes, 0, sizeof(mModes));
+    memset(mModeBlobs, 0, sizeof(mModeBlobs));
+    memset(&mCrtc, 0, sizeof(mCrtc));
+    mCtmBlob = 0;
+    mCtmChanged = false;
     mConnectorID = 0;
+    memset(&mWriteback, 0, sizeof(mWriteback));
+    mWritebackID = 0;
+    mWritebackCrtcs = 0;
+    mWritebackBound = false;
+    mWritebackTarget = NULL;
+    mWritebackAcquire = -1;
+    mWritebackDone = NULL;
+    mWritebackFence = -1;
+    mWritebackFormatNum = 0;
     mKmsPlaneNum = 1;
     memset(mKmsPlanes, 0, sizeof(mKmsPlanes));
     mPset = NULL;
-    mOverlay = NULL;
+    mPsetOpen = false;
+    memset(mOverlays, 0, sizeof(mOverlays));
+    memset(mPlaneLayers, 0, sizeof(mPlaneLayers));
+    mFenceLayerNum = 0;
+    mPlaneLimit = 0;
+    for (int i=0; i<KMS_PLANE_NUM; i++) {
+        mPlaneFences[i] = -1;
+    }
+    memset(mOverlayFbs, 0, sizeof(mOverlayFbs));
+    memset(&mCursorPlane, 0, sizeof(mCursorPlane));
+    mCursorLayer = NULL;
+    mCursorPlaneLayer = NULL;
+    mCursorFb = 0;
+    mCursorFence = -1;
+    mCursorWidth = KMS_CURSOR_SIZE;
+    mCursorHeight = KMS_CURSOR_SIZE;
+    memset(mFbCache, 0, sizeof(mFbCache));
+    for (int i=0; i<KMS_FB_CACHE_SIZE; i++) {
+        mFbCache[i].fd = -1;
+    }
+    mFbSerial = 0;
+    mFlipPending = false;
+    mFlipTime = 0;
+    mLastMarkNum = 0;
+    mFlipMarkNum = 0;
+    mEarlyView = -1;
+    mEarlyViewReleased = false;
+    mEarlyViewTime = 0;
+    mMemoryManager->addListener(this);
 }
 
 KmsDisplay::~KmsDisplay()
 {
     sp<VSyncThread> vsync = NULL;
+    sp<SidebandThread> sideband = NULL;
     {
         Mutex::Autolock _l(mLock);
         vsync = mVsyncThread;
+        sideband = mSidebandThread;
     }
 
     if (vsync != NULL) {
         vsync->requestExit();
     }
 
+    if (sideband != NULL) {
+        sideband->requestExit();
+        sideband->wake();
+        sideband->join();
+    }
+
     closeKms();
+    if (mPset != NULL) {
+        drmModeAtomicFree(mPset);
+        mPset = NULL;
+    }
+    mMemoryManager->removeListener(this);
     if (mDrmFd > 0) {
         close(mDrmFd);
     }
@@ -144,6 +222,8 @@ void KmsPlane::getPropertyIds()
         {"CRTC_W",  &crtc_w},
         {"CRTC_H",  &crtc_h},
         {"alpha",   &alpha_id},
+        {"rotation", &rotation_id},
+        {"IN_FENCE_FD", &in_fence_fd},
         {"FB_ID",   &fb_id},
         {"CRTC_ID", &crtc_id},
     };
@@ -152,6 +232,118 @@ void KmsPlane::getPropertyIds()
                      DRM_MODE_OBJECT_PLANE,
                      planeTable, ARRAY_LEN(planeTable),
                      mDrmFd);
+    getRotations();
+}
+
+void KmsPlane::getRotations()
+{
+    mRotations = DRM_MODE_ROTATE_0;
+    if (rotation_id == 0) {
+        return;
+    }
+
+    drmModePropertyPtr prop = drmModeGetProperty(mDrmFd, rotation_id);
+    if (prop == NULL) {
+        ALOGE("get rotation property failed");
+        return;
+    }
+
+    // value of each bitmask enum is its bit position.
+    if (prop->flags & DRM_MODE_PROP_BITMASK) {
+        for (int i=0; i<prop->count_enums; i++) {
+            if (prop->enums[i].value < 64) {
+                mRotations |= 1ULL << prop->enums[i].value;
+            }
+        }
+    }
+    drmModeFreeProperty(prop);
+    ALOGV("plane %d rotations:0x%" PRIx64, mPlaneID, mRotations);
+}
+
+bool KmsPlane::checkRotation(uint64_t rotation)
+{
+    if (rotation == DRM_MODE_ROTATE_0) {
+        return true;
+    }
+
+    return rotation_id != 0 && (rotation & ~mRotations) == 0;
+}
+
+void KmsPlane::getFormats(drmModePlanePtr plane)
+{
+    mFormatNum = 0;
+    for (size_t k=0; k<plane->count_formats; k++) {
+        uint32_t nFormat = plane->formats[k];
+        ALOGV("available format: %c%c%c%c", nFormat&0xFF, (nFormat>>8)&0xFF,
+                        (nFormat>>16)&0xFF, (nFormat>>24)&0xFF);
+        if (mFormatNum < KMS_PLANE_FORMAT_NUM) {
+            mFormats[mFormatNum++] = nFormat;
+        }
+    }
+}
+
+void KmsPlane::getModifiers()
+{
+    mModifierNum = 0;
+    uint64_t blobId = 0;
+    KmsDisplay::getPropertyValue(mPlaneID, DRM_MODE_OBJECT_PLANE,
+                     "IN_FORMATS", NULL, &blobId, mDrmFd);
+    if (blobId == 0) {
+        // plane only supports linear formats.
+        return;
+    }
+
+    drmModePropertyBlobPtr blob = drmModeGetPropertyBlob(mDrmFd, blobId);
+    if (blob == NULL) {
+        ALOGE("get IN_FORMATS blob failed");
+        return;
+    }
+
+    struct drm_format_modifier_blob* header =
+            (struct drm_format_modifier_blob*)blob->data;
+    uint32_t* formats = (uint32_t*)((char*)header + header->formats_offset);
+    struct drm_format_modifier* modifiers = (struct drm_format_modifier*)
+            ((char*)header + header->modifiers_offset);
+    for (uint32_t i=0; i<header->count_modifiers; i++) {
+        struct drm_format_modifier* mod = &modifiers[i];
+        if (mod->modifier == DRM_FORMAT_MOD_LINEAR) {
+            continue;
+        }
+
+        // each bit of formats marks one format from offset.
+        for (uint32_t k=0; k<64; k++) {
+            uint32_t index = mod->offset + k;
+            if (!(mod->formats & (1ULL << k)) ||
+                index >= header->count_formats ||
+                mModifierNum >= KMS_PLANE_MODIFIER_NUM) {
+                continue;
+            }
+            mModifierFormats[mModifierNum] = formats[index];
+            mModifiers[mModifierNum] = mod->modifier;
+            mModifierNum++;
+        }
+    }
+    drmModeFreePropertyBlob(blob);
+}
+
+bool KmsPlane::checkFormat(uint32_t format, uint64_t modifier)
+{
+    if (modifier != DRM_FORMAT_MOD_LINEAR) {
+        for (uint32_t i=0; i<mModifierNum; i++) {
+            if (mModifierFormats[i] == format && mModifiers[i] == modifier) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (uint32_t i=0; i<mFormatNum; i++) {
+        if (mFormats[i] == format) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /*
@@ -162,6 +354,8 @@ void KmsDisplay::getKmsProperty()
     struct TableProperty crtcTable[] = {
         {"MODE_ID", &mCrtc.mode_id},
         {"ACTIVE",  &mCrtc.active},
+        {"OUT_FENCE_PTR", &mCrtc.out_fence_ptr},
+        {"CTM", &mCrtc.ctm},
     };
 
     struct TableProperty connectorTable[] = {
@@ -181,6 +375,9 @@ void KmsDisplay::getKmsProperty()
     for (uint32_t i=0; i<mKmsPlaneNum; i++) {
         mKmsPlanes[i].getPropertyIds();
     }
+    if (mCursorPlane.mPlaneID != 0) {
+        mCursorPlane.getPropertyIds();
+    }
 }
 
 /*
@@ -208,11 +405,8 @@ void KmsPlane::connectCrtc(drmModeAtomicReqPtr pset,
      * Specify the surface to display in the plane, and connect the
      * plane to the CRTC.
      */
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             fb_id, fb);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             crtc_id, crtc);
-
+    addProperty(pset, KMS_PROP_FB_ID, fb_id, fb);
+    addProperty(pset, KMS_PROP_CRTC_ID, crtc_id, crtc);
 }
 
 void KmsPlane::setAlpha(drmModeAtomicReqPtr pset,
@@ -221,8 +415,13 @@ void KmsPlane::setAlpha(drmModeAtomicReqPtr pset,
     /*
      * Specify the alpha of source surface to display.
      */
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             alpha_id, alpha);
+    addProperty(pset, KMS_PROP_ALPHA, alpha_id, alpha);
+}
+
+void KmsPlane::setRotation(drmModeAtomicReqPtr pset,
+                    uint64_t rotation)
+{
+    addProperty(pset, KMS_PROP_ROTATION, rotation_id, rotation);
 }
 
 void KmsPlane::setSourceSurface(drmModeAtomicReqPtr pset,
@@ -234,15 +433,10 @@ void KmsPlane::setSourceSurface(drmModeAtomicReqPtr pset,
      * "ViewPortIn").  Note these values are in 16.16 format, so shift
      * up by 16.
      */
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             src_x, x);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             src_y, y);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             src_w, w << 16);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             src_h, h << 16);
-
+    addProperty(pset, KMS_PROP_SRC_X, src_x, x << 16);
+    addProperty(pset, KMS_PROP_SRC_Y, src_y, y << 16);
+    addProperty(pset, KMS_PROP_SRC_W, src_w, w << 16);
+    addProperty(pset, KMS_PROP_SRC_H, src_h, h << 16);
 }
 
 void KmsPlane::setDisplayFrame(drmModeAtomicReqPtr pset,
@@ -253,19 +447,105 @@ void KmsPlane::setDisplayFrame(drmModeAtomicReqPtr pset,
      * Specify the region within the mode where the image should be
      * displayed (i.e., the "ViewPortOut").
      */
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             crtc_x, x);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             crtc_y, y);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             crtc_w, w);
-    drmModeAtomicAddProperty(pset, mPlaneID,
-                             crtc_h, h);
+    addProperty(pset, KMS_PROP_CRTC_X, crtc_x, x);
+    addProperty(pset, KMS_PROP_CRTC_Y, crtc_y, y);
+    addProperty(pset, KMS_PROP_CRTC_W, crtc_w, w);
+    addProperty(pset, KMS_PROP_CRTC_H, crtc_h, h);
+}
+
+void KmsPlane::addProperty(drmModeAtomicReqPtr pset, uint32_t prop,
+                    uint32_t id, uint64_t value)
+{
+    uint32_t bit = 1 << prop;
+    if (pset != NULL && pset == mRequest) {
+        // a value added before is overridden by adding the new one.
+        if (mPendingMask & bit) {
+            if (mPending[prop] == value) {
+                return;
+            }
+        }
+        else if ((mCommittedMask & bit) && mCommitted[prop] == value) {
+            return;
+        }
+        mPending[prop] = value;
+        mPendingMask |= bit;
+    }
+
+    drmModeAtomicAddProperty(pset, mPlaneID, id, value);
+}
+
+void KmsPlane::beginRequest(drmModeAtomicReqPtr request)
+{
+    mRequest = request;
+    mPendingMask = 0;
+}
+
+void KmsPlane::finishRequest(bool committed)
+{
+    // failed commit leaves kernel state as it was.
+    if (committed) {
+        for (uint32_t i=0; i<KMS_PROP_NUM; i++) {
+            if (mPendingMask & (1 << i)) {
+                mCommitted[i] = mPending[i];
+            }
+        }
+        mCommittedMask |= mPendingMask;
+    }
+    mPendingMask = 0;
+}
+
+void KmsPlane::forgetProperty(uint32_t prop)
+{
+    mCommittedMask &= ~(1 << prop);
+}
+
+int KmsDisplay::beginRequestLocked()
+{
+    if (!mPset) {
+        mPset = drmModeAtomicAlloc();
+        if (!mPset) {
+            ALOGE("Failed to allocate property set");
+            return -ENOMEM;
+        }
+    }
+    else {
+        // drop properties of last frame which was not committed.
+        drmModeAtomicSetCursor(mPset, 0);
+    }
+
+    for (uint32_t i=0; i<mKmsPlaneNum; i++) {
+        mKmsPlanes[i].beginRequest(mPset);
+    }
+    mCursorPlane.beginRequest(mPset);
+    mPsetOpen = true;
+
+    return 0;
+}
+
+void KmsDisplay::finishRequestLocked(bool committed)
+{
+    for (uint32_t i=0; i<mKmsPlaneNum; i++) {
+        mKmsPlanes[i].finishRequest(committed);
+    }
+    mCursorPlane.finishRequest(committed);
+    if (mPset != NULL) {
+        drmModeAtomicSetCursor(mPset, 0);
+    }
+    mPsetOpen = false;
+}
+
+void KmsDisplay::resetPlaneStatesLocked()
+{
+    for (uint32_t i=0; i<KMS_PLANE_NUM; i++) {
+        mKmsPlanes[i].mCommittedMask = 0;
+    }
+    mCursorPlane.mCommittedMask = 0;
 }
 
 int KmsDisplay::setPowerMode(int mode)
 {
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
 
     switch (mode) {
         case POWER_ON:
@@ -285,6 +565,8 @@ int KmsDisplay::setPowerMode(int mode)
             break;
     }
 
+    updateWorkloadLocked();
+
     // Audio/Video share same clock on HDMI interface.
     // Power off HDMI will also break HDMI Audio clock.
     // So HDMI need to keep power on.
@@ -309,6 +591,8 @@ void KmsDisplay::enableVsync()
     }
 
     mVsyncThread = new VSyncThread(this);
+    // all displays share one open file, so their events are read here.
+    sFlipEvents = true;
 }
 
 void KmsDisplay::setCallback(EventListener* callback)
@@ -343,254 +627,1239 @@ void KmsDisplay::setFakeVSync(bool enable)
     }
 }
 
-bool KmsDisplay::checkOverlay(Layer* layer)
+void KmsDisplay::prepareOverlay()
 {
-    char value[PROPERTY_VALUE_MAX];
-    property_get("hwc.enable.overlay", value, "1");
-    int useOverlay = atoi(value);
-    if (useOverlay == 0) {
-        return false;
-    }
-
-    if (mKmsPlaneNum < 2) {
-        ALOGV("no overlay plane found");
-        return false;
-    }
+    memset(mOverlays, 0, sizeof(mOverlays));
+    mPlaneLimit = mKmsPlaneNum;
+    mCursorLayer = NULL;
+}
 
-    if (layer == NULL || layer->handle == NULL) {
-        ALOGV("updateOverlay: invalid layer or handle");
+bool KmsDisplay::checkCursor(Layer* layer)
+{
+    if (mCursorPlane.mPlaneID == 0 || mActiveConfig < 0) {
         return false;
     }
 
-    Memory* memory = layer->handle;
-    if ((memory->fslFormat >= FORMAT_RGBA8888) &&
-        (memory->fslFormat <= FORMAT_BGRA8888)) {
-        ALOGV("updateOverlay: invalid format");
+    if (layer == NULL || layer->handle == NULL || layer->transform != 0) {
+        ALOGV("checkCursor: invalid layer or transform");
         return false;
     }
 
-    // overlay only needs on imx8mq.
-    if (!(memory->usage & USAGE_PADDING_BUFFER)) {
+    // cursor plane can't scale.
+    const DisplayConfig& config = mConfigs[mActiveConfig];
+    if (layer->sourceCrop.width() != layer->displayFrame.width() ||
+        layer->sourceCrop.height() != layer->displayFrame.height() ||
+        config.mXres != mMode.hdisplay || config.mYres != mMode.vdisplay) {
+        ALOGV("checkCursor: scaling not supported");
         return false;
     }
 
-    // work around to GPU composite if video < 720x576.
-    if (memory->width <= 720 || memory->height <= 576) {
-        ALOGV("work around to GPU composite");
+    Memory* memory = layer->handle;
+    if ((uint64_t)memory->width > mCursorWidth ||
+        (uint64_t)memory->height > mCursorHeight) {
+        ALOGV("checkCursor: cursor too large");
         return false;
     }
 
-    if (mOverlay != NULL) {
-        ALOGW("only support one overlay now");
+    if (!mCursorPlane.checkFormat(convertFormatToDrm(memory->fslFormat),
+                                  getModifier(memory))) {
+        ALOGV("checkCursor: unsupported format");
         return false;
     }
 
-    mOverlay = layer;
-
+    mCursorLayer = layer;
     return true;
 }
 
-int KmsDisplay::performOverlay()
+int KmsDisplay::updateCursorLocked(Layer* layer)
 {
-    Layer* layer = mOverlay;
-    if (layer == NULL || layer->handle == NULL) {
+    if (layer != mCursorPlaneLayer || mPowerMode != POWER_ON ||
+        mDrmFd < 0) {
+        // it's shown at new position by next commit.
         return 0;
     }
 
-    if (!mPset) {
-        mPset = drmModeAtomicAlloc();
-        if (!mPset) {
-            ALOGE("Failed to allocate property set");
-            return -ENOMEM;
-        }
+    // legacy cursor move is applied asynchronously without
+    // waiting the pending commit.
+    Rect& rect = layer->displayFrame;
+    int ret = drmModeMoveCursor(mDrmFd, mCrtcID, rect.left, rect.top);
+    if (ret != 0) {
+        ALOGV("move cursor failed ret=%d", ret);
     }
 
-    Memory* buffer = layer->handle;
-    const DisplayConfig& config = mConfigs[mActiveConfig];
-    if (buffer->fbId == 0) {
-        int format = convertFormatToDrm(buffer->fslFormat);
-        int stride = buffer->stride * 1;
-        uint32_t bo_handles[4] = {0};
-        uint32_t pitches[4] = {0};
-        uint32_t offsets[4] = {0};
-
-        pitches[0] = stride;
-        pitches[1] = stride;
-        offsets[0] = 0;
-        offsets[1] = stride * buffer->height;
-        drmPrimeFDToHandle(mDrmFd, buffer->fd, (uint32_t*)&buffer->fbHandle);
-        bo_handles[0] = buffer->fbHandle;
-        bo_handles[1] = buffer->fbHandle;
-        drmModeAddFB2(mDrmFd, buffer->width, buffer->height, format,
-                    bo_handles, pitches, offsets, (uint32_t*)&buffer->fbId, 0);
-        buffer->kmsFd = mDrmFd;
-    }
-
-    if (buffer->fbId == 0) {
-        ALOGE("%s invalid fbid", __func__);
-        mOverlay = NULL;
-        return 0;
-    }
+    return 0;
+}
 
-    mKmsPlanes[mKmsPlaneNum - 1].connectCrtc(mPset, mCrtcID, buffer->fbId);
+uint64_t KmsDisplay::convertTransformToDrm(int transform)
+{
+    switch (transform) {
+        case 0:
+            return DRM_MODE_ROTATE_0;
+        case TRANSFORM_FLIPH:
+            return DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_X;
+        case TRANSFORM_FLIPV:
+            return DRM_MODE_ROTATE_0 | DRM_MODE_REFLECT_Y;
+        case TRANSFORM_ROT180:
+            return DRM_MODE_ROTATE_180;
+        // layer transform is clockwise, drm rotation is counter clockwise.
+        case TRANSFORM_ROT90:
+            return DRM_MODE_ROTATE_270;
+        case TRANSFORM_ROT270:
+            return DRM_MODE_ROTATE_90;
+        default:
+            return 0;
+    }
+}
 
-    Rect *rect = &layer->sourceCrop;
-    mKmsPlanes[mKmsPlaneNum - 1].setSourceSurface(mPset, rect->left, rect->top,
-                    rect->right - rect->left, rect->bottom - rect->top);
+bool KmsDisplay::checkPlaneScale(Layer* layer)
+{
+    int sw = layer->sourceCrop.width();
+    int sh = layer->sourceCrop.height();
+    int dw = layer->displayFrame.width();
+    int dh = layer->displayFrame.height();
+    // source is scaled after it's rotated.
+    if (layer->transform & TRANSFORM_ROT90) {
+        int tmp = sw;
+        sw = sh;
+        sh = tmp;
+    }
+    if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) {
+        return false;
+    }
 
-    rect = &layer->displayFrame;
-    int x = rect->left * mMode.hdisplay / config.mXres;
-    int y = rect->top * mMode.vdisplay / config.mYres;
-    int w = (rect->right - rect->left) * mMode.hdisplay / config.mXres;
-    int h = (rect->bottom - rect->top) * mMode.hdisplay / config.mXres;
-    mKmsPlanes[mKmsPlaneNum - 1].setDisplayFrame(mPset, x, y, w, h);
+    if (dw > sw * KMS_PLANE_MAX_UPSCALE || dh > sh * KMS_PLANE_MAX_UPSCALE) {
+        return false;
+    }
 
-    mOverlay = NULL;
+    if (sw > dw * KMS_PLANE_MAX_DOWNSCALE || sh > dh * KMS_PLANE_MAX_DOWNSCALE) {
+        return false;
+    }
 
     return true;
 }
 
-int KmsDisplay::updateScreen()
+bool KmsDisplay::checkOverlay(Layer* layer)
 {
-    int drmfd = -1;
-    Memory* buffer = NULL;
-    {
-        Mutex::Autolock _l(mLock);
-
-        if (!mConnected) {
-            ALOGE("updateScreen display plugout");
-            return -EINVAL;
-        }
+    if (!mTunables.mEnableOverlay) {
+        return false;
+    }
 
-        if (mPowerMode != POWER_ON) {
-            ALOGE("can't update screen power mode:%d", mPowerMode);
-            return -EINVAL;
-        }
-        buffer = mRenderTarget;
-        drmfd = mDrmFd;
+    if (mPlaneLimit < 2) {
+        ALOGV("no free overlay plane");
+        return false;
     }
 
-    if (drmfd < 0) {
-        ALOGE("%s invalid drmfd", __func__);
-        return -EINVAL;
+    if (layer == NULL || layer->handle == NULL) {
+        ALOGV("checkOverlay: invalid layer or handle");
+        return false;
     }
 
-    if (!buffer || !(buffer->flags & FLAGS_FRAMEBUFFER)) {
-        ALOGE("%s buffer is invalid", __func__);
-        return -EINVAL;
+    if (layer->type != LAYER_TYPE_DEVICE &&
+        layer->type != LAYER_TYPE_SIDEBAND) {
+        ALOGV("checkOverlay: unsupported type");
+        return false;
     }
 
-    const DisplayConfig& config = mConfigs[mActiveConfig];
-    if (buffer->fbId == 0) {
-        int format = convertFormatToDrm(config.mFormat);
-        int stride = buffer->stride * config.mBytespixel;
-        uint32_t bo_handles[4] = {0};
-        uint32_t pitches[4] = {0};
-        uint32_t offsets[4] = {0};
-
-        pitches[0] = stride;
-        drmPrimeFDToHandle(mDrmFd, buffer->fd, (uint32_t*)&buffer->fbHandle);
-        bo_handles[0] = buffer->fbHandle;
-        drmModeAddFB2(mDrmFd, buffer->width, buffer->height, format,
-                    bo_handles, pitches, offsets, (uint32_t*)&buffer->fbId, 0);
-        buffer->kmsFd = mDrmFd;
-    }
-
-    if (buffer->fbId == 0) {
-        ALOGE("%s invalid fbid", __func__);
-        return 0;
+    uint64_t rotation = convertTransformToDrm(layer->transform);
+    if (rotation == 0) {
+        ALOGV("checkOverlay: unsupported transform:%d", layer->transform);
+        return false;
     }
 
-    if (!mPset) {
-        mPset = drmModeAtomicAlloc();
-        if (!mPset) {
-            ALOGE("Failed to allocate property set");
-            return -ENOMEM;
-        }
+    Memory* memory = layer->handle;
+    bool alphaFormat = (memory->fslFormat == FORMAT_RGBA8888) ||
+                       (memory->fslFormat == FORMAT_BGRA8888);
+    if (alphaFormat && layer->blendMode == BLENDING_COVERAGE) {
+        ALOGV("checkOverlay: coverage blending not supported");
+        return false;
     }
 
-    uint32_t modeID = 0;
-    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK;
-    if (mModeset) {
-        flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
-        drmModeCreatePropertyBlob(drmfd, &mMode, sizeof(mMode), &modeID);
+    if (!checkPlaneScale(layer)) {
+        ALOGV("checkOverlay: scaling out of range");
+        return false;
     }
 
-    bindCrtc(mPset, modeID);
-    mKmsPlanes[0].connectCrtc(mPset, mCrtcID, buffer->fbId);
-    mKmsPlanes[0].setSourceSurface(mPset, 0, 0, config.mXres, config.mYres);
-    mKmsPlanes[0].setDisplayFrame(mPset, 0, 0, mMode.hdisplay, mMode.vdisplay);
+    // allocate plane from top to bottom to keep layer z-order.
+    uint32_t format = convertFormatToDrm(memory->fslFormat);
+    uint64_t modifier = getModifier(memory);
+    for (uint32_t i=mPlaneLimit-1; i>0; i--) {
+        KmsPlane* plane = &mKmsPlanes[i];
+        if (!plane->checkFormat(format, modifier)) {
+            continue;
+        }
 
-    for (uint32_t i=0; i<3; i++) {
-        int ret = drmModeAtomicCommit(drmfd, mPset, flags, NULL);
-        if (ret == -EBUSY) {
-            ALOGV("commit pset busy and try again");
-            usleep(1000);
+        if (layer->planeAlpha != 0xff && plane->alpha_id == 0) {
             continue;
         }
-        else if (ret != 0) {
-            ALOGI("Failed to commit pset ret=%d", ret);
+
+        if (!plane->checkRotation(rotation)) {
+            continue;
         }
-        break;
-    }
 
-    drmModeAtomicFree(mPset);
-    mPset = NULL;
-    if (mModeset) {
-        mModeset = false;
-        drmModeDestroyPropertyBlob(drmfd, modeID);
+        mOverlays[i] = layer;
+        mPlaneLimit = i;
+        return true;
     }
 
-    return 0;
+    ALOGV("checkOverlay: no matched plane");
+    return false;
 }
 
-int KmsDisplay::openKms(drmModeResPtr pModeRes)
+bool KmsDisplay::checkPlaneTransform(Layer* layer)
 {
-    Mutex::Autolock _l(mLock);
-
-    if (mDrmFd < 0 || mConnectorID == 0) {
-        ALOGE("%s invalid drmfd or connector id", __func__);
-        return -ENODEV;
+    if (!mTunables.mEnableOverlay || layer == NULL) {
+        return false;
     }
 
-    int ret = drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
-    if (ret) {
-        ALOGE("failed to set universal plane cap %d", ret);
-        return ret;
+    uint64_t rotation = convertTransformToDrm(layer->transform);
+    if (rotation == 0) {
+        return false;
     }
 
-    ret = drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_ATOMIC, 1);
-    if (ret) {
-        ALOGE("failed to set atomic cap %d", ret);
-        return ret;
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        if (mKmsPlanes[i].checkRotation(rotation)) {
+            return true;
+        }
     }
 
-    drmModeConnectorPtr pConnector = drmModeGetConnector(mDrmFd, mConnectorID);
-    if (pConnector == NULL) {
-        ALOGE("%s drmModeGetConnector failed for "
-              "connector index %d", __func__, mConnectorID);
-        return -ENODEV;
+    return false;
+}
+
+void KmsDisplay::releaseFbEntry(KmsFbEntry* entry)
+{
+    if (entry->fbId != 0) {
+        drmModeRmFB(mDrmFd, entry->fbId);
+    }
+    if (entry->fbHandle != 0) {
+        struct drm_gem_close gem_close;
+        memset(&gem_close, 0, sizeof(gem_close));
+        gem_close.handle = entry->fbHandle;
+        drmIoctl(mDrmFd, DRM_IOCTL_GEM_CLOSE, &gem_close);
     }
+    if (entry->fd >= 0) {
+        close(entry->fd);
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = -1;
+}
 
-    drmModeEncoderPtr pEncoder =
-        drmModeGetEncoder(mDrmFd, pConnector->encoders[0]);
+void KmsDisplay::clearFbCache()
+{
+    Mutex::Autolock _l(mFbLock);
+    for (int i=0; i<KMS_FB_CACHE_SIZE; i++) {
+        if (mFbCache[i].fbId != 0) {
+            releaseFbEntry(&mFbCache[i]);
+        }
+    }
+}
 
-    if (pEncoder == NULL) {
-        ALOGE("drmModeGetEncoder failed for"
-              "encoder 0x%08x", pConnector->encoders[0]);
-        return -ENODEV;
+void KmsDisplay::onMemoryRelease(Memory* handle)
+{
+    struct stat st;
+    if (handle->fd < 0 || fstat(handle->fd, &st) != 0) {
+        return;
     }
 
-    int index = findBestMatch(pConnector);
-    mMode = pConnector->modes[index];
-    for (int i = 0; i < pModeRes->count_crtcs; i++) {
-        if ((pEncoder->possible_crtcs & (1 << i)) == 0) {
-            continue;
+    Mutex::Autolock _l(mFbLock);
+    for (int i=0; i<KMS_FB_CACHE_SIZE; i++) {
+        KmsFbEntry* entry = &mFbCache[i];
+        if (entry->fbId != 0 && entry->dev == st.st_dev &&
+            entry->ino == st.st_ino) {
+            releaseFbEntry(entry);
         }
-
-        mCrtcID = pModeRes->crtcs[i];
-        mCrtcIndex = i;
-        break;
+    }
+}
+
+uint64_t KmsDisplay::getModifier(Memory* buffer)
+{
+    enum g2d_tiling tile = G2D_LINEAR;
+    if (mComposer.getTiling(buffer, &tile) != 0) {
+        return DRM_FORMAT_MOD_LINEAR;
+    }
+
+    switch (tile) {
+        case G2D_TILED:
+            return DRM_FORMAT_MOD_VIVANTE_TILED;
+        case G2D_SUPERTILED:
+            return DRM_FORMAT_MOD_VIVANTE_SUPER_TILED;
+        default:
+            return DRM_FORMAT_MOD_LINEAR;
+    }
+}
+
+int KmsDisplay::getFbId(Memory* buffer, int format, uint64_t modifier,
+                        uint32_t* fbId)
+{
+    struct stat st;
+    if (buffer->fd < 0 || fstat(buffer->fd, &st) != 0) {
+        ALOGE("%s invalid buffer fd", __func__);
+        return -EINVAL;
+    }
+
+    Mutex::Autolock _l(mFbLock);
+    KmsFbEntry* victim = NULL;
+    for (int i=0; i<KMS_FB_CACHE_SIZE; i++) {
+        KmsFbEntry* entry = &mFbCache[i];
+        if (entry->fbId != 0 && entry->dev == st.st_dev &&
+            entry->ino == st.st_ino && entry->format == format &&
+            entry->modifier == modifier) {
+            entry->serial = mFbSerial;
+            *fbId = entry->fbId;
+            return 0;
+        }
+
+        // pick free entry, or least recently used one.
+        if (victim == NULL || (victim->fbId != 0 &&
+            (entry->fbId == 0 || entry->serial < victim->serial))) {
+            victim = entry;
+        }
+    }
+
+    if (victim->fbId != 0) {
+        if (victim->serial + 2 > mFbSerial) {
+            ALOGE("%s all cached framebuffers are on screen", __func__);
+            return -ENOSPC;
+        }
+        releaseFbEntry(victim);
+    }
+
+    uint32_t drmFormat = convertFormatToDrm(format);
+    uint32_t bo_handles[4] = {0};
+    uint32_t pitches[4] = {0};
+    uint32_t offsets[4] = {0};
+    uint32_t handle = 0;
+
+    if (drmPrimeFDToHandle(mDrmFd, buffer->fd, &handle) != 0) {
+        ALOGE("%s import buffer failed", __func__);
+        return -EINVAL;
+    }
+
+    bo_handles[0] = handle;
+    switch (format) {
+        case FORMAT_NV12:
+        case FORMAT_NV21:
+        case FORMAT_NV16:
+            pitches[0] = buffer->stride;
+            pitches[1] = buffer->stride;
+            offsets[1] = buffer->stride * buffer->height;
+            bo_handles[1] = handle;
+            break;
+        case FORMAT_YUYV:
+        case FORMAT_RGB565:
+            pitches[0] = buffer->stride * 2;
+            break;
+        case FORMAT_RGB888:
+            pitches[0] = buffer->stride * 3;
+            break;
+        default:
+            pitches[0] = buffer->stride * 4;
+            break;
+    }
+
+    victim->fbHandle = handle;
+    victim->fd = dup(buffer->fd);
+    if (modifier != DRM_FORMAT_MOD_LINEAR) {
+        uint64_t modifiers[4] = {0};
+        for (int i=0; i<4; i++) {
+            modifiers[i] = (bo_handles[i] != 0) ? modifier : 0;
+        }
+        drmModeAddFB2WithModifiers(mDrmFd, buffer->width, buffer->height,
+                drmFormat, bo_handles, pitches, offsets, modifiers,
+                &victim->fbId, DRM_MODE_FB_MODIFIERS);
+    }
+    else {
+        drmModeAddFB2(mDrmFd, buffer->width, buffer->height, drmFormat,
+                bo_handles, pitches, offsets, &victim->fbId, 0);
+    }
+    if (victim->fbId == 0) {
+        ALOGE("%s add framebuffer failed", __func__);
+        releaseFbEntry(victim);
+        return -EINVAL;
+    }
+
+    victim->dev = st.st_dev;
+    victim->ino = st.st_ino;
+    victim->format = format;
+    victim->modifier = modifier;
+    victim->serial = mFbSerial;
+    *fbId = victim->fbId;
+
+    return 0;
+}
+
+void KmsDisplay::setOverlayPlanesLocked(drmModeAtomicReqPtr pset)
+{
+    const DisplayConfig& config = mConfigs[mActiveConfig];
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        KmsPlane* plane = &mKmsPlanes[i];
+        Layer* layer = mOverlays[i];
+        if (layer == NULL) {
+            // disconnect plane not used in this frame.
+            if (mPlaneLayers[i] != NULL) {
+                plane->connectCrtc(pset, 0, 0);
+            }
+            continue;
+        }
+
+        plane->connectCrtc(pset, mCrtcID, mOverlayFbs[i]);
+
+        Rect *rect = &layer->sourceCrop;
+        plane->setSourceSurface(pset, rect->left, rect->top,
+                        rect->right - rect->left, rect->bottom - rect->top);
+
+        rect = &layer->displayFrame;
+        int x = rect->left * mMode.hdisplay / config.mXres;
+        int y = rect->top * mMode.vdisplay / config.mYres;
+        int w = (rect->right - rect->left) * mMode.hdisplay / config.mXres;
+        int h = (rect->bottom - rect->top) * mMode.vdisplay / config.mYres;
+        plane->setDisplayFrame(pset, x, y, w, h);
+
+        if (plane->alpha_id != 0) {
+            plane->setAlpha(pset, layer->planeAlpha);
+        }
+        if (plane->rotation_id != 0) {
+            plane->setRotation(pset, convertTransformToDrm(layer->transform));
+        }
+    }
+}
+
+void KmsDisplay::setCursorPlaneLocked(drmModeAtomicReqPtr pset)
+{
+    Layer* layer = mCursorLayer;
+    if (layer == NULL) {
+        if (mCursorPlaneLayer != NULL) {
+            mCursorPlane.connectCrtc(pset, 0, 0);
+        }
+        return;
+    }
+
+    mCursorPlane.connectCrtc(pset, mCrtcID, mCursorFb);
+    Rect *rect = &layer->sourceCrop;
+    mCursorPlane.setSourceSurface(pset, rect->left, rect->top,
+                    rect->right - rect->left, rect->bottom - rect->top);
+    rect = &layer->displayFrame;
+    mCursorPlane.setDisplayFrame(pset, rect->left, rect->top,
+                    rect->right - rect->left, rect->bottom - rect->top);
+}
+
+uint32_t KmsDisplay::setSidebandPlanesLocked(drmModeAtomicReqPtr pset,
+                                             bool force)
+{
+    uint32_t planes = 0;
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        Layer* layer = mPlaneLayers[i];
+        if (layer == NULL || !layer->busy || layer->sideband == NULL ||
+            layer->type != LAYER_TYPE_SIDEBAND) {
+            continue;
+        }
+
+        SidebandStream* stream = layer->sideband;
+        if (!force && !stream->hasNewFrame()) {
+            continue;
+        }
+
+        Memory* memory = stream->latchFrame();
+        uint32_t fbId = 0;
+        if (memory == NULL || getFbId(memory, memory->fslFormat,
+                                      getModifier(memory), &fbId) != 0) {
+            ALOGV("%s invalid sideband frame", __func__);
+            continue;
+        }
+
+        layer->handle = memory;
+        mKmsPlanes[i].connectCrtc(pset, mCrtcID, fbId);
+        planes |= 1 << i;
+    }
+
+    return planes;
+}
+
+void KmsDisplay::onSidebandCommitLocked(uint32_t planes)
+{
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        Layer* layer = mPlaneLayers[i];
+        if ((planes & (1 << i)) && layer != NULL && layer->sideband != NULL) {
+            layer->sideband->onCommit();
+        }
+    }
+}
+
+void KmsDisplay::handleSidebandEvents(int wakeFd)
+{
+    struct pollfd fds[KMS_PLANE_NUM + 1];
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = wakeFd;
+    fds[0].events = POLLIN;
+    int num = 1;
+    {
+        Mutex::Autolock _l(mLock);
+        for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+            Layer* layer = mPlaneLayers[i];
+            if (layer != NULL && layer->sideband != NULL) {
+                fds[num].fd = layer->sideband->eventFd();
+                fds[num].events = POLLIN;
+                num++;
+            }
+        }
+    }
+
+    if (poll(fds, num, KMS_EVENT_TIMEOUT) <= 0) {
+        return;
+    }
+
+    if (fds[0].revents & POLLIN) {
+        uint64_t count = 0;
+        read(wakeFd, &count, sizeof(count));
+    }
+
+    bool queued = false;
+    for (int i=1; i<num; i++) {
+        if (fds[i].revents & POLLIN) {
+            queued = true;
+        }
+    }
+    if (!queued) {
+        return;
+    }
+
+    // frame commits are held off, flip of last commit is waited outside
+    // of mLock so that validate isn't blocked.
+    Mutex::Autolock _s(mSidebandLock);
+    if (sFlipEvents) {
+        waitFlipDone();
+    }
+
+    Mutex::Autolock _l(mLock);
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        Layer* layer = mPlaneLayers[i];
+        if (layer != NULL && layer->sideband != NULL) {
+            layer->sideband->clearEvents();
+        }
+    }
+
+    if (mPowerMode != POWER_ON || mModeset || mActiveConfig < 0 ||
+        mDrmFd < 0) {
+        return;
+    }
+
+    drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
+    if (pset == NULL) {
+        ALOGE("Failed to allocate property set");
+        return;
+    }
+
+    uint32_t planes = setSidebandPlanesLocked(pset, false);
+    if (planes == 0) {
+        drmModeAtomicFree(pset);
+        return;
+    }
+
+    ATRACE_NAME("sideband commit");
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK;
+    if (sFlipEvents) {
+        flags |= DRM_MODE_PAGE_FLIP_EVENT;
+        Mutex::Autolock _f(mFlipLock);
+        mFlipPending = true;
+        ATRACE_INT("KMS flip pending", 1);
+    }
+
+    int ret = drmModeAtomicCommit(mDrmFd, pset, flags, this);
+    drmModeAtomicFree(pset);
+    if (ret == 0) {
+        // frame request diffs against framebuffers of this commit.
+        for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+            if (planes & (1 << i)) {
+                mKmsPlanes[i].forgetProperty(KMS_PROP_FB_ID);
+            }
+        }
+        onSidebandCommitLocked(planes);
+        Mutex::Autolock _f(mFbLock);
+        mFbSerial++;
+    }
+    else {
+        // next queued frame tries again.
+        ALOGV("sideband commit failed ret=%d", ret);
+        if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
+            Mutex::Autolock _f(mFlipLock);
+            mFlipPending = false;
+            ATRACE_INT("KMS flip pending", 0);
+        }
+    }
+}
+
+Layer* KmsDisplay::testOverlay()
+{
+    if (mCursorLayer != NULL) {
+        Memory* memory = mCursorLayer->handle;
+        if (getFbId(memory, memory->fslFormat, getModifier(memory),
+                    &mCursorFb) != 0) {
+            ALOGV("testOverlay: invalid cursor fbid");
+            Layer* layer = mCursorLayer;
+            mCursorLayer = NULL;
+            return layer;
+        }
+    }
+
+    // the lowest assigned plane is taken off first to keep z-order.
+    uint32_t lowest = 0;
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        Layer* layer = mOverlays[i];
+        if (layer == NULL) {
+            continue;
+        }
+
+        if (getFbId(layer->handle, layer->handle->fslFormat,
+                    getModifier(layer->handle), &mOverlayFbs[i]) != 0) {
+            ALOGV("testOverlay: invalid fbid");
+            mOverlays[i] = NULL;
+            return layer;
+        }
+
+        if (lowest == 0) {
+            lowest = i;
+        }
+    }
+
+    if (lowest == 0 && mCursorLayer == NULL) {
+        return NULL;
+    }
+
+    // crtc is not active before modeset, so overlay can't be tested.
+    int ret = -EINVAL;
+    if (!mModeset && mActiveConfig >= 0) {
+        drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
+        if (pset == NULL) {
+            ALOGE("Failed to allocate property set");
+            ret = -ENOMEM;
+        }
+        else {
+            setOverlayPlanesLocked(pset);
+            setCursorPlaneLocked(pset);
+            ret = drmModeAtomicCommit(mDrmFd, pset,
+                            DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+            drmModeAtomicFree(pset);
+        }
+    }
+
+    if (ret == 0) {
+        return NULL;
+    }
+
+    ALOGV("testOverlay: plane %d test failed ret=%d", lowest, ret);
+    Layer* layer = NULL;
+    if (lowest != 0) {
+        layer = mOverlays[lowest];
+        mOverlays[lowest] = NULL;
+    }
+    else {
+        layer = mCursorLayer;
+        mCursorLayer = NULL;
+    }
+
+    return layer;
+}
+
+int KmsDisplay::performOverlay()
+{
+    int ret = beginRequestLocked();
+    if (ret != 0) {
+        return ret;
+    }
+
+    setOverlayPlanesLocked(mPset);
+    setCursorPlaneLocked(mPset);
+    // buffers on planes in last and this frame are released by this commit.
+    mFenceLayerNum = 0;
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        if (mPlaneLayers[i] != NULL) {
+            mFenceLayers[mFenceLayerNum++] = mPlaneLayers[i];
+        }
+        if (mOverlays[i] != NULL && mOverlays[i] != mPlaneLayers[i]) {
+            mFenceLayers[mFenceLayerNum++] = mOverlays[i];
+        }
+        mPlaneLayers[i] = mOverlays[i];
+        mOverlays[i] = NULL;
+        if (mPlaneLayers[i] != NULL && mPlaneLayers[i]->sideband != NULL &&
+            mSidebandThread == NULL) {
+            mSidebandThread = new SidebandThread(this);
+        }
+    }
+    if (mCursorPlaneLayer != NULL) {
+        mFenceLayers[mFenceLayerNum++] = mCursorPlaneLayer;
+    }
+    if (mCursorLayer != NULL && mCursorLayer != mCursorPlaneLayer) {
+        mFenceLayers[mFenceLayerNum++] = mCursorLayer;
+    }
+    mCursorPlaneLayer = mCursorLayer;
+    mCursorLayer = NULL;
+
+    // let kms wait acquire fences instead of blocking composition.
+    closePlaneFencesLocked();
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        Layer* layer = mPlaneLayers[i];
+        KmsPlane* plane = &mKmsPlanes[i];
+        if (layer == NULL || layer->acquireFence == -1 ||
+            plane->in_fence_fd == 0) {
+            continue;
+        }
+
+        drmModeAtomicAddProperty(mPset, plane->mPlaneID,
+                                 plane->in_fence_fd, layer->acquireFence);
+        mPlaneFences[i] = layer->acquireFence;
+        layer->acquireFence = -1;
+    }
+
+    Layer* cursor = mCursorPlaneLayer;
+    if (cursor != NULL && cursor->acquireFence != -1 &&
+        mCursorPlane.in_fence_fd != 0) {
+        drmModeAtomicAddProperty(mPset, mCursorPlane.mPlaneID,
+                                 mCursorPlane.in_fence_fd, cursor->acquireFence);
+        mCursorFence = cursor->acquireFence;
+        cursor->acquireFence = -1;
+    }
+
+    return 0;
+}
+
+bool KmsDisplay::enterIdleLocked()
+{
+    if (mPowerMode != POWER_ON || mModeset || mNoSeamless ||
+        mRenderTarget == NULL || mActiveConfig < 0) {
+        return false;
+    }
+
+    // only last frame on primary plane can be committed again.
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        if (mPlaneLayers[i] != NULL) {
+            return false;
+        }
+    }
+    if (mCursorPlaneLayer != NULL) {
+        return false;
+    }
+
+    // lowest refresh rate at the same size.
+    const DisplayConfig& active = mConfigs[mActiveConfig];
+    int idle = -1;
+    nsecs_t period = active.mVsyncPeriod;
+    for (size_t i=0; i<mConfigs.size() && i<KMS_CONFIG_NUM; i++) {
+        const DisplayConfig& config = mConfigs[i];
+        if (config.mXres == active.mXres && config.mYres == active.mYres &&
+            config.mVsyncPeriod > period) {
+            period = config.mVsyncPeriod;
+            idle = i;
+        }
+    }
+    if (idle < 0) {
+        return false;
+    }
+
+    mIdleConfig = idle;
+    mModeset = true;
+    mSeamless = true;
+    return true;
+}
+
+void KmsDisplay::exitIdleLocked()
+{
+    if (mIdleConfig < 0) {
+        return;
+    }
+
+    mIdleConfig = -1;
+    mModeset = true;
+    mSeamless = true;
+}
+
+void KmsDisplay::setContentPeriodLocked(nsecs_t period)
+{
+    int content = -1;
+    if (period > 0 && mPowerMode == POWER_ON && !mNoSeamless &&
+        mActiveConfig >= 0) {
+        // highest refresh up to active one which shows each frame
+        // for the same number of vblanks.
+        const DisplayConfig& active = mConfigs[mActiveConfig];
+        nsecs_t best = 0;
+        for (size_t i=0; i<mConfigs.size() && i<KMS_CONFIG_NUM; i++) {
+            const DisplayConfig& config = mConfigs[i];
+            nsecs_t vsync = config.mVsyncPeriod;
+            if (config.mXres != active.mXres ||
+                config.mYres != active.mYres ||
+                vsync < active.mVsyncPeriod || vsync <= 0) {
+                continue;
+            }
+
+            nsecs_t frames = (period + vsync / 2) / vsync;
+            nsecs_t error = period - frames * vsync;
+            if (frames < 1 || error * 50 > period || -error * 50 > period) {
+                continue;
+            }
+            if (best == 0 || vsync < best) {
+                best = vsync;
+                content = i;
+            }
+        }
+    }
+
+    // active config already matches content.
+    if (content == mActiveConfig) {
+        content = -1;
+    }
+    if (content == mContentConfig) {
+        return;
+    }
+
+    ALOGV("content period %" PRId64 " takes config %d", period, content);
+    mContentConfig = content;
+    mModeset = true;
+    mSeamless = true;
+}
+
+nsecs_t KmsDisplay::getRefreshPeriodLocked()
+{
+    int config = (mIdleConfig >= 0) ? mIdleConfig :
+                 (mContentConfig >= 0) ? mContentConfig : mActiveConfig;
+    if (config < 0) {
+        return 0;
+    }
+
+    return mConfigs[config].mVsyncPeriod;
+}
+
+bool KmsDisplay::canPresentAsyncLocked()
+{
+    // release fences of overlay layers come from commit.
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        if (mOverlays[i] != NULL || mPlaneLayers[i] != NULL) {
+            return false;
+        }
+    }
+    if (mCursorLayer != NULL || mCursorPlaneLayer != NULL) {
+        return false;
+    }
+
+    return Display::canPresentAsyncLocked();
+}
+
+void KmsDisplay::closePlaneFencesLocked()
+{
+    for (uint32_t i=0; i<KMS_PLANE_NUM; i++) {
+        if (mPlaneFences[i] != -1) {
+            close(mPlaneFences[i]);
+            mPlaneFences[i] = -1;
+        }
+    }
+    if (mCursorFence != -1) {
+        close(mCursorFence);
+        mCursorFence = -1;
+    }
+}
+
+void KmsDisplay::setReleaseFencesLocked(int fence)
+{
+    for (uint32_t i=0; i<mFenceLayerNum; i++) {
+        Layer* layer = mFenceLayers[i];
+        if (!layer->busy) {
+            continue;
+        }
+
+        if (layer->releaseFence != -1) {
+            close(layer->releaseFence);
+        }
+        layer->releaseFence = (fence != -1) ? dup(fence) : -1;
+    }
+    mFenceLayerNum = 0;
+}
+
+int KmsDisplay::updateScreen()
+{
+    ATRACE_CALL();
+    int drmfd = -1;
+    Memory* buffer = NULL;
+    int srcWidth = 0, srcHeight = 0;
+    {
+        Mutex::Autolock _l(mLock);
+
+        if (!mConnected) {
+            ALOGE("updateScreen display plugout");
+            return -EINVAL;
+        }
+
+        if (mPowerMode != POWER_ON) {
+            ALOGE("can't update screen power mode:%d", mPowerMode);
+            return -EINVAL;
+        }
+        buffer = mRenderTarget;
+        drmfd = mDrmFd;
+        // 2D target composed at reduced size is scaled up by plane.
+        for (int i=0; i<MAX_FRAMEBUFFERS; i++) {
+            if (buffer != NULL && buffer == mTargets[i] &&
+                mTargetWidths[i] > 0) {
+                srcWidth = mTargetWidths[i];
+                srcHeight = mTargetHeights[i];
+            }
+        }
+    }
+
+    if (drmfd < 0) {
+        ALOGE("%s invalid drmfd", __func__);
+        return -EINVAL;
+    }
+
+    if (!buffer || !(buffer->flags & FLAGS_FRAMEBUFFER)) {
+        ALOGE("%s buffer is invalid", __func__);
+        return -EINVAL;
+    }
+
+    const DisplayConfig& config = mConfigs[mActiveConfig];
+    if (srcWidth == 0) {
+        srcWidth = config.mXres;
+        srcHeight = config.mYres;
+    }
+    uint32_t fbId = 0;
+    uint64_t modifier = getModifier(buffer);
+    if (!mKmsPlanes[0].checkFormat(convertFormatToDrm(config.mFormat),
+                                   modifier)) {
+        // keep scanout of client target as before.
+        modifier = DRM_FORMAT_MOD_LINEAR;
+    }
+    if (getFbId(buffer, config.mFormat, modifier, &fbId) != 0) {
+        ALOGE("%s invalid fbid", __func__);
+        return 0;
+    }
+
+    {
+        // frame without performOverlay, e.g. idle refresh switch.
+        Mutex::Autolock _l(mLock);
+        if (!mPsetOpen && beginRequestLocked() != 0) {
+            return -ENOMEM;
+        }
+    }
+
+    int modeConfig = (mIdleConfig >= 0) ? mIdleConfig :
+                     (mContentConfig >= 0) ? mContentConfig : mActiveConfig;
+    uint32_t modeID = mModeBlobs[modeConfig];
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK;
+    if (mModeset) {
+        flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    bindCrtc(mPset, modeID);
+    if (mCrtc.ctm != 0 && (mCtmChanged || mModeset)) {
+        drmModeAtomicAddProperty(mPset, mCrtcID, mCrtc.ctm, mCtmBlob);
+    }
+    mKmsPlanes[0].connectCrtc(mPset, mCrtcID, fbId);
+    mKmsPlanes[0].setSourceSurface(mPset, 0, 0, srcWidth, srcHeight);
+    mKmsPlanes[0].setDisplayFrame(mPset, 0, 0, mMode.hdisplay, mMode.vdisplay);
+
+    // sideband frames queued since validate replace the ones latched there,
+    // no sideband commit may run until this frame is committed.
+    Mutex::Autolock _s(mSidebandLock);
+    uint32_t sideband = 0;
+    {
+        Mutex::Autolock _l(mLock);
+        sideband = setSidebandPlanesLocked(mPset, true);
+    }
+
+    bool earlyView = false;
+    {
+        Mutex::Autolock _l(mLock);
+        if (holdEarlyViewLocked()) {
+            // frame is dropped, rear view is still on screen.
+            finishRequestLocked(false);
+            closePlaneFencesLocked();
+            setReleaseFencesLocked(-1);
+            return 0;
+        }
+        earlyView = mEarlyView >= 0;
+    }
+
+    // driver may change refresh rate without modeset, keep panel on.
+    if (mModeset && mSeamless) {
+        if (drmModeAtomicCommit(drmfd, mPset,
+                DRM_MODE_ATOMIC_TEST_ONLY, NULL) == 0) {
+            ALOGV("switch refresh rate without modeset");
+            flags = DRM_MODE_ATOMIC_NONBLOCK;
+        }
+        else if (mIdleConfig >= 0) {
+            // blanking panel for idle costs more than it saves.
+            ALOGI("idle refresh rate needs modeset, disabled");
+            mNoSeamless = true;
+            mIdleConfig = -1;
+            mModeset = false;
+            mSeamless = false;
+            Mutex::Autolock _l(mLock);
+            finishRequestLocked(false);
+            return 0;
+        }
+        else if (mContentConfig >= 0) {
+            // frame goes out at active refresh, mode stays as it is.
+            ALOGI("content refresh rate needs modeset, disabled");
+            mNoSeamless = true;
+            mContentConfig = -1;
+            bindCrtc(mPset, mModeBlobs[mActiveConfig]);
+        }
+    }
+
+    // writeback connector is bound with full modeset, panel blanks anyway.
+    bool bindWriteback = false;
+    if ((flags & DRM_MODE_ATOMIC_ALLOW_MODESET) && mWritebackID != 0 &&
+        !mWritebackBound) {
+        drmModeAtomicReqPtr test = drmModeAtomicDuplicate(mPset);
+        if (test != NULL) {
+            drmModeAtomicAddProperty(test, mWritebackID,
+                                     mWriteback.crtc_id, mCrtcID);
+            if (drmModeAtomicCommit(drmfd, test, DRM_MODE_ATOMIC_TEST_ONLY |
+                    DRM_MODE_ATOMIC_ALLOW_MODESET, NULL) == 0) {
+                drmModeAtomicAddProperty(mPset, mWritebackID,
+                                         mWriteback.crtc_id, mCrtcID);
+                bindWriteback = true;
+            }
+            else {
+                ALOGI("writeback can't take crtc %d, disabled", mCrtcID);
+                mWritebackID = 0;
+            }
+            drmModeAtomicFree(test);
+        }
+    }
+
+    // mirrored virtual display takes crtc output of this commit.
+    Memory* writeback = NULL;
+    int writebackFence = -1;
+    {
+        Mutex::Autolock _l(mLock);
+        writeback = mWritebackTarget;
+        mWritebackTarget = NULL;
+        // consumer still reads buffer, virtual display composes itself.
+        if (writeback != NULL && mWritebackAcquire != -1 &&
+            sync_wait(mWritebackAcquire, 0) != 0) {
+            writeback = NULL;
+        }
+        if (mWritebackAcquire != -1) {
+            close(mWritebackAcquire);
+            mWritebackAcquire = -1;
+        }
+    }
+    uint32_t writebackFb = 0;
+    if (writeback != NULL && mWritebackBound &&
+        getFbId(writeback, writeback->fslFormat, DRM_FORMAT_MOD_LINEAR,
+                &writebackFb) == 0) {
+        drmModeAtomicAddProperty(mPset, mWritebackID, mWriteback.fb_id,
+                                 writebackFb);
+        drmModeAtomicAddProperty(mPset, mWritebackID,
+                                 mWriteback.out_fence_ptr,
+                                 (uint64_t)(uintptr_t)&writebackFence);
+    }
+    else {
+        writeback = NULL;
+    }
+
+    // kernel returns a fence signaled when this frame is on screen.
+    int outFence = -1;
+    if (mCrtc.out_fence_ptr != 0) {
+        drmModeAtomicAddProperty(mPset, mCrtcID, mCrtc.out_fence_ptr,
+                                 (uint64_t)(uintptr_t)&outFence);
+    }
+
+    // camera frames on screen are timed by vblank of this flip.
+    nsecs_t marks[KMS_LATENCY_MARKS];
+    int markNum = 0;
+    if (sFlipEvents) {
+        Mutex::Autolock _l(mLock);
+        markNum = readLatencyMarksLocked(marks);
+    }
+
+    // wait last page flip instead of retrying on busy commit.
+    if (sFlipEvents) {
+        waitFlipDone();
+        flags |= DRM_MODE_PAGE_FLIP_EVENT;
+        Mutex::Autolock _l(mFlipLock);
+        mFlipPending = true;
+        memcpy(mFlipMarks, marks, markNum * sizeof(marks[0]));
+        mFlipMarkNum = markNum;
+        ATRACE_INT("KMS flip pending", 1);
+    }
+
+    int ret = 0;
+    for (uint32_t i=0; i<3; i++) {
+        ret = drmModeAtomicCommit(drmfd, mPset, flags, this);
+        if (ret == -EBUSY) {
+            ALOGV("commit pset busy and try again");
+            usleep(1000);
+            continue;
+        }
+        else if (ret != 0) {
+            ALOGI("Failed to commit pset ret=%d", ret);
+        }
+        break;
+    }
+
+    if (mModeset) {
+        mModeset = false;
+        mSeamless = false;
+    }
+
+    if (ret == 0) {
+        mCtmChanged = false;
+        if (bindWriteback) {
+            mWritebackBound = true;
+        }
+        Mutex::Autolock _l(mFbLock);
+        mFbSerial++;
+    }
+    else if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
+        Mutex::Autolock _l(mFlipLock);
+        mFlipPending = false;
+        mFlipMarkNum = 0;
+        ATRACE_INT("KMS flip pending", 0);
+    }
+
+    if (ret != 0 && outFence != -1) {
+        close(outFence);
+        outFence = -1;
+    }
+    if (ret != 0 && writebackFence != -1) {
+        close(writebackFence);
+        writebackFence = -1;
+    }
+
+    {
+        Mutex::Autolock _l(mLock);
+        finishRequestLocked(ret == 0);
+        closePlaneFencesLocked();
+        setReleaseFencesLocked(outFence);
+        if (mPresentFence != -1) {
+            close(mPresentFence);
+        }
+        mPresentFence = outFence;
+        // writeback of last commit not taken by virtual display is stale.
+        if (mWritebackFence != -1) {
+            close(mWritebackFence);
+        }
+        mWritebackDone = (writebackFence != -1) ? writeback : NULL;
+        mWritebackFence = writebackFence;
+        if (ret == 0) {
+            onSidebandCommitLocked(sideband);
+        }
+        if (ret == 0 && earlyView) {
+            // screen is ours, rear view exits.
+            ALOGI("display took over rear view");
+            rearview_send(mEarlyView, REARVIEW_MSG_DONE, NULL, -1);
+            close(mEarlyView);
+            mEarlyView = -1;
+        }
+        if (mSidebandThread != NULL) {
+            mSidebandThread->wake();
+        }
+    }
+
+    return 0;
+}
+
+// drm ctm entry is sign-magnitude S31.32 fixed point.
+static uint64_t convertCtmValue(float value)
+{
+    uint64_t sign = 0;
+    if (value < 0) {
+        sign = 1ULL << 63;
+        value = -value;
+    }
+
+    uint64_t magnitude = (uint64_t)((double)value * (1ULL << 32));
+    return sign | (magnitude & ~(1ULL << 63));
+}
+
+int KmsDisplay::setColorTransform(const float* matrix)
+{
+    Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
+
+    if (mCrtc.ctm == 0 || mDrmFd < 0) {
+        return (matrix == NULL) ? 0 : -EINVAL;
+    }
+
+    uint32_t blob = 0;
+    if (matrix != NULL) {
+        // row vector times matrix, ctm can't take offsets or alpha terms.
+        if (matrix[3] != 0 || matrix[7] != 0 || matrix[11] != 0 ||
+            matrix[12] != 0 || matrix[13] != 0 || matrix[14] != 0) {
+            ALOGV("color matrix with offset not supported");
+            return -EINVAL;
+        }
+
+        struct drm_color_ctm ctm;
+        for (int row=0; row<3; row++) {
+            for (int col=0; col<3; col++) {
+                ctm.matrix[row * 3 + col] =
+                            convertCtmValue(matrix[col * 4 + row]);
+            }
+        }
+
+        if (drmModeCreatePropertyBlob(mDrmFd, &ctm, sizeof(ctm), &blob)) {
+            ALOGE("create ctm blob failed");
+            return -EINVAL;
+        }
+    }
+
+    // crtc state keeps its own reference of committed blob.
+    if (mCtmBlob != 0) {
+        drmModeDestroyPropertyBlob(mDrmFd, mCtmBlob);
+    }
+    mCtmBlob = blob;
+    mCtmChanged = true;
+
+    return 0;
+}
+
+int KmsDisplay::openKms(drmModeResPtr pModeRes)
+{
+    Mutex::Autolock _l(mLock);
+
+    if (mDrmFd < 0 || mConnectorID == 0) {
+        ALOGE("%s invalid drmfd or connector id", __func__);
+        return -ENODEV;
+    }
+
+    int ret = drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+    if (ret) {
+        ALOGE("failed to set universal plane cap %d", ret);
+        return ret;
+    }
+
+    ret = drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_ATOMIC, 1);
+    if (ret) {
+        ALOGE("failed to set atomic cap %d", ret);
+        return ret;
+    }
+
+    // connector is probed by readConnection before.
+    drmModeConnectorPtr pConnector =
+                drmModeGetConnectorCurrent(mDrmFd, mConnectorID);
+    if (pConnector == NULL) {
+        ALOGE("%s drmModeGetConnector failed for "
+              "connector index %d", __func__, mConnectorID);
+        return -ENODEV;
+    }
+
+    drmModeEncoderPtr pEncoder =
+        drmModeGetEncoder(mDrmFd, pConnector->encoders[0]);
+
+    if (pEncoder == NULL) {
+        ALOGE("drmModeGetEncoder failed for"
+              "encoder 0x%08x", pConnector->encoders[0]);
+        return -ENODEV;
+    }
+
+    int index = findBestMatch(pConnector);
+    mMode = pConnector->modes[index];
+    for (int i = 0; i < pModeRes->count_crtcs; i++) {
+        if ((pEncoder->possible_crtcs & (1 << i)) == 0) {
+            continue;
+        }
+
+        mCrtcID = pModeRes->crtcs[i];
+        mCrtcIndex = i;
+        break;
     }
 
     if (mCrtcID == 0) {
@@ -626,9 +1895,41 @@ int KmsDisplay::openKms(drmModeResPtr pModeRes)
         height = 480;
     }
 
-    ssize_t configId = getConfigIdLocked(width, height);
+    // configs at gui size for every refresh rate of best mode size.
+    releaseModeBlobsLocked();
+    mConfigs.clear();
+    for (int i=0; i<pConnector->count_modes; i++) {
+        drmModeModeInfo& mode = pConnector->modes[i];
+        if (i != index && (mode.hdisplay != mMode.hdisplay ||
+            mode.vdisplay != mMode.vdisplay || mode.vrefresh == 0 ||
+            (mode.flags & DRM_MODE_FLAG_INTERLACE))) {
+            continue;
+        }
+
+        // one config per refresh rate, best mode keeps its rate.
+        bool found = false;
+        if (i != index) {
+            found = (mode.vrefresh == mMode.vrefresh ||
+                     mConfigs.size() >= KMS_CONFIG_NUM - 1);
+            for (size_t j=0; j<mConfigs.size() && !found; j++) {
+                int k = mConfigs[j].mModeIndex;
+                found = (pConnector->modes[k].vrefresh == mode.vrefresh);
+            }
+        }
+        if (!found) {
+            getConfigIdLocked(width, height, i);
+        }
+    }
+
+    ssize_t configId = -1;
+    for (size_t i=0; i<mConfigs.size(); i++) {
+        if (mConfigs[i].mModeIndex == index) {
+            configId = i;
+        }
+    }
     if (configId < 0) {
         ALOGE("can't find config: w:%d, h:%d", mMode.hdisplay, mMode.vdisplay);
+        drmModeFreeConnector(pConnector);
         return -1;
     }
 
@@ -646,27 +1947,38 @@ int KmsDisplay::openKms(drmModeResPtr pModeRes)
     }
     drmModeFreePlane(planePtr);
 
-    DisplayConfig& config = mConfigs.editItemAt(configId);
-    config.mXdpi = mMode.hdisplay * 25400 / pConnector->mmWidth;
-    config.mYdpi = mMode.vdisplay * 25400 / pConnector->mmHeight;
-    config.mFps  = mMode.vrefresh;
-    config.mVsyncPeriod  = 1000000000 / mMode.vrefresh;
-    config.mFormat = format;
-    config.mBytespixel = 4;
-    ALOGW("xres         = %d px\n"
-          "yres         = %d px\n"
-          "xdpi         = %.2f ppi\n"
-          "ydpi         = %.2f ppi\n"
-          "fps          = %.2f Hz\n",
-          config.mXres, config.mYres, config.mXdpi / 1000.0f,
-          config.mYdpi / 1000.0f, config.mFps);
+    for (size_t i=0; i<mConfigs.size(); i++) {
+        DisplayConfig& config = mConfigs.editItemAt(i);
+        drmModeModeInfo& mode = pConnector->modes[config.mModeIndex];
+        config.mXdpi = mode.hdisplay * 25400 / pConnector->mmWidth;
+        config.mYdpi = mode.vdisplay * 25400 / pConnector->mmHeight;
+        config.mFps  = mode.vrefresh;
+        config.mVsyncPeriod  = 1000000000 / mode.vrefresh;
+        config.mFormat = format;
+        config.mBytespixel = 4;
+        ALOGW("xres         = %d px\n"
+              "yres         = %d px\n"
+              "xdpi         = %.2f ppi\n"
+              "ydpi         = %.2f ppi\n"
+              "fps          = %.2f Hz\n",
+              config.mXres, config.mYres, config.mXdpi / 1000.0f,
+              config.mYdpi / 1000.0f, config.mFps);
+    }
+    createModeBlobsLocked(pConnector);
 
     if (pConnector != NULL) {
         drmModeFreeConnector(pConnector);
     }
 
+    mModeset = true;
+    mSeamless = false;
+    mIdleConfig = -1;
+    mContentConfig = -1;
     mActiveConfig = configId;
+    // plane values left by last user of kms are unknown.
+    resetPlaneStatesLocked();
     prepareTargetsLocked();
+    updateWorkloadLocked();
 
     return 0;
 }
@@ -744,16 +2056,8 @@ int KmsDisplay::getPrimaryPlane()
         }
 
         crtcs = pPlane->possible_crtcs;
-
-        for (size_t k=0; k<pPlane->count_formats; k++) {
-            uint32_t nFormat = pPlane->formats[k];
-            ALOGV("available format: %c%c%c%c", nFormat&0xFF, (nFormat>>8)&0xFF,
-                            (nFormat>>16)&0xFF, (nFormat>>24)&0xFF);
-        }
-
-        drmModeFreePlane(pPlane);
-
         if ((crtcs & (1 << mCrtcIndex)) == 0) {
+            drmModeFreePlane(pPlane);
             continue;
         }
 
@@ -761,19 +2065,49 @@ int KmsDisplay::getPrimaryPlane()
                          DRM_MODE_OBJECT_PLANE,
                         "type", NULL, &type, mDrmFd);
 
+        KmsPlane* plane = NULL;
         if (type == DRM_PLANE_TYPE_PRIMARY) {
-            mKmsPlanes[0].mPlaneID = pPlaneRes->planes[i];
-            mKmsPlanes[0].mDrmFd = mDrmFd;
+            plane = &mKmsPlanes[0];
         }
         if (type == DRM_PLANE_TYPE_OVERLAY && mKmsPlaneNum < KMS_PLANE_NUM) {
-            mKmsPlanes[mKmsPlaneNum].mPlaneID = pPlaneRes->planes[i];
-            mKmsPlanes[mKmsPlaneNum].mDrmFd = mDrmFd;
+            plane = &mKmsPlanes[mKmsPlaneNum];
             mKmsPlaneNum++;
         }
+        if (type == DRM_PLANE_TYPE_CURSOR && mCursorPlane.mPlaneID == 0) {
+            plane = &mCursorPlane;
+        }
+
+        if (plane != NULL) {
+            plane->mPlaneID = pPlaneRes->planes[i];
+            plane->mDrmFd = mDrmFd;
+            plane->getFormats(pPlane);
+            plane->getModifiers();
+            getPropertyValue(pPlaneRes->planes[i],
+                             DRM_MODE_OBJECT_PLANE,
+                            "zpos", NULL, &plane->mZpos, mDrmFd);
+        }
+        drmModeFreePlane(pPlane);
+    }
+
+    // sort overlay planes by zpos so that plane index follows z-order.
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        for (uint32_t k=i+1; k<mKmsPlaneNum; k++) {
+            if (mKmsPlanes[k].mZpos < mKmsPlanes[i].mZpos) {
+                KmsPlane plane = mKmsPlanes[i];
+                mKmsPlanes[i] = mKmsPlanes[k];
+                mKmsPlanes[k] = plane;
+            }
+        }
     }
 
     drmModeFreePlaneResources(pPlaneRes);
 
+    if (drmGetCap(mDrmFd, DRM_CAP_CURSOR_WIDTH, &mCursorWidth) != 0 ||
+        drmGetCap(mDrmFd, DRM_CAP_CURSOR_HEIGHT, &mCursorHeight) != 0) {
+        mCursorWidth = KMS_CURSOR_SIZE;
+        mCursorHeight = KMS_CURSOR_SIZE;
+    }
+
     if (mKmsPlanes[0].mPlaneID == 0) {
         ALOGE("can't find primary plane.");
         return -ENODEV;
@@ -796,10 +2130,42 @@ int KmsDisplay::closeKms()
     }
     mConfigs.clear();
     mActiveConfig = -1;
+    updateWorkloadLocked();
+    releaseModeBlobsLocked();
+    if (mCtmBlob != 0) {
+        drmModeDestroyPropertyBlob(mDrmFd, mCtmBlob);
+        mCtmBlob = 0;
+    }
+    mCtmChanged = false;
+    // binding of writeback is lost with crtc state.
+    mWritebackBound = false;
+    mWritebackTarget = NULL;
+    mWritebackDone = NULL;
+    if (mWritebackAcquire != -1) {
+        close(mWritebackAcquire);
+        mWritebackAcquire = -1;
+    }
+    if (mWritebackFence != -1) {
+        close(mWritebackFence);
+        mWritebackFence = -1;
+    }
     mKmsPlaneNum = 1;
     memset(mKmsPlanes, 0, sizeof(mKmsPlanes));
+    mPsetOpen = false;
+    memset(mOverlays, 0, sizeof(mOverlays));
+    memset(mPlaneLayers, 0, sizeof(mPlaneLayers));
+    mFenceLayerNum = 0;
+    memset(&mCursorPlane, 0, sizeof(mCursorPlane));
+    mCursorLayer = NULL;
+    mCursorPlaneLayer = NULL;
+
+    if (mEarlyView >= 0) {
+        close(mEarlyView);
+        mEarlyView = -1;
+    }
 
     releaseTargetsLocked();
+    clearFbCache();
     return 0;
 }
 
@@ -851,7 +2217,12 @@ void KmsDisplay::prepareTargetsLocked()
     desc.mFslFormat = config.mFormat;
     desc.mProduceUsage |= USAGE_HW_COMPOSER |
                           USAGE_HW_2D | USAGE_HW_RENDER;
-    desc.mFlag = FLAGS_FRAMEBUFFER;
+    desc.mFlag = FLAGS_FRAMEBUFFER | FLAGS_PRIVATE;
+    // compose to super tiled target when primary plane can scan it out.
+    if (mKmsPlanes[0].checkFormat(convertFormatToDrm(config.mFormat),
+                                  DRM_FORMAT_MOD_VIVANTE_SUPER_TILED)) {
+        desc.mFlag |= FLAGS_SUPERTILED;
+    }
     desc.checkFormat();
 
     for (int i=0; i<MAX_FRAMEBUFFERS; i++) {
@@ -870,14 +2241,23 @@ void KmsDisplay::releaseTargetsLocked()
         mTargets[i] = NULL;
     }
     mTargetIndex = 0;
+    memset(mTargetWidths, 0, sizeof(mTargetWidths));
+    memset(mTargetHeights, 0, sizeof(mTargetHeights));
+    // render size is picked again for new target size.
+    mRenderWidth = 0;
+    mRenderHeight = 0;
+    mComposeLoad = 0;
+    resetDamageLocked();
 }
 
-int KmsDisplay::getConfigIdLocked(int width, int height)
+int KmsDisplay::getConfigIdLocked(int width, int height, int modeIndex)
 {
     int index = -1;
     DisplayConfig config;
+    memset(&config, 0, sizeof(config));
     config.mXres = width;
     config.mYres = height;
+    config.mModeIndex = modeIndex;
 
     index = mConfigs.indexOf(config);
     if (index < 0) {
@@ -887,25 +2267,87 @@ int KmsDisplay::getConfigIdLocked(int width, int height)
     return index;
 }
 
+void KmsDisplay::createModeBlobsLocked(drmModeConnectorPtr pConnector)
+{
+    for (size_t i=0; i<mConfigs.size() && i<KMS_CONFIG_NUM; i++) {
+        mModes[i] = pConnector->modes[mConfigs[i].mModeIndex];
+        if (drmModeCreatePropertyBlob(mDrmFd, &mModes[i], sizeof(mModes[i]),
+                                      &mModeBlobs[i]) != 0) {
+            ALOGE("create mode blob of config %zu failed", i);
+            mModeBlobs[i] = 0;
+        }
+    }
+}
+
+void KmsDisplay::releaseModeBlobsLocked()
+{
+    for (size_t i=0; i<KMS_CONFIG_NUM; i++) {
+        if (mModeBlobs[i] != 0) {
+            drmModeDestroyPropertyBlob(mDrmFd, mModeBlobs[i]);
+            mModeBlobs[i] = 0;
+        }
+    }
+}
+
 int KmsDisplay::setActiveConfig(int configId)
 {
     Mutex::Autolock _l(mLock);
+    waitPresentIdleLocked();
     if (mActiveConfig == configId) {
         ALOGI("the same config, no need to change");
         return 0;
     }
 
-    if (configId < 0 || configId >= (int)mConfigs.size()) {
+    if (configId < 0 || configId >= (int)mConfigs.size() ||
+        configId >= KMS_CONFIG_NUM) {
         ALOGI("invalid config id:%d", configId);
         return -EINVAL;
     }
 
-    releaseTargetsLocked();
-    prepareTargetsLocked();
+    const DisplayConfig& next = mConfigs[configId];
+    bool sameSize = mActiveConfig >= 0 &&
+                    mConfigs[mActiveConfig].mXres == next.mXres &&
+                    mConfigs[mActiveConfig].mYres == next.mYres &&
+                    mModes[configId].hdisplay == mMode.hdisplay &&
+                    mModes[configId].vdisplay == mMode.vdisplay;
+
+    mActiveConfig = configId;
+    mIdleConfig = -1;
+    mContentConfig = -1;
+    mMode = mModes[configId];
+    mModeset = true;
+    // render targets and planes keep as they are for refresh change.
+    mSeamless = sameSize;
+    if (!sameSize) {
+        releaseTargetsLocked();
+        prepareTargetsLocked();
+    }
+    updateWorkloadLocked();
 
     return 0;
 }
 
+// 4K scanout underruns once busfreq drops to low-bus mode, power HAL
+// holds bus bandwidth while any powered display scans out 4K mode.
+void KmsDisplay::updateWorkloadLocked()
+{
+    bool scanout4k = mActiveConfig >= 0 && mPowerMode != DRM_MODE_DPMS_OFF &&
+                     mMode.hdisplay * mMode.vdisplay >= KMS_4K_PIXELS;
+
+    Mutex::Autolock _l(sWorkloadLock);
+    uint32_t displays = s4kDisplays;
+    if (scanout4k) {
+        displays |= 1 << mIndex;
+    }
+    else {
+        displays &= ~(1 << mIndex);
+    }
+    if ((displays != 0) != (s4kDisplays != 0)) {
+        power_workload_set(POWER_WORKLOAD_DISPLAY_4K, displays != 0);
+    }
+    s4kDisplays = displays;
+}
+
 int KmsDisplay::composeLayers()
 {
     Mutex::Autolock _l(mLock);
@@ -913,16 +2355,123 @@ int KmsDisplay::composeLayers()
     // mLayerVector's size > 0 means 2D composite.
     // only this case needs override mRenderTarget.
     if (mLayerVector.size() > 0) {
+        Memory* cached = getCachedTargetLocked();
+        if (cached != NULL) {
+            mRenderTarget = cached;
+            return composeLayersLocked();
+        }
+
+        updateRenderSizeLocked();
         mTargetIndex = mTargetIndex % MAX_FRAMEBUFFERS;
         mRenderTarget = mTargets[mTargetIndex];
+        mTargetWidths[mTargetIndex] = mRenderWidth;
+        mTargetHeights[mTargetIndex] = mRenderHeight;
         mTargetIndex++;
     }
 
     return composeLayersLocked();
 }
 
+void KmsDisplay::updateRenderSizeLocked()
+{
+    if (mActiveConfig < 0) {
+        return;
+    }
+
+    const DisplayConfig& config = mConfigs[mActiveConfig];
+    int height = mTunables.mRenderHeight;
+    bool enable = !mNoRenderScale && height > 0 && config.mYres > height;
+    if (mComposeTime > 0) {
+        nsecs_t time = mComposeTime;
+        if (mRenderWidth > 0) {
+            time = time * config.mXres * config.mYres /
+                   (mRenderWidth * mRenderHeight);
+        }
+        mComposeLoad = (mComposeLoad * 7 + time) / 8;
+        mComposeTime = 0;
+    }
+
+    nsecs_t period = config.mVsyncPeriod;
+    bool scaled = mRenderWidth > 0;
+    if (!enable) {
+        scaled = false;
+    }
+    else if (!scaled) {
+        scaled = mComposeLoad > period * KMS_RENDER_LOAD_HIGH / 100;
+    }
+    else {
+        scaled = mComposeLoad >= period * KMS_RENDER_LOAD_LOW / 100;
+    }
+
+    int width = 0;
+    if (scaled) {
+        // keep aspect ratio, even size for yuv targets.
+        width = (config.mXres * height / config.mYres) & ~1;
+        height &= ~1;
+    }
+    else {
+        height = 0;
+    }
+    if (width == mRenderWidth && height == mRenderHeight) {
+        return;
+    }
+
+    if (width > 0 && !testPrimaryScaleLocked(width, height)) {
+        ALOGI("primary plane can't scale render size, disabled");
+        mNoRenderScale = true;
+        return;
+    }
+
+    ALOGI("display %d render size %dx%d load %" PRId64 "us", mIndex,
+          width, height, mComposeLoad / 1000);
+    mRenderWidth = width;
+    mRenderHeight = height;
+    // content of targets was rendered at other size.
+    resetDamageLocked();
+}
+
+bool KmsDisplay::testPrimaryScaleLocked(int width, int height)
+{
+    // crtc is not active before modeset, try it again next frame.
+    if (mModeset || mTargets[0] == NULL) {
+        return true;
+    }
+
+    const DisplayConfig& config = mConfigs[mActiveConfig];
+    uint64_t modifier = getModifier(mTargets[0]);
+    if (!mKmsPlanes[0].checkFormat(convertFormatToDrm(config.mFormat),
+                                   modifier)) {
+        modifier = DRM_FORMAT_MOD_LINEAR;
+    }
+
+    uint32_t fbId = 0;
+    if (getFbId(mTargets[0], config.mFormat, modifier, &fbId) != 0) {
+        return false;
+    }
+
+    drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
+    if (pset == NULL) {
+        ALOGE("Failed to allocate property set");
+        return false;
+    }
+
+    mKmsPlanes[0].connectCrtc(pset, mCrtcID, fbId);
+    mKmsPlanes[0].setSourceSurface(pset, 0, 0, width, height);
+    mKmsPlanes[0].setDisplayFrame(pset, 0, 0, mMode.hdisplay, mMode.vdisplay);
+    int ret = drmModeAtomicCommit(mDrmFd, pset,
+                    DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+    drmModeAtomicFree(pset);
+
+    return ret == 0;
+}
+
 void KmsDisplay::handleVsyncEvent(nsecs_t timestamp)
 {
+    ATRACE_CALL();
+    // called by vsync thread only.
+    mVsyncTrace = !mVsyncTrace;
+    ATRACE_INT("HW_VSYNC", mVsyncTrace);
+
     EventListener* callback = NULL;
     {
         Mutex::Autolock _l(mLock);
@@ -936,6 +2485,97 @@ void KmsDisplay::handleVsyncEvent(nsecs_t timestamp)
     callback->onVSync(DISPLAY_PRIMARY, timestamp);
 }
 
+void KmsDisplay::pageFlipHandler(int /*fd*/, unsigned int /*sequence*/,
+                    unsigned int sec, unsigned int usec,
+                    unsigned int /*crtcId*/, void* data)
+{
+    KmsDisplay* display = (KmsDisplay*)data;
+    if (display != NULL) {
+        display->handleFlipEvent((nsecs_t)sec * 1000000000LL +
+                                 (nsecs_t)usec * 1000);
+    }
+}
+
+void KmsDisplay::handleFlipEvent(nsecs_t timestamp)
+{
+    nsecs_t marks[KMS_LATENCY_MARKS];
+    int markNum = 0;
+    {
+        Mutex::Autolock _l(mFlipLock);
+        mFlipPending = false;
+        mFlipTime = timestamp;
+        markNum = mFlipMarkNum;
+        memcpy(marks, mFlipMarks, markNum * sizeof(marks[0]));
+        mFlipMarkNum = 0;
+        ATRACE_INT("KMS flip pending", 0);
+        mFlipCondition.broadcast();
+    }
+    // scanout of flipped frame starts at vblank of event.
+    for (int i=0; i<markNum; i++) {
+        if (timestamp > marks[i]) {
+            mStats.addLatency(timestamp - marks[i]);
+        }
+    }
+    // flip completes at vblank, mLock is taken out of mFlipLock.
+    setVsyncTime(timestamp);
+}
+
+void KmsDisplay::waitFlipDone()
+{
+    ATRACE_CALL();
+    Mutex::Autolock _l(mFlipLock);
+    while (mFlipPending) {
+        if (mFlipCondition.waitRelative(mFlipLock, KMS_FLIP_TIMEOUT) ==
+                -ETIMEDOUT) {
+            // event may be lost when crtc is disabled.
+            ALOGW("wait page flip event timeout");
+            mFlipPending = false;
+            mFlipMarkNum = 0;
+        }
+    }
+}
+
+int KmsDisplay::readLatencyMarksLocked(nsecs_t* marks)
+{
+    nsecs_t current[KMS_LATENCY_MARKS];
+    int num = 0, added = 0;
+    for (size_t i=0; mTunables.mLatencyMark && i<mActiveCount &&
+         num<KMS_LATENCY_MARKS; i++) {
+        Memory* handle = mActiveLayers[i]->handle;
+        if (handle == NULL || !(handle->usage & USAGE_HW_CAMERA_WRITE) ||
+            handle->size < LATENCY_MARK_SIZE) {
+            continue;
+        }
+
+        void* vaddr = NULL;
+        if (mMemoryManager->lock(handle, USAGE_SW_READ_OFTEN, 0, 0,
+                                 handle->width, 1, &vaddr) != 0) {
+            continue;
+        }
+        nsecs_t mark = vaddr != NULL ? latency_mark_read(vaddr) : 0;
+        mMemoryManager->unlock(handle);
+        if (mark == 0) {
+            continue;
+        }
+
+        // buffer stays on screen until camera queues next one.
+        current[num++] = mark;
+        bool shown = false;
+        for (int j=0; j<mLastMarkNum; j++) {
+            if (mLastMarks[j] == mark) {
+                shown = true;
+            }
+        }
+        if (!shown) {
+            marks[added++] = mark;
+        }
+    }
+
+    memcpy(mLastMarks, current, num * sizeof(current[0]));
+    mLastMarkNum = num;
+    return added;
+}
+
 int KmsDisplay::setDrm(int drmfd, size_t connectorId)
 {
     if (drmfd < 0 || connectorId == 0) {
@@ -953,12 +2593,195 @@ int KmsDisplay::setDrm(int drmfd, size_t connectorId)
     return 0;
 }
 
+void KmsDisplay::setEarlyView(int sock)
+{
+    Mutex::Autolock _l(mLock);
+    if (mEarlyView >= 0) {
+        close(mEarlyView);
+    }
+    mEarlyView = sock;
+    mEarlyViewReleased = false;
+    mEarlyViewTime = 0;
+}
+
+bool KmsDisplay::holdEarlyViewLocked()
+{
+    if (mEarlyView < 0) {
+        return false;
+    }
+
+    nsecs_t now = systemTime(CLOCK_MONOTONIC);
+    if (!mEarlyViewReleased) {
+        struct rearview_msg msg;
+        int type = rearview_recv(mEarlyView, &msg, NULL, MSG_DONTWAIT);
+        if (type == -EAGAIN) {
+            return true;
+        }
+        mEarlyViewReleased = true;
+        // rear view gone without release has nothing left to show.
+        mEarlyViewTime = (type == REARVIEW_MSG_RELEASED) ? now : 0;
+    }
+
+    // last rear view frame stays until camera preview replaces it.
+    bool preview = false;
+    for (size_t i=0; i<mActiveCount; i++) {
+        Memory* handle = mActiveLayers[i]->handle;
+        if (handle != NULL && (handle->usage & USAGE_HW_CAMERA_WRITE)) {
+            preview = true;
+        }
+    }
+    if (!preview && now - mEarlyViewTime < KMS_EARLY_VIEW_TIMEOUT) {
+        return true;
+    }
+
+    // planes rear view may use are unknown, clear all this frame leaves.
+    for (uint32_t i=1; i<mKmsPlaneNum; i++) {
+        if (mPlaneLayers[i] == NULL) {
+            mKmsPlanes[i].connectCrtc(mPset, 0, 0);
+        }
+    }
+    if (mCursorPlane.mPlaneID != 0 && mCursorPlaneLayer == NULL) {
+        mCursorPlane.connectCrtc(mPset, 0, 0);
+    }
+    // keep mode of rear view if it matches.
+    mModeset = true;
+    mSeamless = true;
+    return false;
+}
+
 int KmsDisplay::powerMode()
 {
     Mutex::Autolock _l(mLock);
     return mPowerMode;
 }
 
+int KmsDisplay::setWriteback(uint32_t connectorId)
+{
+    drmModeConnectorPtr pConnector =
+                drmModeGetConnectorCurrent(mDrmFd, connectorId);
+    if (pConnector == NULL) {
+        ALOGE("%s get connector %d failed", __func__, connectorId);
+        return -ENODEV;
+    }
+
+    uint32_t crtcs = 0;
+    for (int i=0; i<pConnector->count_encoders; i++) {
+        drmModeEncoderPtr pEncoder =
+                drmModeGetEncoder(mDrmFd, pConnector->encoders[i]);
+        if (pEncoder != NULL) {
+            crtcs |= pEncoder->possible_crtcs;
+            drmModeFreeEncoder(pEncoder);
+        }
+    }
+    drmModeFreeConnector(pConnector);
+
+    struct TableProperty writebackTable[] = {
+        {"CRTC_ID", &mWriteback.crtc_id},
+        {"WRITEBACK_FB_ID", &mWriteback.fb_id},
+        {"WRITEBACK_OUT_FENCE_PTR", &mWriteback.out_fence_ptr},
+    };
+    getTableProperty(connectorId, DRM_MODE_OBJECT_CONNECTOR,
+                     writebackTable, ARRAY_LEN(writebackTable), mDrmFd);
+    if (mWriteback.crtc_id == 0 || mWriteback.fb_id == 0 ||
+        mWriteback.out_fence_ptr == 0) {
+        ALOGI("writeback connector %d misses properties", connectorId);
+        return -ENODEV;
+    }
+
+    uint64_t blobId = 0;
+    size_t num = 0;
+    getPropertyValue(connectorId, DRM_MODE_OBJECT_CONNECTOR,
+                     "WRITEBACK_PIXEL_FORMATS", NULL, &blobId, mDrmFd);
+    drmModePropertyBlobPtr blob = (blobId != 0) ?
+                drmModeGetPropertyBlob(mDrmFd, blobId) : NULL;
+    if (blob != NULL) {
+        uint32_t* formats = (uint32_t*)blob->data;
+        for (size_t i=0; i<blob->length / sizeof(uint32_t) &&
+                         num < KMS_WRITEBACK_FORMAT_NUM; i++) {
+            mWritebackFormats[num++] = formats[i];
+        }
+        drmModeFreePropertyBlob(blob);
+    }
+
+    Mutex::Autolock _l(mLock);
+    mWritebackID = connectorId;
+    mWritebackCrtcs = crtcs;
+    mWritebackFormatNum = num;
+    ALOGI("writeback connector %d crtcs:0x%x formats:%zu", connectorId,
+          crtcs, num);
+
+    return 0;
+}
+
+bool KmsDisplay::checkWritebackLocked(Memory* buffer)
+{
+    if (mWritebackID == 0 || !mWritebackBound || buffer == NULL ||
+        !(mWritebackCrtcs & (1U << mCrtcIndex)) ||
+        mPowerMode != POWER_ON || mCtmBlob != 0) {
+        return false;
+    }
+
+    // writeback takes crtc output as it is, without scaling.
+    if (buffer->width != mMode.hdisplay || buffer->height != mMode.vdisplay) {
+        return false;
+    }
+
+    uint32_t format = convertFormatToDrm(buffer->fslFormat);
+    for (size_t i=0; i<mWritebackFormatNum; i++) {
+        if (mWritebackFormats[i] == format) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int KmsDisplay::queueWriteback(Memory* buffer, int acquireFence)
+{
+    Mutex::Autolock _l(mLock);
+    // frame handed to present thread must not take it.
+    waitPresentIdleLocked();
+    if (!checkWritebackLocked(buffer)) {
+        return -EINVAL;
+    }
+
+    if (mWritebackAcquire != -1) {
+        close(mWritebackAcquire);
+        mWritebackAcquire = -1;
+    }
+    mWritebackTarget = buffer;
+    if (acquireFence != -1) {
+        mWritebackAcquire = dup(acquireFence);
+    }
+
+    return 0;
+}
+
+int KmsDisplay::takeWriteback(Memory* buffer, int* outFence)
+{
+    Mutex::Autolock _l(mLock);
+    // commit of frame handed to present thread may take it.
+    waitPresentIdleLocked();
+    if (mWritebackTarget == buffer) {
+        // frame was not committed yet, virtual display composes itself.
+        mWritebackTarget = NULL;
+        if (mWritebackAcquire != -1) {
+            close(mWritebackAcquire);
+            mWritebackAcquire = -1;
+        }
+    }
+
+    if (outFence == NULL || buffer == NULL || mWritebackDone != buffer ||
+        mWritebackFence == -1) {
+        return -EAGAIN;
+    }
+
+    *outFence = mWritebackFence;
+    mWritebackFence = -1;
+    mWritebackDone = NULL;
+    return 0;
+}
+
 int KmsDisplay::readType()
 {
     if (mDrmFd < 0 || mConnectorID == 0) {
@@ -1008,6 +2831,24 @@ int KmsDisplay::readConnection()
     }
 
     drmModeConnectorPtr pConnector = drmModeGetConnector(mDrmFd, mConnectorID);
+    return updateConnection(pConnector);
+}
+
+int KmsDisplay::readCurrentConnection()
+{
+    if (mDrmFd < 0 || mConnectorID == 0) {
+        ALOGE("%s invalid drmfd or connector id", __func__);
+        return -ENODEV;
+    }
+
+    // no forced probe, edid is read again only by kernel.
+    drmModeConnectorPtr pConnector =
+                drmModeGetConnectorCurrent(mDrmFd, mConnectorID);
+    return updateConnection(pConnector);
+}
+
+int KmsDisplay::updateConnection(drmModeConnectorPtr pConnector)
+{
     if (pConnector == NULL) {
         ALOGE("%s drmModeGetConnector failed for "
               "connector index %d", __func__, mConnectorID);
@@ -1023,9 +2864,7 @@ int KmsDisplay::readConnection()
         mConnected = false;
     }
 
-    if (pConnector != NULL) {
-        drmModeFreeConnector(pConnector);
-    }
+    drmModeFreeConnector(pConnector);
 
     return 0;
 }
@@ -1036,12 +2875,42 @@ extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
                            struct timespec *remain);
 
 KmsDisplay::VSyncThread::VSyncThread(KmsDisplay *ctx)
-    : Thread(false), mCtx(ctx), mEnabled(false),
+    : Thread(false), mCtx(ctx), mEnabled(false), mVBlankPending(false),
       mFakeVSync(false), mNextFakeVSync(0)
 {
     mRefreshPeriod = 0;
 }
 
+KmsDisplay::SidebandThread::SidebandThread(KmsDisplay *ctx)
+    : Thread(false), mCtx(ctx)
+{
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+KmsDisplay::SidebandThread::~SidebandThread()
+{
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+    }
+}
+
+void KmsDisplay::SidebandThread::onFirstRef()
+{
+    run("HWC-Sideband-Thread", android::PRIORITY_URGENT_DISPLAY);
+}
+
+void KmsDisplay::SidebandThread::wake()
+{
+    uint64_t one = 1;
+    write(mWakeFd, &one, sizeof(one));
+}
+
+bool KmsDisplay::SidebandThread::threadLoop()
+{
+    mCtx->handleSidebandEvents(mWakeFd);
+    return true;
+}
+
 void KmsDisplay::VSyncThread::onFirstRef()
 {
     run("HWC-VSYNC-Thread", android::PRIORITY_URGENT_DISPLAY);
@@ -1049,12 +2918,19 @@ void KmsDisplay::VSyncThread::onFirstRef()
 
 int32_t KmsDisplay::VSyncThread::readyToRun()
 {
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    setThreadPolicy(tunables.mVsyncPriority, tunables.mVsyncCpus);
     return 0;
 }
 
 void KmsDisplay::VSyncThread::setEnabled(bool enabled) {
     Mutex::Autolock _l(mLock);
     mEnabled = enabled;
+    if (mEnabled && !mFakeVSync && !mVBlankPending) {
+        // event wakes up the thread polling drm fd.
+        requestVBlankLocked();
+    }
     mCondition.signal();
 }
 
@@ -1066,19 +2942,22 @@ void KmsDisplay::VSyncThread::setFakeVSync(bool enable)
 
 bool KmsDisplay::VSyncThread::threadLoop()
 {
+    bool fake = false;
     { // scope for lock
         Mutex::Autolock _l(mLock);
-        while (!mEnabled) {
-            mCondition.wait(mLock);
+        if (mEnabled && !mVBlankPending) {
+            // software vsync when vblank event can't be queued.
+            fake = mFakeVSync || requestVBlankLocked() != 0;
         }
     }
 
-    if (mFakeVSync) {
+    if (fake) {
         performFakeVSync();
     }
-    else {
-        performVSync();
-    }
+
+    // vblank and page flip events of all crtcs come from one drm fd.
+    handleEvents(fake ? 0 : KMS_EVENT_TIMEOUT);
+    mCtx->checkIdle(systemTime(CLOCK_MONOTONIC));
 
     return true;
 }
@@ -1112,45 +2991,84 @@ void KmsDisplay::VSyncThread::performFakeVSync()
     }
 }
 
-static const int64_t kOneSecondNs = 1 * 1000 * 1000 * 1000;
-void KmsDisplay::VSyncThread::performVSync()
+int KmsDisplay::VSyncThread::requestVBlankLocked()
 {
-    uint64_t timestamp = 0;
-    static uint64_t lasttime = 0;
-
     int drmfd = mCtx->drmfd();
     uint32_t high_crtc = (mCtx->crtcpipe() << DRM_VBLANK_HIGH_CRTC_SHIFT);
     drmVBlank vblank;
     memset(&vblank, 0, sizeof(vblank));
     vblank.request.type = (drmVBlankSeqType)(
-            DRM_VBLANK_RELATIVE | (high_crtc & DRM_VBLANK_HIGH_CRTC_MASK));
+            DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+            (high_crtc & DRM_VBLANK_HIGH_CRTC_MASK));
     vblank.request.sequence = 1;
+    vblank.request.signal = (unsigned long)this;
     int ret = drmWaitVBlank(drmfd, &vblank);
-    if (ret == -EINTR) {
-        ALOGE("drmWaitVBlank failed");
-        return;
+    if (ret != 0) {
+        ALOGV("queue vblank event failed, use fake vsync");
+        return ret;
     }
-    else if (ret) {
-        ALOGI("switch to fake vsync");
-        performFakeVSync();
+
+    mVBlankPending = true;
+    return 0;
+}
+
+void KmsDisplay::VSyncThread::handleEvents(int timeout)
+{
+    struct pollfd fds;
+    fds.fd = mCtx->drmfd();
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int ret = poll(&fds, 1, timeout);
+    if (ret <= 0 || !(fds.revents & POLLIN)) {
         return;
     }
-    else {
-        timestamp = (uint64_t)vblank.reply.tval_sec * kOneSecondNs +
-                (uint64_t)vblank.reply.tval_usec * 1000;
+
+    drmEventContext context;
+    memset(&context, 0, sizeof(context));
+    context.version = 3;
+    context.vblank_handler = vblankHandler;
+    context.page_flip_handler2 = KmsDisplay::pageFlipHandler;
+    drmHandleEvent(fds.fd, &context);
+}
+
+void KmsDisplay::VSyncThread::vblankHandler(int /*fd*/,
+                    unsigned int /*sequence*/, unsigned int sec,
+                    unsigned int usec, void* data)
+{
+    VSyncThread* thread = (VSyncThread*)data;
+    if (thread != NULL) {
+        thread->onVBlank((nsecs_t)sec * 1000000000LL +
+                         (nsecs_t)usec * 1000);
+    }
+}
+
+void KmsDisplay::VSyncThread::onVBlank(nsecs_t timestamp)
+{
+    static nsecs_t lasttime = 0;
+    bool enabled = false;
+    {
+        Mutex::Autolock _l(mLock);
+        mVBlankPending = false;
+        enabled = mEnabled && !mFakeVSync;
+        if (enabled) {
+            // queue next event before callback to not miss vblank.
+            requestVBlankLocked();
+        }
     }
 
     // bypass timestamp when it is 0.
-    if (timestamp == 0) {
+    if (!enabled || timestamp == 0) {
         return;
     }
 
     if (lasttime != 0) {
-        ALOGV("vsync period: %" PRIu64, timestamp - lasttime);
+        ALOGV("vsync period: %" PRId64, timestamp - lasttime);
     }
 
     lasttime = timestamp;
     if (mCtx != NULL) {
+        // fake vsync isn't aligned to vblank, so only real one is kept.
+        mCtx->setVsyncTime(timestamp);
         mCtx->handleVsyncEvent(timestamp);
     }
 }
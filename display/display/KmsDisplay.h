@@ -37,12 +37,85 @@ namespace fsl {
 
 using android::Condition;
 
+// plane rotation bits of older drm headers.
+#ifndef DRM_MODE_ROTATE_0
+#define DRM_MODE_ROTATE_0   (1 << 0)
+#define DRM_MODE_ROTATE_90  (1 << 1)
+#define DRM_MODE_ROTATE_180 (1 << 2)
+#define DRM_MODE_ROTATE_270 (1 << 3)
+#define DRM_MODE_REFLECT_X  (1 << 4)
+#define DRM_MODE_REFLECT_Y  (1 << 5)
+#endif
+
+// writeback connector of older drm headers.
+#ifndef DRM_MODE_CONNECTOR_WRITEBACK
+#define DRM_MODE_CONNECTOR_WRITEBACK 18
+#endif
+#ifndef DRM_CLIENT_CAP_WRITEBACK_CONNECTORS
+#define DRM_CLIENT_CAP_WRITEBACK_CONNECTORS 5
+#endif
+
 #define ARRAY_LEN(_arr) (sizeof(_arr) / sizeof(_arr[0]))
-#define KMS_PLANE_NUM 2
+#define KMS_PLANE_NUM 4
+#define KMS_PLANE_FORMAT_NUM 32
+// number of non-linear format and modifier pairs of plane.
+#define KMS_PLANE_MODIFIER_NUM 32
+// scaling limits of overlay plane.
+#define KMS_PLANE_MAX_UPSCALE   8
+#define KMS_PLANE_MAX_DOWNSCALE 4
+// number of cached drm framebuffers.
+#define KMS_FB_CACHE_SIZE 32
+// configs of different refresh rates at display size.
+#define KMS_CONFIG_NUM 8
+// cursor size when driver doesn't report it.
+#define KMS_CURSOR_SIZE 64
+// poll timeout of drm event loop in ms.
+#define KMS_EVENT_TIMEOUT 1000
+// wait limit of page flip event in ns.
+#define KMS_FLIP_TIMEOUT 50000000
+// camera buffers of one frame whose latency marks are read.
+#define KMS_LATENCY_MARKS 4
+// rear view stays on screen this long in ns after sensor release
+// when no camera preview replaces it.
+#define KMS_EARLY_VIEW_TIMEOUT 1000000000
+// modes of this size or larger need bus held out of low-bus mode.
+#define KMS_4K_PIXELS (3840 * 2160)
+// 2D composition time at full size in percent of vsync period,
+// above high render size is reduced, below low it's restored.
+#define KMS_RENDER_LOAD_HIGH 50
+#define KMS_RENDER_LOAD_LOW  25
+// pixel formats of writeback connector.
+#define KMS_WRITEBACK_FORMAT_NUM 16
+
+// plane properties whose committed values are cached.
+enum {
+    KMS_PROP_FB_ID = 0,
+    KMS_PROP_CRTC_ID,
+    KMS_PROP_SRC_X,
+    KMS_PROP_SRC_Y,
+    KMS_PROP_SRC_W,
+    KMS_PROP_SRC_H,
+    KMS_PROP_CRTC_X,
+    KMS_PROP_CRTC_Y,
+    KMS_PROP_CRTC_W,
+    KMS_PROP_CRTC_H,
+    KMS_PROP_ALPHA,
+    KMS_PROP_ROTATION,
+    KMS_PROP_NUM
+};
 
 struct KmsPlane
 {
     void getPropertyIds();
+    // properties added to frame request are only the changed ones,
+    // other requests always get all properties.
+    void addProperty(drmModeAtomicReqPtr pset, uint32_t prop,
+                    uint32_t id, uint64_t value);
+    void beginRequest(drmModeAtomicReqPtr request);
+    // cache values of frame request when it's committed.
+    void finishRequest(bool committed);
+    // value set by other request is unknown to the cache.
+    void forgetProperty(uint32_t prop);
     void connectCrtc(drmModeAtomicReqPtr pset,
                     uint32_t crtc, uint32_t fb);
     void setDisplayFrame(drmModeAtomicReqPtr pset,
@@ -52,6 +125,14 @@ struct KmsPlane
                     uint32_t x, uint32_t y,
                     uint32_t w, uint32_t h);
     void setAlpha(drmModeAtomicReqPtr pset, uint32_t alpha);
+    void setRotation(drmModeAtomicReqPtr pset, uint64_t rotation);
+    // get rotations supported by rotation bitmask property.
+    void getRotations();
+    bool checkRotation(uint64_t rotation);
+    void getFormats(drmModePlanePtr plane);
+    // get tiled formats from IN_FORMATS blob.
+    void getModifiers();
+    bool checkFormat(uint32_t format, uint64_t modifier);
 
     uint32_t src_x;
     uint32_t src_y;
@@ -63,10 +144,41 @@ struct KmsPlane
     uint32_t crtc_h;
 
     uint32_t alpha_id;
+    uint32_t rotation_id;
+    uint32_t in_fence_fd;
     uint32_t fb_id;
     uint32_t crtc_id;
     uint32_t mPlaneID;
     int mDrmFd;
+
+    // frame request, values added to it and values of last commit.
+    drmModeAtomicReqPtr mRequest;
+    uint32_t mPendingMask;
+    uint64_t mPending[KMS_PROP_NUM];
+    uint32_t mCommittedMask;
+    uint64_t mCommitted[KMS_PROP_NUM];
+
+    uint32_t mFormats[KMS_PLANE_FORMAT_NUM];
+    uint32_t mFormatNum;
+    uint32_t mModifierFormats[KMS_PLANE_MODIFIER_NUM];
+    uint64_t mModifiers[KMS_PLANE_MODIFIER_NUM];
+    uint32_t mModifierNum;
+    uint64_t mZpos;
+    // mask of DRM_MODE_ROTATE_* and DRM_MODE_REFLECT_* bits.
+    uint64_t mRotations;
+};
+
+// drm framebuffer of one dma-buf, keeps dma-buf open by its own fd.
+struct KmsFbEntry
+{
+    dev_t dev;
+    ino_t ino;
+    int format;
+    uint64_t modifier;
+    int fd;
+    uint32_t fbHandle;
+    uint32_t fbId;
+    uint64_t serial;
 };
 
 struct TableProperty
@@ -75,7 +187,7 @@ struct TableProperty
     uint32_t *ptr;
 };
 
-class KmsDisplay : public Display
+class KmsDisplay : public Display, public MemoryListener
 {
 public:
     KmsDisplay();
@@ -98,6 +210,8 @@ public:
     virtual int setActiveConfig(int configId);
     // update composite buffer to screen.
     virtual int updateScreen();
+    // apply color matrix with crtc CTM.
+    virtual int setColorTransform(const float* matrix);
 
     // open drm device.
     int openKms(drmModeResPtr pModeRes);
@@ -107,33 +221,102 @@ public:
     int readType();
     // read display connection state.
     int readConnection();
+    // read connection state kernel probed before hotplug event.
+    int readCurrentConnection();
     // set display drm fd and connector id.
     int setDrm(int drmfd, size_t connectorId);
     // get display drm fd.
     int drmfd() {return mDrmFd;}
     // get crtc pipe.
     int crtcpipe() {return mCrtcIndex;}
+    // get connector id.
+    uint32_t connectorId() {return mConnectorID;}
     // get display power mode.
     int powerMode();
+    // writeback connector which can take output of this crtc.
+    int setWriteback(uint32_t connectorId);
+    virtual int queueWriteback(Memory* buffer, int acquireFence);
+    virtual int takeWriteback(Memory* buffer, int* outFence);
+    // socket of early rear view driving this screen, see rearview_ext.h.
+    void setEarlyView(int sock);
 
+    virtual void prepareOverlay();
     virtual bool checkOverlay(Layer* layer);
+    virtual bool checkPlaneTransform(Layer* layer);
+    virtual Layer* testOverlay();
     virtual int performOverlay();
+    virtual bool canPresentAsyncLocked();
+    virtual bool enterIdleLocked();
+    virtual void exitIdleLocked();
+    virtual void setContentPeriodLocked(nsecs_t period);
+    virtual nsecs_t getRefreshPeriodLocked();
+    virtual bool checkCursor(Layer* layer);
+    virtual int updateCursorLocked(Layer* layer);
     static void getTableProperty(uint32_t objectID, uint32_t objectType,
                       struct TableProperty *table,
                       size_t tableLen, int drmfd);
     static void getPropertyValue(uint32_t objectID, uint32_t objectType,
                           const char *propName, uint32_t* propId,
                           uint64_t* value, int drmfd);
+    // drop cached framebuffer of memory to be released.
+    virtual void onMemoryRelease(Memory* handle);
+    // page flip completion event of atomic commit.
+    static void pageFlipHandler(int fd, unsigned int sequence,
+                    unsigned int sec, unsigned int usec,
+                    unsigned int crtcId, void* data);
 private:
-    int getConfigIdLocked(int width, int height);
+    int getConfigIdLocked(int width, int height, int modeIndex);
+    // create mode blobs of all configs once at open.
+    void createModeBlobsLocked(drmModeConnectorPtr pConnector);
+    void releaseModeBlobsLocked();
     void prepareTargetsLocked();
     void releaseTargetsLocked();
+    // writeback is bound and takes buffer of mode size and its format.
+    bool checkWritebackLocked(Memory* buffer);
+    // pick 2D render size of next composition from composition load.
+    void updateRenderSizeLocked();
+    // true while rear view keeps screen, else turns off its planes for
+    // the frame taking over.
+    bool holdEarlyViewLocked();
+    // check primary plane can scale target of width x height to mode.
+    bool testPrimaryScaleLocked(int width, int height);
     uint32_t convertFormatToDrm(uint32_t format);
     void getKmsProperty();
     int getPrimaryPlane();
     int findBestMatch(drmModeConnectorPtr pConnector);
+    bool checkPlaneScale(Layer* layer);
+    // drm rotation of layer transform, 0 if it has no drm equivalent.
+    uint64_t convertTransformToDrm(int transform);
+    // get drm format modifier from tiling of memory.
+    uint64_t getModifier(Memory* buffer);
+    int getFbId(Memory* buffer, int format, uint64_t modifier,
+                uint32_t* fbId);
+    void releaseFbEntry(KmsFbEntry* entry);
+    void clearFbCache();
+    void setOverlayPlanesLocked(drmModeAtomicReqPtr pset);
+    void setCursorPlaneLocked(drmModeAtomicReqPtr pset);
+    void setReleaseFencesLocked(int fence);
+    void closePlaneFencesLocked();
+    // set newest frames of sideband layers on planes, return plane mask.
+    // frames are only latched when new ones are queued unless forced.
+    uint32_t setSidebandPlanesLocked(drmModeAtomicReqPtr pset, bool force);
+    void onSidebandCommitLocked(uint32_t planes);
+    // commit queued sideband frames without SurfaceFlinger.
+    void handleSidebandEvents(int wakeFd);
 
     void bindCrtc(drmModeAtomicReqPtr pset, uint32_t mode);
+    // reuse frame request, properties of uncommitted frame are dropped.
+    int beginRequestLocked();
+    void finishRequestLocked(bool committed);
+    // plane values in kernel are unknown, add all of them next frame.
+    void resetPlaneStatesLocked();
+    int updateConnection(drmModeConnectorPtr pConnector);
+    void handleFlipEvent(nsecs_t timestamp);
+    // wait page flip of last commit to complete.
+    void waitFlipDone();
+    // capture times of camera buffers which are new on screen in this
+    // frame, return their number.
+    int readLatencyMarksLocked(nsecs_t* marks);
 
 protected:
     int mDrmFd;
@@ -141,10 +324,19 @@ protected:
 
     int mTargetIndex;
     Memory* mTargets[MAX_FRAMEBUFFERS];
+    // size each target was composed at, 0 for whole target.
+    int mTargetWidths[MAX_FRAMEBUFFERS];
+    int mTargetHeights[MAX_FRAMEBUFFERS];
+    // average 2D composition time mapped to whole target size.
+    nsecs_t mComposeLoad;
+    // primary plane can't scale up reduced render size.
+    bool mNoRenderScale;
 
     struct {
         uint32_t mode_id;
         uint32_t active;
+        uint32_t out_fence_ptr;
+        uint32_t ctm;
     } mCrtc;
     uint32_t mCrtcID;
     int mCrtcIndex;
@@ -156,14 +348,99 @@ protected:
     } mConnector;
     uint32_t mConnectorID;
 
+    // writeback connector is bound to crtc with a full modeset and
+    // stays there, frames are written only when fb is set.
+    struct {
+        uint32_t crtc_id;
+        uint32_t fb_id;
+        uint32_t out_fence_ptr;
+    } mWriteback;
+    uint32_t mWritebackID;
+    uint32_t mWritebackCrtcs;
+    bool mWritebackBound;
+    // buffer written back by next commit, and fence its consumer holds.
+    Memory* mWritebackTarget;
+    int mWritebackAcquire;
+    // buffer written back by last commit and its fence, until taken.
+    Memory* mWritebackDone;
+    int mWritebackFence;
+    uint32_t mWritebackFormats[KMS_WRITEBACK_FORMAT_NUM];
+    size_t mWritebackFormatNum;
+    // early rear view until first frame of this display is committed.
+    int mEarlyView;
+    bool mEarlyViewReleased;
+    nsecs_t mEarlyViewTime;
+
     drmModeModeInfo mMode;
     bool mModeset;
+    // refresh rate switch tried without full modeset first.
+    bool mSeamless;
+    // driver needs full modeset to change refresh rate.
+    bool mNoSeamless;
+    // low refresh config used while display is idle.
+    int mIdleConfig;
+    // config whose refresh is a multiple of video content rate.
+    int mContentConfig;
+    // drm mode and its property blob of each config.
+    drmModeModeInfo mModes[KMS_CONFIG_NUM];
+    uint32_t mModeBlobs[KMS_CONFIG_NUM];
+    // color matrix blob, set to crtc on next commit when changed.
+    uint32_t mCtmBlob;
+    bool mCtmChanged;
     KmsPlane mKmsPlanes[KMS_PLANE_NUM];
     uint32_t mKmsPlaneNum;
+    // frame request kept across frames, open until it's committed.
     drmModeAtomicReqPtr mPset;
-    Layer* mOverlay;
+    bool mPsetOpen;
+    // layers assigned to overlay planes, indexed by plane.
+    Layer* mOverlays[KMS_PLANE_NUM];
+    // layers shown on planes in last commit.
+    Layer* mPlaneLayers[KMS_PLANE_NUM];
+    // overlay layers whose buffers are released by next commit.
+    Layer* mFenceLayers[(KMS_PLANE_NUM + 1) * 2];
+    uint32_t mFenceLayerNum;
+    // acquire fences passed to kms, closed after commit.
+    int mPlaneFences[KMS_PLANE_NUM];
+    // framebuffers of layers on overlay planes.
+    uint32_t mOverlayFbs[KMS_PLANE_NUM];
+
+    // cursor plane, cursor layer of this frame and the one on plane.
+    KmsPlane mCursorPlane;
+    Layer* mCursorLayer;
+    Layer* mCursorPlaneLayer;
+    uint32_t mCursorFb;
+    int mCursorFence;
+    uint64_t mCursorWidth;
+    uint64_t mCursorHeight;
+
+    // LRU framebuffer cache, entries used by last
+    // two commits are on screen and never evicted.
+    Mutex mFbLock;
+    KmsFbEntry mFbCache[KMS_FB_CACHE_SIZE];
+    uint64_t mFbSerial;
+    // overlay planes below this index are free.
+    uint32_t mPlaneLimit;
     MemoryManager* mMemoryManager;
 
+    // page flip of last commit not completed yet.
+    Mutex mFlipLock;
+    Condition mFlipCondition;
+    bool mFlipPending;
+    nsecs_t mFlipTime;
+    // latency marks of last commit, and the new ones waiting its flip
+    // with mFlipLock.
+    nsecs_t mLastMarks[KMS_LATENCY_MARKS];
+    int mLastMarkNum;
+    nsecs_t mFlipMarks[KMS_LATENCY_MARKS];
+    int mFlipMarkNum;
+    // drm events are dispatched by vsync thread of primary display.
+    static bool sFlipEvents;
+    // request display 4K workload of power HAL as mode or power changes.
+    void updateWorkloadLocked();
+    // bit per display index scanning out 4K, with sWorkloadLock.
+    static Mutex sWorkloadLock;
+    static uint32_t s4kDisplays;
+
 protected:
     void handleVsyncEvent(nsecs_t timestamp);
     class VSyncThread : public Thread {
@@ -177,12 +454,19 @@ protected:
         virtual int32_t readyToRun();
         virtual bool threadLoop();
         void performFakeVSync();
-        void performVSync();
+        // queue vblank event of next vsync.
+        int requestVBlankLocked();
+        // dispatch vblank and page flip events of drm fd.
+        void handleEvents(int timeout);
+        void onVBlank(nsecs_t timestamp);
+        static void vblankHandler(int fd, unsigned int sequence,
+                        unsigned int sec, unsigned int usec, void* data);
 
         KmsDisplay *mCtx;
         mutable Mutex mLock;
         Condition mCondition;
         bool mEnabled;
+        bool mVBlankPending;
 
         bool mFakeVSync;
         mutable nsecs_t mNextFakeVSync;
@@ -190,7 +474,28 @@ protected:
     };
 
     sp<VSyncThread> mVsyncThread;
+
+    class SidebandThread : public Thread {
+    public:
+        explicit SidebandThread(KmsDisplay *ctx);
+        virtual ~SidebandThread();
+        // poll streams of sideband planes again.
+        void wake();
+
+    private:
+        virtual void onFirstRef();
+        virtual bool threadLoop();
+
+        KmsDisplay *mCtx;
+        int mWakeFd;
+    };
+
+    // serializes sideband commits with frame commits, taken before mLock.
+    Mutex mSidebandLock;
+    sp<SidebandThread> mSidebandThread;
     EventListener* mListener;
+    // HW_VSYNC counter track, toggled on each vsync.
+    int mVsyncTrace;
 };
 
 }
@@ -21,11 +21,14 @@ namespace fsl {
 Layer::Layer()
   : busy(false), zorder(0), type(LAYER_TYPE_INVALID),
     handle(NULL), transform(0), blendMode(BLENDING_NONE),
-    color(0), acquireFence(-1), index(-1)
+    color(0), dataspace(0), damageState(DAMAGE_UNKNOWN), composed(false),
+    acquireFence(-1), index(-1), sideband(NULL)
 {
     sourceCrop.clear();
     displayFrame.clear();
     visibleRegion.clear();
+    surfaceDamage.clear();
+    lastState.handle = NULL;
 }
 
 bool Layer::isSolidColor()
@@ -33,6 +36,33 @@ bool Layer::isSolidColor()
     return type == LAYER_TYPE_SOLID_COLOR;
 }
 
+void Layer::saveState()
+{
+    lastState.handle = handle;
+    lastState.zorder = zorder;
+    lastState.transform = transform;
+    lastState.blendMode = blendMode;
+    lastState.planeAlpha = planeAlpha;
+    lastState.color = color;
+    lastState.dataspace = dataspace;
+    lastState.sourceCrop = sourceCrop;
+    lastState.displayFrame = displayFrame;
+    lastState.visibleBounds = visibleRegion.getBounds();
+}
+
+bool Layer::isGeometryChanged()
+{
+    return (lastState.zorder != zorder ||
+            lastState.transform != transform ||
+            lastState.blendMode != blendMode ||
+            lastState.planeAlpha != planeAlpha ||
+            lastState.color != color ||
+            lastState.dataspace != dataspace ||
+            lastState.sourceCrop != sourceCrop ||
+            lastState.displayFrame != displayFrame ||
+            lastState.visibleBounds != visibleRegion.getBounds());
+}
+
 LayerVector::LayerVector() {
 }
 
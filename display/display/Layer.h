@@ -31,6 +31,8 @@ using android::Rect;
 using android::Region;
 using android::SortedVector;
 
+class SidebandStream;
+
 enum {
     LAYER_TYPE_INVALID = 0,
     LAYER_TYPE_CLIENT,
@@ -56,11 +58,36 @@ enum {
     BLENDING_DIM      = 0x0805,
 };
 
+enum {
+    DAMAGE_UNKNOWN = 0,
+    DAMAGE_REGION,
+    DAMAGE_ALL,
+};
+
+// layer attributes used in last composition.
+struct LayerState
+{
+    Memory* handle;
+    int zorder;
+    int transform;
+    int blendMode;
+    int planeAlpha;
+    int color;
+    int dataspace;
+    Rect sourceCrop;
+    Rect displayFrame;
+    Rect visibleBounds;
+};
+
 class Layer
 {
 public:
     Layer();
     bool isSolidColor();
+    // save current attributes as composed state.
+    void saveState();
+    // check whether geometry or color changed since last composition.
+    bool isGeometryChanged();
 
     bool busy;
     int zorder;
@@ -71,13 +98,23 @@ public:
     int blendMode;
     int planeAlpha;
     int color;
+    // HAL dataspace of buffer, 0 if unknown.
+    int dataspace;
     Rect sourceCrop;
     Rect displayFrame;
     Region visibleRegion;
+    // surface damage in source buffer coordinates.
+    Region surfaceDamage;
+    int damageState;
+    // layer is composed by 2D engine in last frame.
+    bool composed;
+    LayerState lastState;
     int acquireFence;
     int releaseFence;
     int index;
     void* priv;
+    // stream of sideband layer, its frames are latched by display.
+    SidebandStream* sideband;
 };
 
 class LayerVector : public SortedVector<Layer*> {
@@ -26,7 +26,7 @@ Memory::Memory(MemoryDesc* desc, int fd)
     format(desc->mFormat), stride(desc->mStride),
     usage(desc->mProduceUsage), pid(getpid()),
     fslFormat(desc->mFslFormat), kmsFd(-1),
-    fbHandle(0), fbId(0)
+    fbHandle(0), fbId(0), mapCount(0), planeOffsets(0)
 {
     version = sizeof(native_handle);
     numInts = sNumInts();
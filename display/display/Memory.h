@@ -37,6 +37,10 @@ enum {
     USAGE_HW_COMPOSER = 0x00000800,
     /* buffer will be used with the HW video encoder */
     USAGE_HW_VIDEO_ENCODER = 0x00010000,
+    /* buffer will be written by the HW camera pipeline */
+    USAGE_HW_CAMERA_WRITE = 0x00020000,
+    /* camera buffer asked for overlay scanout */
+    USAGE_CAMERA_SCANOUT = USAGE_HW_CAMERA_WRITE | USAGE_HW_COMPOSER,
     /* buffer size of hantro decoder is not to yuv pixel size, it need to
     * pad some bytes for vpu usage, so add this flag */
     USAGE_PADDING_BUFFER = 0x80000000,
@@ -47,6 +51,14 @@ enum {
     FLAGS_ALLOCATION_ION = 0x00000010,
     FLAGS_ALLOCATION_GPU = 0x00000020,
     FLAGS_WRAP_GPU       = 0x00000040,
+    /* memory is never shared out of process, ION pool recycles it */
+    FLAGS_PRIVATE        = 0x00000080,
+    /* memory is in vivante super tiled layout */
+    FLAGS_SUPERTILED     = 0x00000100,
+    /* memory from uncached dma-buf heap, no cache maintenance */
+    FLAGS_UNCACHED       = 0x00000200,
+    /* memory from scatter-gather heap, it has no physical address */
+    FLAGS_SCATTER_GATHER = 0x00000400,
     FLAGS_CAMERA         = 0x00100000,
     FLAGS_VIDEO          = 0x00200000,
     FLAGS_UI             = 0x00400000,
@@ -85,7 +97,10 @@ struct Memory : public native_handle
     int kmsFd;
     uint32_t fbHandle;
     uint32_t fbId;
-    uint64_t fsl_reserved[2] __attribute__((aligned(8)));
+    /* count of CPU locks, memory is mapped on first one. */
+    uint64_t mapCount __attribute__((aligned(8)));
+    /* yuv chroma offsets set at allocation, cb in low 32 bits, cr in high. */
+    uint64_t planeOffsets __attribute__((aligned(8)));
 
     /* pointer to viv private. */
     uint64_t viv_reserved[4] __attribute__((aligned(8)));
@@ -36,6 +36,7 @@ enum {
     FORMAT_NV21  = 0x11, // NV21
     FORMAT_YUYV  = 0x14, // YUY2
     FORMAT_I420  = 0x101,
+    FORMAT_UYVY  = 0x102,
     FORMAT_NV12  = 0x103,
 };
 
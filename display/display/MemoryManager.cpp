@@ -18,13 +18,18 @@
 #include <sys/mman.h>
 #include <cutils/log.h>
 #include <cutils/properties.h>
-#include <xf86drm.h>
-#include <xf86drmMode.h>
 #include "MemoryManager.h"
+#include "Tunables.h"
 
 namespace fsl {
 
 #define GPU_MODULE_ID "gralloc_viv"
+// allocations of one descriptor closer than this are one burst.
+#define PREFETCH_BURST_NS   (200 * 1000000LL)
+// prefetched memory not taken by then is released.
+#define PREFETCH_EXPIRE_NS  (2000 * 1000000LL)
+// most buffers queued and prefetched at a time.
+#define PREFETCH_MAX        8
 
 MemoryManager* MemoryManager::sInstance(0);
 Mutex MemoryManager::sLock(Mutex::PRIVATE);
@@ -42,6 +47,7 @@ MemoryManager* MemoryManager::getInstance()
 }
 
 MemoryManager::MemoryManager()
+    : mPrefetchLock(Mutex::PRIVATE), mBurstTime(0), mBurstCount(0)
 {
     mIonManager = new IonManager();
 
@@ -61,6 +67,20 @@ MemoryManager::MemoryManager()
 
 MemoryManager::~MemoryManager()
 {
+    if (mPrefetchThread != NULL) {
+        mPrefetchThread->requestExit();
+        {
+            Mutex::Autolock _l(mPrefetchLock);
+            mPrefetchQueue.clear();
+            mPrefetchCondition.broadcast();
+        }
+        mPrefetchThread->join();
+    }
+    for (size_t i=0; i<mPrefetched.size(); i++) {
+        releaseMemory(mPrefetched[i].memory);
+    }
+    mPrefetched.clear();
+
     if (mIonManager != NULL) {
         delete mIonManager;
     }
@@ -76,7 +96,9 @@ bool MemoryManager::isDrmAlloc(int flags, int format, int usage)
     /* The following conditions decide allocator.
      * 1) framebuffer should use ION.
      * 2) Hantro VPU needs special size should use ION.
-     * 3) other conditions can use DRM Gralloc.
+     * 3) camera yuv for overlay scanout should use ION, contiguous
+     *    with the packed stride of MemoryDesc camera writes.
+     * 4) other conditions can use DRM Gralloc.
     */
     if (flags & FLAGS_FRAMEBUFFER) {
         canHandle = false;
@@ -88,11 +110,62 @@ bool MemoryManager::isDrmAlloc(int flags, int format, int usage)
          (usage & USAGE_PADDING_BUFFER)) {
         canHandle = false;
     }
+    else if (((format == FORMAT_NV12) || (format == FORMAT_NV21) ||
+         (format == FORMAT_NV16) || (format == FORMAT_YUYV)) &&
+         (usage & USAGE_CAMERA_SCANOUT) == USAGE_CAMERA_SCANOUT) {
+        canHandle = false;
+    }
 
     return canHandle;
 }
 
+// chroma plane layout of ion memory, so that flex locks just add base.
+static void setPlaneOffsets(Memory* handle)
+{
+    uint64_t luma = (uint64_t)handle->stride * handle->height;
+    uint64_t chroma = (uint64_t)(handle->stride / 2) * (handle->height / 2);
+    uint64_t cb = 0, cr = 0;
+
+    switch (handle->fslFormat) {
+        case FORMAT_NV12:
+            cb = luma;
+            cr = luma + 1;
+            break;
+        case FORMAT_NV21:
+            cr = luma;
+            cb = luma + 1;
+            break;
+        case FORMAT_I420:
+            cb = luma;
+            cr = luma + chroma;
+            break;
+        case FORMAT_YV12:
+            cr = luma;
+            cb = luma + chroma;
+            break;
+        default:
+            return;
+    }
+
+    handle->planeOffsets = (cr << 32) | cb;
+}
+
 int MemoryManager::allocMemory(MemoryDesc& desc, Memory** out)
+{
+    if (!canPrefetch(desc)) {
+        return allocNewMemory(desc, out);
+    }
+
+    MemoryDesc key = desc;
+    observeAllocation(key);
+    if (takePrefetched(desc, out)) {
+        return 0;
+    }
+
+    return allocNewMemory(desc, out);
+}
+
+int MemoryManager::allocNewMemory(MemoryDesc& desc, Memory** out)
 {
     Memory *handle = NULL;
     int ret = 0;
@@ -115,12 +188,175 @@ int MemoryManager::allocMemory(MemoryDesc& desc, Memory** out)
         return -EINVAL;
     }
 
+    setPlaneOffsets(handle);
     retainMemory(handle);
     *out = handle;
 
     return 0;
 }
 
+static bool isSameDesc(const MemoryDesc& a, const MemoryDesc& b)
+{
+    return a.mFlag == b.mFlag && a.mWidth == b.mWidth &&
+           a.mHeight == b.mHeight && a.mFormat == b.mFormat &&
+           a.mFslFormat == b.mFslFormat &&
+           a.mProduceUsage == b.mProduceUsage &&
+           a.mConsumeUsage == b.mConsumeUsage;
+}
+
+bool MemoryManager::canPrefetch(const MemoryDesc& desc)
+{
+    // private memory is pooled already, GPU allocator is only used
+    // from caller thread.
+    if (desc.mFlag & (FLAGS_PRIVATE | FLAGS_FRAMEBUFFER)) {
+        return false;
+    }
+    if (isDrmAlloc(desc.mFlag, desc.mFormat, desc.mProduceUsage)) {
+        return false;
+    }
+
+    Tunables tunables;
+    TunableManager::getInstance()->getTunables(&tunables);
+    return tunables.mAllocPrefetch > 0;
+}
+
+bool MemoryManager::takePrefetched(MemoryDesc& desc, Memory** out)
+{
+    Mutex::Autolock _l(mPrefetchLock);
+    for (size_t i=0; i<mPrefetched.size(); i++) {
+        if (isSameDesc(mPrefetched[i].key, desc)) {
+            desc = mPrefetched[i].desc;
+            *out = mPrefetched[i].memory;
+            mPrefetched.removeAt(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MemoryManager::observeAllocation(const MemoryDesc& key)
+{
+    nsecs_t now = systemTime(CLOCK_MONOTONIC);
+    Mutex::Autolock _l(mPrefetchLock);
+    if (mBurstCount > 0 && isSameDesc(mBurstDesc, key) &&
+        now - mBurstTime < PREFETCH_BURST_NS) {
+        mBurstCount++;
+    }
+    else {
+        mBurstDesc = key;
+        mBurstCount = 1;
+    }
+    mBurstTime = now;
+
+    // buffer queue allocates its slots one after another.
+    if (mBurstCount == 2) {
+        Tunables tunables;
+        TunableManager::getInstance()->getTunables(&tunables);
+        queuePrefetchLocked(key, tunables.mAllocPrefetch);
+    }
+}
+
+void MemoryManager::prefetchMemory(const MemoryDesc& desc, int count)
+{
+    if (count <= 0 || !canPrefetch(desc)) {
+        return;
+    }
+
+    Mutex::Autolock _l(mPrefetchLock);
+    queuePrefetchLocked(desc, count);
+}
+
+void MemoryManager::queuePrefetchLocked(const MemoryDesc& desc, int count)
+{
+    for (int i=0; i<count; i++) {
+        if (mPrefetchQueue.size() + mPrefetched.size() >= PREFETCH_MAX) {
+            break;
+        }
+        mPrefetchQueue.add(desc);
+    }
+
+    if (mPrefetchThread == NULL) {
+        mPrefetchThread = new PrefetchThread(this);
+    }
+    mPrefetchCondition.signal();
+}
+
+MemoryManager::PrefetchThread::PrefetchThread(MemoryManager *ctx)
+    : Thread(false), mCtx(ctx)
+{
+}
+
+void MemoryManager::PrefetchThread::onFirstRef()
+{
+    run("Gralloc-Prefetch", android::PRIORITY_DEFAULT);
+}
+
+int32_t MemoryManager::PrefetchThread::readyToRun()
+{
+    return 0;
+}
+
+bool MemoryManager::PrefetchThread::threadLoop()
+{
+    MemoryDesc desc;
+    Vector<Memory*> expired;
+    bool pending = false;
+
+    { // scope for lock
+        Mutex::Autolock _l(mCtx->mPrefetchLock);
+        while (mCtx->mPrefetchQueue.isEmpty() && !exitPending()) {
+            nsecs_t now = systemTime(CLOCK_MONOTONIC);
+            nsecs_t next = 0;
+            for (ssize_t i=mCtx->mPrefetched.size()-1; i>=0; i--) {
+                const PrefetchEntry& entry = mCtx->mPrefetched[i];
+                if (entry.expire <= now) {
+                    expired.add(entry.memory);
+                    mCtx->mPrefetched.removeAt(i);
+                }
+                else if (next == 0 || entry.expire < next) {
+                    next = entry.expire;
+                }
+            }
+            if (!expired.isEmpty()) {
+                break;
+            }
+
+            if (next == 0) {
+                mCtx->mPrefetchCondition.wait(mCtx->mPrefetchLock);
+            }
+            else {
+                mCtx->mPrefetchCondition.waitRelative(mCtx->mPrefetchLock,
+                                                      next - now);
+            }
+        }
+
+        if (!mCtx->mPrefetchQueue.isEmpty()) {
+            desc = mCtx->mPrefetchQueue[0];
+            mCtx->mPrefetchQueue.removeAt(0);
+            pending = true;
+        }
+    }
+
+    // prediction was wrong, give memory back.
+    for (size_t i=0; i<expired.size(); i++) {
+        mCtx->releaseMemory(expired[i]);
+    }
+
+    if (pending) {
+        PrefetchEntry entry;
+        entry.key = desc;
+        entry.desc = desc;
+        if (mCtx->allocNewMemory(entry.desc, &entry.memory) == 0) {
+            entry.expire = systemTime(CLOCK_MONOTONIC) + PREFETCH_EXPIRE_NS;
+            Mutex::Autolock _l(mCtx->mPrefetchLock);
+            mCtx->mPrefetched.add(entry);
+        }
+    }
+
+    return true;
+}
+
 int MemoryManager::retainMemory(Memory* handle)
 {
     if (handle == NULL || !handle->isValid()) {
@@ -132,11 +368,34 @@ int MemoryManager::retainMemory(Memory* handle)
         return mGPUModule->registerBuffer(mGPUModule, handle);
     }
 
-    mIonManager->getVaddrs(handle);
+    // CPU mapping is created on first lock with CPU usage,
+    // except memory often accessed by CPU through base directly.
+    handle->base = 0;
+    handle->mapCount = 0;
+    if (handle->usage & (USAGE_SW_READ_OFTEN | USAGE_SW_WRITE_OFTEN)) {
+        mIonManager->getVaddrs(handle);
+    }
 
     return 0;
 }
 
+void MemoryManager::addListener(MemoryListener* listener)
+{
+    Mutex::Autolock _l(mListenerLock);
+    mListeners.add(listener);
+}
+
+void MemoryManager::removeListener(MemoryListener* listener)
+{
+    Mutex::Autolock _l(mListenerLock);
+    for (size_t i=0; i<mListeners.size(); i++) {
+        if (mListeners[i] == listener) {
+            mListeners.removeAt(i);
+            break;
+        }
+    }
+}
+
 int MemoryManager::releaseMemory(Memory* handle)
 {
     if (handle == NULL || !handle->isValid()) {
@@ -144,30 +403,28 @@ int MemoryManager::releaseMemory(Memory* handle)
         return -EINVAL;
     }
 
-    if (isDrmAlloc(handle->flags, handle->format, handle->usage)) {
-        return mGPUAlloc->free(mGPUAlloc, handle);
-    }
-
-    /* kmsFd, fbHandle and fbId are created in KmsDisplay.
-     * It is hard to put free memory code to KmsDisplay.
+    /* framebuffer ids are cached in KmsDisplay,
+     * let it release them before memory is freed.
     */
-    if (handle->kmsFd > 0) {
-        if (handle->fbId != 0) {
-            drmModeRmFB(handle->kmsFd, handle->fbId);
-        }
-        if (handle->fbHandle != 0) {
-            struct drm_gem_close gem_close;
-            memset(&gem_close, 0, sizeof(gem_close));
-            gem_close.handle = handle->fbHandle;
-            drmIoctl(handle->kmsFd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+    {
+        Mutex::Autolock _l(mListenerLock);
+        for (size_t i=0; i<mListeners.size(); i++) {
+            mListeners[i]->onMemoryRelease(handle);
         }
     }
 
+    if (isDrmAlloc(handle->flags, handle->format, handle->usage)) {
+        return mGPUAlloc->free(mGPUAlloc, handle);
+    }
+
     if (handle->base != 0) {
         munmap((void*)handle->base, handle->size);
     }
 
-    close(handle->fd);
+    // pool owns fd of recycled memory.
+    if (!mIonManager->recycleMemory(handle)) {
+        close(handle->fd);
+    }
     delete handle;
 
     return 0;
@@ -209,6 +466,20 @@ int MemoryManager::lockYCbCr(Memory* handle, int usage,
         return -EINVAL;
     }
 
+    if (handle->planeOffsets != 0) {
+        uint32_t cb = (uint32_t)handle->planeOffsets;
+        uint32_t cr = (uint32_t)(handle->planeOffsets >> 32);
+        // semi-planar chroma is interleaved with step 2.
+        bool interleaved = (cb + 1 == cr) || (cr + 1 == cb);
+        ycbcr->ystride = handle->stride;
+        ycbcr->cstride = interleaved ? handle->stride : handle->stride / 2;
+        ycbcr->chroma_step = interleaved ? 2 : 1;
+        ycbcr->y = (void*)handle->base;
+        ycbcr->cb = (void*)(handle->base + cb);
+        ycbcr->cr = (void*)(handle->base + cr);
+        return 0;
+    }
+
     switch (handle->fslFormat) {
         case FORMAT_NV12:
             ycbcr->ystride = handle->stride;
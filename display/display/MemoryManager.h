@@ -19,12 +19,38 @@
 #define _FSL_MEMORY_MANAGER_H
 
 #include <hardware/gralloc.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
 #include "Memory.h"
 #include "MemoryDesc.h"
 #include "IonManager.h"
 
 namespace fsl {
 
+using android::Vector;
+using android::Thread;
+using android::Condition;
+using android::sp;
+
+// memory allocated ahead for next allocation of the same descriptor.
+struct PrefetchEntry
+{
+    // descriptor as asked, and as filled by allocation.
+    MemoryDesc key;
+    MemoryDesc desc;
+    Memory* memory;
+    nsecs_t expire;
+};
+
+// notified before memory is released.
+class MemoryListener
+{
+public:
+    virtual ~MemoryListener() {}
+    virtual void onMemoryRelease(Memory* handle) = 0;
+};
+
 class MemoryManager
 {
 public:
@@ -36,6 +62,9 @@ public:
     int allocMemory(MemoryDesc& desc, Memory** out);
     // release memory interface.
     int releaseMemory(Memory* handle);
+    // allocate count buffers of desc in background, next allocations of
+    // the same descriptor take them, unused ones are released later.
+    void prefetchMemory(const MemoryDesc& desc, int count);
 
     // keep memory reference and import it.
     int retainMemory(Memory* handle);
@@ -50,15 +79,53 @@ public:
     // unlock memory after CPU access.
     int unlock(Memory* handle);
 
+    // add/remove listener of memory release.
+    void addListener(MemoryListener* listener);
+    void removeListener(MemoryListener* listener);
+
 protected:
     MemoryManager();
     bool isDrmAlloc(int flags, int format, int usage);
 
+private:
+    int allocNewMemory(MemoryDesc& desc, Memory** out);
+    bool canPrefetch(const MemoryDesc& desc);
+    bool takePrefetched(MemoryDesc& desc, Memory** out);
+    // second allocation of a descriptor in a burst predicts a buffer queue.
+    void observeAllocation(const MemoryDesc& key);
+    void queuePrefetchLocked(const MemoryDesc& desc, int count);
+
+    class PrefetchThread : public Thread {
+    public:
+        explicit PrefetchThread(MemoryManager *ctx);
+
+    private:
+        virtual void onFirstRef();
+        virtual int32_t readyToRun();
+        virtual bool threadLoop();
+
+        MemoryManager *mCtx;
+    };
+
 private:
     IonManager *mIonManager;
     alloc_device_t *mGPUAlloc;
     gralloc_module_t* mGPUModule;
 
+    Mutex mListenerLock;
+    Vector<MemoryListener*> mListeners;
+
+    // prefetch thread allocates queued descriptors, allocation takes
+    // prefetched memory, thread releases it after expire.
+    Mutex mPrefetchLock;
+    Condition mPrefetchCondition;
+    Vector<MemoryDesc> mPrefetchQueue;
+    Vector<PrefetchEntry> mPrefetched;
+    sp<PrefetchThread> mPrefetchThread;
+    MemoryDesc mBurstDesc;
+    nsecs_t mBurstTime;
+    int mBurstCount;
+
 private:
     static Mutex sLock;
     static MemoryManager* sInstance;
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <cutils/log.h>
+
+#include "MemoryDesc.h"
+#include "MemoryManager.h"
+#include "SidebandStream.h"
+
+namespace fsl {
+
+SidebandStream::SidebandStream()
+  : mHandle(NULL), mControl(NULL), mEventFd(-1), mCount(0),
+    mLatched(-1), mCommitted(-1), mShown(-1), mSequence(0)
+{
+    memset(mFrames, 0, sizeof(mFrames));
+}
+
+SidebandStream::~SidebandStream()
+{
+    // framebuffers cached by display are dropped with frames.
+    MemoryManager* manager = MemoryManager::getInstance();
+    for (uint32_t i=0; i<mCount; i++) {
+        if (mFrames[i] != NULL) {
+            manager->releaseMemory(mFrames[i]);
+        }
+    }
+
+    if (mControl != NULL) {
+        __atomic_store_n(&mControl->busy, 0, __ATOMIC_SEQ_CST);
+        munmap(mControl, sizeof(*mControl));
+    }
+    if (mEventFd >= 0) {
+        close(mEventFd);
+    }
+}
+
+SidebandStream* SidebandStream::create(const native_handle_t* handle)
+{
+    if (handle == NULL || handle->numFds <= SIDEBAND_BUFFER_FD ||
+        handle->numFds - SIDEBAND_BUFFER_FD > SIDEBAND_MAX_BUFFERS) {
+        ALOGE("%s invalid handle", __func__);
+        return NULL;
+    }
+
+    void* addr = mmap(NULL, sizeof(struct sideband_control),
+                      PROT_READ | PROT_WRITE, MAP_SHARED,
+                      handle->data[SIDEBAND_CONTROL_FD], 0);
+    if (addr == MAP_FAILED) {
+        ALOGE("%s map control failed", __func__);
+        return NULL;
+    }
+
+    struct sideband_control* control = (struct sideband_control*)addr;
+    uint32_t count = handle->numFds - SIDEBAND_BUFFER_FD;
+    if (control->magic != SIDEBAND_MAGIC || control->count != count ||
+        control->width <= 0 || control->height <= 0 ||
+        (control->format != FORMAT_NV12 && control->format != FORMAT_YUYV)) {
+        ALOGE("%s invalid stream control", __func__);
+        munmap(addr, sizeof(*control));
+        return NULL;
+    }
+
+    SidebandStream* stream = new SidebandStream();
+    stream->mHandle = handle;
+    stream->mControl = control;
+    stream->mEventFd = dup(handle->data[SIDEBAND_EVENT_FD]);
+    if (stream->mEventFd >= 0) {
+        // events are drained without blocking, producer only writes.
+        int flags = fcntl(stream->mEventFd, F_GETFL);
+        fcntl(stream->mEventFd, F_SETFL, flags | O_NONBLOCK);
+    }
+    for (uint32_t i=0; i<count; i++) {
+        // HAL format of NV12 and YUYV is the same value as fsl format.
+        MemoryDesc desc;
+        desc.mFlag = FLAGS_CAMERA;
+        desc.mWidth = control->width;
+        desc.mHeight = control->height;
+        desc.mFormat = control->format;
+        desc.mFslFormat = control->format;
+        desc.mProduceUsage = USAGE_CAMERA_SCANOUT;
+        if (desc.checkFormat() != 0) {
+            delete stream;
+            return NULL;
+        }
+        if (control->stride > 0) {
+            desc.mStride = control->stride;
+        }
+
+        Memory* memory = new Memory(&desc,
+                                    handle->data[SIDEBAND_BUFFER_FD + i]);
+        memory->phys = control->phys[i];
+        stream->mFrames[i] = memory;
+        stream->mCount++;
+    }
+    __atomic_store_n(&control->busy, 0, __ATOMIC_SEQ_CST);
+
+    ALOGI("%s %dx%d format:0x%x buffers:%d", __func__, control->width,
+          control->height, control->format, count);
+    return stream;
+}
+
+void SidebandStream::clearEvents()
+{
+    uint64_t count = 0;
+    if (read(mEventFd, &count, sizeof(count)) < 0) {
+        ALOGV("%s read event failed", __func__);
+    }
+}
+
+bool SidebandStream::hasNewFrame()
+{
+    return __atomic_load_n(&mControl->sequence, __ATOMIC_SEQ_CST) !=
+           mSequence;
+}
+
+void SidebandStream::updateBusy()
+{
+    uint32_t busy = 0;
+    if (mLatched >= 0) {
+        busy |= 1U << mLatched;
+    }
+    if (mCommitted >= 0) {
+        busy |= 1U << mCommitted;
+    }
+    if (mShown >= 0) {
+        busy |= 1U << mShown;
+    }
+    __atomic_store_n(&mControl->busy, busy, __ATOMIC_SEQ_CST);
+}
+
+Memory* SidebandStream::latchFrame()
+{
+    while (true) {
+        int32_t latest = __atomic_load_n(&mControl->latest, __ATOMIC_SEQ_CST);
+        uint32_t sequence = __atomic_load_n(&mControl->sequence,
+                                            __ATOMIC_SEQ_CST);
+        if (latest < 0 || (uint32_t)latest >= mCount) {
+            break;
+        }
+
+        mLatched = latest;
+        updateBusy();
+        // producer may have taken it before busy bit was set.
+        if (__atomic_load_n(&mControl->latest, __ATOMIC_SEQ_CST) == latest) {
+            mSequence = sequence;
+            break;
+        }
+    }
+
+    return (mLatched >= 0) ? mFrames[mLatched] : NULL;
+}
+
+void SidebandStream::onCommit()
+{
+    // last commit completed before this one, its frame is on screen.
+    mShown = mCommitted;
+    mCommitted = mLatched;
+    updateBusy();
+}
+
+}
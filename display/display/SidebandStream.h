@@ -0,0 +1,66 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FSL_SIDEBAND_STREAM_H_
+#define _FSL_SIDEBAND_STREAM_H_
+
+#include <cutils/native_handle.h>
+#include <sideband_ext.h>
+
+#include "Memory.h"
+
+namespace fsl {
+
+// consumer side of sideband stream, see sideband_ext.h.
+// called with display lock held.
+class SidebandStream
+{
+public:
+    // import stream handle, NULL if it's invalid.
+    static SidebandStream* create(const native_handle_t* handle);
+    ~SidebandStream();
+
+    // stream handle set by SurfaceFlinger.
+    const native_handle_t* handle() {return mHandle;}
+    // readable when producer queues a frame.
+    int eventFd() {return mEventFd;}
+    // drain frame events of event fd.
+    void clearEvents();
+    // producer queued a frame after last latch.
+    bool hasNewFrame();
+    // hold newest frame for next commit, NULL before first frame.
+    Memory* latchFrame();
+    // latched frame is committed, frame on screen before is released.
+    void onCommit();
+
+private:
+    SidebandStream();
+    void updateBusy();
+
+    const native_handle_t* mHandle;
+    struct sideband_control* mControl;
+    int mEventFd;
+    uint32_t mCount;
+    Memory* mFrames[SIDEBAND_MAX_BUFFERS];
+    // frames held by composer, -1 if none.
+    int32_t mLatched;
+    int32_t mCommitted;
+    int32_t mShown;
+    uint32_t mSequence;
+};
+
+}
+#endif
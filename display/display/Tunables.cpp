@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+#include <hal_config_ext.h>
+#include <latency_mark_ext.h>
+
+#include "Tunables.h"
+
+namespace fsl {
+
+TunableManager* TunableManager::sInstance(0);
+Mutex TunableManager::sLock(Mutex::PRIVATE);
+
+TunableManager* TunableManager::getInstance()
+{
+    Mutex::Autolock _l(sLock);
+    if (sInstance != NULL) {
+        return sInstance;
+    }
+
+    sInstance = new TunableManager();
+
+    return sInstance;
+}
+
+TunableManager::TunableManager()
+    : mLock(Mutex::PRIVATE), mSerial(0)
+{
+    Mutex::Autolock _l(mLock);
+    hal_config_changed(&mSerial);
+    loadLocked();
+}
+
+void TunableManager::loadLocked()
+{
+    // product config file sets these, property of same name overrides.
+    mTunables.mEnableOverlay = hal_config_get_bool("hwc.enable.overlay", 1) != 0;
+    mTunables.mG2dBatch = hal_config_get_bool("hwc.g2d.batch", 1) != 0;
+    mTunables.mPresentAsync = hal_config_get_bool("hwc.present.async", 1) != 0;
+    mTunables.mPresentLatch = hal_config_get_bool("hwc.present.latch", 1) != 0;
+    hal_config_get("hwc.drm.device", mTunables.mDrmDevice, "/dev/dri");
+    mTunables.mIonPoolSize = (size_t)hal_config_get_int("hwc.ion.pool.size", 64)
+                             * 1024 * 1024;
+    mTunables.mIonSgHeapMask = (unsigned int)hal_config_get_int("hwc.ion.sg.heap", 0);
+    mTunables.mDmaHeap = hal_config_get_bool("hwc.dma.heap", 1) != 0;
+    mTunables.mAllocPrefetch = (int)hal_config_get_int("hwc.alloc.prefetch", 0);
+    mTunables.mIdleFrames = (int)hal_config_get_int("hwc.idle.frames", 60);
+    mTunables.mRenderHeight = (int)hal_config_get_int("hwc.render.height", 0);
+    mTunables.mContentRate = hal_config_get_bool("hwc.content.rate", 1) != 0;
+    mTunables.mVsyncPriority = (int)hal_config_get_int("hwc.vsync.priority", 2);
+    mTunables.mVsyncCpus = (uint32_t)hal_config_get_int("hwc.vsync.cpus", 0);
+    mTunables.mHotplugCpus = (uint32_t)hal_config_get_int("hwc.hotplug.cpus", 0);
+    mTunables.mLatencyMark = hal_config_get_bool(LATENCY_MARK_PROP, 0) != 0;
+}
+
+void setThreadPolicy(int priority, uint32_t cpus)
+{
+    if (priority > 0) {
+        int max = sched_get_priority_max(SCHED_FIFO);
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = (priority < max) ? priority : max;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            ALOGW("%s set SCHED_FIFO %d failed:%d", __func__, priority, err);
+        }
+    }
+
+    if (cpus != 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i=0; i<32; i++) {
+            if (cpus & (1U << i)) {
+                CPU_SET(i, &set);
+            }
+        }
+        // mask without online cpu fails, thread stays on any cpu.
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            ALOGW("%s set cpus 0x%x failed:%d", __func__, cpus, errno);
+        }
+    }
+}
+
+void TunableManager::getTunables(Tunables* out)
+{
+    Mutex::Autolock _l(mLock);
+    // area serial changes whenever any property is set.
+    if (hal_config_changed(&mSerial)) {
+        ALOGV("property changed, reload tunables");
+        loadLocked();
+    }
+
+    if (out != NULL) {
+        *out = mTunables;
+    }
+}
+
+}
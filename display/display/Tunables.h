@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FSL_TUNABLES_H_
+#define _FSL_TUNABLES_H_
+
+#include <cutils/properties.h>
+#include <utils/threads.h>
+
+namespace fsl {
+
+using android::Mutex;
+
+// snapshot of hwc.* tunables, from product config file or properties.
+struct Tunables
+{
+    // hwc.enable.overlay
+    bool mEnableOverlay;
+    // hwc.g2d.batch
+    bool mG2dBatch;
+    // hwc.present.async
+    bool mPresentAsync;
+    // hwc.present.latch, async present starts composition at predicted
+    // time before next vblank.
+    bool mPresentLatch;
+    // hwc.drm.device
+    char mDrmDevice[PROPERTY_VALUE_MAX];
+    // hwc.ion.pool.size in MB, bytes here.
+    size_t mIonPoolSize;
+    // hwc.ion.sg.heap, ion heap mask of scatter-gather memory for
+    // buffers used only by GPU and CPU, 0 takes all from CMA.
+    unsigned int mIonSgHeapMask;
+    // hwc.dma.heap, allocate from /dev/dma_heap when kernel has it,
+    // read once at start, 0 keeps legacy ion.
+    bool mDmaHeap;
+    // hwc.alloc.prefetch, buffers allocated ahead when a descriptor is
+    // allocated twice in a burst. prefetched buffers hold CMA until
+    // taken or expired, so it is off by default.
+    int mAllocPrefetch;
+    // hwc.idle.frames, frames without present before refresh rate
+    // is lowered, 0 disables it.
+    int mIdleFrames;
+    // hwc.render.height, 2D composition of taller display renders at
+    // this height and plane scales it up under load, 0 disables it.
+    int mRenderHeight;
+    // hwc.content.rate, refresh rate follows cadence of full screen
+    // video when nothing else changes.
+    bool mContentRate;
+    // hwc.vsync.priority, SCHED_FIFO priority of vsync threads,
+    // 0 keeps them at normal policy.
+    int mVsyncPriority;
+    // hwc.vsync.cpus and hwc.hotplug.cpus, cpu mask of threads,
+    // e.g. 0x30 for one cluster, 0 runs them on any cpu.
+    uint32_t mVsyncCpus;
+    uint32_t mHotplugCpus;
+    // LATENCY_MARK_PROP, capture time marked in camera buffers is
+    // taken back at flip of frames showing them.
+    bool mLatencyMark;
+};
+
+// set SCHED_FIFO priority and cpu mask of calling thread,
+// 0 keeps normal policy or any cpu.
+void setThreadPolicy(int priority, uint32_t cpus);
+
+class TunableManager
+{
+public:
+    static TunableManager* getInstance();
+
+    // get tunables, reloaded only after any property changed.
+    void getTunables(Tunables* out);
+
+protected:
+    TunableManager();
+    void loadLocked();
+
+private:
+    Mutex mLock;
+    uint32_t mSerial;
+    Tunables mTunables;
+
+private:
+    static Mutex sLock;
+    static TunableManager* sInstance;
+};
+
+}
+#endif
@@ -27,6 +27,7 @@
 #include <sync/sync.h>
 
 #include "VirtualDisplay.h"
+#include "DisplayManager.h"
 
 namespace fsl {
 
@@ -67,4 +68,67 @@ void VirtualDisplay::setBusy(bool busy)
     mBusy = busy;
 }
 
+int VirtualDisplay::setRenderTarget(Memory* buffer, int acquireFence)
+{
+    int ret = Display::setRenderTarget(buffer, acquireFence);
+    Display* primary = DisplayManager::getInstance()->getPhysicalDisplay(
+                                        DISPLAY_PRIMARY);
+
+    bool mirror = false;
+    {
+        Mutex::Autolock _l(mLock);
+        mirror = ret == 0 && primary != NULL && buffer != NULL &&
+                 isMirrorLocked(primary);
+    }
+
+    // output buffer comes before frames are presented, so primary
+    // writes it back as part of its own commit of this frame.
+    if (mirror) {
+        primary->queueWriteback(buffer, acquireFence);
+    }
+
+    return ret;
+}
+
+int VirtualDisplay::composeLayers()
+{
+    Display* primary = DisplayManager::getInstance()->getPhysicalDisplay(
+                                        DISPLAY_PRIMARY);
+
+    Memory* target = NULL;
+    {
+        Mutex::Autolock _l(mLock);
+        target = mRenderTarget;
+    }
+
+    // primary may not have committed this frame yet, e.g. it is
+    // presented after this display, then layers are composed here.
+    int fence = -1;
+    if (primary == NULL || target == NULL ||
+        primary->takeWriteback(target, &fence) != 0) {
+        Mutex::Autolock _l(mLock);
+        return composeLayersLocked();
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (mRenderTarget != target || !isMirrorLocked(primary)) {
+        // layers changed since output buffer was set, 2D engine writes
+        // it after writeback.
+        sync_wait(fence, -1);
+        close(fence);
+        return composeLayersLocked();
+    }
+
+    // layers are not read by 2D engine, only wait their buffers.
+    waitOnFenceLocked();
+    resetDamageLocked();
+    mCachedTarget = NULL;
+    if (mPresentFence != -1) {
+        close(mPresentFence);
+    }
+    // consumer of output buffer waits writeback done.
+    mPresentFence = fence;
+    return 0;
+}
+
 }
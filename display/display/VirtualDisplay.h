@@ -47,6 +47,11 @@ public:
     void reset();
     bool busy();
     void setBusy(bool busy);
+    // primary writes its frame back into buffer when it shows the same
+    // layers.
+    virtual int setRenderTarget(Memory* buffer, int acquireFence);
+    // take frame from writeback of primary, else compose layers.
+    virtual int composeLayers();
 
 private:
     bool mBusy;
@@ -0,0 +1,427 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// device composition of synthetic layer stacks,
+// usage: compose_bench [-p] [frames]
+// layers are composed into an offscreen target of a virtual display of
+// primary size. -p presents on primary display instead, it needs
+// surfaceflinger stopped.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Timers.h>
+#include "DisplayManager.h"
+#include "Display.h"
+#include "Layer.h"
+#include "Memory.h"
+#include "MemoryDesc.h"
+#include "MemoryManager.h"
+
+using namespace fsl;
+
+#define BENCH_FRAMES 300
+#define BENCH_WARMUP 10
+#define BENCH_MAX_BUFFERS 16
+#define BENCH_TILE_SIZE 128
+
+enum {
+    STAGE_VERIFY = 0,
+    STAGE_COMPOSE,
+    STAGE_COMMIT,
+    STAGE_FRAME,
+    STAGE_NUM,
+};
+
+static const char* sStageNames[STAGE_NUM] = {
+    "verify", "compose", "commit", "frame",
+};
+
+enum {
+    STACK_FULLSCREEN = 0,
+    STACK_TILES,
+    STACK_VIDEO,
+    STACK_DIM,
+};
+
+struct BenchStack
+{
+    const char* name;
+    int kind;
+    // layers above opaque background.
+    int count;
+};
+
+static const BenchStack sStacks[] = {
+    {"fullscreen-2", STACK_FULLSCREEN, 1},
+    {"fullscreen-4", STACK_FULLSCREEN, 3},
+    {"fullscreen-6", STACK_FULLSCREEN, 5},
+    {"tiles-16", STACK_TILES, 16},
+    {"tiles-48", STACK_TILES, 48},
+    {"video-rot90", STACK_VIDEO, 1},
+    {"dim-dialog", STACK_DIM, 1},
+};
+
+struct BenchContext
+{
+    Display* display;
+    bool physical;
+    int width;
+    int height;
+    // output of virtual display.
+    Memory* target;
+    Memory* buffers[BENCH_MAX_BUFFERS];
+    int bufferNum;
+    Layer* layers[MAX_LAYERS];
+    int layerNum;
+};
+
+static int compareSample(const void* lhs, const void* rhs)
+{
+    nsecs_t l = *(const nsecs_t*)lhs;
+    nsecs_t r = *(const nsecs_t*)rhs;
+    return (l > r) - (l < r);
+}
+
+static Memory* allocBuffer(int width, int height, int format)
+{
+    MemoryDesc desc;
+    desc.mWidth = width;
+    desc.mHeight = height;
+    desc.mFormat = format;
+    desc.mFslFormat = format;
+    desc.mProduceUsage |= USAGE_HW_COMPOSER | USAGE_HW_2D |
+                          USAGE_HW_TEXTURE | USAGE_HW_RENDER;
+    if (desc.checkFormat() != 0) {
+        return NULL;
+    }
+
+    Memory* memory = NULL;
+    if (MemoryManager::getInstance()->allocMemory(desc, &memory) != 0) {
+        return NULL;
+    }
+
+    return memory;
+}
+
+static Memory* addBuffer(BenchContext* ctx, int width, int height, int format)
+{
+    if (ctx->bufferNum >= BENCH_MAX_BUFFERS) {
+        return NULL;
+    }
+
+    Memory* memory = allocBuffer(width, height, format);
+    if (memory != NULL) {
+        ctx->buffers[ctx->bufferNum++] = memory;
+    }
+
+    return memory;
+}
+
+static Layer* addLayer(BenchContext* ctx, Memory* buffer, const Rect& frame,
+                       int blendMode)
+{
+    if (ctx->layerNum >= MAX_LAYERS - 1) {
+        return NULL;
+    }
+
+    Layer* layer = ctx->display->getFreeLayer();
+    if (layer == NULL) {
+        return NULL;
+    }
+
+    layer->origType = buffer != NULL ? LAYER_TYPE_DEVICE
+                                     : LAYER_TYPE_SOLID_COLOR;
+    layer->handle = buffer;
+    layer->zorder = ctx->layerNum;
+    layer->transform = 0;
+    layer->blendMode = blendMode;
+    layer->planeAlpha = 0xff;
+    if (buffer != NULL) {
+        layer->sourceCrop = Rect(buffer->width, buffer->height);
+    }
+    layer->displayFrame = frame;
+    layer->visibleRegion = Region(frame);
+    layer->acquireFence = -1;
+    ctx->layers[ctx->layerNum++] = layer;
+
+    return layer;
+}
+
+static void releaseStack(BenchContext* ctx)
+{
+    for (int i = 0; i < ctx->layerNum; i++) {
+        ctx->display->releaseLayer(ctx->layers[i]->index);
+    }
+    ctx->layerNum = 0;
+
+    for (int i = 0; i < ctx->bufferNum; i++) {
+        MemoryManager::getInstance()->releaseMemory(ctx->buffers[i]);
+    }
+    ctx->bufferNum = 0;
+}
+
+static int buildStack(BenchContext* ctx, const BenchStack& stack)
+{
+    int width = ctx->width, height = ctx->height;
+    Rect screen(width, height);
+
+    Memory* background = addBuffer(ctx, width, height, FORMAT_RGBX8888);
+    if (background == NULL ||
+        addLayer(ctx, background, screen, BLENDING_NONE) == NULL) {
+        return -ENOMEM;
+    }
+
+    switch (stack.kind) {
+        case STACK_FULLSCREEN:
+            // app windows stacked over wallpaper.
+            for (int i = 0; i < stack.count; i++) {
+                Memory* buffer = addBuffer(ctx, width, height, FORMAT_RGBA8888);
+                if (buffer == NULL ||
+                    addLayer(ctx, buffer, screen, BLENDING_PREMULT) == NULL) {
+                    return -ENOMEM;
+                }
+            }
+            break;
+
+        case STACK_TILES: {
+            // icons of launcher grid, one buffer for all tiles.
+            Memory* tile = addBuffer(ctx, BENCH_TILE_SIZE, BENCH_TILE_SIZE,
+                                     FORMAT_RGBA8888);
+            if (tile == NULL) {
+                return -ENOMEM;
+            }
+            int columns = width / BENCH_TILE_SIZE;
+            for (int i = 0; i < stack.count; i++) {
+                int x = (i % columns) * BENCH_TILE_SIZE;
+                int y = (i / columns) * BENCH_TILE_SIZE % height;
+                Rect frame(x, y, x + BENCH_TILE_SIZE, y + BENCH_TILE_SIZE);
+                if (addLayer(ctx, tile, frame, BLENDING_PREMULT) == NULL) {
+                    return -ENOMEM;
+                }
+            }
+            break;
+        }
+
+        case STACK_VIDEO: {
+            // portrait 1080p video on landscape screen, UI controls above.
+            Memory* video = addBuffer(ctx, 1920, 1080, FORMAT_NV12);
+            if (video == NULL) {
+                return -ENOMEM;
+            }
+            int frameWidth = height * 1080 / 1920;
+            int left = (width - frameWidth) / 2;
+            Layer* layer = addLayer(ctx, video,
+                    Rect(left, 0, left + frameWidth, height), BLENDING_NONE);
+            if (layer == NULL) {
+                return -ENOMEM;
+            }
+            layer->transform = TRANSFORM_ROT90;
+
+            Memory* controls = addBuffer(ctx, width, height / 8,
+                                         FORMAT_RGBA8888);
+            if (controls == NULL ||
+                addLayer(ctx, controls,
+                         Rect(0, height - height / 8, width, height),
+                         BLENDING_PREMULT) == NULL) {
+                return -ENOMEM;
+            }
+            break;
+        }
+
+        case STACK_DIM: {
+            // half transparent black behind a dialog.
+            Layer* dim = addLayer(ctx, NULL, screen, BLENDING_DIM);
+            if (dim == NULL) {
+                return -ENOMEM;
+            }
+            dim->color = 0x80000000;
+
+            Memory* dialog = addBuffer(ctx, width / 2, height / 2,
+                                       FORMAT_RGBA8888);
+            if (dialog == NULL ||
+                addLayer(ctx, dialog,
+                         Rect(width / 4, height / 4,
+                              width * 3 / 4, height * 3 / 4),
+                         BLENDING_PREMULT) == NULL) {
+                return -ENOMEM;
+            }
+            break;
+        }
+
+        default:
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+static void printStage(const char* stack, const char* stage,
+                       nsecs_t* samples, int count)
+{
+    qsort(samples, count, sizeof(nsecs_t), compareSample);
+    printf("%-14s %-8s p50=%8.1fus p90=%8.1fus p99=%8.1fus max=%8.1fus\n",
+           stack, stage,
+           samples[count / 2] / 1000.0f,
+           samples[(count * 90) / 100] / 1000.0f,
+           samples[(count * 99) / 100] / 1000.0f,
+           samples[count - 1] / 1000.0f);
+}
+
+static void runStack(BenchContext* ctx, const BenchStack& stack, int frames)
+{
+    if (buildStack(ctx, stack) != 0) {
+        printf("%-14s setup failed\n", stack.name);
+        releaseStack(ctx);
+        return;
+    }
+
+    nsecs_t* samples[STAGE_NUM];
+    for (int i = 0; i < STAGE_NUM; i++) {
+        samples[i] = (nsecs_t*)calloc(frames, sizeof(nsecs_t));
+    }
+
+    Display* display = ctx->display;
+    int count = 0;
+    bool fallback = false;
+    for (int i = -BENCH_WARMUP; i < frames; i++) {
+        // every buffer changes, composition cache can't skip frames.
+        for (int n = 0; n < ctx->layerNum; n++) {
+            ctx->layers[n]->damageState = DAMAGE_ALL;
+        }
+
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (!display->verifyLayers()) {
+            fallback = true;
+            break;
+        }
+        nsecs_t verified = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        if (!ctx->physical) {
+            display->setRenderTarget(ctx->target, -1);
+        }
+        // composition waits G2D, it is blit time of the frame.
+        display->composeLayers();
+        nsecs_t composed = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        if (ctx->physical) {
+            int32_t fence = -1;
+            display->updateScreen();
+            display->getPresentFence(&fence);
+            if (fence != -1) {
+                close(fence);
+            }
+        }
+        nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        if (i < 0) {
+            continue;
+        }
+        samples[STAGE_VERIFY][count] = verified - start;
+        samples[STAGE_COMPOSE][count] = composed - verified;
+        samples[STAGE_COMMIT][count] = end - composed;
+        samples[STAGE_FRAME][count] = end - start;
+        count++;
+    }
+
+    if (fallback) {
+        // G2D can't compose stack, e.g. no rotation on this SoC.
+        printf("%-14s layers=%d needs client composition\n",
+               stack.name, ctx->layerNum);
+    }
+    else if (count > 0) {
+        printf("%-14s layers=%d buffers=%d frames=%d\n",
+               stack.name, ctx->layerNum, ctx->bufferNum, count);
+        for (int i = 0; i < STAGE_NUM; i++) {
+            if (i == STAGE_COMMIT && !ctx->physical) {
+                continue;
+            }
+            printStage(stack.name, sStageNames[i], samples[i], count);
+        }
+    }
+
+    for (int i = 0; i < STAGE_NUM; i++) {
+        free(samples[i]);
+    }
+    releaseStack(ctx);
+}
+
+int main(int argc, char** argv)
+{
+    BenchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    int frames = BENCH_FRAMES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0) {
+            ctx.physical = true;
+        }
+        else {
+            frames = atoi(argv[i]);
+        }
+    }
+    if (frames <= 0) {
+        frames = BENCH_FRAMES;
+    }
+
+    DisplayManager* manager = DisplayManager::getInstance();
+    Display* primary = manager->getPhysicalDisplay(DISPLAY_PRIMARY);
+    if (primary == NULL || primary->getActiveId() < 0) {
+        fprintf(stderr, "primary display is not available\n");
+        return 1;
+    }
+    const DisplayConfig& config = primary->getConfig(primary->getActiveId());
+    ctx.width = config.mXres;
+    ctx.height = config.mYres;
+
+    int format = FORMAT_RGBA8888;
+    VirtualDisplay* virtualDisplay = NULL;
+    if (ctx.physical) {
+        ctx.display = primary;
+        primary->setPowerMode(POWER_ON);
+    }
+    else {
+        virtualDisplay = manager->createVirtualDisplay();
+        if (virtualDisplay == NULL) {
+            fprintf(stderr, "can't create virtual display\n");
+            return 1;
+        }
+        virtualDisplay->setConfig(ctx.width, ctx.height, &format);
+        ctx.display = virtualDisplay;
+        ctx.target = allocBuffer(ctx.width, ctx.height, format);
+        if (ctx.target == NULL) {
+            fprintf(stderr, "can't allocate render target\n");
+            manager->destroyVirtualDisplay(virtualDisplay->index());
+            return 1;
+        }
+    }
+
+    printf("%s %dx%d frames=%d\n", ctx.physical ? "primary" : "virtual",
+           ctx.width, ctx.height, frames);
+    for (size_t i = 0; i < sizeof(sStacks) / sizeof(sStacks[0]); i++) {
+        runStack(&ctx, sStacks[i], frames);
+    }
+
+    if (virtualDisplay != NULL) {
+        manager->destroyVirtualDisplay(virtualDisplay->index());
+        MemoryManager::getInstance()->releaseMemory(ctx.target);
+    }
+
+    return 0;
+}
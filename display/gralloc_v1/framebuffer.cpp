@@ -18,6 +18,7 @@
 #include <sys/mman.h>
 
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include <cutils/ashmem.h>
 #include <cutils/log.h>
@@ -39,6 +40,8 @@
 #endif
 #include <linux/mxcfb.h>
 
+#include <hal_config_ext.h>
+
 #include "gralloc_priv.h"
 #include "gr.h"
 
@@ -51,8 +54,13 @@
 #define USE_PAN_DISPLAY 0
 #endif
 
-// numbers of buffers for page flipping
-#define NUM_BUFFERS 3
+// numbers of buffers for page flipping, hwc.fb.buffers of product
+// config sets 2 to save memory or 4 to absorb longer GPU frames.
+#define NUM_BUFFERS_PROP "hwc.fb.buffers"
+#define NUM_BUFFERS_DEFAULT 3
+#define NUM_BUFFERS_MAX 4
+// posts waiting for pan, one buffer is on screen and one is rendered.
+#define POST_QUEUE_MAX (NUM_BUFFERS_MAX - 2)
 #define EPDC_WAITTIME_MS 300000
 #define EPDC_WAITCOUNT 10
 #define FB_NAME_PATH "/sys/class/graphics/fb0/name"
@@ -66,6 +74,17 @@ enum {
 struct fb_context_t {
     framebuffer_device_t  device;
     bool epdc_display;
+    // post thread pans queued buffers at vblank, fb_post only waits
+    // when all posts are queued.
+    pthread_t post_thread;
+    pthread_mutex_t post_lock;
+    pthread_cond_t post_cond;
+    bool post_thread_started;
+    bool post_exit;
+    buffer_handle_t post_queue[POST_QUEUE_MAX];
+    int post_size;
+    int post_head;
+    int post_count;
 };
 
 static bool isEPDCDisplay()
@@ -172,6 +191,61 @@ static int fb_setUpdateRect(struct framebuffer_device_t* dev,
     return 0;
 }
 
+static int fb_pan(fb_context_t* ctx, buffer_handle_t buffer)
+{
+    private_handle_t const* hnd = reinterpret_cast<private_handle_t const*>(buffer);
+    private_module_t* m = reinterpret_cast<private_module_t*>(
+            ctx->device.common.module);
+
+    const size_t offset = hnd->base - m->framebuffer->base;
+    m->info.activate = FB_ACTIVATE_VBL;
+    m->info.yoffset = offset / m->finfo.line_length;
+    if (ioctl(m->framebuffer->fd, FBIOPAN_DISPLAY, &m->info) == -1) {
+        ALOGE("FBIOPAN_DISPLAY failed");
+        m->base.unlock(&m->base, buffer);
+        return -errno;
+    }
+
+    // Update EPDC with mode, and waveform setting
+    if (ctx->epdc_display == true)
+        update_to_display(m, 0, 0,
+                m->info.xres, m->info.yres,
+                WAVEFORM_MODE_AUTO, 1, 0);
+
+    m->currentBuffer = buffer;
+    return 0;
+}
+
+static void* fb_post_thread(void* arg)
+{
+    fb_context_t* ctx = (fb_context_t*)arg;
+    buffer_handle_t buffer;
+
+    pthread_mutex_lock(&ctx->post_lock);
+    while (true) {
+        while (ctx->post_count == 0 && !ctx->post_exit)
+            pthread_cond_wait(&ctx->post_cond, &ctx->post_lock);
+        // queued posts are still shown before exit.
+        if (ctx->post_count == 0)
+            break;
+
+        buffer = ctx->post_queue[ctx->post_head];
+        pthread_mutex_unlock(&ctx->post_lock);
+
+        // pan waits for vblank, buffer stays queued until it is on screen,
+        // so back buffers are handed out again in post order.
+        fb_pan(ctx, buffer);
+
+        pthread_mutex_lock(&ctx->post_lock);
+        ctx->post_head = (ctx->post_head + 1) % ctx->post_size;
+        ctx->post_count--;
+        pthread_cond_broadcast(&ctx->post_cond);
+    }
+    pthread_mutex_unlock(&ctx->post_lock);
+
+    return NULL;
+}
+
 static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
 {
     if (private_handle_t::validate(buffer) < 0)
@@ -183,24 +257,16 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
     private_module_t* m = reinterpret_cast<private_module_t*>(
             dev->common.module);
     if (hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) {
-	    int wave_mode = WAVEFORM_MODE_AUTO;
-        const size_t offset = hnd->base - m->framebuffer->base;
-        m->info.activate = FB_ACTIVATE_VBL;
-        m->info.yoffset = offset / m->finfo.line_length;
-        if (ioctl(m->framebuffer->fd, FBIOPAN_DISPLAY, &m->info) == -1) {
-            ALOGE("FBIOPUT_VSCREENINFO failed");
-            m->base.unlock(&m->base, buffer); 
-            return -errno;
-        }
-
-        // Update EPDC with mode, and waveform setting
-        if (ctx->epdc_display == true)
-            update_to_display(m, 0, 0,
-                    m->info.xres, m->info.yres,
-                    WAVEFORM_MODE_AUTO, 1, 0);
-
-        m->currentBuffer = buffer;
-        
+        if (!ctx->post_thread_started)
+            return fb_pan(ctx, buffer);
+
+        pthread_mutex_lock(&ctx->post_lock);
+        while (ctx->post_count == ctx->post_size)
+            pthread_cond_wait(&ctx->post_cond, &ctx->post_lock);
+        ctx->post_queue[(ctx->post_head + ctx->post_count) % ctx->post_size] = buffer;
+        ctx->post_count++;
+        pthread_cond_broadcast(&ctx->post_cond);
+        pthread_mutex_unlock(&ctx->post_lock);
     } else {
         // If we can't do the page_flip, just copy the buffer to the front 
         // FIXME: use copybit HAL instead of memcpy
@@ -269,9 +335,15 @@ int mapFrameBufferLocked(struct private_module_t* module)
     info.activate = FB_ACTIVATE_NOW;
 
     /*
-     * Request NUM_BUFFERS screens (at lest 2 for page flipping)
+     * Request configured screens (at lest 2 for page flipping)
      */
-    info.yres_virtual = info.yres * NUM_BUFFERS;
+    int numBuffers = (int)hal_config_get_int(NUM_BUFFERS_PROP, NUM_BUFFERS_DEFAULT);
+    if (numBuffers < 2 || numBuffers > NUM_BUFFERS_MAX) {
+        ALOGW("%s %d out of range, use %d", NUM_BUFFERS_PROP, numBuffers,
+              NUM_BUFFERS_DEFAULT);
+        numBuffers = NUM_BUFFERS_DEFAULT;
+    }
+    info.yres_virtual = info.yres * numBuffers;
 
 
     uint32_t flags = PAGE_FLIP;
@@ -408,6 +480,15 @@ static int fb_close(struct hw_device_t *dev)
 {
     fb_context_t* ctx = (fb_context_t*)dev;
     if (ctx) {
+        if (ctx->post_thread_started) {
+            pthread_mutex_lock(&ctx->post_lock);
+            ctx->post_exit = true;
+            pthread_cond_broadcast(&ctx->post_cond);
+            pthread_mutex_unlock(&ctx->post_lock);
+            pthread_join(ctx->post_thread, NULL);
+        }
+        pthread_cond_destroy(&ctx->post_cond);
+        pthread_mutex_destroy(&ctx->post_lock);
         free(ctx);
     }
     return 0;
@@ -434,9 +515,21 @@ int fb_device_open(hw_module_t const* module, const char* name,
         if(isEPDCDisplay())
             dev->epdc_display = true;
 
+        pthread_mutex_init(&dev->post_lock, NULL);
+        pthread_cond_init(&dev->post_cond, NULL);
+
         private_module_t* m = (private_module_t*)module;
         status = mapFrameBuffer(m);
         if (status >= 0) {
+            // with two buffers the next one drawn is on screen until pan,
+            // so post waits for it.
+            dev->post_size = m->numBuffers - 2;
+            if (dev->post_size > POST_QUEUE_MAX)
+                dev->post_size = POST_QUEUE_MAX;
+            if (m->numBuffers > 2 &&
+                pthread_create(&dev->post_thread, NULL, fb_post_thread, dev) == 0)
+                dev->post_thread_started = true;
+
             int stride = m->finfo.line_length / (m->info.bits_per_pixel >> 3);
             int format = (m->info.bits_per_pixel == 32)
                          ? (m->info.red.offset ? HAL_PIXEL_FORMAT_BGRA_8888 : HAL_PIXEL_FORMAT_RGBX_8888)
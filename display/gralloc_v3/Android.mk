@@ -37,3 +37,21 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 endif
+
+ifeq ($(TARGET_GRALLOC_VERSION),v3)
+include $(CLEAR_VARS)
+LOCAL_SHARED_LIBRARIES := liblog libcutils libhardware libutils
+
+LOCAL_SRC_FILES :=  \
+    gralloc_bench.cpp
+
+LOCAL_C_INCLUDES += system/core/include/
+
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE := gralloc_bench
+LOCAL_CFLAGS:= -DLOG_TAG=\"gralloc_bench\"
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+endif
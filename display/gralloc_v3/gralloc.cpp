@@ -84,6 +84,22 @@ int convertAndroidFormat(int format)
     return fslFormat;
 }
 
+// keep hardware usage of memory, take CPU access from lock request.
+static int getLockUsage(Memory* memory, uint64_t produceUsage,
+                        uint64_t consumeUsage)
+{
+    int usage = memory->usage & ~(USAGE_SW_READ_OFTEN | USAGE_SW_WRITE_OFTEN);
+    if ((produceUsage & GRALLOC1_PRODUCER_USAGE_CPU_READ_OFTEN) != 0 ||
+        (consumeUsage & GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN) != 0) {
+        usage |= USAGE_SW_READ_OFTEN;
+    }
+    if ((produceUsage & GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN) != 0) {
+        usage |= USAGE_SW_WRITE_OFTEN;
+    }
+
+    return usage;
+}
+
 static int gralloc_unlock(gralloc1_device_t* device,
                    buffer_handle_t buffer,
                    int32_t* outReleaseFence)
@@ -120,9 +136,9 @@ static int gralloc_unlock(gralloc1_device_t* device,
 
 static int gralloc_lock(gralloc1_device_t* device,
                    buffer_handle_t buffer,
-                   uint64_t /*produceUsage*/,
-                   uint64_t /*consumeUsage*/,
-                   const gralloc1_rect_t* /*accessRegion*/,
+                   uint64_t produceUsage,
+                   uint64_t consumeUsage,
+                   const gralloc1_rect_t* accessRegion,
                    void** outData,
                    int32_t acquireFence)
 {
@@ -148,7 +164,17 @@ static int gralloc_lock(gralloc1_device_t* device,
         return -EINVAL;
     }
 
-    int ret = pManager->lock(memory, memory->usage, 0, 0, memory->width, memory->height, outData);
+    int l = 0, t = 0, w = memory->width, h = memory->height;
+    if (accessRegion != NULL && accessRegion->width > 0 &&
+        accessRegion->height > 0) {
+        l = accessRegion->left;
+        t = accessRegion->top;
+        w = accessRegion->width;
+        h = accessRegion->height;
+    }
+
+    int usage = getLockUsage(memory, produceUsage, consumeUsage);
+    int ret = pManager->lock(memory, usage, l, t, w, h, outData);
     if (ret != 0) {
         ALOGE("%s lock memory failed", __func__);
         return GRALLOC1_ERROR_NO_RESOURCES;
@@ -197,8 +223,8 @@ static int gralloc_get_num_flex_planes(gralloc1_device_t* /*device*/,
 
 static int gralloc_lock_flex(gralloc1_device_t* /*device*/,
                    buffer_handle_t buffer,
-                   uint64_t /*produceUsage*/,
-                   uint64_t /*consumeUsage*/,
+                   uint64_t produceUsage,
+                   uint64_t consumeUsage,
                    const gralloc1_rect_t* /*accessRegion*/,
                    struct android_flex_layout* layout,
                    int32_t acquireFence)
@@ -225,7 +251,8 @@ static int gralloc_lock_flex(gralloc1_device_t* /*device*/,
     }
 
     android_ycbcr ycbcr;
-    int ret = pManager->lockYCbCr(memory, memory->usage, 0, 0, memory->width, memory->height, &ycbcr);
+    int usage = getLockUsage(memory, produceUsage, consumeUsage);
+    int ret = pManager->lockYCbCr(memory, usage, 0, 0, memory->width, memory->height, &ycbcr);
     if (ret != 0) {
         ALOGE("%s lock memory failed", __func__);
         return GRALLOC1_ERROR_NO_RESOURCES;
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// gralloc1 latency benchmark, usage: gralloc_bench [iterations]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <hardware/hardware.h>
+#include <hardware/gralloc1.h>
+#include <utils/Timers.h>
+
+#define BENCH_ITERATIONS 100
+#define BENCH_RING_MAX 16
+// buddy orders of at least 64KB with 4KB pages count as unfragmented.
+#define BENCH_BUDDY_ORDER 4
+#define BENCH_BUDDY_ORDERS 11
+
+enum {
+    OP_ALLOCATE = 0,
+    OP_LOCK,
+    OP_UNLOCK,
+    OP_RELEASE,
+    OP_NUM,
+};
+
+static const char* sOpNames[OP_NUM] = {
+    "allocate", "lock", "unlock", "release",
+};
+
+struct BenchCase
+{
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+    int32_t format;
+    uint64_t produceUsage;
+    uint64_t consumeUsage;
+    // buffers held at the same time, like a BufferQueue ring.
+    int ring;
+    bool cpuAccess;
+};
+
+static const BenchCase sCases[] = {
+    {"ui-rgba-1080p", 1920, 1080, HAL_PIXEL_FORMAT_RGBA_8888,
+     GRALLOC1_PRODUCER_USAGE_GPU_RENDER_TARGET,
+     GRALLOC1_CONSUMER_USAGE_HWCOMPOSER | GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE,
+     3, false},
+    {"ui-rgba-cpu", 1280, 720, HAL_PIXEL_FORMAT_RGBA_8888,
+     GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN,
+     GRALLOC1_CONSUMER_USAGE_GPU_TEXTURE, 3, true},
+    {"camera-nv12-1080p", 1920, 1080, HAL_PIXEL_FORMAT_YCbCr_420_SP,
+     GRALLOC1_PRODUCER_USAGE_CAMERA | GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN,
+     GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN, 8, true},
+    {"video-nv12-4k", 3840, 2160, HAL_PIXEL_FORMAT_YCbCr_420_SP,
+     GRALLOC1_PRODUCER_USAGE_VIDEO_DECODER,
+     GRALLOC1_CONSUMER_USAGE_HWCOMPOSER, 6, false},
+};
+
+struct Gralloc1
+{
+    gralloc1_device_t* device;
+    GRALLOC1_PFN_CREATE_DESCRIPTOR createDescriptor;
+    GRALLOC1_PFN_DESTROY_DESCRIPTOR destroyDescriptor;
+    GRALLOC1_PFN_SET_DIMENSIONS setDimensions;
+    GRALLOC1_PFN_SET_FORMAT setFormat;
+    GRALLOC1_PFN_SET_PRODUCER_USAGE setProducerUsage;
+    GRALLOC1_PFN_SET_CONSUMER_USAGE setConsumerUsage;
+    GRALLOC1_PFN_ALLOCATE allocate;
+    GRALLOC1_PFN_LOCK lock;
+    GRALLOC1_PFN_UNLOCK unlock;
+    GRALLOC1_PFN_RELEASE release;
+};
+
+struct OpStats
+{
+    nsecs_t* samples;
+    int count;
+    int failures;
+};
+
+static int openGralloc(Gralloc1* gralloc)
+{
+    const hw_module_t* module = NULL;
+    int ret = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module);
+    if (ret != 0) {
+        fprintf(stderr, "can't load gralloc module: %d\n", ret);
+        return ret;
+    }
+
+    ret = gralloc1_open(module, &gralloc->device);
+    if (ret != 0) {
+        fprintf(stderr, "can't open gralloc1 device: %d\n", ret);
+        return ret;
+    }
+
+    gralloc1_device_t* dev = gralloc->device;
+#define GET_FUNCTION(member, type, id) \
+    gralloc->member = (type)dev->getFunction(dev, id); \
+    if (gralloc->member == NULL) { \
+        fprintf(stderr, "gralloc1 misses %s\n", #id); \
+        return -EINVAL; \
+    }
+
+    GET_FUNCTION(createDescriptor, GRALLOC1_PFN_CREATE_DESCRIPTOR,
+                 GRALLOC1_FUNCTION_CREATE_DESCRIPTOR);
+    GET_FUNCTION(destroyDescriptor, GRALLOC1_PFN_DESTROY_DESCRIPTOR,
+                 GRALLOC1_FUNCTION_DESTROY_DESCRIPTOR);
+    GET_FUNCTION(setDimensions, GRALLOC1_PFN_SET_DIMENSIONS,
+                 GRALLOC1_FUNCTION_SET_DIMENSIONS);
+    GET_FUNCTION(setFormat, GRALLOC1_PFN_SET_FORMAT,
+                 GRALLOC1_FUNCTION_SET_FORMAT);
+    GET_FUNCTION(setProducerUsage, GRALLOC1_PFN_SET_PRODUCER_USAGE,
+                 GRALLOC1_FUNCTION_SET_PRODUCER_USAGE);
+    GET_FUNCTION(setConsumerUsage, GRALLOC1_PFN_SET_CONSUMER_USAGE,
+                 GRALLOC1_FUNCTION_SET_CONSUMER_USAGE);
+    GET_FUNCTION(allocate, GRALLOC1_PFN_ALLOCATE,
+                 GRALLOC1_FUNCTION_ALLOCATE);
+    GET_FUNCTION(lock, GRALLOC1_PFN_LOCK, GRALLOC1_FUNCTION_LOCK);
+    GET_FUNCTION(unlock, GRALLOC1_PFN_UNLOCK, GRALLOC1_FUNCTION_UNLOCK);
+    GET_FUNCTION(release, GRALLOC1_PFN_RELEASE, GRALLOC1_FUNCTION_RELEASE);
+#undef GET_FUNCTION
+
+    return 0;
+}
+
+// fraction of free pages in blocks below BENCH_BUDDY_ORDER.
+static float readFragmentation()
+{
+    FILE* fp = fopen("/proc/buddyinfo", "r");
+    if (fp == NULL) {
+        return -1.0f;
+    }
+
+    uint64_t total = 0, small = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char* p = strstr(line, "zone");
+        if (p == NULL) {
+            continue;
+        }
+        // skip "zone" and zone name.
+        p += strlen("zone");
+        while (*p == ' ') p++;
+        while (*p != ' ' && *p != '\0') p++;
+
+        for (int order=0; order<BENCH_BUDDY_ORDERS; order++) {
+            char* end = NULL;
+            uint64_t blocks = strtoull(p, &end, 10);
+            if (end == p) {
+                break;
+            }
+            p = end;
+            uint64_t pages = blocks << order;
+            total += pages;
+            if (order < BENCH_BUDDY_ORDER) {
+                small += pages;
+            }
+        }
+    }
+    fclose(fp);
+
+    return (total == 0) ? 0.0f : (float)small / total;
+}
+
+static int compareSample(const void* lhs, const void* rhs)
+{
+    nsecs_t l = *(const nsecs_t*)lhs;
+    nsecs_t r = *(const nsecs_t*)rhs;
+    return (l > r) - (l < r);
+}
+
+static void record(OpStats* stats, nsecs_t start, int ret)
+{
+    if (ret != GRALLOC1_ERROR_NONE) {
+        stats->failures++;
+        return;
+    }
+    stats->samples[stats->count++] = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+}
+
+static void report(const char* name, OpStats* stats)
+{
+    if (stats->count == 0) {
+        printf("  %-10s no samples, %d failures\n", name, stats->failures);
+        return;
+    }
+
+    qsort(stats->samples, stats->count, sizeof(nsecs_t), compareSample);
+    int count = stats->count;
+    printf("  %-10s n=%-6d p50=%8.1fus p99=%8.1fus max=%8.1fus fail=%d\n",
+           name, count,
+           stats->samples[count / 2] / 1000.0f,
+           stats->samples[(count * 99) / 100] / 1000.0f,
+           stats->samples[count - 1] / 1000.0f, stats->failures);
+}
+
+static int runCase(Gralloc1* gralloc, const BenchCase& bench, int iterations)
+{
+    gralloc1_buffer_descriptor_t desc;
+    int ret = gralloc->createDescriptor(gralloc->device, &desc);
+    if (ret != GRALLOC1_ERROR_NONE) {
+        fprintf(stderr, "%s create descriptor failed\n", bench.name);
+        return ret;
+    }
+
+    gralloc->setDimensions(gralloc->device, desc, bench.width, bench.height);
+    gralloc->setFormat(gralloc->device, desc, bench.format);
+    gralloc->setProducerUsage(gralloc->device, desc, bench.produceUsage);
+    gralloc->setConsumerUsage(gralloc->device, desc, bench.consumeUsage);
+
+    OpStats stats[OP_NUM];
+    int samples = iterations * bench.ring;
+    for (int i=0; i<OP_NUM; i++) {
+        stats[i].samples = (nsecs_t*)calloc(samples, sizeof(nsecs_t));
+        stats[i].count = 0;
+        stats[i].failures = 0;
+    }
+
+    float fragBefore = readFragmentation();
+    buffer_handle_t ring[BENCH_RING_MAX];
+    int ringSize = bench.ring < BENCH_RING_MAX ? bench.ring : BENCH_RING_MAX;
+    for (int n=0; n<iterations; n++) {
+        memset(ring, 0, sizeof(ring));
+        for (int i=0; i<ringSize; i++) {
+            nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+            ret = gralloc->allocate(gralloc->device, 1, &desc, &ring[i]);
+            record(&stats[OP_ALLOCATE], start, ret);
+            if (ret != GRALLOC1_ERROR_NONE) {
+                ring[i] = NULL;
+            }
+        }
+
+        for (int i=0; i<ringSize && bench.cpuAccess; i++) {
+            if (ring[i] == NULL) {
+                continue;
+            }
+
+            void* vaddr = NULL;
+            gralloc1_rect_t rect = {0, 0, (int32_t)bench.width,
+                                    (int32_t)bench.height};
+            nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+            ret = gralloc->lock(gralloc->device, ring[i],
+                    bench.produceUsage & GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN,
+                    bench.consumeUsage & GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN,
+                    &rect, &vaddr, -1);
+            record(&stats[OP_LOCK], start, ret);
+            if (ret != GRALLOC1_ERROR_NONE) {
+                continue;
+            }
+
+            int32_t fence = -1;
+            start = systemTime(SYSTEM_TIME_MONOTONIC);
+            ret = gralloc->unlock(gralloc->device, ring[i], &fence);
+            record(&stats[OP_UNLOCK], start, ret);
+            if (fence >= 0) {
+                close(fence);
+            }
+        }
+
+        // release in rotating order so that frees interleave with holds.
+        for (int i=0; i<ringSize; i++) {
+            int index = (i + n) % ringSize;
+            if (ring[index] == NULL) {
+                continue;
+            }
+            nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+            ret = gralloc->release(gralloc->device, ring[index]);
+            record(&stats[OP_RELEASE], start, ret);
+        }
+    }
+    float fragAfter = readFragmentation();
+
+    printf("%s %ux%u format:%d ring:%d\n", bench.name, bench.width,
+           bench.height, bench.format, ringSize);
+    for (int i=0; i<OP_NUM; i++) {
+        bool cpuOp = (i == OP_LOCK || i == OP_UNLOCK);
+        if (!cpuOp || bench.cpuAccess) {
+            report(sOpNames[i], &stats[i]);
+        }
+        free(stats[i].samples);
+    }
+    if (fragBefore >= 0.0f) {
+        printf("  fragmentation %.3f -> %.3f\n", fragBefore, fragAfter);
+    }
+
+    gralloc->destroyDescriptor(gralloc->device, desc);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = BENCH_ITERATIONS;
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+        if (iterations <= 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    Gralloc1 gralloc;
+    memset(&gralloc, 0, sizeof(gralloc));
+    if (openGralloc(&gralloc) != 0) {
+        return 1;
+    }
+
+    for (size_t i=0; i<sizeof(sCases)/sizeof(sCases[0]); i++) {
+        runCase(&gralloc, sCases[i], iterations);
+    }
+
+    gralloc1_close(gralloc.device);
+    return 0;
+}
@@ -110,6 +110,10 @@ static int setLayer(hwc_layer_1_t* hwlayer, Layer* layer, int index)
     layer->zorder = index;
     layer->origType = getLayerType(hwlayer);
     layer->handle = (Memory*)(hwlayer->handle);
+    if (layer->origType == LAYER_TYPE_SIDEBAND) {
+        // sideband stream is not a buffer, streams are handled by hwc2.
+        layer->handle = NULL;
+    }
     layer->transform = hwlayer->transform;
     layer->blendMode = hwlayer->blending;
     layer->planeAlpha = hwlayer->planeAlpha;
@@ -132,7 +136,6 @@ static int setLayer(hwc_layer_1_t* hwlayer, Layer* layer, int index)
     layer->acquireFence = hwlayer->acquireFenceFd;
     hwlayer->acquireFenceFd = -1;
     layer->releaseFence = -1;
-    layer->priv = hwlayer;
 
     return 0;
 }
@@ -185,6 +188,7 @@ static int hwc_prepare(hwc_composer_device_1_t *dev,
                 return -ENOSR;
             }
             setLayer(hwlayer, layer, k);
+            display->setLayerPriv(layer, hwlayer);
         }
         if (!display->verifyLayers()) {
             ALOGV("pass to 3D to handle");
@@ -260,25 +264,44 @@ static int hwc_set(struct hwc_composer_device_1 *dev,
             continue;
         }
 
+        // acquire fences are only valid in set, display waits them
+        // right before composition instead of here.
         hwc_layer_1_t* hwlayer = NULL;
-        for (size_t k=0; k<list->numHwLayers-1; k++) {
+        Layer* layers[MAX_LAYERS];
+        size_t numLayers = list->numHwLayers - 1;
+        if (numLayers > MAX_LAYERS) {
+            numLayers = MAX_LAYERS;
+        }
+        for (size_t k=0; k<numLayers; k++) {
             hwlayer = &list->hwLayers[k];
-            if (hwlayer->acquireFenceFd != -1) {
-                sync_wait(hwlayer->acquireFenceFd, -1);
-                close(hwlayer->acquireFenceFd);
-                hwlayer->acquireFenceFd = -1;
+            Layer* layer = display->getLayerByPriv(hwlayer);
+            layers[k] = layer;
+            if (layer == NULL || layer->type != LAYER_TYPE_DEVICE) {
+                if (hwlayer->acquireFenceFd != -1) {
+                    close(hwlayer->acquireFenceFd);
+                    hwlayer->acquireFenceFd = -1;
+                }
+                continue;
+            }
+            if (layer->acquireFence != -1) {
+                close(layer->acquireFence);
             }
+            layer->acquireFence = hwlayer->acquireFenceFd;
+            hwlayer->acquireFenceFd = -1;
         }
 
         display->setRenderTarget(target, fenceFd);
-        display->composeLayers();
-        display->updateScreen();
-
-        // set release fence here.
-        for (size_t k=0; k<list->numHwLayers-1; k++) {
+        // composition may run in present thread of display.
+        int32_t presentFence = -1;
+        display->presentFrame(&presentFence);
+        list->retireFenceFd = presentFence;
+
+        // set release fence here, layers are looked up before present
+        // so that pending composition isn't waited for.
+        for (size_t k=0; k<numLayers; k++) {
             hwlayer = &list->hwLayers[k];
-            Layer* layer = display->getLayerByPriv(hwlayer);
-            if (layer->type == LAYER_TYPE_DEVICE) {
+            Layer* layer = layers[k];
+            if (layer != NULL && layer->type == LAYER_TYPE_DEVICE) {
                 hwlayer->releaseFenceFd = layer->releaseFence;
                 layer->releaseFence = -1;
             }
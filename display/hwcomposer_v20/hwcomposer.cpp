@@ -141,13 +141,25 @@ static int hwc2_set_layer_sideband_stream(hwc2_device_t* device, hwc2_display_t
         return HWC2_ERROR_BAD_PARAMETER;
     }
 
+    Display* pDisplay = NULL;
+    DisplayManager* displayManager = DisplayManager::getInstance();
+    pDisplay = displayManager->getDisplay(display);
+    if (pDisplay == NULL) {
+        ALOGE("%s invalid display id:%" PRId64, __func__, display);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
     Layer* pLayer = hwc2_get_layer(display, layer);
     if (pLayer == NULL) {
         ALOGE("%s get layer failed", __func__);
         return HWC2_ERROR_BAD_PARAMETER;
     }
 
-    pLayer->handle = (Memory*)stream;
+    // frames of stream are latched by display, not by SurfaceFlinger.
+    if (pDisplay->setSidebandStream(pLayer, stream) != 0) {
+        ALOGE("%s invalid sideband stream", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
 
     return HWC2_ERROR_NONE;
 }
@@ -193,9 +205,22 @@ static int hwc2_set_layer_display_frame(hwc2_device_t* device, hwc2_display_t di
     return HWC2_ERROR_NONE;
 }
 
-static int hwc2_set_layer_dataspace(hwc2_device_t* /*device*/, hwc2_display_t /*display*/,
-                                    hwc2_layer_t /*layer*/, int32_t /*dataspace*/)
+static int hwc2_set_layer_dataspace(hwc2_device_t* device, hwc2_display_t display,
+                                    hwc2_layer_t layer, int32_t dataspace)
 {
+    if (!device) {
+        ALOGE("%s invalid device", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    Layer* pLayer = hwc2_get_layer(display, layer);
+    if (pLayer == NULL) {
+        ALOGE("%s get layer failed", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    // yuv layers composed by 2D engine take matrix of dataspace.
+    pLayer->dataspace = dataspace;
     return HWC2_ERROR_NONE;
 }
 
@@ -263,9 +288,37 @@ static int hwc2_set_layer_blend_mode(hwc2_device_t* device, hwc2_display_t displ
     return HWC2_ERROR_NONE;
 }
 
-static int hwc2_set_layer_surface_dmage(hwc2_device_t* /*device*/, hwc2_display_t /*display*/,
-                                        hwc2_layer_t /*layer*/, hwc_region_t /*damage*/)
+static int hwc2_set_layer_surface_dmage(hwc2_device_t* device, hwc2_display_t display,
+                                        hwc2_layer_t layer, hwc_region_t damage)
 {
+    if (!device) {
+        ALOGE("%s invalid device", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    Layer* pLayer = hwc2_get_layer(display, layer);
+    if (pLayer == NULL) {
+        ALOGE("%s get layer failed", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    // no rect means whole buffer is modified.
+    pLayer->surfaceDamage.clear();
+    if (damage.numRects == 0) {
+        pLayer->damageState = DAMAGE_ALL;
+        return HWC2_ERROR_NONE;
+    }
+
+    for (size_t n=0; n<damage.numRects; n++) {
+        const hwc_rect_t &hrect = damage.rects[n];
+        Rect rect(hrect.left, hrect.top, hrect.right, hrect.bottom);
+        if (rect.isEmpty()) {
+            continue;
+        }
+        pLayer->surfaceDamage.orSelf(rect);
+    }
+    pLayer->damageState = DAMAGE_REGION;
+
     return HWC2_ERROR_NONE;
 }
 
@@ -294,10 +347,34 @@ static int hwc2_set_layer_buffer(hwc2_device_t* device, hwc2_display_t display,
     return HWC2_ERROR_NONE;
 }
 
-static int hwc2_set_cursor_position(hwc2_device_t* /*device*/, hwc2_display_t /*display*/,
-                                    hwc2_layer_t /*layer*/, int32_t /*x*/, int32_t /*y*/)
+static int hwc2_set_cursor_position(hwc2_device_t* device, hwc2_display_t display,
+                                    hwc2_layer_t layer, int32_t x, int32_t y)
 {
-    return HWC2_ERROR_UNSUPPORTED;
+    if (!device) {
+        ALOGE("%s invalid device", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    Display* pDisplay = NULL;
+    DisplayManager* displayManager = DisplayManager::getInstance();
+    pDisplay = displayManager->getDisplay(display);
+    if (pDisplay == NULL) {
+        ALOGE("%s invalid display id:%" PRId64, __func__, display);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    Layer* pLayer = pDisplay->getLayer(layer);
+    if (pLayer == NULL) {
+        ALOGE("%s get layer failed", __func__);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    // only layer on cursor plane can be moved without validate.
+    if (pDisplay->setCursorPosition(pLayer, x, y) != 0) {
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return HWC2_ERROR_NONE;
 }
 
 static int hwc2_validate_display(hwc2_device_t* device, hwc2_display_t display,
@@ -419,10 +496,35 @@ static int hwc2_set_output_buffer(hwc2_device_t* device, hwc2_display_t display,
     return HWC2_ERROR_NONE;
 }
 
-static int hwc2_set_color_transform(hwc2_device_t* /*device*/, hwc2_display_t /*display*/,
-                                    const float* /*matrix*/, int32_t /*hint*/)
+static int hwc2_set_color_transform(hwc2_device_t* device, hwc2_display_t display,
+                                    const float* matrix, int32_t hint)
 {
-    return HWC2_ERROR_UNSUPPORTED;
+    if (!device) {
+        ALOGE("%s invalid device", __func__);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    Display* pDisplay = NULL;
+    DisplayManager* displayManager = DisplayManager::getInstance();
+    pDisplay = displayManager->getDisplay(display);
+    if (pDisplay == NULL) {
+        ALOGE("%s invalid display id:%" PRId64, __func__, display);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    if (hint == HAL_COLOR_TRANSFORM_IDENTITY) {
+        matrix = NULL;
+    }
+    else if (matrix == NULL) {
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    // matrix is applied after composition, layers stay on device.
+    if (pDisplay->setColorTransform(matrix) != 0) {
+        return HWC2_ERROR_UNSUPPORTED;
+    }
+
+    return HWC2_ERROR_NONE;
 }
 
 static int hwc2_set_color_mode(hwc2_device_t* device, hwc2_display_t display,
@@ -546,11 +648,7 @@ static int hwc2_present_display(hwc2_device_t* device, hwc2_display_t display,
         return HWC2_ERROR_BAD_DISPLAY;
     }
 
-    pDisplay->composeLayers();
-    pDisplay->updateScreen();
-    if (outPresentFence != NULL) {
-        *outPresentFence = -1;
-    }
+    pDisplay->presentFrame(outPresentFence);
 
     struct hwc2_context_t *ctx = (struct hwc2_context_t*)device;
     if (ctx->checkHDMI && ctx->mHotplug != NULL && ctx->mVsync != NULL) {
@@ -1004,12 +1102,45 @@ static int hwc2_accept_display_changes(hwc2_device_t* device, hwc2_display_t dis
     return HWC2_ERROR_NONE;
 }
 
-static void hwc2_dump(struct hwc2_device* /*device*/,
-                      uint32_t* outSize, char* /*outBuffer*/)
+// dump is built on size query and copied out on the next call.
+static Mutex sDumpLock;
+static String8 sDumpString;
+
+static void hwc2_dump(struct hwc2_device* device,
+                      uint32_t* outSize, char* outBuffer)
 {
-    if (outSize != NULL) {
-        *outSize = 0;
+    if (!device || outSize == NULL) {
+        ALOGE("%s invalid parameters", __func__);
+        return;
+    }
+
+    Mutex::Autolock _l(sDumpLock);
+    if (outBuffer != NULL) {
+        if (*outSize == 0) {
+            return;
+        }
+        // dump grown since size query is cut, still NUL terminated.
+        uint32_t size = sDumpString.length() + 1;
+        if (size > *outSize) {
+            size = *outSize;
+        }
+        memcpy(outBuffer, sDumpString.string(), size - 1);
+        outBuffer[size - 1] = '\0';
+        *outSize = size;
+        return;
+    }
+
+    sDumpString.clear();
+    sDumpString.append("fsl hwcomposer:\n");
+    DisplayManager* displayManager = DisplayManager::getInstance();
+    for (int i=0; i<MAX_PHYSICAL_DISPLAY + MAX_VIRTUAL_DISPLAY; i++) {
+        Display* pDisplay = displayManager->getDisplay(i);
+        if (pDisplay == NULL) {
+            continue;
+        }
+        pDisplay->dump(sDumpString);
     }
+    *outSize = sDumpString.length() + 1;
 }
 
 static hwc2_function_pointer_t hwc_get_function(struct hwc2_device* device,
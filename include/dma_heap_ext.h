@@ -0,0 +1,72 @@
+/*
+ *   Copyright 2017 NXP
+ */
+
+#ifndef _DMA_HEAP_EXT_H
+#define _DMA_HEAP_EXT_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * dma-buf heaps of newer kernels, one char device per heap under
+ * /dev/dma_heap, allocation returns a dma-buf fd in a single ioctl.
+ * uapi headers of older toolchains lack these, ABI is stable.
+ */
+#define DMA_HEAP_PATH               "/dev/dma_heap/"
+
+struct dma_heap_allocation_data_ext {
+    __u64 len;
+    __u32 fd;
+    __u32 fd_flags;
+    __u64 heap_flags;
+};
+
+#define DMA_HEAP_IOC_MAGIC_EXT      'H'
+#define DMA_HEAP_IOCTL_ALLOC_EXT    _IOWR(DMA_HEAP_IOC_MAGIC_EXT, 0x0, \
+                                          struct dma_heap_allocation_data_ext)
+
+struct dma_buf_sync_ext {
+    __u64 flags;
+};
+
+#define DMA_BUF_SYNC_READ_EXT       (1 << 0)
+#define DMA_BUF_SYNC_WRITE_EXT      (2 << 0)
+#define DMA_BUF_SYNC_RW_EXT         (DMA_BUF_SYNC_READ_EXT | DMA_BUF_SYNC_WRITE_EXT)
+#define DMA_BUF_SYNC_START_EXT      (0 << 2)
+#define DMA_BUF_SYNC_END_EXT        (1 << 2)
+
+#define DMA_BUF_BASE_EXT            'b'
+#define DMA_BUF_IOCTL_SYNC_EXT      _IOW(DMA_BUF_BASE_EXT, 0, struct dma_buf_sync_ext)
+/* imx kernels: physical address of contiguous dma-buf. */
+#define DMA_BUF_IOCTL_PHYS_EXT      _IOW(DMA_BUF_BASE_EXT, 10, unsigned long)
+
+/* new dma-buf fd of size from heap device, -1 on failure. */
+static inline int dma_heap_alloc(int heap_fd, size_t size) {
+    struct dma_heap_allocation_data_ext data = {
+        .len = size, .fd = 0, .fd_flags = O_RDWR | O_CLOEXEC, .heap_flags = 0,
+    };
+
+    return ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC_EXT, &data) ? -1 : (int)data.fd;
+}
+
+static inline uint64_t dma_buf_phys(int dmafd) {
+    unsigned long phys = 0;
+
+    return ioctl(dmafd, DMA_BUF_IOCTL_PHYS_EXT, &phys) ? 0 : phys;
+}
+
+/* write back and invalidate CPU cache of whole dma-buf. */
+static inline int dma_buf_sync(int dmafd) {
+    struct dma_buf_sync_ext sync = { .flags = DMA_BUF_SYNC_START_EXT | DMA_BUF_SYNC_RW_EXT };
+
+    if (ioctl(dmafd, DMA_BUF_IOCTL_SYNC_EXT, &sync))
+        return -1;
+    sync.flags = DMA_BUF_SYNC_END_EXT | DMA_BUF_SYNC_RW_EXT;
+    return ioctl(dmafd, DMA_BUF_IOCTL_SYNC_EXT, &sync);
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ *   Copyright 2017 NXP
+ */
+
+#ifndef _HAL_CONFIG_EXT_H
+#define _HAL_CONFIG_EXT_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/system_properties.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+/*
+ * runtime configuration of vendor HALs. a key is looked up in system
+ * properties first, then in HAL_CONFIG_FILE installed by the product,
+ * then takes the default of caller, so a product tunes overlay use,
+ * buffer depths or audio periods without rebuilding and a property
+ * still overrides it while debugging.
+ *
+ * the file has one "key=value" per line, key named like the property,
+ * '#' starts a comment line. its state is static in this header, so
+ * the file is parsed once in each source file that looks a key up,
+ * callers look keys up at init and keep the values. properties are
+ * read at every lookup, hal_config_changed() tells a cached snapshot
+ * to reload after any property is set. lines past HAL_CONFIG_MAX_SIZE
+ * bytes are dropped with a warning.
+ */
+#define HAL_CONFIG_FILE             "/vendor/etc/imx_hal.conf"
+#define HAL_CONFIG_MAX_SIZE         4096
+#define HAL_CONFIG_MAX_KEYS         128
+
+struct hal_config {
+    int count;
+    const char *keys[HAL_CONFIG_MAX_KEYS];
+    const char *values[HAL_CONFIG_MAX_KEYS];
+    char data[HAL_CONFIG_MAX_SIZE];
+};
+
+static inline struct hal_config *hal_config_data(void) {
+    static struct hal_config config;
+
+    return &config;
+}
+
+static inline char *hal_config_trim(char *s, char *end) {
+    while (s < end && (*s == ' ' || *s == '\t'))
+        s++;
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        end--;
+    *end = '\0';
+    return s;
+}
+
+static inline void hal_config_parse(void) {
+    struct hal_config *config = hal_config_data();
+    char *line, *next, *eq;
+    ssize_t size;
+    char extra;
+    int truncated = 0;
+    int fd;
+
+    fd = open(HAL_CONFIG_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    size = read(fd, config->data, HAL_CONFIG_MAX_SIZE - 1);
+    if (size == HAL_CONFIG_MAX_SIZE - 1 && read(fd, &extra, 1) > 0)
+        truncated = 1;
+    close(fd);
+    if (size <= 0)
+        return;
+    config->data[size] = '\0';
+    if (truncated) {
+        /* cut line would set a wrong value, keep whole lines only */
+        line = strrchr(config->data, '\n');
+        if (line)
+            line[1] = '\0';
+        else
+            config->data[0] = '\0';
+        ALOGW("%s is larger than %d bytes, lines past it are ignored",
+              HAL_CONFIG_FILE, HAL_CONFIG_MAX_SIZE);
+    }
+
+    for (line = config->data; line && config->count < HAL_CONFIG_MAX_KEYS; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        eq = strchr(line, '=');
+        if (line[0] == '#' || eq == NULL)
+            continue;
+        *eq = '\0';
+        line = hal_config_trim(line, eq);
+        if (line[0] == '\0')
+            continue;
+        config->keys[config->count] = line;
+        config->values[config->count] = hal_config_trim(eq + 1, eq + 1 + strlen(eq + 1));
+        config->count++;
+    }
+}
+
+/* value of key in HAL_CONFIG_FILE, NULL if the file doesn't set it. */
+static inline const char *hal_config_file_value(const char *key) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    struct hal_config *config = hal_config_data();
+    int i;
+
+    pthread_once(&once, hal_config_parse);
+    /* later lines override earlier ones */
+    for (i = config->count - 1; i >= 0; i--) {
+        if (!strcmp(config->keys[i], key))
+            return config->values[i];
+    }
+    return NULL;
+}
+
+/* same as property_get(), value holds PROPERTY_VALUE_MAX bytes. */
+static inline int hal_config_get(const char *key, char *value, const char *default_value) {
+    const char *file_value;
+    int len;
+
+    len = property_get(key, value, "");
+    if (len > 0)
+        return len;
+
+    file_value = hal_config_file_value(key);
+    if (file_value == NULL)
+        file_value = default_value;
+    if (file_value == NULL) {
+        value[0] = '\0';
+        return 0;
+    }
+    strncpy(value, file_value, PROPERTY_VALUE_MAX - 1);
+    value[PROPERTY_VALUE_MAX - 1] = '\0';
+    return (int)strlen(value);
+}
+
+/* decimal or 0x hex, default_value if unset or not a number. */
+static inline int64_t hal_config_get_int(const char *key, int64_t default_value) {
+    char value[PROPERTY_VALUE_MAX];
+    char *end;
+    int64_t result;
+
+    if (hal_config_get(key, value, NULL) == 0)
+        return default_value;
+    result = strtoll(value, &end, 0);
+    return (end == value || *end != '\0') ? default_value : result;
+}
+
+/* "1", "y", "true" or "on" is true, "0", "n", "false" or "off" false. */
+static inline int hal_config_get_bool(const char *key, int default_value) {
+    char value[PROPERTY_VALUE_MAX];
+
+    if (hal_config_get(key, value, NULL) == 0)
+        return default_value;
+    if (!strcmp(value, "1") || !strcmp(value, "y") || !strcmp(value, "true") ||
+            !strcmp(value, "on"))
+        return 1;
+    if (!strcmp(value, "0") || !strcmp(value, "n") || !strcmp(value, "false") ||
+            !strcmp(value, "off"))
+        return 0;
+    return default_value;
+}
+
+/* true once after any property is set since last call with serial. */
+static inline int hal_config_changed(uint32_t *serial) {
+    uint32_t current = __system_property_area_serial();
+
+    if (*serial == current)
+        return 0;
+    *serial = current;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ *   Copyright 2017 NXP
+ */
+
+#ifndef _LATENCY_MARK_EXT_H
+#define _LATENCY_MARK_EXT_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * glass-to-glass latency measurement. while LATENCY_MARK_PROP is set,
+ * camera HAL writes capture time of each frame into the first
+ * LATENCY_MARK_SIZE bytes of preview buffers, hwc reads it back from
+ * buffers it presents and takes the vblank of their flip as display
+ * time. the mark overwrites a few pixels of the first line, so it is
+ * for diagnostics only.
+ *
+ * timestamp is CLOCK_MONOTONIC as in V4L2 buffers and DRM events.
+ */
+#define LATENCY_MARK_PROP           "rw.camera.latency"
+#define LATENCY_MARK_MAGIC          0x4d4c4747  /* "GGLM" */
+#define LATENCY_MARK_SIZE           16
+
+struct latency_mark {
+    uint32_t magic;
+    /* magic ^ both timestamp words, tells mark from pixels */
+    uint32_t check;
+    int64_t timestamp;
+};
+
+static inline uint32_t latency_mark_check(int64_t timestamp) {
+    return LATENCY_MARK_MAGIC ^ (uint32_t)timestamp ^
+           (uint32_t)((uint64_t)timestamp >> 32);
+}
+
+static inline void latency_mark_write(void *pixels, int64_t timestamp) {
+    struct latency_mark mark;
+
+    mark.magic = LATENCY_MARK_MAGIC;
+    mark.check = latency_mark_check(timestamp);
+    mark.timestamp = timestamp;
+    memcpy(pixels, &mark, sizeof(mark));
+#if defined(__aarch64__)
+    /* reader maps buffer on its own, clean line out of cache */
+    asm volatile("dc cvac, %0" : : "r"(pixels) : "memory");
+    asm volatile("dsb sy" : : : "memory");
+#endif
+}
+
+/* capture time of mark in pixels, 0 if buffer has no valid mark. */
+static inline int64_t latency_mark_read(const void *pixels) {
+    struct latency_mark mark;
+
+    memcpy(&mark, pixels, sizeof(mark));
+    if (mark.magic != LATENCY_MARK_MAGIC || mark.timestamp <= 0 ||
+            mark.check != latency_mark_check(mark.timestamp))
+        return 0;
+    return mark.timestamp;
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ *   Copyright 2017 NXP
+ */
+
+#ifndef _POWER_WORKLOAD_EXT_H
+#define _POWER_WORKLOAD_EXT_H
+
+#include <cutils/properties.h>
+
+/*
+ * bus bandwidth workloads of vendor HALs, "1" while active and "0"
+ * otherwise. power HAL holds DDR and NOC at the bandwidth of active
+ * ones and lets busfreq drop to low-bus mode when none is.
+ */
+#define POWER_WORKLOAD_DISPLAY_4K       "vendor.power.display_4k"
+#define POWER_WORKLOAD_CAMERA           "vendor.power.camera"
+#define POWER_WORKLOAD_VIDEO_DECODE     "vendor.power.video_decode"
+
+static inline void power_workload_set(const char *workload, int active) {
+    property_set(workload, active ? "1" : "0");
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ *   Copyright 2017 NXP
+ */
+
+#ifndef _REARVIEW_EXT_H
+#define _REARVIEW_EXT_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <cutils/sockets.h>
+
+/*
+ * handover of early rear view camera. imx_rearview starts from init
+ * before camera HAL and hwcomposer, streams one sensor onto a KMS plane
+ * and serves REARVIEW_SOCKET:
+ *  - hwcomposer asks for its drm fd, so drm master moves with the open
+ *    file and screen is never blanked. display keeps off the screen
+ *    until it gets REARVIEW_MSG_RELEASED, then sends REARVIEW_MSG_DONE
+ *    after its first commit and rear view exits.
+ *  - camera HAL asks rear view to release sensor before it opens it,
+ *    reply comes after sensor is closed.
+ * without the service all helpers return at once.
+ */
+#define REARVIEW_SOCKET             "rearview"
+#define REARVIEW_DEVICE_MAX         64
+/* camera HAL waits sensor release at most this long, in ms */
+#define REARVIEW_RELEASE_TIMEOUT    500
+
+enum {
+    /* client asks for drm fd, reply carries it */
+    REARVIEW_MSG_DRM = 1,
+    /* client opens device, rear view gives it up if it streams it */
+    REARVIEW_MSG_RELEASE,
+    /* sensor is closed, sent to drm client and release requester */
+    REARVIEW_MSG_RELEASED,
+    /* display took over screen */
+    REARVIEW_MSG_DONE,
+};
+
+struct rearview_msg {
+    uint32_t type;
+    char device[REARVIEW_DEVICE_MAX];
+};
+
+static inline int rearview_send(int sock, uint32_t type, const char *device,
+                                int fd) {
+    struct rearview_msg msg;
+    struct msghdr hdr;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    if (device != NULL)
+        strncpy(msg.device, device, REARVIEW_DEVICE_MAX - 1);
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (fd >= 0) {
+        struct cmsghdr *cmsg;
+
+        memset(control, 0, sizeof(control));
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &hdr, MSG_NOSIGNAL) == (ssize_t)sizeof(msg) ? 0 : -errno;
+}
+
+/*
+ * message type, 0 when peer is gone, -EAGAIN when nothing is queued
+ * with MSG_DONTWAIT in flags. fd passed with message goes to *fd.
+ */
+static inline int rearview_recv(int sock, struct rearview_msg *msg, int *fd,
+                                int flags) {
+    struct msghdr hdr;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+    ssize_t len;
+
+    if (fd != NULL)
+        *fd = -1;
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(*msg);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    len = recvmsg(sock, &hdr, flags | MSG_CMSG_CLOEXEC);
+    if (len < 0)
+        return -errno;
+
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int passed;
+
+            memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+            if (fd != NULL)
+                *fd = passed;
+            else
+                close(passed);
+        }
+    }
+    if (len != (ssize_t)sizeof(*msg))
+        return 0;
+    msg->device[REARVIEW_DEVICE_MAX - 1] = '\0';
+    return (int)msg->type;
+}
+
+static inline int rearview_connect(void) {
+    return socket_local_client(REARVIEW_SOCKET, ANDROID_SOCKET_NAMESPACE_RESERVED,
+                               SOCK_SEQPACKET);
+}
+
+/*
+ * drm fd of rear view if it drives the device at path, -1 otherwise.
+ * *sock is kept connected for REARVIEW_MSG_RELEASED and DONE.
+ */
+static inline int rearview_take_drm(const char *path, int *sock) {
+    struct rearview_msg msg;
+    struct stat own, passed;
+    int fd = -1;
+
+    *sock = rearview_connect();
+    if (*sock < 0)
+        return -1;
+    if (rearview_send(*sock, REARVIEW_MSG_DRM, path, -1) != 0 ||
+            rearview_recv(*sock, &msg, &fd, 0) != REARVIEW_MSG_DRM || fd < 0 ||
+            stat(path, &own) != 0 || fstat(fd, &passed) != 0 ||
+            own.st_rdev != passed.st_rdev) {
+        if (fd >= 0)
+            close(fd);
+        close(*sock);
+        *sock = -1;
+        return -1;
+    }
+    return fd;
+}
+
+/* wait rear view to close device before caller opens it. */
+static inline void rearview_release(const char *device, int timeout_ms) {
+    struct rearview_msg msg;
+    struct pollfd pfd;
+    int sock;
+
+    sock = rearview_connect();
+    if (sock < 0)
+        return;
+    if (rearview_send(sock, REARVIEW_MSG_RELEASE, device, -1) == 0) {
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) > 0)
+            rearview_recv(sock, &msg, NULL, 0);
+    }
+    close(sock);
+}
+
+#endif
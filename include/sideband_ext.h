@@ -0,0 +1,68 @@
+/*
+ *   Copyright 2017 NXP
+ */
+
+#ifndef _SIDEBAND_EXT_H
+#define _SIDEBAND_EXT_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * sideband stream handle from video producer (e.g. tv input capture)
+ * to hwcomposer, frames go to overlay plane without SurfaceFlinger.
+ * data[0] is shared memory holding struct sideband_control,
+ * data[1] is eventfd written on each queued frame,
+ * data[2..] are dma-buf fds of frame buffers, numInts is 0.
+ * composer holds frame on screen, frame committed and frame latched,
+ * producer needs five buffers to always find a free one.
+ */
+#define SIDEBAND_MAGIC          0x53424e44
+#define SIDEBAND_MAX_BUFFERS    8
+#define SIDEBAND_CONTROL_FD     0
+#define SIDEBAND_EVENT_FD       1
+#define SIDEBAND_BUFFER_FD      2
+
+struct sideband_control {
+    uint32_t magic;
+    uint32_t count;
+    int32_t width;
+    int32_t height;
+    /* in pixels, 0 to use 16 aligned width. */
+    int32_t stride;
+    /* HAL_PIXEL_FORMAT_YCbCr_420_SP or HAL_PIXEL_FORMAT_YCbCr_422_I. */
+    int32_t format;
+    /* physical address of contiguous buffers for 2D engine, or 0. */
+    uint64_t phys[SIDEBAND_MAX_BUFFERS];
+    /* newest queued buffer, -1 before first frame. */
+    int32_t latest;
+    uint32_t sequence;
+    /* bit per buffer held by composer. */
+    uint32_t busy;
+};
+
+/* free buffer for producer to write next frame, -1 if none. */
+static inline int sideband_dequeue(struct sideband_control* ctrl) {
+    int32_t latest = __atomic_load_n(&ctrl->latest, __ATOMIC_SEQ_CST);
+    uint32_t busy = __atomic_load_n(&ctrl->busy, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < ctrl->count && i < SIDEBAND_MAX_BUFFERS; i++) {
+        if ((int32_t)i != latest && !(busy & (1U << i))) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* publish written buffer as newest frame and wake composer. */
+static inline void sideband_queue(struct sideband_control* ctrl, int index,
+                                  int eventfd) {
+    uint64_t one = 1;
+    __atomic_store_n(&ctrl->latest, index, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&ctrl->sequence, 1, __ATOMIC_SEQ_CST);
+    if (write(eventfd, &one, sizeof(one)) < 0) {
+        /* counter is full, composer is already woken. */
+    }
+}
+
+#endif
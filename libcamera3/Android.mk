@@ -42,6 +42,10 @@ LOCAL_SRC_FILES := \
     Stream.cpp \
     VendorTags.cpp \
     CameraUtils.cpp \
+    ColorConvert.cpp \
+    FrameStats.cpp \
+    IonPool.cpp \
+    IpuQueue.cpp \
     MessageQueue.cpp \
     VideoStream.cpp \
     JpegBuilder.cpp \
@@ -62,10 +66,15 @@ LOCAL_SRC_FILES := \
     MMAPStream.cpp \
     TinyExif.cpp
 
+LOCAL_SRC_FILES += \
+    UvcMJPGDevice.cpp
+
 ifeq ($(BOARD_HAVE_VPU),true)
     LOCAL_SRC_FILES += \
-    UvcMJPGDevice.cpp \
     MJPGStream.cpp
+else
+    LOCAL_SRC_FILES += \
+    SwMJPGStream.cpp
 endif
 
 LOCAL_SHARED_LIBRARIES := \
@@ -116,4 +125,67 @@ LOCAL_CFLAGS += -Wall -Wextra -fvisibility=hidden
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    convert_bench.cpp \
+    ColorConvert.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    liblog
+
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE := camera_convert_bench
+LOCAL_CFLAGS := -DLOG_TAG=\"camera_convert_bench\"
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    camera_hal_bench.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libcamera_metadata \
+    libhardware \
+    libutils \
+    liblog
+
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE := camera_hal_bench
+LOCAL_CFLAGS := -DLOG_TAG=\"camera_hal_bench\"
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    RearView.cpp
+
+LOCAL_C_INCLUDES += \
+    $(IMX_PATH)/imx/include \
+    external/libdrm \
+    external/libdrm/include/drm \
+    device/fsl/common/kernel-headers
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    libutils \
+    libdrm \
+    liblog
+
+LOCAL_VENDOR_MODULE := true
+LOCAL_MODULE := imx_rearview
+LOCAL_CFLAGS := -DLOG_TAG=\"imx_rearview\" -Wall -Wextra
+LOCAL_INIT_RC := imx_rearview.rc
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
 endif
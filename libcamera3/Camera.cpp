@@ -31,9 +31,11 @@
 
 //#define LOG_NDEBUG 0
 #include <cutils/log.h>
+#include <power_workload_ext.h>
 
 #include "Camera.h"
 #include "CameraUtils.h"
+#include "IonPool.h"
 #include "Max9286Mipi.h"
 #include "Ov5640Csi.h"
 #include "Ov5640Csi8MQ.h"
@@ -59,6 +61,128 @@ static int32_t close_device(hw_device_t* dev)
 } // extern "C"
 
 android::Mutex Camera::sStaticInfoLock(android::Mutex::PRIVATE);
+android::Mutex Camera::sWorkloadLock(android::Mutex::PRIVATE);
+int32_t Camera::sOpenCount = 0;
+
+// sensor tables and static info built once per dev node, kept until
+// hotplug of the node, with sStaticInfoLock.
+struct StaticInfoEntry
+{
+    StaticInfoEntry() : mInfo(NULL), mFacing(0) {mName[0] = '\0';}
+
+    char mName[CAMERA_SENSOR_LENGTH];
+    int32_t mFacing;
+    SensorData mSensor;
+    camera_metadata_t* mInfo;
+};
+
+static StaticInfoEntry sStaticCache[MAX_CAMERAS];
+
+// persisted sensor tables, metadata is rebuilt from them.
+#define STATIC_CACHE_PROP "rw.camera.static_cache"
+#define STATIC_CACHE_DIR "/data/vendor/camera"
+#define STATIC_CACHE_MAGIC 0x43535449
+#define STATIC_CACHE_VERSION 2
+
+#define STATIC_CACHE_FIELDS(F)                                   \
+    F(mPreviewResolutions) F(mPreviewResolutionCount)            \
+    F(mPictureResolutions) F(mPictureResolutionCount)            \
+    F(mAvailableFormats) F(mAvailableFormatCount)                \
+    F(mMinFrameDuration) F(mMaxFrameDuration) F(mTargetFpsRange) \
+    F(mMaxWidth) F(mMaxHeight) F(mPhysicalWidth)                 \
+    F(mPhysicalHeight) F(mFocalLength) F(mActiveArrayWidth)      \
+    F(mActiveArrayHeight) F(mPixelArrayWidth)                    \
+    F(mPixelArrayHeight) F(mPicturePixelFormat)                  \
+    F(mPreviewPixelFormat) F(mVpuSupportFmt)                     \
+    F(mPictureSupportFmt) F(mSensorFormats)                      \
+    F(mSensorFormatCount) F(mHighSpeedModes)                     \
+    F(mHighSpeedModeCount)
+
+struct StaticFileHeader
+{
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint32_t mSize;
+    char mName[CAMERA_SENSOR_LENGTH];
+    char mDevPath[CAMAERA_FILENAME_LENGTH];
+    // tables are probed again after system update.
+    char mBuild[PROPERTY_VALUE_MAX];
+};
+
+static uint32_t getStaticFieldsSize()
+{
+    uint32_t size = 0;
+#define F(field) size += sizeof(((SensorData*)0)->field);
+    STATIC_CACHE_FIELDS(F)
+#undef F
+    return size;
+}
+
+static void getStaticFilePath(const char* devPath, char* file, size_t len)
+{
+    const char* node = strrchr(devPath, '/');
+    snprintf(file, len, "%s/static_%s.bin", STATIC_CACHE_DIR,
+             node != NULL ? node + 1 : devPath);
+}
+
+static bool isStaticFileEnabled()
+{
+    char prop[PROPERTY_VALUE_MAX];
+    property_get(STATIC_CACHE_PROP, prop, "1");
+    return atoi(prop) != 0;
+}
+
+static StaticInfoEntry* findStaticEntry(const char* name, const char* devPath,
+                                        int32_t facing)
+{
+    for (int32_t i = 0; i < MAX_CAMERAS; i++) {
+        StaticInfoEntry& entry = sStaticCache[i];
+        if (entry.mInfo != NULL && entry.mFacing == facing &&
+            !strcmp(entry.mName, name) &&
+            !strcmp(entry.mSensor.mDevPath, devPath)) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+static void addStaticEntry(const char* name, int32_t facing,
+                           const SensorData& sensor,
+                           const camera_metadata_t* info)
+{
+    for (int32_t i = 0; i < MAX_CAMERAS; i++) {
+        StaticInfoEntry& entry = sStaticCache[i];
+        if (entry.mInfo != NULL) {
+            continue;
+        }
+
+        entry.mInfo = clone_camera_metadata(info);
+        if (entry.mInfo == NULL) {
+            return;
+        }
+        strncpy(entry.mName, name, CAMERA_SENSOR_LENGTH - 1);
+        entry.mName[CAMERA_SENSOR_LENGTH - 1] = '\0';
+        entry.mFacing = facing;
+        entry.mSensor = sensor;
+        return;
+    }
+}
+
+void Camera::invalidateStaticInfo(const char* devPath)
+{
+    android::Mutex::Autolock al(sStaticInfoLock);
+    for (int32_t i = 0; i < MAX_CAMERAS; i++) {
+        StaticInfoEntry& entry = sStaticCache[i];
+        if (entry.mInfo != NULL && !strcmp(entry.mSensor.mDevPath, devPath)) {
+            free_camera_metadata(entry.mInfo);
+            entry.mInfo = NULL;
+        }
+    }
+
+    char file[CAMAERA_FILENAME_LENGTH];
+    getStaticFilePath(devPath, file, sizeof(file));
+    unlink(file);
+}
 
 Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
                              int32_t orientation, char* path)
@@ -80,7 +204,6 @@ Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
         device = new Ov5640Csi(id, facing, orientation, path);
     }
     else if (strstr(name, UVC_SENSOR_NAME)) {
-#ifdef BOARD_HAVE_VPU
         char uvcMJPGStr[92];
         int configUseMJPG = 0;
 
@@ -91,22 +214,29 @@ Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
         else
             configUseMJPG = atoi(uvcMJPGStr);
 
-        if(configUseMJPG == 0) {
-            ALOGI("create id:%d usb camera device", id);
-            device = UvcDevice::newInstance(id, name, facing, orientation, path);
-        } else {
+        bool useH264 = false;
+#ifdef BOARD_HAVE_VPU
+        char uvcH264Str[PROPERTY_VALUE_MAX];
+        property_get(UVC_USE_H264, uvcH264Str, DEFAULT_ERROR_NAME_str);
+        useH264 = atoi(uvcH264Str) != 0;
+#endif
+
+        if (useH264) {
+            ALOGI("create id:%d usb camera device, config to use H264", id);
+            device = new UvcMJPGDevice(id, facing, orientation, path, true);
+        } else if (configUseMJPG != 0) {
+            // decoded by VPU, or by CPU workers on boards without VPU.
             ALOGI("DeviceAdapter: Create uvc device, config to use MJPG");
             device = new UvcMJPGDevice(id, facing, orientation, path);
-        }
-#else
+        } else {
 #ifdef IMX7ULP_UVC
-        ALOGI("create id:%d imx7ulp usb camera device", id);
-        device = Uvc7ulpDevice::newInstance(id, name, facing, orientation, path);
+            ALOGI("create id:%d imx7ulp usb camera device", id);
+            device = Uvc7ulpDevice::newInstance(id, name, facing, orientation, path);
 #else
-        ALOGI("create id:%d usb camera device", id);
-        device = UvcDevice::newInstance(id, name, facing, orientation, path);
-#endif
+            ALOGI("create id:%d usb camera device", id);
+            device = UvcDevice::newInstance(id, name, facing, orientation, path);
 #endif
+        }
     }
     else if (strstr(name, OV5640_SENSOR_NAME)) {
 #ifdef VADC_TVIN
@@ -146,11 +276,15 @@ Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
         ALOGE("doesn't support camera id:%d %s", id, name);
     }
 
+    if (device != NULL) {
+        strncpy(device->mSensorName, name, CAMERA_SENSOR_LENGTH - 1);
+    }
+
     return device;
 }
 
 Camera::Camera(int32_t id, int32_t facing, int32_t orientation, char *path)
-    : mId(id), mStaticInfo(NULL), mBusy(false), mCallbackOps(NULL), mStreams(NULL), mNumStreams(0), mTmpBuf(NULL), usemx6s(0)
+    : mId(id), mStaticInfo(NULL), mBusy(false), mCallbackOps(NULL), mStreams(NULL), mNumStreams(0), mSettingsDirty(true), mHighSpeed(false), mShareIndex(0), mTmpBuf(NULL), usemx6s(0)
 {
     ALOGI("%s:%d: new camera device", __func__, mId);
     android::Mutex::Autolock al(mDeviceLock);
@@ -158,6 +292,7 @@ Camera::Camera(int32_t id, int32_t facing, int32_t orientation, char *path)
     camera_info::facing = facing;
     camera_info::orientation = orientation;
     strncpy(SensorData::mDevPath, path, CAMAERA_FILENAME_LENGTH);
+    memset(mSensorName, 0, sizeof(mSensorName));
 
     memset(&mDevice, 0, sizeof(mDevice));
     mDevice.common.tag = HARDWARE_DEVICE_TAG;
@@ -176,11 +311,25 @@ Camera::~Camera()
         free_camera_metadata(mStaticInfo);
     }
 
+    // shared stream is destroyed by its owner.
+    if (mVideoStream != NULL && mShareIndex == 0) {
+        mVideoStream->destroyStream();
+    }
+    mVideoStream.clear();
+    mVideoStream = NULL;
+}
+
+void Camera::shareStream(Camera* owner, uint32_t client)
+{
+    android::Mutex::Autolock al(mDeviceLock);
     if (mVideoStream != NULL) {
         mVideoStream->destroyStream();
-        mVideoStream.clear();
-        mVideoStream = NULL;
     }
+
+    ALOGI("%s: camera %d shares sensor of camera %d as client %d",
+          __func__, mId, owner->mId, client);
+    mVideoStream = owner->mVideoStream;
+    mShareIndex = client;
 }
 
 void Camera::setPreviewPixelFormat()
@@ -208,13 +357,14 @@ int32_t Camera::openDev(const hw_module_t *module, hw_device_t **device)
     }
 
     // open camera dev nodes, etc
-    int32_t ret = mVideoStream->openDev(mDevPath);
+    int32_t ret = mVideoStream->openDev(mDevPath, mShareIndex);
     if (ret != 0) {
         ALOGE("can not open camera devpath:%s", mDevPath);
         return BAD_VALUE;
     }
 
     mBusy = true;
+    updateWorkload(1);
     mDevice.common.module = const_cast<hw_module_t*>(module);
     *device = &mDevice.common;
     return 0;
@@ -228,18 +378,138 @@ int32_t Camera::getInfo(struct camera_info *info)
     info->orientation = camera_info::orientation;
     info->device_version = mDevice.common.version;
     if (mStaticInfo == NULL) {
-        int32_t ret = initSensorStaticData();
-        if (ret != 0) {
-            ALOGW("%s initSensorStaticData failed", __func__);
-        }
-        setPreviewPixelFormat();
-        setPicturePixelFormat();
-        mStaticInfo = Metadata::createStaticInfo(*this, *this);
+        android::Mutex::Autolock sl(sStaticInfoLock);
+        buildStaticInfoLocked();
     }
     info->static_camera_characteristics = mStaticInfo;
     return 0;
 }
 
+void Camera::buildStaticInfoLocked()
+{
+    bool cacheable = isStaticInfoCacheable();
+    int32_t facing = camera_info::facing;
+
+    if (cacheable) {
+        StaticInfoEntry* entry = findStaticEntry(mSensorName, mDevPath, facing);
+        if (entry != NULL) {
+            ALOGI("%s:%d: static info of %s from cache", __func__, mId,
+                  mDevPath);
+            SensorData::operator=(entry->mSensor);
+            mStaticInfo = clone_camera_metadata(entry->mInfo);
+            if (mStaticInfo != NULL) {
+                return;
+            }
+        }
+        else if (loadStaticFileLocked()) {
+            ALOGI("%s:%d: sensor tables of %s from file", __func__, mId,
+                  mDevPath);
+            mStaticInfo = Metadata::createStaticInfo(*this, *this);
+            if (mStaticInfo != NULL) {
+                addStaticEntry(mSensorName, facing, *this, mStaticInfo);
+                return;
+            }
+        }
+    }
+
+    int32_t ret = initSensorStaticData();
+    if (ret != 0) {
+        ALOGW("%s initSensorStaticData failed", __func__);
+    }
+    setPreviewPixelFormat();
+    setPicturePixelFormat();
+    mStaticInfo = Metadata::createStaticInfo(*this, *this);
+
+    // failed probe is not cached, it is retried by next camera.
+    if (cacheable && ret == 0 && mStaticInfo != NULL) {
+        addStaticEntry(mSensorName, facing, *this, mStaticInfo);
+        saveStaticFileLocked();
+    }
+}
+
+bool Camera::loadStaticFileLocked()
+{
+    if (!isStaticFileEnabled()) {
+        return false;
+    }
+
+    char file[CAMAERA_FILENAME_LENGTH];
+    getStaticFilePath(mDevPath, file, sizeof(file));
+    FILE* fp = fopen(file, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    StaticFileHeader header;
+    char build[PROPERTY_VALUE_MAX];
+    memset(build, 0, sizeof(build));
+    property_get("ro.build.fingerprint", build, "");
+
+    bool valid = fread(&header, sizeof(header), 1, fp) == 1 &&
+                 header.mMagic == STATIC_CACHE_MAGIC &&
+                 header.mVersion == STATIC_CACHE_VERSION &&
+                 header.mSize == getStaticFieldsSize() &&
+                 !strncmp(header.mName, mSensorName, CAMERA_SENSOR_LENGTH) &&
+                 !strncmp(header.mDevPath, mDevPath, CAMAERA_FILENAME_LENGTH) &&
+                 !strncmp(header.mBuild, build, PROPERTY_VALUE_MAX);
+
+    // read into copy, this is untouched if file is short.
+    SensorData data(*this);
+#define F(field) valid = valid && \
+        fread(&data.field, sizeof(data.field), 1, fp) == 1;
+    STATIC_CACHE_FIELDS(F)
+#undef F
+    fclose(fp);
+
+    if (!valid) {
+        ALOGW("%s: drop stale %s", __func__, file);
+        unlink(file);
+        return false;
+    }
+
+    SensorData::operator=(data);
+    return true;
+}
+
+void Camera::saveStaticFileLocked()
+{
+    if (!isStaticFileEnabled()) {
+        return;
+    }
+
+    char file[CAMAERA_FILENAME_LENGTH];
+    char temp[CAMAERA_FILENAME_LENGTH + 8];
+    getStaticFilePath(mDevPath, file, sizeof(file));
+    snprintf(temp, sizeof(temp), "%s.tmp", file);
+
+    StaticFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.mMagic = STATIC_CACHE_MAGIC;
+    header.mVersion = STATIC_CACHE_VERSION;
+    header.mSize = getStaticFieldsSize();
+    strncpy(header.mName, mSensorName, CAMERA_SENSOR_LENGTH - 1);
+    strncpy(header.mDevPath, mDevPath, CAMAERA_FILENAME_LENGTH - 1);
+    property_get("ro.build.fingerprint", header.mBuild, "");
+
+    FILE* fp = fopen(temp, "wb");
+    if (fp == NULL) {
+        ALOGW("%s: can't create %s", __func__, temp);
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+#define F(field) ok = ok && fwrite(&field, sizeof(field), 1, fp) == 1;
+    STATIC_CACHE_FIELDS(F)
+#undef F
+    ok = (fclose(fp) == 0) && ok;
+
+    // rename keeps old file whole if write is cut by reboot.
+    if (!ok || rename(temp, file) != 0) {
+        ALOGW("%s: write %s failed", __func__, file);
+        unlink(temp);
+    }
+}
+
 int32_t Camera::closeDev()
 {
     ALOGI("%s:%d: Closing camera device", __func__, mId);
@@ -251,12 +521,26 @@ int32_t Camera::closeDev()
     }
 
     // close camera dev nodes, etc
-    mVideoStream->closeDev();
+    mVideoStream->closeDev(mShareIndex);
 
     mBusy = false;
+    updateWorkload(-1);
     return 0;
 }
 
+void Camera::updateWorkload(int32_t delta)
+{
+    android::Mutex::Autolock wl(sWorkloadLock);
+    bool active = sOpenCount > 0;
+
+    sOpenCount += delta;
+    if ((sOpenCount > 0) != active) {
+        power_workload_set(POWER_WORKLOAD_CAMERA, sOpenCount > 0);
+        // CMA buffers are not pinned while no camera is open.
+        IonPool::getInstance().setActive(sOpenCount > 0);
+    }
+}
+
 int32_t Camera::initializeDev(const camera3_callback_ops_t *callback_ops)
 {
     int32_t res;
@@ -282,6 +566,8 @@ int32_t Camera::configureStreams(camera3_stream_configuration_t *stream_config)
 
     ALOGV("%s:%d: stream_config=%p", __func__, mId, stream_config);
     android::Mutex::Autolock al(mDeviceLock);
+    // next request settings configure new streams.
+    mSettingsDirty = true;
 
     if (stream_config == NULL) {
         ALOGE("%s:%d: NULL stream configuration array", __func__, mId);
@@ -292,6 +578,11 @@ int32_t Camera::configureStreams(camera3_stream_configuration_t *stream_config)
         return -EINVAL;
     }
 
+    // new streams size their buffers by session mode.
+    bool highSpeed = mHighSpeed;
+    mHighSpeed = stream_config->operation_mode ==
+                 CAMERA3_STREAM_CONFIGURATION_CONSTRAINED_HIGH_SPEED_MODE;
+
     // Create new stream array
     newStreams = new sp<Stream>[stream_config->num_streams];
     ALOGV("%s:%d: Number of Streams: %d", __func__, mId,
@@ -316,6 +607,8 @@ int32_t Camera::configureStreams(camera3_stream_configuration_t *stream_config)
             goto err_out;
         }
         astream->priv = newStreams[i].get();
+        // jpeg scratch buffers are allocated once per configured stream.
+        newStreams[i]->prepareJpegBuffers(getPicturePixelFormat());
     }
 
     // Verify the set of streams in aggregate
@@ -323,6 +616,11 @@ int32_t Camera::configureStreams(camera3_stream_configuration_t *stream_config)
         ALOGE("%s:%d: Invalid stream set", __func__, mId);
         goto err_out;
     }
+    if (mHighSpeed && !isValidHighSpeedStreamSet(newStreams,
+                                                  stream_config->num_streams)) {
+        ALOGE("%s:%d: Invalid high speed stream set", __func__, mId);
+        goto err_out;
+    }
 
     // Destroy all old streams and replace stream array with new one
     destroyStreams(mStreams, mNumStreams);
@@ -334,6 +632,7 @@ int32_t Camera::configureStreams(camera3_stream_configuration_t *stream_config)
 err_out:
     // Clean up temporary streams, preserve existing mStreams/mNumStreams
     destroyStreams(newStreams, stream_config->num_streams);
+    mHighSpeed = highSpeed;
     return -EINVAL;
 }
 
@@ -397,6 +696,33 @@ bool Camera::isValidStreamSet(sp<Stream> *streams, int32_t count)
     return true;
 }
 
+bool Camera::isValidHighSpeedStreamSet(sp<Stream> *streams, int32_t count)
+{
+    if (count > 2) {
+        ALOGE("%s:%d: %d streams, at most preview and video", __func__, mId,
+              count);
+        return false;
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+        sp<Stream>& stream = streams[i];
+        if (stream->isInputType() || stream->isJpeg() || stream->isCallback()) {
+            ALOGE("%s:%d: stream %d is not a video stream", __func__, mId, i);
+            return false;
+        }
+        // sensor has one mode, so preview and video share the size.
+        if (stream->width() != streams[0]->width() ||
+                stream->height() != streams[0]->height() ||
+                getHighSpeedFps(stream->width(), stream->height()) <= 0) {
+            ALOGE("%s:%d: %dx%d is not a high speed size", __func__, mId,
+                  stream->width(), stream->height());
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int32_t Camera::registerStreamBuffers(const camera3_stream_buffer_set_t *buf_set)
 {
     ALOGV("%s:%d: buffer_set=%p", __func__, mId, buf_set);
@@ -438,13 +764,24 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
     ALOGV("%s:%d: Request Frame:%d Settings:%p", __func__, mId,
             request->frame_number, request->settings);
 
-    // NULL indicates use last settings
-    if (request->settings != NULL) {
+    // NULL indicates use last settings, repeating requests mostly
+    // resend same settings, which are handled like NULL.
+    // reprocess settings don't change sensor configuration.
+    bool changed = false;
+    bool reprocess = request->input_buffer != NULL;
+    if (request->settings != NULL && !reprocess) {
         android::Mutex::Autolock al(mDeviceLock);
-        mSettings = new Metadata(request->settings);
+        if (mSettings == NULL || !mSettings->equals(request->settings)) {
+            mSettings = mSettingsPool.obtain(request->settings);
+            changed = true;
+        }
+        if (mSettingsDirty) {
+            mSettingsDirty = false;
+            changed = true;
+        }
     }
 
-    if (request->input_buffer != NULL) {
+    if (reprocess) {
         ALOGV("%s:%d: Reprocessing input buffer %p", __func__, mId,
                 request->input_buffer);
 
@@ -498,7 +835,12 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
         camera_metadata_entry_t streams = mSettings->find(
                             ANDROID_CONTROL_AE_TARGET_FPS_RANGE);
         if (streams.count > 1) {
-            if (streams.data.i32[0] > 15 && streams.data.i32[1] > 15) {
+            if (mHighSpeed && streams.data.i32[1] > HIGH_SPEED_PREVIEW_FPS) {
+                // [30, max] preview and [max, max] recording share mode,
+                // so recording starts without sensor reconfigure.
+                fps = streams.data.i32[1];
+            }
+            else if (streams.data.i32[0] > 15 && streams.data.i32[1] > 15) {
                 fps = 30;
             }
             else {
@@ -506,15 +848,30 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
             }
         }
 
-        meta = mSettings;
+        meta = reprocess ? mSettingsPool.obtain(request->settings) : mSettings;
         devStream = mVideoStream;
         callback = (camera3_callback_ops*)mCallbackOps;
     }
     sp<CaptureRequest> capture = new CaptureRequest();
 
     // configure VideoStream according to request type.
-    if (request->settings != NULL) {
-        if (meta->getRequestType() == TYPE_STILLCAP) {
+    if (changed) {
+        // burst keeps sensor at still size between shots.
+        if (meta->isBurstMode() && stillcap != NULL) {
+            int32_t burstFps = 0;
+            if (meta->getBurstFps(burstFps) == NO_ERROR && burstFps > 0) {
+                fps = (burstFps > 15) ? 30 : 15;
+            }
+            stillcap->setFps(fps);
+            devStream->configure(stillcap, mShareIndex);
+        }
+        else if (meta->getRequestType() == TYPE_ZSL && stillcap != NULL) {
+            // sensor streams at still size for preview too, still
+            // requests take a recent frame instead of switching mode.
+            stillcap->setFps(fps);
+            devStream->configure(stillcap, mShareIndex, true);
+        }
+        else if (meta->getRequestType() == TYPE_STILLCAP) {
             if (stillcap == NULL) {
                 ALOGE("still capture intent but without jpeg stream");
                 if (preview != NULL) {
@@ -525,40 +882,62 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
             }
             if (stillcap != NULL) {
                 stillcap->setFps(fps);
-                devStream->configure(stillcap);
+                devStream->configure(stillcap, mShareIndex);
             }
         } else if (preview != NULL) {
             if (meta->getRequestType() != TYPE_SNAPSHOT) {
                 preview->setFps(fps);
             }
-            devStream->configure(preview);
+            devStream->configure(preview, mShareIndex);
         } else if (callbackStream != NULL) {
             callbackStream->setFps(fps);
-            devStream->configure(callbackStream);
+            devStream->configure(callbackStream, mShareIndex);
         } else {
             ALOGI("%s: RequestType = %d, but preview and callback stream is null", __func__, meta->getRequestType());
         }
     }
 
     capture->init(request, callback, meta);
+    capture->mCamera = this;
 
-    return devStream->requestCapture(capture);
+    return devStream->requestCapture(capture, mShareIndex);
 
 err_out:
     // TODO: this should probably be a total device failure; transient for now
     return -EINVAL;
 }
 
-bool Camera::isValidReprocessSettings(const camera_metadata_t* /*settings*/)
+bool Camera::isValidReprocessSettings(const camera_metadata_t* settings)
 {
-    // TODO: reject settings that cannot be reprocessed
-    // input buffers unimplemented, use this to reject reprocessing requests
-    ALOGE("%s:%d: Input buffer reprocessing not implemented", __func__, mId);
-    return false;
+    // reprocess request repeats settings of its input frame.
+    if (settings == NULL) {
+        ALOGE("%s:%d: NULL settings for reprocess request", __func__, mId);
+        return false;
+    }
+
+    android::Mutex::Autolock al(mDeviceLock);
+    bool input = false, jpeg = false;
+    for (int32_t i = 0; i < mNumStreams; i++) {
+        if (mStreams[i]->isInputType()) {
+            input = true;
+        }
+        if (mStreams[i]->isJpeg()) {
+            jpeg = true;
+        }
+    }
+
+    // input is only encoded to jpeg.
+    if (!input || !jpeg) {
+        ALOGE("%s:%d: reprocess needs input and jpeg streams", __func__, mId);
+        return false;
+    }
+
+    return true;
 }
 
 //do advanced character set.
-int32_t Camera::processSettings(sp<Metadata> settings, uint32_t frame)
+int32_t Camera::processSettings(sp<Metadata> settings, Metadata& result,
+                                uint32_t frame, nsecs_t timestamp)
 {
     if (settings == NULL || settings->isEmpty()) {
         ALOGE("invalid settings");
@@ -581,33 +960,54 @@ int32_t Camera::processSettings(sp<Metadata> settings, uint32_t frame)
         m3aState.aeTriggerId = entry.data.i32[0];
     }
 
-    int64_t timestamp = 0;
-    timestamp = systemTime();
-    settings->addInt64(ANDROID_SENSOR_TIMESTAMP, 1, &timestamp);
+    // same clock as V4L2 frame time, see TIMESTAMP_SOURCE_REALTIME.
+    if (timestamp == 0) {
+        timestamp = systemTime(SYSTEM_TIME_BOOTTIME);
+    }
+    result.addInt64(ANDROID_SENSOR_TIMESTAMP, 1, &timestamp);
 
-    settings->addUInt8(ANDROID_CONTROL_AE_STATE, 1, &m3aState.aeState);
+    result.addUInt8(ANDROID_CONTROL_AE_STATE, 1, &m3aState.aeState);
 
     // auto focus control.
     m3aState.afState = ANDROID_CONTROL_AF_STATE_INACTIVE;
-    settings->addUInt8(ANDROID_CONTROL_AF_STATE, 1, &m3aState.afState);
+    result.addUInt8(ANDROID_CONTROL_AF_STATE, 1, &m3aState.afState);
 
     // auto white balance control.
     m3aState.awbState = ANDROID_CONTROL_AWB_STATE_INACTIVE;
-    settings->addUInt8(ANDROID_CONTROL_AWB_STATE, 1, &m3aState.awbState);
+    result.addUInt8(ANDROID_CONTROL_AWB_STATE, 1, &m3aState.awbState);
 
     entry = settings->find(ANDROID_CONTROL_AF_TRIGGER_ID);
     if (entry.count > 0) {
         m3aState.afTriggerId = entry.data.i32[0];
     }
 
-    settings->addInt32(ANDROID_CONTROL_AF_TRIGGER_ID, 1, &m3aState.afTriggerId);
-    settings->addInt32(ANDROID_CONTROL_AE_PRECAPTURE_ID, 1, &m3aState.aeTriggerId);
+    result.addInt32(ANDROID_CONTROL_AF_TRIGGER_ID, 1, &m3aState.afTriggerId);
+    result.addInt32(ANDROID_CONTROL_AE_PRECAPTURE_ID, 1, &m3aState.aeTriggerId);
 
     notifyShutter(frame, timestamp);
 
     return 0;
 }
 
+int32_t Camera::flush()
+{
+    ALOGI("%s:%d: flush", __func__, mId);
+    sp<VideoStream> stream;
+    {
+        android::Mutex::Autolock al(mDeviceLock);
+        if (!mBusy) {
+            return 0;
+        }
+        stream = mVideoStream;
+    }
+
+    if (stream == NULL) {
+        return 0;
+    }
+
+    return stream->flush(mShareIndex);
+}
+
 void Camera::notifyShutter(uint32_t frame_number, uint64_t timestamp)
 {
     int32_t res;
@@ -638,7 +1038,8 @@ void Camera::dumpDev(int32_t fd)
     ALOGV("%s:%d: Dumping to fd %d", __func__, mId, fd);
     android::Mutex::Autolock al(mDeviceLock);
 
-    dprintf(fd, "Camera ID: %d (Busy: %d)\n", mId, mBusy);
+    dprintf(fd, "Camera ID: %d (Busy: %d, Sensor client: %d)\n", mId, mBusy,
+            mShareIndex);
 
     // TODO: dump all settings
     dprintf(fd, "Most Recent Settings: (%p)\n", mSettings.get());
@@ -702,6 +1103,24 @@ int32_t Camera::initDevice()
 {
     int32_t res;
 
+    // templates only depend on static info, build them on first open.
+    {
+        android::Mutex::Autolock al(mDeviceLock);
+        bool built = true;
+        for (int32_t type = CAMERA3_TEMPLATE_PREVIEW;
+             type < CAMERA3_TEMPLATE_COUNT; type++) {
+            if (mTemplates[type] == NULL || mTemplates[type]->isEmpty()) {
+                built = false;
+                break;
+            }
+        }
+        if (built) {
+            mSettingsPool.setCapacity(mStaticInfo, mTemplates,
+                                      CAMERA3_TEMPLATE_COUNT);
+            return 0;
+        }
+    }
+
     // Use base settings to create all other templates and set them
     res = setPreviewTemplate();
     if (res)
@@ -722,6 +1141,8 @@ int32_t Camera::initDevice()
     if (res)
         return res;
 
+    android::Mutex::Autolock al(mDeviceLock);
+    mSettingsPool.setCapacity(mStaticInfo, mTemplates, CAMERA3_TEMPLATE_COUNT);
     return 0;
 }
 
@@ -883,10 +1304,9 @@ static void dump(const camera3_device_t *dev, int32_t fd)
     camdev_to_camera(dev)->dumpDev(fd);
 }
 
-static int32_t flush(const camera3_device_t*)
+static int32_t flush(const camera3_device_t *dev)
 {
-    ALOGE("%s: unimplemented.", __func__);
-    return -1;
+    return camdev_to_camera(dev)->flush();
 }
 
 } // extern "C"
@@ -41,13 +41,24 @@ public:
 
     static Camera* createCamera(int32_t id, char* name, int32_t facing,
                                 int32_t orientation, char* path);
-    // do advanced character set.
-    int32_t processSettings(sp<Metadata> settings, uint32_t frame);
+    // do advanced character set, 3A state of settings goes to result.
+    // timestamp is of frame already captured, 0 means now.
+    // capacity of results, see MetadataPool.
+    size_t resultEntries() {return mSettingsPool.entries();}
+    size_t resultData() {return mSettingsPool.data();}
+    int32_t processSettings(sp<Metadata> settings, Metadata& result,
+                            uint32_t frame, nsecs_t timestamp = 0);
     // Common Camera Device Operations (see <hardware/camera_common.h>)
     int32_t openDev(const hw_module_t *module, hw_device_t **device);
     int32_t getInfo(struct camera_info *info);
     int32_t closeDev();
     virtual bool isHotplug() {return false;}
+    // static info may be reused by next camera of same node and sensor.
+    virtual bool isStaticInfoCacheable() {return !isHotplug();}
+    // drop cached static info of dev node, on hotplug.
+    static void invalidateStaticInfo(const char* devPath);
+    // use sensor stream of owner as logical camera of index client.
+    void shareStream(Camera* owner, uint32_t client);
 
     // Camera v3 Device Operations (see <hardware/camera3.h>)
     int32_t initializeDev(const camera3_callback_ops_t *callback_ops);
@@ -56,6 +67,10 @@ public:
     const camera_metadata_t *constructDefaultRequestSettings(int32_t type);
     int32_t processCaptureRequest(camera3_capture_request_t *request);
     void dumpDev(int32_t fd);
+    // return in-flight requests as soon as possible, keep streaming.
+    int32_t flush();
+    // streams are configured for constrained high speed video.
+    bool isHighSpeed() {return mHighSpeed;}
     int32_t usemx6s;
 
     // some camera's resolution is not 16 pixels aligned, while gralloc is 16
@@ -106,12 +121,19 @@ private:
     void destroyStreams(sp<Stream> *array, int32_t count);
     // Verify a set of streams is valid in aggregate
     bool isValidStreamSet(sp<Stream> *array, int32_t count);
+    // high speed session takes at most 2 video streams of one mode.
+    bool isValidHighSpeedStreamSet(sp<Stream> *array, int32_t count);
     // Verify settings are valid for reprocessing an input buffer
     bool isValidReprocessSettings(const camera_metadata_t *settings);
     // Send a shutter notify message with start of exposure time
     void notifyShutter(uint32_t frame_number, uint64_t timestamp);
     // Is type a valid template type (and valid index int32_to mTemplates)
     bool isValidTemplateType(int32_t type);
+    // probe sensor or take tables from cache, with sStaticInfoLock.
+    void buildStaticInfoLocked();
+    // persisted sensor tables, false if file is missing or stale.
+    bool loadStaticFileLocked();
+    void saveStaticFileLocked();
 
     // Identifier used by framework to distinguish cameras
     const int32_t mId;
@@ -128,17 +150,33 @@ private:
     // Lock protecting only static camera characteristics, which may
     // be accessed without the camera device open
     static android::Mutex sStaticInfoLock;
+    // open cameras of all ids, camera bus workload is requested from
+    // power HAL while there is one.
+    static void updateWorkload(int32_t delta);
+    static android::Mutex sWorkloadLock;
+    static int32_t sOpenCount;
+    // sensor name matched in init.rc, part of static info cache key.
+    char mSensorName[CAMERA_SENSOR_LENGTH];
     // Array of handles to streams currently in use by the device
     sp<Stream> *mStreams;
     // Number of streams in mStreams
     int32_t mNumStreams;
     // Static array of standard camera settings templates
     sp<Metadata> mTemplates[CAMERA3_TEMPLATE_COUNT];
-    // Most recent request settings seen, memoized to be reused
+    // Most recent request settings seen, memoized to be reused.
+    // not changed once passed to a request.
     sp<Metadata> mSettings;
+    // streams changed since mSettings were applied.
+    bool mSettingsDirty;
+    // buffers of mSettings and reprocess settings, sized on open.
+    MetadataPool mSettingsPool;
+    // session of constrained high speed video, sensor at fixed fast rate.
+    bool mHighSpeed;
 
 protected:
     sp<VideoStream> mVideoStream;
+    // client index in mVideoStream, 0 is camera owning sensor.
+    uint32_t mShareIndex;
     autoState m3aState;
     uint8_t *mTmpBuf;  // used for soft csc temp buffer
 };
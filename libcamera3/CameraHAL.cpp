@@ -22,6 +22,7 @@
 #include <sys/stat.h>
 #include <linux/videodev2.h>
 #include <dirent.h>
+#include <pthread.h>
 #include "VendorTags.h"
 
 //#define LOG_NDEBUG 0
@@ -29,8 +30,10 @@
 
 #define ATRACE_TAG (ATRACE_TAG_CAMERA | ATRACE_TAG_HAL)
 #include <cutils/trace.h>
+#include <hal_config_ext.h>
 
 #include "CameraHAL.h"
+#include "VideoStream.h"
 
 /* Hardware limitation on I.MX6DQ platform
  * VPU only support NV12&I420 format.
@@ -67,6 +70,10 @@
 #define CAMERA_PLUG_EVENT "video4linux/video"
 #define CAMERA_PLUG_ADD "add@"
 #define CAMERA_PLUG_REMOVE "remove@"
+// usb camera answers QUERYCAP some time after add event.
+#define CAMERA_PROBE_DELAY 5000     // in usecs, doubled per retry
+#define CAMERA_PROBE_MAX_DELAY 200000
+#define CAMERA_PROBE_TIMEOUT 3000000
 // Default Camera HAL has 2 cameras, front and rear.
 static CameraHAL gCameraHAL;
 // Handle containing vendor tag functionality
@@ -80,7 +87,8 @@ static VendorTags gVendorTags;
 
 CameraHAL::CameraHAL()
   : mCameraCount(0),
-    mCallbacks(NULL)
+    mCallbacks(NULL),
+    mProbeExit(false)
 {
     // Allocate camera array and instantiate camera devices
     mCameras = new Camera*[MAX_CAMERAS];
@@ -109,13 +117,16 @@ CameraHAL::CameraHAL()
             mCameraCount++;
         }
     }
+    addSharedCameras();
     ALOGI("camera number is %d", mCameraCount);
 
+    mProbeThread = new ProbeThread(this);
     mHotplugThread = new HotplugThread(this);
 }
 
 CameraHAL::~CameraHAL()
 {
+    handleThreadExit();
     for (int32_t i = 0; i < mCameraCount; i++) {
         if (mCameras[i] != NULL) {
             delete mCameras[i];
@@ -124,42 +135,67 @@ CameraHAL::~CameraHAL()
     delete [] mCameras;
 }
 
-int32_t CameraHAL::handleCameraConnected(char* uevent)
+int32_t CameraHAL::waitNodeReady(const char* devName, nodeSet* node)
 {
     size_t nameLen = CAMERA_SENSOR_LENGTH - 1;
-    char* devName = strstr(uevent, "video");
-    char* tmpName = devName;
-    if (devName == NULL) {
-        ALOGW("%s bad uevent:%s", __func__, uevent);
-        return 0;
-    }
+    int32_t delay = CAMERA_PROBE_DELAY;
+    int32_t waited = 0;
 
-    while (devName != NULL) {
-        tmpName = devName;
-        devName = strstr(devName+1, "video");
+    sprintf(node->devNode, "/dev/%s", devName);
+    while (true) {
+        memset(node->nodeName, 0, sizeof(node->nodeName));
+        getNodeName(node->devNode, node->nodeName, nameLen);
+        // name is set once QUERYCAP succeeds.
+        if (strlen(node->nodeName) > 0) {
+            ALOGI("%s %s ready after %dus", __func__, devName, waited);
+            return 0;
+        }
+
+        if (waited >= CAMERA_PROBE_TIMEOUT || isRemovePending(devName)) {
+            ALOGW("%s %s not ready after %dus", __func__, devName, waited);
+            return -1;
+        }
+
+        usleep(delay);
+        waited += delay;
+        delay = delay * 2 < CAMERA_PROBE_MAX_DELAY ? delay * 2
+                                                   : CAMERA_PROBE_MAX_DELAY;
     }
+}
 
-    nodeSet* node = (nodeSet*)malloc(sizeof(nodeSet));
-    if (node == NULL) {
-        ALOGE("%s malloc failed", __func__);
-        return 0;
+bool CameraHAL::isRemovePending(const char* devName)
+{
+    android::Mutex::Autolock al(mProbeLock);
+    if (mProbeExit) {
+        return true;
     }
 
-    memset(node, 0, sizeof(nodeSet));
-    sprintf(node->devNode, "/dev/%s", tmpName);
+    for (android::List<hotplugEvent>::iterator it = mProbeEvents.begin();
+         it != mProbeEvents.end(); it++) {
+        if (!it->isAdd && !strcmp(it->devName, devName)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // usb camera is not ready until 100ms.
-    usleep(100000);
-    getNodeName(node->devNode, node->nodeName, nameLen);
-    ALOGI("%s devNode:%s, nodeName:%s", __func__, node->devNode, node->nodeName);
+int32_t CameraHAL::handleCameraConnected(const char* devName)
+{
+    nodeSet node;
+    memset(&node, 0, sizeof(node));
+    if (waitNodeReady(devName, &node) != 0) {
+        return 0;
+    }
+    ALOGI("%s devNode:%s, nodeName:%s", __func__, node.devNode, node.nodeName);
 
+    // only slots without camera are matched against new node.
     for (int32_t index = 0; index < mCameraCount; index++) {
         // sensor is absent then to check it.
         if (!mSets[index].mExisting) {
             // match sensor according to property set.
-            matchPropertyName(node, index);
+            matchPropertyName(&node, index);
             if (!mSets[index].mExisting) {
-                ALOGI("sensor plug event:%s enumerate failed", uevent);
+                ALOGI("sensor plug event:%s enumerate failed", devName);
                 continue;
             }
 
@@ -169,7 +205,7 @@ int32_t CameraHAL::handleCameraConnected(char* uevent)
             if (mCameras[index] == NULL) {
                 // camera sensor is not supported now.
                 ALOGE("Error: camera %s, %s create failed",
-                        mSets[index].mSensorName, uevent);
+                        mSets[index].mSensorName, devName);
                 return 0;
             }
 
@@ -183,19 +219,15 @@ int32_t CameraHAL::handleCameraConnected(char* uevent)
         }
     }
 
-    if (node != NULL) {
-        free(node);
-    }
-
     return 0;
 }
 
-int32_t CameraHAL::handleCameraDisonnected(char* uevent)
+int32_t CameraHAL::handleCameraDisonnected(const char* devName)
 {
     char* devPath = NULL;
     for (int32_t index = 0; index < mCameraCount; index++) {
         devPath = strstr(mSets[index].mDevPath, "video");
-        if ((devPath != NULL) && strstr(uevent, devPath)) {
+        if ((devPath != NULL) && !strcmp(devName, devPath)) {
             if (mCameras[index] == NULL) {
                 ALOGW("camera:%d disconnected but without object", index);
                 mSets[index].mExisting = false;
@@ -215,6 +247,8 @@ int32_t CameraHAL::handleCameraDisonnected(char* uevent)
             delete mCameras[index];
             mCameras[index] = NULL;
             mSets[index].mExisting = false;
+            // next sensor on this node may differ.
+            Camera::invalidateStaticInfo(mSets[index].mDevPath);
         }
     }
 
@@ -238,19 +272,63 @@ int32_t CameraHAL::handleThreadHotplug()
     char uevent_desc[4096];
     memset(uevent_desc, 0, sizeof(uevent_desc));
     int len = uevent_next_event(uevent_desc, sizeof(uevent_desc) - 2);
-    if (strstr(uevent_desc, CAMERA_PLUG_EVENT) != NULL) {
-        ALOGI("%s uevent %s", __func__, uevent_desc);
-        if (strstr(uevent_desc, CAMERA_PLUG_ADD) != NULL) {
-            // handle camera add event.
-            handleCameraConnected(uevent_desc);
-        }
-        else if (strstr(uevent_desc, CAMERA_PLUG_REMOVE) != NULL) {
-            //handle camera remove event.
-            handleCameraDisonnected(uevent_desc);
+    if (strstr(uevent_desc, CAMERA_PLUG_EVENT) == NULL) {
+        return 0;
+    }
+
+    ALOGI("%s uevent %s", __func__, uevent_desc);
+    hotplugEvent event;
+    memset(&event, 0, sizeof(event));
+    if (strstr(uevent_desc, CAMERA_PLUG_ADD) != NULL) {
+        event.isAdd = true;
+    }
+    else if (strstr(uevent_desc, CAMERA_PLUG_REMOVE) == NULL) {
+        ALOGI("%s doesn't handle uevent %s", __func__, uevent_desc);
+        return 0;
+    }
+
+    // last "video" of devpath is node name.
+    char* devName = strstr(uevent_desc, "video");
+    char* tmpName = devName;
+    while (devName != NULL) {
+        tmpName = devName;
+        devName = strstr(devName + 1, "video");
+    }
+    if (tmpName == NULL) {
+        ALOGW("%s bad uevent:%s", __func__, uevent_desc);
+        return 0;
+    }
+    strncpy(event.devName, tmpName, CAMERA_SENSOR_LENGTH - 1);
+
+    // probing is done in probe thread, keep reading uevents.
+    android::Mutex::Autolock al(mProbeLock);
+    mProbeEvents.push_back(event);
+    mProbeCondition.signal();
+    return 0;
+}
+
+int32_t CameraHAL::handleThreadProbe()
+{
+    hotplugEvent event;
+    {
+        android::Mutex::Autolock al(mProbeLock);
+        while (mProbeEvents.empty() && !mProbeExit) {
+            mProbeCondition.wait(mProbeLock);
         }
-        else {
-            ALOGI("%s doesn't handle uevent %s", __func__, uevent_desc);
+        if (mProbeExit) {
+            return -1;
         }
+        event = *mProbeEvents.begin();
+        mProbeEvents.erase(mProbeEvents.begin());
+    }
+
+    // events are handled in order, so remove after add of same node
+    // finds camera created by add.
+    if (event.isAdd) {
+        handleCameraConnected(event.devName);
+    }
+    else {
+        handleCameraDisonnected(event.devName);
     }
 
     return 0;
@@ -258,6 +336,9 @@ int32_t CameraHAL::handleThreadHotplug()
 
 void CameraHAL::handleThreadExit()
 {
+    android::Mutex::Autolock al(mProbeLock);
+    mProbeExit = true;
+    mProbeCondition.signal();
 }
 
 int CameraHAL::getNumberOfCameras()
@@ -305,9 +386,56 @@ int CameraHAL::openDev(const hw_module_t* mod, const char* name, hw_device_t** d
     return mCameras[id]->openDev(mod, dev);
 }
 
+void CameraHAL::addSharedCameras()
+{
+    // logical cameras on back camera sensor, e.g. preview and
+    // analytics of one MAX9286 input without reopening it.
+    char value[PROPERTY_VALUE_MAX];
+    hal_config_get("back_camera_shared", value, "0");
+    int32_t num = atoi(value);
+    Camera* owner = mCameras[BACK_CAMERA_ID];
+    if (num <= 0 || owner == NULL) {
+        return;
+    }
+
+    if (owner->isHotplug()) {
+        ALOGW("%s: hotplug camera can't be shared", __func__);
+        return;
+    }
+
+    uint32_t client = 1;
+    for (int32_t index = 0; index < MAX_CAMERAS && num > 0 &&
+            client < MAX_SHARED_CLIENTS; index++) {
+        if (mSets[index].mExisting) {
+            continue;
+        }
+
+        SensorSet& set = mSets[index];
+        const SensorSet& back = mSets[BACK_CAMERA_ID];
+        strncpy(set.mSensorName, back.mSensorName, PROPERTY_VALUE_MAX-1);
+        strncpy(set.mDevPath, back.mDevPath, CAMAERA_FILENAME_LENGTH-1);
+        set.mFacing = back.mFacing;
+        set.mOrientation = back.mOrientation;
+
+        mCameras[index] = Camera::createCamera(index, set.mSensorName,
+                set.mFacing, set.mOrientation, set.mDevPath);
+        if (mCameras[index] == NULL) {
+            ALOGW("Error: shared camera:%d, %s create failed", index,
+                    set.mSensorName);
+            break;
+        }
+
+        mCameras[index]->shareStream(owner, client++);
+        // keep hotplug from taking this slot.
+        set.mExisting = true;
+        mCameraCount++;
+        num--;
+    }
+}
+
 void CameraHAL::enumSensorSet()
 {
-    // get property from init.rc mSets.
+    // get sensor sets from product config file or init.rc properties.
     char orientStr[CAMERA_SENSOR_LENGTH];
     char *pCameraName = NULL;
     int32_t ret = 0;
@@ -315,16 +443,16 @@ void CameraHAL::enumSensorSet()
     ALOGI("%s", __func__);
     // get back camera property.
     memset(orientStr, 0, sizeof(orientStr));
-    property_get("back_camera_name", mSets[BACK_CAMERA_ID].mPropertyName, "0");
-    property_get("back_camera_orient", orientStr, "0");
+    hal_config_get("back_camera_name", mSets[BACK_CAMERA_ID].mPropertyName, "0");
+    hal_config_get("back_camera_orient", orientStr, "0");
     mSets[BACK_CAMERA_ID].mOrientation = atoi(orientStr);
     mSets[BACK_CAMERA_ID].mFacing = CAMERA_FACING_BACK;
     mSets[BACK_CAMERA_ID].mExisting = false;
 
     // get front camera property.
     memset(orientStr, 0, sizeof(orientStr));
-    property_get("front_camera_name", mSets[FRONT_CAMERA_ID].mPropertyName, "0");
-    property_get("front_camera_orient", orientStr, "0");
+    hal_config_get("front_camera_name", mSets[FRONT_CAMERA_ID].mPropertyName, "0");
+    hal_config_get("front_camera_orient", orientStr, "0");
     mSets[FRONT_CAMERA_ID].mOrientation = atoi(orientStr);
     mSets[FRONT_CAMERA_ID].mFacing = CAMERA_FACING_FRONT;
     mSets[FRONT_CAMERA_ID].mExisting = false;
@@ -412,12 +540,62 @@ int32_t CameraHAL::matchNodeName(const char* nodeName, nodeSet* nodes, int32_t i
     return ret;
 }
 
+// sysfs names of memory to memory nodes, e.g. codecs and ISI m2m,
+// they can't be cameras and may be slow to open.
+static const char* sSkipNodeNames[] = {
+    "m2m", "jpeg", "vpu", "v4l2dec", "v4l2enc", "decoder", "encoder",
+};
+
+static bool isSkippedNode(const char* devName)
+{
+    char path[CAMAERA_FILENAME_LENGTH];
+    char name[CAMERA_SENSOR_LENGTH];
+    snprintf(path, sizeof(path), "/sys/class/video4linux/%s/name", devName);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    memset(name, 0, sizeof(name));
+    bool read = fgets(name, sizeof(name), fp) != NULL;
+    fclose(fp);
+    if (!read) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < sizeof(sSkipNodeNames) / sizeof(sSkipNodeNames[0]); i++) {
+        if (strcasestr(name, sSkipNodeNames[i]) != NULL) {
+            ALOGI("%s %s is %s", __func__, devName, name);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void* CameraHAL::probeNodeThread(void* arg)
+{
+    NodeProbe* probe = (NodeProbe*)arg;
+    size_t nameLen = CAMERA_SENSOR_LENGTH - 1;
+    while (true) {
+        uint32_t i = __atomic_fetch_add(&probe->mNext, 1, __ATOMIC_SEQ_CST);
+        if (i >= probe->mNum) {
+            break;
+        }
+        nodeSet* node = probe->mNodes[i];
+        probe->mHal->getNodeName(node->devNode, node->nodeName, nameLen);
+    }
+
+    return NULL;
+}
+
 int32_t CameraHAL::matchDevNodes()
 {
     DIR *vidDir = NULL;
     struct dirent *dirEntry;
-    size_t nameLen = CAMERA_SENSOR_LENGTH - 1;
     nodeSet *nodes = NULL, *node = NULL, *last = NULL;
+    nodeSet* probes[CAMERA_PROBE_NODES];
+    uint32_t num = 0;
 
     ALOGI("%s", __func__);
     vidDir = opendir("/sys/class/video4linux");
@@ -426,9 +604,14 @@ int32_t CameraHAL::matchDevNodes()
     }
 
     while ((dirEntry = readdir(vidDir)) != NULL) {
-        if (strncmp(dirEntry->d_name, "video", 5)) {
+        if (strncmp(dirEntry->d_name, "video", 5) ||
+                isSkippedNode(dirEntry->d_name)) {
             continue;
         }
+        if (num >= CAMERA_PROBE_NODES) {
+            ALOGW("%s too many video nodes", __func__);
+            break;
+        }
 
         node = (nodeSet*)malloc(sizeof(nodeSet));
         if (node == NULL) {
@@ -446,12 +629,32 @@ int32_t CameraHAL::matchDevNodes()
         last = node;
 
         sprintf(node->devNode, "/dev/%s", dirEntry->d_name);
-
-        getNodeName(node->devNode, node->nodeName, nameLen);
+        probes[num++] = node;
     }
 
     closedir(vidDir);
 
+    // nodes are opened and queried in parallel, a slow driver doesn't
+    // hold back the others.
+    NodeProbe probe;
+    probe.mHal = this;
+    probe.mNodes = probes;
+    probe.mNum = num;
+    probe.mNext = 0;
+    uint32_t threads = (num > 1) ? num - 1 : 0;
+    threads = (threads > CAMERA_PROBE_THREADS) ? CAMERA_PROBE_THREADS : threads;
+    pthread_t tids[CAMERA_PROBE_THREADS];
+    bool started[CAMERA_PROBE_THREADS];
+    for (uint32_t i = 0; i < threads; i++) {
+        started[i] = pthread_create(&tids[i], NULL, probeNodeThread, &probe) == 0;
+    }
+    probeNodeThread(&probe);
+    for (uint32_t i = 0; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+
     for (int32_t index=0; index<MAX_CAMERAS; index++) {
         matchPropertyName(nodes, index);
     }
@@ -22,6 +22,7 @@
 #include <hardware/camera_common.h>
 #include <hardware_legacy/uevent.h>
 #include <system/camera_vendor_tags.h>
+#include <utils/List.h>
 #include "Camera.h"
 #include "VendorTags.h"
 
@@ -32,6 +33,26 @@ struct nodeSet {
     nodeSet* next;
 };
 
+// video nodes probed at boot, by caller and up to CAMERA_PROBE_THREADS.
+#define CAMERA_PROBE_NODES   64
+#define CAMERA_PROBE_THREADS 3
+
+class CameraHAL;
+// nodes of matchDevNodes, taken by index by probe threads.
+struct NodeProbe {
+    CameraHAL* mHal;
+    nodeSet** mNodes;
+    uint32_t mNum;
+    uint32_t mNext;
+};
+
+// video node plug event, probed off uevent thread.
+struct hotplugEvent {
+    bool isAdd;
+    // node name, e.g. video1.
+    char devName[CAMERA_SENSOR_LENGTH];
+};
+
 // CameraHAL contains all module state that isn't specific to an individual
 // camera device.
 class CameraHAL
@@ -51,15 +72,24 @@ public:
 
 private:
     int32_t matchDevNodes();
+    static void* probeNodeThread(void* arg);
     int32_t getNodeName(const char* devNode, char name[], size_t length);
     int32_t matchNodeName(const char* nodeName, nodeSet* nodes, int32_t index);
     int32_t matchPropertyName(nodeSet* nodes, int32_t index);
 
     int32_t handleThreadHotplug();
     void handleThreadExit();
-    int32_t handleCameraConnected(char* uevent);
-    int32_t handleCameraDisonnected(char* uevent);
+    // take queued plug events in order, runs in probe thread.
+    int32_t handleThreadProbe();
+    int32_t handleCameraConnected(const char* devName);
+    int32_t handleCameraDisonnected(const char* devName);
+    // retry QUERYCAP with backoff until node answers, -1 on timeout
+    // or when node is removed meanwhile.
+    int32_t waitNodeReady(const char* devName, nodeSet* node);
+    bool isRemovePending(const char* devName);
     void enumSensorSet();
+    // add logical cameras which share back camera sensor.
+    void addSharedCameras();
     void enumSensorNode(int index);
 
 private:
@@ -110,6 +140,32 @@ private:
         CameraHAL *mModule;
     };
 
+    // usb camera needs time after add event before it answers, so
+    // it's probed here and uevents are not held up meanwhile.
+    class ProbeThread : public android::Thread {
+    public:
+        ProbeThread(CameraHAL *hal)
+            : Thread(false), mModule(hal) {}
+        ~ProbeThread() {}
+
+        virtual void onFirstRef() {
+            run("ProbeThread", PRIORITY_URGENT_DISPLAY);
+        }
+
+        virtual bool threadLoop() {
+            int ret = mModule->handleThreadProbe();
+            if (ret != 0) {
+                ALOGI("%s exit...", __func__);
+                return false;
+            }
+
+            return true;
+        }
+
+    private:
+        CameraHAL *mModule;
+    };
+
 private:
     SensorSet mSets[MAX_CAMERAS];
     // Number of cameras
@@ -120,6 +176,12 @@ private:
     Camera **mCameras;
     // camera hotplug handle thread.
     sp<HotplugThread> mHotplugThread;
+    sp<ProbeThread> mProbeThread;
+    // plug events from hotplug thread to probe thread.
+    android::Mutex mProbeLock;
+    android::Condition mProbeCondition;
+    android::List<hotplugEvent> mProbeEvents;
+    bool mProbeExit;
 };
 
 #endif // CAMERA_HAL_H_
@@ -16,7 +16,11 @@
  */
 
 #include "CameraUtils.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <linux/videodev2.h>
+#include <latency_mark_ext.h>
 #include "Metadata.h"
 #include "Stream.h"
 
@@ -67,7 +71,74 @@ int convertPixelFormatToV4L2Format(PixelFormat format, bool invert)
     return nFormat;
 }
 
+nsecs_t getV4l2Timestamp(const struct timeval& tv, uint32_t flags)
+{
+    if ((flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        return 0;
+    }
+
+    nsecs_t timestamp = (nsecs_t)tv.tv_sec * 1000000000LL +
+                        (nsecs_t)tv.tv_usec * 1000LL;
+    if (timestamp <= 0) {
+        return 0;
+    }
+
+    // clocks only differ by time in suspend, take offset at dequeue.
+    nsecs_t mono = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t boot = systemTime(SYSTEM_TIME_BOOTTIME);
+    if (timestamp > mono) {
+        return 0;
+    }
+
+    return timestamp + boot - mono;
+}
+
+nsecs_t getMonotonicTime(nsecs_t timestamp)
+{
+    nsecs_t mono = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (timestamp <= 0) {
+        return mono;
+    }
+
+    return timestamp - (systemTime(SYSTEM_TIME_BOOTTIME) - mono);
+}
+
+void setCaptureThreadPolicy()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get("rw.camera.capture.priority", value, "1");
+    int priority = atoi(value);
+    if (priority > 0) {
+        int max = sched_get_priority_max(SCHED_FIFO);
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = (priority < max) ? priority : max;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            ALOGW("%s set SCHED_FIFO %d failed:%d", __func__, priority, err);
+        }
+    }
+
+    property_get("rw.camera.capture.cpus", value, "0");
+    uint32_t cpus = (uint32_t)strtoul(value, NULL, 0);
+    if (cpus != 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i=0; i<32; i++) {
+            if (cpus & (1U << i)) {
+                CPU_SET(i, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            ALOGW("%s set cpus 0x%x failed:%d", __func__, cpus, errno);
+        }
+    }
+}
+
 StreamBuffer::StreamBuffer()
+    : mFd(-1), mRefs(0), mDeinterlaced(false), mTimestamp(0),
+      mSensorTimestamp(0)
 {
 }
 
@@ -86,19 +157,88 @@ void StreamBuffer::initialize(buffer_handle_t* buf_h)
     mVirtAddr  = (void *)handle->base;
     mPhyAddr   = handle->phys;
     mSize      = handle->size;
+    mFd        = handle->fd;
 
     //for uvc jpeg stream
     mpFrameBuf  = NULL;
 
 }
 
+//--------------------BufferIndexMap----------------------
+BufferIndexMap::BufferIndexMap()
+{
+    clear();
+}
+
+void BufferIndexMap::clear()
+{
+    for (uint32_t i = 0; i < BUFFER_MAP_SIZE; i++) {
+        mPhys[i] = 0;
+        mIndex[i] = -1;
+    }
+    mCount = 0;
+}
+
+uint32_t BufferIndexMap::hash(int32_t phys)
+{
+    // buffers are page aligned, low bits carry nothing.
+    uint32_t key = (uint32_t)phys >> 12;
+    return (key * 2654435761u) % BUFFER_MAP_SIZE;
+}
+
+void BufferIndexMap::add(int32_t phys, int32_t index)
+{
+    if (phys == 0) {
+        return;
+    }
+
+    uint32_t slot = hash(phys);
+    for (uint32_t i = 0; i < BUFFER_MAP_SIZE; i++) {
+        uint32_t cur = (slot + i) % BUFFER_MAP_SIZE;
+        if (mPhys[cur] == phys) {
+            mIndex[cur] = index;
+            return;
+        }
+        if (mPhys[cur] == 0) {
+            if (mCount >= BUFFER_MAP_SIZE / 2) {
+                // stale entries of freed buffers, start over.
+                clear();
+                add(phys, index);
+                return;
+            }
+            mPhys[cur] = phys;
+            mIndex[cur] = index;
+            mCount++;
+            return;
+        }
+    }
+}
+
+int32_t BufferIndexMap::find(int32_t phys) const
+{
+    uint32_t slot = hash(phys);
+    for (uint32_t i = 0; i < BUFFER_MAP_SIZE; i++) {
+        uint32_t cur = (slot + i) % BUFFER_MAP_SIZE;
+        if (mPhys[cur] == phys) {
+            return mIndex[cur];
+        }
+        if (mPhys[cur] == 0) {
+            break;
+        }
+    }
+
+    return -1;
+}
+
 //--------------------CaptureRequest----------------------
 CaptureRequest::CaptureRequest()
-    : mOutBuffersNumber(0)
+    : mOutBuffersNumber(0), mInputBuffer(NULL), mCamera(NULL),
+      mCaptureTime(0)
 {
     for (uint32_t i = 0; i < MAX_STREAM_BUFFERS; i++) {
         mOutBuffers[i] = NULL;
     }
+    memset(mTimestamps, 0, sizeof(mTimestamps));
 }
 
 CaptureRequest::~CaptureRequest()
@@ -107,6 +247,8 @@ CaptureRequest::~CaptureRequest()
         if (mOutBuffers[i] != NULL)
             delete mOutBuffers[i];
     }
+    if (mInputBuffer != NULL)
+        delete mInputBuffer;
 }
 
 void CaptureRequest::init(camera3_capture_request* request,
@@ -118,6 +260,8 @@ void CaptureRequest::init(camera3_capture_request* request,
     mOutBuffersNumber = request->num_output_buffers;
     mRequest = request;
     mCallbackOps = callback;
+    mTimestamps[FRAME_QUEUED] = systemTime(SYSTEM_TIME_MONOTONIC);
+    mCaptureTime = 0;
 
     ALOGV("CaptureRequest fm:%d, bn:%d", mFrameNumber, mOutBuffersNumber);
     for (uint32_t i = 0; i < request->num_output_buffers; i++) {
@@ -127,6 +271,14 @@ void CaptureRequest::init(camera3_capture_request* request,
         mOutBuffers[i]->mAcquireFence = request->output_buffers[i].acquire_fence;
         mOutBuffers[i]->initialize(request->output_buffers[i].buffer);
     }
+
+    if (request->input_buffer != NULL) {
+        mInputBuffer = new StreamBuffer();
+        mInputBuffer->mStream = reinterpret_cast<Stream*>(
+                            request->input_buffer->stream->priv);
+        mInputBuffer->mAcquireFence = request->input_buffer->acquire_fence;
+        mInputBuffer->initialize(request->input_buffer->buffer);
+    }
 }
 
 int32_t CaptureRequest::onCaptureError()
@@ -148,12 +300,114 @@ int32_t CaptureRequest::onCaptureError()
         StreamBuffer* out = mOutBuffers[i];
         cameraBuffer.stream = out->mStream->stream();
         cameraBuffer.buffer = out->mBufHandle;
+        out->mStream->stats().onDropped();
         mCallbackOps->process_capture_result(mCallbackOps, &result);
     }
+    onInputDone(true);
 
     return 0;
 }
 
+int32_t CaptureRequest::onCaptureError(StreamBuffer* buffer)
+{
+    if (buffer == NULL || buffer->mBufHandle == NULL || mCallbackOps == NULL) {
+        return 0;
+    }
+
+    camera3_stream_buffer_t cameraBuffer;
+    cameraBuffer.stream = buffer->mStream->stream();
+    cameraBuffer.buffer = buffer->mBufHandle;
+    cameraBuffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+    cameraBuffer.acquire_fence = -1;
+    // acquire fence not waited yet goes back to framework.
+    cameraBuffer.release_fence = buffer->mAcquireFence;
+    buffer->mAcquireFence = -1;
+
+    camera3_capture_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.frame_number = mFrameNumber;
+    result.result = NULL;
+    result.num_output_buffers = 1;
+    result.output_buffers = &cameraBuffer;
+
+    buffer->mStream->stats().onDropped();
+    ALOGV("onCaptureError fm:%d", mFrameNumber);
+    mCallbackOps->process_capture_result(mCallbackOps, &result);
+    return 0;
+}
+
+int32_t CaptureRequest::onRequestError()
+{
+    if (mCallbackOps == NULL) {
+        return 0;
+    }
+
+    // no shutter or result was sent, so whole request is failed.
+    camera3_notify_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = CAMERA3_MSG_ERROR;
+    msg.message.error.frame_number = mFrameNumber;
+    msg.message.error.error_stream = NULL;
+    msg.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+    mCallbackOps->notify(mCallbackOps, &msg);
+
+    camera3_stream_buffer_t cameraBuffer;
+    camera3_capture_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.frame_number = mFrameNumber;
+    result.result = NULL;
+    result.num_output_buffers = 1;
+    result.output_buffers = &cameraBuffer;
+
+    for (uint32_t i=0; i<mOutBuffersNumber; i++) {
+        StreamBuffer* out = mOutBuffers[i];
+        cameraBuffer.stream = out->mStream->stream();
+        cameraBuffer.buffer = out->mBufHandle;
+        cameraBuffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+        cameraBuffer.acquire_fence = -1;
+        // acquire fence was not waited, framework takes it back.
+        cameraBuffer.release_fence = out->mAcquireFence;
+        out->mAcquireFence = -1;
+        out->mStream->stats().onDropped();
+        mCallbackOps->process_capture_result(mCallbackOps, &result);
+    }
+    onInputDone(true);
+
+    return 0;
+}
+
+int32_t CaptureRequest::onInputDone(bool error)
+{
+    if (mInputBuffer == NULL || mCallbackOps == NULL) {
+        return 0;
+    }
+
+    camera3_stream_buffer_t cameraBuffer;
+    cameraBuffer.stream = mInputBuffer->mStream->stream();
+    cameraBuffer.buffer = mInputBuffer->mBufHandle;
+    cameraBuffer.status = error ? CAMERA3_BUFFER_STATUS_ERROR :
+                                  CAMERA3_BUFFER_STATUS_OK;
+    cameraBuffer.acquire_fence = -1;
+    // fence not waited yet goes back to framework.
+    cameraBuffer.release_fence = mInputBuffer->mAcquireFence;
+    mInputBuffer->mAcquireFence = -1;
+
+    camera3_capture_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.frame_number = mFrameNumber;
+    result.result = NULL;
+    result.num_output_buffers = 0;
+    result.output_buffers = NULL;
+    result.input_buffer = &cameraBuffer;
+
+    ALOGV("onInputDone fm:%d", mFrameNumber);
+    mCallbackOps->process_capture_result(mCallbackOps, &result);
+    // input is returned once.
+    delete mInputBuffer;
+    mInputBuffer = NULL;
+    return 0;
+}
+
 int32_t CaptureRequest::onCaptureDone(StreamBuffer* buffer)
 {
     if (buffer == NULL || buffer->mBufHandle == NULL || mCallbackOps == NULL) {
@@ -178,18 +432,25 @@ int32_t CaptureRequest::onCaptureDone(StreamBuffer* buffer)
     // partial_result to 1 when metadata is included in this result.
     result.partial_result = 1;
 
+    // display side reads capture time back from presented buffer.
+    if (mCaptureTime > 0 && buffer->mStream->isPreview() &&
+            buffer->mVirtAddr != NULL && buffer->mSize >= LATENCY_MARK_SIZE) {
+        latency_mark_write(buffer->mVirtAddr, mCaptureTime);
+    }
+
+    buffer->mStream->stats().onResult(mTimestamps);
     ALOGV("onCaptureDone fm:%d", mFrameNumber);
     mCallbackOps->process_capture_result(mCallbackOps, &result);
     return 0;
 }
 
-int32_t CaptureRequest::onSettingsDone(sp<Metadata> meta)
+int32_t CaptureRequest::onSettingsDone(Metadata& meta)
 {
-    if (meta == NULL || (meta->get() == NULL) || mCallbackOps == NULL) {
+    if ((meta.get() == NULL) || mCallbackOps == NULL) {
         return 0;
     }
 
-    camera_metadata_entry_t entry = meta->find(ANDROID_SENSOR_TIMESTAMP);
+    camera_metadata_entry_t entry = meta.find(ANDROID_SENSOR_TIMESTAMP);
     if (entry.count <= 0) {
         ALOGW("invalid meta data");
         return 0;
@@ -198,7 +459,7 @@ int32_t CaptureRequest::onSettingsDone(sp<Metadata> meta)
     camera3_capture_result_t result;
     memset(&result, 0, sizeof(result));
     result.frame_number = mFrameNumber;
-    result.result = meta->get();
+    result.result = meta.get();
     result.num_output_buffers = 0;
     result.output_buffers = NULL;
 
@@ -225,6 +486,8 @@ SensorData::SensorData()
 
     memset(mPreviewResolutions, 0, sizeof(mPreviewResolutions));
     memset(mPictureResolutions, 0, sizeof(mPictureResolutions));
+    memset(mHighSpeedModes, 0, sizeof(mHighSpeedModes));
+    mHighSpeedModeCount = 0;
 }
 
 SensorData::~SensorData()
@@ -330,6 +593,36 @@ int SensorData::getCaptureMode(int width, int height)
     return capturemode;
 }
 
+int32_t SensorData::getHighSpeedFps(int width, int height)
+{
+    for (int i = 0; i < mHighSpeedModeCount; i += 3) {
+        if (mHighSpeedModes[i] == width && mHighSpeedModes[i+1] == height) {
+            return mHighSpeedModes[i+2];
+        }
+    }
+
+    return 0;
+}
+
+void SensorData::addHighSpeedMode(int width, int height, int fps)
+{
+    if (mHighSpeedModeCount + 3 > MAX_HIGH_SPEED_MODE * 3 ||
+            fps < HIGH_SPEED_MIN_FPS) {
+        return;
+    }
+
+    for (int i = 0; i < mPreviewResolutionCount; i += 2) {
+        if (mPreviewResolutions[i] == width &&
+                mPreviewResolutions[i+1] == height) {
+            mHighSpeedModes[mHighSpeedModeCount++] = width;
+            mHighSpeedModes[mHighSpeedModeCount++] = height;
+            mHighSpeedModes[mHighSpeedModeCount++] = fps;
+            ALOGI("HighSpeedMode: %d x %d @ %d", width, height, fps);
+            return;
+        }
+    }
+}
+
 status_t SensorData::adjustPreviewResolutions()
 {
     int xTmp, yTmp, xMax, yMax, idx;
@@ -45,8 +45,9 @@
 #include <graphics_ext.h>
 #include <hardware/camera3.h>
 #include "gralloc_priv.h"
+#include "FrameStats.h"
 
-#define MAX_CAMERAS 2
+#define MAX_CAMERAS 4
 
 #define FACE_CAMERA_NAME "camera_name"
 #define FACE_CAMERA_ORIENT "camera_orient"
@@ -72,6 +73,12 @@
 #define MAX_FPS_RANGE 6
 #define MAX_SENSOR_FORMAT 20
 
+// width, height and fps of modes above 30fps.
+#define MAX_HIGH_SPEED_MODE 4
+// high speed batches are sent in 30fps preview steps.
+#define HIGH_SPEED_PREVIEW_FPS 30
+// constrained high speed video needs at least 120fps.
+#define HIGH_SPEED_MIN_FPS 120
 #define MAX_VPU_SUPPORT_FORMAT 2
 #define MAX_PICTURE_SUPPORT_FORMAT 2
 
@@ -90,8 +97,20 @@
                                  GRALLOC_USAGE_SW_WRITE_NEVER | \
                                  GRALLOC_USAGE_HW_CAMERA_WRITE
 
+// preview buffers may be scanned out by overlay plane, allocator
+// gives them contiguous memory.
+#define CAMERA_GRALLOC_USAGE_PREVIEW CAMERA_GRALLOC_USAGE | \
+                                     GRALLOC_USAGE_HW_COMPOSER
+
 #define NUM_PREVIEW_BUFFER      2
 #define NUM_CAPTURE_BUFFER      1
+// V4L2 slots when preview or record buffers are captured into directly.
+#define NUM_DIRECT_BUFFER       4
+// "true" captures preview or record stream of device geometry in place.
+#define DIRECT_PREVIEW_PROP     "rw.camera.direct"
+#define DIRECT_RECORD_PROP      "rw.camera.direct.record"
+// framework queues a whole request batch of high speed video.
+#define NUM_HIGH_SPEED_BUFFER   8
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 #define  ALIGN_PIXEL_4(x)  ((x+ 3) & ~3)
@@ -101,9 +120,18 @@
 using namespace android;
 
 int convertPixelFormatToV4L2Format(PixelFormat format, bool invert=false);
+// V4L2 buffer time in CLOCK_BOOTTIME of sensor timestamp, 0 if driver
+// doesn't stamp frames with monotonic clock.
+nsecs_t getV4l2Timestamp(const struct timeval& tv, uint32_t flags);
+// CLOCK_MONOTONIC time of sensor timestamp, current time if it's 0.
+nsecs_t getMonotonicTime(nsecs_t timestamp);
+// set calling thread to SCHED_FIFO priority of rw.camera.capture.priority
+// and cpu mask of rw.camera.capture.cpus, 0 keeps normal policy or any cpu.
+void setCaptureThreadPolicy();
 
 class Metadata;
 class Stream;
+class Camera;
 
 struct SensorSet
 {
@@ -156,12 +184,43 @@ public:
 
     //for uvc jpeg stream
     void *mpFrameBuf;
+    // frames of shared sensor clients using this buffer.
+    uint32_t mRefs;
+    // fields of captured frame are already deinterlaced.
+    bool mDeinterlaced;
+    // when frame was dequeued from V4L2.
+    nsecs_t mTimestamp;
+    // driver capture time for shutter and result, 0 if not known.
+    nsecs_t mSensorTimestamp;
+};
+
+// buffer index by physical address, open addressing with stale
+// entries validated by caller against its buffer table.
+#define BUFFER_MAP_SIZE (MAX_STREAM_BUFFERS * 2)
+
+class BufferIndexMap
+{
+public:
+    BufferIndexMap();
+    void clear();
+    // replace entry of phys, table is cleared when full.
+    void add(int32_t phys, int32_t index);
+    // -1 if phys is not known.
+    int32_t find(int32_t phys) const;
+
+private:
+    static uint32_t hash(int32_t phys);
+
+    int32_t mPhys[BUFFER_MAP_SIZE];
+    int32_t mIndex[BUFFER_MAP_SIZE];
+    uint32_t mCount;
 };
 
 enum RequestType {
     TYPE_PREVIEW = 1,
     TYPE_SNAPSHOT = 2,
-    TYPE_STILLCAP = 3
+    TYPE_STILLCAP = 3,
+    TYPE_ZSL = 4
 };
 
 class CaptureRequest : public LightRefBase<CaptureRequest>
@@ -173,17 +232,32 @@ public:
     void init(camera3_capture_request* request, camera3_callback_ops* callback,
               sp<Metadata> settings);
     int32_t onCaptureDone(StreamBuffer* buffer);
-    int32_t onSettingsDone(sp<Metadata> meta);
+    int32_t onSettingsDone(Metadata& meta);
     int32_t onCaptureError();
+    // return one buffer with error status.
+    int32_t onCaptureError(StreamBuffer* buffer);
+    // request dropped before capture, e.g. by flush.
+    int32_t onRequestError();
+    // return input buffer of reprocess request.
+    int32_t onInputDone(bool error);
 
 public:
     uint32_t mFrameNumber;
     sp<Metadata> mSettings;
     uint32_t mOutBuffersNumber;
     StreamBuffer* mOutBuffers[MAX_STREAM_BUFFERS];
+    // input buffer of reprocess request, NULL for sensor capture.
+    StreamBuffer* mInputBuffer;
 
     camera3_capture_request* mRequest;
     camera3_callback_ops *mCallbackOps;
+    // logical camera which sent request, sensor may be shared.
+    Camera* mCamera;
+    // FRAME_* stage times for FrameStats.
+    nsecs_t mTimestamps[FRAME_STAMP_NUM];
+    // CLOCK_MONOTONIC capture time marked into preview outputs in
+    // latency mode, 0 otherwise.
+    nsecs_t mCaptureTime;
 };
 
 class SensorData
@@ -208,10 +282,15 @@ public:
 
     int32_t getSensorFormat(int32_t availFormat);
 
+    // fps of constrained high speed mode for size, 0 if none.
+    int32_t getHighSpeedFps(int width, int height);
+
 protected:
     int32_t changeSensorFormats(int *src, int *dst, int len);
     status_t adjustPreviewResolutions();
     status_t setMaxPictureResolutions();
+    // mode is taken only for a preview size sensor reported.
+    void addHighSpeedMode(int width, int height, int fps);
 
 public:
     int mPreviewResolutions[MAX_RESOLUTION_SIZE];
@@ -223,6 +302,9 @@ public:
     nsecs_t mMinFrameDuration;
     nsecs_t mMaxFrameDuration;
     int mTargetFpsRange[MAX_FPS_RANGE];
+    // width, height, fps of each mode, count in ints.
+    int mHighSpeedModes[MAX_HIGH_SPEED_MODE * 3];
+    int mHighSpeedModeCount;
     int mMaxWidth;
     int mMaxHeight;
     float mPhysicalWidth;
@@ -0,0 +1,735 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ColorConvert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_HAVE_NEON 1
+#else
+#define CONVERT_HAVE_NEON 0
+#endif
+
+static bool sNeon = CONVERT_HAVE_NEON;
+
+void setConvertNeon(bool enable)
+{
+    sNeon = enable && CONVERT_HAVE_NEON;
+}
+
+// pixels handled by scalar code, from start to end of row.
+static void yuyvRowScalar(const uint8_t* src, uint8_t* y, uint8_t* uv,
+                          uint32_t start, uint32_t end, bool vu)
+{
+    for (uint32_t x = start; x + 1 < end; x += 2) {
+        const uint8_t* p = src + x * 2;
+        y[x] = p[0];
+        y[x + 1] = p[2];
+        if (uv != NULL) {
+            uv[x] = vu ? p[3] : p[1];
+            uv[x + 1] = vu ? p[1] : p[3];
+        }
+    }
+}
+
+static void yuyvRow(const uint8_t* src, uint8_t* y, uint8_t* uv,
+                    uint32_t width, bool vu)
+{
+    uint32_t x = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        // 32 pixels per step: Y0 U Y1 V deinterleaved by vld4.
+        for (; x + 32 <= width; x += 32) {
+            uint8x16x4_t in = vld4q_u8(src + x * 2);
+            uint8x16x2_t luma;
+            luma.val[0] = in.val[0];
+            luma.val[1] = in.val[2];
+            vst2q_u8(y + x, luma);
+            if (uv != NULL) {
+                uint8x16x2_t chroma;
+                if (vu) {
+                    chroma.val[0] = in.val[3];
+                    chroma.val[1] = in.val[1];
+                }
+                else {
+                    chroma.val[0] = in.val[1];
+                    chroma.val[1] = in.val[3];
+                }
+                vst2q_u8(uv + x, chroma);
+            }
+        }
+    }
+#endif
+    yuyvRowScalar(src, y, uv, x, width, vu);
+}
+
+static void yuv444RowScalar(const uint8_t* src, uint8_t* y, uint8_t* uv,
+                            uint32_t start, uint32_t end)
+{
+    uint32_t x = start;
+    for (; x + 1 < end; x += 2) {
+        const uint8_t* p = src + x * 4;
+        y[x] = p[2];
+        y[x + 1] = p[6];
+        if (uv != NULL) {
+            uv[x] = p[1];
+            uv[x + 1] = p[0];
+        }
+    }
+
+    // last column of odd width, chroma row has room for its U only.
+    if (x < end) {
+        const uint8_t* p = src + x * 4;
+        y[x] = p[2];
+        if (uv != NULL) {
+            uv[x] = p[1];
+        }
+    }
+}
+
+static void yuv444Row(const uint8_t* src, uint8_t* y, uint8_t* uv,
+                      uint32_t width)
+{
+    uint32_t x = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        // 32 pixels per step: V U Y A deinterleaved by vld4, chroma
+        // of even pixels picked by vuzp.
+        for (; x + 32 <= width; x += 32) {
+            uint8x16x4_t lo = vld4q_u8(src + x * 4);
+            uint8x16x4_t hi = vld4q_u8(src + x * 4 + 64);
+            vst1q_u8(y + x, lo.val[2]);
+            vst1q_u8(y + x + 16, hi.val[2]);
+            if (uv != NULL) {
+                uint8x16x2_t chroma;
+                chroma.val[0] = vuzpq_u8(lo.val[1], hi.val[1]).val[0];
+                chroma.val[1] = vuzpq_u8(lo.val[0], hi.val[0]).val[0];
+                vst2q_u8(uv + x, chroma);
+            }
+        }
+    }
+#endif
+    yuv444RowScalar(src, y, uv, x, width);
+}
+
+static void swapScalar(uint8_t* uv, size_t start, size_t end)
+{
+    for (size_t i = start; i + 1 < end; i += 2) {
+        uint8_t t = uv[i];
+        uv[i] = uv[i + 1];
+        uv[i + 1] = t;
+    }
+}
+
+static void swapRange(uint8_t* uv, size_t start, size_t end)
+{
+    size_t i = start;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        for (; i + 16 <= end; i += 16) {
+            vst1q_u8(uv + i, vrev16q_u8(vld1q_u8(uv + i)));
+        }
+    }
+#endif
+    swapScalar(uv, i, end);
+}
+
+static void splitChromaScalar(const uint8_t* uv, uint8_t* u, uint8_t* v,
+                              uint32_t start, uint32_t end)
+{
+    for (uint32_t i = start; i < end; i++) {
+        u[i] = uv[i * 2];
+        v[i] = uv[i * 2 + 1];
+    }
+}
+
+static void mergeChromaScalar(const uint8_t* u, const uint8_t* v, uint8_t* uv,
+                              uint32_t start, uint32_t end)
+{
+    for (uint32_t i = start; i < end; i++) {
+        uv[i * 2] = u[i];
+        uv[i * 2 + 1] = v[i];
+    }
+}
+
+static void splitYUYVScalar(const uint8_t* src, uint8_t* y, uint8_t* u,
+                            uint8_t* v, uint32_t start, uint32_t end)
+{
+    for (uint32_t i = start; i < end; i++) {
+        const uint8_t* p = src + i * 4;
+        y[i * 2] = p[0];
+        y[i * 2 + 1] = p[2];
+        u[i] = p[1];
+        v[i] = p[3];
+    }
+}
+
+// rebuild one bottom field row from rows above and below, motion
+// mode keeps captured bytes that differ little from last frame.
+static void deinterlaceRowScalar(const uint8_t* above, const uint8_t* below,
+                                 uint8_t* cur, uint8_t* history,
+                                 uint32_t start, uint32_t end)
+{
+    for (uint32_t i = start; i < end; i++) {
+        uint8_t interp = (uint8_t)((above[i] + below[i] + 1) >> 1);
+        if (history == NULL) {
+            cur[i] = interp;
+            continue;
+        }
+
+        uint8_t captured = cur[i];
+        int diff = captured - history[i];
+        if (diff < 0) {
+            diff = -diff;
+        }
+        cur[i] = diff > DEINTERLACE_MOTION_THRESHOLD ? interp : captured;
+        history[i] = captured;
+    }
+}
+
+static void deinterlaceRow(const uint8_t* above, const uint8_t* below,
+                           uint8_t* cur, uint8_t* history, uint32_t bytes)
+{
+    uint32_t i = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        if (history == NULL) {
+            for (; i + 16 <= bytes; i += 16) {
+                vst1q_u8(cur + i, vrhaddq_u8(vld1q_u8(above + i),
+                                             vld1q_u8(below + i)));
+            }
+        } else {
+            uint8x16_t threshold = vdupq_n_u8(DEINTERLACE_MOTION_THRESHOLD);
+            for (; i + 16 <= bytes; i += 16) {
+                uint8x16_t interp = vrhaddq_u8(vld1q_u8(above + i),
+                                               vld1q_u8(below + i));
+                uint8x16_t captured = vld1q_u8(cur + i);
+                uint8x16_t moved = vcgtq_u8(vabdq_u8(captured,
+                                       vld1q_u8(history + i)), threshold);
+                vst1q_u8(cur + i, vbslq_u8(moved, interp, captured));
+                vst1q_u8(history + i, captured);
+            }
+        }
+    }
+#endif
+    deinterlaceRowScalar(above, below, cur, history, i, bytes);
+}
+
+struct ConvertBand
+{
+    const uint8_t* src;
+    uint8_t* dst;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowStart;
+    uint32_t rowEnd;
+    size_t byteStart;
+    size_t byteEnd;
+    bool vu;
+    const struct ResizeTable* table;
+    const uint8_t* resizeSrc;
+    uint8_t* history;
+};
+
+static void* yuyvBand(void* data)
+{
+    ConvertBand* band = (ConvertBand*)data;
+    uint8_t* planeY = band->dst;
+    uint8_t* planeUV = band->dst + band->width * band->height;
+    uint32_t chromaRows = band->height / 2;
+    for (uint32_t h = band->rowStart; h < band->rowEnd; h++) {
+        const uint8_t* src = band->src + h * band->width * 2;
+        // last row of odd height has no chroma row in NV12 plane.
+        uint8_t* uv = ((h & 0x1) || h >= chromaRows * 2) ? NULL :
+                      planeUV + (h / 2) * band->width;
+        yuyvRow(src, planeY + h * band->width, uv, band->width, band->vu);
+    }
+
+    return NULL;
+}
+
+static void* yuv444Band(void* data)
+{
+    ConvertBand* band = (ConvertBand*)data;
+    uint8_t* planeY = band->dst;
+    uint8_t* planeUV = band->dst + band->width * band->height;
+    uint32_t chromaRows = band->height / 2;
+    for (uint32_t h = band->rowStart; h < band->rowEnd; h++) {
+        const uint8_t* src = band->src + h * band->width * 4;
+        // last row of odd height has no chroma row in NV12 plane.
+        uint8_t* uv = ((h & 0x1) || h >= chromaRows * 2) ? NULL :
+                      planeUV + (h / 2) * band->width;
+        yuv444Row(src, planeY + h * band->width, uv, band->width);
+    }
+
+    return NULL;
+}
+
+static void* swapBand(void* data)
+{
+    ConvertBand* band = (ConvertBand*)data;
+    swapRange(band->dst, band->byteStart, band->byteEnd);
+    return NULL;
+}
+
+// rows of band are bottom field rows, odd rows of plane.
+static void* deinterlaceBand(void* data)
+{
+    ConvertBand* band = (ConvertBand*)data;
+    uint32_t bytes = band->width;
+    for (uint32_t h = band->rowStart | 1; h < band->rowEnd; h += 2) {
+        const uint8_t* above = band->dst + (h - 1) * bytes;
+        // last row of even height plane has no row below.
+        const uint8_t* below = (h + 1 < band->height) ?
+                               band->dst + (h + 1) * bytes : above;
+        uint8_t* history = band->history ?
+                           band->history + (h / 2) * bytes : NULL;
+        deinterlaceRow(above, below, band->dst + h * bytes, history, bytes);
+    }
+
+    return NULL;
+}
+
+static uint32_t getBandNum(uint32_t pixels,
+                           uint32_t minPixels = CONVERT_PARALLEL_PIXELS)
+{
+    if (pixels < minPixels) {
+        return 1;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    if (cpus > CONVERT_MAX_THREADS) {
+        cpus = CONVERT_MAX_THREADS;
+    }
+
+    return (uint32_t)cpus;
+}
+
+// run first band in caller thread, others in their own threads.
+static void runBands(ConvertBand* bands, uint32_t num, void* (*func)(void*))
+{
+    pthread_t threads[CONVERT_MAX_THREADS];
+    bool started[CONVERT_MAX_THREADS];
+
+    for (uint32_t i = 1; i < num; i++) {
+        started[i] = pthread_create(&threads[i], NULL, func, &bands[i]) == 0;
+        if (!started[i]) {
+            func(&bands[i]);
+        }
+    }
+
+    func(&bands[0]);
+
+    for (uint32_t i = 1; i < num; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+void convertYUYVToNV12(const uint8_t* src, uint8_t* dst,
+                       uint32_t width, uint32_t height, bool vu)
+{
+    if (src == NULL || dst == NULL || width < 2) {
+        return;
+    }
+
+    ConvertBand bands[CONVERT_MAX_THREADS];
+    uint32_t num = getBandNum(width * height);
+    // bands start at even rows which carry chroma.
+    uint32_t rows = ((height / num) + 1) & ~1;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    for (; n < num && row < height; n++) {
+        bands[n].src = src;
+        bands[n].dst = dst;
+        bands[n].width = width;
+        bands[n].height = height;
+        bands[n].rowStart = row;
+        row = (n == num - 1 || row + rows > height) ? height : row + rows;
+        bands[n].rowEnd = row;
+        bands[n].vu = vu;
+    }
+
+    runBands(bands, n, yuyvBand);
+}
+
+void convertYUV444ToNV12(const uint8_t* src, uint8_t* dst,
+                         uint32_t width, uint32_t height)
+{
+    if (src == NULL || dst == NULL || width < 2) {
+        return;
+    }
+
+    ConvertBand bands[CONVERT_MAX_THREADS];
+    // source is 4 bytes per pixel, so PAL frame is worth splitting.
+    uint32_t num = getBandNum(width * height, CONVERT_PARALLEL_PIXELS / 4);
+    // bands start at even rows which carry chroma.
+    uint32_t rows = ((height / num) + 1) & ~1;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    for (; n < num && row < height; n++) {
+        bands[n].src = src;
+        bands[n].dst = dst;
+        bands[n].width = width;
+        bands[n].height = height;
+        bands[n].rowStart = row;
+        row = (n == num - 1 || row + rows > height) ? height : row + rows;
+        bands[n].rowEnd = row;
+    }
+
+    runBands(bands, n, yuv444Band);
+}
+
+void swapChromaBytes(uint8_t* uv, size_t size)
+{
+    if (uv == NULL || size < 2) {
+        return;
+    }
+
+    ConvertBand bands[CONVERT_MAX_THREADS];
+    uint32_t num = getBandNum(size * 2);
+    // bands are whole chroma pairs.
+    size_t bytes = ((size / num) + 1) & ~(size_t)1;
+    size_t pos = 0;
+    uint32_t n = 0;
+    for (; n < num && pos < size; n++) {
+        bands[n].dst = uv;
+        bands[n].byteStart = pos;
+        pos = (n == num - 1 || pos + bytes > size) ? size : pos + bytes;
+        bands[n].byteEnd = pos;
+    }
+
+    runBands(bands, n, swapBand);
+}
+
+void splitChroma(const uint8_t* uv, uint8_t* u, uint8_t* v, uint32_t pairs)
+{
+    uint32_t i = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        for (; i + 16 <= pairs; i += 16) {
+            uint8x16x2_t in = vld2q_u8(uv + i * 2);
+            vst1q_u8(u + i, in.val[0]);
+            vst1q_u8(v + i, in.val[1]);
+        }
+    }
+#endif
+    splitChromaScalar(uv, u, v, i, pairs);
+}
+
+void mergeChroma(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t pairs)
+{
+    uint32_t i = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        for (; i + 16 <= pairs; i += 16) {
+            uint8x16x2_t out;
+            out.val[0] = vld1q_u8(u + i);
+            out.val[1] = vld1q_u8(v + i);
+            vst2q_u8(uv + i * 2, out);
+        }
+    }
+#endif
+    mergeChromaScalar(u, v, uv, i, pairs);
+}
+
+void splitYUYV(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+               uint32_t pairs)
+{
+    uint32_t i = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        // 16 pairs per step: Y0 U Y1 V deinterleaved by vld4.
+        for (; i + 16 <= pairs; i += 16) {
+            uint8x16x4_t in = vld4q_u8(src + i * 4);
+            uint8x16x2_t luma;
+            luma.val[0] = in.val[0];
+            luma.val[1] = in.val[2];
+            vst2q_u8(y + i * 2, luma);
+            vst1q_u8(u + i, in.val[1]);
+            vst1q_u8(v + i, in.val[3]);
+        }
+    }
+#endif
+    splitYUYVScalar(src, y, u, v, i, pairs);
+}
+
+void deinterlacePlane(uint8_t* plane, uint32_t rowBytes, uint32_t rows,
+                      uint8_t* history, int mode)
+{
+    if (plane == NULL || rowBytes == 0 || rows < 2 ||
+            mode == DEINTERLACE_WEAVE) {
+        return;
+    }
+
+    ConvertBand bands[CONVERT_MAX_THREADS];
+    // one pass over half of rows, PAL YUYV frame is worth splitting.
+    uint32_t num = getBandNum(rowBytes / 2 * rows, CONVERT_PARALLEL_PIXELS / 4);
+    // bands start at even rows, odd rows only read their neighbours.
+    uint32_t step = ((rows / num) + 1) & ~1;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    for (; n < num && row < rows; n++) {
+        bands[n].dst = plane;
+        bands[n].width = rowBytes;
+        bands[n].height = rows;
+        bands[n].rowStart = row;
+        row = (n == num - 1 || row + step > rows) ? rows : row + step;
+        bands[n].rowEnd = row;
+        bands[n].history = (mode == DEINTERLACE_MOTION) ? history : NULL;
+    }
+
+    runBands(bands, n, deinterlaceBand);
+}
+
+// 7 bit fraction so weights fit in a byte for vmull_u8.
+#define RESIZE_FRAC_BITS 7
+#define RESIZE_FRAC_ONE (1 << RESIZE_FRAC_BITS)
+#define RESIZE_TABLE_NUM 2
+
+struct ResizeAxis
+{
+    uint32_t* index;
+    uint8_t* frac;
+};
+
+struct ResizeTable
+{
+    uint32_t srcWidth;
+    uint32_t srcHeight;
+    uint32_t dstWidth;
+    uint32_t dstHeight;
+    // luma and interleaved chroma axes.
+    ResizeAxis lumaX;
+    ResizeAxis lumaY;
+    ResizeAxis chromaX;
+    ResizeAxis chromaY;
+    uint8_t* data;
+};
+
+// last geometries, thumbnail and main picture usually.
+static ResizeTable sResizeTables[RESIZE_TABLE_NUM];
+static uint32_t sResizeNext = 0;
+static pthread_mutex_t sResizeLock = PTHREAD_MUTEX_INITIALIZER;
+
+// map dst to src keeping index + 1 inside src, same as VT_resizeFrame.
+static void fillAxis(ResizeAxis& axis, uint32_t src, uint32_t dst)
+{
+    uint32_t step = src > 1 ? ((src - 1) << 16) / dst : 0;
+    for (uint32_t i = 0; i < dst; i++) {
+        uint32_t pos = i * step;
+        axis.index[i] = pos >> 16;
+        axis.frac[i] = (pos >> (16 - RESIZE_FRAC_BITS)) & (RESIZE_FRAC_ONE - 1);
+    }
+}
+
+static int buildTable(ResizeTable& table, uint32_t srcWidth, uint32_t srcHeight,
+                      uint32_t dstWidth, uint32_t dstHeight)
+{
+    uint32_t count = dstWidth + dstHeight + dstWidth / 2 + dstHeight / 2;
+    uint8_t* data = (uint8_t*)malloc(count * (sizeof(uint32_t) + 1));
+    if (data == NULL) {
+        return -ENOMEM;
+    }
+
+    free(table.data);
+    table.data = data;
+    ResizeAxis* axes[] = {&table.lumaX, &table.lumaY,
+                          &table.chromaX, &table.chromaY};
+    uint32_t sizes[] = {dstWidth, dstHeight, dstWidth / 2, dstHeight / 2};
+    uint32_t* index = (uint32_t*)data;
+    uint8_t* frac = data + count * sizeof(uint32_t);
+    for (int i = 0; i < 4; i++) {
+        axes[i]->index = index;
+        axes[i]->frac = frac;
+        index += sizes[i];
+        frac += sizes[i];
+    }
+
+    fillAxis(table.lumaX, srcWidth, dstWidth);
+    fillAxis(table.lumaY, srcHeight, dstHeight);
+    fillAxis(table.chromaX, srcWidth / 2, dstWidth / 2);
+    fillAxis(table.chromaY, srcHeight / 2, dstHeight / 2);
+    table.srcWidth = srcWidth;
+    table.srcHeight = srcHeight;
+    table.dstWidth = dstWidth;
+    table.dstHeight = dstHeight;
+
+    return 0;
+}
+
+// caller holds sResizeLock.
+static const ResizeTable* getResizeTable(uint32_t srcWidth, uint32_t srcHeight,
+                                         uint32_t dstWidth, uint32_t dstHeight)
+{
+    for (uint32_t i = 0; i < RESIZE_TABLE_NUM; i++) {
+        ResizeTable& table = sResizeTables[i];
+        if (table.data != NULL && table.srcWidth == srcWidth &&
+                table.srcHeight == srcHeight && table.dstWidth == dstWidth &&
+                table.dstHeight == dstHeight) {
+            return &table;
+        }
+    }
+
+    ResizeTable& table = sResizeTables[sResizeNext];
+    if (buildTable(table, srcWidth, srcHeight, dstWidth, dstHeight) != 0) {
+        return NULL;
+    }
+    sResizeNext = (sResizeNext + 1) % RESIZE_TABLE_NUM;
+
+    return &table;
+}
+
+// horizontal pass, step 1 for luma and 2 for interleaved chroma.
+static void resizeRowX(const uint8_t* src, uint8_t* dst,
+                       const ResizeAxis& axis, uint32_t num, uint32_t step)
+{
+    for (uint32_t i = 0; i < num; i++) {
+        const uint8_t* p = src + axis.index[i] * step;
+        uint32_t f = axis.frac[i];
+        for (uint32_t c = 0; c < step; c++) {
+            dst[c] = (p[c] * (RESIZE_FRAC_ONE - f) + p[c + step] * f +
+                      RESIZE_FRAC_ONE / 2) >> RESIZE_FRAC_BITS;
+        }
+        dst += step;
+    }
+}
+
+// vertical pass between two horizontally scaled rows.
+static void resizeRowY(const uint8_t* top, const uint8_t* bottom,
+                       uint8_t* dst, uint32_t size, uint32_t f)
+{
+    uint32_t i = 0;
+#if CONVERT_HAVE_NEON
+    if (sNeon) {
+        uint8x8_t wTop = vdup_n_u8(RESIZE_FRAC_ONE - f);
+        uint8x8_t wBottom = vdup_n_u8(f);
+        for (; i + 16 <= size; i += 16) {
+            uint8x16_t a = vld1q_u8(top + i);
+            uint8x16_t b = vld1q_u8(bottom + i);
+            uint16x8_t lo = vmull_u8(vget_low_u8(a), wTop);
+            uint16x8_t hi = vmull_u8(vget_high_u8(a), wTop);
+            lo = vmlal_u8(lo, vget_low_u8(b), wBottom);
+            hi = vmlal_u8(hi, vget_high_u8(b), wBottom);
+            vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, RESIZE_FRAC_BITS),
+                                          vrshrn_n_u16(hi, RESIZE_FRAC_BITS)));
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        dst[i] = (top[i] * (RESIZE_FRAC_ONE - f) + bottom[i] * f +
+                  RESIZE_FRAC_ONE / 2) >> RESIZE_FRAC_BITS;
+    }
+}
+
+static void resizePlane(const uint8_t* src, uint32_t srcStride, uint8_t* dst,
+                        uint32_t dstStride, const ResizeAxis& axisX,
+                        const ResizeAxis& axisY, uint32_t num, uint32_t step,
+                        uint32_t rowStart, uint32_t rowEnd, uint8_t* scratch)
+{
+    uint8_t* top = scratch;
+    uint8_t* bottom = scratch + dstStride;
+    uint32_t cached = 0;
+    bool valid = false;
+    for (uint32_t h = rowStart; h < rowEnd; h++) {
+        uint32_t y = axisY.index[h];
+        // upscale reuses rows scaled for previous line.
+        if (!valid || y != cached) {
+            const uint8_t* row = src + y * srcStride;
+            if (valid && y == cached + 1) {
+                uint8_t* t = top;
+                top = bottom;
+                bottom = t;
+            }
+            else {
+                resizeRowX(row, top, axisX, num, step);
+            }
+            resizeRowX(row + srcStride, bottom, axisX, num, step);
+            cached = y;
+            valid = true;
+        }
+        resizeRowY(top, bottom, dst + h * dstStride, num * step, axisY.frac[h]);
+    }
+}
+
+static void* resizeBand(void* data)
+{
+    ConvertBand* band = (ConvertBand*)data;
+    const ResizeTable* table = band->table;
+    uint32_t dstWidth = table->dstWidth;
+    uint8_t* scratch = (uint8_t*)malloc(dstWidth * 2);
+    if (scratch == NULL) {
+        return NULL;
+    }
+
+    const uint8_t* srcUV = band->resizeSrc + table->srcWidth * table->srcHeight;
+    uint8_t* dstUV = band->dst + dstWidth * table->dstHeight;
+    resizePlane(band->resizeSrc, table->srcWidth, band->dst, dstWidth,
+                table->lumaX, table->lumaY, dstWidth, 1,
+                band->rowStart, band->rowEnd, scratch);
+    // band starts at even rows, so chroma rows split cleanly.
+    resizePlane(srcUV, table->srcWidth, dstUV, dstWidth,
+                table->chromaX, table->chromaY, dstWidth / 2, 2,
+                band->rowStart / 2, band->rowEnd / 2, scratch);
+    free(scratch);
+
+    return NULL;
+}
+
+int resizeNV12(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight,
+               uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight)
+{
+    if (src == NULL || dst == NULL || srcWidth < 4 || srcHeight < 4 ||
+            dstWidth < 2 || dstHeight < 2) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&sResizeLock);
+    const ResizeTable* table = getResizeTable(srcWidth, srcHeight,
+                                              dstWidth, dstHeight);
+    if (table == NULL) {
+        pthread_mutex_unlock(&sResizeLock);
+        return -ENOMEM;
+    }
+
+    ConvertBand bands[CONVERT_MAX_THREADS];
+    uint32_t num = getBandNum(dstWidth * dstHeight);
+    uint32_t rows = ((dstHeight / num) + 1) & ~1;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    for (; n < num && row < dstHeight; n++) {
+        bands[n].dst = dst;
+        bands[n].resizeSrc = src;
+        bands[n].table = table;
+        bands[n].rowStart = row;
+        row = (n == num - 1 || row + rows > dstHeight) ? dstHeight : row + rows;
+        bands[n].rowEnd = row;
+    }
+
+    runBands(bands, n, resizeBand);
+    pthread_mutex_unlock(&sResizeLock);
+
+    return 0;
+}
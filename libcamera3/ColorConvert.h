@@ -0,0 +1,67 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COLOR_CONVERT_H_
+#define _COLOR_CONVERT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// frames of at least this many pixels are converted in row bands.
+#define CONVERT_PARALLEL_PIXELS (1280 * 720)
+#define CONVERT_MAX_THREADS 4
+
+// YUYV to NV12 semi planar, chroma order VU when vu is set.
+// chroma of even rows is used, width must be even.
+void convertYUYVToNV12(const uint8_t* src, uint8_t* dst,
+                       uint32_t width, uint32_t height, bool vu);
+// 32 bit V U Y A pixels (VADC YUV444) to NV12, chroma of even
+// rows and columns is used, width must be even.
+void convertYUV444ToNV12(const uint8_t* src, uint8_t* dst,
+                         uint32_t width, uint32_t height);
+// swap bytes of interleaved chroma plane, NV12 <-> NV21 in place.
+void swapChromaBytes(uint8_t* uv, size_t size);
+// split pairs of interleaved chroma bytes into two planes.
+void splitChroma(const uint8_t* uv, uint8_t* u, uint8_t* v, uint32_t pairs);
+// interleave two chroma planes into pairs, inverse of splitChroma.
+void mergeChroma(const uint8_t* u, const uint8_t* v, uint8_t* uv, uint32_t pairs);
+// split pairs of YUYV pixels into luma and chroma planes.
+void splitYUYV(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+               uint32_t pairs);
+// deinterlace modes, top field rows are kept as captured.
+enum {
+    // fields stay woven as captured.
+    DEINTERLACE_WEAVE = 0,
+    // bottom field rows interpolated from top field, line doubling.
+    DEINTERLACE_BOB = 1,
+    // bottom field rows interpolated only where they moved.
+    DEINTERLACE_MOTION = 2,
+};
+// bytes differing more from last frame count as motion.
+#define DEINTERLACE_MOTION_THRESHOLD 24
+// deinterlace woven rows of one plane in place. history holds
+// bottom field of last frame, rows / 2 * rowBytes, and is updated.
+// motion mode with NULL history is bob.
+void deinterlacePlane(uint8_t* plane, uint32_t rowBytes, uint32_t rows,
+                      uint8_t* history, int mode);
+// bilinear NV12 scale, coefficients are cached per geometry.
+// return 0 on success, -EINVAL on bad size.
+int resizeNV12(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight,
+               uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight);
+// use NEON code, false for scalar fallback.
+void setConvertNeon(bool enable);
+
+#endif
@@ -121,8 +121,12 @@ int32_t DMAStream::onFrameAcquireLocked()
         return -1;
     }
 
-    int32_t index = cfilledbuffer.index;
     ALOGV("acquire index:%d", cfilledbuffer.index);
+    if (cfilledbuffer.index < MAX_STREAM_BUFFERS &&
+            mBuffers[cfilledbuffer.index] != NULL) {
+        mBuffers[cfilledbuffer.index]->mSensorTimestamp =
+            getV4l2Timestamp(cfilledbuffer.timestamp, cfilledbuffer.flags);
+    }
     return cfilledbuffer.index;
 }
 
@@ -147,6 +151,15 @@ int32_t DMAStream::onFrameReturnLocked(int32_t index, StreamBuffer& buf)
     return 0;
 }
 
+int32_t DMAStream::onDirectReturnLocked(int32_t index, StreamBuffer& buf)
+{
+    if (buf.mFd < 0 || (int32_t)buf.mSize < mStreamSize) {
+        return -1;
+    }
+
+    return DMAStream::onFrameReturnLocked(index, buf);
+}
+
 int32_t DMAStream::getDeviceBufferSize()
 {
     return getFormatSize();
@@ -38,6 +38,8 @@ public:
     virtual int32_t onFrameAcquireLocked();
     // put buffer back to V4L2.
     virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf);
+    // put framework buffer to V4L2 to capture into it.
+    virtual int32_t onDirectReturnLocked(int32_t index, StreamBuffer& buf);
 
     // allocate buffers.
     virtual int32_t allocateBuffersLocked();
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "FrameStats.h"
+
+// upper bound of each bucket in us, last one is open.
+static const uint32_t sBucketLimits[LATENCY_BUCKETS - 1] = {
+    1000, 2000, 4000, 8000, 16000, 33000, 66000
+};
+
+static const char* sBucketNames[LATENCY_BUCKETS] = {
+    "<1", "<2", "<4", "<8", "<16", "<33", "<66", ">=66"
+};
+
+static const char* sEngineNames[ENGINE_NUM] = {
+    "ipu", "pxp", "g2d", "cpu", "jpeg"
+};
+
+LatencyHistogram::LatencyHistogram()
+    : mNext(0), mCount(0), mSum(0)
+{
+    memset(mSamples, 0, sizeof(mSamples));
+    memset(mBuckets, 0, sizeof(mBuckets));
+}
+
+uint32_t LatencyHistogram::getBucket(uint32_t us)
+{
+    uint32_t i = 0;
+    for (; i < LATENCY_BUCKETS - 1; i++) {
+        if (us < sBucketLimits[i]) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+void LatencyHistogram::add(nsecs_t latency)
+{
+    if (latency < 0) {
+        return;
+    }
+
+    uint32_t us = (uint32_t)(latency / 1000);
+    if (mCount == LATENCY_WINDOW) {
+        // oldest sample leaves window.
+        uint32_t old = mSamples[mNext];
+        mBuckets[getBucket(old)]--;
+        mSum -= old;
+    }
+    else {
+        mCount++;
+    }
+
+    mSamples[mNext] = us;
+    mNext = (mNext + 1) % LATENCY_WINDOW;
+    mBuckets[getBucket(us)]++;
+    mSum += us;
+}
+
+void LatencyHistogram::dump(int fd, const char* name)
+{
+    if (mCount == 0) {
+        return;
+    }
+
+    uint32_t max = 0;
+    for (uint32_t i = 0; i < mCount; i++) {
+        if (mSamples[i] > max) {
+            max = mSamples[i];
+        }
+    }
+
+    dprintf(fd, "  %-8s avg %6.2f max %6.2f ms |", name,
+            mSum / 1000.0 / mCount, max / 1000.0);
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        dprintf(fd, " %s:%u", sBucketNames[i], mBuckets[i]);
+    }
+    dprintf(fd, "\n");
+}
+
+FrameStats::FrameStats()
+    : mFrames(0), mDropped(0)
+{
+}
+
+void FrameStats::onResult(const nsecs_t* stamps)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    android::Mutex::Autolock al(mLock);
+    mFrames++;
+    if (stamps[FRAME_QUEUED] == 0) {
+        return;
+    }
+
+    // stages not reached keep 0 and are skipped.
+    if (stamps[FRAME_STARTED] != 0) {
+        mQueue.add(stamps[FRAME_STARTED] - stamps[FRAME_QUEUED]);
+    }
+    if (stamps[FRAME_SETTINGS] != 0 && stamps[FRAME_STARTED] != 0) {
+        mSettings.add(stamps[FRAME_SETTINGS] - stamps[FRAME_STARTED]);
+    }
+    if (stamps[FRAME_DEQUEUED] != 0 && stamps[FRAME_SETTINGS] != 0) {
+        mSensor.add(stamps[FRAME_DEQUEUED] - stamps[FRAME_SETTINGS]);
+    }
+    if (stamps[FRAME_DEQUEUED] != 0) {
+        mProcess.add(now - stamps[FRAME_DEQUEUED]);
+    }
+    mTotal.add(now - stamps[FRAME_QUEUED]);
+}
+
+void FrameStats::onDropped()
+{
+    android::Mutex::Autolock al(mLock);
+    mDropped++;
+}
+
+void FrameStats::onEngine(int32_t engine, nsecs_t time)
+{
+    if (engine < 0 || engine >= ENGINE_NUM) {
+        return;
+    }
+
+    android::Mutex::Autolock al(mLock);
+    mEngines[engine].add(time);
+}
+
+void FrameStats::onFenceWait(nsecs_t time)
+{
+    android::Mutex::Autolock al(mLock);
+    mFence.add(time);
+}
+
+void FrameStats::dump(int fd)
+{
+    android::Mutex::Autolock al(mLock);
+
+    dprintf(fd, "Frames: %llu Dropped: %llu\n",
+            (unsigned long long)mFrames, (unsigned long long)mDropped);
+    dprintf(fd, "Latency of last %d frames (ms buckets):\n", LATENCY_WINDOW);
+    mQueue.dump(fd, "queue");
+    mSettings.dump(fd, "settings");
+    mSensor.dump(fd, "sensor");
+    mProcess.dump(fd, "process");
+    mTotal.dump(fd, "total");
+    mFence.dump(fd, "fence");
+    for (int32_t i = 0; i < ENGINE_NUM; i++) {
+        mEngines[i].dump(fd, sEngineNames[i]);
+    }
+}
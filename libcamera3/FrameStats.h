@@ -0,0 +1,93 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAME_STATS_H_
+#define _FRAME_STATS_H_
+
+#include <stdint.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+
+// timestamps carried by capture request.
+enum {
+    FRAME_QUEUED = 0,
+    // capture thread starts request.
+    FRAME_STARTED,
+    FRAME_SETTINGS,
+    // V4L2 frame of request is dequeued.
+    FRAME_DEQUEUED,
+    FRAME_STAMP_NUM
+};
+
+// conversion engines timed per output buffer.
+enum {
+    ENGINE_IPU = 0,
+    ENGINE_PXP,
+    ENGINE_G2D,
+    ENGINE_CPU,
+    ENGINE_JPEG,
+    ENGINE_NUM
+};
+
+#define LATENCY_WINDOW  256
+#define LATENCY_BUCKETS 8
+
+// latency of last LATENCY_WINDOW samples in ms buckets.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+    void add(nsecs_t latency);
+    void dump(int fd, const char* name);
+
+private:
+    static uint32_t getBucket(uint32_t us);
+
+    // samples in us, ring of rolling window.
+    uint32_t mSamples[LATENCY_WINDOW];
+    uint32_t mNext;
+    uint32_t mCount;
+    uint32_t mBuckets[LATENCY_BUCKETS];
+    uint64_t mSum;
+};
+
+// per stream frame timing, printed by dumpsys media.camera.
+class FrameStats
+{
+public:
+    FrameStats();
+    // result of request is sent, stamps are FRAME_STAMP_NUM long.
+    void onResult(const nsecs_t* stamps);
+    void onDropped();
+    void onEngine(int32_t engine, nsecs_t time);
+    // consumer held the buffer, acquire fence wait.
+    void onFenceWait(nsecs_t time);
+    void dump(int fd);
+
+private:
+    android::Mutex mLock;
+    LatencyHistogram mQueue;
+    LatencyHistogram mSettings;
+    LatencyHistogram mSensor;
+    LatencyHistogram mProcess;
+    LatencyHistogram mTotal;
+    LatencyHistogram mFence;
+    LatencyHistogram mEngines[ENGINE_NUM];
+    uint64_t mFrames;
+    uint64_t mDropped;
+};
+
+#endif
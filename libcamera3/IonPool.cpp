@@ -0,0 +1,189 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ion/ion.h>
+#include <linux/mxc_ion.h>
+#include <ion_ext.h>
+#include "IonPool.h"
+#include "Stream.h"
+
+IonPool& IonPool::getInstance()
+{
+    static IonPool sPool;
+    return sPool;
+}
+
+IonPool::IonPool()
+    : mIonFd(-1), mFreeNum(0), mFreeSize(0), mActive(false)
+{
+}
+
+IonPool::~IonPool()
+{
+    clear();
+    if (mIonFd > 0) {
+        close(mIonFd);
+        mIonFd = -1;
+    }
+}
+
+StreamBuffer* IonPool::acquire(size_t size)
+{
+    size_t ionSize = (size + PAGE_SIZE) & (~(PAGE_SIZE - 1));
+    Mutex::Autolock lock(mLock);
+
+    // smallest idle buffer that fits, without wasting a quarter of it.
+    int32_t best = -1;
+    for (uint32_t i = 0; i < mFreeNum; i++) {
+        size_t cur = mFree[i]->mSize;
+        if (cur < ionSize || cur > ionSize + ionSize / 4) {
+            continue;
+        }
+        if (best < 0 || cur < mFree[best]->mSize) {
+            best = i;
+        }
+    }
+
+    if (best >= 0) {
+        StreamBuffer* buf = mFree[best];
+        removeLocked(best);
+        ALOGV("%s reuse phy:0x%x size:%zu", __func__, buf->mPhyAddr, buf->mSize);
+        return buf;
+    }
+
+    return allocateLocked(ionSize);
+}
+
+void IonPool::release(StreamBuffer* buf)
+{
+    if (buf == NULL) {
+        return;
+    }
+
+    // pooled buffer must not keep its stream alive.
+    buf->mStream = NULL;
+    buf->mRefs = 0;
+    buf->mDeinterlaced = false;
+
+    Mutex::Autolock lock(mLock);
+    // streams stop after their camera closes, nothing reuses it then.
+    if (!mActive || buf->mSize > ION_POOL_MAX_SIZE) {
+        freeLocked(buf);
+        return;
+    }
+
+    while (mFreeNum > 0 && (mFreeNum >= ION_POOL_BUFFERS ||
+                            mFreeSize + buf->mSize > ION_POOL_MAX_SIZE)) {
+        StreamBuffer* old = mFree[0];
+        removeLocked(0);
+        freeLocked(old);
+    }
+
+    mFree[mFreeNum++] = buf;
+    mFreeSize += buf->mSize;
+}
+
+void IonPool::clear()
+{
+    Mutex::Autolock lock(mLock);
+    while (mFreeNum > 0) {
+        StreamBuffer* buf = mFree[mFreeNum - 1];
+        removeLocked(mFreeNum - 1);
+        freeLocked(buf);
+    }
+}
+
+void IonPool::setActive(bool active)
+{
+    {
+        Mutex::Autolock lock(mLock);
+        mActive = active;
+    }
+
+    if (!active) {
+        clear();
+    }
+}
+
+void IonPool::removeLocked(uint32_t index)
+{
+    mFreeSize -= mFree[index]->mSize;
+    for (uint32_t i = index; i + 1 < mFreeNum; i++) {
+        mFree[i] = mFree[i + 1];
+    }
+    mFreeNum--;
+    mFree[mFreeNum] = NULL;
+}
+
+StreamBuffer* IonPool::allocateLocked(size_t ionSize)
+{
+    if (mIonFd <= 0) {
+        mIonFd = ion_open();
+        if (mIonFd <= 0) {
+            ALOGE("%s ion_open failed", __func__);
+            return NULL;
+        }
+    }
+
+    unsigned char *ptr = NULL;
+    int32_t sharedFd = -1;
+    int32_t phyAddr;
+    ion_user_handle_t ionHandle = -1;
+
+    int32_t err = ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle);
+    if (err) {
+        ALOGE("%s ion_alloc failed", __func__);
+        return NULL;
+    }
+
+    err = ion_map(mIonFd, ionHandle, ionSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, 0, &ptr, &sharedFd);
+    if (err) {
+        ALOGE("%s ion_map failed", __func__);
+        ion_free(mIonFd, ionHandle);
+        if (sharedFd > 0) {
+            close(sharedFd);
+        }
+        return NULL;
+    }
+
+    phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
+    if (phyAddr == 0) {
+        ALOGE("%s ion_phys failed", __func__);
+        munmap(ptr, ionSize);
+        close(sharedFd);
+        ion_free(mIonFd, ionHandle);
+        return NULL;
+    }
+
+    ALOGI("%s ptr:0x%p, phy:0x%x, size:%zu", __func__, ptr, phyAddr, ionSize);
+    StreamBuffer* buf = new StreamBuffer();
+    buf->mVirtAddr = ptr;
+    buf->mPhyAddr = phyAddr;
+    buf->mSize = ionSize;
+    buf->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
+    buf->mFd = sharedFd;
+
+    return buf;
+}
+
+void IonPool::freeLocked(StreamBuffer* buf)
+{
+    munmap(buf->mVirtAddr, buf->mSize);
+    close(buf->mFd);
+    ion_free(mIonFd, (ion_user_handle_t)(uintptr_t)buf->mBufHandle);
+    delete buf;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ION_POOL_H
+#define _ION_POOL_H
+
+#include "CameraUtils.h"
+
+// idle buffers kept for the next stream start.
+#define ION_POOL_BUFFERS MAX_STREAM_BUFFERS
+#define ION_POOL_MAX_SIZE (64 * 1024 * 1024)
+
+// physically contiguous ION buffers shared by streams of all cameras.
+// StreamBuffer carries virtual and physical address and its dma-buf
+// fd, so buffers stay mapped while they are pooled.
+class IonPool
+{
+public:
+    static IonPool& getInstance();
+
+    // buffer of at least size bytes, NULL on failure.
+    StreamBuffer* acquire(size_t size);
+    // keep buffer for reuse, oldest idle buffers are freed over limit.
+    void release(StreamBuffer* buf);
+    // free all idle buffers.
+    void clear();
+    // pool keeps buffers only while a camera is open. going inactive
+    // frees idle buffers, buffers released later are freed at once.
+    void setActive(bool active);
+
+private:
+    IonPool();
+    ~IonPool();
+
+    StreamBuffer* allocateLocked(size_t size);
+    void freeLocked(StreamBuffer* buf);
+    void removeLocked(uint32_t index);
+
+    Mutex mLock;
+    int32_t mIonFd;
+    // idle buffers, oldest first.
+    StreamBuffer* mFree[ION_POOL_BUFFERS];
+    uint32_t mFreeNum;
+    size_t mFreeSize;
+    bool mActive;
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <cutils/log.h>
+#include "IpuQueue.h"
+
+IpuQueue& IpuQueue::getInstance()
+{
+    static IpuQueue sQueue;
+    return sQueue;
+}
+
+IpuQueue::IpuQueue()
+    : mStarted(false), mExit(false)
+{
+    for (uint32_t i = 0; i < IPU_QUEUE_WORKERS; i++) {
+        mFds[i] = -1;
+    }
+}
+
+IpuQueue::~IpuQueue()
+{
+    {
+        Mutex::Autolock lock(mLock);
+        mExit = true;
+        mQueueCondition.broadcast();
+    }
+
+    for (uint32_t i = 0; i < IPU_QUEUE_WORKERS; i++) {
+        if (mWorkers[i] != NULL) {
+            mWorkers[i]->requestExitAndWait();
+            mWorkers[i].clear();
+        }
+        if (mFds[i] > 0) {
+            close(mFds[i]);
+            mFds[i] = -1;
+        }
+    }
+}
+
+bool IpuQueue::startLocked()
+{
+    if (mStarted) {
+        return true;
+    }
+
+    uint32_t num = 0;
+    for (uint32_t i = 0; i < IPU_QUEUE_WORKERS; i++) {
+        mFds[i] = open("/dev/mxc_ipu", O_RDWR, 0);
+        if (mFds[i] <= 0) {
+            ALOGE("%s open mxc_ipu failed", __func__);
+            mFds[i] = -1;
+            continue;
+        }
+        mWorkers[i] = new WorkerThread(this, mFds[i]);
+        mWorkers[i]->run("IpuWorker", PRIORITY_URGENT_DISPLAY);
+        num++;
+    }
+
+    mStarted = num > 0;
+    ALOGI("%s %d workers", __func__, num);
+    return mStarted;
+}
+
+int32_t IpuQueue::queue(IpuJob* job)
+{
+    Mutex::Autolock lock(mLock);
+    if (!startLocked()) {
+        return -1;
+    }
+
+    job->mResult = 0;
+    job->mBusy = true;
+    job->mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    mJobs.push_back(job);
+    mQueueCondition.signal();
+    return 0;
+}
+
+int32_t IpuQueue::wait(IpuJob* job)
+{
+    Mutex::Autolock lock(mLock);
+    while (job->mBusy) {
+        mDoneCondition.wait(mLock);
+    }
+
+    return job->mResult;
+}
+
+bool IpuQueue::runJob(int32_t fd)
+{
+    IpuJob* job = NULL;
+    {
+        Mutex::Autolock lock(mLock);
+        while (mJobs.empty() && !mExit) {
+            mQueueCondition.wait(mLock);
+        }
+        if (mExit) {
+            return false;
+        }
+        job = *mJobs.begin();
+        mJobs.erase(mJobs.begin());
+    }
+
+    // job is only touched by this worker until it's done.
+    int32_t ret = ioctl(fd, IPU_QUEUE_TASK, &job->mTask);
+    if (ret < 0) {
+        ALOGE("%s IPU_QUEUE_TASK failed %d", __func__, ret);
+    }
+
+    Mutex::Autolock lock(mLock);
+    job->mResult = ret;
+    job->mEnd = systemTime(SYSTEM_TIME_MONOTONIC);
+    job->mBusy = false;
+    mDoneCondition.broadcast();
+    return true;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _IPU_QUEUE_H
+#define _IPU_QUEUE_H
+
+#include <linux/ipu.h>
+#include <utils/Condition.h>
+#include <utils/List.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+// IPU_QUEUE_TASK blocks until its task is done, and the driver runs
+// tasks of concurrent callers on free IPUs. one worker per IPU of
+// i.MX6Q/QP keeps both busy.
+#define IPU_QUEUE_WORKERS 2
+
+// IPU task of one output buffer, owned by its stream.
+struct IpuJob
+{
+    struct ipu_task mTask;
+    int32_t mResult;
+    // queued or running on a worker.
+    bool mBusy;
+    nsecs_t mStart;
+    nsecs_t mEnd;
+};
+
+// IPU tasks of streams of all cameras run on worker threads, so
+// capture thread dequeues next frame while they convert.
+class IpuQueue
+{
+public:
+    static IpuQueue& getInstance();
+
+    // run job in background, -1 if workers can't start.
+    int32_t queue(IpuJob* job);
+    // wait for job queued before, return its IPU_QUEUE_TASK result.
+    int32_t wait(IpuJob* job);
+
+private:
+    IpuQueue();
+    ~IpuQueue();
+
+    bool startLocked();
+    // false when queue exits.
+    bool runJob(int32_t fd);
+
+    class WorkerThread : public Thread
+    {
+    public:
+        WorkerThread(IpuQueue* queue, int32_t fd)
+            : Thread(false), mQueue(queue), mFd(fd)
+            {}
+
+        virtual bool threadLoop() {
+            return mQueue->runJob(mFd);
+        }
+
+    private:
+        IpuQueue* mQueue;
+        int32_t mFd;
+    };
+
+    Mutex mLock;
+    // signaled with mLock when job is queued or queue exits.
+    Condition mQueueCondition;
+    // signaled with mLock when job completes.
+    Condition mDoneCondition;
+    List<IpuJob*> mJobs;
+    // each worker has own IPU handle.
+    int32_t mFds[IPU_QUEUE_WORKERS];
+    sp<WorkerThread> mWorkers[IPU_QUEUE_WORKERS];
+    bool mStarted;
+    bool mExit;
+};
+
+#endif
@@ -16,6 +16,7 @@
  */
 
 #define LOG_TAG "CameraHAL"
+#define ATRACE_TAG (ATRACE_TAG_CAMERA | ATRACE_TAG_HAL)
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -25,6 +26,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <math.h>
+#include <utils/Trace.h>
 
 #include "JpegBuilder.h"
 #include "Metadata.h"
@@ -134,15 +136,22 @@ status_t JpegBuilder::insertElement(uint16_t tag,
     table[position].val5 = val5;
     table[position].val6 = val6;
 
+    table[position].strVal = NULL;
     if (strVal) {
         if (table[position].tag == TAG_GPS_PROCESSING_METHOD) {
             value_length = sizeof(ExifAsciiPrefix) +
                            strlen(strVal + sizeof(ExifAsciiPrefix));
-            table[position].strVal = (char *)malloc(sizeof(char) * (value_length + 1));
-            memcpy(table[position].strVal, strVal, value_length + 1);
         } else {
-            table[position].strVal = strdup(strVal);
+            value_length = strlen(strVal);
         }
+
+        if (mArenaUsed + value_length + 1 > sizeof(mArena)) {
+            ALOGE("EXIF string arena full, tag 0x%x", tag);
+            return NO_MEMORY;
+        }
+        table[position].strVal = mArena + mArenaUsed;
+        memcpy(table[position].strVal, strVal, value_length + 1);
+        mArenaUsed += value_length + 1;
     }
 
     position++;
@@ -151,24 +160,37 @@ status_t JpegBuilder::insertElement(uint16_t tag,
 }
 
 JpegBuilder::JpegBuilder()
-    : position(0), has_datetime_tag(false)
+    : position(0), has_datetime_tag(false),
+      mEncoder(NULL), mEncoderFormat(0), mSessionHeld(false),
+      mMainSkip(JPEG_MAIN_SKIP_DEFAULT),
+      mArenaUsed(0), mStaticPosition(0), mStaticArena(0),
+      mStaticWidth(0), mStaticHeight(0), mFocalLength(0),
+      mFocalNumerator(0), mFocalDenominator(0)
 {
+    memset(table, 0, sizeof(table));
+    ResetExifLayout(&mLayout);
     reset();
 }
 
 void JpegBuilder::reset()
 {
-    position         = 0;
+    position         = mStaticPosition;
+    mArenaUsed       = mStaticArena;
     has_datetime_tag = false;
     mMainInput       = NULL;
     mThumbnailInput  = NULL;
     mCancelEncoding  = false;
     memset(&mEXIFData, 0, sizeof(mEXIFData));
-    memset(table, 0, sizeof(table));
 }
 
 JpegBuilder::~JpegBuilder()
 {
+    if (mEncoder != NULL) {
+        delete mEncoder;
+    }
+    if (mSessionHeld) {
+        YuvToJpegEncoder::release();
+    }
 }
 
 status_t JpegBuilder::prepareImage(const StreamBuffer *streamBuf)
@@ -185,18 +207,38 @@ status_t JpegBuilder::prepareImage(const StreamBuffer *streamBuf)
 
     const sp<Stream>& stream = streamBuf->mStream;
 
-    insertElement(TAG_MODEL, 0, 0, 0, 0, 0, 0, EXIF_MODEL);
-    insertElement(TAG_MAKE, 0, 0, 0, 0, 0, 0, EXIF_MAKENOTE);
+    int width, height;
+    width = stream->width();
+    height = stream->height();
+
+    // tags fixed for stream size are built once.
+    if (mStaticPosition == 0 || width != mStaticWidth || height != mStaticHeight) {
+        position   = 0;
+        mArenaUsed = 0;
+        insertElement(TAG_MODEL, 0, 0, 0, 0, 0, 0, EXIF_MODEL);
+        insertElement(TAG_MAKE, 0, 0, 0, 0, 0, 0, EXIF_MAKENOTE);
+        insertElement(TAG_IMAGE_WIDTH, width, 0, 0, 0, 0, 0, NULL);
+        insertElement(TAG_IMAGE_LENGTH, height, 0, 0, 0, 0, 0, NULL);
+        mStaticPosition = position;
+        mStaticArena    = mArenaUsed;
+        mStaticWidth    = width;
+        mStaticHeight   = height;
+    }
+    position   = mStaticPosition;
+    mArenaUsed = mStaticArena;
 
     float focalLength;
     ret = mMeta->getFocalLength(focalLength);
     if ((NO_ERROR == ret)) {
-        char str[16];  // 14 should be enough. We overestimate to be safe.
-        snprintf(str, sizeof(str), "%g", focalLength);
-        unsigned int numerator = 0, denominator = 0;
-        JpegBuilder::stringToRational(str, &numerator, &denominator);
-        if (numerator || denominator) {
-            insertElement(TAG_FOCALLENGTH, numerator, denominator, 0, 0, 0, 0, NULL);
+        if (focalLength != mFocalLength) {
+            char str[16];  // 14 should be enough. We overestimate to be safe.
+            snprintf(str, sizeof(str), "%g", focalLength);
+            mFocalNumerator = mFocalDenominator = 0;
+            JpegBuilder::stringToRational(str, &mFocalNumerator, &mFocalDenominator);
+            mFocalLength = focalLength;
+        }
+        if (mFocalNumerator || mFocalDenominator) {
+            insertElement(TAG_FOCALLENGTH, mFocalNumerator, mFocalDenominator, 0, 0, 0, 0, NULL);
         }
     }
 
@@ -217,12 +259,6 @@ status_t JpegBuilder::prepareImage(const StreamBuffer *streamBuf)
         insertElement(TAG_DATETIME, 0, 0, 0, 0, 0, 0, temp_value);
     }
 
-    int width, height;
-    width = stream->width();
-    height = stream->height();
-
-    insertElement(TAG_IMAGE_WIDTH, width, 0, 0, 0, 0, 0, NULL);
-    insertElement(TAG_IMAGE_LENGTH, height, 0, 0, 0, 0, 0, NULL);
     int32_t jpegRotation;
     ret = mMeta->getJpegRotation(jpegRotation);
     if (NO_ERROR == ret) {
@@ -478,8 +514,10 @@ void JpegBuilder::setMetadata(sp<Metadata> meta)
 }
 
 status_t JpegBuilder::encodeImage(JpegParams *mainJpeg,
-                                  JpegParams *thumbNail)
+                                  JpegParams *thumbNail,
+                                  const StreamBuffer *streamBuf)
 {
+    ATRACE_CALL();
     status_t ret = NO_ERROR;
 
     mMainInput      = mainJpeg;
@@ -493,14 +531,63 @@ status_t JpegBuilder::encodeImage(JpegParams *mainJpeg,
         return ret;
     }
 
-    return encodeJpeg(mainJpeg);
+    bool inPlace = (mainJpeg->dst == NULL);
+    if (inPlace) {
+        if (!streamBuf || !streamBuf->mVirtAddr) {
+            ALOGE("%s invalid param", __FUNCTION__);
+            return BAD_VALUE;
+        }
+
+        // head size depends on tags and thumbnail only, so main
+        // picture is encoded where it ends up, its own SOI and APP0
+        // are overwritten by EXIF head.
+        int offset = GetMainJpegOffset(&mLayout, table, position,
+                             thumbNail ? thumbNail->jpeg_size : 0);
+        if (offset < 0) {
+            ALOGE("%s GetMainJpegOffset failed", __FUNCTION__);
+            return BAD_VALUE;
+        }
+
+        uint32_t start = ((uint32_t)offset > mMainSkip) ? offset - mMainSkip : 0;
+        if (start >= streamBuf->mSize) {
+            ALOGE("%s buffer size %zu too small", __FUNCTION__, streamBuf->mSize);
+            return BAD_VALUE;
+        }
+        mainJpeg->dst = (uint8_t *)streamBuf->mVirtAddr + start;
+        mainJpeg->dst_size = streamBuf->mSize - start;
+    }
+
+    ret = encodeJpeg(mainJpeg);
+    if (ret == NO_ERROR && inPlace) {
+        // other encoder header, buildImage moves this picture once
+        // and next ones land in place.
+        int skip = GetMainJpegSkip(mainJpeg->dst, mainJpeg->jpeg_size);
+        if (skip >= 0 && (uint32_t)skip != mMainSkip) {
+            ALOGI("%s main header %d bytes, was %d", __FUNCTION__, skip, mMainSkip);
+            mMainSkip = skip;
+        }
+    }
+
+    return ret;
 }
 
 status_t JpegBuilder::encodeJpeg(JpegParams *input)
 {
     PixelFormat format = input->format;
-    YuvToJpegEncoder *encoder = YuvToJpegEncoder::create(format);
+    // only builders which encode keep vpu session open.
+    if (!mSessionHeld) {
+        YuvToJpegEncoder::acquire();
+        mSessionHeld = true;
+    }
+    if (mEncoder == NULL || mEncoderFormat != format) {
+        if (mEncoder != NULL) {
+            delete mEncoder;
+        }
+        mEncoder = YuvToJpegEncoder::create(format);
+        mEncoderFormat = format;
+    }
 
+    YuvToJpegEncoder *encoder = mEncoder;
     if (encoder == NULL) {
         ALOGE("%s YuvToJpegEncoder::create failed", __FUNCTION__);
         return BAD_VALUE;
@@ -517,7 +604,6 @@ status_t JpegBuilder::encodeJpeg(JpegParams *input)
                           input->out_width,
                           input->out_height);
 
-    delete encoder;
     if (res) {
         input->jpeg_size = res;
         return NO_ERROR;
@@ -544,7 +630,8 @@ status_t JpegBuilder::buildImage(const StreamBuffer *streamBuf)
         dwThumbSize = mThumbnailInput->jpeg_size;
     }
 
-    ret = InsertEXIFAndThumbnail(table,
+    ret = InsertEXIFAndThumbnail(&mLayout,
+                                 table,
                                  position,
                                  pThumb,
                                  dwThumbSize,
@@ -553,16 +640,9 @@ status_t JpegBuilder::buildImage(const StreamBuffer *streamBuf)
                                  (uint8_t *)streamBuf->mVirtAddr,
                                  streamBuf->mSize);
 
-    // clean IDF table
-    unsigned int i;
-    for (i = 0; i < position; i++) {
-        if (table[i].strVal) {
-            free(table[i].strVal);
-        }
-    }
-
-    memset(table, 0, sizeof(table));
-    position = 0;
+    // per-shot tags are dropped, their strings go with arena.
+    position   = mStaticPosition;
+    mArenaUsed = mStaticArena;
 
     return ret;
 }
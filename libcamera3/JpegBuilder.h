@@ -41,6 +41,10 @@ static const char TAG_GPS_TIMESTAMP[]         = "GPSTimeStamp";
 static const char TAG_GPS_DATESTAMP[]         = "GPSDateStamp";**/
 
 #define MAX_EXIF_TAGS_SUPPORTED 30
+// string values of one picture, GPS strings are the largest.
+#define EXIF_ARENA_SIZE         1024
+// SOI and JFIF APP0 written by libjpeg before DQT.
+#define JPEG_MAIN_SKIP_DEFAULT  20
 #define GPS_MIN_DIV                 60
 #define GPS_SEC_DIV                 60
 #define GPS_SEC_ACCURACY            1000
@@ -130,10 +134,14 @@ public:
 
     status_t prepareImage(const StreamBuffer *streamBuf);
 
+    // main picture without dst is encoded into streamBuf, after
+    // room which buildImage fills with EXIF head and thumbnail.
     status_t encodeImage(JpegParams *mainJpeg,
-                         JpegParams *thumbNail);
+                         JpegParams *thumbNail,
+                         const StreamBuffer *streamBuf);
     size_t   getImageSize();
     status_t buildImage(const StreamBuffer *streamBuf);
+    // clear per-shot tags, static tags and IFD layout stay.
     void     reset();
     void setMetadata(sp<Metadata> meta);
 
@@ -169,6 +177,8 @@ private:
 private:
     JpegParams *mMainInput;
     JpegParams *mThumbnailInput;
+    // header bytes encoder writes before DQT, from last picture.
+    uint32_t mMainSkip;
 
     bool mCancelEncoding;
     EXIFData mEXIFData;
@@ -177,10 +187,29 @@ private:
     IFDEle table[MAX_EXIF_TAGS_SUPPORTED];
     unsigned int  gps_tag_count;
     unsigned int  position;
+    // strVal of table elements, rewound instead of freed.
+    char mArena[EXIF_ARENA_SIZE];
+    uint32_t mArenaUsed;
+    // make, model and size lead table and are kept across shots
+    // of same size, per-shot tags follow them.
+    unsigned int mStaticPosition;
+    uint32_t mStaticArena;
+    int mStaticWidth;
+    int mStaticHeight;
+    // focal length rational of last shot.
+    float mFocalLength;
+    unsigned int mFocalNumerator;
+    unsigned int mFocalDenominator;
+    ExifLayout mLayout;
     bool jpeg_opened;
     bool has_datetime_tag;
 
     sp<Metadata> mMeta;
+    // encoder reused by captures of same format.
+    YuvToJpegEncoder *mEncoder;
+    int mEncoderFormat;
+    // builder encoded once and holds vpu session.
+    bool mSessionHeld;
 };
 };
 
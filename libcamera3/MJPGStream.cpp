@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <poll.h>
 #include "MJPGStream.h"
 
 unsigned char* VPUptr;
@@ -140,47 +141,24 @@ static int SearchHufTabPos(u8 *pSrc, u32 nSrcSize, bool *pbExist, u32 *pdwExptDH
 
 }
 
-static int CheckAndInsertHufTab(u8 *pDst, u8 *pSrc, u32 nDstSize, u32 nSrcSize) {
-    bool bExist = 0;
-    u32 dwExptDHTPos = 0;
-    int ret;
-    ret = SearchHufTabPos(pSrc, nSrcSize, &bExist, &dwExptDHTPos);
-    if(ret) {
-        ALOGE("CheckAndInsertHufTab, SearchHufTabPos failed, ret %d", ret);
-        return ret;
-    }
-
-    u32 nCopySize = (nDstSize < nSrcSize) ? nDstSize : nSrcSize;
-    if(bExist) {
-        memcpy(pDst, pSrc, nCopySize);
-        return 0;
-    }
-
-    //insert huf tab
-    if(dwExptDHTPos + sizeof(g_hufTab) > nCopySize) {
-        ALOGE("%s, dwExptDHTPos (%d) + sizeof(g_hufTab) (%d) > nCopySize (%d)",
-                __FUNCTION__, dwExptDHTPos, sizeof(g_hufTab), nCopySize);
-        return -1;
-    }
-
-    memcpy(pDst, pSrc, dwExptDHTPos);
-    memcpy(pDst + dwExptDHTPos, g_hufTab, sizeof(g_hufTab));
-    u32 dwLeftSize = nCopySize - (dwExptDHTPos + sizeof(g_hufTab));
-    memcpy(pDst + dwExptDHTPos + sizeof(g_hufTab), pSrc + dwExptDHTPos, dwLeftSize);
-
-    return 0;
-}
-
-MJPGStream::MJPGStream(Camera* device): DMAStream(device), mStreamSize(0)
+MJPGStream::MJPGStream(Camera* device, uint32_t codec): DMAStream(device),
+    mStreamSize(0), mCodecFormat(codec), mDecodeNum(0), mDecodeExit(false), mDhtState(MJPG_DHT_UNKNOWN),
+    mHufFrame(NULL), mHufFrameSize(0)
 {
     mVPUHandle = 0;
     memset(&mDecMemInfo,0,sizeof(DecMemInfo));
     memset(&mDecContxt, 0, sizeof(mDecContxt));
+    memset(mVPUPhyAddr, 0, sizeof(mVPUPhyAddr));
+    memset(mVPUVirtAddr, 0, sizeof(mVPUVirtAddr));
 }
 
 MJPGStream::~MJPGStream()
 {
-
+    stopDecodeLocked();
+    if (mHufFrame != NULL) {
+        free(mHufFrame);
+        mHufFrame = NULL;
+    }
 }
 
 // configure device.
@@ -196,7 +174,11 @@ int32_t MJPGStream::onDeviceConfigureLocked()
 
     int32_t fps = mFps;
     int32_t vformat;
-    vformat = v4l2_fourcc('M', 'J', 'P', 'G');
+    vformat = mCodecFormat;
+    if (isH264() && mNumBuffers < MJPG_H264_BUFFERS) {
+        // decoder keeps reference frames on top of consumer frames.
+        mNumBuffers = MJPG_H264_BUFFERS;
+    }
 
     if ((mWidth > 1920) || (mHeight > 1080)) {
         fps = 15;
@@ -304,7 +286,7 @@ int32_t MJPGStream::onDeviceStartLocked()
         return ret;
     }
 
-    return 0;
+    return startDecodeLocked();
 }
 
 int32_t MJPGStream::onDeviceStopLocked()
@@ -317,6 +299,9 @@ int32_t MJPGStream::onDeviceStopLocked()
         return BAD_VALUE;
     }
 
+    // decoder must not touch UVC buffers after stream off.
+    stopDecodeLocked();
+
     enum v4l2_buf_type bufType;
     bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ret = ioctl(mDev, VIDIOC_STREAMOFF, &bufType);
@@ -335,34 +320,208 @@ int32_t MJPGStream::onDeviceStopLocked()
     return 0;
 }
 
-int32_t MJPGStream::onFrameAcquireLocked()
+int32_t MJPGStream::startDecodeLocked()
 {
-    ALOGV("%s", __func__);
-    int32_t ret = 0;
-    int32_t ret2 = 0;
+    mInputFrames.clear();
+    mOutputFrames.clear();
+    mDecodeNum = 0;
+    mDecodeExit = false;
+    // device may be configured to other mode, look at its frames again.
+    mDhtState = MJPG_DHT_UNKNOWN;
+
+    mDecodeThread = new DecodeThread(this);
+    status_t ret = mDecodeThread->run("MJPGDecodeThread",
+                                      PRIORITY_URGENT_DISPLAY);
+    if (ret != NO_ERROR) {
+        ALOGE("%s run decode thread failed %d", __func__, ret);
+        mDecodeThread.clear();
+        return BAD_VALUE;
+    }
+
+    return 0;
+}
+
+void MJPGStream::stopDecodeLocked()
+{
+    if (mDecodeThread == NULL) {
+        return;
+    }
+
+    {
+        Mutex::Autolock _l(mDecodeLock);
+        mDecodeExit = true;
+        mInputCondition.broadcast();
+    }
+    {
+        // wake decoder waiting for free VPU frame.
+        Mutex::Autolock _l(mVPULock);
+        mReleaseCondition.broadcast();
+    }
+    mDecodeThread->requestExitAndWait();
+    mDecodeThread.clear();
+
+    // UVC buffers of undecoded frames are dropped by stream off.
+    mInputFrames.clear();
+    MJPGOutput output;
+    while (mOutputFrames.pop(output)) {
+        mBuffers[output.nIndex]->mpFrameBuf = output.pFrameBuf;
+        onFrameReturnLocked(output.nIndex, *mBuffers[output.nIndex]);
+    }
+    mDecodeNum = 0;
+}
+
+int32_t MJPGStream::queueCompressedLocked(bool block)
+{
+    if (!block) {
+        struct pollfd fds;
+        fds.fd = mDev;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        if (poll(&fds, 1, 0) <= 0 || !(fds.revents & POLLIN)) {
+            return -EAGAIN;
+        }
+    }
+
     struct v4l2_buffer cfilledbuffer;
     memset(&cfilledbuffer, 0, sizeof (cfilledbuffer));
     cfilledbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     cfilledbuffer.memory = V4L2_MEMORY_DMABUF;
-    ret = ioctl(mDev, VIDIOC_DQBUF, &cfilledbuffer);
+    int32_t ret = ioctl(mDev, VIDIOC_DQBUF, &cfilledbuffer);
     if (ret < 0) {
         ALOGE("%s: VIDIOC_DQBUF Failed: %s", __func__, strerror(errno));
         return -1;
     }
 
-    int32_t index = cfilledbuffer.index;
     ALOGV("acquire index:%d", cfilledbuffer.index);
-    int JPGLen;
-    int VPUIndex;
-    JPGLen = cfilledbuffer.length;
-    VPUIndex = VPUDec((u8 *)mSensorBuffers[index]->mVirtAddr, JPGLen, index);
-    ret2 = ioctl(mDev, VIDIOC_QBUF, &cfilledbuffer);
-    if (ret < 0) {
+    MJPGFrame frame;
+    frame.nIndex = cfilledbuffer.index;
+    frame.nLength = cfilledbuffer.bytesused > 0 ? cfilledbuffer.bytesused
+                                                : cfilledbuffer.length;
+    frame.nTimestamp = getV4l2Timestamp(cfilledbuffer.timestamp,
+                                        cfilledbuffer.flags);
+
+    Mutex::Autolock _l(mDecodeLock);
+    if (!mInputFrames.push(frame)) {
+        ALOGE("%s decode ring full, drop %d", __func__, frame.nIndex);
+        ioctl(mDev, VIDIOC_QBUF, &cfilledbuffer);
+        return -ENOSPC;
+    }
+    mDecodeNum++;
+    mInputCondition.signal();
+
+    return 0;
+}
+
+int32_t MJPGStream::onFrameAcquireLocked()
+{
+    ALOGV("%s", __func__);
+
+    // keep decoder busy with next frame while consumer holds this one.
+    while (true) {
+        uint32_t num;
+        bool ready;
+        {
+            Mutex::Autolock _l(mDecodeLock);
+            num = mDecodeNum;
+            ready = !mOutputFrames.empty();
+        }
+
+        if (num >= MJPG_DECODE_DEPTH) {
+            break;
+        }
+        // block only if nothing could come out of decoder.
+        int32_t ret = queueCompressedLocked(num == 0 && !ready);
+        if (ret == -EAGAIN) {
+            break;
+        }
+        if (ret != 0) {
+            if (num == 0 && !ready) {
+                return -1;
+            }
+            break;
+        }
+    }
+
+    Mutex::Autolock _l(mDecodeLock);
+    MJPGOutput output;
+    while (!mOutputFrames.pop(output)) {
+        if (mDecodeNum == 0) {
+            // frame had no output, let caller try next one.
+            ALOGW("%s no decoded frame", __func__);
+            return -1;
+        }
+
+        if (mOutputCondition.waitRelative(mDecodeLock,
+                                          MJPG_DECODE_TIMEOUT) != NO_ERROR) {
+            ALOGE("%s wait decoded frame timeout", __func__);
+            return -1;
+        }
+    }
+
+    // VPU frame goes with buffer under mLock, onFrameReturnLocked
+    // gives it back.
+    mBuffers[output.nIndex]->mpFrameBuf = output.pFrameBuf;
+    return output.nIndex;
+}
+
+int32_t MJPGStream::handleDecodeFrame()
+{
+    MJPGFrame frame;
+    {
+        Mutex::Autolock _l(mDecodeLock);
+        while (!mDecodeExit && !mInputFrames.pop(frame)) {
+            mInputCondition.wait(mDecodeLock);
+        }
+
+        if (mDecodeExit) {
+            return -1;
+        }
+    }
+
+    u8* data = (u8 *)mSensorBuffers[frame.nIndex]->mVirtAddr;
+    if (!isH264() && mDhtState == MJPG_DHT_UNKNOWN) {
+        // camera emits same header layout on every frame, search once.
+        bool exist = false;
+        u32 pos = 0;
+        if (SearchHufTabPos(data, frame.nLength, &exist, &pos) == 0) {
+            mDhtState = exist ? MJPG_DHT_PRESENT : MJPG_DHT_ABSENT;
+            ALOGI("%s frames %s huffman tables", __func__,
+                  exist ? "have" : "lack");
+        }
+    }
+
+    void* frameBuf = NULL;
+    int32_t index = VPUDec(data, frame.nLength, frame.nIndex,
+                           mDhtState == MJPG_DHT_ABSENT, &frameBuf);
+
+    struct v4l2_buffer cfilledbuffer;
+    memset(&cfilledbuffer, 0, sizeof (cfilledbuffer));
+    cfilledbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cfilledbuffer.memory = V4L2_MEMORY_DMABUF;
+    cfilledbuffer.index = frame.nIndex;
+    cfilledbuffer.m.fd = mSensorBuffers[frame.nIndex]->mFd;
+    cfilledbuffer.length = mSensorBuffers[frame.nIndex]->mSize;
+    if (ioctl(mDev, VIDIOC_QBUF, &cfilledbuffer) < 0) {
         ALOGE("%s: VIDIOC_QBUF Failed: %s", __func__, strerror(errno));
-        return BAD_VALUE;
     }
-    return VPUIndex;
 
+    Mutex::Autolock _l(mDecodeLock);
+    if (index >= 0 && index < MAX_STREAM_BUFFERS && mBuffers[index] != NULL) {
+        // decoder runs without reorder, output is frame just fed.
+        mBuffers[index]->mSensorTimestamp = frame.nTimestamp;
+    }
+    MJPGOutput output;
+    output.nIndex = index;
+    output.pFrameBuf = frameBuf;
+    if (index >= 0 && !mOutputFrames.push(output)) {
+        ALOGE("%s output ring full, drop %d", __func__, index);
+        Mutex::Autolock lock(mVPULock);
+        VPU_DecOutFrameDisplayed(mVPUHandle, (VpuFrameBuffer *)frameBuf);
+    }
+    mDecodeNum--;
+    mOutputCondition.signal();
+
+    return 0;
 }
 
 int32_t MJPGStream::onFrameReturnLocked(int32_t index, StreamBuffer& buf)
@@ -379,6 +538,9 @@ int32_t MJPGStream::onFrameReturnLocked(int32_t index, StreamBuffer& buf)
             ALOGI("%s: vpu clear frame display failure: ret=%d \r\n",__FUNCTION__,ret);
             ret = BAD_VALUE;
         }
+        buf.mpFrameBuf = NULL;
+        // decoder may wait for this frame.
+        mReleaseCondition.signal();
     }
 
 
@@ -528,7 +690,7 @@ int MJPGStream::VPUInit()
     int capability=0;
 
     //Initial decode context
-    mDecContxt.nCodec = 11; // -f (Fixed as JPG)
+    mDecContxt.nCodec = isH264() ? MJPG_CODEC_AVC : MJPG_CODEC_MJPG;
     mDecContxt.nChromaInterleave = 1;
     mDecContxt.nMapType = 0;
     mDecContxt.nTile2LinearEnable = 0;
@@ -588,7 +750,8 @@ int MJPGStream::VPUInit()
         goto bail;
     }
 
-    decOpenParam.nReorderEnable=1;  //for H264
+    // camera H.264 has no B frames, output each frame once decoded.
+    decOpenParam.nReorderEnable = isH264() ? 0 : 1;
     decOpenParam.nEnableFileMode=0; //unit test: using stream mode
 
     //check capabilities
@@ -659,79 +822,125 @@ int MJPGStream::VPUExit()
     return 0;
 }
 
-int MJPGStream::VPUDec(u8 *InVirAddr, u32 inLen, unsigned int nUVCBufIdx)
+int32_t MJPGStream::getVPUFrameIndex(VpuFrameBuffer* frame)
+{
+    // decode thread runs without mLock, don't use shared buffer map.
+    uint32_t num = mNumBuffers < MAX_PREVIEW_BUFFER ? mNumBuffers
+                                                   : MAX_PREVIEW_BUFFER;
+    for (uint32_t i = 0; i < num; i++) {
+        if (mVPUPhyAddr[i] == frame->pbufY) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int MJPGStream::VPUDec(u8 *InVirAddr, u32 inLen, unsigned int /*nUVCBufIdx*/,
+                       bool dhtAbsent, void** outFrameBuf)
 {
-DecLogic:
     VpuDecRetCode ret;
     int bufRetCode = 0;
-    int err = 0;
 
-    //DecContxt * decContxt;
     DecMemInfo pDecMemInfo;
-
     VpuBufferNode InData;
 
-    unsigned int outIdx = 0;
-    unsigned int VPUIndex = 0;
-
     Mutex::Autolock lock(mVPULock);
 
-    memset(&InData, 0, sizeof(InData));
-    InData.nSize = inLen;
-    InData.pPhyAddr = NULL;
-    InData.pVirAddr = InVirAddr;
-    InData.sCodecData.pData = NULL;
-    InData.sCodecData.nSize = 0;
-
-    ret = VPU_DecDecodeBuf(mVPUHandle, &InData, &bufRetCode);
+    if (dhtAbsent && inLen > 2) {
+        // VPU wrapper inserts codec data only at sequence start, so
+        // every frame gets tables spliced in after its SOI. tables may
+        // precede frame header.
+        u32 size = inLen + sizeof(g_hufTab);
+        if (mHufFrameSize < size) {
+            free(mHufFrame);
+            mHufFrame = (uint8_t *)malloc(size);
+            mHufFrameSize = (mHufFrame != NULL) ? size : 0;
+        }
+        if (mHufFrame == NULL) {
+            ALOGE("%s: no memory for huffman tables", __FUNCTION__);
+            return -1;
+        }
 
-    // check init info
-    if(bufRetCode & VPU_DEC_INIT_OK) {
-        ALOGI("%s: vpu & VPU_DEC_INIT_OK \r\n", __FUNCTION__);
-        int nFrmNum;
-        VpuDecInitInfo InitInfo;
+        memcpy(mHufFrame, InVirAddr, 2);
+        memcpy(mHufFrame + 2, g_hufTab, sizeof(g_hufTab));
+        memcpy(mHufFrame + 2 + sizeof(g_hufTab), InVirAddr + 2, inLen - 2);
+        InVirAddr = mHufFrame;
+        inLen = size;
+    }
 
-        //process init info
-        if(ProcessInitInfo(&InitInfo, &pDecMemInfo, &nFrmNum, &VPUptr, &mVPUBuffersIndex) == 0)
-        {
-        ALOGI("%s: vpu process init info failure: \r\n", __FUNCTION__);
-            return 0;
+    while (!mDecodeExit) {
+        memset(&InData, 0, sizeof(InData));
+        InData.nSize = inLen;
+        InData.pPhyAddr = NULL;
+        InData.pVirAddr = InVirAddr;
+        InData.sCodecData.pData = NULL;
+        InData.sCodecData.nSize = 0;
+
+        bufRetCode = 0;
+        ret = VPU_DecDecodeBuf(mVPUHandle, &InData, &bufRetCode);
+        if (ret != VPU_DEC_RET_SUCCESS) {
+            ALOGE("%s: vpu decode failure: ret=%d", __FUNCTION__, ret);
+            return -1;
         }
 
-        goto DecLogic;
-    }
+        // check init info
+        if(bufRetCode & VPU_DEC_INIT_OK) {
+            ALOGI("%s: vpu & VPU_DEC_INIT_OK \r\n", __FUNCTION__);
+            int nFrmNum;
+            VpuDecInitInfo InitInfo;
 
-    //check output buff
-    if((bufRetCode & VPU_DEC_OUTPUT_DIS) ||(bufRetCode & VPU_DEC_OUTPUT_MOSAIC_DIS))
-    {
-        VpuDecOutFrameInfo frameInfo;
+            //process init info
+            if(ProcessInitInfo(&InitInfo, &pDecMemInfo, &nFrmNum, &VPUptr, &mVPUBuffersIndex) == 0)
+            {
+                ALOGI("%s: vpu process init info failure: \r\n", __FUNCTION__);
+                return -1;
+            }
 
-        // get output frame
-        ret = VPU_DecGetOutputFrame(mVPUHandle, &frameInfo);
-        if(ret != VPU_DEC_RET_SUCCESS)
-        {
-            ALOGE("%s: vpu get output frame failure: ret=%d \r\n",__FUNCTION__,ret);
-            return 0;
+            // decode same frame with registered buffers.
+            continue;
         }
 
-        unsigned int i;
-        for(i = 0; i < mNumBuffers; i++) {
-            if(frameInfo.pDisplayFrameBuf->pbufY == (unsigned char* )(uintptr_t)mBuffers[i]->mPhyAddr) {
-                VPUIndex = i;
-                break;
+        //check output buff
+        if((bufRetCode & VPU_DEC_OUTPUT_DIS) ||(bufRetCode & VPU_DEC_OUTPUT_MOSAIC_DIS))
+        {
+            VpuDecOutFrameInfo frameInfo;
+
+            // get output frame
+            ret = VPU_DecGetOutputFrame(mVPUHandle, &frameInfo);
+            if(ret != VPU_DEC_RET_SUCCESS)
+            {
+                ALOGE("%s: vpu get output frame failure: ret=%d \r\n",__FUNCTION__,ret);
+                return -1;
+            }
+
+            int32_t index = getVPUFrameIndex(frameInfo.pDisplayFrameBuf);
+            if (index < 0) {
+                ALOGE("%s: unknown output frame %p", __FUNCTION__,
+                      frameInfo.pDisplayFrameBuf->pbufY);
+                VPU_DecOutFrameDisplayed(mVPUHandle, frameInfo.pDisplayFrameBuf);
+                return -1;
             }
+
+            *outFrameBuf = (void *)frameInfo.pDisplayFrameBuf;
+            return index;
         }
 
-            mBuffers[VPUIndex]->mpFrameBuf = (void *)frameInfo.pDisplayFrameBuf;
+        if(bufRetCode & VPU_DEC_NO_ENOUGH_BUF) {
+            // all frames are held, retry once consumer returns one.
+            ALOGV("VPU_DEC_NO_ENOUGH_BUF, wait frame release");
+            if (mReleaseCondition.waitRelative(mVPULock,
+                        MJPG_DECODE_TIMEOUT) != NO_ERROR) {
+                ALOGW("%s wait frame release timeout", __FUNCTION__);
+            }
+            continue;
+        }
 
-    } else if(bufRetCode & VPU_DEC_NO_ENOUGH_BUF) {
-        mVPULock.unlock();
-        usleep(10000);
-        ALOGI("VPU_DEC_NO_ENOUGH_BUF, wait 10ms, goto DecLogic");
-        goto DecLogic;
+        // input consumed without output frame.
+        return -1;
     }
 
-      return VPUIndex;
+    return -1;
 }
 
 int  MJPGStream::ProcessInitInfo(VpuDecInitInfo* pInitInfo, DecMemInfo* /*pDecMemInfo*/, int*pOutFrmNum, unsigned char** rptr, int32_t* vpuindex)
@@ -776,6 +985,12 @@ int  MJPGStream::ProcessInitInfo(VpuDecInitInfo* pInitInfo, DecMemInfo* /*pDecMe
         return 0;
     }
 
+    if ((uint32_t)requestedBufNum > mNumBuffers) {
+        ALOGE("%s: vpu needs %d frames, stream has %d", __FUNCTION__,
+              requestedBufNum, mNumBuffers);
+        return 0;
+    }
+
     unsigned char *VPUptr = NULL;
     int32_t sharedFd;
     unsigned char *phyAddr;
@@ -942,6 +1157,10 @@ int  MJPGStream::ProcessInitInfo(VpuDecInitInfo* pInitInfo, DecMemInfo* /*pDecMe
         }
 
         ALOGI("VPU reg buf, idx %d, ptr phy %p, vir %p", i, ptr, ptrVirt);
+        if (i < MAX_PREVIEW_BUFFER) {
+            mVPUPhyAddr[i] = ptr;
+            mVPUVirtAddr[i] = ptrVirt;
+        }
 
         /* fill stride info */
         frameBuf[i].nStrideY=yStride;
@@ -1099,7 +1318,7 @@ int MJPGStream::ConvertCodecFormat(int codec, VpuCodStd* pCodec)
         case 7:
             *pCodec=VPU_V_H263;
             break;
-        case 8:
+        case MJPG_CODEC_AVC:
             *pCodec=VPU_V_AVC;
             break;
         case 9:
@@ -1108,7 +1327,7 @@ int MJPGStream::ConvertCodecFormat(int codec, VpuCodStd* pCodec)
         case 10:
             *pCodec=VPU_V_RV;
             break;
-        case 11:
+        case MJPG_CODEC_MJPG:
             *pCodec=VPU_V_MJPG;
             break;
         case 12:
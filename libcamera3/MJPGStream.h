@@ -16,11 +16,12 @@
 #ifndef _UVCMJPEG_H
 #define _UVCMJPEG_H
 
+#include <linux/videodev2.h>
+#include <atomic>
 #include "USPStream.h"
 #include "vpu_wrapper.h"
 #include "DMAStream.h"
-
-#define UVC_USE_MJPG "uvc_mjpg"
+#include "RingQueue.h"
 
 #define VPU_DEC_MAX_NUM_MEM_NUM 20
 #define DEFAULT_FILL_DATA_UNIT  (16*1024)
@@ -30,6 +31,23 @@
 #define MAX_FRAME_NUM                (30)
 #define FRAME_SURPLUS                (0)
 #define FRAME_ALIGN          (16)
+// compressed frames handed to decode thread ahead of consumer.
+#define MJPG_DECODE_DEPTH    2
+#define MJPG_RING_SIZE       16
+#define MJPG_DECODE_TIMEOUT  500000000LL
+
+// codec ids of ConvertCodecFormat.
+#define MJPG_CODEC_AVC       8
+#define MJPG_CODEC_MJPG      11
+// H.264 frames are references of next ones, VPU asks for more.
+#define MJPG_H264_BUFFERS    MAX_PREVIEW_BUFFER
+// VPU aligns frame planes, see nAddressAlignment.
+#define MJPG_VPU_ALIGN_PAD   4096
+
+// DHT of UVC frames, header layout is the same for all frames of stream.
+#define MJPG_DHT_UNKNOWN     0
+#define MJPG_DHT_PRESENT     1
+#define MJPG_DHT_ABSENT      2
 
 typedef struct
 {
@@ -71,12 +89,28 @@ typedef struct
     int nTile2LinearEnable;
 }DecContxt;
 
+// UVC buffer holding one compressed frame.
+typedef struct
+{
+    int32_t nIndex;
+    uint32_t nLength;
+    nsecs_t nTimestamp;
+}MJPGFrame;
+
+// decoded VPU buffer, frame is handed to its StreamBuffer by consumer.
+typedef struct
+{
+    int32_t nIndex;
+    void* pFrameBuf;
+}MJPGOutput;
+
 // stream uses DMABUF buffers which allcated in user space.
 // that exports DMABUF handle.
 class MJPGStream : public DMAStream
 {
 public:
-    MJPGStream(Camera* device);
+    // codec is V4L2 fourcc of compressed frames, MJPG or H264.
+    MJPGStream(Camera* device, uint32_t codec = v4l2_fourcc('M', 'J', 'P', 'G'));
     virtual ~MJPGStream();
 
     StreamBuffer* mSensorBuffers[MAX_STREAM_BUFFERS];
@@ -91,6 +125,10 @@ public:
     virtual int32_t onFrameAcquireLocked();
     // put buffer back to V4L2.
     virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf);
+    // frames are decoded by VPU, never captured into output buffers.
+    virtual int32_t onDirectReturnLocked(int32_t, StreamBuffer&) {return -1;}
+    // V4L2 frames still need decode, ready mDev doesn't mean ready frame.
+    virtual bool canLookahead() {return false;}
 
     // allocate buffers.
     virtual int32_t allocateBuffersLocked(){return 0;}
@@ -102,8 +140,17 @@ public:
     // get device buffer required size.
     virtual int32_t getDeviceBufferSize();
 
+    bool isH264() {return mCodecFormat == v4l2_fourcc('H', '2', '6', '4');}
+    uint32_t getCodecFormat() {return mCodecFormat;}
 
-    int VPUDec( unsigned char *InVirAddr, unsigned int inLen, unsigned int nUVCBufIdx);
+
+    // return VPU output buffer index and its VPU frame, -1 if no frame
+    // is output. default huffman tables are spliced in after SOI if
+    // dhtAbsent is set.
+    int VPUDec( unsigned char *InVirAddr, unsigned int inLen, unsigned int nUVCBufIdx,
+                bool dhtAbsent, void** outFrameBuf);
+    // decode one queued frame, return non zero to exit thread.
+    int32_t handleDecodeFrame();
     int ProcessInitInfo(VpuDecInitInfo* pInitInfo, DecMemInfo* pDecMemInfo, int*pOutFrmNum, unsigned char**, int32_t*);
     int FreeMemBlock(DecMemInfo* pDecMem);
 
@@ -118,14 +165,55 @@ public:
 private:
     int VPUInit();
     int VPUExit();
+    int32_t startDecodeLocked();
+    void stopDecodeLocked();
+    // dequeue UVC buffer into decoder, wait for it if block is set.
+    int32_t queueCompressedLocked(bool block);
+    int32_t getVPUFrameIndex(VpuFrameBuffer* frame);
+
+    class DecodeThread : public Thread
+    {
+    public:
+        DecodeThread(MJPGStream *stream)
+            : Thread(false), mStream(stream)
+            {}
+
+        virtual bool threadLoop() {
+            return mStream->handleDecodeFrame() == 0;
+        }
+
+    private:
+        MJPGStream* mStream;
+    };
 
 private:
     int32_t mStreamSize;
+    uint32_t mCodecFormat;
     VpuDecHandle mVPUHandle;
     DecMemInfo mDecMemInfo;
     DecContxt mDecContxt;
     mutable Mutex mVPULock;
+    // signaled with mVPULock when consumer releases a VPU frame.
+    Condition mReleaseCondition;
     DecOutColorFmt meOutColorFmt;
+
+    // capture thread queues compressed frames, decode thread
+    // queues decoded VPU buffer indexes back.
+    sp<DecodeThread> mDecodeThread;
+    RingQueue<MJPGFrame, MJPG_RING_SIZE> mInputFrames;
+    RingQueue<MJPGOutput, MJPG_RING_SIZE> mOutputFrames;
+    Mutex mDecodeLock;
+    Condition mInputCondition;
+    Condition mOutputCondition;
+    // frames queued to decoder and not decoded yet.
+    uint32_t mDecodeNum;
+    // set under mDecodeLock, VPUDec polls it under mVPULock.
+    std::atomic<bool> mDecodeExit;
+    // MJPG_DHT_*, found on first frame after start, decode thread.
+    int32_t mDhtState;
+    // frame with default huffman tables spliced in, under mVPULock.
+    uint8_t* mHufFrame;
+    uint32_t mHufFrameSize;
 };
 
 #endif
@@ -20,12 +20,14 @@ MMAPStream::MMAPStream(Camera* device)
     : VideoStream(device)
 {
     mPlane = false;
+    mRateConfigured = false;
 }
 
 MMAPStream::MMAPStream(Camera *device, bool mplane) : VideoStream(device) {
     // If driver support V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, will set mplane as
     // true, else set it as false.
     mPlane = mplane;
+    mRateConfigured = false;
 }
 
 MMAPStream::~MMAPStream()
@@ -33,6 +35,56 @@ MMAPStream::~MMAPStream()
 }
 
 // configure device.
+int32_t MMAPStream::getDeviceFps(int32_t width, int32_t height, int32_t fps)
+{
+    // streams with own configure pick rate themselves.
+    if (!mRateConfigured) {
+        return fps;
+    }
+
+    return capDeviceFps(width, height, fps);
+}
+
+int32_t MMAPStream::capDeviceFps(int32_t width, int32_t height, int32_t fps)
+{
+    // high speed mode runs above the caps below.
+    int32_t fast = mCamera->getHighSpeedFps(width, height);
+    if (fps > HIGH_SPEED_PREVIEW_FPS && fast > 0) {
+        return fps < fast ? fps : fast;
+    }
+
+    if ((width > 1920) || (height > 1080)) {
+        return 15;
+    } else if ((width <= 1024) || (height <= 768)) {
+        return 30;
+    }
+    return fps;
+}
+
+int32_t MMAPStream::onDeviceRateLocked()
+{
+    if (!mRateConfigured || mDev <= 0) {
+        return -1;
+    }
+
+    struct v4l2_streamparm param;
+    memset(&param, 0, sizeof(param));
+    param.type = mPlane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                        : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    param.parm.capture.timeperframe.numerator   = 1;
+    param.parm.capture.timeperframe.denominator =
+            capDeviceFps(mWidth, mHeight, mFps);
+    param.parm.capture.capturemode = mCamera->getCaptureMode(mWidth, mHeight);
+    // drivers which can't change rate while streaming return EBUSY.
+    int32_t ret = ioctl(mDev, VIDIOC_S_PARM, &param);
+    if (ret < 0) {
+        ALOGW("%s: VIDIOC_S_PARM Failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 int32_t MMAPStream::onDeviceConfigureLocked()
 {
     ALOGI("%s", __func__);
@@ -42,16 +94,12 @@ int32_t MMAPStream::onDeviceConfigureLocked()
         return BAD_VALUE;
     }
 
-    int32_t fps = mFps;
+    // set again once device took rate and format.
+    mRateConfigured = false;
+    int32_t fps = capDeviceFps(mWidth, mHeight, mFps);
     int32_t vformat;
     vformat = convertPixelFormatToV4L2Format(mFormat);
 
-    if ((mWidth > 1920) || (mHeight > 1080)) {
-        fps = 15;
-    } else if ((mWidth <= 1024) || (mHeight <= 768)) {
-        fps = 30;
-    }
-
     ALOGI("Width * Height %d x %d format %c%c%c%c, fps: %d",
           mWidth, mHeight, vformat&0xFF, (vformat>>8)&0xFF,
           (vformat>>16)&0xFF, (vformat>>24)&0xFF, fps);
@@ -115,6 +163,7 @@ int32_t MMAPStream::onDeviceConfigureLocked()
         return ret;
     }
 
+    mRateConfigured = true;
     return 0;
 }
 
@@ -302,6 +351,12 @@ int32_t MMAPStream::onFrameAcquireLocked()
         return -1;
     }
 
+    if (cfilledbuffer.index < MAX_STREAM_BUFFERS &&
+            mBuffers[cfilledbuffer.index] != NULL) {
+        mBuffers[cfilledbuffer.index]->mSensorTimestamp =
+            getV4l2Timestamp(cfilledbuffer.timestamp, cfilledbuffer.flags);
+    }
+
     return cfilledbuffer.index;
 }
 
@@ -29,6 +29,10 @@ public:
 
     // configure device.
     virtual int32_t onDeviceConfigureLocked();
+    virtual int32_t getDeviceFps(int32_t width, int32_t height, int32_t fps);
+    // S_PARM only, capture mode follows unchanged resolution. streaming
+    // goes on when driver takes it.
+    virtual int32_t onDeviceRateLocked();
     // start device.
     virtual int32_t onDeviceStartLocked();
     // stop device.
@@ -45,7 +49,12 @@ public:
     virtual int32_t freeBuffersLocked() {return 0;}
 
 private:
+    // rate limits of sensor for resolution.
+    int32_t capDeviceFps(int32_t width, int32_t height, int32_t fps);
+
     bool mPlane;
+    // rate is set by onDeviceConfigureLocked here, not by subclass.
+    bool mRateConfigured;
 
 };
 
@@ -14,8 +14,41 @@
  * limitations under the License.
  */
 
+#include <poll.h>
+#include <rearview_ext.h>
 #include "Max9286Mipi.h"
 
+// parse channel nodes of MAX9286_CHANNEL_PROP, return their number.
+static uint32_t getChannelNodes(char nodes[][CAMAERA_FILENAME_LENGTH])
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get(MAX9286_CHANNEL_PROP, value, "");
+
+    uint32_t num = 0;
+    char* name = value;
+    while (name != NULL && *name != '\0' && num < MAX9286_CHANNELS - 1) {
+        char* next = strchr(name, ',');
+        size_t len = (next != NULL) ? (size_t)(next - name) : strlen(name);
+        if (len > 0 && len < CAMAERA_FILENAME_LENGTH) {
+            if (nodes != NULL) {
+                memcpy(nodes[num + 1], name, len);
+                nodes[num + 1][len] = '\0';
+            }
+            num++;
+        }
+        name = (next != NULL) ? next + 1 : NULL;
+    }
+
+    return num;
+}
+
+// channels are tiled two per row.
+static void getMosaicGrid(uint32_t channels, uint32_t* cols, uint32_t* rows)
+{
+    *cols = (channels > 1) ? 2 : 1;
+    *rows = (channels + 1) / 2;
+}
+
 Max9286Mipi::Max9286Mipi(int32_t id, int32_t facing, int32_t orientation, char *path)
     : Camera(id, facing, orientation, path)
 {
@@ -41,6 +74,10 @@ status_t Max9286Mipi::initSensorStaticData()
     memset(sensorFormats, 0, sizeof(sensorFormats));
     memset(availFormats, 0, sizeof(availFormats));
 
+    // synchronized channels are reported as one mosaic frame.
+    uint32_t cols, rows;
+    getMosaicGrid(1 + getChannelNodes(NULL), &cols, &rows);
+
     // v4l2 does not support enum format, now hard code here.
     sensorFormats[index] = v4l2_fourcc('Y', 'U', 'Y', 'V');
     availFormats[index++] = v4l2_fourcc('Y', 'U', 'Y', 'V');
@@ -92,13 +129,13 @@ status_t Max9286Mipi::initSensorStaticData()
         // 1920x1080 1280x720 is required by CTS.
         if (!(vid_frmsize.discrete.width == 176 &&
               vid_frmsize.discrete.height == 144)) {
-            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.width;
-            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.height;
+            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.width * cols;
+            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.height * rows;
         }
 
         if (vid_frmval.discrete.denominator / vid_frmval.discrete.numerator > 15) {
-            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.width;
-            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.height;
+            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.width * cols;
+            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.height * rows;
         }
     }  // end while
 
@@ -130,10 +167,10 @@ status_t Max9286Mipi::initSensorStaticData()
     mFocalLength = 3.37f;
     mPhysicalWidth = 3.6288f;   // 2592 x 1.4u
     mPhysicalHeight = 2.7216f;  // 1944 x 1.4u
-    mActiveArrayWidth = 1280;
-    mActiveArrayHeight = 800;
-    mPixelArrayWidth = 1280;
-    mPixelArrayHeight = 800;
+    mActiveArrayWidth = 1280 * cols;
+    mActiveArrayHeight = 800 * rows;
+    mPixelArrayWidth = 1280 * cols;
+    mPixelArrayHeight = 800 * rows;
 
     ALOGI("ImxdpuCsi, mFocalLength:%f, mPhysicalWidth:%f, mPhysicalHeight %f",
           mFocalLength,
@@ -150,11 +187,52 @@ PixelFormat Max9286Mipi::getPreviewPixelFormat()
     return HAL_PIXEL_FORMAT_YCbCr_422_I;
 }
 
+Max9286Mipi::Max9286Stream::Max9286Stream(Camera *device)
+    : MMAPStream(device, true), mChannelWidth(0), mChannelHeight(0),
+      mMosaicBusy(0), mTarget(NULL), mSyncExit(false)
+{
+    memset(mNodes, 0, sizeof(mNodes));
+    memset(mChannels, 0, sizeof(mChannels));
+    for (uint32_t i = 0; i < MAX9286_CHANNELS; i++) {
+        mChannels[i].mFd = -1;
+        mChannels[i].mIndex = -1;
+    }
+    mChannelNum = 1 + getChannelNodes(mNodes);
+    if (mChannelNum > 1) {
+        ALOGI("%s: %d channels captured in lockstep", __func__, mChannelNum);
+    }
+}
+
+Max9286Mipi::Max9286Stream::~Max9286Stream()
+{
+}
+
+int32_t Max9286Mipi::Max9286Stream::setFormatLocked(int32_t fd,
+                                   uint32_t width, uint32_t height)
+{
+    int32_t vformat = convertPixelFormatToV4L2Format(mFormat);
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = vformat;
+    fmt.fmt.pix_mp.width = width & 0xFFFFFFF8;
+    fmt.fmt.pix_mp.height = height & 0xFFFFFFF8;
+    fmt.fmt.pix_mp.num_planes = 1; /* max9286 use YUYV format, is packed storage mode, set num_planes 1*/
+
+    int32_t ret = ioctl(fd, VIDIOC_S_FMT, &fmt);
+    if (ret < 0) {
+        ALOGE("%s: VIDIOC_S_FMT Failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    return 0;
+}
+
 // configure device.
 int32_t Max9286Mipi::Max9286Stream::onDeviceConfigureLocked()
 {
     ALOGI("%s", __func__);
-    int32_t ret = 0;
     if (mDev <= 0) {
         ALOGE("%s invalid fd handle", __func__);
         return BAD_VALUE;
@@ -170,20 +248,509 @@ int32_t Max9286Mipi::Max9286Stream::onDeviceConfigureLocked()
 
     ALOGI("Width * Height %d x %d format %c%c%c%c, fps: %d", mWidth, mHeight, vformat & 0xFF, (vformat >> 8) & 0xFF, (vformat >> 16) & 0xFF, (vformat >> 24) & 0xFF, fps);
 
+    if (mChannelNum <= 1) {
+        return setFormatLocked(mDev, mWidth, mHeight);
+    }
+
+    // each channel captures one tile of mosaic.
+    uint32_t cols, rows;
+    getMosaicGrid(mChannelNum, &cols, &rows);
+    mChannelWidth = (mWidth / cols) & 0xFFFFFFF8;
+    mChannelHeight = (mHeight / rows) & 0xFFFFFFF8;
+    ALOGI("%s: channel %dx%d, mosaic %dx%d", __func__, mChannelWidth,
+          mChannelHeight, cols, rows);
+
+    return setFormatLocked(mDev, mChannelWidth, mChannelHeight);
+}
+
+int32_t Max9286Mipi::Max9286Stream::onDeviceStartLocked()
+{
+    if (mChannelNum <= 1) {
+        return MMAPStream::onDeviceStartLocked();
+    }
+
+    return startChannelsLocked();
+}
+
+int32_t Max9286Mipi::Max9286Stream::onDeviceStopLocked()
+{
+    if (mChannelNum <= 1) {
+        return MMAPStream::onDeviceStopLocked();
+    }
+
+    stopChannelsLocked();
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::startChannel(Max9286Channel& c)
+{
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = MAX9286_CHANNEL_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(c.mFd, VIDIOC_REQBUFS, &req) < 0 || req.count == 0) {
+        ALOGE("%s VIDIOC_REQBUFS failed", __func__);
+        return BAD_VALUE;
+    }
+
+    c.mNumBuffers = req.count < MAX9286_CHANNEL_BUFFERS ? req.count
+                                                         : MAX9286_CHANNEL_BUFFERS;
+    for (uint32_t i = 0; i < c.mNumBuffers; i++) {
+        struct v4l2_buffer buf;
+        struct v4l2_plane planes;
+        memset(&buf, 0, sizeof(buf));
+        memset(&planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.m.planes = &planes;
+        buf.length = 1;
+        buf.index = i;
+        if (ioctl(c.mFd, VIDIOC_QUERYBUF, &buf) < 0) {
+            ALOGE("%s VIDIOC_QUERYBUF error", __func__);
+            return BAD_VALUE;
+        }
+
+        c.mSize[i] = planes.length;
+        c.mVirtAddr[i] = mmap(NULL, planes.length, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, c.mFd, planes.m.mem_offset);
+        if (c.mVirtAddr[i] == MAP_FAILED) {
+            ALOGE("%s mmap failed", __func__);
+            c.mVirtAddr[i] = NULL;
+            return BAD_VALUE;
+        }
+
+        if (ioctl(c.mFd, VIDIOC_QBUF, &buf) < 0) {
+            ALOGE("%s VIDIOC_QBUF Failed", __func__);
+            return BAD_VALUE;
+        }
+    }
+
     struct v4l2_format fmt;
     memset(&fmt, 0, sizeof(fmt));
-
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    fmt.fmt.pix_mp.pixelformat = vformat;
-    fmt.fmt.pix_mp.width = mWidth & 0xFFFFFFF8;
-    fmt.fmt.pix_mp.height = mHeight & 0xFFFFFFF8;
-    fmt.fmt.pix_mp.num_planes = 1; /* max9286 use YUYV format, is packed storage mode, set num_planes 1*/
+    c.mStride = mChannelWidth * 2;
+    if (ioctl(c.mFd, VIDIOC_G_FMT, &fmt) == 0 &&
+            fmt.fmt.pix_mp.plane_fmt[0].bytesperline > 0) {
+        c.mStride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    }
 
-    ret = ioctl(mDev, VIDIOC_S_FMT, &fmt);
-    if (ret < 0) {
-        ALOGE("%s: VIDIOC_S_FMT Failed: %s", __func__, strerror(errno));
-        return ret;
+    enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (ioctl(c.mFd, VIDIOC_STREAMON, &bufType) < 0) {
+        ALOGE("%s VIDIOC_STREAMON failed:%s", __func__, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    c.mIndex = -1;
+    c.mCommand = CHANNEL_IDLE;
+    return 0;
+}
+
+void Max9286Mipi::Max9286Stream::stopChannel(Max9286Channel& c)
+{
+    if (c.mFd < 0) {
+        return;
+    }
+
+    enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    ioctl(c.mFd, VIDIOC_STREAMOFF, &bufType);
+    for (uint32_t i = 0; i < MAX9286_CHANNEL_BUFFERS; i++) {
+        if (c.mVirtAddr[i] != NULL) {
+            munmap(c.mVirtAddr[i], c.mSize[i]);
+            c.mVirtAddr[i] = NULL;
+        }
+    }
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(c.mFd, VIDIOC_REQBUFS, &req);
+
+    // channel 0 is device node of stream.
+    if (c.mFd != mDev) {
+        close(c.mFd);
+    }
+    c.mFd = -1;
+    c.mIndex = -1;
+}
+
+int32_t Max9286Mipi::Max9286Stream::allocateMosaicLocked()
+{
+    if (mIonFd <= 0) {
+        mIonFd = ion_open();
+        if (mIonFd <= 0) {
+            ALOGE("%s ion_open failed", __func__);
+            return BAD_VALUE;
+        }
+    }
+
+    int32_t size = mWidth * mHeight * 2;
+    int32_t ionSize = (size + PAGE_SIZE) & (~(PAGE_SIZE - 1));
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        unsigned char *ptr = NULL;
+        int32_t sharedFd = -1;
+        ion_user_handle_t ionHandle = -1;
+        if (ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle)) {
+            ALOGE("%s ion_alloc failed", __func__);
+            return BAD_VALUE;
+        }
+
+        if (ion_map(mIonFd, ionHandle, ionSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, 0, &ptr, &sharedFd)) {
+            ALOGE("%s ion_map failed", __func__);
+            ion_free(mIonFd, ionHandle);
+            if (sharedFd > 0) {
+                close(sharedFd);
+            }
+            return BAD_VALUE;
+        }
+
+        int32_t phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
+        if (phyAddr == 0) {
+            ALOGE("%s ion_phys failed", __func__);
+            munmap(ptr, ionSize);
+            close(sharedFd);
+            ion_free(mIonFd, ionHandle);
+            return BAD_VALUE;
+        }
+
+        mBuffers[i] = new StreamBuffer();
+        mBuffers[i]->mVirtAddr  = ptr;
+        mBuffers[i]->mPhyAddr   = phyAddr;
+        mBuffers[i]->mSize      = ionSize;
+        mBuffers[i]->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
+        mBuffers[i]->mFd = sharedFd;
+        mBuffers[i]->mStream = this;
     }
 
+    mMosaicBusy = 0;
+    return 0;
+}
+
+void Max9286Mipi::Max9286Stream::freeMosaicLocked()
+{
+    for (uint32_t i = 0; i < MAX_STREAM_BUFFERS; i++) {
+        if (mBuffers[i] == NULL) {
+            continue;
+        }
+
+        ion_user_handle_t ionHandle =
+            (ion_user_handle_t)(uintptr_t)mBuffers[i]->mBufHandle;
+        munmap(mBuffers[i]->mVirtAddr, mBuffers[i]->mSize);
+        close(mBuffers[i]->mFd);
+        ion_free(mIonFd, ionHandle);
+        delete mBuffers[i];
+        mBuffers[i] = NULL;
+    }
+    mMosaicBusy = 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::startChannelsLocked()
+{
+    ALOGI("%s", __func__);
+    if (mDev <= 0) {
+        ALOGE("%s invalid dev node", __func__);
+        return BAD_VALUE;
+    }
+
+    for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+        Max9286Channel& c = mChannels[ch];
+        if (ch > 0) {
+            rearview_release(mNodes[ch], REARVIEW_RELEASE_TIMEOUT);
+        }
+        c.mFd = (ch == 0) ? mDev : open(mNodes[ch], O_RDWR);
+        if (c.mFd < 0) {
+            ALOGE("%s can not open channel %d node %s", __func__, ch,
+                  mNodes[ch]);
+            goto err;
+        }
+
+        if ((ch > 0 && setFormatLocked(c.mFd, mChannelWidth,
+                                       mChannelHeight) != 0) ||
+                startChannel(c) != 0) {
+            ALOGE("%s start channel %d failed", __func__, ch);
+            goto err;
+        }
+    }
+
+    if (allocateMosaicLocked() != 0) {
+        goto err;
+    }
+
+    mSyncExit = false;
+    for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+        mThreads[ch] = new ChannelThread(this, ch);
+        mThreads[ch]->run("Max9286Channel", PRIORITY_URGENT_DISPLAY);
+    }
+
+    return 0;
+
+err:
+    stopChannelsLocked();
+    return BAD_VALUE;
+}
+
+void Max9286Mipi::Max9286Stream::stopChannelsLocked()
+{
+    {
+        Mutex::Autolock _l(mSyncLock);
+        mSyncExit = true;
+        mSyncCondition.broadcast();
+    }
+
+    for (uint32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        if (mThreads[ch] != NULL) {
+            mThreads[ch]->requestExitAndWait();
+            mThreads[ch].clear();
+        }
+    }
+
+    for (uint32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        if (mChannels[ch].mFd >= 0) {
+            ALOGI("%s channel %d dropped %d missed %d", __func__, ch,
+                  mChannels[ch].mDropped, mChannels[ch].mMissed);
+        }
+        stopChannel(mChannels[ch]);
+    }
+    freeMosaicLocked();
+}
+
+void Max9286Mipi::Max9286Stream::waitChannelsLocked()
+{
+    for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+        while (mChannels[ch].mCommand != CHANNEL_IDLE) {
+            mDoneCondition.wait(mSyncLock);
+        }
+    }
+}
+
+void Max9286Mipi::Max9286Stream::runChannelsLocked(uint32_t mask,
+                                   int32_t command, bool wait)
+{
+    // prefetch of last frame completes first.
+    waitChannelsLocked();
+    for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+        if (mask & (1 << ch)) {
+            mChannels[ch].mCommand = command;
+        }
+    }
+    mSyncCondition.broadcast();
+
+    if (wait) {
+        waitChannelsLocked();
+    }
+}
+
+int32_t Max9286Mipi::Max9286Stream::onFrameAcquireLocked()
+{
+    if (mChannelNum <= 1) {
+        return MMAPStream::onFrameAcquireLocked();
+    }
+
+    int32_t index = -1;
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        if (!(mMosaicBusy & (1 << i))) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        ALOGE("%s no free mosaic buffer", __func__);
+        return -1;
+    }
+
+    uint32_t all = (1 << mChannelNum) - 1;
+    nsecs_t tolerance = 1000000000LL / (mFps > 0 ? mFps : 30) / 2;
+
+    Mutex::Autolock _l(mSyncLock);
+    waitChannelsLocked();
+    uint32_t empty = 0;
+    for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+        if (mChannels[ch].mIndex < 0) {
+            empty |= 1 << ch;
+        }
+    }
+    if (empty != 0) {
+        runChannelsLocked(empty, CHANNEL_DEQUEUE, true);
+    }
+
+    // channels behind newest frame take their next frame.
+    nsecs_t newest = 0;
+    nsecs_t sensorTime = 0;
+    for (uint32_t retry = 0; retry <= MAX9286_SYNC_RETRY; retry++) {
+        newest = 0;
+        for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+            Max9286Channel& c = mChannels[ch];
+            if (c.mIndex >= 0 && c.mTimestamp > newest) {
+                newest = c.mTimestamp;
+                sensorTime = c.mSensorTimestamp;
+            }
+        }
+
+        uint32_t late = 0;
+        for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+            Max9286Channel& c = mChannels[ch];
+            if (c.mIndex >= 0 && c.mTimestamp + tolerance < newest) {
+                late |= 1 << ch;
+                c.mDropped++;
+            }
+        }
+
+        if (late == 0 || retry == MAX9286_SYNC_RETRY) {
+            break;
+        }
+        runChannelsLocked(late, CHANNEL_DEQUEUE, true);
+    }
+
+    if (newest == 0) {
+        ALOGE("%s no channel captured", __func__);
+        return -1;
+    }
+
+    // stalled channel gets black tile, others keep frame rate.
+    for (uint32_t ch = 0; ch < mChannelNum; ch++) {
+        if (mChannels[ch].mIndex < 0) {
+            ALOGW("%s channel %d stalled, missed %d", __func__, ch,
+                  mChannels[ch].mMissed);
+        }
+    }
+    mBuffers[index]->mSensorTimestamp = sensorTime;
+    mTarget = (uint8_t*)mBuffers[index]->mVirtAddr;
+    runChannelsLocked(all, CHANNEL_COPY, true);
+    mMosaicBusy |= 1 << index;
+
+    // next frames are dequeued while this one is processed.
+    runChannelsLocked(all, CHANNEL_DEQUEUE, false);
+
+    return index;
+}
+
+int32_t Max9286Mipi::Max9286Stream::onFrameReturnLocked(int32_t index,
+                                                       StreamBuffer& buf)
+{
+    if (mChannelNum <= 1) {
+        return MMAPStream::onFrameReturnLocked(index, buf);
+    }
+
+    mMosaicBusy &= ~(1 << index);
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::dequeueChannel(Max9286Channel& c)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes;
+    memset(&buf, 0, sizeof(buf));
+    memset(&planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.m.planes = &planes;
+    buf.length = 1;
+
+    if (c.mIndex >= 0) {
+        // frame is too old for mosaic, give it back.
+        buf.index = c.mIndex;
+        ioctl(c.mFd, VIDIOC_QBUF, &buf);
+        c.mIndex = -1;
+    }
+
+    // wait two frames at most, stalled channel must not block others.
+    struct pollfd fds;
+    fds.fd = c.mFd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int32_t timeout = 2000 / (mFps > 0 ? mFps : 30);
+    if (poll(&fds, 1, timeout) <= 0 || !(fds.revents & POLLIN)) {
+        c.mMissed++;
+        return -ETIMEDOUT;
+    }
+
+    if (ioctl(c.mFd, VIDIOC_DQBUF, &buf) < 0) {
+        ALOGE("%s: VIDIOC_DQBUF Failed: %s", __func__, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    c.mIndex = buf.index;
+    c.mTimestamp = (nsecs_t)buf.timestamp.tv_sec * 1000000000LL +
+                   buf.timestamp.tv_usec * 1000LL;
+    c.mSensorTimestamp = getV4l2Timestamp(buf.timestamp, buf.flags);
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::copyChannel(Max9286Channel& c, uint32_t ch)
+{
+    uint32_t cols, rows;
+    getMosaicGrid(mChannelNum, &cols, &rows);
+    uint32_t stride = mWidth * 2;
+    uint32_t line = mChannelWidth * 2;
+    uint8_t* dst = mTarget + (ch / cols) * mChannelHeight * stride +
+                   (ch % cols) * line;
+
+    if (c.mIndex < 0) {
+        // YUYV black.
+        for (uint32_t y = 0; y < mChannelHeight; y++) {
+            uint32_t* p = (uint32_t*)(dst + y * stride);
+            for (uint32_t x = 0; x < line / 4; x++) {
+                p[x] = 0x80108010;
+            }
+        }
+        return 0;
+    }
+
+    const uint8_t* src = (const uint8_t*)c.mVirtAddr[c.mIndex];
+    for (uint32_t y = 0; y < mChannelHeight; y++) {
+        memcpy(dst + y * stride, src + y * c.mStride, line);
+    }
+
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes;
+    memset(&buf, 0, sizeof(buf));
+    memset(&planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.m.planes = &planes;
+    buf.length = 1;
+    buf.index = c.mIndex;
+    c.mIndex = -1;
+    if (ioctl(c.mFd, VIDIOC_QBUF, &buf) < 0) {
+        ALOGE("%s: VIDIOC_QBUF Failed: %s", __func__, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::handleChannel(uint32_t ch)
+{
+    Max9286Channel& c = mChannels[ch];
+    int32_t command;
+    {
+        Mutex::Autolock _l(mSyncLock);
+        while (c.mCommand == CHANNEL_IDLE && !mSyncExit) {
+            mSyncCondition.wait(mSyncLock);
+        }
+
+        if (mSyncExit) {
+            c.mCommand = CHANNEL_IDLE;
+            mDoneCondition.broadcast();
+            return -1;
+        }
+        command = c.mCommand;
+    }
+
+    int32_t ret = 0;
+    if (command == CHANNEL_DEQUEUE) {
+        ret = dequeueChannel(c);
+    }
+    else if (command == CHANNEL_COPY) {
+        ret = copyChannel(c, ch);
+    }
+
+    Mutex::Autolock _l(mSyncLock);
+    c.mResult = ret;
+    c.mCommand = CHANNEL_IDLE;
+    mDoneCondition.broadcast();
+
     return 0;
 }
@@ -20,6 +20,15 @@
 #include "Camera.h"
 #include "MMAPStream.h"
 
+// channels of deserializer captured in lockstep into one mosaic frame.
+#define MAX9286_CHANNELS 4
+#define MAX9286_CHANNEL_BUFFERS 4
+// other channel nodes, "/dev/video1,/dev/video2,/dev/video3".
+// empty keeps single channel capture.
+#define MAX9286_CHANNEL_PROP "rw.camera.max9286.channels"
+// rounds of dropping old frames to align channel timestamps.
+#define MAX9286_SYNC_RETRY 2
+
 class Max9286Mipi : public Camera
 {
 public:
@@ -27,17 +36,102 @@ public:
     ~Max9286Mipi();
 
     virtual status_t initSensorStaticData();
+    // mosaic size follows channel property, which may change.
+    virtual bool isStaticInfoCacheable() {return false;}
     virtual PixelFormat getPreviewPixelFormat();
 
 private:
+    struct Max9286Channel
+    {
+        int32_t mFd;
+        uint32_t mStride;
+        uint32_t mNumBuffers;
+        void* mVirtAddr[MAX9286_CHANNEL_BUFFERS];
+        size_t mSize[MAX9286_CHANNEL_BUFFERS];
+        // CHANNEL_* command, worker sets it idle when done.
+        int32_t mCommand;
+        // dequeued V4L2 buffer, -1 if channel has no frame.
+        int32_t mIndex;
+        nsecs_t mTimestamp;
+        // mTimestamp in clock of sensor timestamp.
+        nsecs_t mSensorTimestamp;
+        int32_t mResult;
+        // frames dropped to align and frames missed by timeout.
+        uint32_t mDropped;
+        uint32_t mMissed;
+    };
+
     class Max9286Stream : public MMAPStream
     {
     public:
-        Max9286Stream(Camera *device) : MMAPStream(device, true) {}
-        virtual ~Max9286Stream() {}
+        Max9286Stream(Camera *device);
+        virtual ~Max9286Stream();
 
         // configure device.
         virtual int32_t onDeviceConfigureLocked();
+        // start device.
+        virtual int32_t onDeviceStartLocked();
+        // stop device.
+        virtual int32_t onDeviceStopLocked();
+        // get assembled frame in synchronized mode.
+        virtual int32_t onFrameAcquireLocked();
+        // put buffer back.
+        virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf);
+        // mosaic frames come from channel threads, not from mDev.
+        virtual bool canLookahead() {return mChannelNum <= 1;}
+
+        // channel worker, return non zero to exit.
+        int32_t handleChannel(uint32_t ch);
+
+    private:
+        static const int32_t CHANNEL_IDLE = 0;
+        static const int32_t CHANNEL_DEQUEUE = 1;
+        static const int32_t CHANNEL_COPY = 2;
+
+        class ChannelThread : public Thread
+        {
+        public:
+            ChannelThread(Max9286Stream *stream, uint32_t ch)
+                : Thread(false), mStream(stream), mChannel(ch)
+                {}
+
+            virtual bool threadLoop() {
+                return mStream->handleChannel(mChannel) == 0;
+            }
+
+        private:
+            Max9286Stream* mStream;
+            uint32_t mChannel;
+        };
+
+        int32_t setFormatLocked(int32_t fd, uint32_t width, uint32_t height);
+        int32_t startChannelsLocked();
+        void stopChannelsLocked();
+        int32_t startChannel(Max9286Channel& c);
+        void stopChannel(Max9286Channel& c);
+        int32_t allocateMosaicLocked();
+        void freeMosaicLocked();
+        // send command to channels of mask and wait them done.
+        void runChannelsLocked(uint32_t mask, int32_t command, bool wait);
+        void waitChannelsLocked();
+        int32_t dequeueChannel(Max9286Channel& c);
+        int32_t copyChannel(Max9286Channel& c, uint32_t ch);
+
+        // channel nodes besides mDev, channel 0 is mDev.
+        char mNodes[MAX9286_CHANNELS][CAMAERA_FILENAME_LENGTH];
+        uint32_t mChannelNum;
+        Max9286Channel mChannels[MAX9286_CHANNELS];
+        sp<ChannelThread> mThreads[MAX9286_CHANNELS];
+        uint32_t mChannelWidth;
+        uint32_t mChannelHeight;
+        // mosaic buffers handed out to pipeline, bit per index.
+        uint32_t mMosaicBusy;
+        uint8_t* mTarget;
+
+        Mutex mSyncLock;
+        Condition mSyncCondition;
+        Condition mDoneCondition;
+        bool mSyncExit;
     };
 };
 
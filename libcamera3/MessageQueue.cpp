@@ -19,6 +19,11 @@
 #include <errno.h>
 #include <sys/types.h>
 
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
 #include <utils/threads.h>
 #include <utils/Timers.h>
 #include <utils/Log.h>
@@ -28,39 +33,28 @@
 
 using namespace android;
 
-void CMessageList::insert(const sp<CMessage>& node)
-{
-    mList.push_back(node);
-}
-
-void CMessageList::remove(CMessageList::LIST::iterator pos)
-{
-    mList.erase(pos);
-}
-
-void CMessageList::clear()
-{
-    mList.clear();
-}
-
 CMessageQueue::CMessageQueue()
+    : mCommandNum(0)
 {
-    Mutex::Autolock _l(mLock);
-    mMessages.clear();
-    mCommands.clear();
+    mEventFd = eventfd(0, EFD_CLOEXEC);
+    if (mEventFd < 0) {
+        ALOGE("%s eventfd failed: %s", __func__, strerror(errno));
+    }
 }
 
 CMessageQueue::~CMessageQueue()
 {
-    Mutex::Autolock _l(mLock);
-
-    mMessages.clear();
-    mCommands.clear();
+    clearMessages();
+    clearCommands();
+    if (mEventFd >= 0) {
+        close(mEventFd);
+        mEventFd = -1;
+    }
 }
+
 void CMessageQueue::clearMessages()
 {
-    Mutex::Autolock _l(mLock);
-
+    // called by consumer thread, or after it exits.
     mMessages.clear();
 }
 
@@ -69,72 +63,96 @@ void CMessageQueue::clearCommands()
     Mutex::Autolock _l(mLock);
 
     mCommands.clear();
+    mCommandNum = 0;
 }
 
-sp<CMessage> CMessageQueue::waitMessage(nsecs_t timeout)
+void CMessageQueue::wake()
+{
+    uint64_t value = 1;
+    if (write(mEventFd, &value, sizeof(value)) != sizeof(value)) {
+        ALOGE("%s write eventfd failed: %s", __func__, strerror(errno));
+    }
+}
+
+status_t CMessageQueue::waitMessage(CMessage& message, nsecs_t timeout,
+                                    int fd)
 {
-    sp<CMessage>    result;
     nsecs_t timeoutTime = systemTime() + timeout;
+    bool readable = false;
     while (true) {
-        Mutex::Autolock _l(mLock);
-        nsecs_t now = systemTime();
-
         // handle command firstly.
-        LIST::iterator cur(mCommands.begin());
-        if (cur != mCommands.end()) {
-            result = *cur;
-        }
-
-        if (result != 0) {
-            mCommands.remove(cur);
-            break;
+        if (mCommandNum.load() > 0) {
+            Mutex::Autolock _l(mLock);
+            if (!mCommands.empty()) {
+                message = *mCommands.begin();
+                mCommands.erase(mCommands.begin());
+                mCommandNum--;
+                return NO_ERROR;
+            }
         }
 
         // handle message secondly.
-        cur = mMessages.begin();
-        if (cur != mMessages.end()) {
-            result = *cur;
+        if (mMessages.pop(message)) {
+            return NO_ERROR;
         }
 
-        if (result != 0) {
-            mMessages.remove(cur);
-            break;
+        if (readable) {
+            return -EAGAIN;
         }
 
+        int waitMs = -1;
         if (timeout >= 0) {
+            nsecs_t now = systemTime();
             if (timeoutTime < now) {
-                result = 0;
-                break;
+                return -ETIMEDOUT;
             }
-            nsecs_t relTime = timeoutTime - systemTime();
-            mCondition.waitRelative(mLock, relTime);
-        } else {
-            mCondition.wait(mLock);
+            waitMs = (int)ns2ms(timeoutTime - now);
         }
-    }
-
-    return result;
-}
 
-status_t CMessageQueue::postMessage(const sp<CMessage> message,
-                                    int32_t             flags)
-{
-    return queueMessage(message, flags);
+        // eventfd counter keeps wakes posted before poll.
+        struct pollfd fds[2];
+        fds[0].fd = mEventFd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        int ret = poll(fds, fd >= 0 ? 2 : 1, waitMs);
+        if (ret > 0) {
+            if (fds[0].revents & POLLIN) {
+                uint64_t value;
+                if (read(mEventFd, &value, sizeof(value)) < 0) {
+                    ALOGW("%s read eventfd failed: %s", __func__,
+                          strerror(errno));
+                }
+            }
+            // messages posted meanwhile still go first.
+            readable = fds[1].revents != 0;
+        }
+        else if (ret < 0 && errno != EINTR) {
+            ALOGE("%s poll failed: %s", __func__, strerror(errno));
+            return -errno;
+        }
+    }
 }
 
-status_t CMessageQueue::queueMessage(const sp<CMessage>& message,
-                                     int32_t             flags)
+status_t CMessageQueue::postMessage(int32_t  what,
+                                    intptr_t arg0,
+                                    int32_t  flags)
 {
-    Mutex::Autolock _l(mLock);
-
     if (flags == 0) {
-        mMessages.insert(message);
+        Mutex::Autolock _l(mPostLock);
+        if (!mMessages.push(CMessage(what, arg0))) {
+            ALOGE("%s message ring full, what:%d", __func__, what);
+            return -ENOSPC;
+        }
     }
     else {
-        mCommands.insert(message);
+        Mutex::Autolock _l(mLock);
+        mCommands.push_back(CMessage(what, arg0));
+        mCommandNum++;
     }
 
-    mCondition.signal();
+    wake();
     return NO_ERROR;
 }
-
@@ -24,77 +24,55 @@
 #include <utils/threads.h>
 #include <utils/Timers.h>
 #include <utils/List.h>
-#include <semaphore.h>
+#include <atomic>
 
-using namespace android;
-class CMessage;
-
-class CMessageList {
-    List< sp<CMessage> > mList;
-    typedef List< sp<CMessage> > LIST;
-
-public:
-    inline LIST::iterator begin() {
-        return mList.begin();
-    }
-
-    inline LIST::const_iterator begin() const {
-        return mList.begin();
-    }
-
-    inline LIST::iterator end() {
-        return mList.end();
-    }
-
-    inline LIST::const_iterator end() const {
-        return mList.end();
-    }
-
-    inline bool isEmpty() const {
-        return mList.empty();
-    }
+#include "RingQueue.h"
 
-    void insert(const sp<CMessage>& node);
-    void remove(LIST::iterator pos);
-    void clear();
-};
+using namespace android;
 
-class CMessage : public LightRefBase<CMessage>{
-public:
+// messages are copied by value, no allocation per message.
+struct CMessage {
     int32_t what;
-    int32_t arg0;
+    intptr_t arg0;
 
-    CMessage(int32_t what,
-             int32_t arg0 = 0)
+    CMessage(int32_t what = 0,
+             intptr_t arg0 = 0)
         : what(what), arg0(arg0) {}
-
-    virtual ~CMessage() {}
-
-private:
-    friend class LightRefBase<CMessage>;
 };
 
-class CMessageQueue {
-    typedef List< sp<CMessage> > LIST;
+// capacity of ordered message ring.
+#define MESSAGE_RING_SIZE 64
 
+class CMessageQueue {
 public:
     CMessageQueue();
     ~CMessageQueue();
 
-    sp<CMessage> waitMessage(nsecs_t timeout = -1);
-    status_t     postMessage(const sp<CMessage> message,
-                             int32_t             flags = 0);
+    // commands first, then messages in post order. return -ETIMEDOUT
+    // on timeout, -EAGAIN if fd is readable or in
+    // error and no message is queued.
+    status_t     waitMessage(CMessage& message, nsecs_t timeout = -1,
+                             int fd = -1);
+    // flags 0 posts message through ordered ring, other flags post
+    // command which goes first. any thread may post.
+    status_t     postMessage(int32_t  what,
+                             intptr_t arg0  = 0,
+                             int32_t  flags = 0);
 	void clearMessages();
 	void clearCommands();
 
 private:
-    status_t queueMessage(const sp<CMessage>& message,
-                          int32_t             flags);
+    void wake();
 
     Mutex mLock;
-    Condition mCondition;
-    CMessageList mMessages;
-    CMessageList mCommands;
+    List<CMessage> mCommands;
+    // commands count, so consumer skips mLock without commands.
+    std::atomic<int32_t> mCommandNum;
+    // ring has one producer side, framework threads of shared logical
+    // cameras post at the same time. consumer pops without lock.
+    Mutex mPostLock;
+    RingQueue<CMessage, MESSAGE_RING_SIZE> mMessages;
+    int mEventFd;
 };
 
 #endif // ifndef CAMERA_HAL_MESSAGE_QUEUE_H
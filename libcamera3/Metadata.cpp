@@ -15,11 +15,15 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
 #include <system/camera_metadata.h>
 
 //#define LOG_NDEBUG 0
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <latency_mark_ext.h>
 #include "Metadata.h"
+#include "VendorTags.h"
 
 Metadata::Metadata(const camera_metadata_t *metadata)
 {
@@ -36,6 +40,89 @@ camera_metadata_entry_t Metadata::find(uint32_t tag)
     return mData.find(tag);
 }
 
+void Metadata::set(const camera_metadata_t *metadata)
+{
+    mData = metadata;
+}
+
+void Metadata::assign(const camera_metadata_t *metadata, size_t entries,
+                      size_t data)
+{
+    if (metadata == NULL) {
+        mData.clear();
+        return;
+    }
+
+    size_t needEntries = get_camera_metadata_entry_count(metadata);
+    size_t needData = get_camera_metadata_data_count(metadata);
+    entries = (entries > needEntries) ? entries : needEntries;
+    data = (data > needData) ? data : needData;
+
+    camera_metadata_t* buffer = mData.release();
+    if (buffer != NULL &&
+            (get_camera_metadata_entry_capacity(buffer) < entries ||
+             get_camera_metadata_data_capacity(buffer) < data)) {
+        ALOGV("%s grow to %zu entries %zu bytes", __func__, entries, data);
+        entries = (get_camera_metadata_entry_capacity(buffer) > entries) ?
+                  get_camera_metadata_entry_capacity(buffer) : entries;
+        data = (get_camera_metadata_data_capacity(buffer) > data) ?
+               get_camera_metadata_data_capacity(buffer) : data;
+        free_camera_metadata(buffer);
+        buffer = NULL;
+    }
+
+    if (buffer == NULL) {
+        buffer = allocate_camera_metadata(entries, data);
+    }
+    else {
+        // empty the buffer in place, capacity stays.
+        buffer = place_camera_metadata(buffer, get_camera_metadata_size(buffer),
+                    get_camera_metadata_entry_capacity(buffer),
+                    get_camera_metadata_data_capacity(buffer));
+    }
+
+    if (buffer == NULL || append_camera_metadata(buffer, metadata) != 0) {
+        ALOGE("%s copy metadata failed", __func__);
+        if (buffer != NULL) {
+            free_camera_metadata(buffer);
+        }
+        mData = metadata;
+        return;
+    }
+
+    mData.acquire(buffer);
+}
+
+bool Metadata::equals(const camera_metadata_t *other)
+{
+    const camera_metadata_t* data = get();
+    if (data == NULL || other == NULL) {
+        return data == other;
+    }
+
+    size_t count = get_camera_metadata_entry_count(data);
+    if (count != get_camera_metadata_entry_count(other)) {
+        return false;
+    }
+
+    // framework keeps entries in order, so compare them pairwise.
+    camera_metadata_ro_entry_t a, b;
+    for (size_t i = 0; i < count; i++) {
+        if (get_camera_metadata_ro_entry(data, i, &a) != 0 ||
+            get_camera_metadata_ro_entry(other, i, &b) != 0) {
+            return false;
+        }
+
+        if (a.tag != b.tag || a.type != b.type || a.count != b.count ||
+            memcmp(a.data.u8, b.data.u8,
+                   a.count * camera_metadata_type_size[a.type])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int32_t Metadata::getRequestType()
 {
     camera_metadata_entry_t intent =
@@ -50,6 +137,9 @@ int32_t Metadata::getRequestType()
     else if (intent.data.u8[0] == ANDROID_CONTROL_CAPTURE_INTENT_VIDEO_SNAPSHOT) {
         return TYPE_SNAPSHOT;
     }
+    else if (intent.data.u8[0] == ANDROID_CONTROL_CAPTURE_INTENT_ZERO_SHUTTER_LAG) {
+        return TYPE_ZSL;
+    }
 
     return TYPE_PREVIEW;
 }
@@ -162,6 +252,41 @@ int32_t Metadata::getJpegThumbSize(int &width, int &height)
     return NO_ERROR;
 }
 
+bool Metadata::isBurstMode()
+{
+    camera_metadata_entry_t entry;
+    entry = mData.find(imx_capture_burst_mode);
+    if (entry.count == 0) {
+        return false;
+    }
+
+    return entry.data.u8[0] != 0;
+}
+
+int32_t Metadata::getBurstFps(int32_t &fps)
+{
+    camera_metadata_entry_t entry;
+    entry = mData.find(imx_capture_burst_fps);
+    if (entry.count == 0) {
+        return BAD_VALUE;
+    }
+
+    fps = entry.data.i32[0];
+    return NO_ERROR;
+}
+
+int32_t Metadata::getDeinterlaceMode(int32_t &mode)
+{
+    camera_metadata_entry_t entry;
+    entry = mData.find(imx_capture_deinterlace);
+    if (entry.count == 0) {
+        return BAD_VALUE;
+    }
+
+    mode = entry.data.u8[0];
+    return NO_ERROR;
+}
+
 int32_t Metadata::getFocalLength(float &focalLength)
 {
     camera_metadata_entry_t entry;
@@ -231,6 +356,20 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
             ARRAY_SIZE(android_request_max_num_output_streams),
             android_request_max_num_output_streams);
 
+    int32_t android_request_max_num_input_streams = 1;
+    m.addInt32(ANDROID_REQUEST_MAX_NUM_INPUT_STREAMS, 1,
+            &android_request_max_num_input_streams);
+
+    // format, number of outputs, output formats.
+    int32_t inputOutputFormats[] = {HAL_PIXEL_FORMAT_YCBCR_420_888, 1, HAL_PIXEL_FORMAT_BLOB};
+    m.addInt32(ANDROID_SCALER_AVAILABLE_INPUT_OUTPUT_FORMATS_MAP,
+            ARRAY_SIZE(inputOutputFormats),
+            inputOutputFormats);
+
+    // reprocess request is encoded in frame it is queued.
+    int32_t reprocessMaxStall = 1;
+    m.addInt32(ANDROID_REPROCESS_MAX_CAPTURE_STALL, 1, &reprocessMaxStall);
+
     /* android.scaler */
     m.addInt32(ANDROID_SCALER_AVAILABLE_FORMATS,
             sensor.mAvailableFormatCount,
@@ -313,11 +452,45 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
              ARRAY_SIZE(availableSceneModes),
              availableSceneModes);
 
-    uint8_t available_capabilities[] = {ANDROID_REQUEST_AVAILABLE_CAPABILITIES_BACKWARD_COMPATIBLE};
+    // yuv input is reprocessed to jpeg by the capture encoder.
+    uint8_t available_capabilities[] = {ANDROID_REQUEST_AVAILABLE_CAPABILITIES_BACKWARD_COMPATIBLE,
+                                        ANDROID_REQUEST_AVAILABLE_CAPABILITIES_YUV_REPROCESSING,
+                                        ANDROID_REQUEST_AVAILABLE_CAPABILITIES_CONSTRAINED_HIGH_SPEED_VIDEO};
+    // high speed video is last, only for sensors with fast modes.
+    int capabilityCount = ARRAY_SIZE(available_capabilities);
+    if (sensor.mHighSpeedModeCount == 0) {
+        capabilityCount--;
+    }
     m.addUInt8(ANDROID_REQUEST_AVAILABLE_CAPABILITIES,
-            ARRAY_SIZE(available_capabilities),
+            capabilityCount,
             available_capabilities);
 
+    // width, height, fps min, fps max, batch size. preview runs from
+    // 30fps, recording at fixed mode rate.
+    int32_t highSpeedConfigs[MAX_HIGH_SPEED_MODE * 10];
+    int highSpeedCount = 0;
+    int maxBatch = 1;
+    for (int i = 0; i < sensor.mHighSpeedModeCount; i += 3) {
+        int32_t fps = sensor.mHighSpeedModes[i+2];
+        int32_t batch = fps / HIGH_SPEED_PREVIEW_FPS;
+        int32_t fpsMin[] = {HIGH_SPEED_PREVIEW_FPS, fps};
+        for (int j = 0; j < 2; j++) {
+            highSpeedConfigs[highSpeedCount++] = sensor.mHighSpeedModes[i];
+            highSpeedConfigs[highSpeedCount++] = sensor.mHighSpeedModes[i+1];
+            highSpeedConfigs[highSpeedCount++] = fpsMin[j];
+            highSpeedConfigs[highSpeedCount++] = fps;
+            highSpeedConfigs[highSpeedCount++] = batch;
+        }
+        if (batch > maxBatch) {
+            maxBatch = batch;
+        }
+    }
+    if (highSpeedCount > 0) {
+        m.addInt32(ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS,
+                highSpeedCount,
+                highSpeedConfigs);
+    }
+
     uint8_t lensFacing = (camInfo.facing == CAMERA_FACING_BACK) ? ANDROID_LENS_FACING_BACK : ANDROID_LENS_FACING_FRONT;
     m.addUInt8(ANDROID_LENS_FACING,
                1,
@@ -326,7 +499,7 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
     int ResIdx = 0;
     int ResCount = 0;
     int streamConfigIdx = 0;
-    int32_t streamConfig[MAX_RESOLUTION_SIZE * 6]; // MAX_RESOLUTION_SIZE/2 * 2 * 6;
+    int32_t streamConfig[MAX_RESOLUTION_SIZE * 8]; // input yuv config adds 2 more;
     int64_t minFrmDuration[MAX_RESOLUTION_SIZE * 6];
     int64_t stallDuration[MAX_RESOLUTION_SIZE * 6];
 
@@ -391,16 +564,27 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
          stallDuration[streamConfigIdx + 3] = 0;
     }
 
+    // durations are for output configs only.
+    int durationCount = streamConfigIdx + 4;
+    for (ResIdx = 0; ResIdx < ResCount; ResIdx++) {
+         streamConfigIdx = durationCount + ResIdx * 4;
+
+         streamConfig[streamConfigIdx] = HAL_PIXEL_FORMAT_YCBCR_420_888;
+         streamConfig[streamConfigIdx + 1] = sensor.mPreviewResolutions[ResIdx * 2];
+         streamConfig[streamConfigIdx + 2] = sensor.mPreviewResolutions[ResIdx * 2 + 1];
+         streamConfig[streamConfigIdx + 3] = ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS_INPUT;
+    }
+
     m.addInt32(ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS,
                     streamConfigIdx + 4,
                     streamConfig);
 
     m.addInt64(ANDROID_SCALER_AVAILABLE_MIN_FRAME_DURATIONS,
-                    streamConfigIdx + 4,
+                    durationCount,
                     minFrmDuration);
 
     m.addInt64(ANDROID_SCALER_AVAILABLE_STALL_DURATIONS,
-                    streamConfigIdx + 4,
+                    durationCount,
                     stallDuration);
 
     uint8_t supportedHwLvl =  ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL_LEGACY;
@@ -423,7 +607,8 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
     static const uint8_t tonemapMode = ANDROID_TONEMAP_MODE_FAST;
     m.addUInt8(ANDROID_TONEMAP_MODE, 1, &tonemapMode);
 
-    static const uint8_t pipelineMaxDepth = 3;
+    // a whole high speed batch is in flight at once.
+    uint8_t pipelineMaxDepth = maxBatch > 3 ? maxBatch : 3;
     m.addUInt8(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, 1, &pipelineMaxDepth);
 
     static const int32_t partialResultCount = 1;
@@ -435,8 +620,17 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
     static const int32_t maxFaceCount = 0;
     m.addInt32(ANDROID_STATISTICS_INFO_MAX_FACE_COUNT, 1, &maxFaceCount);
 
-    int32_t availableResultKeys[] = {ANDROID_SENSOR_TIMESTAMP, ANDROID_FLASH_STATE};
-    m.addInt32(ANDROID_REQUEST_AVAILABLE_RESULT_KEYS, ARRAY_SIZE(availableResultKeys), availableResultKeys);
+    // capture frame time is only in results while latency marks run,
+    // same property VideoStream reads.
+    char latency[PROPERTY_VALUE_MAX];
+    property_get(LATENCY_MARK_PROP, latency, "0");
+    int32_t availableResultKeys[] = {ANDROID_SENSOR_TIMESTAMP, ANDROID_FLASH_STATE,
+                                     (int32_t)imx_capture_frame_time};
+    size_t resultKeyCount = ARRAY_SIZE(availableResultKeys);
+    if (atoi(latency) == 0) {
+        resultKeyCount--;
+    }
+    m.addInt32(ANDROID_REQUEST_AVAILABLE_RESULT_KEYS, resultKeyCount, availableResultKeys);
 
     static const uint8_t availableVstabModes[] = {ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF};
     m.addUInt8(ANDROID_CONTROL_AVAILABLE_VIDEO_STABILIZATION_MODES, ARRAY_SIZE(availableVstabModes), availableVstabModes);
@@ -499,11 +693,14 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
         ANDROID_COLOR_CORRECTION_AVAILABLE_ABERRATION_MODES,
         ANDROID_SCALER_CROPPING_TYPE,
         ANDROID_SCALER_AVAILABLE_MAX_DIGITAL_ZOOM,
+        ANDROID_SCALER_AVAILABLE_INPUT_OUTPUT_FORMATS_MAP,
+        ANDROID_REPROCESS_MAX_CAPTURE_STALL,
         ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES,
         ANDROID_LENS_FACING,
         ANDROID_LENS_INFO_AVAILABLE_FOCAL_LENGTHS,
         ANDROID_NOISE_REDUCTION_AVAILABLE_NOISE_REDUCTION_MODES,
         ANDROID_REQUEST_AVAILABLE_CAPABILITIES,
+        ANDROID_REQUEST_MAX_NUM_INPUT_STREAMS,
         ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
         ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
         ANDROID_SENSOR_INFO_TIMESTAMP_SOURCE,
@@ -514,9 +711,15 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
         ANDROID_SENSOR_ORIENTATION,
         ANDROID_STATISTICS_INFO_AVAILABLE_FACE_DETECT_MODES,
         ANDROID_STATISTICS_INFO_MAX_FACE_COUNT,
-        ANDROID_SYNC_MAX_LATENCY};
+        ANDROID_SYNC_MAX_LATENCY,
+        ANDROID_CONTROL_AVAILABLE_HIGH_SPEED_VIDEO_CONFIGURATIONS};
+    // high speed configurations key is last, only added with modes.
+    int keyCount = ARRAY_SIZE(characteristics_keys_basic);
+    if (highSpeedCount == 0) {
+        keyCount--;
+    }
     m.addInt32(ANDROID_REQUEST_AVAILABLE_CHARACTERISTICS_KEYS,
-               ARRAY_SIZE(characteristics_keys_basic),
+               keyCount,
                characteristics_keys_basic);
 
     /* face detect mode */
@@ -570,7 +773,10 @@ camera_metadata_t* Metadata::createStaticInfo(SensorData& sensor, camera_info &c
                                       ANDROID_SENSOR_INFO_EXPOSURE_TIME_RANGE,
                                       ANDROID_CONTROL_EFFECT_MODE,
                                       ANDROID_FLASH_STATE,
-                                      ANDROID_CONTROL_AE_AVAILABLE_MODES};
+                                      ANDROID_CONTROL_AE_AVAILABLE_MODES,
+                                      (int32_t)imx_capture_burst_mode,
+                                      (int32_t)imx_capture_burst_fps,
+                                      (int32_t)imx_capture_deinterlace};
     m.addInt32(ANDROID_REQUEST_AVAILABLE_REQUEST_KEYS, ARRAY_SIZE(availableRequestKeys), availableRequestKeys);
 
     return clone_camera_metadata(m.get());
@@ -898,6 +1104,57 @@ int Metadata::addRational(uint32_t tag, int count,
     return mData.update(tag, data, count);
 }
 
+void MetadataPool::setCapacity(camera_metadata_t* staticInfo,
+                               sp<Metadata>* templates, int32_t count)
+{
+    size_t entries = 0, data = 0;
+    camera_metadata_ro_entry_t entry;
+    if (staticInfo != NULL) {
+        if (find_camera_metadata_ro_entry(staticInfo,
+                ANDROID_REQUEST_AVAILABLE_REQUEST_KEYS, &entry) == 0) {
+            entries += entry.count;
+        }
+        if (find_camera_metadata_ro_entry(staticInfo,
+                ANDROID_REQUEST_AVAILABLE_RESULT_KEYS, &entry) == 0) {
+            entries += entry.count;
+        }
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+        camera_metadata_t* settings = (templates[i] != NULL) ?
+                                      templates[i]->get() : NULL;
+        if (settings == NULL) {
+            continue;
+        }
+        size_t cur = get_camera_metadata_data_count(settings);
+        data = (cur > data) ? cur : data;
+        cur = get_camera_metadata_entry_count(settings);
+        entries = (cur > entries) ? cur : entries;
+    }
+
+    mEntries = entries;
+    mData = data + METADATA_RESULT_DATA;
+    ALOGI("%s %zu entries %zu bytes", __func__, mEntries, mData);
+}
+
+sp<Metadata> MetadataPool::obtain(const camera_metadata_t *metadata)
+{
+    for (uint32_t i = 0; i < METADATA_POOL_SIZE; i++) {
+        if (mItems[i] == NULL) {
+            mItems[i] = new Metadata();
+        }
+        else if (mItems[i]->getStrongCount() > 1) {
+            continue;
+        }
+
+        mItems[i]->assign(metadata, mEntries, mData);
+        return mItems[i];
+    }
+
+    ALOGV("%s all buffers are held", __func__);
+    return new Metadata(metadata);
+}
+
 bool Metadata::isEmpty() const {
     return mData.isEmpty();
 }
@@ -36,6 +36,15 @@ public:
                                       int request_template);
 
     camera_metadata_entry_t find(uint32_t tag);
+    // replace content with copy of metadata, storage is reused by
+    // later updates of same tags.
+    void set(const camera_metadata_t *metadata);
+    // same as set, but content is copied into own buffer of at least
+    // entries and data bytes, which is only reallocated to grow.
+    void assign(const camera_metadata_t *metadata, size_t entries,
+                size_t data);
+    // same entries as other, regardless of buffer capacity.
+    bool equals(const camera_metadata_t *other);
     //void clear();
     int32_t getRequestType();
 
@@ -47,6 +56,10 @@ public:
     int32_t getJpegQuality(int32_t &quality);
     int32_t getJpegThumbQuality(int32_t &thumb);
     int32_t getJpegThumbSize(int &width, int &height);
+    // burst capture vendor tags.
+    bool isBurstMode();
+    int32_t getBurstFps(int32_t &fps);
+    int32_t getDeinterlaceMode(int32_t &mode);
 
     // Initialize with framework metadata
     //int init(const camera_metadata_t *metadata);
@@ -74,4 +87,30 @@ private:
     CameraMetadata mData;
 };
 
+#define METADATA_POOL_SIZE 8
+// data bytes of result tags which requests don't carry.
+#define METADATA_RESULT_DATA 512
+
+// settings copies of in-flight requests, sized once from static info.
+// a buffer is refilled when no request holds it any more.
+class MetadataPool
+{
+public:
+    MetadataPool() : mEntries(0), mData(0) {}
+
+    // capacity of a request or result, templates and request and
+    // result keys of static info bound it.
+    void setCapacity(camera_metadata_t* staticInfo,
+                     sp<Metadata>* templates, int32_t count);
+    size_t entries() {return mEntries;}
+    size_t data() {return mData;}
+    // copy of metadata, allocates only when all buffers are held.
+    sp<Metadata> obtain(const camera_metadata_t *metadata);
+
+private:
+    size_t mEntries;
+    size_t mData;
+    sp<Metadata> mItems[METADATA_POOL_SIZE];
+};
+
 #endif // METADATA_H_
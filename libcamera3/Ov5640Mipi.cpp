@@ -159,6 +159,26 @@ status_t Ov5640Mipi::initSensorStaticData()
     mTargetFpsRange[i++] = 30;
     mTargetFpsRange[i++] = 30;
 
+    // binned mode of mipi sensor for constrained high speed video, only
+    // when driver reports its frame interval.
+    memset(&vid_frmval, 0, sizeof(struct v4l2_frmivalenum));
+    vid_frmval.pixel_format = convertPixelFormatToV4L2Format(mSensorFormats[0]);
+    vid_frmval.width        = 640;
+    vid_frmval.height       = 480;
+    while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &vid_frmval) == 0) {
+        ALOGV("vid_frmval denominator:%d, numeraton:%d",
+                vid_frmval.discrete.denominator,
+                vid_frmval.discrete.numerator);
+        if (vid_frmval.type == V4L2_FRMIVAL_TYPE_DISCRETE &&
+                vid_frmval.discrete.numerator > 0 &&
+                vid_frmval.discrete.denominator /
+                vid_frmval.discrete.numerator >= HIGH_SPEED_MIN_FPS) {
+            addHighSpeedMode(640, 480, HIGH_SPEED_MIN_FPS);
+            break;
+        }
+        vid_frmval.index++;
+    }
+
     setMaxPictureResolutions();
     ALOGI("mMaxWidth:%d, mMaxHeight:%d", mMaxWidth, mMaxHeight);
 
@@ -0,0 +1,938 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// early rear view camera, started by init before camera HAL and
+// hwcomposer, see imx_rearview.rc for its config.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/videodev2.h>
+#include <drm/drm_fourcc.h>
+#include <cutils/log.h>
+#include <cutils/sockets.h>
+#include <private/android_filesystem_config.h>
+#include <hal_config_ext.h>
+#include <rearview_ext.h>
+#include "RearView.h"
+
+#ifndef DRM_PLANE_TYPE_OVERLAY
+#define DRM_PLANE_TYPE_OVERLAY 0
+#define DRM_PLANE_TYPE_PRIMARY 1
+#endif
+
+// sensor formats a plane scans out from one V4L2 buffer.
+static uint32_t convertFourccToDrm(uint32_t fourcc)
+{
+    switch (fourcc) {
+        case V4L2_PIX_FMT_YUYV:
+            return DRM_FORMAT_YUYV;
+        case V4L2_PIX_FMT_UYVY:
+            return DRM_FORMAT_UYVY;
+        case V4L2_PIX_FMT_NV12:
+            return DRM_FORMAT_NV12;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t parseFourcc(const char* value)
+{
+    if (strlen(value) != 4) {
+        return 0;
+    }
+
+    return v4l2_fourcc(value[0], value[1], value[2], value[3]);
+}
+
+RearView::RearView()
+    : mInput(-1), mWidth(0), mHeight(0), mFourcc(0), mBufferNum(0),
+      mTimeout(0), mV4l2Fd(-1), mPlane(false), mStride(0), mShown(-1),
+      mReleased(false), mStartTime(0), mReleaseTime(0), mDrmFd(-1),
+      mConnectorId(0), mCrtcId(0), mPlaneId(0), mPrimary(false),
+      mModeset(false), mX(0), mY(0), mW(0), mH(0), mScreenSet(false),
+      mPrimaryPlaneId(0), mBlankHandle(0), mBlankFb(0), mPlaneFb(0),
+      mListenFd(-1), mDisplayClient(-1), mDone(false)
+{
+    memset(mDevice, 0, sizeof(mDevice));
+    memset(mDrmDevice, 0, sizeof(mDrmDevice));
+    memset(&mMode, 0, sizeof(mMode));
+    memset(mHandles, 0, sizeof(mHandles));
+    memset(mFbs, 0, sizeof(mFbs));
+    for (uint32_t i = 0; i < REARVIEW_MAX_CLIENTS; i++) {
+        mClients[i] = -1;
+    }
+}
+
+RearView::~RearView()
+{
+    for (uint32_t i = 0; i < REARVIEW_MAX_CLIENTS; i++) {
+        closeClient(i);
+    }
+    closeSensor();
+    closeDisplay();
+}
+
+bool RearView::init()
+{
+    char value[PROPERTY_VALUE_MAX];
+    hal_config_get("rearview.device", mDevice, "/dev/video0");
+    hal_config_get("rearview.drm.device", mDrmDevice, "/dev/dri/card0");
+    mInput = (int32_t)hal_config_get_int("rearview.input", -1);
+    mWidth = (uint32_t)hal_config_get_int("rearview.width", 1280);
+    mHeight = (uint32_t)hal_config_get_int("rearview.height", 720);
+    hal_config_get("rearview.format", value, "YUYV");
+    mFourcc = parseFourcc(value);
+    mBufferNum = (uint32_t)hal_config_get_int("rearview.buffers", 4);
+    if (mBufferNum < 2 || mBufferNum > REARVIEW_MAX_BUFFERS) {
+        mBufferNum = 4;
+    }
+    mTimeout = (int32_t)hal_config_get_int("rearview.timeout",
+                                            REARVIEW_SENSOR_TIMEOUT);
+    if (convertFourccToDrm(mFourcc) == 0) {
+        ALOGE("%s format %s can't be scanned out", __func__, value);
+        return false;
+    }
+
+    mStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    // socket is created by init, clients queue until loop runs.
+    mListenFd = android_get_control_socket(REARVIEW_SOCKET);
+    if (mListenFd < 0 || listen(mListenFd, REARVIEW_MAX_CLIENTS) != 0) {
+        ALOGW("%s no control socket, display can't take over", __func__);
+        mListenFd = -1;
+    }
+
+    if (!openDisplay() || !openSensor() || !importBuffers()) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < mBufferNum; i++) {
+        struct v4l2_buffer buf;
+        struct v4l2_plane plane;
+        memset(&buf, 0, sizeof(buf));
+        memset(&plane, 0, sizeof(plane));
+        buf.type = mPlane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                          : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (mPlane) {
+            buf.m.planes = &plane;
+            buf.length = 1;
+        }
+        if (ioctl(mV4l2Fd, VIDIOC_QBUF, &buf) < 0) {
+            ALOGE("%s VIDIOC_QBUF %d failed: %s", __func__, i, strerror(errno));
+            return false;
+        }
+    }
+
+    int type = mPlane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                      : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(mV4l2Fd, VIDIOC_STREAMON, &type) < 0) {
+        ALOGE("%s VIDIOC_STREAMON failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    ALOGI("%s %s %dx%d on plane %d crtc %d", __func__, mDevice, mWidth,
+          mHeight, mPlaneId, mCrtcId);
+    return true;
+}
+
+bool RearView::openSensor()
+{
+    mV4l2Fd = open(mDevice, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (mV4l2Fd < 0) {
+        ALOGE("%s open %s failed: %s", __func__, mDevice, strerror(errno));
+        return false;
+    }
+
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (ioctl(mV4l2Fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        ALOGE("%s VIDIOC_QUERYCAP failed: %s", __func__, strerror(errno));
+        return false;
+    }
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+                    cap.device_caps : cap.capabilities;
+    mPlane = (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) != 0;
+
+    // analog decoder, e.g. TVIN, picks its input first.
+    if (mInput >= 0 && ioctl(mV4l2Fd, VIDIOC_S_INPUT, &mInput) < 0) {
+        ALOGW("%s VIDIOC_S_INPUT %d failed: %s", __func__, mInput,
+              strerror(errno));
+    }
+
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    if (mPlane) {
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        fmt.fmt.pix_mp.width = mWidth;
+        fmt.fmt.pix_mp.height = mHeight;
+        fmt.fmt.pix_mp.pixelformat = mFourcc;
+        fmt.fmt.pix_mp.num_planes = 1;
+    }
+    else {
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = mWidth;
+        fmt.fmt.pix.height = mHeight;
+        fmt.fmt.pix.pixelformat = mFourcc;
+    }
+    if (ioctl(mV4l2Fd, VIDIOC_S_FMT, &fmt) < 0) {
+        ALOGE("%s VIDIOC_S_FMT failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    // driver may round size, buffers are scanned out as it filled them.
+    if (mPlane) {
+        mWidth = fmt.fmt.pix_mp.width;
+        mHeight = fmt.fmt.pix_mp.height;
+        mStride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+        if (fmt.fmt.pix_mp.pixelformat != mFourcc ||
+                fmt.fmt.pix_mp.num_planes != 1) {
+            ALOGE("%s format of one plane is not taken", __func__);
+            return false;
+        }
+    }
+    else {
+        mWidth = fmt.fmt.pix.width;
+        mHeight = fmt.fmt.pix.height;
+        mStride = fmt.fmt.pix.bytesperline;
+        if (fmt.fmt.pix.pixelformat != mFourcc) {
+            ALOGE("%s format is not taken", __func__);
+            return false;
+        }
+    }
+    if (mStride == 0) {
+        mStride = (mFourcc == V4L2_PIX_FMT_NV12) ? mWidth : mWidth * 2;
+    }
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.type = fmt.type;
+    req.memory = V4L2_MEMORY_MMAP;
+    req.count = mBufferNum;
+    if (ioctl(mV4l2Fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+        ALOGE("%s VIDIOC_REQBUFS failed: %s", __func__, strerror(errno));
+        return false;
+    }
+    mBufferNum = req.count < REARVIEW_MAX_BUFFERS ? req.count
+                                                   : REARVIEW_MAX_BUFFERS;
+
+    return true;
+}
+
+void RearView::closeSensor()
+{
+    if (mV4l2Fd < 0) {
+        return;
+    }
+
+    int type = mPlane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                      : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(mV4l2Fd, VIDIOC_STREAMOFF, &type);
+    // exported buffers live on in framebuffers of drm.
+    close(mV4l2Fd);
+    mV4l2Fd = -1;
+}
+
+uint32_t RearView::getPropertyId(uint32_t objectId, uint32_t objectType,
+                                 const char* name)
+{
+    drmModeObjectPropertiesPtr props =
+            drmModeObjectGetProperties(mDrmFd, objectId, objectType);
+    if (props == NULL) {
+        return 0;
+    }
+
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < props->count_props && id == 0; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(mDrmFd, props->props[i]);
+        if (prop == NULL) {
+            continue;
+        }
+        if (!strcmp(prop->name, name)) {
+            id = prop->prop_id;
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+
+    return id;
+}
+
+static uint64_t getPropertyValue(int fd, uint32_t objectId,
+                                 uint32_t objectType, const char* name)
+{
+    drmModeObjectPropertiesPtr props =
+            drmModeObjectGetProperties(fd, objectId, objectType);
+    if (props == NULL) {
+        return 0;
+    }
+
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+        if (prop == NULL) {
+            continue;
+        }
+        if (!strcmp(prop->name, name)) {
+            value = props->prop_values[i];
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+
+    return value;
+}
+
+bool RearView::openDisplay()
+{
+    mDrmFd = open(mDrmDevice, O_RDWR | O_CLOEXEC);
+    if (mDrmFd < 0) {
+        ALOGE("%s open %s failed: %s", __func__, mDrmDevice, strerror(errno));
+        return false;
+    }
+
+    if (drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 ||
+            drmSetClientCap(mDrmFd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+        ALOGE("%s atomic modesetting is not supported", __func__);
+        return false;
+    }
+
+    drmModeResPtr res = drmModeGetResources(mDrmFd);
+    if (res == NULL) {
+        ALOGE("%s no drm resources", __func__);
+        return false;
+    }
+
+    // first connected connector, as primary display of hwcomposer.
+    int32_t crtcIndex = -1;
+    for (int i = 0; i < res->count_connectors && crtcIndex < 0; i++) {
+        drmModeConnectorPtr conn = drmModeGetConnector(mDrmFd,
+                                                       res->connectors[i]);
+        if (conn == NULL) {
+            continue;
+        }
+        if (conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0) {
+            drmModeFreeConnector(conn);
+            continue;
+        }
+
+        for (int e = 0; e < conn->count_encoders && crtcIndex < 0; e++) {
+            drmModeEncoderPtr enc = drmModeGetEncoder(mDrmFd,
+                                                      conn->encoders[e]);
+            if (enc == NULL) {
+                continue;
+            }
+            for (int c = 0; c < res->count_crtcs; c++) {
+                bool bound = enc->crtc_id == res->crtcs[c];
+                if (bound || (crtcIndex < 0 &&
+                              (enc->possible_crtcs & (1 << c)))) {
+                    crtcIndex = c;
+                }
+                if (bound) {
+                    break;
+                }
+            }
+            drmModeFreeEncoder(enc);
+        }
+
+        if (crtcIndex >= 0) {
+            mConnectorId = conn->connector_id;
+            mCrtcId = res->crtcs[crtcIndex];
+            // bootloader splash keeps its mode, screen isn't blanked.
+            drmModeCrtcPtr crtc = drmModeGetCrtc(mDrmFd, mCrtcId);
+            if (crtc != NULL && crtc->mode_valid) {
+                mMode = crtc->mode;
+            }
+            else {
+                mMode = conn->modes[0];
+                for (int m = 0; m < conn->count_modes; m++) {
+                    if (conn->modes[m].type & DRM_MODE_TYPE_PREFERRED) {
+                        mMode = conn->modes[m];
+                        break;
+                    }
+                }
+                mModeset = true;
+            }
+            if (crtc != NULL) {
+                drmModeFreeCrtc(crtc);
+            }
+        }
+        drmModeFreeConnector(conn);
+    }
+    drmModeFreeResources(res);
+
+    if (crtcIndex < 0) {
+        ALOGE("%s no connected display", __func__);
+        return false;
+    }
+
+    drmModePlaneResPtr planes = drmModeGetPlaneResources(mDrmFd);
+    if (planes == NULL) {
+        ALOGE("%s no planes", __func__);
+        return false;
+    }
+    bool found = findPlane(planes, 1 << crtcIndex);
+    drmModeFreePlaneResources(planes);
+
+    mPlaneFb = getPropertyId(mPlaneId, DRM_MODE_OBJECT_PLANE, "FB_ID");
+    return found && mPlaneFb != 0;
+}
+
+bool RearView::findPlane(drmModePlaneResPtr planes, uint32_t crtcBit)
+{
+    uint32_t format = convertFourccToDrm(mFourcc);
+    uint32_t primary = 0, primaryCamera = 0, overlay = 0;
+
+    for (uint32_t i = 0; i < planes->count_planes; i++) {
+        drmModePlanePtr plane = drmModeGetPlane(mDrmFd, planes->planes[i]);
+        if (plane == NULL) {
+            continue;
+        }
+        if (!(plane->possible_crtcs & crtcBit)) {
+            drmModeFreePlane(plane);
+            continue;
+        }
+
+        uint64_t type = getPropertyValue(mDrmFd, plane->plane_id,
+                                         DRM_MODE_OBJECT_PLANE, "type");
+        bool supported = false;
+        for (uint32_t f = 0; f < plane->count_formats; f++) {
+            if (plane->formats[f] == format) {
+                supported = true;
+            }
+        }
+
+        if (type == DRM_PLANE_TYPE_PRIMARY && primary == 0) {
+            primary = plane->plane_id;
+            if (supported) {
+                primaryCamera = plane->plane_id;
+            }
+        }
+        else if (type == DRM_PLANE_TYPE_OVERLAY && supported && overlay == 0) {
+            overlay = plane->plane_id;
+        }
+        drmModeFreePlane(plane);
+    }
+
+    mPrimaryPlaneId = primary;
+    mPlaneId = overlay != 0 ? overlay : primaryCamera;
+    mPrimary = (overlay == 0);
+    if (mPlaneId == 0) {
+        ALOGE("%s no plane scans out sensor format", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+bool RearView::importBuffers()
+{
+    uint32_t format = convertFourccToDrm(mFourcc);
+    for (uint32_t i = 0; i < mBufferNum; i++) {
+        struct v4l2_exportbuffer exp;
+        memset(&exp, 0, sizeof(exp));
+        exp.type = mPlane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                          : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        exp.index = i;
+        exp.plane = 0;
+        exp.flags = O_CLOEXEC | O_RDWR;
+        if (ioctl(mV4l2Fd, VIDIOC_EXPBUF, &exp) < 0) {
+            ALOGE("%s VIDIOC_EXPBUF %d failed: %s", __func__, i,
+                  strerror(errno));
+            return false;
+        }
+
+        int ret = drmPrimeFDToHandle(mDrmFd, exp.fd, &mHandles[i]);
+        // gem object holds buffer, dma-buf fd isn't needed any more.
+        close(exp.fd);
+        if (ret != 0) {
+            ALOGE("%s import buffer %d failed: %d", __func__, i, ret);
+            return false;
+        }
+
+        uint32_t handles[4] = {mHandles[i], 0, 0, 0};
+        uint32_t pitches[4] = {mStride, 0, 0, 0};
+        uint32_t offsets[4] = {0, 0, 0, 0};
+        if (format == DRM_FORMAT_NV12) {
+            handles[1] = mHandles[i];
+            pitches[1] = mStride;
+            offsets[1] = mStride * mHeight;
+        }
+        if (drmModeAddFB2(mDrmFd, mWidth, mHeight, format, handles, pitches,
+                          offsets, &mFbs[i], 0) != 0) {
+            ALOGE("%s add framebuffer %d failed: %s", __func__, i,
+                  strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RearView::createBlankFb()
+{
+    struct drm_mode_create_dumb create;
+    memset(&create, 0, sizeof(create));
+    create.width = mMode.hdisplay;
+    create.height = mMode.vdisplay;
+    create.bpp = 32;
+    if (drmIoctl(mDrmFd, DRM_IOCTL_MODE_CREATE_DUMB, &create) != 0) {
+        ALOGE("%s create dumb buffer failed: %s", __func__, strerror(errno));
+        return false;
+    }
+    mBlankHandle = create.handle;
+
+    struct drm_mode_map_dumb map;
+    memset(&map, 0, sizeof(map));
+    map.handle = create.handle;
+    if (drmIoctl(mDrmFd, DRM_IOCTL_MODE_MAP_DUMB, &map) == 0) {
+        void* vaddr = mmap(NULL, create.size, PROT_WRITE, MAP_SHARED, mDrmFd,
+                           map.offset);
+        if (vaddr != MAP_FAILED) {
+            memset(vaddr, 0, create.size);
+            munmap(vaddr, create.size);
+        }
+    }
+
+    uint32_t handles[4] = {create.handle, 0, 0, 0};
+    uint32_t pitches[4] = {create.pitch, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    if (drmModeAddFB2(mDrmFd, create.width, create.height, DRM_FORMAT_XRGB8888,
+                      handles, pitches, offsets, &mBlankFb, 0) != 0) {
+        ALOGE("%s add blank framebuffer failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool RearView::addPlane(drmModeAtomicReqPtr req, uint32_t planeId,
+                        uint32_t fbId, uint32_t srcW, uint32_t srcH,
+                        int32_t x, int32_t y, uint32_t w, uint32_t h)
+{
+    static const char* sNames[] = {
+        "FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+        "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+    };
+    // source is in 16.16 fixed point.
+    uint64_t values[] = {
+        fbId, mCrtcId, 0, 0, (uint64_t)srcW << 16, (uint64_t)srcH << 16,
+        (uint64_t)x, (uint64_t)y, w, h,
+    };
+
+    for (uint32_t i = 0; i < sizeof(sNames) / sizeof(sNames[0]); i++) {
+        uint32_t id = getPropertyId(planeId, DRM_MODE_OBJECT_PLANE, sNames[i]);
+        if (id == 0 || drmModeAtomicAddProperty(req, planeId, id,
+                                                values[i]) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RearView::setupScreen(int32_t index)
+{
+    uint32_t modeBlob = 0;
+    if (mModeset && drmModeCreatePropertyBlob(mDrmFd, &mMode, sizeof(mMode),
+                                              &modeBlob) != 0) {
+        ALOGE("%s create mode blob failed", __func__);
+        return false;
+    }
+
+    // scaled to fill screen, plane without scaler shows frame centered.
+    uint32_t screenW = mMode.hdisplay, screenH = mMode.vdisplay;
+    bool blank = false;
+    bool done = false;
+    for (int attempt = 0; attempt < 4 && !done; attempt++) {
+        bool scaled = (attempt & 1) == 0;
+        blank = attempt >= 2;
+        if (blank && (mPrimary || mPrimaryPlaneId == 0 ||
+                      (mBlankFb == 0 && !createBlankFb()))) {
+            break;
+        }
+
+        uint32_t w = screenW, h = screenH;
+        if (!scaled) {
+            w = mWidth < screenW ? mWidth : screenW;
+            h = mHeight < screenH ? mHeight : screenH;
+        }
+        mX = (screenW - w) / 2;
+        mY = (screenH - h) / 2;
+        mW = w;
+        mH = h;
+
+        drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+        if (req == NULL) {
+            break;
+        }
+        bool ok = true;
+        uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY;
+        if (mModeset) {
+            flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+            uint32_t connCrtc = getPropertyId(mConnectorId,
+                    DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+            uint32_t mode = getPropertyId(mCrtcId, DRM_MODE_OBJECT_CRTC,
+                                          "MODE_ID");
+            uint32_t active = getPropertyId(mCrtcId, DRM_MODE_OBJECT_CRTC,
+                                            "ACTIVE");
+            ok = connCrtc != 0 && mode != 0 && active != 0 &&
+                 drmModeAtomicAddProperty(req, mConnectorId, connCrtc,
+                                          mCrtcId) >= 0 &&
+                 drmModeAtomicAddProperty(req, mCrtcId, mode, modeBlob) >= 0 &&
+                 drmModeAtomicAddProperty(req, mCrtcId, active, 1) >= 0;
+        }
+        if (ok && blank) {
+            ok = addPlane(req, mPrimaryPlaneId, mBlankFb, screenW, screenH,
+                          0, 0, screenW, screenH);
+        }
+        // crop frame larger than screen.
+        ok = ok && addPlane(req, mPlaneId, mFbs[index],
+                            scaled ? mWidth : w, scaled ? mHeight : h,
+                            mX, mY, w, h);
+        if (ok && drmModeAtomicCommit(mDrmFd, req, flags, NULL) == 0) {
+            flags &= ~DRM_MODE_ATOMIC_TEST_ONLY;
+            done = drmModeAtomicCommit(mDrmFd, req, flags, NULL) == 0;
+        }
+        drmModeAtomicFree(req);
+    }
+
+    if (modeBlob != 0) {
+        drmModeDestroyPropertyBlob(mDrmFd, modeBlob);
+    }
+    if (!done) {
+        ALOGE("%s no plane setup is accepted", __func__);
+        return false;
+    }
+
+    ALOGI("%s frame at %d,%d %dx%d%s", __func__, mX, mY, mW, mH,
+          blank ? " over blank primary" : "");
+    mScreenSet = true;
+    return true;
+}
+
+bool RearView::showFrame(int32_t index)
+{
+    if (!mScreenSet) {
+        // first frame goes out with plane setup, rear view gives up
+        // when display rejects every setup.
+        if (!setupScreen(index)) {
+            mDone = true;
+            return false;
+        }
+        return true;
+    }
+
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    if (req == NULL) {
+        return false;
+    }
+
+    bool ok = drmModeAtomicAddProperty(req, mPlaneId, mPlaneFb,
+                                       mFbs[index]) >= 0 &&
+              drmModeAtomicCommit(mDrmFd, req, 0, NULL) == 0;
+    drmModeAtomicFree(req);
+    if (!ok) {
+        ALOGW("%s commit frame %d failed: %s", __func__, index,
+              strerror(errno));
+    }
+
+    return ok;
+}
+
+void RearView::captureFrame()
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    buf.type = mPlane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                      : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (mPlane) {
+        buf.m.planes = &plane;
+        buf.length = 1;
+    }
+    if (ioctl(mV4l2Fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno != EAGAIN) {
+            ALOGW("%s VIDIOC_DQBUF failed: %s", __func__, strerror(errno));
+        }
+        return;
+    }
+    if (buf.index >= mBufferNum) {
+        return;
+    }
+
+    if (mShown < 0 && !mScreenSet) {
+        ALOGI("%s first frame %" PRId64 " ms after start", __func__,
+              (int64_t)ns2ms(systemTime(SYSTEM_TIME_MONOTONIC) - mStartTime));
+    }
+
+    // frame on screen until now is free once flip is done.
+    int32_t requeue = buf.index;
+    if (showFrame(buf.index)) {
+        requeue = mShown;
+        mShown = buf.index;
+    }
+    if (requeue < 0) {
+        return;
+    }
+
+    buf.index = requeue;
+    if (ioctl(mV4l2Fd, VIDIOC_QBUF, &buf) < 0) {
+        ALOGW("%s VIDIOC_QBUF failed: %s", __func__, strerror(errno));
+    }
+}
+
+void RearView::acceptClient()
+{
+    int fd = accept4(mListenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < REARVIEW_MAX_CLIENTS; i++) {
+        if (mClients[i] < 0) {
+            mClients[i] = fd;
+            return;
+        }
+    }
+
+    ALOGW("%s too many clients", __func__);
+    close(fd);
+}
+
+void RearView::closeClient(int32_t slot)
+{
+    if (mClients[slot] < 0) {
+        return;
+    }
+
+    close(mClients[slot]);
+    mClients[slot] = -1;
+    if (mDisplayClient == slot) {
+        // display exited before it took over, next one asks again.
+        mDisplayClient = -1;
+    }
+}
+
+bool RearView::checkPeer(int32_t sock)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        ALOGW("%s SO_PEERCRED failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    if (cred.uid == AID_ROOT || cred.uid == AID_SYSTEM ||
+        cred.uid == AID_CAMERASERVER || cred.gid == AID_GRAPHICS) {
+        return true;
+    }
+
+    ALOGW("%s pid %d uid %d refused", __func__, cred.pid, cred.uid);
+    return false;
+}
+
+void RearView::handleClient(int32_t slot)
+{
+    struct rearview_msg msg;
+    int sock = mClients[slot];
+    int type = rearview_recv(sock, &msg, NULL, MSG_DONTWAIT);
+    if (type == -EAGAIN) {
+        return;
+    }
+
+    if ((type == REARVIEW_MSG_DRM || type == REARVIEW_MSG_RELEASE) &&
+        !checkPeer(sock)) {
+        closeClient(slot);
+        return;
+    }
+
+    switch (type) {
+        case REARVIEW_MSG_DRM:
+            // open file moves with fd, so display is drm master too.
+            if (rearview_send(sock, REARVIEW_MSG_DRM, NULL, mDrmFd) != 0) {
+                closeClient(slot);
+                return;
+            }
+            mDisplayClient = slot;
+            ALOGI("%s display took drm fd", __func__);
+            if (mReleased) {
+                rearview_send(sock, REARVIEW_MSG_RELEASED, NULL, -1);
+            }
+            break;
+
+        case REARVIEW_MSG_RELEASE:
+            // other sensor of camera HAL doesn't disturb rear view.
+            if (msg.device[0] == '\0' || !strcmp(msg.device, mDevice)) {
+                releaseSensor();
+            }
+            rearview_send(sock, REARVIEW_MSG_RELEASED, NULL, -1);
+            break;
+
+        case REARVIEW_MSG_DONE:
+            ALOGI("%s display took over screen", __func__);
+            mDone = true;
+            break;
+
+        default:
+            closeClient(slot);
+            break;
+    }
+}
+
+void RearView::releaseSensor()
+{
+    if (mReleased) {
+        return;
+    }
+
+    closeSensor();
+    mReleased = true;
+    mReleaseTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    ALOGI("%s after %" PRId64 " ms", __func__,
+          (int64_t)ns2ms(mReleaseTime - mStartTime));
+    if (mDisplayClient >= 0) {
+        rearview_send(mClients[mDisplayClient], REARVIEW_MSG_RELEASED,
+                      NULL, -1);
+    }
+}
+
+void RearView::closeDisplay()
+{
+    if (mDrmFd < 0) {
+        return;
+    }
+
+    // display disabled camera plane with its first commit, removing
+    // framebuffers still on screen disables their plane otherwise.
+    for (uint32_t i = 0; i < REARVIEW_MAX_BUFFERS; i++) {
+        if (mFbs[i] != 0) {
+            drmModeRmFB(mDrmFd, mFbs[i]);
+        }
+        if (mHandles[i] != 0) {
+            struct drm_gem_close req;
+            memset(&req, 0, sizeof(req));
+            req.handle = mHandles[i];
+            drmIoctl(mDrmFd, DRM_IOCTL_GEM_CLOSE, &req);
+        }
+    }
+    if (mBlankFb != 0) {
+        drmModeRmFB(mDrmFd, mBlankFb);
+    }
+    if (mBlankHandle != 0) {
+        struct drm_mode_destroy_dumb req;
+        memset(&req, 0, sizeof(req));
+        req.handle = mBlankHandle;
+        drmIoctl(mDrmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &req);
+    }
+
+    close(mDrmFd);
+    mDrmFd = -1;
+}
+
+int RearView::run()
+{
+    while (!mDone) {
+        struct pollfd fds[REARVIEW_MAX_CLIENTS + 2];
+        int32_t slots[REARVIEW_MAX_CLIENTS + 2];
+        nfds_t num = 0;
+        if (mV4l2Fd >= 0) {
+            fds[num].fd = mV4l2Fd;
+            fds[num].events = POLLIN;
+            slots[num++] = -1;
+        }
+        if (mListenFd >= 0) {
+            fds[num].fd = mListenFd;
+            fds[num].events = POLLIN;
+            slots[num++] = -2;
+        }
+        for (int32_t i = 0; i < REARVIEW_MAX_CLIENTS; i++) {
+            if (mClients[i] >= 0) {
+                fds[num].fd = mClients[i];
+                fds[num].events = POLLIN;
+                slots[num++] = i;
+            }
+        }
+
+        // product may cap rear view after boot, display waits otherwise.
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        int32_t timeout = -1;
+        if (mReleased) {
+            timeout = REARVIEW_DONE_TIMEOUT -
+                      (int32_t)ns2ms(now - mReleaseTime);
+            if (timeout <= 0) {
+                ALOGW("%s no display took over", __func__);
+                break;
+            }
+        }
+        else if (mTimeout > 0) {
+            timeout = mTimeout - (int32_t)ns2ms(now - mStartTime);
+            if (timeout <= 0) {
+                releaseSensor();
+                continue;
+            }
+        }
+
+        int ret = poll(fds, num, timeout);
+        if (ret < 0 && errno != EINTR) {
+            ALOGE("%s poll failed: %s", __func__, strerror(errno));
+            return 1;
+        }
+
+        for (nfds_t i = 0; ret > 0 && i < num; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            if (slots[i] == -1) {
+                if (mV4l2Fd >= 0) {
+                    captureFrame();
+                }
+            }
+            else if (slots[i] == -2) {
+                acceptClient();
+            }
+            else if (fds[i].revents & (POLLHUP | POLLERR)) {
+                closeClient(slots[i]);
+            }
+            else {
+                handleClient(slots[i]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main()
+{
+    RearView view;
+    if (!view.init()) {
+        // camera HAL and display start as without rear view.
+        return 1;
+    }
+
+    return view.run();
+}
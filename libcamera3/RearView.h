@@ -0,0 +1,134 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _REAR_VIEW_H
+#define _REAR_VIEW_H
+
+#include <stdint.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// V4L2 buffers which are scanned out directly.
+#define REARVIEW_MAX_BUFFERS 8
+// hwcomposer and camera HAL connect at most at the same time.
+#define REARVIEW_MAX_CLIENTS 4
+// rear view exits when no display takes over after sensor release.
+#define REARVIEW_DONE_TIMEOUT 10000
+// ms sensor is given up on its own when camera HAL never asks, so
+// display doesn't hold its frames for rear view forever.
+#define REARVIEW_SENSOR_TIMEOUT 10000
+
+// early rear view camera, see rearview_ext.h for handover. it only
+// needs V4L2 and KMS, so frames show before camera HAL enumerates
+// sensors or hwcomposer probes displays.
+class RearView
+{
+public:
+    RearView();
+    ~RearView();
+
+    // read config, start sensor and set up plane, false if rear view
+    // can't run.
+    bool init();
+    // show frames until display takes over, return exit code.
+    int run();
+
+private:
+    bool openSensor();
+    void closeSensor();
+    bool openDisplay();
+    void closeDisplay();
+    // overlay plane of crtc which scans out sensor format, primary if
+    // there is no such overlay plane.
+    bool findPlane(drmModePlaneResPtr planes, uint32_t crtcBit);
+    bool importBuffers();
+    // black primary plane for modeset when camera is on an overlay.
+    bool createBlankFb();
+    uint32_t getPropertyId(uint32_t objectId, uint32_t objectType,
+                           const char* name);
+    // bind crtc, connector and plane with first frame, scaled to screen
+    // if plane can.
+    bool setupScreen(int32_t index);
+    bool addPlane(drmModeAtomicReqPtr req, uint32_t planeId, uint32_t fbId,
+                  uint32_t srcW, uint32_t srcH, int32_t x, int32_t y,
+                  uint32_t w, uint32_t h);
+    // blocking commit, buffer of last frame is free when it returns.
+    bool showFrame(int32_t index);
+    void captureFrame();
+
+    void acceptClient();
+    void handleClient(int32_t slot);
+    void closeClient(int32_t slot);
+    // only camera HAL and hwcomposer may take drm fd or sensor.
+    bool checkPeer(int32_t sock);
+    // stop sensor and tell clients, last frame stays on screen.
+    void releaseSensor();
+
+private:
+    // config, see imx_rearview.rc.
+    char mDevice[PROPERTY_VALUE_MAX];
+    char mDrmDevice[PROPERTY_VALUE_MAX];
+    int32_t mInput;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mFourcc;
+    uint32_t mBufferNum;
+    int32_t mTimeout;
+
+    // sensor.
+    int32_t mV4l2Fd;
+    bool mPlane;
+    uint32_t mStride;
+    int32_t mShown;
+    bool mReleased;
+    nsecs_t mStartTime;
+    nsecs_t mReleaseTime;
+
+    // display.
+    int32_t mDrmFd;
+    uint32_t mConnectorId;
+    uint32_t mCrtcId;
+    uint32_t mPlaneId;
+    // camera plane is primary plane of crtc.
+    bool mPrimary;
+    drmModeModeInfo mMode;
+    // crtc is off or lit by other mode, first commit sets mode.
+    bool mModeset;
+    uint32_t mHandles[REARVIEW_MAX_BUFFERS];
+    uint32_t mFbs[REARVIEW_MAX_BUFFERS];
+    // screen rect of frames.
+    int32_t mX, mY;
+    uint32_t mW, mH;
+    bool mScreenSet;
+    // blank primary plane.
+    uint32_t mPrimaryPlaneId;
+    uint32_t mBlankHandle;
+    uint32_t mBlankFb;
+
+    // FB_ID of camera plane, the only property changed per frame.
+    uint32_t mPlaneFb;
+
+    // control socket of init and connected clients.
+    int32_t mListenFd;
+    int32_t mClients[REARVIEW_MAX_CLIENTS];
+    // client which took drm fd, -1 if none.
+    int32_t mDisplayClient;
+    bool mDone;
+};
+
+#endif
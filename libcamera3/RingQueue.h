@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RING_QUEUE_H_
+#define _RING_QUEUE_H_
+
+#include <stdint.h>
+#include <atomic>
+
+// bounded queue of one producer and one consumer thread, no lock and
+// no allocation. N must be power of 2.
+template <typename T, uint32_t N>
+class RingQueue
+{
+    static_assert((N & (N - 1)) == 0, "RingQueue size must be power of 2");
+
+public:
+    RingQueue() : mHead(0), mTail(0) {}
+
+    // producer side, false if queue is full.
+    bool push(const T& item)
+    {
+        uint32_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+
+        mItems[tail & (N - 1)] = item;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false if queue is empty.
+    bool pop(T& item)
+    {
+        uint32_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = mItems[head & (N - 1)];
+        // slot must not keep reference of item.
+        mItems[head & (N - 1)] = T();
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side.
+    void clear()
+    {
+        T item;
+        while (pop(item)) {
+        }
+    }
+
+    bool empty() const
+    {
+        return mHead.load(std::memory_order_acquire) ==
+               mTail.load(std::memory_order_acquire);
+    }
+
+private:
+    T mItems[N];
+    std::atomic<uint32_t> mHead;
+    std::atomic<uint32_t> mTail;
+};
+
+#endif
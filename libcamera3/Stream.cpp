@@ -15,16 +15,19 @@
  * limitations under the License.
  */
 
+#define ATRACE_TAG (ATRACE_TAG_CAMERA | ATRACE_TAG_HAL)
 #include <stdio.h>
 #include <hardware/camera3.h>
 #include <hardware/gralloc.h>
 #include <system/graphics.h>
 #include <graphics_ext.h>
+#include <hal_config_ext.h>
 #include <utils/Mutex.h>
 #include <utils/StrongPointer.h>
 #include <binder/MemoryBase.h>
 #include <binder/MemoryHeapBase.h>
 #include <sync/sync.h>
+#include <utils/Trace.h>
 
 //#define LOG_NDEBUG 0
 
@@ -36,6 +39,14 @@ extern "C" {
 #include "Camera.h"
 #include "Stream.h"
 #include "CameraUtils.h"
+#include "ColorConvert.h"
+
+#ifdef PLATFORM_VERSION_4
+// seems th encoder use VUVU planner
+#define YUYV_CHROMA_VU true
+#else
+#define YUYV_CHROMA_VU false
+#endif
 
 static void YUYVCopyByLine(uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, uint8_t *src, uint32_t srcWidth, uint32_t srcHeight)
 {
@@ -69,68 +80,12 @@ static void YUYVCopyByLine(uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight,
     return;
 }
 
-static void convertYUYVtoNV12SP(uint8_t *inputBuffer, uint8_t *outputBuffer, int width, int height)
-{
-#define u32 unsigned int
-#define u8 unsigned char
-
-    u32 h, w;
-    u32 nHeight = height;
-    u32 nWidthDiv4 = width / 4;
-
-    u8 *pYSrcOffset = inputBuffer;
-    u8 *pUSrcOffset = inputBuffer + 1;
-    u8 *pVSrcOffset = inputBuffer + 3;
-
-    u32 *pYDstOffset = (u32 *)outputBuffer;
-    u32 *pUVDstOffset = (u32 *)(((u8 *)(outputBuffer)) + width * height);
-
-    for (h = 0; h < nHeight; h++) {
-        if (!(h & 0x1)) {
-            for (w = 0; w < nWidthDiv4; w++) {
-                *pYDstOffset = (((u32)(*(pYSrcOffset + 0))) << 0) +
-                               (((u32)(*(pYSrcOffset + 2))) << 8) +
-                               (((u32)(*(pYSrcOffset + 4))) << 16) +
-                               (((u32)(*(pYSrcOffset + 6))) << 24);
-                pYSrcOffset += 8;
-                pYDstOffset += 1;
-
-#ifdef PLATFORM_VERSION_4
-                // seems th encoder use VUVU planner
-                *pUVDstOffset = (((u32)(*(pVSrcOffset + 0))) << 0) +
-                                (((u32)(*(pUSrcOffset + 0))) << 8) +
-                                (((u32)(*(pVSrcOffset + 4))) << 16) +
-                                (((u32)(*(pUSrcOffset + 4))) << 24);
-#else
-                *pUVDstOffset = (((u32)(*(pUSrcOffset + 0))) << 0) +
-                                (((u32)(*(pVSrcOffset + 0))) << 8) +
-                                (((u32)(*(pUSrcOffset + 4))) << 16) +
-                                (((u32)(*(pVSrcOffset + 4))) << 24);
-#endif
-                pUSrcOffset += 8;
-                pVSrcOffset += 8;
-                pUVDstOffset += 1;
-            }
-        } else {
-            pUSrcOffset += nWidthDiv4 * 8;
-            pVSrcOffset += nWidthDiv4 * 8;
-            for (w = 0; w < nWidthDiv4; w++) {
-                *pYDstOffset = (((u32)(*(pYSrcOffset + 0))) << 0) +
-                               (((u32)(*(pYSrcOffset + 2))) << 8) +
-                               (((u32)(*(pYSrcOffset + 4))) << 16) +
-                               (((u32)(*(pYSrcOffset + 6))) << 24);
-                pYSrcOffset += 8;
-                pYDstOffset += 1;
-            }
-        }
-    }
-}
-
 Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
   : mReuse(false),
     mPreview(false),
     mJpeg(false),
     mCallback(false),
+    mDirect(false),
     mId(id),
     mStream(s),
     mType(s->stream_type),
@@ -143,7 +98,14 @@ Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
     mRegistered(false),
     mCamera(camera)
 {
-    if (s->format == HAL_PIXEL_FORMAT_BLOB) {
+    if (s->stream_type == CAMERA3_STREAM_INPUT) {
+        ALOGI("%s create reprocess input stream", __func__);
+        // gralloc allocates flexible yuv as NV12, encoder reads it so.
+        mFormat = HAL_PIXEL_FORMAT_YCbCr_420_SP;
+        mUsage = GRALLOC_USAGE_HW_CAMERA_READ | GRALLOC_USAGE_SW_READ_RARELY;
+        mNumBuffers = NUM_CAPTURE_BUFFER;
+    }
+    else if (s->format == HAL_PIXEL_FORMAT_BLOB) {
         ALOGI("%s create capture stream", __func__);
         mJpeg = true;
         mFormat = s->format;
@@ -161,6 +123,22 @@ Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
             ALOGI("%s create video recording stream", __func__);
             mPreview = false;
         }
+        else {
+            mUsage = CAMERA_GRALLOC_USAGE_PREVIEW;
+        }
+        if (mCamera->isHighSpeed()) {
+            // each preview frame comes with a batch of video requests.
+            mNumBuffers = NUM_HIGH_SPEED_BUFFER;
+        }
+
+        // record buffers captured directly go to encoder without a copy,
+        // preview of same frame is converted from them.
+        if (hal_config_get_bool(mPreview ? DIRECT_PREVIEW_PROP
+                                         : DIRECT_RECORD_PROP, 0)) {
+            // extra buffers stay queued in V4L2.
+            mDirect = true;
+            mNumBuffers += NUM_DIRECT_BUFFER;
+        }
     }
     else {
         ALOGI("create callback stream", __func__);
@@ -198,6 +176,22 @@ Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
         mBuffers[i] = NULL;
     }
 
+    mPxpConf = NULL;
+    mPxpPending = false;
+    mPxpStart = 0;
+    mG2dPending = NULL;
+    mG2dStart = 0;
+    memset(&mPxpGeometry, 0, sizeof(mPxpGeometry));
+    memset(&mIpuJob, 0, sizeof(mIpuJob));
+    mIpuTaskValid = false;
+    mIpuPending = false;
+    memset(&mPlan, 0, sizeof(mPlan));
+    mPlanValid = false;
+    mIonFd = -1;
+    for (uint32_t i=0; i<JPEG_SCALE_NUM; i++) {
+        mScaleBuffers[i] = NULL;
+    }
+
     mJpegBuilder = new JpegBuilder();
 }
 
@@ -205,6 +199,7 @@ Stream::Stream(Camera* camera)
   : mReuse(false),
     mPreview(false),
     mJpeg(false),
+    mDirect(false),
     mId(-1),
     mStream(NULL),
     mType(-1),
@@ -233,11 +228,35 @@ Stream::Stream(Camera* camera)
     for (uint32_t i=0; i<MAX_STREAM_BUFFERS; i++) {
         mBuffers[i] = NULL;
     }
+
+    mPxpConf = NULL;
+    mPxpPending = false;
+    mPxpStart = 0;
+    mG2dPending = NULL;
+    mG2dStart = 0;
+    memset(&mPxpGeometry, 0, sizeof(mPxpGeometry));
+    memset(&mIpuJob, 0, sizeof(mIpuJob));
+    mIpuTaskValid = false;
+    mIpuPending = false;
+    memset(&mPlan, 0, sizeof(mPlan));
+    mPlanValid = false;
+    mIonFd = -1;
+    for (uint32_t i=0; i<JPEG_SCALE_NUM; i++) {
+        mScaleBuffers[i] = NULL;
+    }
 }
 
 Stream::~Stream()
 {
     android::Mutex::Autolock al(mLock);
+    // engine must not touch buffers or job after stream is gone. g2d
+    // handle is closed by process thread only after its frames are
+    // collected, so it is still open for a job left here.
+    if (isJobPending()) {
+        ALOGW("%s job still running, wait for it", __func__);
+        finishPendingJob();
+    }
+
     if (mIpuFd > 0) {
         close(mIpuFd);
         mIpuFd = -1;
@@ -247,6 +266,17 @@ Stream::~Stream()
         close(mPxpFd);
         mPxpFd = -1;
     }
+
+    if (mPxpConf != NULL) {
+        delete mPxpConf;
+        mPxpConf = NULL;
+    }
+
+    freeScaleBuffers();
+    if (mIonFd > 0) {
+        ion_close(mIonFd);
+        mIonFd = -1;
+    }
 }
 
 int32_t Stream::processJpegBuffer(StreamBuffer& src,
@@ -256,30 +286,33 @@ int32_t Stream::processJpegBuffer(StreamBuffer& src,
     int32_t encodeQuality = 100, thumbQuality = 100;
     int32_t thumbWidth, thumbHeight;
     JpegParams *mainJpeg = NULL, *thumbJpeg = NULL;
-    void *rawBuf = NULL, *thumbBuf = NULL;
+    void *thumbBuf = NULL;
     uint32_t v4l2Width = 0, v4l2Height = 0;
 
     StreamBuffer* dstBuf = mCurrent;
     sp<Stream>& srcStream = src.mStream;
 
-    ret = mCamera->getV4l2Res(srcStream->mWidth, srcStream->mHeight, &v4l2Width, &v4l2Height);
-    if (ret) {
-        ALOGE("%s getV4l2Res failed, ret %d", __func__, ret);
+    if (dstBuf == NULL || srcStream == NULL) {
+        ALOGE("%s invalid param", __FUNCTION__);
         return BAD_VALUE;
     }
 
-    ALOGI("%s srcStream->mWidth:%d, srcStream->mHeight:%d, v4l2Width:%d, v4l2Height:%d", __func__,
-        srcStream->mWidth,
-        srcStream->mHeight,
-        v4l2Width,
-        v4l2Height);
-    // just set to actual v4l2 res
-    srcStream->mWidth = v4l2Width;
-    srcStream->mHeight = v4l2Height;
+    // reprocess input has its own size, not sensor resolution.
+    if (!srcStream->isInputType()) {
+        ret = mCamera->getV4l2Res(srcStream->mWidth, srcStream->mHeight, &v4l2Width, &v4l2Height);
+        if (ret) {
+            ALOGE("%s getV4l2Res failed, ret %d", __func__, ret);
+            return BAD_VALUE;
+        }
 
-    if (dstBuf == NULL || srcStream == NULL) {
-        ALOGE("%s invalid param", __FUNCTION__);
-        return BAD_VALUE;
+        ALOGI("%s srcStream->mWidth:%d, srcStream->mHeight:%d, v4l2Width:%d, v4l2Height:%d", __func__,
+            srcStream->mWidth,
+            srcStream->mHeight,
+            v4l2Width,
+            v4l2Height);
+        // just set to actual v4l2 res
+        srcStream->mWidth = v4l2Width;
+        srcStream->mHeight = v4l2Height;
     }
 
     sp<Stream>& capture = dstBuf->mStream;
@@ -304,92 +337,111 @@ int32_t Stream::processJpegBuffer(StreamBuffer& src,
         thumbQuality = 100;
     }
 
-    int captureSize = 0;
-    int alignedw, alignedh, c_stride;
-    switch (srcStream->format()) {
-        case HAL_PIXEL_FORMAT_YCbCr_420_P:
-            alignedw = ALIGN_PIXEL_32(capture->mWidth);
-            alignedh = ALIGN_PIXEL_4(capture->mHeight);
-            c_stride = (alignedw/2+15)/16*16;
-            captureSize = alignedw * alignedh + c_stride * alignedh;
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 3 / 2;
-            break;
-
-        case HAL_PIXEL_FORMAT_YCbCr_422_I:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 2;
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 2;
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_444_888:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 3;
-            break;
-
-        default:
-            ALOGE("Error: %s format not supported", __FUNCTION__);
+    int captureSize = getJpegScratchSize(srcStream->format(),
+                                         capture->mWidth, capture->mHeight);
+    if (captureSize <= 0) {
+        ALOGE("Error: %s format not supported", __FUNCTION__);
+        return BAD_VALUE;
     }
 
-    sp<MemoryHeapBase> rawFrame(
-        new MemoryHeapBase(captureSize, 0, "rawFrame"));
-    rawBuf = rawFrame->getBase();
-    if (rawBuf == MAP_FAILED) {
-        ALOGE("%s new MemoryHeapBase failed", __FUNCTION__);
+    ret = meta->getJpegThumbSize(thumbWidth, thumbHeight);
+    if (ret != NO_ERROR) {
+        ALOGE("%s getJpegThumbSize failed", __FUNCTION__);
         return BAD_VALUE;
     }
 
-    sp<MemoryHeapBase> thumbFrame(
-        new MemoryHeapBase(captureSize, 0, "thumbFrame"));
-    thumbBuf = thumbFrame->getBase();
-    if (thumbBuf == MAP_FAILED) {
-        ALOGE("%s new MemoryHeapBase failed", __FUNCTION__);
-        return BAD_VALUE;
+    int thumbSize = getJpegScratchSize(srcStream->format(),
+                                       thumbWidth, thumbHeight);
+
+    // scratch buffers are allocated at configure, grow on mismatch.
+    if ((thumbWidth > 0) && (thumbHeight > 0) && (mThumbFrame == NULL ||
+            mThumbFrame->getSize() < (size_t)thumbSize)) {
+        mThumbFrame = new MemoryHeapBase(thumbSize, 0, "thumbFrame");
+    }
+    if (mThumbFrame != NULL) {
+        thumbBuf = mThumbFrame->getBase();
+        if (thumbBuf == MAP_FAILED) {
+            ALOGE("%s new MemoryHeapBase failed", __FUNCTION__);
+            mThumbFrame.clear();
+            return BAD_VALUE;
+        }
     }
 
-    mainJpeg = new JpegParams((uint8_t *)src.mVirtAddr,
-                              (uint8_t *)(uintptr_t)src.mPhyAddr,
-                              src.mSize,
-                              (uint8_t *)rawBuf,
-                              captureSize,
+    // scale in hardware so encoder gets the output size, and convert
+    // to a format VPU encodes, else libjpeg takes the picture.
+    StreamBuffer* mainSrc = &src;
+    uint32_t mainWidth = srcStream->mWidth;
+    uint32_t mainHeight = srcStream->mHeight;
+    int32_t mainFormat = YuvToJpegEncoder::getVpuFormat(srcStream->format());
+    if (mainFormat < 0) {
+        mainFormat = srcStream->format();
+    }
+    if ((mainWidth != capture->mWidth) || (mainHeight != capture->mHeight) ||
+            (mainFormat != srcStream->format())) {
+        StreamBuffer* scaled = scaleJpegSource(src, JPEG_SCALE_MAIN,
+                                               capture->mWidth, capture->mHeight,
+                                               mainFormat);
+        if (scaled != NULL) {
+            mainSrc = scaled;
+            mainWidth = capture->mWidth;
+            mainHeight = capture->mHeight;
+        }
+        else {
+            mainFormat = srcStream->format();
+        }
+    }
+
+    // no dst, main picture is encoded straight into blob buffer.
+    mainJpeg = new JpegParams((uint8_t *)mainSrc->mVirtAddr,
+                              (uint8_t *)(uintptr_t)mainSrc->mPhyAddr,
+                              mainSrc->mSize,
+                              NULL,
+                              0,
                               encodeQuality,
-                              srcStream->mWidth,
-                              srcStream->mHeight,
+                              mainWidth,
+                              mainHeight,
                               capture->mWidth,
                               capture->mHeight,
-                              srcStream->format());
-
-    ret = meta->getJpegThumbSize(thumbWidth, thumbHeight);
-    if (ret != NO_ERROR) {
-        ALOGE("%s getJpegThumbSize failed", __FUNCTION__);
-        goto err_out;
-    }
+                              mainFormat);
 
     if ((thumbWidth > 0) && (thumbHeight > 0)) {
-        int thumbSize = captureSize;
-        thumbJpeg = new JpegParams((uint8_t *)src.mVirtAddr,
-                           (uint8_t *)(uintptr_t)src.mPhyAddr,
-                           src.mSize,
-                           (uint8_t *)thumbBuf,
-                           thumbSize,
-                           thumbQuality,
-                           srcStream->mWidth,
-                           srcStream->mHeight,
-                           thumbWidth,
-                           thumbHeight,
-                           srcStream->format());
+        StreamBuffer* thumbSrc = scaleJpegSource(src, JPEG_SCALE_THUMB,
+                                                 thumbWidth, thumbHeight,
+                                                 srcStream->format());
+        if (thumbSrc != NULL) {
+            // no physical address, thumbnail is encoded by libjpeg to
+            // keep VPU session on main picture size.
+            thumbJpeg = new JpegParams((uint8_t *)thumbSrc->mVirtAddr,
+                               NULL,
+                               thumbSrc->mSize,
+                               (uint8_t *)thumbBuf,
+                               thumbSize,
+                               thumbQuality,
+                               thumbWidth,
+                               thumbHeight,
+                               thumbWidth,
+                               thumbHeight,
+                               srcStream->format());
+        }
+        else {
+            thumbJpeg = new JpegParams((uint8_t *)src.mVirtAddr,
+                               (uint8_t *)(uintptr_t)src.mPhyAddr,
+                               src.mSize,
+                               (uint8_t *)thumbBuf,
+                               thumbSize,
+                               thumbQuality,
+                               srcStream->mWidth,
+                               srcStream->mHeight,
+                               thumbWidth,
+                               thumbHeight,
+                               srcStream->format());
+        }
     }
 
     mJpegBuilder->prepareImage(&src);
-    ret = mJpegBuilder->encodeImage(mainJpeg, thumbJpeg);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    ret = mJpegBuilder->encodeImage(mainJpeg, thumbJpeg, dstBuf);
+    mStats.onEngine(ENGINE_JPEG, systemTime(SYSTEM_TIME_MONOTONIC) - start);
     if (ret != NO_ERROR) {
         ALOGE("%s encodeImage failed", __FUNCTION__);
         goto err_out;
@@ -413,8 +465,237 @@ err_out:
     return ret;
 }
 
+int32_t Stream::getJpegScratchSize(int32_t format,
+                                   uint32_t width, uint32_t height)
+{
+    int alignedw, alignedh, c_stride;
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_P:
+            alignedw = ALIGN_PIXEL_32(width);
+            alignedh = ALIGN_PIXEL_4(height);
+            c_stride = (alignedw/2+15)/16*16;
+            return alignedw * alignedh + c_stride * alignedh;
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            return alignedw * alignedh * 3 / 2;
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            return alignedw * alignedh * 2;
+        case HAL_PIXEL_FORMAT_YCbCr_444_888:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            return alignedw * alignedh * 3;
+        default:
+            return 0;
+    }
+}
+
+int32_t Stream::prepareJpegBuffers(int32_t srcFormat)
+{
+    if (!mJpeg) {
+        return 0;
+    }
+
+    int32_t captureSize = getJpegScratchSize(srcFormat, mWidth, mHeight);
+    int32_t thumbSize = getJpegScratchSize(srcFormat,
+                            JPEG_THUMB_MAX_WIDTH, JPEG_THUMB_MAX_HEIGHT);
+    if (captureSize <= 0 || thumbSize <= 0) {
+        ALOGW("%s format 0x%x not supported", __func__, srcFormat);
+        return BAD_VALUE;
+    }
+
+    if (mThumbFrame == NULL || mThumbFrame->getSize() < (size_t)thumbSize) {
+        mThumbFrame = new MemoryHeapBase(thumbSize, 0, "thumbFrame");
+    }
+
+    // no hardware scaler, encoder resizes by itself.
+#ifndef TARGET_FSL_IMX_2D
+    if (mPxpFd <= 0) {
+        return 0;
+    }
+#endif
+    allocScaleBuffer(JPEG_SCALE_MAIN, captureSize);
+    allocScaleBuffer(JPEG_SCALE_THUMB, thumbSize);
+
+    return 0;
+}
+
+int32_t Stream::allocScaleBuffer(int32_t index, size_t size)
+{
+    StreamBuffer* buf = mScaleBuffers[index];
+    if (buf != NULL && buf->mSize >= size) {
+        return 0;
+    }
+
+    if (mIonFd <= 0) {
+        mIonFd = ion_open();
+        if (mIonFd <= 0) {
+            ALOGE("%s ion_open failed", __func__);
+            return BAD_VALUE;
+        }
+    }
+
+    unsigned char *ptr = NULL;
+    int32_t sharedFd = -1;
+    int32_t phyAddr;
+    ion_user_handle_t ionHandle = -1;
+    int32_t ionSize = (size + PAGE_SIZE) & (~(PAGE_SIZE - 1));
+
+    int32_t err = ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle);
+    if (err) {
+        ALOGE("%s ion_alloc failed", __func__);
+        return BAD_VALUE;
+    }
+
+    err = ion_map(mIonFd, ionHandle, ionSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, 0, &ptr, &sharedFd);
+    if (err) {
+        ALOGE("%s ion_map failed", __func__);
+        ion_free(mIonFd, ionHandle);
+        if (sharedFd > 0) {
+            close(sharedFd);
+        }
+        return BAD_VALUE;
+    }
+
+    phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
+    if (phyAddr == 0) {
+        ALOGE("%s ion_phys failed", __func__);
+        munmap(ptr, ionSize);
+        close(sharedFd);
+        ion_free(mIonFd, ionHandle);
+        return BAD_VALUE;
+    }
+
+    if (buf == NULL) {
+        buf = new StreamBuffer();
+        mScaleBuffers[index] = buf;
+    }
+    else {
+        munmap(buf->mVirtAddr, buf->mSize);
+        close(buf->mFd);
+        ion_free(mIonFd, (ion_user_handle_t)(uintptr_t)buf->mBufHandle);
+    }
+
+    buf->mVirtAddr = ptr;
+    buf->mPhyAddr = phyAddr;
+    buf->mSize = ionSize;
+    buf->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
+    buf->mFd = sharedFd;
+
+    return 0;
+}
+
+void Stream::freeScaleBuffers()
+{
+    for (uint32_t i = 0; i < JPEG_SCALE_NUM; i++) {
+        StreamBuffer* buf = mScaleBuffers[i];
+        if (buf == NULL) {
+            continue;
+        }
+
+        munmap(buf->mVirtAddr, buf->mSize);
+        close(buf->mFd);
+        ion_free(mIonFd, (ion_user_handle_t)(uintptr_t)buf->mBufHandle);
+        delete buf;
+        mScaleBuffers[i] = NULL;
+    }
+}
+
+#ifdef TARGET_FSL_IMX_2D
+static int32_t convertG2dFormat(int32_t format)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+            return G2D_NV12;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            return G2D_NV21;
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+            return G2D_NV16;
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            return G2D_YUYV;
+        default:
+            return -1;
+    }
+}
+
+// stride and planeHeight of 0 are width and height of frame.
+static void setG2dSurface(struct g2d_surface& surface, int32_t phyAddr,
+                          uint32_t width, uint32_t height, int32_t format,
+                          uint32_t stride = 0, uint32_t planeHeight = 0)
+{
+    stride = (stride > 0) ? stride : width;
+    planeHeight = (planeHeight > 0) ? planeHeight : height;
+    memset(&surface, 0, sizeof(surface));
+    surface.format = (enum g2d_format)format;
+    surface.planes[0] = phyAddr;
+    if (format != G2D_YUYV) {
+        surface.planes[1] = phyAddr + stride * planeHeight;
+    }
+    surface.left = 0;
+    surface.top = 0;
+    surface.right = width;
+    surface.bottom = height;
+    surface.stride = stride;
+    surface.width = stride;
+    surface.height = planeHeight;
+    surface.global_alpha = 255;
+    surface.rot = G2D_ROTATION_0;
+}
+#endif
+
+StreamBuffer* Stream::scaleJpegSource(StreamBuffer& src, int32_t index,
+                                      uint32_t width, uint32_t height,
+                                      int32_t dstFormat)
+{
+    sp<Stream>& device = src.mStream;
+    if (device == NULL || src.mPhyAddr == 0) {
+        return NULL;
+    }
+
+    int32_t format = device->format();
+    int32_t size = getJpegScratchSize(dstFormat, width, height);
+    if (size <= 0 || allocScaleBuffer(index, size) != 0) {
+        return NULL;
+    }
+
+    StreamBuffer* dst = mScaleBuffers[index];
+#ifdef TARGET_FSL_IMX_2D
+    // called in jpeg thread, use its own g2d handle.
+    void* g2dHandle = device->getJpegG2dHandle();
+    int32_t g2dFormat = convertG2dFormat(format);
+    int32_t g2dDstFormat = convertG2dFormat(dstFormat);
+    if (g2dHandle != NULL && g2dFormat >= 0 && g2dDstFormat >= 0) {
+        struct g2d_surface s_surface, d_surface;
+        setG2dSurface(s_surface, src.mPhyAddr, device->mWidth,
+                      device->mHeight, g2dFormat);
+        setG2dSurface(d_surface, dst->mPhyAddr, width, height, g2dDstFormat);
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (g2d_blit(g2dHandle, &s_surface, &d_surface) == 0 &&
+                g2d_finish(g2dHandle) == 0) {
+            mStats.onEngine(ENGINE_G2D, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+            return dst;
+        }
+        ALOGW("%s g2d_blit failed, try pxp", __func__);
+    }
+#endif
+
+    if (mPxpFd > 0 && blitWithPXP(src.mPhyAddr, device->mWidth,
+                device->mHeight, format, dst->mPhyAddr, width,
+                height, dstFormat, true) == 0) {
+        return dst;
+    }
+
+    return NULL;
+}
+
 int32_t Stream::processBufferWithPXP(StreamBuffer& src)
 {
+    ATRACE_CALL();
     ALOGV("%s", __func__);
     sp<Stream>& device = src.mStream;
     if (device == NULL) {
@@ -428,67 +709,156 @@ int32_t Stream::processBufferWithPXP(StreamBuffer& src)
         return 0;
     }
 
-    struct pxp_config_data pxp_conf;
-    struct pxp_layer_param *src_param = NULL, *out_param = NULL;
-    int32_t ret = -1;
-
-    memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
+    // process thread collects completion by finishPendingJob.
+    return blitWithPXP(src.mPhyAddr, device->mWidth, device->mHeight,
+                       device->mFormat, out->mPhyAddr, mWidth, mHeight,
+                       mFormat, false);
+}
 
-    src_param = &(pxp_conf.s0_param);
-    out_param = &(pxp_conf.out_param);
+int32_t Stream::blitWithPXP(int32_t srcPhy, uint32_t srcWidth,
+                            uint32_t srcHeight, int32_t srcFormat,
+                            int32_t dstPhy, uint32_t dstWidth,
+                            uint32_t dstHeight, int32_t dstFormat, bool wait)
+{
+    return blitFourccWithPXP(srcPhy, srcWidth, srcHeight,
+                             convertPixelFormatToV4L2Format(srcFormat),
+                             dstPhy, dstWidth, dstHeight,
+                             convertPixelFormatToV4L2Format(dstFormat), wait);
+}
 
-    /*
-    * Initialize src parameters
-    */
-    src_param->paddr = src.mPhyAddr;
-    src_param->width = device->mWidth;
-    src_param->height = device->mHeight;
-    src_param->color_key = -1;
-    src_param->color_key_enable = 0;
-    src_param->pixel_fmt = convertPixelFormatToV4L2Format(device->mFormat);
-    pxp_conf.proc_data.srect.top = 0;
-    pxp_conf.proc_data.srect.left = 0;
-    pxp_conf.proc_data.srect.width = device->mWidth;
-    pxp_conf.proc_data.srect.height = device->mHeight;
+int32_t Stream::blitFourccWithPXP(int32_t srcPhy, uint32_t srcWidth,
+                                  uint32_t srcHeight, uint32_t srcFourcc,
+                                  int32_t dstPhy, uint32_t dstWidth,
+                                  uint32_t dstHeight, uint32_t dstFourcc,
+                                  bool wait)
+{
+    int32_t ret = -1;
 
-    /*
-    * Initialize out parameters
-    */
-    out_param->paddr = out->mPhyAddr;
-    out_param->width = mWidth;
-    out_param->height = mHeight;
-    out_param->stride = mWidth;
-    out_param->pixel_fmt = convertPixelFormatToV4L2Format(mFormat);
-    pxp_conf.handle = channel;
-    pxp_conf.proc_data.drect.top = 0;
-    pxp_conf.proc_data.drect.left = 0;
-    pxp_conf.proc_data.drect.width = mWidth;
-    pxp_conf.proc_data.drect.height = mHeight;
-
-    ret = ioctl(mPxpFd, PXP_IOC_CONFIG_CHAN, &pxp_conf);
+    // one job in flight per channel, frames collect their job before
+    // next one is queued, so a job left here has nobody to report to.
+    if (isJobPending()) {
+        ALOGE("%s pxp job of earlier buffer not collected", __func__);
+        finishPendingJob();
+    }
+
+    PxpGeometry geometry;
+    memset(&geometry, 0, sizeof(geometry));
+    geometry.srcWidth = srcWidth;
+    geometry.srcHeight = srcHeight;
+    geometry.srcFourcc = srcFourcc;
+    geometry.dstWidth = dstWidth;
+    geometry.dstHeight = dstHeight;
+    geometry.dstFourcc = dstFourcc;
+
+    if (mPxpConf == NULL ||
+            memcmp(&geometry, &mPxpGeometry, sizeof(geometry)) != 0) {
+        if (mPxpConf == NULL) {
+            mPxpConf = new struct pxp_config_data;
+        }
+        struct pxp_config_data& pxp_conf = *mPxpConf;
+        struct pxp_layer_param *src_param = NULL, *out_param = NULL;
+
+        memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
+
+        src_param = &(pxp_conf.s0_param);
+        out_param = &(pxp_conf.out_param);
+
+        /*
+        * Initialize src parameters
+        */
+        src_param->width = srcWidth;
+        src_param->height = srcHeight;
+        src_param->color_key = -1;
+        src_param->color_key_enable = 0;
+        src_param->pixel_fmt = srcFourcc;
+        pxp_conf.proc_data.srect.top = 0;
+        pxp_conf.proc_data.srect.left = 0;
+        pxp_conf.proc_data.srect.width = srcWidth;
+        pxp_conf.proc_data.srect.height = srcHeight;
+
+        /*
+        * Initialize out parameters
+        */
+        out_param->width = dstWidth;
+        out_param->height = dstHeight;
+        out_param->stride = dstWidth;
+        out_param->pixel_fmt = dstFourcc;
+        pxp_conf.proc_data.drect.top = 0;
+        pxp_conf.proc_data.drect.left = 0;
+        pxp_conf.proc_data.drect.width = dstWidth;
+        pxp_conf.proc_data.drect.height = dstHeight;
+        mPxpGeometry = geometry;
+    }
+
+    // only buffer addresses change between frames.
+    mPxpConf->s0_param.paddr = srcPhy;
+    mPxpConf->out_param.paddr = dstPhy;
+    mPxpConf->handle = channel;
+
+    ret = ioctl(mPxpFd, PXP_IOC_CONFIG_CHAN, mPxpConf);
     if(ret < 0) {
         ALOGE("%s:%d, PXP_IOC_CONFIG_CHAN failed %d", __FUNCTION__, __LINE__ ,ret);
         return ret;
     }
 
-    ret = ioctl(mPxpFd, PXP_IOC_START_CHAN, &(pxp_conf.handle));
+    mPxpStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    ret = ioctl(mPxpFd, PXP_IOC_START_CHAN, &(mPxpConf->handle));
     if(ret < 0) {
         ALOGE("%s:%d, PXP_IOC_START_CHAN failed %d", __FUNCTION__, __LINE__ ,ret);
         return ret;
     }
 
-    ret = ioctl(mPxpFd, PXP_IOC_WAIT4CMPLT, &pxp_conf);
+    mPxpPending = true;
+    if (wait) {
+        ret = finishPendingJob();
+    }
+
+    return ret;
+}
+
+int32_t Stream::finishPendingJob()
+{
+#ifdef TARGET_FSL_IMX_2D
+    if (mG2dPending != NULL) {
+        void* g2dHandle = mG2dPending;
+        mG2dPending = NULL;
+        if (g2d_finish(g2dHandle) != 0) {
+            ALOGE("%s g2d_finish failed", __func__);
+            return -1;
+        }
+        mStats.onEngine(ENGINE_G2D, systemTime(SYSTEM_TIME_MONOTONIC) - mG2dStart);
+        return 0;
+    }
+#endif
+
+    if (mIpuPending) {
+        mIpuPending = false;
+        int32_t ret = IpuQueue::getInstance().wait(&mIpuJob);
+        if (ret >= 0) {
+            mStats.onEngine(ENGINE_IPU, mIpuJob.mEnd - mIpuJob.mStart);
+        }
+        return ret;
+    }
+
+    if (!mPxpPending) {
+        return 0;
+    }
+
+    mPxpPending = false;
+    int32_t ret = ioctl(mPxpFd, PXP_IOC_WAIT4CMPLT, mPxpConf);
     if(ret < 0) {
         ALOGE("%s:%d, PXP_IOC_WAIT4CMPLT failed %d", __FUNCTION__, __LINE__ ,ret);
-        return ret;
+    }
+    else {
+        mStats.onEngine(ENGINE_PXP, systemTime(SYSTEM_TIME_MONOTONIC) - mPxpStart);
     }
 
     return ret;
-
 }
 
 int32_t Stream::processBufferWithIPU(StreamBuffer& src)
 {
+    ATRACE_CALL();
     ALOGV("%s", __func__);
     sp<Stream>& device = src.mStream;
     if (device == NULL) {
@@ -502,7 +872,22 @@ int32_t Stream::processBufferWithIPU(StreamBuffer& src)
         return 0;
     }
 
-    struct ipu_task mTask;
+    // one job in flight per stream, worker may still read the task.
+    // frames collect their job before next one is queued, so a job
+    // left here has nobody to report to.
+    if (isJobPending()) {
+        ALOGE("%s ipu job of earlier buffer not collected", __func__);
+        finishPendingJob();
+    }
+
+    struct ipu_task& mTask = mIpuJob.mTask;
+    if (mIpuTaskValid) {
+        // task was checked for this mode, only addresses change.
+        mTask.input.paddr = src.mPhyAddr;
+        mTask.output.paddr = out->mPhyAddr;
+        return queueIpuJob();
+    }
+
     memset(&mTask, 0, sizeof(mTask));
 
     mTask.input.width = device->mWidth;
@@ -529,15 +914,6 @@ int32_t Stream::processBufferWithIPU(StreamBuffer& src)
     mTask.output.rotate = 0;
     mTask.output.paddr = out->mPhyAddr;
 
-    // If after convert, src/dst has same format and resolution, then process with GPU.
-    // For exmaple, HAL_PIXEL_FORMAT_YCBCR_420_888, HAL_PIXEL_FORMAT_YCbCr_420_SP
-    // both convert to v4l2_fourcc('N', 'V', '1', '2').
-    if( (mTask.output.format == mTask.input.format) &&
-        (mTask.output.width == mTask.input.width) &&
-        (mTask.output.height == mTask.input.height) ) {
-        return processBufferWithGPU(src);
-    }
-
     int32_t ret = IPU_CHECK_ERR_INPUT_CROP;
     while(ret != IPU_CHECK_OK && ret > IPU_CHECK_ERR_MIN) {
         ret = ioctl(mIpuFd, IPU_CHECK_TASK, &mTask);
@@ -563,28 +939,45 @@ int32_t Stream::processBufferWithIPU(StreamBuffer& src)
         }
     }
 
-    ret = ioctl(mIpuFd, IPU_QUEUE_TASK, &mTask);
+    mIpuTaskValid = true;
+    return queueIpuJob();
+}
+
+int32_t Stream::queueIpuJob()
+{
+    // task runs in background like pxp job, process thread
+    // collects completion by finishPendingJob.
+    if (IpuQueue::getInstance().queue(&mIpuJob) == 0) {
+        mIpuPending = true;
+        return 0;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int32_t ret = ioctl(mIpuFd, IPU_QUEUE_TASK, &mIpuJob.mTask);
     if(ret < 0) {
         ALOGE("%s:%d, IPU_QUEUE_TASK failed %d", __FUNCTION__, __LINE__ ,ret);
         return ret;
     }
+    mStats.onEngine(ENGINE_IPU, systemTime(SYSTEM_TIME_MONOTONIC) - start);
 
     return ret;
 }
 
-static void bufferDump(StreamBuffer *frame, bool in)
+static bool isBufferDump()
 {
     // for test code
     char value[100];
-    char name[100];
     memset(value, 0, sizeof(value));
-    bool vflg = false;
-    static int dump_num = 1;
     property_get("rw.camera.test", value, "");
-    if (strcmp(value, "true") == 0)
-        vflg = true;
+    return strcmp(value, "true") == 0;
+}
 
-    if (vflg) {
+static void bufferDump(StreamBuffer *frame, bool in)
+{
+    char name[100];
+    static int dump_num = 1;
+
+    if (isBufferDump()) {
         FILE *pf = NULL;
         memset(name, 0, sizeof(name));
         snprintf(name, 100, "/data/dump/camera_dump_%s_%d.data",
@@ -603,6 +996,7 @@ static void bufferDump(StreamBuffer *frame, bool in)
 
 int32_t Stream::processBufferWithGPU(StreamBuffer& src)
 {
+    ATRACE_CALL();
     sp<Stream>& device = src.mStream;
     if (device == NULL) {
         ALOGE("%s invalid device stream", __func__);
@@ -624,20 +1018,119 @@ int32_t Stream::processBufferWithGPU(StreamBuffer& src)
         return 0;
     }
 
+    int32_t ret = 0;
 #ifdef TARGET_FSL_IMX_2D
+    // one job in flight per stream, frames collect their job before
+    // next one is queued, so a job left here has nobody to report to.
+    if (isJobPending()) {
+        ALOGE("%s g2d job of earlier buffer not collected", __func__);
+        finishPendingJob();
+    }
+
     struct g2d_buf s_buf, d_buf;
     s_buf.buf_paddr = src.mPhyAddr;
     s_buf.buf_vaddr = src.mVirtAddr;
     d_buf.buf_paddr = out->mPhyAddr;
     d_buf.buf_vaddr = out->mVirtAddr;
-    g2d_copy(g2dHandle, &d_buf, &s_buf, size);
-    g2d_finish(g2dHandle);
+    // copy runs in background like pxp job, process thread
+    // collects completion by finishPendingJob.
+    mG2dStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (g2d_copy(g2dHandle, &d_buf, &s_buf, size) != 0 ||
+            g2d_flush(g2dHandle) != 0) {
+        ALOGE("%s g2d_copy failed", __func__);
+        g2d_finish(g2dHandle);
+        return -1;
+    }
+    mG2dPending = g2dHandle;
 #endif
 
-    bufferDump(&src, true);
-    bufferDump(out, false);
+    if (isBufferDump()) {
+        ret = finishPendingJob();
+        bufferDump(&src, true);
+        bufferDump(out, false);
+    }
 
-    return 0;
+    return ret;
+}
+
+bool Stream::canBlitWithG2D(sp<Stream>& device)
+{
+#ifdef TARGET_FSL_IMX_2D
+    return device->getG2dHandle() != NULL &&
+           convertG2dFormat(device->mFormat) >= 0 &&
+           convertG2dFormat(mFormat) >= 0;
+#else
+    return false;
+#endif
+}
+
+int32_t Stream::processBufferWithG2D(StreamBuffer& src)
+{
+    ATRACE_CALL();
+    ALOGV("%s", __func__);
+    sp<Stream>& device = src.mStream;
+    if (device == NULL) {
+        ALOGE("%s invalid device stream", __func__);
+        return 0;
+    }
+
+    StreamBuffer* out = mCurrent;
+    if (out == NULL || out->mBufHandle == NULL) {
+        ALOGE("%s invalid buffer handle", __func__);
+        return 0;
+    }
+
+    int32_t ret = 0;
+#ifdef TARGET_FSL_IMX_2D
+    // one job in flight per stream, frames collect their job before
+    // next one is queued, so a job left here has nobody to report to.
+    if (isJobPending()) {
+        ALOGE("%s g2d job of earlier buffer not collected", __func__);
+        finishPendingJob();
+    }
+
+    // scale, color convert and rotate in one blit, device frame is
+    // laid out in V4L2 size of its mode.
+    void* g2dHandle = device->getG2dHandle();
+    struct g2d_surface s_surface, d_surface;
+    setG2dSurface(s_surface, src.mPhyAddr, device->mWidth, device->mHeight,
+                  convertG2dFormat(device->mFormat), mPlan.mV4l2Width,
+                  mPlan.mV4l2Height);
+    setG2dSurface(d_surface, out->mPhyAddr, mWidth, mHeight,
+                  convertG2dFormat(mFormat));
+    if (mStream != NULL) {
+        switch (mStream->rotation) {
+            case CAMERA3_STREAM_ROTATION_90:
+                d_surface.rot = G2D_ROTATION_90;
+                break;
+            case CAMERA3_STREAM_ROTATION_180:
+                d_surface.rot = G2D_ROTATION_180;
+                break;
+            case CAMERA3_STREAM_ROTATION_270:
+                d_surface.rot = G2D_ROTATION_270;
+                break;
+            default:
+                break;
+        }
+    }
+
+    mG2dStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (g2d_blit(g2dHandle, &s_surface, &d_surface) != 0 ||
+            g2d_flush(g2dHandle) != 0) {
+        ALOGE("%s g2d_blit failed", __func__);
+        g2d_finish(g2dHandle);
+        return -1;
+    }
+    mG2dPending = g2dHandle;
+#endif
+
+    if (isBufferDump()) {
+        ret = finishPendingJob();
+        bufferDump(&src, true);
+        bufferDump(out, false);
+    }
+
+    return ret;
 }
 
 int32_t Stream::convertNV12toNV21(StreamBuffer& src)
@@ -681,19 +1174,15 @@ int32_t Stream::convertNV12toNV21(StreamBuffer& src)
         memcpy(dstOut, srcIn, size);
     }
 
-    for (int k = 0; k < UVsize/2; k++) {
-        __asm volatile ("rev16 %0, %0" : "+r"(*UVout));
-        UVout += 1;
-    }
+    swapChromaBytes((uint8_t *)UVout, UVsize * 2);
 
     return 0;
 }
 
 int32_t Stream::processBufferWithCPU(StreamBuffer &src)
 {
+    ATRACE_CALL();
     int ret;
-    uint32_t v4l2Width;
-    uint32_t v4l2Height;
 
     sp<Stream> &device = src.mStream;
     if (device == NULL) {
@@ -707,11 +1196,10 @@ int32_t Stream::processBufferWithCPU(StreamBuffer &src)
         return 0;
     }
 
-    ret = mCamera->getV4l2Res(mWidth, mHeight, &v4l2Width, &v4l2Height);
-    if (ret) {
-        ALOGE("%s getV4l2Res failed, ret %d", __func__, ret);
-        return 0;
-    }
+    // sizes match below, so V4L2 size of device mode is that of stream.
+    const ConvertPlan& plan = getConvertPlan(device);
+    uint32_t v4l2Width = plan.mV4l2Width;
+    uint32_t v4l2Height = plan.mV4l2Height;
 
     ALOGV("res, stream %dx%d, v4l2 %dx%d", mWidth, mHeight, v4l2Width, v4l2Height);
 
@@ -732,11 +1220,13 @@ int32_t Stream::processBufferWithCPU(StreamBuffer &src)
             }
             YUYVCopyByLine(pTmpBuf, mWidth, mHeight, (uint8_t *)src.mVirtAddr, v4l2Width, v4l2Height);
         }
-        convertYUYVtoNV12SP(pTmpBuf, (uint8_t *)out->mVirtAddr, mWidth, mHeight);
+        convertYUYVToNV12(pTmpBuf, (uint8_t *)out->mVirtAddr, mWidth, mHeight,
+                          YUYV_CHROMA_VU);
 
     } else if ((mFormat == HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
                (device->mFormat == HAL_PIXEL_FORMAT_YCbCr_422_I)) {
-        convertYUYVtoNV12SP((uint8_t *)src.mVirtAddr, (uint8_t *)out->mVirtAddr, mWidth, mHeight);
+        convertYUYVToNV12((uint8_t *)src.mVirtAddr, (uint8_t *)out->mVirtAddr,
+                          mWidth, mHeight, YUYV_CHROMA_VU);
     } else if ((device->mFormat == HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
                (mFormat == HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
         ret = convertNV12toNV21(src);
@@ -760,29 +1250,73 @@ int32_t Stream::processFrameBuffer(StreamBuffer& src,
         return 0;
     }
 
-    int32_t ret = 0;
-    uint32_t v4l2Width;
-    uint32_t v4l2Height;
+    const ConvertPlan& plan = getConvertPlan(device);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int32_t ret = (this->*plan.mProcess)(src);
+    mStats.onEngine(plan.mEngine, systemTime(SYSTEM_TIME_MONOTONIC) - start);
 
-    ret = mCamera->getV4l2Res(device->mWidth, device->mHeight, &v4l2Width, &v4l2Height);
-    if (ret) {
-        ALOGE("%s getV4l2Res failed, ret %d", __func__, ret);
-    }
+    return ret;
+}
 
-    if ((mWidth != v4l2Width) || (mHeight != v4l2Height) ||
+const Stream::ConvertPlan& Stream::getConvertPlan(sp<Stream>& device)
+{
+    ConvertPlan& plan = mPlan;
+    if (mPlanValid && plan.mDevice == device.get() &&
+            plan.mDeviceWidth == device->mWidth &&
+            plan.mDeviceHeight == device->mHeight &&
+            plan.mDeviceFormat == device->mFormat) {
+        return plan;
+    }
+
+    plan.mDevice = device.get();
+    plan.mDeviceWidth = device->mWidth;
+    plan.mDeviceHeight = device->mHeight;
+    plan.mDeviceFormat = device->mFormat;
+    if (mCamera->getV4l2Res(device->mWidth, device->mHeight,
+                            &plan.mV4l2Width, &plan.mV4l2Height) != 0) {
+        ALOGE("%s getV4l2Res failed", __func__);
+        plan.mV4l2Width = device->mWidth;
+        plan.mV4l2Height = device->mHeight;
+    }
+
+    // pxp, ipu and g2d blit time is taken when its job completes.
+    plan.mEngine = -1;
+    if ((mWidth != plan.mV4l2Width) || (mHeight != plan.mV4l2Height) ||
             (mFormat != device->mFormat)) {
-        if ((mIpuFd > 0) && (mFormat != HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
-            ret = processBufferWithIPU(src);
+        // If after convert, src/dst has same format and resolution, then process with GPU.
+        // For exmaple, HAL_PIXEL_FORMAT_YCBCR_420_888, HAL_PIXEL_FORMAT_YCbCr_420_SP
+        // both convert to v4l2_fourcc('N', 'V', '1', '2').
+        bool sameIpuFormat = (mWidth == device->mWidth) &&
+                (mHeight == device->mHeight) &&
+                (convertPixelFormatToV4L2Format(mFormat, mCallback) ==
+                 convertPixelFormatToV4L2Format(device->mFormat));
+        if ((mIpuFd > 0) && (mFormat != HAL_PIXEL_FORMAT_YCrCb_420_SP) &&
+                sameIpuFormat) {
+            plan.mEngine = device->getG2dHandle() != NULL ? ENGINE_G2D : ENGINE_CPU;
+            plan.mProcess = &Stream::processBufferWithGPU;
+        } else if ((mIpuFd > 0) && (mFormat != HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
+            plan.mProcess = &Stream::processBufferWithIPU;
         } else if (mPxpFd > 0){
-            ret = processBufferWithPXP(src);
+            plan.mProcess = &Stream::processBufferWithPXP;
+        } else if (canBlitWithG2D(device)) {
+            // GPU parts without IPU or PXP, e.g. i.MX8QM.
+            plan.mProcess = &Stream::processBufferWithG2D;
         } else {
-            ret = processBufferWithCPU(src);
+            plan.mEngine = ENGINE_CPU;
+            plan.mProcess = &Stream::processBufferWithCPU;
         }
     } else {
-        ret = processBufferWithGPU(src);
+        plan.mEngine = device->getG2dHandle() != NULL ? ENGINE_G2D : ENGINE_CPU;
+        plan.mProcess = &Stream::processBufferWithGPU;
     }
 
-    return ret;
+    // task is checked again for new mode.
+    mIpuTaskValid = false;
+    mPlanValid = true;
+    ALOGI("%s %dx%d 0x%x -> %dx%d 0x%x, engine %d", __func__,
+          device->mWidth, device->mHeight, device->mFormat, mWidth, mHeight,
+          mFormat, plan.mEngine);
+    return plan;
 }
 
 int32_t Stream::processCaptureBuffer(StreamBuffer& src,
@@ -798,7 +1332,9 @@ int32_t Stream::processCaptureBuffer(StreamBuffer& src,
     }
 
     if (out->mAcquireFence != -1) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
         res = sync_wait(out->mAcquireFence, CAMERA_SYNC_TIMEOUT);
+        mStats.onFenceWait(systemTime(SYSTEM_TIME_MONOTONIC) - start);
         if (res == -ETIME) {
             ALOGE("%s: Timeout waiting on buffer acquire fence",
                     __func__);
@@ -809,6 +1345,7 @@ int32_t Stream::processCaptureBuffer(StreamBuffer& src,
             ALOGV("fence id:%d", out->mAcquireFence);
         }
         close(out->mAcquireFence);
+        out->mAcquireFence = -1;
     }
 
     if (mJpeg) {
@@ -861,7 +1398,13 @@ bool Stream::isValidReuseStream(int id, camera3_stream_t *s)
         return false;
     }
 
-    if (s->width != mWidth || s->height != mHeight || s->format != mFormat) {
+    // input stream keeps flexible format, taken as NV12 in HAL.
+    int32_t format = s->format;
+    if (mType == CAMERA3_STREAM_INPUT && format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
+        format = HAL_PIXEL_FORMAT_YCbCr_420_SP;
+    }
+
+    if (s->width != mWidth || s->height != mHeight || format != mFormat) {
         ALOGE("%s:%d: Mismatched reused stream."
               "Got w:%d, h:%d, f:%d expect w:%d, h:%d, f:%d",
                 __func__, mId, s->width, s->height, s->format,
@@ -896,5 +1439,6 @@ void Stream::dump(int fd)
         dprintf(fd, "Buffer %d %d : %p\n", i, mNumBuffers,
                 mBuffers[i]->mBufHandle);
     }
+    mStats.dump(fd);
 }
 
@@ -22,11 +22,13 @@
 #include <system/graphics.h>
 #include <utils/Mutex.h>
 #include <utils/RefBase.h>
+#include <binder/MemoryHeapBase.h>
 #include <linux/ipu.h>
 #include <ion/ion.h>
 #include <linux/mxc_ion.h>
 #include <ion_ext.h>
 #include "JpegBuilder.h"
+#include "IpuQueue.h"
 
 #ifdef TARGET_FSL_IMX_2D
 #include "g2d.h"
@@ -34,6 +36,27 @@
 
 using namespace android;
 
+// largest size of ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES.
+#define JPEG_THUMB_MAX_WIDTH  160
+#define JPEG_THUMB_MAX_HEIGHT 120
+
+// contiguous buffers jpeg source is scaled into.
+#define JPEG_SCALE_MAIN  0
+#define JPEG_SCALE_THUMB 1
+#define JPEG_SCALE_NUM   2
+
+// geometry of cached PXP configuration.
+struct PxpGeometry
+{
+    uint32_t srcWidth;
+    uint32_t srcHeight;
+    uint32_t srcFourcc;
+    uint32_t dstWidth;
+    uint32_t dstHeight;
+    uint32_t dstFourcc;
+};
+
+struct pxp_config_data;
 class Camera;
 // Stream represents a single input or output stream for a camera device.
 class Stream : public LightRefBase<Stream>
@@ -51,9 +74,12 @@ public:
 
     void setCurrentBuffer(StreamBuffer* out) {mCurrent = out;}
     virtual void* getG2dHandle() {return NULL;}
+    virtual void* getJpegG2dHandle() {return NULL;}
     bool isPreview() {return mPreview;}
     bool isJpeg() {return mJpeg;}
     bool isCallback() {return mCallback;}
+    // V4L2 captures into buffers of stream without copy.
+    bool isDirect() {return mDirect;}
     uint32_t width() {return mWidth;}
     uint32_t height() {return mHeight;}
     int32_t format() {return mFormat;}
@@ -62,31 +88,85 @@ public:
     void setReuse(bool reuse) {mReuse = mReuse;}
     void setFps(uint32_t fps) {mFps = fps;}
     uint32_t fps() {return mFps;};
+    FrameStats& stats() {return mStats;}
 
     int getType();
     bool isInputType();
     bool isOutputType();
     bool isRegistered();
     void dump(int fd);
+    // PXP, IPU or G2D job of last processed buffer is still running.
+    bool isJobPending() {
+        return mPxpPending || mIpuPending || mG2dPending != NULL;
+    }
+    // wait for pending PXP, IPU or G2D job, return its result.
+    int32_t finishPendingJob();
+    // allocate jpeg scratch buffers for source format once.
+    int32_t prepareJpegBuffers(int32_t srcFormat);
 
 protected:
+    // yuv size of jpeg scratch buffer, 0 for unsupported format.
+    static int32_t getJpegScratchSize(int32_t format,
+                                      uint32_t width, uint32_t height);
+
     int32_t processJpegBuffer(StreamBuffer& src,
                               sp<Metadata> meta);
+    // scale jpeg source by G2D or PXP into format, NULL if no
+    // hardware path.
+    StreamBuffer* scaleJpegSource(StreamBuffer& src, int32_t index,
+                                  uint32_t width, uint32_t height,
+                                  int32_t format);
+    int32_t allocScaleBuffer(int32_t index, size_t size);
+    void freeScaleBuffers();
+    int32_t blitWithPXP(int32_t srcPhy, uint32_t srcWidth, uint32_t srcHeight,
+                        int32_t srcFormat, int32_t dstPhy, uint32_t dstWidth,
+                        uint32_t dstHeight, int32_t dstFormat, bool wait);
+    // same with V4L2 fourcc, for device formats without HAL format.
+    int32_t blitFourccWithPXP(int32_t srcPhy, uint32_t srcWidth,
+                              uint32_t srcHeight, uint32_t srcFourcc,
+                              int32_t dstPhy, uint32_t dstWidth,
+                              uint32_t dstHeight, uint32_t dstFourcc,
+                              bool wait);
     int32_t processFrameBuffer(StreamBuffer& src,
                                sp<Metadata> meta);
     int32_t convertNV12toNV21(StreamBuffer& src);
     int32_t processBufferWithPXP(StreamBuffer& src);
     int32_t processBufferWithIPU(StreamBuffer& src);
+    // queue checked mIpuJob, runs it inline if workers are missing.
+    int32_t queueIpuJob();
     int32_t processBufferWithGPU(StreamBuffer& src);
+    // G2D has formats of both device and this stream.
+    bool canBlitWithG2D(sp<Stream>& device);
+    int32_t processBufferWithG2D(StreamBuffer& src);
 
     int32_t processBufferWithCPU(StreamBuffer& src);
 
+    typedef int32_t (Stream::*ProcessFunc)(StreamBuffer& src);
+    // conversion of device frames into this stream. routing only
+    // changes with device mode, so it is decided once per mode.
+    struct ConvertPlan
+    {
+        // device mode plan was built for.
+        Stream* mDevice;
+        uint32_t mDeviceWidth;
+        uint32_t mDeviceHeight;
+        int32_t mDeviceFormat;
+        // buffer size of device frames, see Camera::getV4l2Res.
+        uint32_t mV4l2Width;
+        uint32_t mV4l2Height;
+        // ENGINE_* of stats, -1 if async job takes its own time.
+        int32_t mEngine;
+        ProcessFunc mProcess;
+    };
+    const ConvertPlan& getConvertPlan(sp<Stream>& device);
+
 protected:
     // This stream is being reused. Used in stream configuration passes
     bool mReuse;
     bool mPreview;
     bool mJpeg;
     bool mCallback;
+    bool mDirect;
     // The camera device id this stream belongs to
     const int mId;
     // Handle to framework's stream, used as a cookie for buffers
@@ -115,9 +195,32 @@ protected:
     int32_t mIpuFd;
     int32_t mPxpFd;
     int32_t channel;
+    // descriptor is rebuilt only when geometry changes.
+    struct pxp_config_data* mPxpConf;
+    PxpGeometry mPxpGeometry;
+    // checked IPU task of plan, only addresses change per frame.
+    // task runs on IpuQueue, process thread finishes the job.
+    IpuJob mIpuJob;
+    bool mIpuTaskValid;
+    bool mIpuPending;
+    ConvertPlan mPlan;
+    bool mPlanValid;
+    bool mPxpPending;
     StreamBuffer* mCurrent;
     Camera* mCamera;
     sp<JpegBuilder> mJpegBuilder;
+    // jpeg scratch buffers reused by all captures of stream.
+    android::sp<android::MemoryHeapBase> mThumbFrame;
+    // ion buffers of hardware scaled jpeg source.
+    int32_t mIonFd;
+    StreamBuffer* mScaleBuffers[JPEG_SCALE_NUM];
+    // pxp job start, for engine time of async job.
+    nsecs_t mPxpStart;
+    // g2d handle of flushed copy not finished yet, it belongs to
+    // process thread which also finishes the job.
+    void* mG2dPending;
+    nsecs_t mG2dStart;
+    FrameStats mStats;
 };
 
 #endif // STREAM_H_
@@ -0,0 +1,667 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <poll.h>
+#include "SwMJPGStream.h"
+#include "ColorConvert.h"
+
+//----------------------SwMJPGDecoder--------------------
+
+SwMJPGDecoder::SwMJPGDecoder()
+    : mScratch(NULL), mScratchSize(0)
+{
+    memset(&mInfo, 0, sizeof(mInfo));
+    mInfo.err = jpeg_std_error(&mError);
+    mError.error_exit = onErrorExit;
+    mError.output_message = onMessage;
+    jpeg_create_decompress(&mInfo);
+
+    memset(&mSource, 0, sizeof(mSource));
+    mSource.init_source = initSource;
+    mSource.fill_input_buffer = fillInput;
+    mSource.skip_input_data = skipInput;
+    mSource.resync_to_restart = jpeg_resync_to_restart;
+    mSource.term_source = termSource;
+    mInfo.src = &mSource;
+}
+
+SwMJPGDecoder::~SwMJPGDecoder()
+{
+    jpeg_destroy_decompress(&mInfo);
+    free(mScratch);
+}
+
+void SwMJPGDecoder::onErrorExit(j_common_ptr info)
+{
+    ErrorMgr* error = (ErrorMgr*)info->err;
+    (*error->output_message)(info);
+    // decompress struct is kept, caller aborts it.
+    longjmp(error->mJump, 1);
+}
+
+void SwMJPGDecoder::onMessage(j_common_ptr info)
+{
+    char buffer[JMSG_LENGTH_MAX];
+    (*info->err->format_message)(info, buffer);
+    ALOGW("mjpg decode: %s", buffer);
+}
+
+void SwMJPGDecoder::initSource(j_decompress_ptr /*info*/)
+{
+}
+
+boolean SwMJPGDecoder::fillInput(j_decompress_ptr info)
+{
+    // truncated frame, end it so that decoded part is kept.
+    static const JOCTET sEoi[2] = {0xFF, JPEG_EOI};
+    info->src->next_input_byte = sEoi;
+    info->src->bytes_in_buffer = sizeof(sEoi);
+    return TRUE;
+}
+
+void SwMJPGDecoder::skipInput(j_decompress_ptr info, long bytes)
+{
+    jpeg_source_mgr* src = info->src;
+    if (bytes <= 0) {
+        return;
+    }
+
+    if ((size_t)bytes > src->bytes_in_buffer) {
+        bytes = src->bytes_in_buffer;
+    }
+    src->next_input_byte += bytes;
+    src->bytes_in_buffer -= bytes;
+}
+
+void SwMJPGDecoder::termSource(j_decompress_ptr /*info*/)
+{
+}
+
+uint8_t* SwMJPGDecoder::getScratch(size_t size)
+{
+    if (size > mScratchSize) {
+        free(mScratch);
+        mScratch = (uint8_t*)malloc(size);
+        mScratchSize = mScratch != NULL ? size : 0;
+    }
+
+    return mScratch;
+}
+
+int32_t SwMJPGDecoder::decode(const uint8_t* src, uint32_t size,
+                              uint8_t* dst, uint32_t width, uint32_t height)
+{
+    if (setjmp(mError.mJump)) {
+        jpeg_abort_decompress(&mInfo);
+        return -1;
+    }
+
+    mSource.next_input_byte = src;
+    mSource.bytes_in_buffer = size;
+    // libjpeg-turbo takes standard huffman tables when frame has no DHT.
+    jpeg_read_header(&mInfo, TRUE);
+
+    jpeg_component_info* comp = mInfo.comp_info;
+    if (mInfo.image_width != width || mInfo.image_height != height ||
+        mInfo.num_components != 3 || comp[0].h_samp_factor != 2 ||
+        (comp[0].v_samp_factor != 1 && comp[0].v_samp_factor != 2) ||
+        comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 ||
+        comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1) {
+        ALOGE("%s unsupported frame %dx%d, %d components", __func__,
+              mInfo.image_width, mInfo.image_height, mInfo.num_components);
+        jpeg_abort_decompress(&mInfo);
+        return -1;
+    }
+
+    // planes are read as coded, no upsampling and color conversion.
+    mInfo.raw_data_out = TRUE;
+    mInfo.do_fancy_upsampling = FALSE;
+    mInfo.dct_method = JDCT_IFAST;
+    jpeg_start_decompress(&mInfo);
+
+    // luma rows of one row group, 8 for 4:2:2, 16 for 4:2:0.
+    uint32_t vsamp = comp[0].v_samp_factor;
+    uint32_t lines = vsamp * DCTSIZE;
+    // IDCT writes whole blocks, which spill into next row when luma
+    // width is not block aligned.
+    uint32_t yWidth = comp[0].width_in_blocks * DCTSIZE;
+    uint32_t cWidth = comp[1].width_in_blocks * DCTSIZE;
+    bool yDirect = (yWidth == width);
+    uint8_t* scratch = getScratch(cWidth * DCTSIZE * 2 + yWidth * lines);
+    if (scratch == NULL) {
+        jpeg_abort_decompress(&mInfo);
+        return -1;
+    }
+
+    uint8_t* uRows = scratch;
+    uint8_t* vRows = uRows + cWidth * DCTSIZE;
+    uint8_t* yRows = vRows + cWidth * DCTSIZE;
+    uint8_t* uv = dst + width * height;
+
+    JSAMPROW y[2 * DCTSIZE];
+    JSAMPROW u[DCTSIZE];
+    JSAMPROW v[DCTSIZE];
+    JSAMPARRAY planes[3] = {y, u, v};
+    for (uint32_t i = 0; i < DCTSIZE; i++) {
+        u[i] = uRows + i * cWidth;
+        v[i] = vRows + i * cWidth;
+    }
+
+    while (mInfo.output_scanline < mInfo.output_height) {
+        uint32_t row = mInfo.output_scanline;
+        // luma goes to frame, rows past frame end to scratch.
+        for (uint32_t i = 0; i < lines; i++) {
+            if (yDirect && row + i < height) {
+                y[i] = dst + (row + i) * width;
+            }
+            else {
+                y[i] = yRows + i * yWidth;
+            }
+        }
+
+        if (jpeg_read_raw_data(&mInfo, planes, lines) == 0) {
+            break;
+        }
+
+        for (uint32_t i = 0; !yDirect && i < lines && row + i < height; i++) {
+            memcpy(dst + (row + i) * width, y[i], width);
+        }
+
+        // one chroma row per two luma rows, 4:2:2 drops odd rows. last
+        // luma row of odd height has no chroma row in NV12 plane.
+        for (uint32_t i = 0; i < lines / 2 && (row + i * 2) + 1 < height; i++) {
+            uint32_t c = vsamp == 2 ? i : i * 2;
+            mergeChroma(u[c], v[c], uv + (row / 2 + i) * width, width / 2);
+        }
+    }
+
+    // rest of frame is not needed, struct is reused by next frame.
+    jpeg_abort_decompress(&mInfo);
+
+    return 0;
+}
+
+//----------------------SwMJPGStream--------------------
+
+SwMJPGStream::SwMJPGStream(Camera* device)
+    : DMAStream(device), mWorkerNum(0), mInputNum(0), mDecodeNum(0),
+      mReadyNum(0), mDecodeSequence(0), mOutputSequence(0),
+      mDecodeExit(false)
+{
+    memset(mInputAddr, 0, sizeof(mInputAddr));
+    memset(mInputSize, 0, sizeof(mInputSize));
+    memset(mSlots, 0, sizeof(mSlots));
+}
+
+SwMJPGStream::~SwMJPGStream()
+{
+    stopDecodeLocked();
+}
+
+int32_t SwMJPGStream::onDeviceConfigureLocked()
+{
+    ALOGI("%s", __func__);
+
+    if (mDev <= 0) {
+        ALOGE("%s invalid fd handle", __func__);
+        return BAD_VALUE;
+    }
+
+    if (mFormat != HAL_PIXEL_FORMAT_YCbCr_420_SP) {
+        ALOGE("%s format 0x%x not supported", __func__, mFormat);
+        return BAD_VALUE;
+    }
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("rw.camera.mjpg.workers", value, "");
+    int32_t workers = atoi(value);
+    if (workers <= 0) {
+        workers = MJPG_SW_DEFAULT_WORKERS;
+    }
+    mWorkerNum = workers > MJPG_SW_MAX_WORKERS ? MJPG_SW_MAX_WORKERS : workers;
+    // other workers need own slots while consumer holds one.
+    mNumBuffers += mWorkerNum - 1;
+    if (mNumBuffers > MAX_STREAM_BUFFERS) {
+        mNumBuffers = MAX_STREAM_BUFFERS;
+    }
+
+    int32_t fps = mFps;
+    if ((mWidth > 1920) || (mHeight > 1080)) {
+        fps = 15;
+    }
+
+    ALOGI("Width * Height %d x %d MJPG, fps: %d, workers: %d",
+          mWidth, mHeight, fps, mWorkerNum);
+
+    struct v4l2_streamparm param;
+    memset(&param, 0, sizeof(param));
+    param.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    param.parm.capture.timeperframe.numerator   = 1;
+    param.parm.capture.timeperframe.denominator = fps;
+    param.parm.capture.capturemode = mCamera->getCaptureMode(mWidth, mHeight);
+    int32_t ret = ioctl(mDev, VIDIOC_S_PARM, &param);
+    if (ret < 0) {
+        ALOGE("%s: VIDIOC_S_PARM Failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type                 = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    // compressed frames have no line alignment, decoder handles
+    // partial blocks at right and bottom edge.
+    fmt.fmt.pix.width        = mWidth;
+    fmt.fmt.pix.height       = mHeight;
+    fmt.fmt.pix.pixelformat  = v4l2_fourcc('M', 'J', 'P', 'G');
+    ret = ioctl(mDev, VIDIOC_S_FMT, &fmt);
+    if (ret < 0) {
+        ALOGE("%s: VIDIOC_S_FMT Failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    if (fmt.fmt.pix.width != mWidth || fmt.fmt.pix.height != mHeight) {
+        // every frame would fail decode at another size.
+        ALOGE("%s: device gives %dx%d for %dx%d", __func__,
+              fmt.fmt.pix.width, fmt.fmt.pix.height, mWidth, mHeight);
+        return BAD_VALUE;
+    }
+
+    return 0;
+}
+
+int32_t SwMJPGStream::allocateInputBuffersLocked()
+{
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof (req));
+    req.count = MJPG_SW_INPUT_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(mDev, VIDIOC_REQBUFS, &req) < 0) {
+        ALOGE("%s: VIDIOC_REQBUFS failed", __func__);
+        return BAD_VALUE;
+    }
+
+    mInputNum = req.count < MJPG_SW_INPUT_BUFFERS ? req.count
+                                                  : MJPG_SW_INPUT_BUFFERS;
+    for (uint32_t i = 0; i < mInputNum; i++) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof (buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (ioctl(mDev, VIDIOC_QUERYBUF, &buf) < 0) {
+            ALOGE("%s: VIDIOC_QUERYBUF failed", __func__);
+            return BAD_VALUE;
+        }
+
+        void* addr = mmap(NULL, buf.length, PROT_READ, MAP_SHARED,
+                          mDev, buf.m.offset);
+        if (addr == MAP_FAILED) {
+            ALOGE("%s: mmap failed: %s", __func__, strerror(errno));
+            return BAD_VALUE;
+        }
+        mInputAddr[i] = addr;
+        mInputSize[i] = buf.length;
+
+        if (ioctl(mDev, VIDIOC_QBUF, &buf) < 0) {
+            ALOGE("%s VIDIOC_QBUF Failed: %s", __func__, strerror(errno));
+            return BAD_VALUE;
+        }
+    }
+
+    return 0;
+}
+
+void SwMJPGStream::freeInputBuffersLocked()
+{
+    for (uint32_t i = 0; i < MJPG_SW_INPUT_BUFFERS; i++) {
+        if (mInputAddr[i] != NULL) {
+            munmap(mInputAddr[i], mInputSize[i]);
+            mInputAddr[i] = NULL;
+            mInputSize[i] = 0;
+        }
+    }
+    mInputNum = 0;
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof (req));
+    req.count = 0;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(mDev, VIDIOC_REQBUFS, &req);
+}
+
+int32_t SwMJPGStream::onDeviceStartLocked()
+{
+    ALOGV("%s", __func__);
+
+    if (mDev <= 0) {
+        ALOGE("----%s invalid fd-----", __func__);
+        return BAD_VALUE;
+    }
+
+    if (allocateInputBuffersLocked() != 0) {
+        freeInputBuffersLocked();
+        return BAD_VALUE;
+    }
+
+    enum v4l2_buf_type bufType;
+    bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int32_t ret = ioctl(mDev, VIDIOC_STREAMON, &bufType);
+    if (ret < 0) {
+        ALOGE("%s VIDIOC_STREAMON failed: %s", __func__, strerror(errno));
+        freeInputBuffersLocked();
+        return ret;
+    }
+
+    return startDecodeLocked();
+}
+
+int32_t SwMJPGStream::onDeviceStopLocked()
+{
+    ALOGV("%s", __func__);
+
+    if (mDev <= 0) {
+        ALOGE("%s invalid fd handle", __func__);
+        return BAD_VALUE;
+    }
+
+    // workers must not touch UVC buffers after stream off.
+    stopDecodeLocked();
+
+    enum v4l2_buf_type bufType;
+    bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int32_t ret = ioctl(mDev, VIDIOC_STREAMOFF, &bufType);
+    if (ret < 0) {
+        ALOGE("%s VIDIOC_STREAMOFF failed:%s", __func__, strerror(errno));
+    }
+    freeInputBuffersLocked();
+
+    return ret < 0 ? ret : 0;
+}
+
+int32_t SwMJPGStream::startDecodeLocked()
+{
+    mInputFrames.clear();
+    for (uint32_t i = 0; i < MAX_STREAM_BUFFERS; i++) {
+        mSlots[i].mState = SLOT_FREE;
+        mSlots[i].mTarget = i < mNumBuffers ? mBuffers[i] : NULL;
+        mSlots[i].mSequence = 0;
+        mSlots[i].mTimestamp = 0;
+        mSlots[i].mError = false;
+    }
+    mDecodeNum = 0;
+    mReadyNum = 0;
+    mDecodeSequence = 0;
+    mOutputSequence = 0;
+    mDecodeExit = false;
+
+    for (uint32_t i = 0; i < mWorkerNum; i++) {
+        mWorkers[i] = new DecodeThread(this);
+        status_t ret = mWorkers[i]->run("MJPGSwDecodeThread",
+                                        PRIORITY_URGENT_DISPLAY);
+        if (ret != NO_ERROR) {
+            ALOGE("%s run decode thread failed %d", __func__, ret);
+            mWorkers[i].clear();
+            stopDecodeLocked();
+            return BAD_VALUE;
+        }
+    }
+
+    return 0;
+}
+
+void SwMJPGStream::stopDecodeLocked()
+{
+    {
+        Mutex::Autolock _l(mDecodeLock);
+        mDecodeExit = true;
+        mInputCondition.broadcast();
+    }
+
+    for (uint32_t i = 0; i < MJPG_SW_MAX_WORKERS; i++) {
+        if (mWorkers[i] != NULL) {
+            mWorkers[i]->requestExitAndWait();
+            mWorkers[i].clear();
+        }
+    }
+
+    // UVC buffers of undecoded frames are dropped by stream off.
+    mInputFrames.clear();
+    mDecodeNum = 0;
+    mReadyNum = 0;
+}
+
+void SwMJPGStream::queueInput(int32_t index)
+{
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof (buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(mDev, VIDIOC_QBUF, &buf) < 0) {
+        ALOGE("%s: VIDIOC_QBUF Failed: %s", __func__, strerror(errno));
+    }
+}
+
+int32_t SwMJPGStream::queueCompressedLocked(bool block)
+{
+    if (!block) {
+        struct pollfd fds;
+        fds.fd = mDev;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        if (poll(&fds, 1, 0) <= 0 || !(fds.revents & POLLIN)) {
+            return -EAGAIN;
+        }
+    }
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof (buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    int32_t ret = ioctl(mDev, VIDIOC_DQBUF, &buf);
+    if (ret < 0) {
+        ALOGE("%s: VIDIOC_DQBUF Failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    if (buf.index >= mInputNum) {
+        ALOGE("%s invalid index %d", __func__, buf.index);
+        return -1;
+    }
+
+    SwMJPGFrame frame;
+    frame.mIndex = buf.index;
+    frame.mLength = buf.bytesused > 0 ? buf.bytesused : buf.length;
+    frame.mTimestamp = getV4l2Timestamp(buf.timestamp, buf.flags);
+
+    Mutex::Autolock _l(mDecodeLock);
+    if (!mInputFrames.push(frame)) {
+        ALOGE("%s decode ring full, drop %d", __func__, frame.mIndex);
+        ioctl(mDev, VIDIOC_QBUF, &buf);
+        return -ENOSPC;
+    }
+    mDecodeNum++;
+    mInputCondition.signal();
+
+    return 0;
+}
+
+int32_t SwMJPGStream::findFreeSlotLocked()
+{
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        if (mSlots[i].mState == SLOT_FREE && mSlots[i].mTarget != NULL) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int32_t SwMJPGStream::findNextSlotLocked()
+{
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        if (mSlots[i].mState == SLOT_READY &&
+            mSlots[i].mSequence == mOutputSequence) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int32_t SwMJPGStream::onFrameAcquireLocked()
+{
+    ALOGV("%s", __func__);
+
+    // keep workers busy with next frames while consumer holds this one.
+    while (true) {
+        uint32_t num;
+        bool ready;
+        {
+            Mutex::Autolock _l(mDecodeLock);
+            num = mDecodeNum;
+            ready = mReadyNum > 0;
+        }
+
+        if (num >= mWorkerNum) {
+            break;
+        }
+        // block only if nothing could come out of workers.
+        int32_t ret = queueCompressedLocked(num == 0 && !ready);
+        if (ret == -EAGAIN) {
+            break;
+        }
+        if (ret != 0) {
+            if (num == 0 && !ready) {
+                return -1;
+            }
+            break;
+        }
+    }
+
+    Mutex::Autolock _l(mDecodeLock);
+    while (true) {
+        int32_t index = findNextSlotLocked();
+        if (index >= 0) {
+            Slot& slot = mSlots[index];
+            mOutputSequence++;
+            mReadyNum--;
+            if (!slot.mError) {
+                slot.mState = SLOT_HELD;
+                mBuffers[index]->mSensorTimestamp = slot.mTimestamp;
+                return index;
+            }
+
+            // broken frame, slot keeps its target for next frame.
+            slot.mState = SLOT_FREE;
+            mInputCondition.signal();
+            continue;
+        }
+
+        if (mDecodeNum == 0) {
+            // frame had no output, let caller try next one.
+            ALOGW("%s no decoded frame", __func__);
+            return -1;
+        }
+
+        if (mOutputCondition.waitRelative(mDecodeLock,
+                                          MJPG_SW_TIMEOUT) != NO_ERROR) {
+            ALOGE("%s wait decoded frame timeout", __func__);
+            return -1;
+        }
+    }
+}
+
+int32_t SwMJPGStream::handleDecodeFrame(SwMJPGDecoder& decoder)
+{
+    SwMJPGFrame frame;
+    int32_t index = -1;
+    StreamBuffer* target;
+    {
+        Mutex::Autolock _l(mDecodeLock);
+        while (!mDecodeExit && (mInputFrames.empty() ||
+                                (index = findFreeSlotLocked()) < 0)) {
+            mInputCondition.wait(mDecodeLock);
+        }
+
+        if (mDecodeExit) {
+            return -1;
+        }
+
+        // frame order is kept by sequence, workers finish out of order.
+        mInputFrames.pop(frame);
+        Slot& slot = mSlots[index];
+        slot.mState = SLOT_DECODING;
+        slot.mSequence = mDecodeSequence++;
+        slot.mTimestamp = frame.mTimestamp;
+        target = slot.mTarget;
+    }
+
+    int32_t ret = decoder.decode((const uint8_t*)mInputAddr[frame.mIndex],
+                                 frame.mLength, (uint8_t*)target->mVirtAddr,
+                                 mWidth, mHeight);
+    queueInput(frame.mIndex);
+
+    Mutex::Autolock _l(mDecodeLock);
+    Slot& slot = mSlots[index];
+    slot.mState = SLOT_READY;
+    slot.mError = (ret != 0);
+    mReadyNum++;
+    mDecodeNum--;
+    mOutputCondition.broadcast();
+
+    return 0;
+}
+
+int32_t SwMJPGStream::onFrameReturnLocked(int32_t index, StreamBuffer& /*buf*/)
+{
+    ALOGV("%s: index:%d", __func__, index);
+    if (index < 0 || index >= (int32_t)mNumBuffers) {
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock _l(mDecodeLock);
+    Slot& slot = mSlots[index];
+    if (slot.mState != SLOT_HELD) {
+        return 0;
+    }
+    slot.mState = SLOT_FREE;
+    slot.mTarget = mBuffers[index];
+    mInputCondition.signal();
+
+    return 0;
+}
+
+int32_t SwMJPGStream::onDirectReturnLocked(int32_t index, StreamBuffer& buf)
+{
+    if (index < 0 || index >= (int32_t)mNumBuffers ||
+        buf.mVirtAddr == NULL || (int32_t)buf.mSize < getFormatSize()) {
+        return -1;
+    }
+
+    Mutex::Autolock _l(mDecodeLock);
+    Slot& slot = mSlots[index];
+    if (slot.mState != SLOT_HELD) {
+        return -1;
+    }
+    // framework buffer has stream size and format, decode into it.
+    slot.mState = SLOT_FREE;
+    slot.mTarget = &buf;
+    mInputCondition.signal();
+
+    return 0;
+}
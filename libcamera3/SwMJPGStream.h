@@ -0,0 +1,171 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SW_MJPG_STREAM_H
+#define _SW_MJPG_STREAM_H
+
+#include "DMAStream.h"
+#include "RingQueue.h"
+
+extern "C" {
+    #include "jpeglib.h"
+}
+#include <setjmp.h>
+
+// decode workers, each decodes one whole frame.
+#define MJPG_SW_MAX_WORKERS     4
+#define MJPG_SW_DEFAULT_WORKERS 2
+// compressed frames in V4L2 MMAP buffers.
+#define MJPG_SW_INPUT_BUFFERS   (MJPG_SW_MAX_WORKERS + 2)
+#define MJPG_SW_RING_SIZE       8
+#define MJPG_SW_TIMEOUT         500000000LL
+
+// UVC buffer holding one compressed frame.
+struct SwMJPGFrame
+{
+    int32_t mIndex;
+    uint32_t mLength;
+    nsecs_t mTimestamp;
+};
+
+// libjpeg decoder of one worker, kept across frames.
+class SwMJPGDecoder
+{
+public:
+    SwMJPGDecoder();
+    ~SwMJPGDecoder();
+
+    // decode baseline 4:2:2 or 4:2:0 frame into NV12, 0 on success.
+    int32_t decode(const uint8_t* src, uint32_t size, uint8_t* dst,
+                   uint32_t width, uint32_t height);
+
+private:
+    struct ErrorMgr : jpeg_error_mgr {
+        jmp_buf mJump;
+    };
+
+    static void onErrorExit(j_common_ptr info);
+    static void onMessage(j_common_ptr info);
+    static void initSource(j_decompress_ptr info);
+    static boolean fillInput(j_decompress_ptr info);
+    static void skipInput(j_decompress_ptr info, long bytes);
+    static void termSource(j_decompress_ptr info);
+    uint8_t* getScratch(size_t size);
+
+    jpeg_decompress_struct mInfo;
+    ErrorMgr mError;
+    jpeg_source_mgr mSource;
+    // chroma rows of one row group and padding luma rows.
+    uint8_t* mScratch;
+    size_t mScratchSize;
+};
+
+// UVC MJPEG stream decoded by CPU workers for boards without VPU.
+// frames are decoded into output slot buffers, framework buffer of
+// direct capture is decoded into in place.
+class SwMJPGStream : public DMAStream
+{
+public:
+    SwMJPGStream(Camera* device);
+    virtual ~SwMJPGStream();
+
+    // configure device.
+    virtual int32_t onDeviceConfigureLocked();
+    // start device.
+    virtual int32_t onDeviceStartLocked();
+    // stop device.
+    virtual int32_t onDeviceStopLocked();
+
+    // get decoded slot in frame order.
+    virtual int32_t onFrameAcquireLocked();
+    // give slot back to decoders.
+    virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf);
+    // decode next frame of slot into framework buffer.
+    virtual int32_t onDirectReturnLocked(int32_t index, StreamBuffer& buf);
+    // V4L2 frames still need decode, ready mDev doesn't mean ready frame.
+    virtual bool canLookahead() {return false;}
+
+    // decode one queued frame, return non zero to exit thread.
+    int32_t handleDecodeFrame(SwMJPGDecoder& decoder);
+
+private:
+    enum {
+        SLOT_FREE,
+        SLOT_DECODING,
+        SLOT_READY,
+        SLOT_HELD,
+    };
+
+    struct Slot
+    {
+        int32_t mState;
+        // own buffer, or framework buffer of direct capture.
+        StreamBuffer* mTarget;
+        uint32_t mSequence;
+        nsecs_t mTimestamp;
+        bool mError;
+    };
+
+    class DecodeThread : public Thread
+    {
+    public:
+        DecodeThread(SwMJPGStream *stream)
+            : Thread(false), mStream(stream)
+            {}
+
+        virtual bool threadLoop() {
+            return mStream->handleDecodeFrame(mDecoder) == 0;
+        }
+
+    private:
+        SwMJPGStream* mStream;
+        SwMJPGDecoder mDecoder;
+    };
+
+    int32_t allocateInputBuffersLocked();
+    void freeInputBuffersLocked();
+    int32_t startDecodeLocked();
+    void stopDecodeLocked();
+    // dequeue UVC buffer into decoders, wait for it if block is set.
+    int32_t queueCompressedLocked(bool block);
+    void queueInput(int32_t index);
+    int32_t findFreeSlotLocked();
+    int32_t findNextSlotLocked();
+
+private:
+    uint32_t mWorkerNum;
+    sp<DecodeThread> mWorkers[MJPG_SW_MAX_WORKERS];
+
+    void* mInputAddr[MJPG_SW_INPUT_BUFFERS];
+    size_t mInputSize[MJPG_SW_INPUT_BUFFERS];
+    uint32_t mInputNum;
+
+    // capture thread queues compressed frames, workers take them with
+    // a free slot in queue order, consumer takes slots in same order.
+    RingQueue<SwMJPGFrame, MJPG_SW_RING_SIZE> mInputFrames;
+    Slot mSlots[MAX_STREAM_BUFFERS];
+    Mutex mDecodeLock;
+    Condition mInputCondition;
+    Condition mOutputCondition;
+    // frames dequeued from V4L2 and not decoded yet.
+    uint32_t mDecodeNum;
+    uint32_t mReadyNum;
+    uint32_t mDecodeSequence;
+    uint32_t mOutputSequence;
+    bool mDecodeExit;
+};
+
+#endif
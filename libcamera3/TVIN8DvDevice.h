@@ -35,6 +35,8 @@ public:
     ~TVIN8DvDevice();
 
     virtual status_t initSensorStaticData();
+    // video standard is detected from input signal.
+    virtual bool isStaticInfoCacheable() {return false;}
     virtual PixelFormat getPreviewPixelFormat();
 
     virtual int32_t getV4l2Res(uint32_t streamWidth, uint32_t streamHeight, uint32_t *pV4l2Width, uint32_t *pV4l2Height);
@@ -56,6 +58,8 @@ private:
 
         // configure device.
         virtual int32_t onDeviceConfigureLocked();
+        // analog decoder weaves both fields in one frame.
+        virtual bool isInterlaced() {return true;}
     };
 
 private:
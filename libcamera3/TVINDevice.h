@@ -28,6 +28,8 @@ public:
     ~TVINDevice();
 
     virtual status_t initSensorStaticData();
+    // video standard is detected from input signal.
+    virtual bool isStaticInfoCacheable() {return false;}
 
 private:
     class TVinStream : public MMAPStream {
@@ -38,6 +40,8 @@ private:
 
         // configure device.
         virtual int32_t onDeviceConfigureLocked();
+        // analog decoder weaves both fields in one frame.
+        virtual bool isInterlaced() {return true;}
     };
 
 private:
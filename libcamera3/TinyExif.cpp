@@ -44,27 +44,6 @@ typedef struct st_IFDSpec {
     uint32_t value;
 } __attribute__((packed)) IFDSpec;
 
-#define MAX_ELE_NUM 32
-typedef struct st_IFDGroup {
-    uint32_t eleNum;
-    IFDEle eleArray[MAX_ELE_NUM];
-    uint32_t fixedLenIdx;
-    uint32_t variedLenIdx;
-    uint32_t fixedSize;
-    uint32_t variedSize;
-    uint32_t grpSize;
-    uint32_t exifOffsetIdx;       // idx for TAG_EXIF_OFFSET in g_TiffGroup.eleArray
-    uint32_t gpsOffsetIdx;        // idx for TAG_GPS_OFFSET in g_TiffGroup.eleArray
-    uint32_t nextIFDOffset;       // offset of next IFD, now just used in g_TiffGroup to poit 1st IFD offset
-} IFDGroup;
-
-static IFDGroup g_TiffGroup;
-static IFDGroup g_ExifGroup;
-static IFDGroup g_GpsGroup;
-static IFDGroup g_TiffGroup_1st;
-static uint32_t g_thumbNailOffset;
-static uint32_t g_mainJpgOffset;
-uint32_t tag_length;
 
 #define IFDELE_SIZE 12
 #define ARRAYSIZE(a) (uint32_t)(sizeof(a) / sizeof(a[0]))
@@ -147,7 +126,7 @@ static uint16_t GetTypeFromTag(uint16_t tag)
     return type;
 }
 
-static int WriteOneIFD(IFDGroup* pGrp, uint32_t idx, uint8_t* pDst)
+static int WriteOneIFD(ExifLayout* L, IFDGroup* pGrp, uint32_t idx, uint8_t* pDst)
 {
     IFDEle* pIFDEle = &pGrp->eleArray[idx];
     IFDSpec* pIFDSpec = (IFDSpec*)(pDst + pGrp->fixedLenIdx);
@@ -157,7 +136,7 @@ static int WriteOneIFD(IFDGroup* pGrp, uint32_t idx, uint8_t* pDst)
 
     // set count
     if (pIFDSpec->type == TYPE_UNDEFINED) {
-        pIFDSpec->count = tag_length;
+        pIFDSpec->count = L->tagLength;
     } else if (pIFDSpec->type != TYPE_ASCII) {
         pIFDSpec->count = 1;
     } else if (strlen(pIFDEle->strVal) < 4) {
@@ -196,8 +175,8 @@ static int WriteOneIFD(IFDGroup* pGrp, uint32_t idx, uint8_t* pDst)
         if (strlen(pIFDEle->strVal) < 4) {
             strcpy((char*)(&pIFDSpec->value), pIFDEle->strVal);
         } else if (TYPE_UNDEFINED == pIFDSpec->type) {
-            memcpy((char*)pDst + pGrp->variedLenIdx, pIFDEle->strVal, tag_length);
-            pGrp->variedLenIdx += tag_length;
+            memcpy((char*)pDst + pGrp->variedLenIdx, pIFDEle->strVal, L->tagLength);
+            pGrp->variedLenIdx += L->tagLength;
         } else {
             strcpy((char*)pDst + pGrp->variedLenIdx, pIFDEle->strVal);
             pGrp->variedLenIdx += strlen(pIFDEle->strVal) + 1;
@@ -276,7 +255,8 @@ static bool IsGpsTags(uint16_t tag)
     return flag;
 }
 
-static int InsertThumb(uint8_t* pThumb,
+static int InsertThumb(ExifLayout* L,
+                       uint8_t* pThumb,
                        uint32_t thumbSize,
                        uint8_t* pDst,
                        uint32_t /*dstSize*/)
@@ -284,7 +264,7 @@ static int InsertThumb(uint8_t* pThumb,
     if (pThumb == NULL)
         return 0;
 
-    memcpy(pDst + g_thumbNailOffset, pThumb, thumbSize);
+    memcpy(pDst + L->thumbNailOffset, pThumb, thumbSize);
 
     return 0;
 }
@@ -295,32 +275,58 @@ static int InsertThumb(uint8_t* pThumb,
 #define DRI_Mark_0 0xff
 #define DRI_Mark_1 0xdd
 
-static int InsertMain(uint8_t* pMain,
-                      uint32_t mainSize,
-                      uint8_t* pDst,
-                      uint32_t /*dstSize*/)
+int GetMainJpegSkip(const uint8_t* pMain, uint32_t mainSize)
 {
     uint32_t i = 0;
-    uint32_t DRIOffset = 0;
+
+    if ((pMain == NULL) || (mainSize < 2))
+        return -1;
 
     while ((((pMain[i] != DRI_Mark_0) || (pMain[i + 1] != DRI_Mark_1)) && ((pMain[i] != DQT_Mark_0) || (pMain[i + 1] != DQT_Mark_1))) &&
            (i + 2 <= mainSize))
         i++;
 
-    if (i + 2 > mainSize) {
+    if (i + 2 > mainSize)
+        return -1;
+
+    return i;
+}
+
+static int InsertMain(ExifLayout* L,
+                      uint8_t* pMain,
+                      uint32_t mainSize,
+                      uint8_t* pDst,
+                      uint32_t dstSize)
+{
+    int DRIOffset = GetMainJpegSkip(pMain, mainSize);
+    if (DRIOffset < 0) {
         ALOGE("InsertMain, can't find DRI Mark and DQT Mark, mainSize %d", mainSize);
         return -1;
     }
 
-    DRIOffset = i;
     ALOGV("InsertMain, DQTOffset %d", DRIOffset);
 
-    memcpy(pDst + g_mainJpgOffset, pMain + DRIOffset, mainSize - DRIOffset);
+    if (L->mainJpgOffset >= dstSize) {
+        ALOGE("InsertMain, main offset %d out of dstSize %d", L->mainJpgOffset, dstSize);
+        return -1;
+    }
+
+    // truncated jpeg is not a capture, caller fails the buffer.
+    uint32_t copySize = mainSize - DRIOffset;
+    if (copySize > dstSize - L->mainJpgOffset) {
+        ALOGE("InsertMain, main %d at %d out of dstSize %d", copySize,
+              L->mainJpgOffset, dstSize);
+        return -1;
+    }
+
+    // main picture encoded in place needs no copy.
+    if (pMain + DRIOffset != pDst + L->mainJpgOffset)
+        memmove(pDst + L->mainJpgOffset, pMain + DRIOffset, copySize);
 
     return 0;
 }
 
-static uint32_t CalcGroupSize(IFDGroup* pIFDGrp)
+static uint32_t CalcGroupSize(ExifLayout* L, IFDGroup* pIFDGrp)
 {
     uint32_t i;
     uint32_t fixedSize = 0;
@@ -349,9 +355,9 @@ static uint32_t CalcGroupSize(IFDGroup* pIFDGrp)
                 variedSize += strlen(pIFDEle->strVal) + 1;
             }
         } else if (TYPE_UNDEFINED == type) {
-                tag_length = sizeof(ExifAsciiPrefix) +
+                L->tagLength = sizeof(ExifAsciiPrefix) +
                              strlen(pIFDEle->strVal + sizeof(ExifAsciiPrefix));
-            variedSize += tag_length;
+            variedSize += L->tagLength;
         } else if ((TYPE_RATIONAL == type) || (TYPE_RATIONAL_SIGNED == type)) {
             if (pIFDEle->val6 != 0) {
                 variedSize += 24;
@@ -377,7 +383,72 @@ finished:
         }                                                            \
     } while (0)
 
-static int ScanIFD(IFDEle* pIFDEle,
+// bytes element takes besides its IFD entry, layout stays the same
+// while these stay the same.
+static uint32_t GetEleSize(const IFDEle* pIFDEle)
+{
+    uint16_t type = GetTypeFromTag(pIFDEle->tag);
+
+    if (TYPE_ASCII == type)
+        return strlen(pIFDEle->strVal);
+    if (TYPE_UNDEFINED == type)
+        return strlen(pIFDEle->strVal + sizeof(ExifAsciiPrefix));
+    if ((TYPE_RATIONAL == type) || (TYPE_RATIONAL_SIGNED == type))
+        return (pIFDEle->val6 != 0) ? 24 : 8;
+
+    return 0;
+}
+
+static bool IsSameLayout(ExifLayout* L, IFDEle* pIFDEle, uint32_t eleNum, uint32_t thumbSize)
+{
+    uint32_t i;
+
+    if (!L->valid || (L->eleNum != eleNum) || (L->thumbSize != thumbSize))
+        return false;
+
+    for (i = 0; i < eleNum; i++) {
+        if ((L->tags[i] != pIFDEle[i].tag) || (L->sizes[i] != GetEleSize(&pIFDEle[i])))
+            return false;
+    }
+
+    return true;
+}
+
+// patch values of this picture into cached groups.
+static void RefreshGrp(IFDGroup* pGrp, IFDEle* pIFDEle)
+{
+    uint32_t i;
+
+    for (i = 0; i < pGrp->eleNum; i++) {
+        if (pGrp->srcIdx[i] >= 0)
+            pGrp->eleArray[i] = pIFDEle[pGrp->srcIdx[i]];
+    }
+}
+
+static void SaveLayout(ExifLayout* L, IFDEle* pIFDEle, uint32_t eleNum, uint32_t thumbSize)
+{
+    uint32_t i;
+
+    if (eleNum > MAX_ELE_NUM)
+        return;
+
+    for (i = 0; i < eleNum; i++) {
+        L->tags[i] = pIFDEle[i].tag;
+        L->sizes[i] = GetEleSize(&pIFDEle[i]);
+    }
+    L->eleNum = eleNum;
+    L->thumbSize = thumbSize;
+    L->valid = true;
+}
+
+void ResetExifLayout(ExifLayout* L)
+{
+    if (L)
+        memset(L, 0, sizeof(*L));
+}
+
+static int ScanIFD(ExifLayout* L,
+                   IFDEle* pIFDEle,
                    uint32_t eleNum,
                    uint32_t thumbSize,
                    uint32_t mainSize,
@@ -390,146 +461,172 @@ static int ScanIFD(IFDEle* pIFDEle,
     uint32_t totalHeadSize =
         ARRAYSIZE(SOIMark) + ARRAYSIZE(APP1Head) + ARRAYSIZE(IFDHead);
 
-    memset(&g_TiffGroup, 0, sizeof(g_TiffGroup));
-    memset(&g_ExifGroup, 0, sizeof(g_ExifGroup));
-    memset(&g_GpsGroup, 0, sizeof(g_GpsGroup));
-    memset(&g_TiffGroup_1st, 0, sizeof(g_TiffGroup_1st));
+    // same tags of same sizes as last picture, only values change.
+    if (IsSameLayout(L, pIFDEle, eleNum, thumbSize)) {
+        RefreshGrp(&L->tiff, pIFDEle);
+        RefreshGrp(&L->gps, pIFDEle);
+        RefreshGrp(&L->exif, pIFDEle);
+        if (pRequestSize)
+            *pRequestSize = L->mainJpgOffset + mainSize;
+        return 0;
+    }
+
+    L->valid = false;
+    memset(&L->tiff, 0, sizeof(L->tiff));
+    memset(&L->exif, 0, sizeof(L->exif));
+    memset(&L->gps, 0, sizeof(L->gps));
+    memset(&L->tiff1st, 0, sizeof(L->tiff1st));
 
     for (i = 0; i < eleNum; i++) {
         if (IsTiffTags(pIFDEle[i].tag)) {
-            BOUND_CHECK(g_TiffGroup.eleNum, MAX_ELE_NUM);
-            g_TiffGroup.eleArray[g_TiffGroup.eleNum] = pIFDEle[i];
-            g_TiffGroup.eleNum++;
+            BOUND_CHECK(L->tiff.eleNum, MAX_ELE_NUM);
+            L->tiff.eleArray[L->tiff.eleNum] = pIFDEle[i];
+            L->tiff.srcIdx[L->tiff.eleNum] = i;
+            L->tiff.eleNum++;
         } else if (IsGpsTags(pIFDEle[i].tag)) {
-            BOUND_CHECK(g_GpsGroup.eleNum, MAX_ELE_NUM);
-            g_GpsGroup.eleArray[g_GpsGroup.eleNum] = pIFDEle[i];
-            g_GpsGroup.eleNum++;
+            BOUND_CHECK(L->gps.eleNum, MAX_ELE_NUM);
+            L->gps.eleArray[L->gps.eleNum] = pIFDEle[i];
+            L->gps.srcIdx[L->gps.eleNum] = i;
+            L->gps.eleNum++;
 
             // TAG_GPS_OFFSET
             if (bTagGpsOffsetAdded == false) {
-                BOUND_CHECK(g_TiffGroup.eleNum, MAX_ELE_NUM);
-                g_TiffGroup.eleArray[g_TiffGroup.eleNum].tag = TAG_GPS_OFFSET;
-                g_TiffGroup.gpsOffsetIdx = g_TiffGroup.eleNum;
-                g_TiffGroup.eleNum++;
+                BOUND_CHECK(L->tiff.eleNum, MAX_ELE_NUM);
+                L->tiff.eleArray[L->tiff.eleNum].tag = TAG_GPS_OFFSET;
+                L->tiff.srcIdx[L->tiff.eleNum] = -1;
+                L->tiff.gpsOffsetIdx = L->tiff.eleNum;
+                L->tiff.eleNum++;
                 bTagGpsOffsetAdded = true;
             }
         } else if (IsExifTags(pIFDEle[i].tag)) {
-            BOUND_CHECK(g_ExifGroup.eleNum, MAX_ELE_NUM);
-            g_ExifGroup.eleArray[g_ExifGroup.eleNum] = pIFDEle[i];
-            g_ExifGroup.eleNum++;
+            BOUND_CHECK(L->exif.eleNum, MAX_ELE_NUM);
+            L->exif.eleArray[L->exif.eleNum] = pIFDEle[i];
+            L->exif.srcIdx[L->exif.eleNum] = i;
+            L->exif.eleNum++;
 
             // TAG_EXIF_OFFSET
             if (bTagExifOffsetAdded == false) {
-                BOUND_CHECK(g_TiffGroup.eleNum, MAX_ELE_NUM);
-                g_TiffGroup.eleArray[g_TiffGroup.eleNum].tag = TAG_EXIF_OFFSET;
-                g_TiffGroup.exifOffsetIdx = g_TiffGroup.eleNum;
-                g_TiffGroup.eleNum++;
+                BOUND_CHECK(L->tiff.eleNum, MAX_ELE_NUM);
+                L->tiff.eleArray[L->tiff.eleNum].tag = TAG_EXIF_OFFSET;
+                L->tiff.srcIdx[L->tiff.eleNum] = -1;
+                L->tiff.exifOffsetIdx = L->tiff.eleNum;
+                L->tiff.eleNum++;
                 bTagExifOffsetAdded = true;
             }
         }
     }
 
-    CalcGroupSize(&g_TiffGroup);
-    CalcGroupSize(&g_ExifGroup);
-    CalcGroupSize(&g_GpsGroup);
+    CalcGroupSize(L, &L->tiff);
+    CalcGroupSize(L, &L->exif);
+    CalcGroupSize(L, &L->gps);
 
-    g_TiffGroup.eleArray[g_TiffGroup.gpsOffsetIdx].val1 =
-        ARRAYSIZE(IFDHead) + g_TiffGroup.grpSize;
+    if (bTagGpsOffsetAdded)
+        L->tiff.eleArray[L->tiff.gpsOffsetIdx].val1 =
+            ARRAYSIZE(IFDHead) + L->tiff.grpSize;
 
-    g_TiffGroup.eleArray[g_TiffGroup.exifOffsetIdx].val1 =
-        ARRAYSIZE(IFDHead) + g_TiffGroup.grpSize + g_GpsGroup.grpSize;
+    if (bTagExifOffsetAdded)
+        L->tiff.eleArray[L->tiff.exifOffsetIdx].val1 =
+            ARRAYSIZE(IFDHead) + L->tiff.grpSize + L->gps.grpSize;
 
     if(thumbSize > 0) {
-        g_TiffGroup.nextIFDOffset =
-            ARRAYSIZE(IFDHead) + g_TiffGroup.grpSize + g_GpsGroup.grpSize + g_ExifGroup.grpSize;
-
-        BOUND_CHECK(g_TiffGroup_1st.eleNum, MAX_ELE_NUM);
-        g_TiffGroup_1st.eleArray[g_TiffGroup_1st.eleNum].tag = TAG_THUMBNAIL_OFFSET;
-        g_TiffGroup_1st.eleNum++;
-
-        BOUND_CHECK(g_TiffGroup_1st.eleNum, MAX_ELE_NUM);
-        g_TiffGroup_1st.eleArray[g_TiffGroup_1st.eleNum].tag = TAG_THUMBNAIL_LENGTH;
-        g_TiffGroup_1st.eleArray[g_TiffGroup_1st.eleNum].val1 = thumbSize;
-        g_TiffGroup_1st.eleNum++;
-
-        CalcGroupSize(&g_TiffGroup_1st);
-        g_TiffGroup_1st.eleArray[0].val1 =
-           ARRAYSIZE(IFDHead) + g_TiffGroup.grpSize + g_GpsGroup.grpSize + g_ExifGroup.grpSize + g_TiffGroup_1st.grpSize;
+        L->tiff.nextIFDOffset =
+            ARRAYSIZE(IFDHead) + L->tiff.grpSize + L->gps.grpSize + L->exif.grpSize;
+
+        BOUND_CHECK(L->tiff1st.eleNum, MAX_ELE_NUM);
+        L->tiff1st.eleArray[L->tiff1st.eleNum].tag = TAG_THUMBNAIL_OFFSET;
+        L->tiff1st.srcIdx[L->tiff1st.eleNum] = -1;
+        L->tiff1st.eleNum++;
+
+        BOUND_CHECK(L->tiff1st.eleNum, MAX_ELE_NUM);
+        L->tiff1st.eleArray[L->tiff1st.eleNum].tag = TAG_THUMBNAIL_LENGTH;
+        L->tiff1st.srcIdx[L->tiff1st.eleNum] = -1;
+        L->tiff1st.eleArray[L->tiff1st.eleNum].val1 = thumbSize;
+        L->tiff1st.eleNum++;
+
+        CalcGroupSize(L, &L->tiff1st);
+        L->tiff1st.eleArray[0].val1 =
+           ARRAYSIZE(IFDHead) + L->tiff.grpSize + L->gps.grpSize + L->exif.grpSize + L->tiff1st.grpSize;
     }
 
 
-    g_thumbNailOffset = totalHeadSize + g_TiffGroup.grpSize + g_GpsGroup.grpSize + g_ExifGroup.grpSize + g_TiffGroup_1st.grpSize;
-    g_mainJpgOffset = g_thumbNailOffset + thumbSize;
-    requestSize = g_mainJpgOffset + mainSize;
+    L->thumbNailOffset = totalHeadSize + L->tiff.grpSize + L->gps.grpSize + L->exif.grpSize + L->tiff1st.grpSize;
+    L->mainJpgOffset = L->thumbNailOffset + thumbSize;
+    requestSize = L->mainJpgOffset + mainSize;
 
     if (pRequestSize)
         *pRequestSize = requestSize;
 
     // calulate fixed (IFDs, each 12 bytes) and varied (such as string, ratio data) area offset for each group
-    g_TiffGroup.fixedLenIdx = IFDGROUP_OFFSET;
-    g_TiffGroup.variedLenIdx = g_TiffGroup.fixedLenIdx + g_TiffGroup.fixedSize;
+    L->tiff.fixedLenIdx = IFDGROUP_OFFSET;
+    L->tiff.variedLenIdx = L->tiff.fixedLenIdx + L->tiff.fixedSize;
 
-    g_GpsGroup.fixedLenIdx = IFDGROUP_OFFSET + g_TiffGroup.grpSize;
-    g_GpsGroup.variedLenIdx = g_GpsGroup.fixedLenIdx + g_GpsGroup.fixedSize;
+    L->gps.fixedLenIdx = IFDGROUP_OFFSET + L->tiff.grpSize;
+    L->gps.variedLenIdx = L->gps.fixedLenIdx + L->gps.fixedSize;
 
-    g_ExifGroup.fixedLenIdx = IFDGROUP_OFFSET + g_TiffGroup.grpSize + g_GpsGroup.grpSize;
-    g_ExifGroup.variedLenIdx = g_ExifGroup.fixedLenIdx + g_ExifGroup.fixedSize;
+    L->exif.fixedLenIdx = IFDGROUP_OFFSET + L->tiff.grpSize + L->gps.grpSize;
+    L->exif.variedLenIdx = L->exif.fixedLenIdx + L->exif.fixedSize;
 
-    g_TiffGroup_1st.fixedLenIdx = IFDGROUP_OFFSET + g_TiffGroup.grpSize + g_GpsGroup.grpSize + g_ExifGroup.grpSize;
-    g_TiffGroup_1st.variedLenIdx = g_TiffGroup_1st.fixedLenIdx + g_TiffGroup_1st.fixedSize;
+    L->tiff1st.fixedLenIdx = IFDGROUP_OFFSET + L->tiff.grpSize + L->gps.grpSize + L->exif.grpSize;
+    L->tiff1st.variedLenIdx = L->tiff1st.fixedLenIdx + L->tiff1st.fixedSize;
 
     ALOGI("requestSize %d, thumb offset 0x%x, main offset 0x%x",
           requestSize,
-          g_thumbNailOffset,
-          g_mainJpgOffset);
+          L->thumbNailOffset,
+          L->mainJpgOffset);
 
     ALOGI(
         "TiffGrp elenum %d, fixedSzie %d, Size %d, fixedLenIdx 0x%x, "
         "variedLenIdx 0x%x",
-        g_TiffGroup.eleNum,
-        g_TiffGroup.fixedSize,
-        g_TiffGroup.grpSize,
-        g_TiffGroup.fixedLenIdx,
-        g_TiffGroup.variedLenIdx);
+        L->tiff.eleNum,
+        L->tiff.fixedSize,
+        L->tiff.grpSize,
+        L->tiff.fixedLenIdx,
+        L->tiff.variedLenIdx);
 
     ALOGI(
         "GpsGroup elenum %d, fixedSzie %d, Size %d, fixedLenIdx 0x%x, "
         "variedLenIdx 0x%x",
-        g_GpsGroup.eleNum,
-        g_GpsGroup.fixedSize,
-        g_GpsGroup.grpSize,
-        g_GpsGroup.fixedLenIdx,
-        g_GpsGroup.variedLenIdx);
+        L->gps.eleNum,
+        L->gps.fixedSize,
+        L->gps.grpSize,
+        L->gps.fixedLenIdx,
+        L->gps.variedLenIdx);
 
     ALOGI(
         "ExifGroup elenum %d, fixedSzie %d, Size %d, fixedLenIdx 0x%x, "
         "variedLenIdx 0x%x",
-        g_ExifGroup.eleNum,
-        g_ExifGroup.fixedSize,
-        g_ExifGroup.grpSize,
-        g_ExifGroup.fixedLenIdx,
-        g_ExifGroup.variedLenIdx);
+        L->exif.eleNum,
+        L->exif.fixedSize,
+        L->exif.grpSize,
+        L->exif.fixedLenIdx,
+        L->exif.variedLenIdx);
 
     ALOGI(
         "TiffGrp_1st elenum %d, fixedSzie %d, Size %d, fixedLenIdx 0x%x, "
         "variedLenIdx 0x%x",
-        g_TiffGroup_1st.eleNum,
-        g_TiffGroup_1st.fixedSize,
-        g_TiffGroup_1st.grpSize,
-        g_TiffGroup_1st.fixedLenIdx,
-        g_TiffGroup_1st.variedLenIdx);
+        L->tiff1st.eleNum,
+        L->tiff1st.fixedSize,
+        L->tiff1st.grpSize,
+        L->tiff1st.fixedLenIdx,
+        L->tiff1st.variedLenIdx);
+
+    SaveLayout(L, pIFDEle, eleNum, thumbSize);
 
     return 0;
 }
 
-static int InsertGrp(IFDGroup* pGrp, uint8_t* pDst)
+static int InsertGrp(ExifLayout* L, const IFDGroup* pLayoutGrp, uint8_t* pDst)
 {
     uint32_t i;
     int ret;
 
-    if ((pGrp == NULL) || (pDst == NULL))
+    if ((pLayoutGrp == NULL) || (pDst == NULL))
         return -1;
 
+    // write indexes advance, cached layout keeps start of group.
+    IFDGroup grp = *pLayoutGrp;
+    IFDGroup* pGrp = &grp;
+
     if ((pGrp->eleNum) == 0)
         return 0;
 
@@ -538,7 +635,7 @@ static int InsertGrp(IFDGroup* pGrp, uint8_t* pDst)
     pGrp->fixedLenIdx += 2;
 
     for (i = 0; i < pGrp->eleNum; i++) {
-        ret = WriteOneIFD(pGrp, i, pDst);
+        ret = WriteOneIFD(L, pGrp, i, pDst);
         if (ret) {
             return ret;
         }
@@ -551,7 +648,19 @@ static int InsertGrp(IFDGroup* pGrp, uint8_t* pDst)
     return 0;
 }
 
-int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
+int GetMainJpegOffset(ExifLayout* L, IFDEle* pIFDEle, uint32_t eleNum, uint32_t thumbSize)
+{
+    if ((L == NULL) || (pIFDEle == NULL) || (eleNum == 0))
+        return -1;
+
+    if (ScanIFD(L, pIFDEle, eleNum, thumbSize, 0, NULL))
+        return -1;
+
+    return L->mainJpgOffset;
+}
+
+int InsertEXIFAndThumbnail(ExifLayout* L,
+                           IFDEle* pIFDEle,
                            uint32_t eleNum,
                            uint8_t* pThumb,
                            uint32_t thumbSize,
@@ -564,7 +673,7 @@ int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
     uint32_t requestSize;
     uint32_t app1Size;
 
-    if ((pIFDEle == NULL) || (eleNum == 0) || (pDst == NULL) || (dstSize == 0) ||
+    if ((L == NULL) || (pIFDEle == NULL) || (eleNum == 0) || (pDst == NULL) || (dstSize == 0) ||
         (pMain == NULL) || (mainSize == 0)) {
         ALOGE(
             "%s, para err, pIFDEle %p, eleNum %d, pDst %p, dstSize %d, pMain %p, "
@@ -584,7 +693,7 @@ int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
         pThumb = NULL;
     }
 
-    ret = ScanIFD(pIFDEle, eleNum, thumbSize, mainSize, &requestSize);
+    ret = ScanIFD(L, pIFDEle, eleNum, thumbSize, mainSize, &requestSize);
     if (ret) {
         ALOGE("%s, ScanIFD failed, ret %d", __func__, ret);
         return ret;
@@ -595,55 +704,52 @@ int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
         return -1;
     }
 
+    // main picture may be in pDst, move it before head overwrites it.
+    ret = InsertMain(L, pMain, mainSize, pDst, dstSize);
+    if (ret) {
+        ALOGE("%s, InsertMain failed, ret %d", __func__, ret);
+        return ret;
+    }
+
     // write head
     memcpy(pDst, SOIMark, ARRAYSIZE(SOIMark));
     memcpy(pDst + ARRAYSIZE(SOIMark), APP1Head, ARRAYSIZE(APP1Head));
     memcpy(pDst + IFDHEAD_OFFSET, IFDHead, ARRAYSIZE(IFDHead));
 
-    app1Size = (uint16_t)g_mainJpgOffset - 4;
+    app1Size = (uint16_t)L->mainJpgOffset - 4;
     pDst[4] = (uint8_t)(app1Size >> 8);
     pDst[5] = (uint8_t)(app1Size & 0xff);
 
-    ret = InsertGrp(&g_TiffGroup, pDst);
+    ret = InsertGrp(L, &L->tiff, pDst);
     if (ret) {
-        ALOGE("%s, InsertGrp g_TiffGroup failed, ret %d", __func__, ret);
+        ALOGE("%s, InsertGrp L->tiff failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertGrp(&g_GpsGroup, pDst);
+    ret = InsertGrp(L, &L->gps, pDst);
     if (ret) {
-        ALOGE("%s, InsertGrp g_GpsGroup failed, ret %d", __func__, ret);
+        ALOGE("%s, InsertGrp L->gps failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertGrp(&g_ExifGroup, pDst);
+    ret = InsertGrp(L, &L->exif, pDst);
     if (ret) {
-        ALOGE("%s, InsertGrp g_ExifGroup failed, ret %d", __func__, ret);
+        ALOGE("%s, InsertGrp L->exif failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertGrp(&g_TiffGroup_1st, pDst);
+    ret = InsertGrp(L, &L->tiff1st, pDst);
     if (ret) {
-        ALOGE("%s, InsertGrp g_TiffGroup_1st failed, ret %d", __func__, ret);
+        ALOGE("%s, InsertGrp L->tiff1st failed, ret %d", __func__, ret);
         return ret;
     }
 
 
-    ALOGV("should equal, g_ExifGroup.variedLenIdx %d, g_thumbNailOffset %d",
-          g_ExifGroup.variedLenIdx,
-          g_thumbNailOffset);
-
-    ret = InsertThumb(pThumb, thumbSize, pDst, dstSize);
+    ret = InsertThumb(L, pThumb, thumbSize, pDst, dstSize);
     if (ret) {
         ALOGE("%s, InsertThumb failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertMain(pMain, mainSize, pDst, dstSize);
-    if (ret) {
-        ALOGE("%s, InsertMain failed, ret %d", __func__, ret);
-        return ret;
-    }
-
     return ret;
 }
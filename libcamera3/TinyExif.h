@@ -49,7 +49,52 @@ typedef struct st_IFDEle {
     char* strVal;
 } IFDEle;
 
-int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
+#define MAX_ELE_NUM 32
+typedef struct st_IFDGroup {
+    uint32_t eleNum;
+    IFDEle eleArray[MAX_ELE_NUM];
+    // index of element in caller table, -1 for inner tags.
+    int8_t srcIdx[MAX_ELE_NUM];
+    uint32_t fixedLenIdx;
+    uint32_t variedLenIdx;
+    uint32_t fixedSize;
+    uint32_t variedSize;
+    uint32_t grpSize;
+    uint32_t exifOffsetIdx;       // idx for TAG_EXIF_OFFSET in tiff.eleArray
+    uint32_t gpsOffsetIdx;        // idx for TAG_GPS_OFFSET in tiff.eleArray
+    uint32_t nextIFDOffset;       // offset of next IFD, now just used in tiff to poit 1st IFD offset
+} IFDGroup;
+
+// IFD layout of last picture, owned by caller. it is reused while
+// same tags have same sizes, so only values are patched per shot.
+typedef struct st_ExifLayout {
+    IFDGroup tiff;
+    IFDGroup exif;
+    IFDGroup gps;
+    IFDGroup tiff1st;
+    uint32_t thumbNailOffset;
+    uint32_t mainJpgOffset;
+    uint32_t tagLength;
+    // key of cached layout.
+    bool valid;
+    uint32_t eleNum;
+    uint32_t thumbSize;
+    uint16_t tags[MAX_ELE_NUM];
+    uint32_t sizes[MAX_ELE_NUM];
+} ExifLayout;
+
+void ResetExifLayout(ExifLayout* L);
+
+// offset of main picture in output, APP1 head and thumbnail are
+// before it. -1 on error.
+int GetMainJpegOffset(ExifLayout* L, IFDEle* pIFDEle, uint32_t eleNum, uint32_t thumbSize);
+// bytes of encoded main picture before DQT or DRI mark, they are
+// dropped when it is inserted. -1 if not found.
+int GetMainJpegSkip(const uint8_t* pMain, uint32_t mainSize);
+
+// pMain may be in pDst, e.g. encoded at GetMainJpegOffset.
+int InsertEXIFAndThumbnail(ExifLayout* L,
+                           IFDEle* pIFDEle,
                            uint32_t eleNum,
                            uint8_t* pThumb,
                            uint32_t thumbSize,
@@ -15,19 +15,15 @@
  */
 
 #include "USPStream.h"
+#include "IonPool.h"
 
 USPStream::USPStream(Camera* device)
-    : MMAPStream(device), mIonFd(-1)
+    : MMAPStream(device)
 {
-    mIonFd = ion_open();
 }
 
 USPStream::~USPStream()
 {
-    if (mIonFd > 0) {
-        close(mIonFd);
-        mIonFd = -1;
-    }
 }
 
 // configure device.
@@ -150,6 +146,12 @@ int32_t USPStream::onFrameAcquireLocked()
         return -1;
     }
 
+    if (cfilledbuffer.index < MAX_STREAM_BUFFERS &&
+            mBuffers[cfilledbuffer.index] != NULL) {
+        mBuffers[cfilledbuffer.index]->mSensorTimestamp =
+            getV4l2Timestamp(cfilledbuffer.timestamp, cfilledbuffer.flags);
+    }
+
     return cfilledbuffer.index;
 }
 
@@ -220,11 +222,6 @@ int32_t USPStream::getFormatSize()
 int32_t USPStream::allocateBuffersLocked()
 {
     ALOGV("%s", __func__);
-    if (mIonFd <= 0) {
-        ALOGE("%s ion invalid", __func__);
-        return BAD_VALUE;
-    }
-
     if (mRegistered) {
         ALOGI("%s but buffer is already registered", __func__);
         return 0;
@@ -236,59 +233,14 @@ int32_t USPStream::allocateBuffersLocked()
         return BAD_VALUE;
     }
 
-    unsigned char *ptr = NULL;
-    int32_t sharedFd;
-    int32_t phyAddr;
-    ion_user_handle_t ionHandle;
-    int32_t ionSize = (size + PAGE_SIZE) & (~(PAGE_SIZE - 1));
-
+    // buffers of last session are reused from pool.
+    IonPool& pool = IonPool::getInstance();
     ALOGI("allocateBufferFromIon buffer num:%d", mNumBuffers);
     for (uint32_t i = 0; i < mNumBuffers; i++) {
-        ionHandle = -1;
-        int32_t err = ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle);
-        if (err) {
-            ALOGE("ion_alloc failed.");
-            return BAD_VALUE;
-        }
-
-        err = ion_map(mIonFd,
-                      ionHandle,
-                      ionSize,
-                      PROT_READ | PROT_WRITE,
-                      MAP_SHARED,
-                      0,
-                      &ptr,
-                      &sharedFd);
-
-        if (err) {
-            ALOGE("ion_map failed.");
-            ion_free(mIonFd, ionHandle);
-            if (ptr != MAP_FAILED) {
-                munmap(ptr, ionSize);
-            }
-            if (sharedFd > 0) {
-                close(sharedFd);
-            }
-
-            goto err;
-        }
-        phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
-        if (phyAddr == 0) {
-            ALOGE("ion_phys failed.");
-            ion_free(mIonFd, ionHandle);
-            if (ptr != MAP_FAILED) {
-                munmap(ptr, ionSize);
-            }
-            close(sharedFd);
+        mBuffers[i] = pool.acquire(size);
+        if (mBuffers[i] == NULL) {
             goto err;
         }
-        ALOGI("phyalloc ptr:0x%p, phy:0x%x, ionSize:%d", ptr, phyAddr, ionSize);
-        mBuffers[i] = new StreamBuffer();
-        mBuffers[i]->mVirtAddr  = ptr;
-        mBuffers[i]->mPhyAddr   = phyAddr;
-        mBuffers[i]->mSize      =  ionSize;
-        mBuffers[i]->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
-        mBuffers[i]->mFd = sharedFd;
         mBuffers[i]->mStream = this;
     }
 
@@ -299,6 +251,8 @@ int32_t USPStream::allocateBuffersLocked()
     ret = mCamera->allocTmpBuf(size);
     if (ret) {
         ALOGE("%s, allocTmpBuf failed, ret %d", __func__, ret);
+        mRegistered = false;
+        mAllocatedBuffers = 0;
         goto err;
     }
 
@@ -306,16 +260,7 @@ int32_t USPStream::allocateBuffersLocked()
 
 err:
     for (uint32_t i = 0; i < mNumBuffers; i++) {
-        if (mBuffers[i] == NULL) {
-            continue;
-        }
-
-        ion_user_handle_t ionHandle =
-            (ion_user_handle_t)(uintptr_t)mBuffers[i]->mBufHandle;
-        munmap(mBuffers[i]->mVirtAddr, mBuffers[i]->mSize);
-        close(mBuffers[i]->mFd);
-        ion_free(mIonFd, ionHandle);
-        delete mBuffers[i];
+        pool.release(mBuffers[i]);
         mBuffers[i] = NULL;
     }
 
@@ -325,24 +270,15 @@ err:
 int32_t USPStream::freeBuffersLocked()
 {
     ALOGV("%s", __func__);
-    if (mIonFd <= 0) {
-        ALOGE("%s ion invalid", __func__);
-        return BAD_VALUE;
-    }
-
     if (!mRegistered) {
         ALOGI("%s but buffer is not registered", __func__);
         return 0;
     }
 
     ALOGI("freeBufferToIon buffer num:%d", mAllocatedBuffers);
+    IonPool& pool = IonPool::getInstance();
     for (uint32_t i = 0; i < mAllocatedBuffers; i++) {
-        ion_user_handle_t ionHandle =
-            (ion_user_handle_t)(uintptr_t)mBuffers[i]->mBufHandle;
-        munmap(mBuffers[i]->mVirtAddr, mBuffers[i]->mSize);
-        close(mBuffers[i]->mFd);
-        ion_free(mIonFd, ionHandle);
-        delete mBuffers[i];
+        pool.release(mBuffers[i]);
         mBuffers[i] = NULL;
     }
 
@@ -353,4 +289,3 @@ int32_t USPStream::freeBuffersLocked()
 
     return 0;
 }
-
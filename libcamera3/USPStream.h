@@ -20,7 +20,8 @@
 #include "MMAPStream.h"
 
 // stream uses user pointer buffers which allocated in user space.
-// that exports physical address.
+// that exports physical address. buffers come from IonPool and are
+// reused by next start.
 class USPStream : public MMAPStream
 {
 public:
@@ -46,7 +47,6 @@ public:
 
 protected:
     int32_t getFormatSize();
-    int32_t mIonFd;
 
 private:
 
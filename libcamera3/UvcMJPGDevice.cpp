@@ -14,18 +14,19 @@
  * limitations under the License.
  */
 
-#include "MJPGStream.h"
 #include "DMAStream.h"
 #include "UvcMJPGDevice.h"
 
 //----------------------UvcMJPGDevice--------------------
 
 UvcMJPGDevice::UvcMJPGDevice(int32_t id, int32_t facing, int32_t orientation,
-                     char* path, bool createStream)
+                     char* path, bool h264, bool createStream)
     : Camera(id, facing, orientation, path)
 {
+    mCodecFormat = h264 ? v4l2_fourcc('H', '2', '6', '4')
+                        : v4l2_fourcc('M', 'J', 'P', 'G');
     if (createStream) {
-        mVideoStream = new UvcStream(this, path);
+        mVideoStream = new UvcStream(this, path, mCodecFormat);
     }
 }
 
@@ -50,7 +51,18 @@ status_t UvcMJPGDevice::initSensorStaticData()
 
     struct v4l2_fmtdesc vid_fmtdesc;
 
-    sensorFormats[index++] = v4l2_fourcc('N', 'V', '1', '6');
+#ifdef BOARD_HAVE_VPU
+    if (mCodecFormat == v4l2_fourcc('H', '2', '6', '4')) {
+        // VPU video output is 4:2:0.
+        sensorFormats[index++] = v4l2_fourcc('N', 'V', '1', '2');
+    }
+    else {
+        sensorFormats[index++] = v4l2_fourcc('N', 'V', '1', '6');
+    }
+#else
+    // CPU decoder writes NV12 as preview and recording take it.
+    sensorFormats[index++] = v4l2_fourcc('N', 'V', '1', '2');
+#endif
 
     mSensorFormatCount = changeSensorFormats(sensorFormats, mSensorFormats, index);
     if (mSensorFormatCount == 0) {
@@ -76,7 +88,7 @@ status_t UvcMJPGDevice::initSensorStaticData()
         memset(TmpStr, 0, 20);
         memset(&vid_frmsize, 0, sizeof(struct v4l2_frmsizeenum));
         vid_frmsize.index        = index++;
-        vid_frmsize.pixel_format = v4l2_fourcc('M', 'J', 'P', 'G');
+        vid_frmsize.pixel_format = mCodecFormat;
         ret = ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &vid_frmsize);
         if (ret != 0) {
             continue;
@@ -161,13 +173,13 @@ int32_t UvcMJPGDevice::UvcStream::onDeviceConfigureLocked()
         }
     }
 
-    return MJPGStream::onDeviceConfigureLocked();
+    return MJPGBaseStream::onDeviceConfigureLocked();
 }
 
 int32_t UvcMJPGDevice::UvcStream::onDeviceStopLocked()
 {
     ALOGI("%s", __func__);
-    int32_t ret = MJPGStream::onDeviceStopLocked();
+    int32_t ret = MJPGBaseStream::onDeviceStopLocked();
     // usb camera must close device after stream off.
     if (mDev > 0) {
         close(mDev);
@@ -180,25 +192,48 @@ int32_t UvcMJPGDevice::UvcStream::onDeviceStopLocked()
 int32_t UvcMJPGDevice::UvcStream::onDeviceStartLocked()
 {
     ALOGI("%s", __func__);
-    return MJPGStream::onDeviceStartLocked();
+    return MJPGBaseStream::onDeviceStartLocked();
 }
 
 int32_t UvcMJPGDevice::UvcStream::onFrameAcquireLocked()
 {
     ALOGV("%s", __func__);
-    return MJPGStream::onFrameAcquireLocked();
+    return MJPGBaseStream::onFrameAcquireLocked();
 }
 
 int32_t UvcMJPGDevice::UvcStream::onFrameReturnLocked(int32_t index, StreamBuffer& buf)
 {
     ALOGV("%s", __func__);
-    return MJPGStream::onFrameReturnLocked(index, buf);
+    return MJPGBaseStream::onFrameReturnLocked(index, buf);
 }
 
+#ifdef BOARD_HAVE_VPU
+int32_t UvcMJPGDevice::getV4l2Res(uint32_t streamWidth, uint32_t streamHeight,
+                                  uint32_t *pV4l2Width, uint32_t *pV4l2Height)
+{
+    if ((pV4l2Width == NULL) || (pV4l2Height == NULL)) {
+        ALOGE("%s, para null", __func__);
+        return BAD_VALUE;
+    }
+
+    // chroma of 1080 rows frame starts after 1088 rows.
+    *pV4l2Width = Align(streamWidth, FRAME_ALIGN);
+    *pV4l2Height = Align(streamHeight, FRAME_ALIGN);
+    return NO_ERROR;
+}
+#endif
+
 // usb camera require the specific buffer size.
 int32_t UvcMJPGDevice::UvcStream::getDeviceBufferSize()
 {
     int32_t size = 0;
+#ifdef BOARD_HAVE_VPU
+    if (isH264()) {
+        // VPU writes co-located motion vectors after chroma.
+        size = Align(mWidth, FRAME_ALIGN) * Align(mHeight, FRAME_ALIGN) * 7 / 4;
+        return size + MJPG_VPU_ALIGN_PAD;
+    }
+#endif
     switch (mFormat) {
         case HAL_PIXEL_FORMAT_YCbCr_420_SP:
             size = ((mWidth + 16) & (~15)) * mHeight * 3 / 2;
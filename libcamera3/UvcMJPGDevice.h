@@ -19,24 +19,47 @@
 
 #include "Camera.h"
 #include "DMAStream.h"
+#ifdef BOARD_HAVE_VPU
 #include "MJPGStream.h"
+// frames are decoded by VPU.
+typedef MJPGStream MJPGBaseStream;
+#else
+#include "SwMJPGStream.h"
+// no VPU, frames are decoded by CPU workers.
+typedef SwMJPGStream MJPGBaseStream;
+#endif
+
+#define UVC_USE_MJPG "uvc_mjpg"
+// frames are taken as H.264 and decoded by VPU.
+#define UVC_USE_H264 "uvc_h264"
 
 class UvcMJPGDevice : public Camera
 {
 public:
+    // h264 takes H.264 frames instead of MJPEG, needs VPU.
     UvcMJPGDevice(int32_t id, int32_t facing, int32_t orientation,
-              char* path, bool createStream = true);
+              char* path, bool h264 = false, bool createStream = true);
     virtual ~UvcMJPGDevice();
     virtual status_t initSensorStaticData();
+#ifdef BOARD_HAVE_VPU
+    // VPU frame planes are spaced by 16 aligned size.
+    virtual int32_t getV4l2Res(uint32_t streamWidth, uint32_t streamHeight,
+                               uint32_t *pV4l2Width, uint32_t *pV4l2Height);
+#endif
     virtual bool isHotplug() {return true;}
 
 protected:
 
-    class UvcStream : public MJPGStream {
+    class UvcStream : public MJPGBaseStream {
         public:
 
-            UvcStream(Camera* device, const char* name)
-                : MJPGStream(device) {
+#ifdef BOARD_HAVE_VPU
+            UvcStream(Camera* device, const char* name, uint32_t codec)
+                : MJPGBaseStream(device, codec) {
+#else
+            UvcStream(Camera* device, const char* name, uint32_t /*codec*/)
+                : MJPGBaseStream(device) {
+#endif
                     strncpy(mUvcPath, name, CAMAERA_FILENAME_LENGTH-1);
             }
             virtual ~UvcStream() {}
@@ -58,6 +81,9 @@ protected:
         protected:
             char mUvcPath[CAMAERA_FILENAME_LENGTH];
     };
+
+    // V4L2 fourcc of compressed frames.
+    uint32_t mCodecFormat;
 };
 
 #endif
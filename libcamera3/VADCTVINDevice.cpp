@@ -14,7 +14,12 @@
  * limitations under the License.
  */
 
+extern "C" {
+#include "pxp_lib.h"
+}
+
 #include "VADCTVINDevice.h"
+#include "ColorConvert.h"
 
 VADCTVINDevice::VADCTVINDevice(int32_t id, int32_t facing, int32_t orientation, char* path)
     : Camera(id, facing, orientation, path)
@@ -27,50 +32,6 @@ VADCTVINDevice::~VADCTVINDevice()
 {
 }
 
-static int32_t convertYUV444toNV12(u8 *inputBuffer,
-        u8 *outputBuffer,
-        int32_t      width,
-        int32_t      height)
-{
-    int32_t line, col;
-    u8 *pbySrcY = inputBuffer + 2;
-    u8 *pbySrcU = inputBuffer + 1;
-    u8 *pbySrcV = inputBuffer;
-    u8 *pbyDstY = outputBuffer;
-    u8 *pbyDstU = outputBuffer + width * height;
-    u8 *pbyDstV = pbyDstU + 1;
-
-    for(line = 0; line < height; line++) {
-
-        for(col = 0; col < width; col++) {
-            *pbyDstY = *pbySrcY;
-
-            pbySrcY += 4;
-            pbyDstY++;
-
-            if((line < height/2) && (col < width/2)) {
-                *pbyDstU = *pbySrcU;
-                *pbyDstV = *pbySrcV;
-
-                //jump 2 pixels each step
-                pbySrcU += 8;
-                pbySrcV += 8;
-
-                pbyDstU += 2;
-                pbyDstV += 2;
-            }
-        }
-
-        // Since already moved 8*width/2 bytes,
-        // so total move width*8 bytes.
-        // It means jump 2 lines each cycle.
-        pbySrcU += width * 4;
-        pbySrcV += width * 4;
-    }
-
-    return 0;
-}
-
 status_t VADCTVINDevice::initSensorStaticData()
 {
     int32_t fd = open(mDevPath, O_RDWR);
@@ -528,7 +489,24 @@ int32_t VADCTVINDevice::VADCTVinStream::onFrameAcquireLocked()
     }
 
     // Do format convert and transfer converted data to stream.
-    int32_t rets = convertYUV444toNV12((u8 *)mV4L2Buffers[cfilledbuffer.index]->mVirtAddr, (u8 *)mBuffers[cfilledbuffer.index]->mVirtAddr, mWidth, mHeight);
+    StreamBuffer* src = mV4L2Buffers[cfilledbuffer.index];
+    StreamBuffer* dst = mBuffers[cfilledbuffer.index];
+    dst->mSensorTimestamp = getV4l2Timestamp(cfilledbuffer.timestamp,
+                                             cfilledbuffer.flags);
+#ifdef PXP_PIX_FMT_VUY444
+    // PXP leaves CPU free, CPU convert is fallback.
+    if (!mPxpFailed && mPxpFd > 0) {
+        if (blitFourccWithPXP(src->mPhyAddr, mWidth, mHeight,
+                PXP_PIX_FMT_VUY444, dst->mPhyAddr, mWidth, mHeight,
+                PXP_PIX_FMT_NV12, true) == 0) {
+            return cfilledbuffer.index;
+        }
+        ALOGW("%s: pxp convert failed, use cpu", __func__);
+        mPxpFailed = true;
+    }
+#endif
+    convertYUV444ToNV12((uint8_t*)src->mVirtAddr, (uint8_t*)dst->mVirtAddr,
+                        mWidth, mHeight);
 
     return cfilledbuffer.index;
 }
@@ -27,13 +27,15 @@ public:
     ~VADCTVINDevice();
 
     virtual status_t initSensorStaticData();
+    // video standard is detected from input signal.
+    virtual bool isStaticInfoCacheable() {return false;}
 
 private:
     class VADCTVinStream : public MMAPStream
     {
         public:
             VADCTVinStream(Camera* device)
-                : MMAPStream(device), mIonFd(-1) {
+                : MMAPStream(device), mIonFd(-1), mPxpFailed(false) {
                     for (uint32_t i=0; i<MAX_STREAM_BUFFERS; i++) {
                         mV4L2Buffers[i] = NULL;
                     }
@@ -51,6 +53,8 @@ private:
             int32_t allocateFrameBuffersLocked();
             // get buffer from V4L2.
             virtual int32_t onFrameAcquireLocked();
+            // each dequeued frame is converted, not worth it for lookahead.
+            virtual bool canLookahead() {return false;}
 
             // allocate buffers.
             virtual int32_t allocateBuffersLocked() {return 0;}
@@ -62,6 +66,8 @@ private:
             //int32_t mIonFd;
         protected:
             int32_t mIonFd;
+            // PXP rejected VADC format, stay on CPU convert.
+            bool mPxpFailed;
         private:
 
     };
@@ -66,6 +66,17 @@ const Entry DemoMagic[demo_magic_end - demo_magic_start] = {
         {"levitation",      TYPE_FLOAT}
 };
 
+const Entry ImxCapture[imx_capture_end - imx_capture_start] = {
+    [imx_capture_burst_mode - imx_capture_start] =
+        {"burstMode",       TYPE_BYTE},
+    [imx_capture_burst_fps - imx_capture_start] =
+        {"burstFps",        TYPE_INT32},
+    [imx_capture_deinterlace - imx_capture_start] =
+        {"deinterlace",     TYPE_BYTE},
+    [imx_capture_frame_time - imx_capture_start] =
+        {"frameTime",       TYPE_INT64}
+};
+
 // Array of all sections
 const Section DemoSections[DEMO_SECTION_COUNT] = {
     [DEMO_WIZARDRY] = { "demo.wizardry",
@@ -79,7 +90,11 @@ const Section DemoSections[DEMO_SECTION_COUNT] = {
     [DEMO_MAGIC]    = { "demo.magic",
                         demo_magic_start,
                         demo_magic_end,
-                        DemoMagic }
+                        DemoMagic },
+    [IMX_CAPTURE]   = { "imx.capture",
+                        imx_capture_start,
+                        imx_capture_end,
+                        ImxCapture }
 };
 
 // Get a static handle to a specific vendor tag section
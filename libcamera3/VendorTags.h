@@ -45,6 +45,7 @@ enum {
     DEMO_WIZARDRY,
     DEMO_SORCERY,
     DEMO_MAGIC,
+    IMX_CAPTURE,
     DEMO_SECTION_COUNT
 };
 
@@ -54,6 +55,7 @@ const uint32_t vendor_section_start = VENDOR_SECTION_START;
 const uint32_t demo_wizardry_start = (DEMO_WIZARDRY + VENDOR_SECTION) << 16;
 const uint32_t demo_sorcery_start  = (DEMO_SORCERY  + VENDOR_SECTION) << 16;
 const uint32_t demo_magic_start    = (DEMO_MAGIC    + VENDOR_SECTION) << 16;
+const uint32_t imx_capture_start   = (IMX_CAPTURE   + VENDOR_SECTION) << 16;
 
 // Vendor Tag values, start value begins each section
 const uint32_t demo_wizardry_dimension_size = demo_wizardry_start;
@@ -70,4 +72,13 @@ const uint32_t demo_magic_card_trick = demo_magic_start;
 const uint32_t demo_magic_levitation = demo_magic_start + 1;
 const uint32_t demo_magic_end = demo_magic_start + 2;
 
+// burst capture keeps sensor at still size, burstFps paces jpeg output.
+const uint32_t imx_capture_burst_mode = imx_capture_start;
+const uint32_t imx_capture_burst_fps = imx_capture_start + 1;
+// byte, DEINTERLACE_* mode for interlaced analog sources.
+const uint32_t imx_capture_deinterlace = imx_capture_start + 2;
+// int64 result, CLOCK_MONOTONIC V4L2 time of frame in latency mode.
+const uint32_t imx_capture_frame_time = imx_capture_start + 3;
+const uint32_t imx_capture_end = imx_capture_start + 4;
+
 #endif // VENDOR_TAGS_H_
@@ -14,17 +14,63 @@
  * limitations under the License.
  */
 
+#define ATRACE_TAG (ATRACE_TAG_CAMERA | ATRACE_TAG_HAL)
+#include <inttypes.h>
+#include <latency_mark_ext.h>
+#include <poll.h>
+#include <rearview_ext.h>
+#include <sync/sync.h>
+#include <utils/Trace.h>
 #include "VideoStream.h"
+#include "ColorConvert.h"
+#include "VendorTags.h"
 
 using namespace android;
 
 VideoStream::VideoStream(Camera* device)
     : Stream(device), mState(STATE_INVALID),
+      mClients(0), mConfigClient(0), mNextClient(0),
       mChanged(false), mDev(-1),
-      mAllocatedBuffers(0)
+      mAllocatedBuffers(0), mJpegHeld(0), mReprocessNum(0), mDirectNum(0), mInFlight(0), mPipeExit(false),
+      mFlushing(0), mProcessBusy(false),
+      mFieldHistory(NULL), mFieldHistorySize(0), mFieldHistoryValid(false),
+      mLookaheadNum(0), mLookahead(0), mLookaheadError(false),
+      mZslNum(0), mZslDepth(0), mZslFrameNum(DEFAULT_ZSL_FRAMES),
+      mHoldTime(0), mRingBudget((size_t)DEFAULT_RING_BUDGET << 20),
+      mLatencyMark(false)
 {
+    memset(mFlushAsked, 0, sizeof(mFlushAsked));
+    memset(mFlushDone, 0, sizeof(mFlushDone));
+    memset(mLookaheadFrames, 0, sizeof(mLookaheadFrames));
+    memset(mZslFrames, 0, sizeof(mZslFrames));
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("rw.camera.lookahead", value, "0");
+    int32_t lookahead = atoi(value);
+    if (lookahead > 0) {
+        mLookahead = lookahead < MAX_LOOKAHEAD_FRAMES ? lookahead
+                                                      : MAX_LOOKAHEAD_FRAMES;
+    }
+
+    property_get("rw.camera.zsl.frames", value, "");
+    if (value[0] != '\0') {
+        int32_t zsl = atoi(value);
+        mZslFrameNum = zsl <= 0 ? 0 : (zsl < MAX_ZSL_FRAMES ? zsl
+                                                            : MAX_ZSL_FRAMES);
+    }
+
+    property_get("rw.camera.ring.budget", value, "");
+    if (atoi(value) > 0) {
+        mRingBudget = (size_t)atoi(value) << 20;
+    }
+
+    property_get(LATENCY_MARK_PROP, value, "0");
+    mLatencyMark = atoi(value) != 0;
     g2dHandle = NULL;
+    mJpegG2dHandle = NULL;
     mMessageThread = new MessageThread(this);
+    mProcessThread = new ProcessThread(this, false);
+    mJpegThread = new ProcessThread(this, true);
 }
 
 VideoStream::~VideoStream()
@@ -35,6 +81,11 @@ VideoStream::~VideoStream()
     mMessageQueue.clearCommands();
     mMessageThread.clear();
     mMessageThread = NULL;
+    mProcessThread.clear();
+    mProcessThread = NULL;
+    mJpegThread.clear();
+    mJpegThread = NULL;
+    free(mFieldHistory);
 }
 
 void VideoStream::destroyStream()
@@ -49,33 +100,98 @@ void VideoStream::destroyStream()
     }
 
     if (mMessageThread != NULL && mMessageThread->isRunning()) {
-        mMessageQueue.postMessage(new CMessage(MSG_EXIT, 1), 1);
+        mMessageQueue.postMessage(MSG_EXIT, 1, 1);
         mMessageThread->requestExit();
         mMessageThread->join();
     }
+
+    {
+        Mutex::Autolock _l(mPipeLock);
+        mPipeExit = true;
+        mPipeCondition.broadcast();
+    }
+
+    if (mProcessThread != NULL && mProcessThread->isRunning()) {
+        mProcessThread->requestExit();
+        mProcessThread->join();
+    }
+
+    if (mJpegThread != NULL && mJpegThread->isRunning()) {
+        mJpegThread->requestExit();
+        mJpegThread->join();
+    }
     ALOGI("%s finished!!", __func__);
 }
 
-int32_t VideoStream::openDev(const char* name)
+int32_t VideoStream::openDev(const char* name, uint32_t client)
 {
-    ALOGI("%s", __func__);
-    if (name == NULL) {
-        ALOGE("invalid dev name");
+    ALOGI("%s client:%d", __func__, client);
+    if (name == NULL || client >= MAX_SHARED_CLIENTS) {
+        ALOGE("invalid dev name or client");
         return BAD_VALUE;
     }
 
     Mutex::Autolock lock(mLock);
 
+    if (mClients != 0) {
+        // sensor is already streaming for another logical camera.
+        mClients |= 1 << client;
+        return 0;
+    }
+
+    // early rear view may still stream this sensor.
+    rearview_release(name, REARVIEW_RELEASE_TIMEOUT);
     mDev = open(name, O_RDWR);
     if (mDev <= 0) {
         ALOGE("%s can not open camera devpath:%s", __func__, name);
         return BAD_VALUE;
     }
 
+    mClients = 1 << client;
+    mConfigClient = client;
+
     return 0;
 }
 
-int32_t VideoStream::configure(sp<Stream> stream)
+uint32_t VideoStream::getRingDepthLocked(sp<Stream>& stream, int32_t format,
+                                         int32_t fps)
+{
+    uint32_t depth = stream->bufferNum();
+    if (mHoldTime > 0 && fps > 0 && !mCamera->isHighSpeed()) {
+        // high speed batches keep stream count.
+        nsecs_t period = s2ns(1) / fps;
+        depth = (uint32_t)((mHoldTime + period - 1) / period) + 2;
+    }
+
+    size_t frame = (size_t)stream->width() * stream->height();
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_420_P:
+            frame = frame * 3 / 2;
+            break;
+        default:
+            frame = frame * 2;
+            break;
+    }
+
+    uint32_t limit = frame > 0 ? mRingBudget / frame : MAX_STREAM_BUFFERS;
+    if (depth > limit) {
+        depth = limit;
+    }
+    if (depth < RING_MIN_BUFFERS) {
+        depth = RING_MIN_BUFFERS;
+    }
+    if (depth > MAX_STREAM_BUFFERS) {
+        depth = MAX_STREAM_BUFFERS;
+    }
+
+    ALOGI("%s: %d buffers, hold %" PRId64 " us, budget limit %d", __func__,
+          depth, ns2us(mHoldTime), limit);
+    return depth;
+}
+
+int32_t VideoStream::configure(sp<Stream> stream, uint32_t client, bool zsl)
 {
     ALOGV("%s", __func__);
     if ((stream->width() == 0) || (stream->height() == 0)
@@ -88,17 +204,39 @@ int32_t VideoStream::configure(sp<Stream> stream)
 
     Mutex::Autolock lock(mLock);
 
+    if (client != mConfigClient && (mClients & ~(1 << client)) != 0) {
+        // don't restart sensor under other clients, scale instead.
+        ALOGV("%s: client %d uses sensor mode of client %d", __func__,
+              client, mConfigClient);
+        return 0;
+    }
+
     ConfigureParam* params = new ConfigureParam();
     params->mWidth  = stream->width();
     params->mHeight = stream->height();
     params->mFormat = sensorFormat;
     params->mFps = stream->fps();
-    params->mBuffers = stream->bufferNum();
+    // framework buffers of direct stream are queued in V4L2 slots.
+    params->mBuffers = stream->isDirect() ? NUM_DIRECT_BUFFER
+                       : getRingDepthLocked(stream, sensorFormat, params->mFps);
+    if (!stream->isDirect() && canLookahead()) {
+        // lookahead frames come on top of pipeline buffers.
+        params->mBuffers += mLookahead;
+    }
     params->mIsJpeg = stream->isJpeg();
+    // zsl frames stay dequeued on top of pipeline buffers.
+    params->mZsl = zsl ? mZslFrameNum : 0;
+    params->mBuffers += params->mZsl;
+    if (params->mBuffers > MAX_STREAM_BUFFERS) {
+        params->mBuffers = MAX_STREAM_BUFFERS;
+    }
 
     ALOGI("%s: w:%d, h:%d, sensor format:0x%x, stream format:0x%x, fps:%d, num:%d",
            __func__, params->mWidth, params->mHeight, params->mFormat, stream->format(), params->mFps, params->mBuffers);
-    mMessageQueue.postMessage(new CMessage(MSG_CONFIG, (uintptr_t)params), 0);
+    if (mMessageQueue.postMessage(MSG_CONFIG, (intptr_t)params, 0) != 0) {
+        delete params;
+        return BAD_VALUE;
+    }
 
     return 0;
 }
@@ -114,13 +252,33 @@ int32_t VideoStream::handleConfigureLocked(ConfigureParam* params)
     }
 
     // when width&height&format are same, keep it to reduce start/stop time.
-    if ((mWidth == params->mWidth) && (mHeight == params->mHeight)
-         && (mFormat == params->mFormat)  && (params->mIsJpeg || (mFps == params->mFps))) {
+    // consumer streams added or removed keep sensor mode and buffers.
+    bool sameMode = (mWidth == params->mWidth) &&
+                    (mHeight == params->mHeight) &&
+                    (mFormat == params->mFormat) &&
+                    (mZslDepth == (uint32_t)params->mZsl);
+    if (sameMode && (params->mIsJpeg || getDeviceFps(mWidth, mHeight, mFps)
+                     == getDeviceFps(mWidth, mHeight, params->mFps))) {
         ALOGI("%s, same config, res %dx%d, fmt 0x%x, fps %d, %d, jpg %d",
           __func__, mWidth, mHeight, mFormat, mFps, params->mFps, params->mIsJpeg);
+        if (!params->mIsJpeg) {
+            mFps = params->mFps;
+        }
         return 0;
     }
 
+    if (sameMode && mState != STATE_INVALID && mState != STATE_ERROR) {
+        // only frame rate changes, device takes it while streaming.
+        int32_t fps = mFps;
+        mFps = params->mFps;
+        if (onDeviceRateLocked() == 0) {
+            ALOGI("%s, rate %d -> %d, stream kept", __func__, fps, mFps);
+            return 0;
+        }
+        mFps = fps;
+        ALOGI("%s, rate change needs full configure", __func__);
+    }
+
     mChanged = true;
 
     // add start state to go into config state.
@@ -145,6 +303,7 @@ int32_t VideoStream::handleConfigureLocked(ConfigureParam* params)
     mFormat = params->mFormat;
     mFps = params->mFps;
     mNumBuffers = params->mBuffers;
+    mZslDepth = params->mZsl;
 
     ret = onDeviceConfigureLocked();
     if (ret != 0) {
@@ -184,17 +343,27 @@ int32_t VideoStream::handleStartLocked(bool force)
     }
 
     mState = STATE_START;
+    mLookaheadError = false;
 
     return 0;
 }
 
-int32_t VideoStream::closeDev()
+int32_t VideoStream::closeDev(uint32_t client)
 {
-    ALOGI("%s", __func__);
+    ALOGI("%s client:%d", __func__, client);
     Mutex::Autolock lock(mLock);
 
+    mClients &= ~(1 << client);
+    if (mClients != 0) {
+        // other clients keep sensor streaming.
+        if (client == mConfigClient) {
+            mConfigClient = __builtin_ctz(mClients);
+        }
+        return 0;
+    }
+
     if (mState != STATE_ERROR && mMessageThread->isRunning()) {
-        mMessageQueue.postMessage(new CMessage(MSG_CLOSE, 0), 1);
+        mMessageQueue.postMessage(MSG_CLOSE, 0, 1);
     }
     else {
         ALOGI("%s thread is exit", __func__);
@@ -207,6 +376,112 @@ int32_t VideoStream::closeDev()
     return 0;
 }
 
+int32_t VideoStream::flush(uint32_t client)
+{
+    ALOGI("%s client:%d", __func__, client);
+    if (client >= MAX_SHARED_CLIENTS) {
+        return BAD_VALUE;
+    }
+
+    uint32_t seq;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        seq = ++mFlushAsked[client];
+    }
+
+    // command goes before frame messages already queued.
+    if (mMessageThread == NULL || !mMessageThread->isRunning() ||
+        mMessageQueue.postMessage(MSG_FLUSH, client, 1) != 0) {
+        return 0;
+    }
+
+    Mutex::Autolock _l(mPipeLock);
+    while ((int32_t)(mFlushDone[client] - seq) < 0 && !mPipeExit) {
+        if (mPipeCondition.waitRelative(mPipeLock,
+                ms2ns(CAMERA_SYNC_TIMEOUT)) == TIMED_OUT) {
+            ALOGE("%s: client %d flush timeout", __func__, client);
+            return -ENODEV;
+        }
+    }
+
+    return 0;
+}
+
+void VideoStream::handleFlushLocked(uint32_t client)
+{
+    uint32_t seq;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        seq = mFlushAsked[client];
+        mFlushing |= 1 << client;
+    }
+
+    // requests not started yet are failed whole.
+    sp<CaptureRequest> req = NULL;
+    uint32_t dropped = 0;
+    while (mRequests[client].pop(req)) {
+        req->onRequestError();
+        dropped++;
+    }
+
+    // direct buffers are in V4L2 queue, take them back as frames come
+    // and keep slot queued with own buffer.
+    while (mState == STATE_START && mDirectNum > 0) {
+        int32_t index = onFrameAcquireLocked();
+        if (index < 0 || index >= MAX_STREAM_BUFFERS) {
+            ALOGW("%s: %d direct buffers not back", __func__, mDirectNum);
+            break;
+        }
+
+        CaptureFrame& slot = mDirectFrames[index];
+        if (slot.mRequest != NULL) {
+            Mutex::Autolock _l(mPipeLock);
+            slot.mError = true;
+            mPendingFrames.push_back(slot);
+            slot = CaptureFrame();
+            mDirectNum--;
+            mPipeCondition.broadcast();
+        }
+        onFrameReturnLocked(index, *mBuffers[index]);
+    }
+
+    // frames in process finish fast, their outputs are failed by
+    // process and jpeg threads. PXP job in flight is waited.
+    flushPipelineLocked();
+
+    Mutex::Autolock _l(mPipeLock);
+    while ((!mPendingFrames.empty() || mProcessBusy ||
+            mAsyncFrame.mRequest != NULL) && !mPipeExit) {
+        mPipeCondition.wait(mPipeLock);
+    }
+
+    mFlushing &= ~(1 << client);
+    mFlushDone[client] = seq;
+    mPipeCondition.broadcast();
+    ALOGI("%s client:%d, %d requests dropped", __func__, client, dropped);
+}
+
+bool VideoStream::dropFlushedFrame(CaptureFrame& frame, bool jpegOnly)
+{
+    {
+        Mutex::Autolock _l(mPipeLock);
+        if (!(mFlushing & (1 << frame.mClient))) {
+            return false;
+        }
+    }
+
+    sp<CaptureRequest>& req = frame.mRequest;
+    for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+        StreamBuffer* out = req->mOutBuffers[i];
+        if (jpegOnly && !out->mStream->isJpeg()) {
+            continue;
+        }
+        req->onCaptureError(out);
+    }
+
+    return true;
+}
+
 int32_t VideoStream::handleStopLocked(bool force)
 {
     int32_t ret = 0;
@@ -218,7 +493,14 @@ int32_t VideoStream::handleStopLocked(bool force)
         return 0;
     }
 
+    // frames in process must be back before stream off.
+    flushPipelineLocked();
+    flushLookaheadLocked();
+    flushZslLocked();
+    // next frame after restart has no previous field.
+    mFieldHistoryValid = false;
     ret = onDeviceStopLocked();
+    flushDirectLocked();
     if (ret < 0) {
         mState = STATE_ERROR;
         ALOGE("StopStreaming: Unable to stop capture: %s", strerror(errno));
@@ -239,7 +521,9 @@ int32_t VideoStream::handleStopLocked(bool force)
         // clear request messages.
         mMessageQueue.clearMessages();
         // clear capture request.
-        mRequests.clear();
+        for (uint32_t i = 0; i < MAX_SHARED_CLIENTS; i++) {
+            mRequests[i].clear();
+        }
         // to do configure agian.
         mWidth = 0;
     }
@@ -247,15 +531,19 @@ int32_t VideoStream::handleStopLocked(bool force)
     return ret;
 }
 
-int32_t VideoStream::requestCapture(sp<CaptureRequest> req)
+int32_t VideoStream::requestCapture(sp<CaptureRequest> req, uint32_t client)
 {
-    Mutex::Autolock lock(mLock);
-
-    mRequests.push_back(req);
+    if (client >= MAX_SHARED_CLIENTS) {
+        return BAD_VALUE;
+    }
 
-    mMessageQueue.postMessage(new CMessage(MSG_FRAME, 0));
+    // framework thread of client is the only producer, no lock needed.
+    if (!mRequests[client].push(req)) {
+        ALOGE("%s request ring full, fm:%d", __func__, req->mFrameNumber);
+        return BAD_VALUE;
+    }
 
-    return 0;
+    return mMessageQueue.postMessage(MSG_FRAME, 0);
 }
 
 StreamBuffer* VideoStream::acquireFrameLocked()
@@ -266,13 +554,289 @@ StreamBuffer* VideoStream::acquireFrameLocked()
         return NULL;
     }
 
+    mBuffers[index]->mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
     return mBuffers[index];
 }
 
+StreamBuffer* VideoStream::getDirectOutputLocked(sp<CaptureRequest> req)
+{
+    // V4L2 buffer can't be shared with other clients.
+    if ((mClients & (mClients - 1)) != 0) {
+        return NULL;
+    }
+
+    // fields are rebuilt in V4L2 buffer before output.
+    if (isInterlaced() && getDeinterlaceMode(req) != DEINTERLACE_WEAVE) {
+        return NULL;
+    }
+
+    StreamBuffer* direct = NULL;
+    for (uint32_t i = 0; i < req->mOutBuffersNumber; i++) {
+        StreamBuffer* out = req->mOutBuffers[i];
+        sp<Stream>& stream = out->mStream;
+        // jpeg keeps source frame until encoded, after output is gone.
+        if (stream->isJpeg()) {
+            return NULL;
+        }
+        if (direct == NULL && stream->isDirect() && out->mFd >= 0 &&
+                stream->width() == mWidth && stream->height() == mHeight &&
+                stream->format() == mFormat) {
+            direct = out;
+        }
+    }
+
+    return direct;
+}
+
+StreamBuffer* VideoStream::acquireCaptureLocked(sp<CaptureRequest> req,
+                                                bool* queued)
+{
+    StreamBuffer* direct = getDirectOutputLocked(req);
+
+    *queued = false;
+    while (true) {
+        int32_t index = onFrameAcquireLocked();
+        if (index >= MAX_STREAM_BUFFERS || index < 0) {
+            ALOGE("%s: invalid index %d", __func__, index);
+            return NULL;
+        }
+
+        CaptureFrame& slot = mDirectFrames[index];
+        bool filled = (slot.mRequest == NULL);
+        if (!filled) {
+            // frame is in request buffer, send it in frame order.
+            slot.mRequest->mTimestamps[FRAME_DEQUEUED] =
+                    systemTime(SYSTEM_TIME_MONOTONIC);
+            if (mLatencyMark) {
+                // result went out when capture was queued, pixels
+                // carry driver time of the frame.
+                slot.mRequest->mCaptureTime =
+                        getMonotonicTime(mBuffers[index]->mSensorTimestamp);
+            }
+            Mutex::Autolock _l(mPipeLock);
+            mPendingFrames.push_back(slot);
+            mPipeCondition.broadcast();
+            slot = CaptureFrame();
+            mDirectNum--;
+        }
+
+        if (direct != NULL && direct->mAcquireFence != -1) {
+            // capture thread doesn't wait for consumer, busy buffer is
+            // filled by copy once its fence signals.
+            if (sync_wait(direct->mAcquireFence, 0) != 0) {
+                ALOGV("%s: direct buffer still in use", __func__);
+                direct = NULL;
+            }
+            else {
+                close(direct->mAcquireFence);
+                direct->mAcquireFence = -1;
+            }
+        }
+
+        if (direct != NULL) {
+            StreamBuffer* out = direct;
+            if (onDirectReturnLocked(index, *out) == 0) {
+                // frame of own buffer is dropped to start direct capture.
+                slot.mRequest = req;
+                slot.mOutput = out;
+                mDirectNum++;
+                *queued = true;
+                return NULL;
+            }
+            direct = NULL;
+        }
+
+        // older direct requests complete before this one.
+        if (filled && mDirectNum == 0) {
+            mBuffers[index]->mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+            return mBuffers[index];
+        }
+
+        onFrameReturnLocked(index, *mBuffers[index]);
+    }
+}
+
+bool VideoStream::isLookaheadLocked()
+{
+    if (mLookahead == 0 || mLookaheadError || mState != STATE_START ||
+        mDirectNum > 0 || !canLookahead()) {
+        return false;
+    }
+
+    // full ring swaps its oldest frame for the new one.
+    if (mLookaheadNum >= mLookahead) {
+        return true;
+    }
+
+    uint32_t inFlight;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        inFlight = mInFlight;
+    }
+    // at least one buffer stays queued in V4L2.
+    return inFlight + mLookaheadNum + mZslNum + 1 < mNumBuffers;
+}
+
+void VideoStream::fillLookaheadLocked()
+{
+    while (isLookaheadLocked()) {
+        struct pollfd fds;
+        fds.fd = mDev;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        if (poll(&fds, 1, 0) <= 0) {
+            break;
+        }
+
+        StreamBuffer* buf = NULL;
+        if ((fds.revents & POLLIN) != 0) {
+            buf = acquireFrameLocked();
+        }
+        if (buf == NULL) {
+            ALOGW("%s dequeue failed, lookahead off", __func__);
+            mLookaheadError = true;
+            break;
+        }
+
+        if (mLookaheadNum >= mLookahead) {
+            returnFrameLocked(*mLookaheadFrames[0]);
+            mLookaheadNum--;
+            memmove(&mLookaheadFrames[0], &mLookaheadFrames[1],
+                    mLookaheadNum * sizeof(mLookaheadFrames[0]));
+        }
+        mLookaheadFrames[mLookaheadNum++] = buf;
+    }
+    ATRACE_INT("cam lookahead", mLookaheadNum);
+}
+
+StreamBuffer* VideoStream::takeLookaheadLocked()
+{
+    // frames became ready since last wakeup.
+    fillLookaheadLocked();
+    if (mLookaheadNum == 0) {
+        return NULL;
+    }
+
+    // newest frame serves request, older ones are stale.
+    mLookaheadNum--;
+    StreamBuffer* buf = mLookaheadFrames[mLookaheadNum];
+    flushLookaheadLocked();
+
+    return buf;
+}
+
+void VideoStream::flushLookaheadLocked()
+{
+    for (uint32_t i = 0; i < mLookaheadNum; i++) {
+        returnFrameLocked(*mLookaheadFrames[i]);
+    }
+    mLookaheadNum = 0;
+    ATRACE_INT("cam lookahead", 0);
+}
+
+bool VideoStream::isZslCapture(sp<CaptureRequest> req)
+{
+    return mZslDepth > 0 && hasJpegOutput(req);
+}
+
+void VideoStream::keepZslFrameLocked(StreamBuffer* buf)
+{
+    // frames used by stills come back after newer ones.
+    uint32_t pos = mZslNum;
+    while (pos > 0 && mZslFrames[pos - 1]->mTimestamp > buf->mTimestamp) {
+        pos--;
+    }
+
+    if (mZslNum < mZslDepth) {
+        memmove(&mZslFrames[pos + 1], &mZslFrames[pos],
+                (mZslNum - pos) * sizeof(mZslFrames[0]));
+        mZslFrames[pos] = buf;
+        mZslNum++;
+        return;
+    }
+
+    if (pos == 0) {
+        // older than all kept frames.
+        returnFrameLocked(*buf);
+        return;
+    }
+
+    returnFrameLocked(*mZslFrames[0]);
+    memmove(&mZslFrames[0], &mZslFrames[1],
+            (pos - 1) * sizeof(mZslFrames[0]));
+    mZslFrames[pos - 1] = buf;
+}
+
+StreamBuffer* VideoStream::takeZslLocked(nsecs_t shutter)
+{
+    if (mZslNum == 0) {
+        return NULL;
+    }
+
+    uint32_t best = 0;
+    nsecs_t bestDiff = -1;
+    for (uint32_t i = 0; i < mZslNum; i++) {
+        nsecs_t diff = mZslFrames[i]->mTimestamp - shutter;
+        if (diff < 0) {
+            diff = -diff;
+        }
+        if (bestDiff < 0 || diff < bestDiff) {
+            best = i;
+            bestDiff = diff;
+        }
+    }
+
+    StreamBuffer* buf = mZslFrames[best];
+    mZslNum--;
+    memmove(&mZslFrames[best], &mZslFrames[best + 1],
+            (mZslNum - best) * sizeof(mZslFrames[0]));
+    ALOGV("%s frame %" PRId64 "us from shutter", __func__, bestDiff / 1000);
+
+    return buf;
+}
+
+void VideoStream::flushZslLocked()
+{
+    for (uint32_t i = 0; i < mZslNum; i++) {
+        returnFrameLocked(*mZslFrames[i]);
+    }
+    mZslNum = 0;
+}
+
+void VideoStream::flushDirectLocked()
+{
+    Mutex::Autolock _l(mPipeLock);
+    for (uint32_t i = 0; i < MAX_STREAM_BUFFERS && mDirectNum > 0; i++) {
+        CaptureFrame& slot = mDirectFrames[i];
+        if (slot.mRequest == NULL) {
+            continue;
+        }
+
+        slot.mError = true;
+        mPendingFrames.push_back(slot);
+        slot = CaptureFrame();
+        mDirectNum--;
+    }
+    mPipeCondition.broadcast();
+}
+
 int32_t VideoStream::getBufferIndexLocked(StreamBuffer& buf)
 {
+    return getBufferIndexByPhyLocked(buf.mPhyAddr);
+}
+
+int32_t VideoStream::getBufferIndexByPhyLocked(int32_t phys)
+{
+    int32_t index = mBufferMap.find(phys);
+    if (index >= 0 && (uint32_t)index < mNumBuffers &&
+            mBuffers[index] != NULL && mBuffers[index]->mPhyAddr == phys) {
+        return index;
+    }
+
+    // buffers were reallocated, learn new index once.
     for (uint32_t i=0; i<mNumBuffers; i++) {
-        if (mBuffers[i]->mPhyAddr == buf.mPhyAddr) {
+        if (mBuffers[i] != NULL && mBuffers[i]->mPhyAddr == phys) {
+            mBufferMap.add(phys, i);
             return i;
         }
     }
@@ -288,86 +852,744 @@ int32_t VideoStream::returnFrameLocked(StreamBuffer& buf)
         return BAD_VALUE;
     }
 
+    buf.mDeinterlaced = false;
     return onFrameReturnLocked(i, buf);
 }
 
 int32_t VideoStream::handleCaptureFrame()
 {
+    ATRACE_CALL();
     int32_t ret = 0;
     ALOGV("%s", __func__);
 
-    List< sp<CaptureRequest> >::iterator cur;
     sp<CaptureRequest> req = NULL;
     StreamBuffer *buf = NULL;
-    {
-        Mutex::Autolock lock(mLock);
-        if (mRequests.empty()) {
-            return 0;
-        }
-
-        cur = mRequests.begin();
-        req = *cur;
+    uint32_t client = 0;
+    if (!popRequest(req, &client)) {
+        return 0;
     }
+
     //advanced character.
-    ret = processCaptureSettings(req);
-    if (ret != 0) {
+    req->mTimestamps[FRAME_STARTED] = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (req->mInputBuffer != NULL) {
+        return handleReprocessFrame(req, client);
+    }
+
+    StreamBuffer* zsl = NULL;
+    if (isZslCapture(req)) {
+        // frames processed meanwhile are candidates too.
+        returnDoneFrames(false);
         Mutex::Autolock lock(mLock);
-        mRequests.erase(cur);
-        ALOGE("processSettings failed");
-        return 0;
+        zsl = takeZslLocked(req->mTimestamps[FRAME_QUEUED]);
     }
+    req->mTimestamps[FRAME_SETTINGS] = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // keep V4L2 queue from running empty.
+    returnDoneFrames(true);
 
+    bool queued = false;
     {
         Mutex::Autolock lock(mLock);
-        buf = acquireFrameLocked();
+        if (zsl != NULL) {
+            // frame captured around shutter time, encoded in jpeg thread.
+            buf = zsl;
+        }
+        else if (getDirectOutputLocked(req) != NULL) {
+            // V4L2 slots are needed to capture into request buffer.
+            flushLookaheadLocked();
+        }
+        else {
+            buf = takeLookaheadLocked();
+        }
+
+        if (buf == NULL) {
+            buf = acquireCaptureLocked(req, &queued);
+        }
+    }
+
+    if (queued) {
+        // request completes when V4L2 fills its buffer, its frame is not
+        // captured yet so shutter takes current time.
+        if (processCaptureSettings(req, client) != 0) {
+            ALOGE("processSettings failed");
+        }
+        return 0;
     }
 
     if (buf == NULL) {
         ALOGE("acquireFrameLocked failed");
         req->onCaptureError();
-        Mutex::Autolock lock(mLock);
-        mRequests.erase(cur);
         return 0;
     }
 
-    ret = processCaptureRequest(*buf, req);
+    // shutter and result carry driver time of the frame.
+    req->mTimestamps[FRAME_DEQUEUED] = systemTime(SYSTEM_TIME_MONOTONIC);
+    ret = processCaptureSettings(req, client, buf->mSensorTimestamp);
     if (ret != 0) {
+        ALOGE("processSettings failed");
         Mutex::Autolock lock(mLock);
-        returnFrameLocked(*buf);
-        ALOGE("processRequest failed");
+        if (zsl != NULL) {
+            keepZslFrameLocked(zsl);
+        }
+        else {
+            returnFrameLocked(*buf);
+        }
+        return 0;
+    }
+
+    CaptureFrame frame;
+    frame.mRequest = req;
+    frame.mBuffer = buf;
+    frame.mClient = client;
+    List<CaptureFrame> frames;
+    frames.push_back(frame);
+    shareFrame(buf, client, frames);
+    buf->mRefs = frames.size();
+
+    Mutex::Autolock _l(mPipeLock);
+    for (List<CaptureFrame>::iterator it = frames.begin();
+         it != frames.end(); it++) {
+        mPendingFrames.push_back(*it);
+    }
+    // counts V4L2 buffers, not frames of shared clients.
+    mInFlight++;
+    ATRACE_INT("cam pending frames", mPendingFrames.size());
+    ATRACE_INT("cam in flight", mInFlight);
+    mPipeCondition.broadcast();
+
+    return 0;
+}
+
+int32_t VideoStream::handleReprocessFrame(sp<CaptureRequest> req,
+                                          uint32_t client)
+{
+    // result keeps sensor timestamp of the frame input came from.
+    nsecs_t timestamp = 0;
+    if (req->mSettings != NULL) {
+        camera_metadata_entry_t entry = req->mSettings->find(ANDROID_SENSOR_TIMESTAMP);
+        if (entry.count > 0) {
+            timestamp = entry.data.i64[0];
+        }
+    }
+
+    int32_t ret = processCaptureSettings(req, client, timestamp);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    req->mTimestamps[FRAME_SETTINGS] = now;
+    req->mTimestamps[FRAME_DEQUEUED] = now;
+    if (ret != 0) {
+        ALOGE("%s processSettings failed, fm:%d", __func__, req->mFrameNumber);
+        req->onCaptureError();
         return 0;
     }
 
+    // only yuv to jpeg is advertised for reprocessing.
+    for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+        StreamBuffer* out = req->mOutBuffers[i];
+        if (!out->mStream->isJpeg()) {
+            req->onCaptureError(out);
+        }
+    }
+
+    CaptureFrame frame;
+    frame.mRequest = req;
+    frame.mBuffer = req->mInputBuffer;
+    frame.mReprocess = true;
+    frame.mClient = client;
+
+    // sensor pipeline is not involved, no V4L2 buffer is held.
+    Mutex::Autolock _l(mPipeLock);
+    mJpegFrames.push_back(frame);
+    mReprocessNum++;
+    ATRACE_INT("cam jpeg frames", mJpegFrames.size());
+    mPipeCondition.broadcast();
+
+    return 0;
+}
+
+bool VideoStream::popRequest(sp<CaptureRequest>& req, uint32_t* client)
+{
+    // capture thread is the only consumer.
+    for (uint32_t i = 0; i < MAX_SHARED_CLIENTS; i++) {
+        uint32_t index = (mNextClient + i) % MAX_SHARED_CLIENTS;
+        if (mRequests[index].pop(req)) {
+            *client = index;
+            mNextClient = (index + 1) % MAX_SHARED_CLIENTS;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void VideoStream::shareFrame(StreamBuffer* buf, uint32_t client,
+                             List<CaptureFrame>& frames)
+{
+    for (uint32_t i = 0; i < MAX_SHARED_CLIENTS; i++) {
+        sp<CaptureRequest> req = NULL;
+        if (i == client || !mRequests[i].pop(req)) {
+            continue;
+        }
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        req->mTimestamps[FRAME_STARTED] = now;
+        if (processCaptureSettings(req, i, buf->mSensorTimestamp) != 0) {
+            ALOGE("%s processSettings failed, fm:%d", __func__,
+                  req->mFrameNumber);
+            req->onCaptureError();
+            continue;
+        }
+        now = systemTime(SYSTEM_TIME_MONOTONIC);
+        req->mTimestamps[FRAME_SETTINGS] = now;
+        req->mTimestamps[FRAME_DEQUEUED] = now;
+
+        CaptureFrame frame;
+        frame.mRequest = req;
+        frame.mBuffer = buf;
+        frame.mClient = i;
+        frames.push_back(frame);
+    }
+}
+
+int32_t VideoStream::handleProcessFrame()
+{
+    CaptureFrame frame;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        while (mPendingFrames.empty() && !mPipeExit &&
+               mAsyncFrame.mRequest == NULL) {
+            mPipeCondition.wait(mPipeLock);
+        }
+
+        if (mPendingFrames.empty() && mAsyncFrame.mRequest != NULL) {
+            // nothing to overlap with, complete background job now.
+            frame = mAsyncFrame;
+            mAsyncFrame = CaptureFrame();
+        }
+        else if (mPendingFrames.empty()) {
+            return -1;
+        }
+        else {
+            frame = *mPendingFrames.begin();
+            mPendingFrames.erase(mPendingFrames.begin());
+            ATRACE_INT("cam pending frames", mPendingFrames.size());
+        }
+        // flush waits until frame taken here is done.
+        mProcessBusy = true;
+    }
+
+    processFrame(frame);
+
+    Mutex::Autolock _l(mPipeLock);
+    mProcessBusy = false;
+    mPipeCondition.broadcast();
+    return 0;
+}
+
+void VideoStream::processFrame(CaptureFrame& frame)
+{
+    if (frame.mPending != NULL) {
+        finishFrame(frame, 0);
+        return;
+    }
+
+    if (frame.mBuffer == NULL) {
+        // V4L2 captured into output buffer directly.
+        CaptureFrame last = mAsyncFrame;
+        if (last.mRequest != NULL) {
+            mAsyncFrame = CaptureFrame();
+            finishFrame(last, 0);
+        }
+        processDirectFrame(frame);
+        return;
+    }
+
+    // results of frames are sent in dequeue order, PXP job of this
+    // frame keeps running while next frame is taken.
+    CaptureFrame last = mAsyncFrame;
+    mAsyncFrame = CaptureFrame();
+    int32_t ret = 0;
+    if (dropFlushedFrame(frame, false)) {
+        // outputs are failed, earlier frame still completes first.
+        if (last.mRequest != NULL) {
+            finishFrame(last, 0);
+        }
+        ret = -1;
+    }
+    else {
+        deinterlaceFrame(frame);
+        ret = processCaptureRequest(frame, false, &last);
+        if (ret != 0) {
+            ALOGE("processRequest failed");
+        }
+    }
+
+    if (ret == 0 && frame.mPending != NULL) {
+        mAsyncFrame = frame;
+        return;
+    }
+
+    finishFrame(frame, ret);
+}
+
+void VideoStream::processDirectFrame(CaptureFrame& frame)
+{
+    sp<CaptureRequest>& req = frame.mRequest;
+    if (frame.mError) {
+        for (uint32_t i = 0; i < req->mOutBuffersNumber; i++) {
+            req->onCaptureError(req->mOutBuffers[i]);
+        }
+        return;
+    }
+
+    if (req->mOutBuffersNumber > 1) {
+        // e.g. preview of a record buffer, converted from the buffer V4L2
+        // filled while it is still ours. output is a frame of device.
+        StreamBuffer src = *frame.mOutput;
+        src.mStream = this;
+        src.mRefs = 0;
+        src.mDeinterlaced = false;
+
+        CaptureFrame derived = frame;
+        derived.mBuffer = &src;
+        derived.mPending = NULL;
+        if (processCaptureRequest(derived, false, NULL) != 0) {
+            ALOGE("%s: process outputs failed", __func__);
+        }
+        // encoder may write back or requeue buffer once it is returned,
+        // so background job reading it ends first.
+        finishPendingOutput(derived);
+    }
+
+    req->onCaptureDone(frame.mOutput);
+}
+
+void VideoStream::finishPendingOutput(CaptureFrame& frame)
+{
+    StreamBuffer* out = frame.mPending;
+    if (out == NULL) {
+        return;
+    }
+
+    frame.mPending = NULL;
+    if (out->mStream->finishPendingJob() < 0) {
+        frame.mRequest->onCaptureError(out);
+    }
+    else {
+        frame.mRequest->onCaptureDone(out);
+    }
+}
+
+void VideoStream::finishFrame(CaptureFrame& frame, int32_t ret)
+{
+    finishPendingOutput(frame);
+
+    Mutex::Autolock _l(mPipeLock);
+    if (ret == 0 && hasJpegOutput(frame.mRequest)) {
+        // frame is returned after it is encoded.
+        mJpegFrames.push_back(frame);
+        mJpegHeld++;
+        ATRACE_INT("cam jpeg frames", mJpegFrames.size());
+    }
+    else {
+        releaseFrameLocked(frame.mBuffer);
+    }
+    mPipeCondition.broadcast();
+}
+
+void VideoStream::releaseFrameLocked(StreamBuffer* buf)
+{
+    if (buf->mRefs > 1) {
+        // other clients still process this buffer.
+        buf->mRefs--;
+        return;
+    }
+
+    buf->mRefs = 0;
+    mDoneFrames.push_back(buf);
+}
+
+int32_t VideoStream::getDeinterlaceMode(sp<CaptureRequest> req)
+{
+    int32_t mode = DEINTERLACE_WEAVE;
+    if (req == NULL || req->mSettings == NULL ||
+            req->mSettings->getDeinterlaceMode(mode) != NO_ERROR) {
+        return DEINTERLACE_WEAVE;
+    }
+
+    if (mode != DEINTERLACE_BOB && mode != DEINTERLACE_MOTION) {
+        return DEINTERLACE_WEAVE;
+    }
+
+    return mode;
+}
+
+void VideoStream::deinterlaceFrame(CaptureFrame& frame)
+{
+    StreamBuffer* buf = frame.mBuffer;
+    // shared clients get fields rebuilt by first one.
+    if (!isInterlaced() || buf->mDeinterlaced) {
+        return;
+    }
+
+    int32_t mode = getDeinterlaceMode(frame.mRequest);
+    if (mode == DEINTERLACE_WEAVE) {
+        return;
+    }
+
+    // V4L2 buffer may be larger than stream, see getV4l2Res.
+    uint32_t width = mWidth, height = mHeight;
+    if (mCamera->getV4l2Res(mWidth, mHeight, &width, &height) != NO_ERROR) {
+        return;
+    }
+
+    uint8_t* plane = (uint8_t*)buf->mVirtAddr;
+    uint32_t rowBytes = 0;
+    bool chroma = false;
+    switch (mFormat) {
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            rowBytes = width * 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            rowBytes = width;
+            chroma = true;
+            break;
+        default:
+            ALOGV("%s: format 0x%x not supported", __func__, mFormat);
+            return;
+    }
+
+    size_t frameSize = (size_t)rowBytes * height * (chroma ? 3 : 2) / 2;
+    if (plane == NULL || buf->mSize < frameSize) {
+        return;
+    }
+
+    uint8_t* history = NULL;
+    if (mode == DEINTERLACE_MOTION) {
+        // bottom field rows of all planes.
+        size_t size = (size_t)rowBytes * (height / 2) +
+                      (chroma ? (size_t)rowBytes * (height / 4) : 0);
+        if (mFieldHistorySize != size) {
+            free(mFieldHistory);
+            mFieldHistory = (uint8_t*)malloc(size);
+            mFieldHistorySize = (mFieldHistory != NULL) ? size : 0;
+            mFieldHistoryValid = false;
+        }
+        history = mFieldHistoryValid ? mFieldHistory : NULL;
+        if (mFieldHistory != NULL && !mFieldHistoryValid) {
+            // first frame is bob, its bottom field seeds history.
+            for (uint32_t h = 1; h < height; h += 2) {
+                memcpy(mFieldHistory + (h / 2) * rowBytes,
+                       plane + h * rowBytes, rowBytes);
+            }
+            if (chroma) {
+                uint8_t* uv = plane + rowBytes * height;
+                uint8_t* last = mFieldHistory + (size_t)rowBytes * (height / 2);
+                for (uint32_t h = 1; h < height / 2; h += 2) {
+                    memcpy(last + (h / 2) * rowBytes, uv + h * rowBytes,
+                           rowBytes);
+                }
+            }
+            mFieldHistoryValid = true;
+        }
+    }
+    else {
+        // history is stale once motion mode stops updating it.
+        mFieldHistoryValid = false;
+    }
+
+    deinterlacePlane(plane, rowBytes, height, history, mode);
+    if (chroma) {
+        deinterlacePlane(plane + rowBytes * height, rowBytes, height / 2,
+                history ? history + (size_t)rowBytes * (height / 2) : NULL,
+                mode);
+    }
+
+    Mutex::Autolock _l(mPipeLock);
+    buf->mDeinterlaced = true;
+}
+
+int32_t VideoStream::handleJpegFrame()
+{
+    CaptureFrame frame;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        while (mJpegFrames.empty() && !mPipeExit) {
+            mPipeCondition.wait(mPipeLock);
+        }
+
+        if (mJpegFrames.empty()) {
+            return -1;
+        }
+
+        frame = *mJpegFrames.begin();
+        mJpegFrames.erase(mJpegFrames.begin());
+        ATRACE_INT("cam jpeg frames", mJpegFrames.size());
+    }
+
+    // blob buffers complete out of order to later preview buffers.
+    // flushed frame is not encoded.
+    int32_t ret = -1;
+    if (!dropFlushedFrame(frame, true)) {
+        ret = 0;
+        StreamBuffer* input = frame.mBuffer;
+        if (frame.mReprocess && input->mAcquireFence != -1) {
+            // framework may still write reprocess input.
+            ret = sync_wait(input->mAcquireFence, CAMERA_SYNC_TIMEOUT);
+            close(input->mAcquireFence);
+            input->mAcquireFence = -1;
+        }
+
+        if (ret == 0) {
+            ret = processCaptureRequest(frame, true, NULL);
+        }
+        else {
+            ALOGE("%s wait input fence failed, fm:%d", __func__,
+                  frame.mRequest->mFrameNumber);
+            sp<CaptureRequest>& req = frame.mRequest;
+            for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+                if (req->mOutBuffers[i]->mStream->isJpeg()) {
+                    req->onCaptureError(req->mOutBuffers[i]);
+                }
+            }
+        }
+        if (ret != 0) {
+            ALOGE("processRequest jpeg failed");
+        }
+    }
+
+    if (frame.mReprocess) {
+        frame.mRequest->onInputDone(ret != 0);
+        Mutex::Autolock _l(mPipeLock);
+        mReprocessNum--;
+        mPipeCondition.broadcast();
+        return 0;
+    }
+
+    Mutex::Autolock _l(mPipeLock);
+    mJpegHeld--;
+    releaseFrameLocked(frame.mBuffer);
+    mPipeCondition.broadcast();
+
+    return 0;
+}
+
+void VideoStream::returnDoneFrames(bool wait)
+{
+    List<StreamBuffer*> done;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        uint32_t depth = VIDEO_PIPELINE_DEPTH;
+        uint32_t limit = depth;
+        // at least one buffer stays queued in V4L2.
+        if (mNumBuffers > 1) {
+            limit = mNumBuffers - 1;
+            if (depth > limit) {
+                depth = limit;
+            }
+        }
+        // shared buffer may be held by several jpeg frames.
+        uint32_t held = mJpegHeld < mInFlight ? mJpegHeld : mInFlight;
+        // slow jpeg encode doesn't stall preview while buffers are left.
+        // zsl frames are extra buffers, but not queued in V4L2 either.
+        while (wait && (mInFlight - held >= depth ||
+                        mInFlight + mZslNum >= limit)
+               && mDoneFrames.empty()) {
+            ATRACE_NAME("cam pipeline full");
+            mPipeCondition.wait(mPipeLock);
+        }
+
+        done = mDoneFrames;
+        mDoneFrames.clear();
+        mInFlight -= done.size();
+        ATRACE_INT("cam in flight", mInFlight);
+    }
+
     Mutex::Autolock lock(mLock);
-    mRequests.erase(cur);
-    returnFrameLocked(*buf);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (List<StreamBuffer*>::iterator it = done.begin();
+         it != done.end(); it++) {
+        // peak follows slow frames at once and decays over ~16 frames.
+        nsecs_t hold = now - (*it)->mTimestamp;
+        if ((*it)->mTimestamp > 0 && hold > 0) {
+            mHoldTime = hold > mHoldTime ? hold
+                                         : mHoldTime - (mHoldTime - hold) / 16;
+        }
+        if (mZslDepth > 0) {
+            keepZslFrameLocked(*it);
+        }
+        else {
+            returnFrameLocked(**it);
+        }
+    }
+}
+
+void VideoStream::flushPipelineLocked()
+{
+    List<StreamBuffer*> done;
+    {
+        Mutex::Autolock _l(mPipeLock);
+        // reprocess frames hold no V4L2 buffer, but complete before
+        // flush returns.
+        while (mDoneFrames.size() < mInFlight || mReprocessNum > 0) {
+            mPipeCondition.wait(mPipeLock);
+        }
+
+        done = mDoneFrames;
+        mDoneFrames.clear();
+        mInFlight = 0;
+        ATRACE_INT("cam in flight", 0);
+    }
+
+    for (List<StreamBuffer*>::iterator it = done.begin();
+         it != done.end(); it++) {
+        returnFrameLocked(**it);
+    }
+}
+
+bool VideoStream::hasJpegOutput(sp<CaptureRequest> req)
+{
+    for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+        if (req->mOutBuffers[i]->mStream->isJpeg()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int32_t VideoStream::waitAcquireFences(StreamBuffer** outs, uint32_t num,
+                                       nsecs_t deadline)
+{
+    ATRACE_NAME("cam fence wait");
+    struct pollfd fds[MAX_STREAM_BUFFERS];
+    for (uint32_t i = 0; i < num; i++) {
+        fds[i].fd = outs[i]->mAcquireFence;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int32_t timeout = (int32_t)ns2ms(deadline - start);
+    int32_t ret = timeout > 0 ? poll(fds, num, timeout) : 0;
+    if (ret < 0 && errno == EINTR) {
+        return 0;
+    }
+    if (ret <= 0) {
+        ALOGE("%s: %d acquire fences not signaled", __func__, num);
+        return -ETIME;
+    }
+
+    nsecs_t wait = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    for (uint32_t i = 0; i < num; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        if (fds[i].revents & (POLLERR | POLLNVAL)) {
+            ALOGE("%s: error on acquire fence %d", __func__, fds[i].fd);
+        }
+        outs[i]->mStream->stats().onFenceWait(wait);
+        close(outs[i]->mAcquireFence);
+        outs[i]->mAcquireFence = -1;
+    }
 
     return 0;
 }
 
-int32_t VideoStream::processCaptureRequest(StreamBuffer& src,
-                         sp<CaptureRequest> req)
+int32_t VideoStream::processCaptureOutput(CaptureFrame& frame,
+                                          StreamBuffer* out, bool jpeg,
+                                          CaptureFrame* last)
+{
+    StreamBuffer& src = *frame.mBuffer;
+    sp<CaptureRequest>& req = frame.mRequest;
+    sp<Stream>& stream = out->mStream;
+
+    if (last != NULL && last->mRequest != NULL) {
+        // keep result order of streams across frames. job of last frame
+        // is collected with its status before stream queues next one.
+        finishFrame(*last, 0);
+        last->mRequest = NULL;
+    }
+
+    // stream to process buffer.
+    stream->setCurrentBuffer(out);
+    int32_t ret = stream->processCaptureBuffer(src, req->mSettings);
+    stream->setCurrentBuffer(NULL);
+    if (jpeg && ret != 0) {
+        // failed encode must not leave blob buffer pending.
+        return req->onCaptureError(out);
+    }
+    if (ret == 0 && !jpeg && stream->isJobPending()) {
+        // one output per frame waits in background.
+        finishPendingOutput(frame);
+        frame.mPending = out;
+        return 0;
+    }
+
+    return req->onCaptureDone(out);
+}
+
+int32_t VideoStream::processCaptureRequest(CaptureFrame& frame, bool jpeg,
+                                           CaptureFrame* last)
 {
     int32_t ret = 0;
     ALOGV("%s", __func__);
+    sp<CaptureRequest>& req = frame.mRequest;
+
+    // outputs are processed as their consumers release them, so one
+    // slow consumer doesn't hold back other streams of frame.
+    StreamBuffer* outs[MAX_STREAM_BUFFERS];
+    uint32_t num = 0;
     for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
-        StreamBuffer* out = req->mOutBuffers[i];
-        sp<Stream>& stream = out->mStream;
-        // stream to process buffer.
-        stream->setCurrentBuffer(out);
-        stream->processCaptureBuffer(src, req->mSettings);
-        stream->setCurrentBuffer(NULL);
-        ret = req->onCaptureDone(out);
-        if (ret != 0) {
-            return ret;
+        // direct output already holds the frame.
+        if (req->mOutBuffers[i] == frame.mOutput) {
+            continue;
+        }
+        if (req->mOutBuffers[i]->mStream->isJpeg() == jpeg) {
+            outs[num++] = req->mOutBuffers[i];
         }
     }
 
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) +
+                       ms2ns(CAMERA_SYNC_TIMEOUT);
+    while (num > 0) {
+        uint32_t waiting = 0;
+        for (uint32_t i = 0; i < num; i++) {
+            StreamBuffer* out = outs[i];
+            if (out->mAcquireFence != -1) {
+                outs[waiting++] = out;
+                continue;
+            }
+
+            // failed output doesn't keep others of frame from completing.
+            int32_t err = processCaptureOutput(frame, out, jpeg, last);
+            if (err != 0) {
+                ret = err;
+            }
+        }
+
+        num = waiting;
+        if (num > 0 && waitAcquireFences(outs, num, deadline) != 0) {
+            // buffers go back with their fences, nothing was written.
+            for (uint32_t i = 0; i < num; i++) {
+                req->onCaptureError(outs[i]);
+            }
+            num = 0;
+        }
+    }
+
+    if (last != NULL && last->mRequest != NULL) {
+        finishFrame(*last, 0);
+        last->mRequest = NULL;
+    }
+
     return ret;
 }
 
 // process advanced character.
-int32_t VideoStream::processCaptureSettings(sp<CaptureRequest> req)
+int32_t VideoStream::processCaptureSettings(sp<CaptureRequest> req,
+                                            uint32_t client,
+                                            nsecs_t timestamp)
 {
     ALOGV("%s", __func__);
     sp<Metadata> meta = req->mSettings;
@@ -375,14 +1597,32 @@ int32_t VideoStream::processCaptureSettings(sp<CaptureRequest> req)
         ALOGI("invalid meta data");
         return 0;
     }
-    // device to do advanced character set.
-    int32_t ret = mCamera->processSettings(meta, req->mFrameNumber);
+
+    // result is copied only when settings change, repeating requests
+    // just update 3A state and timestamp in place.
+    // device to do advanced character set, shutter goes to client.
+    Camera* camera = req->mCamera != NULL ? req->mCamera : mCamera;
+    Metadata& result = mResults[client];
+    if (mResultSettings[client] != meta) {
+        // buffer of result is kept, it's only refilled.
+        result.assign(meta->get(), camera->resultEntries(),
+                      camera->resultData());
+        mResultSettings[client] = meta;
+    }
+    int32_t ret = camera->processSettings(meta, result, req->mFrameNumber,
+                                          timestamp);
     if (ret != 0) {
         ALOGI("mCamera->processSettings failed");
         return ret;
     }
 
-    ret = req->onSettingsDone(meta);
+    if (mLatencyMark) {
+        // same clock as page flip events of display.
+        req->mCaptureTime = getMonotonicTime(timestamp);
+        result.addInt64(imx_capture_frame_time, 1, &req->mCaptureTime);
+    }
+
+    ret = req->onSettingsDone(result);
     if (ret != 0) {
         ALOGI("onSettingsDone failed");
         return ret;
@@ -400,16 +1640,33 @@ int32_t VideoStream::handleMessage()
 {
     int32_t ret = 0;
 
-    sp<CMessage> msg = mMessageQueue.waitMessage();
-    if (msg == 0) {
+    CMessage msg;
+    int fd = -1;
+    {
+        Mutex::Autolock lock(mLock);
+        if (isLookaheadLocked()) {
+            fd = mDev;
+        }
+    }
+
+    ret = mMessageQueue.waitMessage(msg, -1, fd);
+    if (ret == -EAGAIN) {
+        // frame is ready while no request waits for it.
+        returnDoneFrames(false);
+        Mutex::Autolock lock(mLock);
+        fillLookaheadLocked();
+        return 0;
+    }
+
+    if (ret != NO_ERROR) {
         ALOGE("get invalid message");
         return -1;
     }
 
-    switch (msg->what) {
+    switch (msg.what) {
         case MSG_CONFIG: {
             Mutex::Autolock lock(mLock);
-            ConfigureParam* params = (ConfigureParam*)(uintptr_t)msg->arg0;
+            ConfigureParam* params = (ConfigureParam*)msg.arg0;
             ret = handleConfigureLocked(params);
             if (params != NULL) {
                 delete params;
@@ -443,6 +1700,12 @@ int32_t VideoStream::handleMessage()
         ret = handleCaptureFrame();
         break;
 
+        case MSG_FLUSH: {
+            Mutex::Autolock lock(mLock);
+            handleFlushLocked((uint32_t)msg.arg0);
+        }
+        break;
+
         case MSG_EXIT: {
             Mutex::Autolock lock(mLock);
             ALOGI("capture thread exit...");
@@ -455,7 +1718,7 @@ int32_t VideoStream::handleMessage()
         break;
 
         default: {
-            ALOGE("%s invalid message what:%d", __func__, msg->what);
+            ALOGE("%s invalid message what:%d", __func__, msg.what);
         }
         break;
     }
@@ -27,6 +27,21 @@ using namespace android;
 
 class Camera;
 
+// frames dequeued from V4L2 and not returned yet.
+#define VIDEO_PIPELINE_DEPTH 2
+// capture requests not yet started by capture thread.
+#define REQUEST_RING_SIZE 64
+// logical cameras fed by one sensor.
+#define MAX_SHARED_CLIENTS 4
+// newest frames kept dequeued while no request waits.
+#define MAX_LOOKAHEAD_FRAMES 4
+// processed full size frames kept for zero shutter lag stills.
+#define MAX_ZSL_FRAMES 4
+#define DEFAULT_ZSL_FRAMES 2
+// V4L2 ring is sized from frame hold time, within CMA budget in MB.
+#define RING_MIN_BUFFERS 2
+#define DEFAULT_RING_BUDGET 64
+
 class ConfigureParam
 {
 public:
@@ -36,6 +51,28 @@ public:
     int32_t mFps;
     int32_t mBuffers;
     int32_t mIsJpeg;
+    // frames kept for zero shutter lag, 0 if not zsl.
+    int32_t mZsl;
+};
+
+// dequeued frame waiting for process thread.
+struct CaptureFrame
+{
+    CaptureFrame() : mBuffer(NULL), mOutput(NULL), mPending(NULL),
+                     mError(false), mReprocess(false), mClient(0) {}
+
+    sp<CaptureRequest> mRequest;
+    StreamBuffer* mBuffer;
+    // output buffer V4L2 captured into directly, mBuffer is NULL.
+    // other outputs of request are converted from it.
+    StreamBuffer* mOutput;
+    // output whose PXP job is still running.
+    StreamBuffer* mPending;
+    bool mError;
+    // mBuffer is reprocess input of request, not a V4L2 buffer.
+    bool mReprocess;
+    // logical camera of request.
+    uint32_t mClient;
 };
 
 class VideoStream : public Stream
@@ -45,16 +82,22 @@ public:
     virtual ~VideoStream();
     void destroyStream();
 
-    // configure device stream.
-    int32_t configure(sp<Stream> stream);
+    // configure device stream, client is index of logical camera.
+    // sensor mode follows one client, others are scaled from it.
+    // zsl keeps recent frames for still requests of jpeg stream.
+    int32_t configure(sp<Stream> stream, uint32_t client, bool zsl = false);
     //send capture request for stream.
-    int32_t requestCapture(sp<CaptureRequest> req);
+    int32_t requestCapture(sp<CaptureRequest> req, uint32_t client);
 
-    // open/close device stream.
-    int32_t openDev(const char* name);
-    int32_t closeDev();
+    // open/close device stream, device is opened once for all clients.
+    int32_t openDev(const char* name, uint32_t client);
+    int32_t closeDev(uint32_t client);
+    // fail requests of client not captured yet and wait frames in
+    // process returned, V4L2 keeps streaming.
+    int32_t flush(uint32_t client);
 
     virtual void* getG2dHandle() {return g2dHandle;}
+    virtual void* getJpegG2dHandle() {return mJpegG2dHandle;}
 
 private:
     // message type.
@@ -62,6 +105,7 @@ private:
     static const int32_t MSG_FRAME = 0x103;
     static const int32_t MSG_CLOSE = 0x104;
     static const int32_t MSG_EXIT  = 0x105;
+    static const int32_t MSG_FLUSH = 0x106;
 
     // device stream state.
     static const int32_t STATE_INVALID = 0x201;
@@ -74,27 +118,112 @@ protected:
     // handle configure message internally.
     int32_t handleConfigureLocked(ConfigureParam* params);
     virtual int32_t onDeviceConfigureLocked() = 0;
+    // frame rate device runs at for requested fps.
+    virtual int32_t getDeviceFps(int32_t /*width*/, int32_t /*height*/,
+                                 int32_t fps) {return fps;}
+    // change frame rate without stream off, also while streaming.
+    // -1 if it needs full configure.
+    virtual int32_t onDeviceRateLocked() {return -1;}
     // handle start message internally.
     int32_t handleStartLocked(bool force);
     virtual int32_t onDeviceStartLocked() = 0;
     // handle stop message internally.
     int32_t handleStopLocked(bool force);
     virtual int32_t onDeviceStopLocked() = 0;
-    // handle frame message internally.
+    // handle frame message internally, dequeue stage of pipeline.
     int32_t handleCaptureFrame();
+    // reprocess request goes to jpeg thread with its input buffer.
+    int32_t handleReprocessFrame(sp<CaptureRequest> req, uint32_t client);
+    // process stage of pipeline, runs in process thread.
+    int32_t handleProcessFrame();
+    void processFrame(CaptureFrame& frame);
+    // complete frame V4L2 captured into request buffer.
+    void processDirectFrame(CaptureFrame& frame);
+    // jpeg encode of frame, runs in jpeg thread.
+    int32_t handleJpegFrame();
+    // put processed frames back to V4L2, wait if pipeline is full.
+    void returnDoneFrames(bool wait);
+    // wait all dequeued frames processed and return them.
+    void flushPipelineLocked();
+    // handle flush message of client in capture thread.
+    void handleFlushLocked(uint32_t client);
+    // fail outputs of frame in flush instead of processing it.
+    bool dropFlushedFrame(CaptureFrame& frame, bool jpeg);
+    // device captures both fields woven in one frame.
+    virtual bool isInterlaced() {return false;}
+    // DEINTERLACE_* mode asked by request, weave by default.
+    int32_t getDeinterlaceMode(sp<CaptureRequest> req);
+    // deinterlace captured buffer of frame in place, once per buffer.
+    void deinterlaceFrame(CaptureFrame& frame);
 
-    // process capture request with lock.
-    int32_t processCaptureRequest(StreamBuffer& src, sp<CaptureRequest> req);
-    // process capture advanced settings with lock.
-    int32_t processCaptureSettings(sp<CaptureRequest> req);
+    // process jpeg or non-jpeg output buffers of capture request.
+    // last frame is completed before results of this one are sent.
+    int32_t processCaptureRequest(CaptureFrame& frame, bool jpeg,
+                                  CaptureFrame* last);
+    // process one output whose acquire fence is already waited.
+    int32_t processCaptureOutput(CaptureFrame& frame, StreamBuffer* out,
+                                 bool jpeg, CaptureFrame* last);
+    // poll acquire fences of outputs together until one signals or
+    // deadline passes, signaled fences are closed. -ETIME on timeout.
+    int32_t waitAcquireFences(StreamBuffer** outs, uint32_t num,
+                              nsecs_t deadline);
+    // wait pending output of frame and pass frame to next stage.
+    void finishFrame(CaptureFrame& frame, int32_t ret);
+    // frame is done with its buffer, return it after last client.
+    void releaseFrameLocked(StreamBuffer* buf);
+    // next request, clients take turns.
+    bool popRequest(sp<CaptureRequest>& req, uint32_t* client);
+    // attach waiting requests of other clients to dequeued buffer.
+    void shareFrame(StreamBuffer* buf, uint32_t client,
+                    List<CaptureFrame>& frames);
+    void finishPendingOutput(CaptureFrame& frame);
+    bool hasJpegOutput(sp<CaptureRequest> req);
+    // V4L2 buffers for stream mode, frames held by pipeline plus one
+    // in capture and one for jitter. stream count is kept until hold
+    // time is known.
+    uint32_t getRingDepthLocked(sp<Stream>& stream, int32_t format,
+                                int32_t fps);
+    // process capture advanced settings with lock, timestamp is sensor
+    // time of captured frame, 0 if not known.
+    int32_t processCaptureSettings(sp<CaptureRequest> req, uint32_t client,
+                                   nsecs_t timestamp = 0);
     // get buffer from V4L2.
     StreamBuffer* acquireFrameLocked();
     virtual int32_t onFrameAcquireLocked() = 0;
+    // get frame for request, or queue its buffer to V4L2 directly.
+    StreamBuffer* acquireCaptureLocked(sp<CaptureRequest> req, bool* queued);
+    // output of device geometry V4L2 captures into, NULL if request has
+    // none. other outputs of request are converted from it.
+    StreamBuffer* getDirectOutputLocked(sp<CaptureRequest> req);
+    // fail requests whose buffers were queued to V4L2.
+    void flushDirectLocked();
+    // keep newest frames dequeued while idle, so that next request
+    // doesn't wait a frame period. dequeue must be plain DQBUF of mDev.
+    virtual bool canLookahead() {return true;}
+    bool isLookaheadLocked();
+    // dequeue ready frames into lookahead ring, oldest goes back to V4L2.
+    void fillLookaheadLocked();
+    // newest frame of ring, older ones are returned to V4L2.
+    StreamBuffer* takeLookaheadLocked();
+    void flushLookaheadLocked();
+    // still request served from zsl ring.
+    bool isZslCapture(sp<CaptureRequest> req);
+    // put processed frame into zsl ring by dequeue time, oldest frame
+    // goes back to V4L2 when ring is full.
+    void keepZslFrameLocked(StreamBuffer* buf);
+    // frame dequeued closest to shutter time, NULL if ring is empty.
+    StreamBuffer* takeZslLocked(nsecs_t shutter);
+    void flushZslLocked();
+    // queue output buffer to V4L2, -1 if stream can't capture into it.
+    virtual int32_t onDirectReturnLocked(int32_t /*index*/,
+                                         StreamBuffer& /*buf*/) {return -1;}
     // put buffer back to V4L2.
     int32_t returnFrameLocked(StreamBuffer& buf);
     virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf) = 0;
     // get buffer index.
     int32_t getBufferIndexLocked(StreamBuffer& buf);
+    // O(1) after first lookup of each buffer.
+    int32_t getBufferIndexByPhyLocked(int32_t phys);
 
     // allocate buffers.
     virtual int32_t allocateBuffersLocked() = 0;
@@ -116,43 +245,158 @@ private:
         }
 
         virtual status_t readyToRun() {
+            // frames are dequeued here, jitter delays the whole pipeline.
+            setCaptureThreadPolicy();
+            return 0;
+        }
+
+        virtual bool threadLoop() {
+            int ret = mStream->handleMessage();
+            if (ret != 0) {
+                ALOGI("%s exit...", __func__);
+                mStream.clear();
+                mStream = NULL;
+                return false;
+            }
+
+            // loop until we need to quit
+            return true;
+        }
+
+    private:
+        sp<VideoStream> mStream;
+    };
+
+    // converts frames into output buffers and sends results,
+    // so that next frame is dequeued meanwhile. jpeg outputs are
+    // encoded by another one, not to hold up preview buffers.
+    class ProcessThread : public Thread
+    {
+    public:
+        ProcessThread(VideoStream *device, bool jpeg)
+            : Thread(false), mStream(device), mJpeg(jpeg)
+            {}
+
+        virtual void onFirstRef() {
+            run(mJpeg ? "JpegThread" : "ProcessThread",
+                PRIORITY_URGENT_DISPLAY);
+        }
+
+        virtual status_t readyToRun() {
+            if (!mJpeg) {
+                setCaptureThreadPolicy();
+            }
 #ifdef TARGET_FSL_IMX_2D
-            g2d_open(&mStream->g2dHandle);
+            // g2d handle is bound to thread using it.
+            g2d_open(mJpeg ? &mStream->mJpegG2dHandle
+                           : &mStream->g2dHandle);
 #endif
             return 0;
         }
 
         virtual bool threadLoop() {
-            int ret = mStream->handleMessage();
+            int ret = mJpeg ? mStream->handleJpegFrame()
+                            : mStream->handleProcessFrame();
             if (ret != 0) {
                 ALOGI("%s exit...", __func__);
 #ifdef TARGET_FSL_IMX_2D
-                g2d_close(mStream->g2dHandle);
+                g2d_close(mJpeg ? mStream->mJpegG2dHandle
+                                : mStream->g2dHandle);
 #endif
                 mStream.clear();
                 mStream = NULL;
                 return false;
             }
 
-            // loop until we need to quit
             return true;
         }
 
     private:
         sp<VideoStream> mStream;
+        bool mJpeg;
     };
 
 protected:
     CMessageQueue mMessageQueue;
     sp<MessageThread> mMessageThread;
+    sp<ProcessThread> mProcessThread;
+    sp<ProcessThread> mJpegThread;
+
+    // frames to process and processed frames to return, frames
+    // are returned in capture thread which owns V4L2 queue.
+    Mutex mPipeLock;
+    Condition mPipeCondition;
+    List<CaptureFrame> mPendingFrames;
+    List<CaptureFrame> mJpegFrames;
+    // processed frame whose PXP job completes in background.
+    CaptureFrame mAsyncFrame;
+    // frames held by jpeg stage, not counted in pipeline depth.
+    uint32_t mJpegHeld;
+    // reprocess frames in jpeg stage, flush waits for them.
+    uint32_t mReprocessNum;
+    List<StreamBuffer*> mDoneFrames;
+    // requests whose output buffer is queued in V4L2 slot.
+    CaptureFrame mDirectFrames[MAX_STREAM_BUFFERS];
+    uint32_t mDirectNum;
+    uint32_t mInFlight;
+    // dequeued frames no request took yet, oldest first. capture thread.
+    StreamBuffer* mLookaheadFrames[MAX_LOOKAHEAD_FRAMES];
+    uint32_t mLookaheadNum;
+    // ring size from rw.camera.lookahead, 0 disables it.
+    uint32_t mLookahead;
+    // dequeue of ready frame failed, ring is off until next start.
+    bool mLookaheadError;
+    // processed frames of zsl stream by dequeue time, oldest first.
+    // capture thread only.
+    StreamBuffer* mZslFrames[MAX_ZSL_FRAMES];
+    uint32_t mZslNum;
+    // ring size of configured stream, 0 if it isn't zsl.
+    uint32_t mZslDepth;
+    // ring size from rw.camera.zsl.frames.
+    uint32_t mZslFrameNum;
+    // decaying peak of time frames stay dequeued, with mLock.
+    nsecs_t mHoldTime;
+    // bytes of V4L2 ring from rw.camera.ring.budget.
+    size_t mRingBudget;
+    // LATENCY_MARK_PROP, capture time goes to result and preview pixels.
+    bool mLatencyMark;
+    bool mPipeExit;
+    // clients in flush, bit per client index.
+    uint32_t mFlushing;
+    // flush sequence asked by framework and done by capture thread.
+    uint32_t mFlushAsked[MAX_SHARED_CLIENTS];
+    uint32_t mFlushDone[MAX_SHARED_CLIENTS];
+    // process thread holds a frame taken from mPendingFrames.
+    bool mProcessBusy;
     int32_t mState;
 
-    List< sp<CaptureRequest> > mRequests;
+    BufferIndexMap mBufferMap;
+    // requests of framework thread to capture thread, one ring
+    // per client of shared sensor.
+    RingQueue<sp<CaptureRequest>, REQUEST_RING_SIZE>
+            mRequests[MAX_SHARED_CLIENTS];
+    // opened clients, bit per client index.
+    uint32_t mClients;
+    // client whose configure sets sensor mode.
+    uint32_t mConfigClient;
+    uint32_t mNextClient;
     int32_t mChanged;
+    // result metadata of each client, reused while its request
+    // settings stay the same. capture thread only.
+    Metadata mResults[MAX_SHARED_CLIENTS];
+    sp<Metadata> mResultSettings[MAX_SHARED_CLIENTS];
+
+    // bottom field of last deinterlaced frame for motion mode,
+    // process thread only.
+    uint8_t* mFieldHistory;
+    size_t mFieldHistorySize;
+    bool mFieldHistoryValid;
 
     // camera dev node.
     int32_t mDev;
     void *g2dHandle;
+    // g2d handle of jpeg thread, scales jpeg source.
+    void *mJpegG2dHandle;
     uint32_t mAllocatedBuffers;
 };
 
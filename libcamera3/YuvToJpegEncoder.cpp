@@ -19,11 +19,21 @@
 #include <ui/PixelFormat.h>
 #include <hardware/hardware.h>
 #include "NV12_resize.h"
+#include "ColorConvert.h"
+#include <pthread.h>
 
 #ifdef BOARD_HAVE_VPU
 #include "vpu_wrapper.h"
 #endif
 
+// libjpeg pictures this large are encoded in slices on all cores.
+#define JPEG_SLICE_MIN_PIXELS	(1280 * 720)
+#define JPEG_MAX_SLICES	4
+// MCU of every supported sampling is 16x16.
+#define JPEG_MCU_SIZE	16
+// headers of each slice besides its compressed rows.
+#define JPEG_SLICE_HEADER_ROOM	4096
+
 #define Align(ptr,align)	(((uintptr_t)ptr+(align)-1)/(align)*(align))
 #define VPU_ENC_MAX_NUM_MEM_REQS	(6)
 #define MAX_FRAME_NUM	(4)
@@ -211,6 +221,8 @@ int EncFreeMemBlock(EncMemInfo* pEncMem)
 		}
 	}
 
+	pEncMem->nVirtNum=0;
+	pEncMem->nPhyNum=0;
 	return retOk;
 }
 
@@ -267,68 +279,77 @@ failure:
 	return 0;
 }
 
-int vpu_encode(void *inYuv,
-                             void* inYuvPhy,
-                             int   Width,
-                             int   Height,
-                             int   /*quality*/,
-                             int   color,
-                             void *outBuf,
-                             int   outSize,
-                             int colorFormat)
+// vpu encoder session, kept open across captures of same size.
+typedef struct{
+	VpuEncHandle handle;
+	int width;
+	int height;
+	int color;
+	int colorFormat;
+	int alignment;
+	//codec and frame buffers memory
+	EncMemInfo encMem;
+	//physical output buffer
+	EncMemInfo outMem;
+	int outSize;
+	unsigned char* outPhy;
+	unsigned char* outVirt;
+}VpuEncSession;
+
+static pthread_mutex_t sVpuLock = PTHREAD_MUTEX_INITIALIZER;
+static VpuEncSession sVpuSession;
+static int sVpuLoaded = 0;
+
+static void vpu_close_session(VpuEncSession* pSession)
+{
+	VpuEncRetCode ret;
+
+	if(pSession->handle!=0){
+		ret=VPU_EncClose(pSession->handle);
+		if (ret!=VPU_ENC_RET_SUCCESS){
+			ALOGE("%s: vpu close failure: ret=%d ",__FUNCTION__,ret);
+		}
+	}
+
+	if(0==EncFreeMemBlock(&pSession->outMem)){
+		ALOGE("%s: free output memory failure:  ",__FUNCTION__);
+	}
+	if(0==EncFreeMemBlock(&pSession->encMem)){
+		ALOGE("%s: free memory failure:  ",__FUNCTION__);
+	}
+
+	memset(pSession,0,sizeof(VpuEncSession));
+}
+
+static int vpu_open_session(VpuEncSession* pSession,
+                            int Width,
+                            int Height,
+                            int color,
+                            int colorFormat)
 {
 	VpuEncRetCode ret;
-	int size=0;
-	VpuVersionInfo ver;
-	VpuWrapperVersionInfo w_ver;
-	VpuEncHandle handle=0;
 	VpuMemInfo sMemInfo;
-	EncMemInfo sEncMemInfo;
 	VpuEncOpenParamSimp sEncOpenParamSimp;
 	VpuEncInitInfo sEncInitInfo;
 	VpuFrameBuffer sFrameBuf[MAX_FRAME_NUM];
 	int nBufNum;
 	int nSrcStride;
-	VpuEncEncParam sEncEncParam;
-	char* tempOut=0;
-	static FILE* fpjpg=0;
 
 	memset(&sMemInfo,0,sizeof(VpuMemInfo));
-	memset(&sEncMemInfo,0,sizeof(EncMemInfo));
 	memset(&sFrameBuf,0,sizeof(VpuFrameBuffer)*MAX_FRAME_NUM);
 
-	ret=VPU_EncLoad();
-	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("load vpu encoder failure !");
-		return 0;
-	}
-	ret=VPU_EncGetVersionInfo(&ver);
-	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("vpu get version info failure: ret=%d ",ret);
-		goto finish;
-	}
-	ALOGI("vpu lib version : major.minor.rel=%d.%d.%d ",ver.nLibMajor,ver.nLibMinor,ver.nLibRelease);
-	ALOGI("vpu fw version : major.minor.rel_rcode=%d.%d.%d_r%d ",ver.nFwMajor,ver.nFwMinor,ver.nFwRelease,ver.nFwCode);
-
-	ret=(VpuEncRetCode)VPU_EncGetWrapperVersionInfo(&w_ver);
-	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("%s: vpu get wrapper version failure: ret=%d ",__FUNCTION__,ret);
-		goto finish;
-	}
-	//ALOGI("vpu wrapper version : major.minor.rel=%d.%d.%d: %s ",w_ver.nMajor,w_ver.nMinor,w_ver.nRelease,w_ver.pBinary);
-
 	//query memory
 	ret=VPU_EncQueryMem(&sMemInfo);
 	if (ret!=VPU_ENC_RET_SUCCESS){
 		ALOGE("%s: vpu query memory failure: ret=0x%X ",__FUNCTION__,ret);
-		goto finish;
+		goto failure;
 	}
 
 	//malloc memory for vpu
-	if(0==EncMallocMemBlock(&sMemInfo,&sEncMemInfo))
+	if(0==EncMallocMemBlock(&sMemInfo,&pSession->encMem))
 	{
 		ALOGE("%s: malloc memory failure: ",__FUNCTION__);
-		goto finish;
+		goto failure;
 	}
 
 	memset(&sEncOpenParamSimp,0,sizeof(VpuEncOpenParamSimp));
@@ -341,45 +362,126 @@ int vpu_encode(void *inYuv,
 	sEncOpenParamSimp.nBitRate=0;
 	sEncOpenParamSimp.nGOPSize=30;
 	sEncOpenParamSimp.nChromaInterleave=1;
-    sEncOpenParamSimp.eColorFormat=(VpuColorFormat)colorFormat;
+	sEncOpenParamSimp.eColorFormat=(VpuColorFormat)colorFormat;
 
 	//open vpu
-	ret=VPU_EncOpenSimp(&handle, &sMemInfo,&sEncOpenParamSimp);
+	ret=VPU_EncOpenSimp(&pSession->handle, &sMemInfo,&sEncOpenParamSimp);
 	if (ret!=VPU_ENC_RET_SUCCESS){
 		ALOGE("%s: vpu open failure: ret=0x%X ",__FUNCTION__,ret);
-		goto finish;
+		pSession->handle=0;
+		goto failure;
 	}
 
 	//get initinfo
-	ret=VPU_EncGetInitialInfo(handle,&sEncInitInfo);
+	ret=VPU_EncGetInitialInfo(pSession->handle,&sEncInitInfo);
 	if(VPU_ENC_RET_SUCCESS!=ret){
 		ALOGE("%s: init vpu failure ",__FUNCTION__);
-		goto finish;
+		goto failure;
 	}
 
 	nBufNum=sEncInitInfo.nMinFrameBufferCount;
-//	ALOGI("==== Init OK: min buffer cnt: %d, alignment: %d ",sEncInitInfo.nMinFrameBufferCount,sEncInitInfo.nAddressAlignment);
 	//fill frameBuf[]
-	if(-1==EncOutFrameBufCreateRegisterFrame(sEncOpenParamSimp.eFormat,color,sFrameBuf, nBufNum,Width, Height, &sEncMemInfo,0,&nSrcStride,sEncInitInfo.nAddressAlignment,0)){
+	if(-1==EncOutFrameBufCreateRegisterFrame(sEncOpenParamSimp.eFormat,color,sFrameBuf, nBufNum,Width, Height, &pSession->encMem,0,&nSrcStride,sEncInitInfo.nAddressAlignment,0)){
 		ALOGE("%s: allocate vpu frame buffer failure ",__FUNCTION__);
-		goto finish;
+		goto failure;
 	}
 
 	//register frame buffs
-	ret=VPU_EncRegisterFrameBuffer(handle, sFrameBuf, nBufNum,nSrcStride);
+	ret=VPU_EncRegisterFrameBuffer(pSession->handle, sFrameBuf, nBufNum,nSrcStride);
 	if(VPU_ENC_RET_SUCCESS!=ret){
 		ALOGE("%s: vpu register frame failure: ret=0x%X ",__FUNCTION__,ret);
-		goto finish;
+		goto failure;
 	}
 
-	//allocate temporary physical output buffer
+	pSession->width=Width;
+	pSession->height=Height;
+	pSession->color=color;
+	pSession->colorFormat=colorFormat;
+	pSession->alignment=sEncInitInfo.nAddressAlignment;
+	ALOGI("%s: vpu session %dx%d opened ",__FUNCTION__,Width,Height);
+	return 0;
+
+failure:
+	vpu_close_session(pSession);
+	return -1;
+}
+
+static int vpu_alloc_output(VpuEncSession* pSession, int outSize)
+{
+	VpuMemInfo sMemInfo;
+
+	if(outSize<=pSession->outSize){
+		return 0;
+	}
+
+	EncFreeMemBlock(&pSession->outMem);
+	pSession->outSize=0;
+
+	//allocate physical output buffer
 	memset(&sMemInfo,0,sizeof(VpuMemInfo));
 	sMemInfo.nSubBlockNum=1;
 	sMemInfo.MemSubBlock[0].MemType=VPU_MEM_PHY;
-	sMemInfo.MemSubBlock[0].nAlignment=sEncInitInfo.nAddressAlignment;//8;
+	sMemInfo.MemSubBlock[0].nAlignment=pSession->alignment;
 	sMemInfo.MemSubBlock[0].nSize=outSize;
-	if(0==EncMallocMemBlock(&sMemInfo,&sEncMemInfo))	{
+	if(0==EncMallocMemBlock(&sMemInfo,&pSession->outMem))	{
 		ALOGE("%s: malloc memory failure: ",__FUNCTION__);
+		return -1;
+	}
+
+	pSession->outPhy=sMemInfo.MemSubBlock[0].pPhyAddr;
+	pSession->outVirt=sMemInfo.MemSubBlock[0].pVirtAddr;
+	pSession->outSize=outSize;
+	return 0;
+}
+
+int vpu_encode(void *inYuv,
+                             void* inYuvPhy,
+                             int   Width,
+                             int   Height,
+                             int   /*quality*/,
+                             int   color,
+                             void *outBuf,
+                             int   outSize,
+                             int colorFormat)
+{
+	VpuEncRetCode ret;
+	int size=0;
+	VpuVersionInfo ver;
+	VpuWrapperVersionInfo w_ver;
+	VpuEncEncParam sEncEncParam;
+	VpuEncSession* pSession=&sVpuSession;
+
+	pthread_mutex_lock(&sVpuLock);
+	if(!sVpuLoaded){
+		ret=VPU_EncLoad();
+		if (ret!=VPU_ENC_RET_SUCCESS){
+			ALOGE("load vpu encoder failure !");
+			goto finish;
+		}
+		sVpuLoaded=1;
+
+		ret=VPU_EncGetVersionInfo(&ver);
+		if (ret==VPU_ENC_RET_SUCCESS){
+			ALOGI("vpu lib version : major.minor.rel=%d.%d.%d ",ver.nLibMajor,ver.nLibMinor,ver.nLibRelease);
+			ALOGI("vpu fw version : major.minor.rel_rcode=%d.%d.%d_r%d ",ver.nFwMajor,ver.nFwMinor,ver.nFwRelease,ver.nFwCode);
+		}
+
+		ret=(VpuEncRetCode)VPU_EncGetWrapperVersionInfo(&w_ver);
+		if (ret!=VPU_ENC_RET_SUCCESS){
+			ALOGE("%s: vpu get wrapper version failure: ret=%d ",__FUNCTION__,ret);
+		}
+	}
+
+	//reopen session when picture changes
+	if((pSession->handle!=0)&&((pSession->width!=Width)||(pSession->height!=Height)
+		||(pSession->color!=color)||(pSession->colorFormat!=colorFormat))){
+		vpu_close_session(pSession);
+	}
+	if((pSession->handle==0)&&(0!=vpu_open_session(pSession,Width,Height,color,colorFormat))){
+		goto finish;
+	}
+
+	if(0!=vpu_alloc_output(pSession,outSize)){
 		goto finish;
 	}
 
@@ -393,50 +495,48 @@ int vpu_encode(void *inYuv,
 	sEncEncParam.nInPhyInput=(uintptr_t)inYuvPhy;
 	sEncEncParam.nInVirtInput=(uintptr_t)inYuv;
 	sEncEncParam.nInInputSize=(color==0)?(Width*Height*3/2):(Width*Height*2);
-	sEncEncParam.nInPhyOutput=(uintptr_t)sMemInfo.MemSubBlock[0].pPhyAddr;
-	sEncEncParam.nInVirtOutput=(uintptr_t)sMemInfo.MemSubBlock[0].pVirtAddr;
+	sEncEncParam.nInPhyOutput=(uintptr_t)pSession->outPhy;
+	sEncEncParam.nInVirtOutput=(uintptr_t)pSession->outVirt;
 	sEncEncParam.nInOutputBufLen=outSize;
 
-	ret=VPU_EncEncodeFrame(handle, &sEncEncParam);
+	ret=VPU_EncEncodeFrame(pSession->handle, &sEncEncParam);
 	if(VPU_ENC_RET_SUCCESS!=ret){
 		ALOGE("%s, vpu encode frame failure: ret=0x%X ",__FUNCTION__,ret);
 		if(VPU_ENC_RET_FAILURE_TIMEOUT==ret){
-			VPU_EncReset(handle);
+			VPU_EncReset(pSession->handle);
 		}
+		//start from a fresh session next capture
+		vpu_close_session(pSession);
+		goto finish;
 	}
 
 	if((sEncEncParam.eOutRetCode & VPU_ENC_OUTPUT_DIS)||(sEncEncParam.eOutRetCode & VPU_ENC_OUTPUT_SEQHEADER)){
 		size=sEncEncParam.nOutOutputSize;
-		//ALOGI("encode succeed, output size: %d ",size);
+		memcpy(outBuf,(void*)(uintptr_t)sEncEncParam.nInVirtOutput,size);
 	}
 	else{
 		ALOGE("%s, vpu encode frame failure: no output,  ret=0x%X ",__FUNCTION__,sEncEncParam.eOutRetCode);
 	}
 
-	memcpy(outBuf,(void*)(uintptr_t)sEncEncParam.nInVirtOutput,sEncEncParam.nOutOutputSize);
-
 finish:
+	pthread_mutex_unlock(&sVpuLock);
+	return size;
+}
 
-	//close vpu
-	if(handle!=0){
-		ret=VPU_EncClose(handle);
+void vpu_release()
+{
+	VpuEncRetCode ret;
+
+	pthread_mutex_lock(&sVpuLock);
+	vpu_close_session(&sVpuSession);
+	if(sVpuLoaded){
+		ret=VPU_EncUnLoad();
 		if (ret!=VPU_ENC_RET_SUCCESS){
-			ALOGE("%s: vpu close failure: ret=%d ",__FUNCTION__,ret);
+			ALOGE("%s: vpu unload failure: ret=%d \r\n",__FUNCTION__,ret);
 		}
+		sVpuLoaded=0;
 	}
-
-	//unload
-	ret=VPU_EncUnLoad();
-	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("%s: vpu unload failure: ret=%d \r\n",__FUNCTION__,ret);
-	}
-
-	//release mem
-	if(0==EncFreeMemBlock(&sEncMemInfo)){
-		ALOGE("%s: free memory failure:  ",__FUNCTION__);
-	}
-
-	return size;
+	pthread_mutex_unlock(&sVpuLock);
 }
 #endif
 
@@ -455,13 +555,245 @@ YuvToJpegEncoder * YuvToJpegEncoder::create(int format) {
     }
 }
 
+int YuvToJpegEncoder::getVpuFormat(int format)
+{
+#ifdef BOARD_HAVE_VPU
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+            return format;
+        default:
+            // e.g. 422I, converted by G2D/PXP together with scale.
+            return HAL_PIXEL_FORMAT_YCbCr_420_SP;
+    }
+#else
+    (void)format;
+    return -1;
+#endif
+}
+
+// builders holding the vpu session, with sSessionLock.
+static pthread_mutex_t sSessionLock = PTHREAD_MUTEX_INITIALIZER;
+static int sSessionUsers = 0;
+
+void YuvToJpegEncoder::acquire()
+{
+    pthread_mutex_lock(&sSessionLock);
+    sSessionUsers++;
+    pthread_mutex_unlock(&sSessionLock);
+}
+
+void YuvToJpegEncoder::release()
+{
+    pthread_mutex_lock(&sSessionLock);
+    if (sSessionUsers > 0) {
+        sSessionUsers--;
+    }
+    // other jpeg streams may still encode with the session.
+    if (sSessionUsers == 0) {
+#ifdef BOARD_HAVE_VPU
+        vpu_release();
+#endif
+    }
+    pthread_mutex_unlock(&sSessionLock);
+}
+
 YuvToJpegEncoder::YuvToJpegEncoder()
     : supportVpu(false),
       fNumPlanes(1),
       color(1),
-      mColorFormat(0)
+      mColorFormat(0),
+      mSliceBuf(NULL),
+      mSliceSize(0)
 {}
 
+YuvToJpegEncoder::~YuvToJpegEncoder()
+{
+    free(mSliceBuf);
+}
+
+struct JpegSlice {
+    YuvToJpegEncoder *encoder;
+    uint8_t *yuv;
+    int      width;
+    int      height;
+    int      rowStart;
+    int      rows;
+    int      quality;
+    int      restart;
+    uint8_t *dst;
+    int      dstSize;
+    size_t   size;
+    bool     overflow;
+};
+
+void *YuvToJpegEncoder::encodeSlice(void *data)
+{
+    JpegSlice *slice = (JpegSlice *)data;
+    jpeg_compress_struct  cinfo;
+    jpegBuilder_error_mgr sk_err;
+    jpegBuilder_destination_mgr dest_mgr(slice->dst, slice->dstSize);
+
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = jpeg_std_error(&sk_err);
+    jpeg_create_compress(&cinfo);
+    cinfo.dest = &dest_mgr;
+
+    slice->encoder->setJpegCompressStruct(&cinfo, slice->width, slice->rows,
+                                          slice->quality);
+    // first slice writes DRI, it is one interval long so it has no
+    // restart marker of its own.
+    cinfo.restart_interval = slice->restart;
+    jpeg_start_compress(&cinfo, TRUE);
+    slice->encoder->compress(&cinfo, slice->yuv, slice->height, slice->rowStart);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    slice->size = dest_mgr.jpegsize;
+    slice->overflow = dest_mgr.overflow;
+    return NULL;
+}
+
+// offset of entropy coded data after SOS, 0 if not found.
+static size_t getScanOffset(const uint8_t *jpeg, size_t size)
+{
+    size_t pos = 2;
+    while (pos + 4 <= size && jpeg[pos] == 0xFF) {
+        size_t len = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+        if (jpeg[pos + 1] == 0xDA) {
+            return (pos + 2 + len <= size) ? pos + 2 + len : 0;
+        }
+        pos += 2 + len;
+    }
+
+    return 0;
+}
+
+// write picture height into SOF0 of header.
+static bool setFrameHeight(uint8_t *jpeg, size_t scan, int height)
+{
+    size_t pos = 2;
+    while (pos + 7 <= scan && jpeg[pos] == 0xFF) {
+        if (jpeg[pos + 1] == 0xC0) {
+            jpeg[pos + 5] = (uint8_t)(height >> 8);
+            jpeg[pos + 6] = (uint8_t)(height & 0xFF);
+            return true;
+        }
+        pos += 2 + ((jpeg[pos + 2] << 8) | jpeg[pos + 3]);
+    }
+
+    return false;
+}
+
+int YuvToJpegEncoder::encodeSliced(uint8_t *yuv,
+                                   int      width,
+                                   int      height,
+                                   int      quality,
+                                   uint8_t *outBuf,
+                                   int      outSize)
+{
+    if (width * height < JPEG_SLICE_MIN_PIXELS) {
+        return 0;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int mcuRows = (height + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE;
+    int num = (cpus > JPEG_MAX_SLICES) ? JPEG_MAX_SLICES : (int)cpus;
+    if (num > mcuRows) {
+        num = mcuRows;
+    }
+    if (num < 2) {
+        return 0;
+    }
+
+    // slices are whole MCU rows, all but last one restart interval.
+    int sliceRows = ((mcuRows + num - 1) / num) * JPEG_MCU_SIZE;
+    int restart = sliceRows / JPEG_MCU_SIZE *
+                  ((width + JPEG_MCU_SIZE - 1) / JPEG_MCU_SIZE);
+    if (restart > 0xFFFF) {
+        return 0;
+    }
+    num = (height + sliceRows - 1) / sliceRows;
+
+    // compressed slice is kept under 2 bytes per pixel, else it is
+    // encoded in one pass.
+    size_t sliceSize = (size_t)sliceRows * width * 2 + JPEG_SLICE_HEADER_ROOM;
+    if (mSliceSize < sliceSize * (num - 1)) {
+        free(mSliceBuf);
+        mSliceBuf = (uint8_t *)malloc(sliceSize * (num - 1));
+        mSliceSize = (mSliceBuf != NULL) ? sliceSize * (num - 1) : 0;
+    }
+    if (mSliceBuf == NULL) {
+        return 0;
+    }
+
+    JpegSlice slices[JPEG_MAX_SLICES];
+    for (int i = 0; i < num; i++) {
+        slices[i].encoder = this;
+        slices[i].yuv = yuv;
+        slices[i].width = width;
+        slices[i].height = height;
+        slices[i].rowStart = i * sliceRows;
+        slices[i].rows = (i == num - 1) ? height - i * sliceRows : sliceRows;
+        slices[i].quality = quality;
+        slices[i].restart = (i == 0) ? restart : 0;
+        // first slice goes to output, it carries picture headers.
+        slices[i].dst = (i == 0) ? outBuf : mSliceBuf + sliceSize * (i - 1);
+        slices[i].dstSize = (i == 0) ? outSize : (int)sliceSize;
+        slices[i].size = 0;
+        slices[i].overflow = false;
+    }
+
+    pthread_t threads[JPEG_MAX_SLICES];
+    bool started[JPEG_MAX_SLICES];
+    for (int i = 1; i < num; i++) {
+        started[i] = pthread_create(&threads[i], NULL, encodeSlice, &slices[i]) == 0;
+        if (!started[i]) {
+            encodeSlice(&slices[i]);
+        }
+    }
+    encodeSlice(&slices[0]);
+    for (int i = 1; i < num; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    for (int i = 0; i < num; i++) {
+        if (slices[i].overflow || slices[i].size < 4) {
+            ALOGW("%s slice %d overflow, encode in one pass", __FUNCTION__, i);
+            return 0;
+        }
+    }
+
+    size_t scan = getScanOffset(outBuf, slices[0].size);
+    if (scan == 0 || !setFrameHeight(outBuf, scan, height)) {
+        return 0;
+    }
+
+    // drop EOI of each slice, join scans with RSTn.
+    size_t pos = slices[0].size - 2;
+    for (int i = 1; i < num; i++) {
+        size_t start = getScanOffset(slices[i].dst, slices[i].size);
+        if (start == 0 || start + 2 > slices[i].size) {
+            return 0;
+        }
+        size_t len = slices[i].size - 2 - start;
+        if (pos + 2 + len + 2 > (size_t)outSize) {
+            ALOGW("%s output too small, encode in one pass", __FUNCTION__);
+            return 0;
+        }
+        outBuf[pos++] = 0xFF;
+        outBuf[pos++] = (uint8_t)(0xD0 + ((i - 1) & 0x7));
+        memcpy(outBuf + pos, slices[i].dst + start, len);
+        pos += len;
+    }
+    outBuf[pos++] = 0xFF;
+    outBuf[pos++] = 0xD9;
+
+    return (int)pos;
+}
+
 int YuvToJpegEncoder::encode(void *inYuv,
                              void* inYuvPhy,
                              int   inWidth,
@@ -472,23 +804,31 @@ int YuvToJpegEncoder::encode(void *inYuv,
                              int   outWidth,
                              int   outHeight) {
 #ifdef BOARD_HAVE_VPU
-    //use vpu to encode
-	if((inWidth == outWidth) && (inHeight == outHeight) && supportVpu){
+    //use vpu to encode, it reads source by physical address
+	if((inWidth == outWidth) && (inHeight == outHeight) && supportVpu &&
+	        (inYuvPhy != NULL)){
 		int size;
 		size=vpu_encode(inYuv, inYuvPhy, outWidth, outHeight,quality,color,outBuf,outSize, mColorFormat);
-		return size;
+		if(size>0){
+			return size;
+		}
+		//e.g. size VPU refuses, libjpeg encodes it
+		ALOGW("%s vpu encode %dx%d failed, use libjpeg", __FUNCTION__, outWidth, outHeight);
 	}
 #endif
 
     jpeg_compress_struct  cinfo;
     jpegBuilder_error_mgr sk_err;
     uint8_t *resize_src = NULL;
+    int size = 0;
     jpegBuilder_destination_mgr dest_mgr((uint8_t *)outBuf, outSize);
 
 
     memset(&cinfo, 0, sizeof(cinfo));
     if ((inWidth != outWidth) || (inHeight != outHeight)) {
-        resize_src = (uint8_t *)malloc(outSize);
+        // outSize is jpeg room, resized picture has at most 2 bytes
+        // per pixel.
+        resize_src = (uint8_t *)malloc((size_t)outWidth * outHeight * 2);
         yuvResize((uint8_t *)inYuv,
                   inWidth,
                   inHeight,
@@ -498,6 +838,13 @@ int YuvToJpegEncoder::encode(void *inYuv,
         inYuv = resize_src;
     }
 
+    size = encodeSliced((uint8_t *)inYuv, outWidth, outHeight, quality,
+                        (uint8_t *)outBuf, outSize);
+    if (size > 0) {
+        free(resize_src);
+        return size;
+    }
+
     cinfo.err = jpeg_std_error(&sk_err);
     jpeg_create_compress(&cinfo);
 
@@ -507,7 +854,7 @@ int YuvToJpegEncoder::encode(void *inYuv,
 
     jpeg_start_compress(&cinfo, TRUE);
 
-    compress(&cinfo, (uint8_t *)inYuv);
+    compress(&cinfo, (uint8_t *)inYuv, outHeight, 0);
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
     if (resize_src != NULL) {
@@ -546,7 +893,9 @@ Yuv420SpToJpegEncoder::Yuv420SpToJpegEncoder() :
 }
 
 void Yuv420SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
-                                     uint8_t              *yuv) {
+                                     uint8_t              *yuv,
+                                     int                   height,
+                                     int                   rowStart) {
     JSAMPROW   y[16];
     JSAMPROW   cb[8];
     JSAMPROW   cr[8];
@@ -557,7 +906,6 @@ void Yuv420SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     planes[2] = cr;
 
     int width         = cinfo->image_width;
-    int height        = cinfo->image_height;
     uint8_t *yPlanar  = yuv;
     uint8_t *vuPlanar = yuv + width * height;
     uint8_t *uRows    = new uint8_t[8 * (width >> 1)];
@@ -566,11 +914,12 @@ void Yuv420SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     // process 16 lines of Y and 8 lines of U/V each time.
     while (cinfo->next_scanline < cinfo->image_height) {
         // deitnerleave u and v
-        deinterleave(vuPlanar, uRows, vRows, cinfo->next_scanline, width, height);
+        int row = rowStart + cinfo->next_scanline;
+        deinterleave(vuPlanar, uRows, vRows, row, width, height);
 
         for (int i = 0; i < 16; i++) {
             // y row
-            y[i] = yPlanar + (cinfo->next_scanline + i) * width;
+            y[i] = yPlanar + (row + i) * width;
 
             // construct u row and v row
             if ((i & 1) == 0) {
@@ -597,14 +946,9 @@ void Yuv420SpToJpegEncoder::deinterleave(uint8_t *vuPlanar,
         if (hoff >= (height >> 1)) {
             return;
         }
-        int offset  = hoff * width;
-        uint8_t *vu = vuPlanar + offset;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int index = row * (width >> 1) + i;
-            uRows[index] = vu[0];
-            vRows[index] = vu[1];
-            vu          += 2;
-        }
+        int offset = row * (width >> 1);
+        splitChroma(vuPlanar + hoff * width, uRows + offset, vRows + offset,
+                    width >> 1);
     }
 }
 
@@ -630,6 +974,12 @@ int Yuv420SpToJpegEncoder::yuvResize(uint8_t *srcBuf,
         return -1;
     }
 
+    if (resizeNV12(srcBuf, srcWidth, srcHeight,
+                   dstBuf, dstWidth, dstHeight) == 0) {
+        return 0;
+    }
+
+    // fall back to single thread scaler.
     structConvImage o_img_ptr, i_img_ptr;
     memset(&o_img_ptr, 0, sizeof(o_img_ptr));
     memset(&i_img_ptr, 0, sizeof(i_img_ptr));
@@ -666,7 +1016,9 @@ Yuv422IToJpegEncoder::Yuv422IToJpegEncoder() :
 }
 
 void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
-                                    uint8_t              *yuv) {
+                                    uint8_t              *yuv,
+                                    int                   height,
+                                    int                   rowStart) {
     JSAMPROW   y[16];
     JSAMPROW   cb[16];
     JSAMPROW   cr[16];
@@ -677,7 +1029,6 @@ void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     planes[2] = cr;
 
     int width      = cinfo->image_width;
-    int height     = cinfo->image_height;
     uint8_t *yRows = new uint8_t[16 * width];
     uint8_t *uRows = new uint8_t[16 * (width >> 1)];
     uint8_t *vRows = new uint8_t[16 * (width >> 1)];
@@ -690,7 +1041,7 @@ void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
                      yRows,
                      uRows,
                      vRows,
-                     cinfo->next_scanline,
+                     rowStart + cinfo->next_scanline,
                      width,
                      height);
 
@@ -720,16 +1071,9 @@ void Yuv422IToJpegEncoder::deinterleave(uint8_t *yuv,
                                         int      width,
                                         int      /*height*/) {
     for (int row = 0; row < 16; ++row) {
-        uint8_t *yuvSeg = yuv + (rowIndex + row) * width * 2;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int indexY = row * width + (i << 1);
-            int indexU = row * (width >> 1) + i;
-            yRows[indexY]     = yuvSeg[0];
-            yRows[indexY + 1] = yuvSeg[2];
-            uRows[indexU]     = yuvSeg[1];
-            vRows[indexU]     = yuvSeg[3];
-            yuvSeg           += 4;
-        }
+        int offset = row * (width >> 1);
+        splitYUYV(yuv + (rowIndex + row) * width * 2, yRows + row * width,
+                  uRows + offset, vRows + offset, width >> 1);
     }
 }
 
@@ -831,7 +1175,9 @@ Yuv422SpToJpegEncoder::Yuv422SpToJpegEncoder() :
     }
 
 void Yuv422SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
-        uint8_t              *yuv) {
+        uint8_t              *yuv,
+        int                   height,
+        int                   rowStart) {
     JSAMPROW   y[16];
     JSAMPROW   cb[16];
     JSAMPROW   cr[16];
@@ -842,7 +1188,6 @@ void Yuv422SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     planes[2] = cr;
 
     int width      = cinfo->image_width;
-    int height     = cinfo->image_height;
     uint8_t *yRows = new uint8_t[16 * width];
     uint8_t *uRows = new uint8_t[16 * (width >> 1)];
     uint8_t *vRows = new uint8_t[16 * (width >> 1)];
@@ -855,7 +1200,7 @@ void Yuv422SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
                 yRows,
                 uRows,
                 vRows,
-                cinfo->next_scanline,
+                rowStart + cinfo->next_scanline,
                 width,
                 height);
 
@@ -885,16 +1230,9 @@ void Yuv422SpToJpegEncoder::deinterleave(uint8_t *yuv,
         int      width,
         int      /*height*/) {
     for (int row = 0; row < 16; ++row) {
-        uint8_t *yuvSeg = yuv + (rowIndex + row) * width * 2;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int indexY = row * width + (i << 1);
-            int indexU = row * (width >> 1) + i;
-            yRows[indexY]     = yuvSeg[0];
-            yRows[indexY + 1] = yuvSeg[2];
-            uRows[indexU]     = yuvSeg[1];
-            vRows[indexU]     = yuvSeg[3];
-            yuvSeg           += 4;
-        }
+        int offset = row * (width >> 1);
+        splitYUYV(yuv + (rowIndex + row) * width * 2, yRows + row * width,
+                  uRows + offset, vRows + offset, width >> 1);
     }
 }
 
@@ -1000,6 +1338,7 @@ static boolean jpegBuilder_empty_output_buffer(j_compress_ptr cinfo) {
 
     dest->next_output_byte = dest->buf;
     dest->free_in_buffer   = dest->bufsize;
+    dest->overflow = true;
     return TRUE; // ?
 }
 
@@ -1020,5 +1359,6 @@ jpegBuilder_destination_mgr::jpegBuilder_destination_mgr(uint8_t *input,
     this->bufsize = size;
 
     jpegsize = 0;
+    overflow = false;
 }
 
@@ -42,6 +42,16 @@ public:
     /** Create an encoder based on the YUV format.
      */
     static YuvToJpegEncoder* create(int pixelFormat);
+    /** Hold vpu encoder session kept across captures.
+     */
+    static void acquire();
+    /** Drop hold of acquire(), session is released with last one.
+     */
+    static void release();
+    /** Format VPU encodes for pixelFormat, itself when VPU takes
+     *  it as is, -1 without VPU.
+     */
+    static int getVpuFormat(int pixelFormat);
 
     YuvToJpegEncoder();
 
@@ -57,7 +67,7 @@ public:
                int   outWidth,
                int   outHeight);
 
-    virtual ~YuvToJpegEncoder() {}
+    virtual ~YuvToJpegEncoder();
     int getColorFormat() {return mColorFormat;}
 
 protected:
@@ -70,8 +80,12 @@ protected:
                                int                   height,
                                int                   quality);
     virtual void configSamplingFactors(jpeg_compress_struct *cinfo) = 0;
+    // encode rows of cinfo from rowStart of yuv picture, which is
+    // height rows, so a slice of picture can be encoded.
     virtual void compress(jpeg_compress_struct *cinfo,
-                          uint8_t              *yuv)                = 0;
+                          uint8_t              *yuv,
+                          int                   height,
+                          int                   rowStart)           = 0;
     virtual int  yuvResize(uint8_t *srcBuf,
                            int      srcWidth,
                            int      srcHeight,
@@ -79,6 +93,22 @@ protected:
                            int      dstWidth,
                            int      dstHeight) = 0;
     bool supportVpu;
+
+private:
+    /** Encode horizontal slices on all cores, joined by restart
+     *  markers. 0 if picture is not sliced.
+     */
+    int encodeSliced(uint8_t *yuv,
+                     int      width,
+                     int      height,
+                     int      quality,
+                     uint8_t *outBuf,
+                     int      outSize);
+    static void *encodeSlice(void *data);
+
+    // compressed slices after first one, kept across captures.
+    uint8_t *mSliceBuf;
+    size_t   mSliceSize;
 };
 
 class Yuv420SpToJpegEncoder : public YuvToJpegEncoder {
@@ -101,7 +131,9 @@ private:
                       int      width,
                       int      height);
     void        compress(jpeg_compress_struct *cinfo,
-                         uint8_t              *yuv);
+                         uint8_t              *yuv,
+                         int                   height,
+                         int                   rowStart);
     virtual int yuvResize(uint8_t *srcBuf,
                           int      srcWidth,
                           int      srcHeight,
@@ -118,7 +150,9 @@ public:
 private:
     void configSamplingFactors(jpeg_compress_struct *cinfo);
     void compress(jpeg_compress_struct *cinfo,
-                  uint8_t              *yuv);
+                  uint8_t              *yuv,
+                  int                   height,
+                  int                   rowStart);
     void deinterleave(uint8_t *yuv,
                       uint8_t *yRows,
                       uint8_t *uRows,
@@ -142,7 +176,9 @@ class Yuv422SpToJpegEncoder : public YuvToJpegEncoder {
     private:
         void configSamplingFactors(jpeg_compress_struct *cinfo);
         void compress(jpeg_compress_struct *cinfo,
-                uint8_t              *yuv);
+                uint8_t              *yuv,
+                int                   height,
+                int                   rowStart);
         void deinterleave(uint8_t *yuv,
                 uint8_t *yRows,
                 uint8_t *uRows,
@@ -165,6 +201,8 @@ struct jpegBuilder_destination_mgr : jpeg_destination_mgr {
     uint8_t *buf;
     int      bufsize;
     size_t   jpegsize;
+    // buffer was too small, output wrapped.
+    bool     overflow;
 };
 
 
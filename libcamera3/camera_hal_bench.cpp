@@ -0,0 +1,679 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// camera HAL throughput through camera3 API, one key=value result per line
+// so runs before and after a change can be diffed.
+// usage: camera_hal_bench [-t seconds] [-c id,id,...] [-s set]
+//   sets: preview, record (preview + video), jpeg (preview + blob every
+//   BENCH_JPEG_INTERVAL requests), quad (preview on all listed cameras at
+//   once, e.g. 4 channels of max9286). all sets run when -s is not given.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <hardware/camera_common.h>
+#include <hardware/camera3.h>
+#include <hardware/gralloc.h>
+#include <system/camera_metadata.h>
+#include <utils/Timers.h>
+
+#define BENCH_SECONDS 10
+#define BENCH_MAX_CAMERAS 4
+#define BENCH_MAX_STREAMS 3
+#define BENCH_MAX_BUFFERS 16
+// frame slots, more than buffers any stream can have in flight.
+#define BENCH_FRAME_SLOTS 64
+#define BENCH_MAX_SAMPLES 16384
+#define BENCH_JPEG_INTERVAL 10
+// preview size is the largest one up to 1080p.
+#define BENCH_PREVIEW_WIDTH 1920
+#define BENCH_PREVIEW_HEIGHT 1080
+// in-flight requests are given up after this.
+#define BENCH_DRAIN_TIMEOUT 2000000000LL
+
+enum {
+    SET_PREVIEW = 0,
+    SET_RECORD,
+    SET_JPEG,
+    SET_QUAD,
+    SET_NUM
+};
+
+static const char* sSetNames[SET_NUM] = {"preview", "record", "jpeg", "quad"};
+
+struct BenchStream
+{
+    // stream pointers of buffers are cast back, keep it first.
+    camera3_stream_t stream;
+    uint32_t count;
+    buffer_handle_t buffers[BENCH_MAX_BUFFERS];
+    bool busy[BENCH_MAX_BUFFERS];
+};
+
+struct BenchFrame
+{
+    bool used;
+    nsecs_t submit;
+    // output buffers not returned yet.
+    uint32_t buffers;
+    // final result metadata or request error received.
+    bool result;
+};
+
+struct BenchCamera
+{
+    // callbacks find camera from ops pointer, keep it first.
+    camera3_callback_ops_t ops;
+    int id;
+    camera3_device_t* device;
+    const camera_metadata_t* info;
+    BenchStream streams[BENCH_MAX_STREAMS];
+    uint32_t numStreams;
+    int32_t jpegStream;
+    int32_t jpegSize;
+    int32_t partialCount;
+    int32_t set;
+    nsecs_t duration;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    BenchFrame frames[BENCH_FRAME_SLOTS];
+    uint32_t inFlight;
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t dropped;
+    bool failed;
+    nsecs_t* latency;
+    uint32_t samples;
+    nsecs_t elapsed;
+};
+
+static camera_module_t* sModule;
+static alloc_device_t* sAlloc;
+
+static int cmpNsecs(const void* a, const void* b)
+{
+    nsecs_t x = *(const nsecs_t*)a, y = *(const nsecs_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// called with camera lock held.
+static void checkFrameDone(BenchCamera* cam, BenchFrame* frame)
+{
+    if (!frame->used || frame->buffers > 0 || !frame->result) {
+        return;
+    }
+
+    frame->used = false;
+    cam->inFlight--;
+    cam->completed++;
+    if (cam->samples < BENCH_MAX_SAMPLES) {
+        cam->latency[cam->samples++] =
+                systemTime(SYSTEM_TIME_MONOTONIC) - frame->submit;
+    }
+    pthread_cond_broadcast(&cam->cond);
+}
+
+static void processCaptureResult(const camera3_callback_ops_t* ops,
+                                 const camera3_capture_result_t* result)
+{
+    BenchCamera* cam = (BenchCamera*)ops;
+    pthread_mutex_lock(&cam->lock);
+    BenchFrame* frame = &cam->frames[result->frame_number % BENCH_FRAME_SLOTS];
+
+    for (uint32_t i = 0; i < result->num_output_buffers; i++) {
+        const camera3_stream_buffer_t& out = result->output_buffers[i];
+        if (out.release_fence >= 0) {
+            close(out.release_fence);
+        }
+        for (uint32_t k = 0; k < cam->numStreams; k++) {
+            BenchStream& s = cam->streams[k];
+            if (out.stream == &s.stream) {
+                s.busy[out.buffer - s.buffers] = false;
+            }
+        }
+        if (frame->buffers > 0) {
+            frame->buffers--;
+        }
+    }
+
+    if (result->result != NULL && result->partial_result >= (uint32_t)cam->partialCount) {
+        frame->result = true;
+    }
+    checkFrameDone(cam, frame);
+    pthread_cond_broadcast(&cam->cond);
+    pthread_mutex_unlock(&cam->lock);
+}
+
+static void notify(const camera3_callback_ops_t* ops,
+                   const camera3_notify_msg_t* msg)
+{
+    if (msg->type != CAMERA3_MSG_ERROR) {
+        return;
+    }
+
+    BenchCamera* cam = (BenchCamera*)ops;
+    const camera3_error_msg_t& error = msg->message.error;
+    pthread_mutex_lock(&cam->lock);
+    BenchFrame* frame = &cam->frames[error.frame_number % BENCH_FRAME_SLOTS];
+    switch (error.error_code) {
+        case CAMERA3_MSG_ERROR_DEVICE:
+            cam->failed = true;
+            break;
+        case CAMERA3_MSG_ERROR_REQUEST:
+            cam->dropped++;
+            frame->result = true;
+            break;
+        case CAMERA3_MSG_ERROR_RESULT:
+            frame->result = true;
+            break;
+        case CAMERA3_MSG_ERROR_BUFFER:
+            cam->dropped++;
+            break;
+        default:
+            break;
+    }
+    checkFrameDone(cam, frame);
+    pthread_cond_broadcast(&cam->cond);
+    pthread_mutex_unlock(&cam->lock);
+}
+
+// largest output size of format, within limit if given.
+static bool findSize(const camera_metadata_t* info, int32_t format,
+                     int32_t maxWidth, int32_t maxHeight,
+                     uint32_t* width, uint32_t* height)
+{
+    camera_metadata_ro_entry_t entry;
+    if (find_camera_metadata_ro_entry(info,
+            ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS, &entry) != 0) {
+        return false;
+    }
+
+    int64_t best = 0;
+    for (size_t i = 0; i + 3 < entry.count; i += 4) {
+        const int32_t* c = entry.data.i32 + i;
+        if (c[0] != format || c[3] !=
+                ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS_OUTPUT) {
+            continue;
+        }
+        if (maxWidth > 0 && (c[1] > maxWidth || c[2] > maxHeight)) {
+            continue;
+        }
+        if ((int64_t)c[1] * c[2] > best) {
+            best = (int64_t)c[1] * c[2];
+            *width = c[1];
+            *height = c[2];
+        }
+    }
+
+    return best > 0;
+}
+
+static int32_t findInt32(const camera_metadata_t* info, uint32_t tag,
+                         int32_t def)
+{
+    camera_metadata_ro_entry_t entry;
+    if (find_camera_metadata_ro_entry(info, tag, &entry) != 0 ||
+            entry.count == 0) {
+        return def;
+    }
+    return entry.data.i32[0];
+}
+
+static void addStream(BenchCamera* cam, int32_t format, uint32_t width,
+                      uint32_t height, uint32_t usage, android_dataspace space)
+{
+    BenchStream& s = cam->streams[cam->numStreams++];
+    memset(&s, 0, sizeof(s));
+    s.stream.stream_type = CAMERA3_STREAM_OUTPUT;
+    s.stream.width = width;
+    s.stream.height = height;
+    s.stream.format = format;
+    s.stream.usage = usage;
+    s.stream.data_space = space;
+    s.stream.rotation = CAMERA3_STREAM_ROTATION_0;
+}
+
+static void freeBuffers(BenchCamera* cam)
+{
+    for (uint32_t k = 0; k < cam->numStreams; k++) {
+        BenchStream& s = cam->streams[k];
+        for (uint32_t i = 0; i < s.count; i++) {
+            sAlloc->free(sAlloc, s.buffers[i]);
+        }
+        s.count = 0;
+    }
+}
+
+// gralloc buffers with format and usage negotiated by configure.
+static int allocBuffers(BenchCamera* cam)
+{
+    for (uint32_t k = 0; k < cam->numStreams; k++) {
+        BenchStream& s = cam->streams[k];
+        uint32_t count = s.stream.max_buffers;
+        if (count == 0 || count > BENCH_MAX_BUFFERS) {
+            count = BENCH_MAX_BUFFERS;
+        }
+
+        int width = s.stream.width, height = s.stream.height;
+        if (s.stream.format == HAL_PIXEL_FORMAT_BLOB) {
+            width = cam->jpegSize;
+            height = 1;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            int stride = 0;
+            if (sAlloc->alloc(sAlloc, width, height, s.stream.format,
+                              s.stream.usage, &s.buffers[i], &stride) != 0) {
+                printf("cam%d.%s.error=alloc\n", cam->id, sSetNames[cam->set]);
+                freeBuffers(cam);
+                return -ENOMEM;
+            }
+            s.count++;
+        }
+    }
+
+    return 0;
+}
+
+static int configure(BenchCamera* cam)
+{
+    uint32_t width = 0, height = 0;
+    if (!findSize(cam->info, HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED,
+                  BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT, &width, &height)) {
+        printf("cam%d.%s.error=no_preview_size\n", cam->id, sSetNames[cam->set]);
+        return -EINVAL;
+    }
+
+    cam->numStreams = 0;
+    cam->jpegStream = -1;
+    addStream(cam, HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED, width, height,
+              GRALLOC_USAGE_HW_TEXTURE | GRALLOC_USAGE_HW_COMPOSER,
+              HAL_DATASPACE_UNKNOWN);
+    if (cam->set == SET_RECORD) {
+        addStream(cam, HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED, width, height,
+                  GRALLOC_USAGE_HW_VIDEO_ENCODER, HAL_DATASPACE_UNKNOWN);
+    }
+    else if (cam->set == SET_JPEG) {
+        if (!findSize(cam->info, HAL_PIXEL_FORMAT_BLOB, 0, 0, &width, &height)) {
+            printf("cam%d.%s.error=no_jpeg_size\n", cam->id, sSetNames[cam->set]);
+            return -EINVAL;
+        }
+        cam->jpegStream = cam->numStreams;
+        addStream(cam, HAL_PIXEL_FORMAT_BLOB, width, height,
+                  GRALLOC_USAGE_SW_READ_OFTEN, HAL_DATASPACE_V0_JFIF);
+    }
+
+    camera3_stream_t* streams[BENCH_MAX_STREAMS];
+    for (uint32_t k = 0; k < cam->numStreams; k++) {
+        streams[k] = &cam->streams[k].stream;
+    }
+    camera3_stream_configuration_t config;
+    memset(&config, 0, sizeof(config));
+    config.num_streams = cam->numStreams;
+    config.streams = streams;
+    config.operation_mode = CAMERA3_STREAM_CONFIGURATION_NORMAL_MODE;
+    if (cam->device->ops->configure_streams(cam->device, &config) != 0) {
+        printf("cam%d.%s.error=configure\n", cam->id, sSetNames[cam->set]);
+        return -EINVAL;
+    }
+
+    return allocBuffers(cam);
+}
+
+// called with camera lock held, false if some stream has no free buffer.
+static bool pickBuffers(BenchCamera* cam, uint32_t frameNumber,
+                        camera3_stream_buffer_t* outputs, uint32_t* num)
+{
+    *num = 0;
+    for (uint32_t k = 0; k < cam->numStreams; k++) {
+        if ((int32_t)k == cam->jpegStream &&
+                frameNumber % BENCH_JPEG_INTERVAL != 0) {
+            continue;
+        }
+
+        BenchStream& s = cam->streams[k];
+        uint32_t i = 0;
+        while (i < s.count && s.busy[i]) {
+            i++;
+        }
+        if (i == s.count) {
+            return false;
+        }
+
+        camera3_stream_buffer_t& out = outputs[(*num)++];
+        memset(&out, 0, sizeof(out));
+        out.stream = &s.stream;
+        out.buffer = &s.buffers[i];
+        out.status = CAMERA3_BUFFER_STATUS_OK;
+        out.acquire_fence = -1;
+        out.release_fence = -1;
+    }
+
+    for (uint32_t i = 0; i < *num; i++) {
+        BenchStream* s = (BenchStream*)outputs[i].stream;
+        s->busy[outputs[i].buffer - s->buffers] = true;
+    }
+    return true;
+}
+
+// called with camera lock held.
+static void waitCamera(BenchCamera* cam, nsecs_t timeout)
+{
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    pthread_cond_timedwait(&cam->cond, &cam->lock, &ts);
+}
+
+// submits requests as fast as buffers come back, for duration.
+static void runCamera(BenchCamera* cam)
+{
+    int tmpl = cam->set == SET_RECORD ? CAMERA3_TEMPLATE_VIDEO_RECORD
+                                      : CAMERA3_TEMPLATE_PREVIEW;
+    const camera_metadata_t* settings =
+            cam->device->ops->construct_default_request_settings(cam->device, tmpl);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t end = start + cam->duration;
+    pthread_mutex_lock(&cam->lock);
+    for (uint32_t frameNumber = 0; !cam->failed; ) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (now >= end) {
+            break;
+        }
+
+        camera3_stream_buffer_t outputs[BENCH_MAX_STREAMS];
+        uint32_t num = 0;
+        BenchFrame* frame = &cam->frames[frameNumber % BENCH_FRAME_SLOTS];
+        if (frame->used || !pickBuffers(cam, frameNumber, outputs, &num)) {
+            waitCamera(cam, 1000000000LL);
+            continue;
+        }
+
+        frame->used = true;
+        frame->buffers = num;
+        frame->result = false;
+        frame->submit = now;
+        cam->inFlight++;
+        cam->submitted++;
+        pthread_mutex_unlock(&cam->lock);
+
+        camera3_capture_request_t request;
+        memset(&request, 0, sizeof(request));
+        request.frame_number = frameNumber;
+        // repeating request, settings are sent once.
+        request.settings = frameNumber == 0 ? settings : NULL;
+        request.num_output_buffers = num;
+        request.output_buffers = outputs;
+        int ret = cam->device->ops->process_capture_request(cam->device, &request);
+
+        pthread_mutex_lock(&cam->lock);
+        if (ret != 0) {
+            printf("cam%d.%s.error=request_%d\n", cam->id, sSetNames[cam->set], ret);
+            cam->failed = true;
+            frame->used = false;
+            cam->inFlight--;
+            cam->submitted--;
+            for (uint32_t i = 0; i < num; i++) {
+                BenchStream* s = (BenchStream*)outputs[i].stream;
+                s->busy[outputs[i].buffer - s->buffers] = false;
+            }
+            break;
+        }
+        frameNumber++;
+    }
+    cam->elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + BENCH_DRAIN_TIMEOUT;
+    while (cam->inFlight > 0 && systemTime(SYSTEM_TIME_MONOTONIC) < deadline) {
+        waitCamera(cam, 1000000000LL);
+    }
+    bool stuck = cam->inFlight > 0;
+    pthread_mutex_unlock(&cam->lock);
+
+    if (stuck) {
+        // buffers HAL still holds come back through flush.
+        cam->device->ops->flush(cam->device);
+    }
+}
+
+static void* cameraThread(void* arg)
+{
+    runCamera((BenchCamera*)arg);
+    return NULL;
+}
+
+static int openCamera(BenchCamera* cam, int id, int32_t set, nsecs_t duration)
+{
+    memset(cam, 0, sizeof(*cam));
+    cam->ops.process_capture_result = processCaptureResult;
+    cam->ops.notify = notify;
+    cam->id = id;
+    cam->set = set;
+    cam->duration = duration;
+    pthread_mutex_init(&cam->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cam->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    cam->latency = (nsecs_t*)calloc(BENCH_MAX_SAMPLES, sizeof(nsecs_t));
+    if (cam->latency == NULL) {
+        return -ENOMEM;
+    }
+
+    struct camera_info info;
+    if (sModule->get_camera_info(id, &info) != 0) {
+        printf("cam%d.error=info\n", id);
+        return -EINVAL;
+    }
+    cam->info = info.static_camera_characteristics;
+    cam->jpegSize = findInt32(cam->info, ANDROID_JPEG_MAX_SIZE, 0);
+    cam->partialCount = findInt32(cam->info, ANDROID_REQUEST_PARTIAL_RESULT_COUNT, 1);
+
+    char name[16];
+    snprintf(name, sizeof(name), "%d", id);
+    hw_device_t* device = NULL;
+    if (sModule->common.methods->open(&sModule->common, name, &device) != 0) {
+        printf("cam%d.%s.error=open\n", id, sSetNames[set]);
+        return -ENODEV;
+    }
+    cam->device = (camera3_device_t*)device;
+    if (cam->device->ops->initialize(cam->device, &cam->ops) != 0) {
+        printf("cam%d.%s.error=initialize\n", id, sSetNames[set]);
+        return -ENODEV;
+    }
+
+    return configure(cam);
+}
+
+static void closeCamera(BenchCamera* cam)
+{
+    if (cam->device != NULL) {
+        cam->device->common.close(&cam->device->common);
+        cam->device = NULL;
+    }
+    freeBuffers(cam);
+    free(cam->latency);
+    cam->latency = NULL;
+    pthread_mutex_destroy(&cam->lock);
+    pthread_cond_destroy(&cam->cond);
+}
+
+static void printCamera(BenchCamera* cam, double cpu)
+{
+    const char* set = sSetNames[cam->set];
+    double seconds = cam->elapsed / 1000000000.0;
+    printf("cam%d.%s.requests=%u\n", cam->id, set, cam->submitted);
+    printf("cam%d.%s.fps=%.1f\n", cam->id, set,
+           seconds > 0 ? cam->completed / seconds : 0);
+    printf("cam%d.%s.dropped=%u\n", cam->id, set, cam->dropped);
+    printf("cam%d.%s.cpu_pct=%.1f\n", cam->id, set, cpu);
+
+    uint32_t n = cam->samples;
+    if (n == 0) {
+        return;
+    }
+    qsort(cam->latency, n, sizeof(nsecs_t), cmpNsecs);
+    printf("cam%d.%s.p50_us=%lld\n", cam->id, set, (long long)cam->latency[n / 2] / 1000);
+    printf("cam%d.%s.p90_us=%lld\n", cam->id, set, (long long)cam->latency[n * 9 / 10] / 1000);
+    printf("cam%d.%s.p99_us=%lld\n", cam->id, set, (long long)cam->latency[n * 99 / 100] / 1000);
+    printf("cam%d.%s.max_us=%lld\n", cam->id, set, (long long)cam->latency[n - 1] / 1000);
+}
+
+static nsecs_t cpuTime()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+// runs set on cameras at once, HAL runs in this process so process cpu
+// time is HAL cpu time.
+static void benchSet(const int* ids, int num, int32_t set, nsecs_t duration)
+{
+    BenchCamera cams[BENCH_MAX_CAMERAS];
+    pthread_t threads[BENCH_MAX_CAMERAS];
+    int opened = 0;
+    bool ok = true;
+    for (; opened < num; opened++) {
+        if (openCamera(&cams[opened], ids[opened], set, duration) != 0) {
+            ok = false;
+            opened++;
+            break;
+        }
+    }
+
+    if (ok) {
+        nsecs_t cpu = cpuTime();
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < num; i++) {
+            pthread_create(&threads[i], NULL, cameraThread, &cams[i]);
+        }
+        for (int i = 0; i < num; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        nsecs_t wall = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        double pct = wall > 0 ? (cpuTime() - cpu) * 100.0 / wall : 0;
+        for (int i = 0; i < num; i++) {
+            printCamera(&cams[i], pct);
+        }
+    }
+
+    for (int i = 0; i < opened; i++) {
+        closeCamera(&cams[i]);
+    }
+}
+
+static void onDeviceStatus(const camera_module_callbacks_t*, int, int)
+{
+}
+
+static void onTorchStatus(const camera_module_callbacks_t*, const char*, int)
+{
+}
+
+int main(int argc, char** argv)
+{
+    nsecs_t duration = BENCH_SECONDS * 1000000000LL;
+    int ids[BENCH_MAX_CAMERAS];
+    int numIds = 0;
+    int32_t only = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:s:")) != -1) {
+        switch (opt) {
+            case 't':
+                if (atoi(optarg) > 0) {
+                    duration = atoi(optarg) * 1000000000LL;
+                }
+                break;
+            case 'c':
+                for (char* p = strtok(optarg, ","); p != NULL &&
+                        numIds < BENCH_MAX_CAMERAS; p = strtok(NULL, ",")) {
+                    ids[numIds++] = atoi(p);
+                }
+                break;
+            case 's':
+                for (int32_t i = 0; i < SET_NUM; i++) {
+                    if (strcmp(optarg, sSetNames[i]) == 0) {
+                        only = i;
+                    }
+                }
+                if (only < 0) {
+                    fprintf(stderr, "unknown set %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-c id,id,...] "
+                        "[-s preview|record|jpeg|quad]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID,
+                      (const hw_module_t**)&sModule) != 0) {
+        fprintf(stderr, "cannot load camera module\n");
+        return 1;
+    }
+    const hw_module_t* gralloc = NULL;
+    if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &gralloc) != 0 ||
+            gralloc_open(gralloc, &sAlloc) != 0) {
+        fprintf(stderr, "cannot open gralloc\n");
+        return 1;
+    }
+
+    static camera_module_callbacks_t callbacks = {onDeviceStatus, onTorchStatus};
+    if (sModule->init != NULL) {
+        sModule->init();
+    }
+    sModule->set_callbacks(&callbacks);
+
+    if (numIds == 0) {
+        numIds = sModule->get_number_of_cameras();
+        if (numIds > BENCH_MAX_CAMERAS) {
+            numIds = BENCH_MAX_CAMERAS;
+        }
+        for (int i = 0; i < numIds; i++) {
+            ids[i] = i;
+        }
+    }
+
+    for (int32_t set = 0; set < SET_NUM; set++) {
+        if (only >= 0 && set != only) {
+            continue;
+        }
+        if (set == SET_QUAD) {
+            if (numIds > 1) {
+                benchSet(ids, numIds, set, duration);
+            }
+            continue;
+        }
+        for (int i = 0; i < numIds; i++) {
+            benchSet(&ids[i], 1, set, duration);
+        }
+    }
+
+    gralloc_close(sAlloc);
+    return 0;
+}
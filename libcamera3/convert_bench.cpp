@@ -0,0 +1,357 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// camera color convert throughput, usage: camera_convert_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/Timers.h>
+#include "ColorConvert.h"
+
+#define BENCH_ITERATIONS 50
+
+struct BenchSize
+{
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+};
+
+static const BenchSize sSizes[] = {
+    {"vga", 640, 480},
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"5mp", 2592, 1944},
+};
+
+static const BenchSize sResizeSizes[] = {
+    {"thumb", 160, 120},
+    {"vga", 640, 480},
+    {"1080p", 1920, 1080},
+};
+
+// MB/s of source bytes.
+static double getRate(size_t bytes, int iterations, nsecs_t time)
+{
+    if (time <= 0) {
+        return 0;
+    }
+
+    return (double)bytes * iterations * 1000.0 / time;
+}
+
+static void benchSize(const BenchSize& size, int iterations, bool neon)
+{
+    size_t yuyvSize = size.width * size.height * 2;
+    size_t nv12Size = size.width * size.height * 3 / 2;
+    uint8_t* src = (uint8_t*)malloc(yuyvSize);
+    uint8_t* dst = (uint8_t*)malloc(nv12Size);
+    if (src == NULL || dst == NULL) {
+        printf("%-6s allocation failed\n", size.name);
+        free(src);
+        free(dst);
+        return;
+    }
+
+    for (size_t i = 0; i < yuyvSize; i++) {
+        src[i] = (uint8_t)(i * 7);
+    }
+
+    setConvertNeon(neon);
+    // touch pages before timing.
+    convertYUYVToNV12(src, dst, size.width, size.height, false);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        convertYUYVToNV12(src, dst, size.width, size.height, false);
+    }
+    nsecs_t yuyvTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    uint8_t* uv = dst + size.width * size.height;
+    size_t uvSize = size.width * size.height / 2;
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        swapChromaBytes(uv, uvSize);
+    }
+    nsecs_t swapTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    printf("%-6s %-6s yuyv->nv12 %8.1f MB/s %6.2f ms  nv12->nv21 %8.1f MB/s %6.2f ms\n",
+           size.name, neon ? "neon" : "scalar",
+           getRate(yuyvSize, iterations, yuyvTime),
+           yuyvTime / 1000000.0 / iterations,
+           getRate(uvSize, iterations, swapTime),
+           swapTime / 1000000.0 / iterations);
+
+    free(src);
+    free(dst);
+}
+
+// NV12 scale from 5mp source, thumbnail and preview sizes.
+static void benchResize(const BenchSize& size, int iterations, bool neon)
+{
+    const BenchSize& from = sSizes[sizeof(sSizes) / sizeof(sSizes[0]) - 1];
+    size_t srcSize = from.width * from.height * 3 / 2;
+    size_t dstSize = size.width * size.height * 3 / 2;
+    uint8_t* src = (uint8_t*)malloc(srcSize);
+    uint8_t* dst = (uint8_t*)malloc(dstSize);
+    if (src == NULL || dst == NULL) {
+        printf("%-6s allocation failed\n", size.name);
+        free(src);
+        free(dst);
+        return;
+    }
+
+    memset(src, 0x80, srcSize);
+    setConvertNeon(neon);
+    // first call builds coefficient table.
+    resizeNV12(src, from.width, from.height, dst, size.width, size.height);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        resizeNV12(src, from.width, from.height, dst, size.width, size.height);
+    }
+    nsecs_t time = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    printf("%-6s %-6s resize from %s %6.2f ms\n", size.name,
+           neon ? "neon" : "scalar", from.name,
+           time / 1000000.0 / iterations);
+
+    free(src);
+    free(dst);
+}
+
+// VADC TV-in frame, 32 bit YUV444 to NV12.
+static void benchYUV444(int iterations, bool neon)
+{
+    const uint32_t width = 720, height = 576;
+    size_t srcSize = width * height * 4;
+    uint8_t* src = (uint8_t*)malloc(srcSize);
+    uint8_t* dst = (uint8_t*)malloc(width * height * 3 / 2);
+    if (src == NULL || dst == NULL) {
+        printf("pal    allocation failed\n");
+        free(src);
+        free(dst);
+        return;
+    }
+
+    for (size_t i = 0; i < srcSize; i++) {
+        src[i] = (uint8_t)(i * 7);
+    }
+    setConvertNeon(neon);
+    convertYUV444ToNV12(src, dst, width, height);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        convertYUV444ToNV12(src, dst, width, height);
+    }
+    nsecs_t time = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    printf("pal    %-6s yuv444->nv12 %8.1f MB/s %6.2f ms\n",
+           neon ? "neon" : "scalar", getRate(srcSize, iterations, time),
+           time / 1000000.0 / iterations);
+
+    free(src);
+    free(dst);
+}
+
+// odd sizes of VADC frame against a plain loop, guard bytes catch
+// writes past NV12 buffer.
+static bool checkYUV444(uint32_t width, uint32_t height, bool neon)
+{
+    const size_t guard = 64;
+    size_t srcSize = width * height * 4;
+    size_t dstSize = width * height * 3 / 2;
+    uint8_t* src = (uint8_t*)malloc(srcSize);
+    uint8_t* dst = (uint8_t*)malloc(dstSize + guard);
+    uint8_t* ref = (uint8_t*)malloc(dstSize + guard);
+    if (src == NULL || dst == NULL || ref == NULL) {
+        printf("%ux%u allocation failed\n", width, height);
+        free(src);
+        free(dst);
+        free(ref);
+        return false;
+    }
+
+    for (size_t i = 0; i < srcSize; i++) {
+        src[i] = (uint8_t)(i * 7);
+    }
+    memset(dst, 0x5a, dstSize + guard);
+    memset(ref, 0x5a, dstSize + guard);
+
+    // V U Y A source, chroma of even pixels on even rows of whole pairs.
+    uint8_t* refUV = ref + width * height;
+    for (uint32_t h = 0; h < height; h++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t* p = src + (h * width + x) * 4;
+            ref[h * width + x] = p[2];
+            if ((h & 0x1) || h >= (height & ~1) || (x & 0x1)) {
+                continue;
+            }
+            refUV[(h / 2) * width + x] = p[1];
+            if (x + 1 < width) {
+                refUV[(h / 2) * width + x + 1] = p[0];
+            }
+        }
+    }
+
+    setConvertNeon(neon);
+    convertYUV444ToNV12(src, dst, width, height);
+    bool ok = memcmp(dst, ref, dstSize + guard) == 0;
+    printf("%ux%u %-6s yuv444->nv12 %s\n", width, height,
+           neon ? "neon" : "scalar", ok ? "ok" : "FAILED");
+
+    free(src);
+    free(dst);
+    free(ref);
+    return ok;
+}
+
+// TV-in PAL YUYV frame deinterlaced in place.
+static void benchDeinterlace(int iterations, bool neon, int mode)
+{
+    const uint32_t width = 720, height = 576;
+    uint32_t rowBytes = width * 2;
+    size_t size = rowBytes * height;
+    uint8_t* frame = (uint8_t*)malloc(size);
+    uint8_t* history = (uint8_t*)malloc(rowBytes * (height / 2));
+    if (frame == NULL || history == NULL) {
+        printf("pal    allocation failed\n");
+        free(frame);
+        free(history);
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        frame[i] = (uint8_t)(i * 7);
+    }
+    memset(history, 0, rowBytes * (height / 2));
+    setConvertNeon(neon);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        deinterlacePlane(frame, rowBytes, height, history, mode);
+    }
+    nsecs_t time = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    printf("pal    %-6s %-12s %8.1f MB/s %6.2f ms\n",
+           neon ? "neon" : "scalar",
+           mode == DEINTERLACE_BOB ? "bob" : "motion",
+           getRate(size, iterations, time), time / 1000000.0 / iterations);
+
+    free(frame);
+    free(history);
+}
+
+// 5mp libjpeg raw input, chroma split row by row as jpeg encoder does.
+static void benchSplit(int iterations, bool neon)
+{
+    const BenchSize& size = sSizes[sizeof(sSizes) / sizeof(sSizes[0]) - 1];
+    uint32_t pairs = size.width / 2;
+    size_t srcSize = size.width * size.height * 2;
+    uint8_t* src = (uint8_t*)malloc(srcSize);
+    uint8_t* y = (uint8_t*)malloc(size.width);
+    uint8_t* u = (uint8_t*)malloc(pairs);
+    uint8_t* v = (uint8_t*)malloc(pairs);
+    if (src == NULL || y == NULL || u == NULL || v == NULL) {
+        printf("%-6s allocation failed\n", size.name);
+        free(src);
+        free(y);
+        free(u);
+        free(v);
+        return;
+    }
+
+    for (size_t i = 0; i < srcSize; i++) {
+        src[i] = (uint8_t)(i * 7);
+    }
+    setConvertNeon(neon);
+
+    // NV12 chroma plane, height / 2 rows.
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        for (uint32_t row = 0; row < size.height / 2; row++) {
+            splitChroma(src + row * size.width, u, v, pairs);
+        }
+    }
+    nsecs_t uvTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < iterations; i++) {
+        for (uint32_t row = 0; row < size.height; row++) {
+            splitYUYV(src + row * size.width * 2, y, u, v, pairs);
+        }
+    }
+    nsecs_t yuyvTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    printf("%-6s %-6s split uv %8.1f MB/s %6.2f ms  split yuyv %8.1f MB/s %6.2f ms\n",
+           size.name, neon ? "neon" : "scalar",
+           getRate(srcSize / 2, iterations, uvTime),
+           uvTime / 1000000.0 / iterations,
+           getRate(srcSize, iterations, yuyvTime),
+           yuyvTime / 1000000.0 / iterations);
+
+    free(src);
+    free(y);
+    free(u);
+    free(v);
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = BENCH_ITERATIONS;
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (iterations <= 0) {
+        iterations = BENCH_ITERATIONS;
+    }
+
+    for (size_t i = 0; i < sizeof(sSizes) / sizeof(sSizes[0]); i++) {
+        benchSize(sSizes[i], iterations, false);
+        benchSize(sSizes[i], iterations, true);
+    }
+
+    benchYUV444(iterations, false);
+    benchYUV444(iterations, true);
+
+    static const BenchSize oddSizes[] = {
+        {"pal-1", 720, 575},
+        {"odd-w", 721, 576},
+        {"small", 64, 3},
+        {"tiny", 3, 3},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(oddSizes) / sizeof(oddSizes[0]); i++) {
+        ok &= checkYUV444(oddSizes[i].width, oddSizes[i].height, false);
+        ok &= checkYUV444(oddSizes[i].width, oddSizes[i].height, true);
+    }
+
+    benchSplit(iterations, false);
+    benchSplit(iterations, true);
+
+    benchDeinterlace(iterations, false, DEINTERLACE_BOB);
+    benchDeinterlace(iterations, true, DEINTERLACE_BOB);
+    benchDeinterlace(iterations, false, DEINTERLACE_MOTION);
+    benchDeinterlace(iterations, true, DEINTERLACE_MOTION);
+
+    for (size_t i = 0; i < sizeof(sResizeSizes) / sizeof(sResizeSizes[0]); i++) {
+        benchResize(sResizeSizes[i], iterations, false);
+        benchResize(sResizeSizes[i], iterations, true);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -45,8 +45,10 @@ AccelSensor::AccelSensor()
 : SensorBase(NULL, ACC_DATA_NAME,ACC_FIFO_NAME),
       mEnabled(0),
       mPendingMask(0),
-      mInputReader(4),
+      mInputReader(64),
       mFifoCount(0),
+      mFifoTotal(0),
+      mFifoLastTimestamp(0),
       mDelay(0)
 {
 	mBatchEnabled = 0;
@@ -160,6 +162,15 @@ int AccelSensor::read_fifo(){
 				timestamp = *((int64_t *)(&buf[offset]));
 				offset += sizeof(timestamp);
 				data = ((int16_t *)(&buf[offset]));
+				/* kernel only stamps the newest sample, spread the record
+				 * over the time since the previous one when that matches
+				 * the chip rate, nominal period drifts with its oscillator */
+				if(mFifoLastTimestamp && timestamp > mFifoLastTimestamp){
+					int64_t measured = (timestamp - mFifoLastTimestamp) / count;
+					if(measured > period * 3 / 4 && measured < period * 5 / 4)
+						period = measured;
+				}
+				mFifoLastTimestamp = timestamp;
 				for(i = 0 ; i <  count; i++){
 					axis = *data++;
 					mFifoPendingEvent[i].acceleration.x = ACC_DATA_CONVERSION(axis);
@@ -173,6 +184,7 @@ int AccelSensor::read_fifo(){
 					mFifoPendingEvent[i].acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
 				}
 				mFifoCount = count;
+				mFifoTotal = count;
 			}
 		}
 	}
@@ -181,7 +193,6 @@ int AccelSensor::read_fifo(){
 int AccelSensor::readEvents(sensors_event_t* data, int count)
 {
 	int events = 0;
-	int clockid = CLOCK_MONOTONIC;
 	int ret;
     if (count < 1)
         return -EINVAL;
@@ -207,7 +218,7 @@ int AccelSensor::readEvents(sensors_event_t* data, int count)
 			}
 			events = (count -1 < mFifoCount)? count -1 : mFifoCount;
 			if(events){
-				memcpy(data,&mFifoPendingEvent[MMA8X5X_FIFO_SIZE - events],sizeof(sensors_event_t) *events);
+				memcpy(data,&mFifoPendingEvent[mFifoTotal - mFifoCount],sizeof(sensors_event_t) *events);
 				mFifoCount -= events;
 				numEventReceived += events;
 				data += events;
@@ -235,39 +246,35 @@ int AccelSensor::readEvents(sensors_event_t* data, int count)
 			mFlushed &= ~(0x01 << ID_A);;
 		}
 
-    if (TEMP_FAILURE_RETRY(ioctl(data_fd, EVIOCSCLOCKID, &clockid)) < 0) {
-        ALOGW("Could not set input clock id to CLOCK_MONOTONIC. errno=%d", errno);
-    }
-
 		ssize_t n = mInputReader.fill(data_fd);
 		if (n < 0)
 			return n;
 		input_event const* event;
-        while (count && mInputReader.readEvent(&event)) {
-            int type = event->type;
-            if ((type == EV_ABS) || (type == EV_REL) || (type == EV_KEY)) {
-                processEvent(event->code, event->value);
-                mInputReader.next();
-            } else if (type == EV_SYN) {
-                int64_t time = timevalToNano(event->time);
-                if (mPendingMask) {
-                    mPendingMask = 0;
-                    mPendingEvent.timestamp = time;
-                    if (mEnabled) {
-                        *data++ = mPendingEvent;
-                        count--;
-                        numEventReceived++;
-                    }
-                }
-                if (!mPendingMask) {
-                    mInputReader.next();
-	            }
-	        } else {
-	            ALOGE("AccelSensor: unknown event (type=%d, code=%d)",
-	                    type, event->code);
-	            mInputReader.next();
-	        }
-	    }
+		ssize_t avail;
+		/* decode whole runs of the ring, one next() per run */
+		while (count && (avail = mInputReader.readEvents(&event)) > 0) {
+			ssize_t i;
+			for (i = 0; i < avail && count; i++, event++) {
+				int type = event->type;
+				if ((type == EV_ABS) || (type == EV_REL) || (type == EV_KEY)) {
+					processEvent(event->code, event->value);
+				} else if (type == EV_SYN) {
+					if (mPendingMask) {
+						mPendingMask = 0;
+						mPendingEvent.timestamp = timevalToNano(event->time);
+						if (mEnabled) {
+							*data++ = mPendingEvent;
+							count--;
+							numEventReceived++;
+						}
+					}
+				} else {
+					ALOGE("AccelSensor: unknown event (type=%d, code=%d)",
+							type, event->code);
+				}
+			}
+			mInputReader.next(i);
+		}
 	}
 	return numEventReceived;
 }
@@ -465,6 +472,8 @@ int AccelSensor::batch(int handle, int flags, int64_t period_ns, int64_t timeout
 			wakeup = 1;
 		fifo(period_ns,timeout,wakeup);
 		mDelay = period_ns;
+		/* records before the rate change don't measure the new one */
+		mFifoLastTimestamp = 0;
 		if(timeout > 0)
 			mBatchEnabled |= (0x01 << ID_A);
 		else
@@ -61,6 +61,9 @@ private:
 	InputEventCircularReader mInputReader;
 	sensors_event_t mPendingEvent;
 	int mFifoCount;
+	int mFifoTotal;
+	// kernel time of newest sample in last fifo record.
+	int64_t mFifoLastTimestamp;
 	sensors_event_t mFifoPendingEvent[MMA8X5X_FIFO_SIZE];
 	int64_t mDelay;
 };
@@ -33,7 +33,9 @@ LOCAL_SRC_FILES := 						\
 				AccelSensor.cpp			\
 				MagSensor.cpp			\
 				PressSensor.cpp			\
-				InputEventReader.cpp
+				InputEventReader.cpp		\
+				DirectChannel.cpp		\
+				GeomagFusion.cpp
 
 LOCAL_SHARED_LIBRARIES := liblog libcutils libdl
 
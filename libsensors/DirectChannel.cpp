@@ -0,0 +1,132 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "Sensors"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cutils/log.h>
+#include <cutils/native_handle.h>
+
+#include "DirectChannel.h"
+
+/*****************************************************************************/
+
+DirectChannel::DirectChannel(const struct sensors_direct_mem_t* mem)
+    : mFd(-1),
+      mBase(NULL),
+      mSize(0),
+      mNumEvents(0),
+      mWritePos(0),
+      mCounter(1)
+{
+    memset(mPeriod, 0, sizeof(mPeriod));
+    memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
+
+    if (mem->type != SENSOR_DIRECT_MEM_TYPE_ASHMEM ||
+            mem->format != SENSOR_DIRECT_FMT_SENSORS_EVENT ||
+            mem->handle == NULL || mem->handle->numFds < 1 ||
+            mem->size < sizeof(sensors_event_t)) {
+        ALOGE("unsupported direct channel type %d format %d size %zu",
+                mem->type, mem->format, mem->size);
+        return;
+    }
+
+    /* client may close its handle once registered */
+    mFd = dup(mem->handle->data[0]);
+    if (mFd < 0) {
+        ALOGE("direct channel dup failed (%s)", strerror(errno));
+        return;
+    }
+
+    void* base = mmap(NULL, mem->size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("direct channel mmap failed (%s)", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+    mBase = (sensors_event_t*)base;
+    mSize = mem->size;
+    mNumEvents = mem->size / sizeof(sensors_event_t);
+}
+
+DirectChannel::~DirectChannel()
+{
+    if (mBase != NULL)
+        munmap(mBase, mSize);
+    if (mFd >= 0)
+        close(mFd);
+}
+
+int64_t DirectChannel::rateToPeriod(int rateLevel)
+{
+    switch (rateLevel) {
+        case SENSOR_DIRECT_RATE_NORMAL:
+            return 20000000LL;      /* 50 Hz */
+        case SENSOR_DIRECT_RATE_FAST:
+            return 5000000LL;       /* 200 Hz */
+        case SENSOR_DIRECT_RATE_VERY_FAST:
+            return 1250000LL;       /* 800 Hz */
+    }
+    return 0;
+}
+
+int DirectChannel::config(int handle, int rateLevel)
+{
+    if (handle < 0 || handle >= SENSORS_MAX)
+        return -EINVAL;
+
+    mPeriod[handle] = rateToPeriod(rateLevel);
+    mLastTimestamp[handle] = 0;
+    /* token tells sensors of the channel apart, handle 0 is valid */
+    return mPeriod[handle] ? handle + 1 : 0;
+}
+
+void DirectChannel::report(sensors_event_t const& event)
+{
+    int handle = event.sensor;
+    if (handle < 0 || handle >= SENSORS_MAX || !mPeriod[handle])
+        return;
+
+    /* sensor may run faster for poll clients, keep the requested rate
+     * with some slack for sample jitter */
+    if (mLastTimestamp[handle] &&
+            event.timestamp - mLastTimestamp[handle] < mPeriod[handle] - mPeriod[handle] / 8)
+        return;
+    mLastTimestamp[handle] = event.timestamp;
+
+    /* reader validates a record by its counter in reserved0, so clear
+     * it first and publish the new one after the payload */
+    sensors_event_t* slot = &mBase[mWritePos];
+    __atomic_store_n(&slot->reserved0, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    sensors_event_t out = event;
+    out.sensor = handle + 1;
+    out.reserved0 = 0;
+    memcpy(slot, &out, sizeof(out));
+    __atomic_store_n(&slot->reserved0, (int32_t)mCounter, __ATOMIC_RELEASE);
+
+    if (++mCounter == 0)
+        mCounter = 1;
+    if (++mWritePos >= mNumEvents)
+        mWritePos = 0;
+}
+
+/*****************************************************************************/
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "GeomagFusion.h"
+
+/*****************************************************************************/
+
+// filter time constant, 0.1s keeps heading steady while still
+// following a turn of the device.
+#define FUSION_TAU_NS           100000000LL
+// below this the vectors do not define a frame, free fall or
+// field parallel to gravity.
+#define FUSION_MIN_GRAVITY      (0.1f * 9.80665f)
+#define FUSION_MIN_EAST         0.1f
+
+GeomagFusion::GeomagFusion()
+{
+    reset();
+}
+
+void GeomagFusion::reset()
+{
+    memset(mGravity, 0, sizeof(mGravity));
+    memset(mGeomag, 0, sizeof(mGeomag));
+    mAccelTime = 0;
+    mMagTime = 0;
+}
+
+void GeomagFusion::lowPass(float* state, const float* v,
+                           int64_t timestamp, int64_t* last)
+{
+    int64_t dt = timestamp - *last;
+    if (*last == 0 || dt <= 0 || dt >= FUSION_TAU_NS * 10) {
+        // first sample or a gap, start over from it
+        state[0] = v[0];
+        state[1] = v[1];
+        state[2] = v[2];
+    } else {
+        float alpha = float(dt) / float(FUSION_TAU_NS + dt);
+        state[0] += alpha * (v[0] - state[0]);
+        state[1] += alpha * (v[1] - state[1]);
+        state[2] += alpha * (v[2] - state[2]);
+    }
+    *last = timestamp;
+}
+
+void GeomagFusion::handleAccel(const float* v, int64_t timestamp)
+{
+    lowPass(mGravity, v, timestamp, &mAccelTime);
+}
+
+void GeomagFusion::handleMag(const float* v, int64_t timestamp)
+{
+    lowPass(mGeomag, v, timestamp, &mMagTime);
+}
+
+bool GeomagFusion::getRotation(float* quat) const
+{
+    if (!mAccelTime || !mMagTime)
+        return false;
+
+    const float* g = mGravity;
+    const float* m = mGeomag;
+    float normA = g[0]*g[0] + g[1]*g[1] + g[2]*g[2];
+    if (normA < FUSION_MIN_GRAVITY * FUSION_MIN_GRAVITY)
+        return false;
+
+    // east = m x g, north = up x east, rows of device to world matrix
+    float hx = m[1]*g[2] - m[2]*g[1];
+    float hy = m[2]*g[0] - m[0]*g[2];
+    float hz = m[0]*g[1] - m[1]*g[0];
+    float normH = sqrtf(hx*hx + hy*hy + hz*hz);
+    if (normH < FUSION_MIN_EAST)
+        return false;
+    float invH = 1.0f / normH;
+    hx *= invH;
+    hy *= invH;
+    hz *= invH;
+    float invA = 1.0f / sqrtf(normA);
+    float ax = g[0] * invA;
+    float ay = g[1] * invA;
+    float az = g[2] * invA;
+    float mx = ay*hz - az*hy;
+    float my = az*hx - ax*hz;
+    float mz = ax*hy - ay*hx;
+
+    // matrix to quaternion, branch on largest diagonal term so that
+    // the divisor never gets near zero
+    float x, y, z, w;
+    float trace = hx + my + az;
+    if (trace > 0.0f) {
+        float s = 0.5f / sqrtf(trace + 1.0f);
+        w = 0.25f / s;
+        x = (ay - mz) * s;
+        y = (hz - ax) * s;
+        z = (mx - hy) * s;
+    } else if (hx > my && hx > az) {
+        float s = 2.0f * sqrtf(1.0f + hx - my - az);
+        w = (ay - mz) / s;
+        x = 0.25f * s;
+        y = (hy + mx) / s;
+        z = (hz + ax) / s;
+    } else if (my > az) {
+        float s = 2.0f * sqrtf(1.0f + my - hx - az);
+        w = (hz - ax) / s;
+        x = (hy + mx) / s;
+        y = 0.25f * s;
+        z = (mz + ay) / s;
+    } else {
+        float s = 2.0f * sqrtf(1.0f + az - hx - my);
+        w = (mx - hy) / s;
+        x = (hz + ax) / s;
+        y = (mz + ay) / s;
+        z = 0.25f * s;
+    }
+    if (w < 0.0f) {
+        x = -x;
+        y = -y;
+        z = -z;
+        w = -w;
+    }
+    quat[0] = x;
+    quat[1] = y;
+    quat[2] = z;
+    quat[3] = w;
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GEOMAG_FUSION_H
+#define ANDROID_GEOMAG_FUSION_H
+
+#include <stdint.h>
+
+/*****************************************************************************/
+
+// gyro-free attitude from accel and mag samples. each vector is low
+// passed with a time constant, the rotation is taken from filtered
+// gravity and geomagnetic field like SensorManager.getRotationMatrix.
+// a few dozen float ops per sample, no state beyond the two vectors.
+class GeomagFusion {
+public:
+            GeomagFusion();
+    void    reset();
+    void    handleAccel(const float* v, int64_t timestamp);
+    void    handleMag(const float* v, int64_t timestamp);
+    // rotation of device to world frame as x, y, z, w with w >= 0,
+    // false until both vectors are known or in free fall.
+    bool    getRotation(float* quat) const;
+
+private:
+    static void lowPass(float* state, const float* v,
+                        int64_t timestamp, int64_t* last);
+
+    float   mGravity[3];
+    float   mGeomag[3];
+    int64_t mAccelTime;
+    int64_t mMagTime;
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_GEOMAG_FUSION_H
@@ -87,3 +87,20 @@ void InputEventCircularReader::next()
         mCurr = mBuffer;
     }
 }
+
+ssize_t InputEventCircularReader::readEvents(input_event const** events)
+{
+    *events = mCurr;
+    ssize_t available = (mBufferEnd - mBuffer) - mFreeSpace;
+    ssize_t contiguous = mBufferEnd - mCurr;
+    return available < contiguous ? available : contiguous;
+}
+
+void InputEventCircularReader::next(size_t numEvents)
+{
+    mCurr += numEvents;
+    mFreeSpace += numEvents;
+    if (mCurr >= mBufferEnd) {
+        mCurr -= mBufferEnd - mBuffer;
+    }
+}
@@ -41,6 +41,10 @@ public:
     ssize_t fill(int fd);
     ssize_t readEvent(input_event const** events);
     void next();
+    // events readable in place from current one, up to end of ring.
+    // consumed with next(numEvents).
+    ssize_t readEvents(input_event const** events);
+    void next(size_t numEvents);
 };
 
 /*****************************************************************************/
@@ -47,7 +47,7 @@
 MagSensor::MagSensor()
 : SensorBase(MAG_CTRL_NAME, MAG_DATA_NAME),
   mPendingMask(0),
-  mInputReader(16)
+  mInputReader(64)
 {
     memset(&mPendingEvent[0], 0, sensors *sizeof(sensors_event_t));
 	memset(mClassPath, '\0', sizeof(mClassPath));
@@ -67,6 +67,8 @@ MagSensor::MagSensor()
     mPendingEvent[orn].orientation.status = SENSOR_STATUS_ACCURACY_LOW;
 	mPendingEvent[orn].version = sizeof(sensors_event_t);
 	
+	mHalBatch = true;
+
 	if(sensor_get_class_path(mClassPath))
 	{
 		ALOGE("Can`t find the mag sensor!");
@@ -125,75 +127,53 @@ int MagSensor::update_delay(int sensor_type)
     else
 	    return 0;
 }
-bool MagSensor::hasPendingEvents(){
-	return (false || (mFlushed & (0x01 << ID_M)) || (mFlushed & (0x01 << ID_O)));
+bool MagSensor::hasPendingEvents() const {
+	return batchDue();
 }
 
 int MagSensor::readEvents(sensors_event_t* data, int count)
 {
-	int i;
-	int clockid = CLOCK_MONOTONIC;
-
     if (count < 1)
         return -EINVAL;
-	sensors_event_t sensor_event;
     int numEventReceived = 0;
-	if((mFlushed & (0x01 << ID_M)) ){
-		memset(&sensor_event,0,sizeof(sensor_event));
-		sensor_event.version = META_DATA_VERSION;
-		sensor_event.type = SENSOR_TYPE_META_DATA;
-		sensor_event.meta_data.sensor = ID_M;
-		sensor_event.meta_data.what = 0;
-		*data++ = sensor_event;
-		count--;
-		numEventReceived++;
-		mFlushed &= ~(0x01 << ID_M);
-	}
-	if((mFlushed & (0x01 << ID_O))){
-		memset(&sensor_event,0,sizeof(sensor_event));
-		sensor_event.version = META_DATA_VERSION;
-		sensor_event.type = SENSOR_TYPE_META_DATA;
-		sensor_event.meta_data.sensor = ID_O;
-		sensor_event.meta_data.what = 0;
-		*data++ = sensor_event;
-		count--;
-		numEventReceived++;
-		mFlushed &= ~(0x01 << ID_O);
+	if (batchDue()) {
+		/* held samples and flush complete events, fd is read on
+		 * next call if it has data too. */
+		return readBatch(data, count);
 	}
 
-    if (TEMP_FAILURE_RETRY(ioctl(data_fd, EVIOCSCLOCKID, &clockid)) < 0) {
-        ALOGW("Could not set input clock id to CLOCK_MONOTONIC. errno=%d", errno);
-    }
-
 	ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
         return n;
 	input_event const* event;
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if ((type == EV_ABS) || (type == EV_REL) || (type == EV_KEY)) {
-            processEvent(event->code, event->value);
-            mInputReader.next();
-        } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-			for(i = 0 ; i< sensors && mPendingMask && count ;i++){
-			  	 	if(mPendingMask & (1 << i)){
-						mPendingMask &= ~(1 << i);
-						mPendingEvent[i].timestamp = time;
-						if (mEnabled[i]) {
-							*data++ = mPendingEvent[i];
+	ssize_t avail;
+	/* decode whole runs of the ring, one next() per run */
+	while (count && (avail = mInputReader.readEvents(&event)) > 0) {
+		ssize_t i;
+		for (i = 0; i < avail && count; i++, event++) {
+			int type = event->type;
+			if ((type == EV_ABS) || (type == EV_REL) || (type == EV_KEY)) {
+				processEvent(event->code, event->value);
+			} else if (type == EV_SYN) {
+				int64_t time = timevalToNano(event->time);
+				for (int j = 0; j < sensors && mPendingMask && count; j++) {
+					if (mPendingMask & (1 << j)) {
+						mPendingMask &= ~(1 << j);
+						mPendingEvent[j].timestamp = time;
+						if (mEnabled[j] && !batchEvent(mPendingEvent[j])) {
+							*data++ = mPendingEvent[j];
 							count--;
 							numEventReceived++;
 						}
-			  	 	}
-	       }
-		   if (!mPendingMask) {
-		       mInputReader.next();
-		   }
-        } else {
-            mInputReader.next();
-        }
-    }
+					}
+				}
+				/* out of room, keep SYN for the rest of the sample */
+				if (mPendingMask)
+					break;
+			}
+		}
+		mInputReader.next(i);
+	}
 
     return numEventReceived;
 }
@@ -371,17 +351,6 @@ int MagSensor::sensor_get_class_path(char *class_path)
 		return -1;
 	}
 }
-int MagSensor::flush(int handle){
-	if(mEnabled[mag] && handle == ID_M){
-		mFlushed |= (0x01 << ID_M);
-		return 0;
-	}else if(mEnabled[orn] && handle == ID_O){
-		mFlushed |= (0x01 << ID_O);
-		return 0;
-	}else{
-		return -EINVAL;
-	}
-}
 
 /*****************************************************************************/
 
@@ -38,8 +38,7 @@ public:
     virtual int setEnable(int32_t handle, int enabled);
     virtual int getEnable(int32_t handle);
     virtual int readEvents(sensors_event_t* data, int count);
-	virtual bool hasPendingEvents(); 
-	virtual int flush(int handle);
+	virtual bool hasPendingEvents() const;
     void processEvent(int code, int value);
 
 private:
@@ -40,8 +40,11 @@
 PressSensor::PressSensor()
 : SensorBase(NULL, PRESS_DATA_NAME),
   mPendingMask(0),
+  mReportedMask(0),
   mInputReader(4)
 {
+    char buffer[PROPERTY_VALUE_MAX];
+
     memset(&mPendingEvent[0], 0, sensors *sizeof(sensors_event_t));
 	memset(mClassPath, '\0', sizeof(mClassPath));
 
@@ -59,7 +62,14 @@ PressSensor::PressSensor()
     mPendingEvent[temperature].type    = SENSOR_TYPE_TEMPERATURE;
     mPendingEvent[temperature].orientation.status = SENSOR_STATUS_ACCURACY_HIGH;
 	mPendingEvent[temperature].version = sizeof(sensors_event_t);
+
+	/* pressure is continuous, every sample is reported */
+	mHysteresis[press] = 0;
+	property_get("ro.tempsensor.hysteresis", buffer, TEMPERATURE_HYSTERESIS);
+	mHysteresis[temperature] = atof(buffer);
 	
+	mHalBatch = true;
+
 	if(sensor_get_class_path(mClassPath))
 	{
 		ALOGE("Can`t find the press sensor!");
@@ -79,6 +89,8 @@ int PressSensor::setEnable(int32_t handle, int en)
 		case ID_T : what = temperature; break;
     }
 
+    /* first sample after enable is always reported */
+    mReportedMask &= ~(1 << what);
     if(en)
 		mEnabled[what]++;
 	else
@@ -119,12 +131,19 @@ int PressSensor::update_delay(int sensor_type)
 	    return 0;
 }
 
+bool PressSensor::hasPendingEvents() const {
+	return batchDue();
+}
+
 int PressSensor::readEvents(sensors_event_t* data, int count)
 {
 	int i;
     if (count < 1)
         return -EINVAL;
 
+	if (batchDue())
+		return readBatch(data, count);
+
     ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
         return n;
@@ -143,7 +162,11 @@ int PressSensor::readEvents(sensors_event_t* data, int count)
 			  	 	if(mPendingMask & (1 << i)){
 						mPendingMask &= ~(1 << i);
 						mPendingEvent[i].timestamp = time;
-						if (mEnabled[i]) {
+						if (!mEnabled[i] || !isChanged(i))
+							continue;
+						mReported[i] = mPendingEvent[i].data[0];
+						mReportedMask |= 1 << i;
+						if (!batchEvent(mPendingEvent[i])) {
 							*data++ = mPendingEvent[i];
 							count--;
 							numEventReceived++;
@@ -161,6 +184,12 @@ int PressSensor::readEvents(sensors_event_t* data, int count)
     return numEventReceived;
 }
 
+bool PressSensor::isChanged(int what) const
+{
+	return !(mReportedMask & (1 << what)) ||
+		fabsf(mPendingEvent[what].data[0] - mReported[what]) >= mHysteresis[what];
+}
+
 void PressSensor::processEvent(int code, int value)
 {
 
@@ -28,6 +28,9 @@
 #include "SensorBase.h"
 #include "InputEventReader.h"
 
+/* default of ro.tempsensor.hysteresis, degrees Celsius */
+#define TEMPERATURE_HYSTERESIS	"0.5"
+
 /*****************************************************************************/
 
 class PressSensor : public SensorBase {
@@ -38,6 +41,7 @@ public:
     virtual int setEnable(int32_t handle, int enabled);
     virtual int getEnable(int32_t handle);
     virtual int readEvents(sensors_event_t* data, int count);
+	virtual bool hasPendingEvents() const;
     void processEvent(int code, int value);
 
 private:
@@ -61,6 +65,12 @@ private:
 	InputEventCircularReader mInputReader;
 	sensors_event_t mPendingEvent[sensors];
 	int64_t mDelay[sensors];
+	/* on-change sensors skip samples within hysteresis of the value
+	 * they reported last, mReportedMask tells which have one. */
+	float mHysteresis[sensors];
+	float mReported[sensors];
+	int mReportedMask;
+	bool isChanged(int what) const;
 };
 
 /*****************************************************************************/
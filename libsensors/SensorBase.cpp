@@ -42,6 +42,14 @@ SensorBase::SensorBase(
 	fifo_name = NULL;
 	mBatchEnabled = 0;
 	mFlushed = 0;
+	mHalBatch = false;
+	memset(mReportLatency, 0, sizeof(mReportLatency));
+	memset(mBatchPeriod, 0, sizeof(mBatchPeriod));
+	memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
+	mBatchEvents = NULL;
+	mBatchHead = 0;
+	mBatchCount = 0;
+	mBatchDeadline = 0;
 }
 
 SensorBase::SensorBase(
@@ -60,7 +68,15 @@ SensorBase::SensorBase(
 		open_fifo_device();
 	}
 	mBatchEnabled = 0;
-	mFlushed = 0; 
+	mFlushed = 0;
+	mHalBatch = false;
+	memset(mReportLatency, 0, sizeof(mReportLatency));
+	memset(mBatchPeriod, 0, sizeof(mBatchPeriod));
+	memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
+	mBatchEvents = NULL;
+	mBatchHead = 0;
+	mBatchCount = 0;
+	mBatchDeadline = 0;
 }
 
 SensorBase::~SensorBase() {
@@ -74,6 +90,7 @@ SensorBase::~SensorBase() {
 	{
 		close(fifo_fd);
 	}
+	free(mBatchEvents);
 }
 
 int SensorBase::open_device() {
@@ -138,7 +155,7 @@ void  processEvent(int code, int value)
 int64_t SensorBase::getTimestamp() {
     struct timespec t;
     t.tv_sec = t.tv_nsec = 0;
-    clock_gettime(CLOCK_MONOTONIC, &t);
+    clock_gettime(CLOCK_BOOTTIME, &t);
     return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
 }
 
@@ -183,6 +200,16 @@ int SensorBase::openInput(const char* inputName) {
     }
     closedir(dir);
     ALOGE_IF(fd<0, "couldn't find '%s' input device", inputName);
+    if (fd >= 0) {
+        /* framework expects elapsedRealtimeNanos, have evdev stamp
+           SYN with it so kernel time is passed through unchanged */
+        int clockid = CLOCK_BOOTTIME;
+        if (ioctl(fd, EVIOCSCLOCKID, &clockid) < 0) {
+            clockid = CLOCK_MONOTONIC;
+            ALOGW("input clock CLOCK_BOOTTIME not supported, using CLOCK_MONOTONIC (%s)", strerror(errno));
+            ioctl(fd, EVIOCSCLOCKID, &clockid);
+        }
+    }
     return fd;
 }
 int SensorBase::readEvents(sensors_event_t* data, int count)
@@ -191,16 +218,106 @@ int SensorBase::readEvents(sensors_event_t* data, int count)
 }
 int SensorBase::batch(int handle, int flags, int64_t period_ns, int64_t timeout){
 	/*default , not support batch mode or SENSORS_BATCH_WAKE_UPON_FIFO_FULL */
-	if(timeout > 0 || flags & SENSORS_BATCH_WAKE_UPON_FIFO_FULL)
+	if(flags & SENSORS_BATCH_WAKE_UPON_FIFO_FULL)
+		return -EINVAL;
+	if(timeout > 0 && (!mHalBatch || handle < 0 || handle >= SENSORS_MAX))
 		return -EINVAL;
 	if(!(flags & SENSORS_BATCH_DRY_RUN)){
+		if(timeout > 0 && mBatchEvents == NULL){
+			mBatchEvents = (sensors_event_t *)calloc(SENSOR_BATCH_EVENTS, sizeof(sensors_event_t));
+			if(mBatchEvents == NULL)
+				return -ENOMEM;
+		}
+		if(mHalBatch && handle >= 0 && handle < SENSORS_MAX){
+			mReportLatency[handle] = timeout;
+			mBatchPeriod[handle] = period_ns;
+			/* release held events at once when leaving batch mode */
+			if(timeout == 0)
+				mBatchDeadline = getTimestamp();
+		}
 		setDelay(handle,period_ns);
 	}
 	return 0;
 }
 int SensorBase::flush(int handle){
+	if(mHalBatch && handle >= 0 && handle < SENSORS_MAX && getEnable(handle)){
+		mFlushed |= (0x01 << handle);
+		return 0;
+	}
 	return -EINVAL;
-	
 }
 
+bool SensorBase::batchEvent(sensors_event_t const& event){
+	int handle = event.sensor;
+	if(mBatchEvents == NULL || handle < 0 || handle >= SENSORS_MAX ||
+			mReportLatency[handle] <= 0)
+		return false;
+
+	sensors_event_t* slot;
+	if(mBatchCount == SENSOR_BATCH_EVENTS){
+		/* full and not read yet, oldest is lost as in a hardware fifo */
+		slot = &mBatchEvents[mBatchHead];
+		mBatchHead = (mBatchHead + 1) % SENSOR_BATCH_EVENTS;
+	}else{
+		slot = &mBatchEvents[(mBatchHead + mBatchCount) % SENSOR_BATCH_EVENTS];
+		mBatchCount++;
+	}
+	*slot = event;
+	/* driver may sync several samples at once, step them by the
+	 * requested period so timestamps keep increasing. */
+	if(mLastTimestamp[handle] && slot->timestamp <= mLastTimestamp[handle])
+		slot->timestamp = mLastTimestamp[handle] + mBatchPeriod[handle];
+	mLastTimestamp[handle] = slot->timestamp;
+
+	int64_t deadline = getTimestamp() + mReportLatency[handle];
+	if(mBatchCount == 1 || deadline < mBatchDeadline)
+		mBatchDeadline = deadline;
+	return true;
+}
+
+bool SensorBase::batchDue() const{
+	if(mFlushed)
+		return true;
+	if(mBatchCount == 0)
+		return false;
+	return mBatchCount == SENSOR_BATCH_EVENTS || getTimestamp() >= mBatchDeadline;
+}
+
+int64_t SensorBase::getBatchDeadline() const{
+	return mBatchCount ? mBatchDeadline : 0;
+}
+
+int SensorBase::readBatch(sensors_event_t* data, int count){
+	int numEventReceived = 0;
+	if(!batchDue())
+		return 0;
 
+	while(count && mBatchCount){
+		*data++ = mBatchEvents[mBatchHead];
+		mBatchHead = (mBatchHead + 1) % SENSOR_BATCH_EVENTS;
+		mBatchCount--;
+		count--;
+		numEventReceived++;
+	}
+	if(mBatchCount){
+		/* rest is still due on next read */
+		mBatchDeadline = getTimestamp();
+		return numEventReceived;
+	}
+
+	/* flush completes after every event held before it */
+	for(int i = 0; count && mFlushed && i < SENSORS_MAX; i++){
+		if(!(mFlushed & (0x01 << i)))
+			continue;
+		memset(data, 0, sizeof(*data));
+		data->version = META_DATA_VERSION;
+		data->type = SENSOR_TYPE_META_DATA;
+		data->meta_data.sensor = i;
+		data->meta_data.what = META_DATA_FLUSH_COMPLETE;
+		data++;
+		count--;
+		numEventReceived++;
+		mFlushed &= ~(0x01 << i);
+	}
+	return numEventReceived;
+}
@@ -27,6 +27,8 @@
 #include "sensors.h"
 
 #define SENSORS_MAX  20
+/* events held by HAL side batching of sensors without hardware fifo */
+#define SENSOR_BATCH_EVENTS  128
 
 /*****************************************************************************/
 class SensorBase {
@@ -40,6 +42,16 @@ protected:
 	int 		fifo_fd;
 	int 		mBatchEnabled;
 	int 		mFlushed;
+	/* HAL side batching, samples are held until report latency of
+	 * oldest one expires, the buffer fills or the sensor is flushed. */
+	bool		mHalBatch;
+	int64_t		mReportLatency[SENSORS_MAX];
+	int64_t		mBatchPeriod[SENSORS_MAX];
+	int64_t		mLastTimestamp[SENSORS_MAX];
+	sensors_event_t* mBatchEvents;
+	int		mBatchHead;
+	int		mBatchCount;
+	int64_t		mBatchDeadline;
     int openInput(const char* inputName);
     static int64_t getTimestamp();
 
@@ -52,6 +64,10 @@ protected:
     int close_device();
 	int open_fifo_device();
     int close_fifo_device();
+	/* queue event of a batched sensor, false if it must be reported now */
+	bool batchEvent(sensors_event_t const& event);
+	/* held events once due, then flush complete events */
+	int readBatch(sensors_event_t* data, int count);
     
 public:
     SensorBase(const char* dev_name,const char* data_name);
@@ -66,6 +82,10 @@ public:
     virtual void processEvent(int code, int value) = 0;
 	virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
 	virtual int flush(int handle);
+	/* batch is due for report or a flush is pending */
+	bool batchDue() const;
+	/* monotonic time held events are due, 0 if none */
+	virtual int64_t getBatchDeadline() const;
 };
 
 /*****************************************************************************/
@@ -23,6 +23,7 @@
 #include <dirent.h>
 #include <math.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <pthread.h>
 #include <stdlib.h>
 
@@ -37,6 +38,8 @@
 #include "MagSensor.h"
 #include "PressSensor.h"
 #include "LightSensor.h"
+#include "DirectChannel.h"
+#include "GeomagFusion.h"
 
 
 /*****************************************************************************/
@@ -53,6 +56,7 @@
 #define SENSORS_PRESS            (1<<ID_P)
 #define SENSORS_TEMPERATURE		 (1<<ID_T)
 #define SENSORS_PROXIMITY        (1<<ID_PX)
+#define SENSORS_GEOMAGNETIC_ROTATION_VECTOR  (1<<ID_GMRV)
 
 #define SENSORS_ACCELERATION_HANDLE     ID_A
 #define SENSORS_MAGNETIC_FIELD_HANDLE   ID_M
@@ -62,6 +66,10 @@
 #define SENSORS_PRESSURE_HANDLE         ID_P
 #define SENSORS_TEMPERATURE_HANDLE      ID_T
 #define SENSORS_PROXIMITY_HANDLE        ID_PX
+#define SENSORS_GEOMAGNETIC_ROTATION_VECTOR_HANDLE  ID_GMRV
+
+/* fastest input rate of the fusion, 100Hz */
+#define FUSION_MIN_PERIOD        10000000LL
 
 /*****************************************************************************/
 
@@ -82,7 +90,9 @@ static const struct sensor_t sSensorList[] = {
     .stringType =             SENSOR_STRING_TYPE_ACCELEROMETER,
     .requiredPermission =     0,
     .maxDelay =               640000,
-    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE |
+                  SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                  (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT),
     .reserved =   {}
     },
     {
@@ -96,11 +106,13 @@ static const struct sensor_t sSensorList[] = {
     .power =      0.50f,
     .minDelay =   2500,
     .fifoReservedEventCount = 0,
-    .fifoMaxEventCount =      0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
     .stringType =             SENSOR_STRING_TYPE_MAGNETIC_FIELD,
     .requiredPermission =     0,
     .maxDelay =               640000,
-    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE |
+                  SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                  (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT),
     .reserved =   {}
     },
     {
@@ -114,7 +126,7 @@ static const struct sensor_t sSensorList[] = {
     .power =      0.50f,
     .minDelay =   2500,
     .fifoReservedEventCount = 0,
-    .fifoMaxEventCount =      0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
     .stringType =             SENSOR_STRING_TYPE_ORIENTATION,
     .requiredPermission =     0,
     .maxDelay =               640000,
@@ -132,19 +144,47 @@ static const struct sensor_t sSensorList[] = {
     .power =      0.35f,
     .minDelay =   0,
     .fifoReservedEventCount = 0,
-    .fifoMaxEventCount =      0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
     .stringType =             SENSOR_STRING_TYPE_LIGHT,
     .requiredPermission =     0,
     .maxDelay =               0,
     .flags =      SENSOR_FLAG_ON_CHANGE_MODE,
     .reserved =   {}
     },
+    {
+    .name =       "Freescale Geomagnetic Rotation Vector",
+    .vendor =     "Freescale Semiconductor Inc.",
+    .version=     1,
+    .handle =     SENSORS_GEOMAGNETIC_ROTATION_VECTOR_HANDLE,
+    .type =       SENSOR_TYPE_GEOMAGNETIC_ROTATION_VECTOR,
+    .maxRange =   1.0f,
+    .resolution = 1.0f / (1 << 24),
+    .power =      0.80f,
+    .minDelay =   FUSION_MIN_PERIOD / 1000,
+    .fifoReservedEventCount = 0,
+    .fifoMaxEventCount =      0,
+    .stringType =             SENSOR_STRING_TYPE_GEOMAGNETIC_ROTATION_VECTOR,
+    .requiredPermission =     0,
+    .maxDelay =               640000,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .reserved =   {}
+    },
 };
 
 
 static int open_sensors(const struct hw_module_t* module, const char* id,
                         struct hw_device_t** device);
 
+/* highest SENSOR_DIRECT_RATE_* of sensor, 0 if it has no direct report */
+static int getDirectRateLevel(int handle)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sSensorList); i++) {
+        if (sSensorList[i].handle == handle)
+            return (sSensorList[i].flags & SENSOR_FLAG_MASK_DIRECT_REPORT) >>
+                    SENSOR_FLAG_SHIFT_DIRECT_REPORT;
+    }
+    return 0;
+}
 
 static int sensors__get_sensors_list(struct sensors_module_t* module,
                                      struct sensor_t const** list)
@@ -179,12 +219,17 @@ struct sensors_poll_context_t {
 
         sensors_poll_context_t();
         ~sensors_poll_context_t();
-	int fillPollFd();
+	// keep epoll set in sync with fd of each driver, it changes
+	// when a sensor switches between batch and continuous mode.
+	void updatePollFd(int index);
     int activate(int handle, int enabled);
     int setDelay(int handle, int64_t ns);
     int pollEvents(sensors_event_t* data, int count);
 	int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
 	int flush(int handle);
+	int registerDirectChannel(const struct sensors_direct_mem_t* mem, int channel_handle);
+	int configDirectReport(int sensor_handle, int channel_handle,
+			const struct sensors_direct_cfg_t* config);
 	struct BatchParameter mBatchParameter[32];
 	int magRunTimes;
 private:
@@ -197,10 +242,49 @@ private:
     };
     static const size_t wake = numFds - 1;
     static const char WAKE_MESSAGE = 'W';
-    struct pollfd mPollFds[numFds];
+    int mEpollFd;
+    // fd of each driver registered in epoll set, -1 if none.
+    int mPollFds[numSensorDrivers];
+    // drivers epoll reported readable and not drained yet.
+    uint32_t mReadyDrivers;
+    pthread_mutex_t mPollFdLock;
+    int mReadPipeFd;
     int mWritePipeFd;
     SensorBase* mSensors[numSensorDrivers];
 
+    // direct report. a sensor runs while the framework or any channel
+    // uses it, events of sensors the framework has not activated are
+    // kept out of poll. mDirectLock guards channels and masks.
+    pthread_mutex_t mDirectLock;
+    DirectChannel* mDirectChannels[DIRECT_CHANNEL_MAX];
+    uint32_t mActiveSensors;
+    uint32_t mDirectSensors;
+    int64_t mDirectPeriod[SENSORS_MAX];
+
+    // geomagnetic rotation vector, fused from accel and mag in poll
+    // thread. the fusion holds both drivers like a direct channel,
+    // mFusionSensors has their bits while it is active.
+    GeomagFusion mFusion;
+    uint32_t mFusionSensors;
+    int64_t mFusionPeriod;
+    sensors_event_t mFusionEvent;
+    bool mFusionPending;
+    bool mFusionFlush;
+
+    int enableDriver(int handle, int enabled);
+    int batchDriver(int handle, int flags, int64_t period_ns, int64_t timeout);
+    int setUser(int handle, uint32_t* users, int enabled);
+    int64_t getSharedPeriod(int handle) const;
+    void updateRate(int handle);
+    void updateDirectReport(int handle);
+    void stopDirectChannel(DirectChannel* channel);
+    int activateFusion(int enabled);
+    void setFusionPeriod(int64_t ns);
+    void fuseEvent(const sensors_event_t& event);
+    int readFusion(sensors_event_t* data, int count);
+    int dispatchEvents(sensors_event_t* data, int count);
+    void wakePoll();
+
     int handleToDriver(int handle) const {
         switch (handle) {
             case ID_A:
@@ -216,44 +300,145 @@ private:
 };
 
 /*****************************************************************************/
-int sensors_poll_context_t::fillPollFd(){
-    int i = 0;
-    for(i = 0 ; i < numSensorDrivers; i++){
-        if(mSensors[i] != NULL)
-            mPollFds[i].fd = mSensors[i]->getFd();
-        mPollFds[i].events = POLLIN;
-        mPollFds[i].revents = 0;
+void sensors_poll_context_t::updatePollFd(int index){
+    struct epoll_event ev;
+    int fd = mSensors[index] != NULL ? mSensors[index]->getFd() : -1;
+
+    pthread_mutex_lock(&mPollFdLock);
+    if (fd != mPollFds[index]) {
+        if (mPollFds[index] >= 0)
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mPollFds[index], NULL);
+        mPollFds[index] = -1;
+        if (fd >= 0) {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.u32 = index;
+            if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) == 0)
+                mPollFds[index] = fd;
+            else
+                ALOGE("epoll add of sensor %d failed (%s)", index, strerror(errno));
+        }
     }
-    return 0;
+    pthread_mutex_unlock(&mPollFdLock);
 }
 sensors_poll_context_t::sensors_poll_context_t()
 {
+    struct epoll_event ev;
+
     mSensors[accel] = new AccelSensor();
 	mSensors[mag] = new MagSensor();
 	mSensors[light] = new LightSensor();
-	fillPollFd();
 	magRunTimes = 0;
+    mReadyDrivers = 0;
+    pthread_mutex_init(&mDirectLock, NULL);
+    memset(mDirectChannels, 0, sizeof(mDirectChannels));
+    mActiveSensors = 0;
+    mDirectSensors = 0;
+    memset(mDirectPeriod, 0, sizeof(mDirectPeriod));
+    memset(mBatchParameter, 0, sizeof(mBatchParameter));
+    mFusionSensors = 0;
+    mFusionPeriod = FUSION_MIN_PERIOD;
+    mFusionPending = false;
+    mFusionFlush = false;
+    memset(&mFusionEvent, 0, sizeof(mFusionEvent));
+    pthread_mutex_init(&mPollFdLock, NULL);
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    ALOGE_IF(mEpollFd<0, "error creating epoll (%s)", strerror(errno));
+    for (int i=0 ; i<numSensorDrivers ; i++) {
+        mPollFds[i] = -1;
+        updatePollFd(i);
+    }
     int wakeFds[2];
     int result = pipe(wakeFds);
     ALOGE_IF(result<0, "error creating wake pipe (%s)", strerror(errno));
     fcntl(wakeFds[0], F_SETFL, O_NONBLOCK);
     fcntl(wakeFds[1], F_SETFL, O_NONBLOCK);
+    mReadPipeFd = wakeFds[0];
     mWritePipeFd = wakeFds[1];
 
-    mPollFds[wake].fd = wakeFds[0];
-    mPollFds[wake].events = POLLIN;
-    mPollFds[wake].revents = 0;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = wake;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mReadPipeFd, &ev);
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
     for (int i=0 ; i<numSensorDrivers ; i++) {
         delete mSensors[i];
     }
-    close(mPollFds[wake].fd);
+    for (int i=0 ; i<DIRECT_CHANNEL_MAX ; i++) {
+        delete mDirectChannels[i];
+    }
+    pthread_mutex_destroy(&mDirectLock);
+    close(mEpollFd);
+    close(mReadPipeFd);
     close(mWritePipeFd);
+    pthread_mutex_destroy(&mPollFdLock);
+}
+
+void sensors_poll_context_t::wakePoll() {
+    const char wakeMessage(WAKE_MESSAGE);
+    int result = write(mWritePipeFd, &wakeMessage, 1);
+    ALOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
 }
 
 int sensors_poll_context_t::activate(int handle, int enabled) {
+    if (handle == ID_GMRV)
+        return activateFusion(enabled);
+    int index = handleToDriver(handle);
+    if (index < 0) return index;
+    pthread_mutex_lock(&mDirectLock);
+    int err = setUser(handle, &mActiveSensors, enabled);
+    pthread_mutex_unlock(&mDirectLock);
+    return err;
+}
+
+/* called with mDirectLock held. driver runs while framework, a direct
+ * channel or the fusion uses it, only first and last user switch it.
+ */
+int sensors_poll_context_t::setUser(int handle, uint32_t* users, int enabled) {
+    uint32_t bit = 1 << handle;
+    uint32_t old = *users;
+    bool running = (mActiveSensors | mDirectSensors | mFusionSensors) & bit;
+    if (enabled)
+        *users |= bit;
+    else
+        *users &= ~bit;
+    if (running == bool((mActiveSensors | mDirectSensors | mFusionSensors) & bit))
+        return 0;
+    int err = enableDriver(handle, enabled);
+    if (err)
+        *users = old;
+    return err;
+}
+
+/* called with mDirectLock held, fastest period direct report and
+ * fusion need, 0 if neither uses the sensor.
+ */
+int64_t sensors_poll_context_t::getSharedPeriod(int handle) const {
+    int64_t period = mDirectPeriod[handle];
+    if ((mFusionSensors & (1 << handle)) && (!period || mFusionPeriod < period))
+        period = mFusionPeriod;
+    return period;
+}
+
+/* called with mDirectLock held. shared users need every sample as it
+ * comes, without them the framework's batch parameters apply.
+ */
+void sensors_poll_context_t::updateRate(int handle) {
+    bool active = mActiveSensors & (1 << handle);
+    struct BatchParameter& param = mBatchParameter[handle];
+    int64_t period = getSharedPeriod(handle);
+    if (period) {
+        if (active && param.period_ns && param.period_ns < period)
+            period = param.period_ns;
+        batchDriver(handle, 0, period, 0);
+    } else if (active && param.period_ns) {
+        batchDriver(handle, param.flags, param.period_ns, param.timeout);
+    }
+}
+
+int sensors_poll_context_t::enableDriver(int handle, int enabled) {
     int index = handleToDriver(handle);
     if (index < 0) return index;
     int err = 0 ;
@@ -280,17 +465,27 @@ int sensors_poll_context_t::activate(int handle, int enabled) {
 		err |=  mSensors[index]->setEnable(handle, enabled);
 	}else
 		err =  mSensors[index]->setEnable(handle, enabled);
-    if (!err) {
-        const char wakeMessage(WAKE_MESSAGE);
-        int result = write(mWritePipeFd, &wakeMessage, 1);
-        ALOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
-    }
+    updatePollFd(index);
+    if (index != accel)
+        updatePollFd(accel);
+    if (!err)
+        wakePoll();
     return err;
 }
 
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
+    if (handle == ID_GMRV) {
+        setFusionPeriod(ns);
+        return 0;
+    }
     int index = handleToDriver(handle);
     if (index < 0) return index;
+    pthread_mutex_lock(&mDirectLock);
+    mBatchParameter[handle].period_ns = ns;
+    int64_t shared = getSharedPeriod(handle);
+    if (shared && shared < ns)
+        ns = shared;
+    pthread_mutex_unlock(&mDirectLock);
 	if(handle == ID_O || handle ==  ID_M){
 		 mSensors[accel]->setDelay(handle, ns);// if handle == orientaion or magnetic ,please enable ACCELERATE Sensor
 	}
@@ -299,80 +494,346 @@ int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
 
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 {
+    struct epoll_event events[numFds];
     int nbEvents = 0;
     int n = 0;
+    bool batchWait;
     do {
-        // see if we have some leftover from the last poll()
+        // drain every ready sensor into one batch, then leftovers
+        // from the last epoll_wait()
         for (int i=0 ; count && i<numSensorDrivers ; i++) {
             SensorBase* const sensor(mSensors[i]);
 
-	   if ((mPollFds[i].revents & POLLIN) || (sensor->hasPendingEvents())) {
+            if ((mReadyDrivers & (1 << i)) || (sensor->hasPendingEvents())) {
                 int nb = sensor->readEvents(data, count);
                 if (nb < count) {
                     // no more data for this sensor
-                    mPollFds[i].revents = 0;
+                    mReadyDrivers &= ~(1 << i);
                 }
+                if (nb > 0 && (mDirectSensors || mFusionSensors))
+                    nb = dispatchEvents(data, nb);
                 count -= nb;
                 nbEvents += nb;
                 data += nb;
             }
         }
+        if (count && (mFusionPending || mFusionFlush)) {
+            int nb = readFusion(data, count);
+            count -= nb;
+            nbEvents += nb;
+            data += nb;
+        }
 
+        batchWait = false;
         if (count) {
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
-            // anything to return
-            //n = poll(mPollFds, numFds, nbEvents ? 0 : -1);
-			do {
-				fillPollFd(); /*reset poll fd , if sensor change between batch mode and continuous mode*/
-			 	n = poll(mPollFds, numFds, nbEvents ? 0 : -1);            
-			} while (n < 0 && errno == EINTR);
+            // anything to return, held batches bound the wait.
+            int timeout = -1;
+            if (nbEvents) {
+                timeout = 0;
+            } else {
+                int64_t deadline = 0;
+                for (int i=0 ; i<numSensorDrivers ; i++) {
+                    int64_t d = mSensors[i]->getBatchDeadline();
+                    if (d && (!deadline || d < deadline))
+                        deadline = d;
+                }
+                if (deadline) {
+                    struct timespec t;
+                    clock_gettime(CLOCK_BOOTTIME, &t);
+                    int64_t wait = deadline - (int64_t(t.tv_sec)*1000000000LL + t.tv_nsec);
+                    timeout = wait > 0 ? (wait + 999999) / 1000000 : 0;
+                    batchWait = true;
+                }
+            }
+            do {
+                n = epoll_wait(mEpollFd, events, numFds, timeout);
+            } while (n < 0 && errno == EINTR);
             if (n<0) {
-                ALOGE("poll() failed (%s)", strerror(errno));
+                ALOGE("epoll_wait() failed (%s)", strerror(errno));
                 return -errno;
             }
-            if (mPollFds[wake].revents & POLLIN) {
-                char msg;
-                int result = read(mPollFds[wake].fd, &msg, 1);
-                ALOGE_IF(result<0, "error reading from wake pipe (%s)", strerror(errno));
-                ALOGE_IF(msg != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg));
-                mPollFds[wake].revents = 0;
+            for (int i=0 ; i<n ; i++) {
+                if (events[i].data.u32 == wake) {
+                    char msg[16];
+                    int result;
+                    // several activate/batch calls may be queued
+                    while ((result = read(mReadPipeFd, msg, sizeof(msg))) > 0)
+                        ALOGE_IF(msg[0] != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg[0]));
+                    ALOGE_IF(result<0 && errno != EAGAIN, "error reading from wake pipe (%s)", strerror(errno));
+                } else {
+                    mReadyDrivers |= 1 << events[i].data.u32;
+                }
             }
         }
-        // if we have events and space, go read them
-    } while (n && count);
+        // if we have events and space, go read them, or the batch
+        // which timed out the wait
+    } while ((n || batchWait) && count);
 
     return nbEvents;
 }
 int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns, int64_t timeout){
     int ret;
+    if (handle == ID_GMRV) {
+        /* no fifo, fused events are reported as they come */
+        if (!(flags & SENSORS_BATCH_DRY_RUN))
+            setFusionPeriod(period_ns);
+        return 0;
+    }
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    if(flags & SENSORS_BATCH_DRY_RUN){
-        ret = mSensors[index]->batch(handle,flags,period_ns,timeout);
-    }else{
-        if(handle == ID_A && magRunTimes > 0)
-            ret = mSensors[index]->batch(handle,flags,period_ns,0);
-        else
-            ret = mSensors[index]->batch(handle,flags,period_ns,timeout);
-
-        /*just recored the batch parameter for recovery acc batch when mag disable */
-        mBatchParameter[handle].flags = flags;
-        mBatchParameter[handle].period_ns = period_ns;
-        mBatchParameter[handle].timeout = timeout;
-        /*wakeup poll , sometime poll may be blocked
-         * before sensor was change from batch mode to continuous mode
-         */
-        const char wakeMessage(WAKE_MESSAGE);
-        int result = write(mWritePipeFd, &wakeMessage, 1);
-        ALOGE_IF(result<0, "error batch sending wake message (%s)", strerror(errno));
+    if(flags & SENSORS_BATCH_DRY_RUN)
+        return mSensors[index]->batch(handle,flags,period_ns,timeout);
+
+    pthread_mutex_lock(&mDirectLock);
+    /*just recored the batch parameter for recovery acc batch when mag disable */
+    mBatchParameter[handle].flags = flags;
+    mBatchParameter[handle].period_ns = period_ns;
+    mBatchParameter[handle].timeout = timeout;
+    int64_t shared = getSharedPeriod(handle);
+    if (shared) {
+        /* direct channel and fusion need every sample as it comes */
+        if (shared < period_ns)
+            period_ns = shared;
+        timeout = 0;
     }
+    ret = batchDriver(handle, flags, period_ns, timeout);
+    pthread_mutex_unlock(&mDirectLock);
+    return ret;
+}
+
+int sensors_poll_context_t::batchDriver(int handle, int flags, int64_t period_ns, int64_t timeout){
+    int ret;
+    int index = handleToDriver(handle);
+    if(handle == ID_A && magRunTimes > 0)
+        ret = mSensors[index]->batch(handle,flags,period_ns,0);
+    else
+        ret = mSensors[index]->batch(handle,flags,period_ns,timeout);
+    updatePollFd(index);
+    /*wakeup poll , sometime poll may be blocked
+     * before sensor was change from batch mode to continuous mode
+     */
+    wakePoll();
     return ret;
 }
 int sensors_poll_context_t::flush(int handle){
+    if (handle == ID_GMRV) {
+        pthread_mutex_lock(&mDirectLock);
+        bool active = mFusionSensors;
+        if (active)
+            mFusionFlush = true;
+        pthread_mutex_unlock(&mDirectLock);
+        if (!active)
+            return -EINVAL;
+        wakePoll();
+        return 0;
+    }
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->flush(handle);
+    int err = mSensors[index]->flush(handle);
+    // complete event is sent by poll thread, may be blocked
+    if (!err)
+        wakePoll();
+    return err;
+}
+
+/* called with mDirectLock held */
+void sensors_poll_context_t::updateDirectReport(int handle) {
+    int64_t period = 0;
+    for (int i=0 ; i<DIRECT_CHANNEL_MAX ; i++) {
+        int64_t p = mDirectChannels[i] ? mDirectChannels[i]->getPeriod(handle) : 0;
+        if (p && (!period || p < period))
+            period = p;
+    }
+    if (period == mDirectPeriod[handle])
+        return;
+
+    mDirectPeriod[handle] = period;
+    setUser(handle, &mDirectSensors, period != 0);
+    updateRate(handle);
+}
+
+/* called with mDirectLock held */
+void sensors_poll_context_t::stopDirectChannel(DirectChannel* channel) {
+    for (int handle=0 ; handle<SENSORS_MAX ; handle++) {
+        if (channel->getPeriod(handle)) {
+            channel->config(handle, SENSOR_DIRECT_RATE_STOP);
+            updateDirectReport(handle);
+        }
+    }
+}
+
+int sensors_poll_context_t::registerDirectChannel(const struct sensors_direct_mem_t* mem,
+        int channel_handle) {
+    int ret = -ENOMEM;
+    if (mem == NULL) {
+        int i = channel_handle - 1;
+        if (i < 0 || i >= DIRECT_CHANNEL_MAX)
+            return -EINVAL;
+        pthread_mutex_lock(&mDirectLock);
+        if (mDirectChannels[i] != NULL) {
+            stopDirectChannel(mDirectChannels[i]);
+            delete mDirectChannels[i];
+            mDirectChannels[i] = NULL;
+        }
+        pthread_mutex_unlock(&mDirectLock);
+        return 0;
+    }
+
+    DirectChannel* channel = new DirectChannel(mem);
+    if (!channel->isValid()) {
+        delete channel;
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&mDirectLock);
+    for (int i=0 ; i<DIRECT_CHANNEL_MAX ; i++) {
+        if (mDirectChannels[i] == NULL) {
+            mDirectChannels[i] = channel;
+            ret = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    if (ret < 0)
+        delete channel;
+    return ret;
+}
+
+int sensors_poll_context_t::configDirectReport(int sensor_handle, int channel_handle,
+        const struct sensors_direct_cfg_t* config) {
+    int rate = config->rate_level;
+    int i = channel_handle - 1;
+    int ret;
+    if (i < 0 || i >= DIRECT_CHANNEL_MAX)
+        return -EINVAL;
+    if (sensor_handle == -1) {
+        if (rate != SENSOR_DIRECT_RATE_STOP)
+            return -EINVAL;
+    } else if (sensor_handle < 0 || sensor_handle >= SENSORS_MAX ||
+            rate > getDirectRateLevel(sensor_handle)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&mDirectLock);
+    DirectChannel* channel = mDirectChannels[i];
+    if (channel == NULL) {
+        ret = -EINVAL;
+    } else if (sensor_handle == -1) {
+        stopDirectChannel(channel);
+        ret = 0;
+    } else {
+        ret = channel->config(sensor_handle, rate);
+        updateDirectReport(sensor_handle);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return ret;
+}
+
+int sensors_poll_context_t::activateFusion(int enabled) {
+    uint32_t sensors = enabled ? SENSORS_ACCELERATION | SENSORS_MAGNETIC_FIELD : 0;
+    int err = 0;
+    pthread_mutex_lock(&mDirectLock);
+    if (sensors != mFusionSensors) {
+        if (enabled) {
+            mFusion.reset();
+            mFusionPending = false;
+        }
+        err = setUser(ID_A, &mFusionSensors, enabled);
+        err |= setUser(ID_M, &mFusionSensors, enabled);
+        updateRate(ID_A);
+        updateRate(ID_M);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return err;
+}
+
+void sensors_poll_context_t::setFusionPeriod(int64_t ns) {
+    if (ns < FUSION_MIN_PERIOD)
+        ns = FUSION_MIN_PERIOD;
+    pthread_mutex_lock(&mDirectLock);
+    mBatchParameter[ID_GMRV].period_ns = ns;
+    if (ns != mFusionPeriod) {
+        mFusionPeriod = ns;
+        if (mFusionSensors) {
+            updateRate(ID_A);
+            updateRate(ID_M);
+        }
+    }
+    pthread_mutex_unlock(&mDirectLock);
+}
+
+/* called with mDirectLock held, a rotation is fused on each accel
+ * sample once a mag sample arrived.
+ */
+void sensors_poll_context_t::fuseEvent(const sensors_event_t& event) {
+    if (event.sensor == ID_M) {
+        mFusion.handleMag(event.magnetic.v, event.timestamp);
+    } else if (event.sensor == ID_A) {
+        mFusion.handleAccel(event.acceleration.v, event.timestamp);
+        if (mFusion.getRotation(mFusionEvent.data)) {
+            mFusionEvent.version = sizeof(sensors_event_t);
+            mFusionEvent.sensor = ID_GMRV;
+            mFusionEvent.type = SENSOR_TYPE_GEOMAGNETIC_ROTATION_VECTOR;
+            mFusionEvent.timestamp = event.timestamp;
+            /* heading accuracy unknown */
+            mFusionEvent.data[4] = -1.0f;
+            mFusionPending = true;
+        }
+    }
+}
+
+/* latest fused rotation and flush complete, older rotations were
+ * replaced while poll had no room.
+ */
+int sensors_poll_context_t::readFusion(sensors_event_t* data, int count) {
+    int nb = 0;
+    pthread_mutex_lock(&mDirectLock);
+    if (mFusionPending && count > nb) {
+        if (mFusionSensors)
+            data[nb++] = mFusionEvent;
+        mFusionPending = false;
+    }
+    if (mFusionFlush && count > nb) {
+        memset(&data[nb], 0, sizeof(data[nb]));
+        data[nb].version = META_DATA_VERSION;
+        data[nb].type = SENSOR_TYPE_META_DATA;
+        data[nb].meta_data.sensor = ID_GMRV;
+        data[nb].meta_data.what = META_DATA_FLUSH_COMPLETE;
+        nb++;
+        mFusionFlush = false;
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return nb;
+}
+
+/* write events to direct channels and fusion, returns number left
+ * for poll.
+ */
+int sensors_poll_context_t::dispatchEvents(sensors_event_t* data, int count) {
+    int kept = 0;
+    pthread_mutex_lock(&mDirectLock);
+    for (int i=0 ; i<count ; i++) {
+        int handle = data[i].sensor;
+        if (data[i].type != SENSOR_TYPE_META_DATA && handle >= 0 &&
+                handle < SENSORS_MAX) {
+            if (mDirectSensors & (1 << handle)) {
+                for (int j=0 ; j<DIRECT_CHANNEL_MAX ; j++) {
+                    if (mDirectChannels[j] != NULL)
+                        mDirectChannels[j]->report(data[i]);
+                }
+            }
+            if (mFusionSensors & (1 << handle))
+                fuseEvent(data[i]);
+            if ((mDirectSensors | mFusionSensors) & ~mActiveSensors & (1 << handle))
+                continue;
+        }
+        if (kept != i)
+            data[kept] = data[i];
+        kept++;
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return kept;
 }
 
 /*****************************************************************************/
@@ -413,6 +874,18 @@ static int poll__flush(struct sensors_poll_device_1* dev, int handle){
 	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
 	return ctx->flush(handle);
 }
+
+static int poll__register_direct_channel(struct sensors_poll_device_1* dev,
+            const struct sensors_direct_mem_t* mem, int channel_handle){
+	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+	return ctx->registerDirectChannel(mem, channel_handle);
+}
+
+static int poll__config_direct_report(struct sensors_poll_device_1* dev,
+            int sensor_handle, int channel_handle, const struct sensors_direct_cfg_t* config){
+	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+	return ctx->configDirectReport(sensor_handle, channel_handle, config);
+}
 /*****************************************************************************/
 
 /** Open a new instance of a sensor device using name */
@@ -433,6 +906,8 @@ static int open_sensors(const struct hw_module_t* module, const char* id,
         dev->device.poll            = poll__poll;
 		dev->device.batch			= poll__batch;
 		dev->device.flush			= poll__flush;
+		dev->device.register_direct_channel	= poll__register_direct_channel;
+		dev->device.config_direct_report	= poll__config_direct_report;
         *device = &dev->device.common;
         status = 0;
 
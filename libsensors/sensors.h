@@ -42,6 +42,7 @@ __BEGIN_DECLS
 #define ID_P  (5)
 #define ID_T  (6)
 #define ID_PX (7)
+#define ID_GMRV (8)
 
 #define HWROTATION_0   (0)
 #define HWROTATION_90  (1)
@@ -41,7 +41,8 @@ LOCAL_SRC_FILES := 						\
 				FSLSensorsHub.cpp		\
 				PressSensor.cpp			\
 				InputEventReader.cpp            \
-				LightSensor.cpp
+				LightSensor.cpp			\
+				DirectChannel.cpp
 
 LOCAL_SHARED_LIBRARIES := liblog libcutils libdl
 
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2017 NXP.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_DIRECT_CHANNEL_H
+#define ANDROID_DIRECT_CHANNEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/sensors.h>
+
+#include "SensorBase.h"
+
+/*****************************************************************************/
+
+#define DIRECT_CHANNEL_MAX  8
+
+/* ashmem ring registered by a client for direct report. written by poll
+ * thread only, callers serialize config() against report(). */
+class DirectChannel {
+public:
+    DirectChannel(const struct sensors_direct_mem_t* mem);
+    ~DirectChannel();
+    bool isValid() const { return mBase != NULL; }
+    /* set rate of sensor in this channel, returns report token or 0
+     * when stopped */
+    int config(int handle, int rateLevel);
+    int64_t getPeriod(int handle) const { return mPeriod[handle]; }
+    /* append event if its sensor reports here and is due */
+    void report(sensors_event_t const& event);
+    static int64_t rateToPeriod(int rateLevel);
+
+private:
+    int mFd;
+    sensors_event_t* mBase;
+    size_t mSize;
+    uint32_t mNumEvents;
+    uint32_t mWritePos;
+    uint32_t mCounter;
+    int64_t mPeriod[SENSORS_MAX];
+    int64_t mLastTimestamp[SENSORS_MAX];
+};
+
+/*****************************************************************************/
+
+#endif  // ANDROID_DIRECT_CHANNEL_H
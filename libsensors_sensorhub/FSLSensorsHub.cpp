@@ -82,12 +82,20 @@
 #define LA_DATA_CONVERSION(value)   ((float)value /10.0f)
 #define GRAVT_DATA_CONVERSION(value)((float)value /10.0f)
 
+/* steps which make a significant motion, walking a few meters */
+#define SIGMO_STEPS			10
+/* step sources reported by step detect and step count events */
+#define STEP_DETECT_MASK	((1 << sd) | (1 << sd_wake))
+#define STEP_COUNT_MASK		((1 << sc) | (1 << sc_wake))
+
 
 
 FSLSensorsHub::FSLSensorsHub()
 : SensorBase(FSL_SENS_CTRL_NAME, FSL_SENS_DATA_NAME),
+  mEnabledMask(0),
   mPendingMask(0),
-  mInputReader(16)
+  mSigmoSteps(0),
+  mInputReader(64)
 {
     memset(&mPendingEvent[0], 0, sensors *sizeof(sensors_event_t));
 
@@ -156,33 +164,94 @@ FSLSensorsHub::FSLSensorsHub()
     mPendingEvent[sc].orientation.status = SENSOR_STATUS_ACCURACY_LOW;
 	mPendingEvent[sc].version = sizeof(sensors_event_t);
 
+	mEnabled[sd_wake] = 0;
+	mDelay[sd_wake] = 0;
+	mPendingEvent[sd_wake] = mPendingEvent[sd];
+	mPendingEvent[sd_wake].sensor = ID_SD_W;
+
+	mEnabled[sc_wake] = 0;
+	mDelay[sc_wake] = 0;
+	mPendingEvent[sc_wake] = mPendingEvent[sc];
+	mPendingEvent[sc_wake].sensor = ID_SC_W;
+
+	mEnabled[sigmo] = 0;
+	mDelay[sigmo] = 0;
+	mPendingEvent[sigmo].sensor  = ID_SM;
+	mPendingEvent[sigmo].type    = SENSOR_TYPE_SIGNIFICANT_MOTION;
+	mPendingEvent[sigmo].version = sizeof(sensors_event_t);
+
+	/* held step events are kept while AP sleeps in batch mode */
+	mHalBatch = true;
+
 	sprintf(mClassPath[accel],"%s/%s",FSL_SENS_SYSFS_PATH,FSL_ACC_DEVICE_NAME);
 	sprintf(mClassPath[mag],"%s/%s",FSL_SENS_SYSFS_PATH,FSL_MAG_DEVICE_NAME);
 	sprintf(mClassPath[gyro],"%s/%s",FSL_SENS_SYSFS_PATH,FSL_GYRO_DEVICE_NAME);
 
+	memset(mRelFields, 0, sizeof(mRelFields));
+	memset(mAbsFields, 0, sizeof(mAbsFields));
+	mapEvent(mRelFields, EVENT_ACC_X, accel, 0, ACC_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_ACC_Y, accel, 1, ACC_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_ACC_Z, accel, 2, ACC_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_MAG_X, mag, 0, MAG_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_MAG_Y, mag, 1, MAG_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_MAG_Z, mag, 2, MAG_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_GYRO_X, gyro, 0, GYRO_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_GYRO_Y, gyro, 1, GYRO_DATA_CONVERSION(1));
+	mapEvent(mRelFields, EVENT_GYRO_Z, gyro, 2, GYRO_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ORNT_X, orn, 0, ORNT_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ORNT_Y, orn, 1, ORNT_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ORNT_Z, orn, 2, ORNT_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_LINEAR_ACC_X, la, 0, LA_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_LINEAR_ACC_Y, la, 1, LA_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_LINEAR_ACC_Z, la, 2, LA_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_GRAVITY_X, gravt, 0, GRAVT_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_GRAVITY_Y, gravt, 1, GRAVT_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_GRAVITY_Z, gravt, 2, GRAVT_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ROTATION_VECTOR_A, rv, 0, RV_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ROTATION_VECTOR_B, rv, 1, RV_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ROTATION_VECTOR_C, rv, 2, RV_DATA_CONVERSION(1));
+	mapEvent(mAbsFields, EVENT_ROTATION_VECTOR_W, rv, 3, RV_DATA_CONVERSION(1));
+}
+
+void FSLSensorsHub::mapEvent(EventField* fields, int code, int what, int index, float scale)
+{
+	fields[code].dest = &mPendingEvent[what].data[index];
+	fields[code].scale = scale;
+	fields[code].mask = 1 << what;
 }
 
 FSLSensorsHub::~FSLSensorsHub()
 {
 }
 
+int FSLSensorsHub::handleToWhat(int32_t handle)
+{
+	switch(handle){
+		case ID_M : return mag;
+		case ID_O : return orn;
+		case ID_GY: return gyro;
+		case ID_RV: return rv;
+		case ID_LA: return la;
+		case ID_GR: return gravt;
+		case ID_SD: return sd;
+		case ID_SC: return sc;
+		case ID_SD_W: return sd_wake;
+		case ID_SC_W: return sc_wake;
+		case ID_SM: return sigmo;
+	}
+	return accel;
+}
+
+bool FSLSensorsHub::hasPendingEvents() const
+{
+	return batchDue();
+}
+
 int FSLSensorsHub::setEnable(int32_t handle, int en)
 {
 	int err = 0;
-	int what = accel;
+	int what = handleToWhat(handle);
 	bool isHaveSensorRun = 0;
-    switch(handle){
-		case ID_A : what = accel; break;
-		case ID_M : what = mag;   break;
-		case ID_O : what = orn;   break;
-		case ID_GY: what = gyro;  break; 
-		case ID_RV: what = rv;	  break;
-		case ID_LA: what = la;	  break;
-		case ID_GR: what = gravt; break;
-		case ID_SD: what = sd;    break;
-		case ID_SC: what = sc;    break;
-		
-    }
 
     if(en)
 		mEnabled[what]++;
@@ -191,6 +260,13 @@ int FSLSensorsHub::setEnable(int32_t handle, int en)
 	
 	if(mEnabled[what] < 0)
 		mEnabled[what] = 0;
+	if(mEnabled[what] > 0)
+		mEnabledMask |= 1 << what;
+	else
+		mEnabledMask &= ~(1 << what);
+	if(what == sigmo && en)
+		mSigmoSteps = 0;
+	setSuspendBlock(mEnabledMask & ((1 << sd_wake) | (1 << sc_wake) | (1 << sigmo)));
 
 	for(int i = 0; i < sensors; i++ ){
 		if(mEnabled[i] > 0)
@@ -225,18 +301,7 @@ int FSLSensorsHub::setDelay(int32_t handle, int64_t ns)
 {
     if (ns < 0)
         return -EINVAL;
-	int what = accel;
-    switch(handle){
-		case ID_A : what = accel; break;
-		case ID_M : what = mag;   break;
-		case ID_O : what = orn;   break;
-		case ID_GY: what = gyro;  break; 
-		case ID_RV: what = rv;	  break;
-		case ID_LA: what = la;	  break;
-		case ID_GR: what = gravt; break;
-		case ID_SD: what = sd;	  break;
-		case ID_SC: what = sc;    break;
-    }
+	int what = handleToWhat(handle);
 
     mDelay[what] = ns;
 	if(what == accel)
@@ -260,9 +325,13 @@ int FSLSensorsHub::update_delay(int sensor_type , int64_t ns)
 
 int FSLSensorsHub::readEvents(sensors_event_t* data, int count)
 {
-	int i;
     if (count < 1)
         return -EINVAL;
+	if (batchDue()) {
+		/* held samples and flush complete events, fd is read on
+		 * next call if it has data too. */
+		return readBatch(data, count);
+	}
 
     ssize_t n = mInputReader.fill(data_fd);
     if (n < 0)
@@ -270,31 +339,52 @@ int FSLSensorsHub::readEvents(sensors_event_t* data, int count)
 
     int numEventReceived = 0;
     input_event const* event;
-
-    while (count && mInputReader.readEvent(&event)) {
-        int type = event->type;
-        if ((type == EV_ABS) || (type == EV_REL) || (type == EV_KEY)) {
-            processEvent(type,event->code, event->value);
-            mInputReader.next();
-        } else if (type == EV_SYN) {
-            int64_t time = timevalToNano(event->time);
-			for(i = 0 ; i< sensors && mPendingMask && count ;i++){
-			  	 	if(mPendingMask & (1 << i)){
-						mPendingMask &= ~(1 << i);
-						mPendingEvent[i].timestamp = time;
-						if (mEnabled[i]) {
-							*data++ = mPendingEvent[i];
-							count--;
-							numEventReceived++;
-						}
-			  	 	}
-	       }
-		   if (!mPendingMask) {
-		       mInputReader.next();
-		   }
-        } else {
-            mInputReader.next();
+    ssize_t avail;
+
+    while (count && (avail = mInputReader.readEvents(&event)) > 0) {
+        ssize_t i;
+        for (i = 0; i < avail && count; i++, event++) {
+            int type = event->type;
+            const EventField* field = NULL;
+            if (type == EV_REL && event->code < REL_CNT)
+                field = &mRelFields[event->code];
+            else if (type == EV_ABS && event->code < ABS_CNT)
+                field = &mAbsFields[event->code];
+
+            if (field && field->dest) {
+                *field->dest = event->value * field->scale;
+                mPendingMask |= field->mask;
+            } else if ((type == EV_ABS) || (type == EV_REL) || (type == EV_KEY)) {
+                processEvent(type, event->code, event->value);
+            } else if (type == EV_SYN) {
+                int64_t time = timevalToNano(event->time);
+                // every sensor of the sample goes out in this pass,
+                // fusion outputs share one SYN.
+                while (mPendingMask && count) {
+                    int what = __builtin_ctz(mPendingMask);
+                    mPendingMask &= ~(1 << what);
+                    if (mEnabledMask & (1 << what)) {
+                        mPendingEvent[what].timestamp = time;
+                        if (what == sigmo) {
+                            /* one-shot, disabled once it triggers */
+                            mEnabled[sigmo] = 0;
+                            mEnabledMask &= ~(1 << sigmo);
+                            setSuspendBlock(mEnabledMask &
+                                    ((1 << sd_wake) | (1 << sc_wake)));
+                        }
+                        if (batchEvent(mPendingEvent[what]))
+                            continue;
+                        *data++ = mPendingEvent[what];
+                        count--;
+                        numEventReceived++;
+                    }
+                }
+                // out of room, keep SYN for the rest of the sample
+                if (mPendingMask)
+                    break;
+            }
         }
+        mInputReader.next(i);
     }
 
     return numEventReceived;
@@ -306,120 +396,33 @@ void FSLSensorsHub::processEvent(int code, int value)
 }
 void FSLSensorsHub::processEvent(int type ,int code, int value){
 	static uint64_t steps_high = 0,steps_low = 0;
+	// data fields are demuxed by mRelFields/mAbsFields in readEvents.
 	if(type == EV_REL){
 		 switch (code) {
-		 case EVENT_ACC_X :
-            mPendingMask |= 1 << accel;
-            mPendingEvent[accel].acceleration.x = ACC_DATA_CONVERSION(value);
-            break;
-        case EVENT_ACC_Y:
-            mPendingMask |= 1 << accel;
-            mPendingEvent[accel].acceleration.y = ACC_DATA_CONVERSION(value);
-            break;
-        case EVENT_ACC_Z:
-            mPendingMask |=  1 << accel;
-            mPendingEvent[accel].acceleration.z = ACC_DATA_CONVERSION(value);
-            break;
-        case EVENT_MAG_X :
-            mPendingMask |= 1 << mag;
-            mPendingEvent[mag].magnetic.x = MAG_DATA_CONVERSION(value);
-            break;
-        case EVENT_MAG_Y:
-            mPendingMask |= 1 << mag;
-            mPendingEvent[mag].magnetic.y = MAG_DATA_CONVERSION(value);
-            break;
-        case EVENT_MAG_Z:
-            mPendingMask |=  1 << mag;
-            mPendingEvent[mag].magnetic.z = MAG_DATA_CONVERSION(value);
-            break;
 		case EVENT_MAG_STATUS:
 			mPendingMask |=  1 << mag;
 			mPendingEvent[mag].magnetic.status 	= value;
 			mPendingEvent[orn].orientation.status	= value;
 			break;
-		case EVENT_GYRO_X :
-            mPendingMask |=  1 << gyro;
-            mPendingEvent[gyro].gyro.x= GYRO_DATA_CONVERSION(value);
-            break;
-        case EVENT_GYRO_Y :
-            mPendingMask |=  1 << gyro;
-            mPendingEvent[gyro].gyro.y = GYRO_DATA_CONVERSION(value);
-            break;
-        case EVENT_GYRO_Z :
-            mPendingMask |=  1 << gyro;
-            mPendingEvent[gyro].gyro.z	= GYRO_DATA_CONVERSION(value);
-            break;
 		case EVENT_STEP_DETECTED:
-            mPendingMask |=  1 << sd;
+            mPendingMask |=  STEP_DETECT_MASK;
             mPendingEvent[sd].data[0] = 1.0f;
+            mPendingEvent[sd_wake].data[0] = 1.0f;
+            if ((mEnabledMask & (1 << sigmo)) && ++mSigmoSteps >= SIGMO_STEPS) {
+                mPendingMask |= 1 << sigmo;
+                mPendingEvent[sigmo].data[0] = 1.0f;
+            }
             break;
 		case EVENT_STEP_COUNT_HIGH:
 			steps_high = (uint64_t)(value & 0xffffffff);
             break;
 		case EVENT_STEP_COUNT_LOW:
-            mPendingMask |=  1 << sc;
+            mPendingMask |=  STEP_COUNT_MASK;
 			steps_low = (uint64_t)(value & 0xffffffff);
             mPendingEvent[sc].u64.step_counter = ((steps_high << 32) | steps_low);
+            mPendingEvent[sc_wake].u64.step_counter = mPendingEvent[sc].u64.step_counter;
             break;
 		}
-    
-	}else if(type == EV_ABS){
-	 switch(code){
-	 	case EVENT_ORNT_X :
-            mPendingMask |=  1 << orn;
-            mPendingEvent[orn].orientation.azimuth	= ORNT_DATA_CONVERSION(value);
-            break;
-        case EVENT_ORNT_Y :
-            mPendingMask |=  1 << orn;
-            mPendingEvent[orn].orientation.pitch = ORNT_DATA_CONVERSION(value);
-            break;
-        case EVENT_ORNT_Z :
-            mPendingMask |=  1 << orn;
-            mPendingEvent[orn].orientation.roll	= ORNT_DATA_CONVERSION(value);
-            break;
-		case EVENT_LINEAR_ACC_X :
-            mPendingMask |= 1 << la;
-            mPendingEvent[la].data[0] = LA_DATA_CONVERSION(value);
-            break;
-        case EVENT_LINEAR_ACC_Y:
-            mPendingMask |= 1 << la;
-            mPendingEvent[la].data[1] = LA_DATA_CONVERSION(value);
-            break;
-        case EVENT_LINEAR_ACC_Z:
-            mPendingMask |=  1 << la;
-            mPendingEvent[la].data[2] = LA_DATA_CONVERSION(value);
-            break;
-
-		case EVENT_GRAVITY_X :
-            mPendingMask |= 1 << gravt;
-            mPendingEvent[gravt].data[0] = GRAVT_DATA_CONVERSION(value);
-            break;
-        case EVENT_GRAVITY_Y:
-            mPendingMask |= 1 << gravt;
-            mPendingEvent[gravt].data[1] = GRAVT_DATA_CONVERSION(value);
-            break;
-        case EVENT_GRAVITY_Z:
-            mPendingMask |=  1 << gravt;
-            mPendingEvent[gravt].data[2] = GRAVT_DATA_CONVERSION(value);
-            break;
-			
-		case EVENT_ROTATION_VECTOR_W :
-            mPendingMask |= 1 << rv;
-            mPendingEvent[rv].data[3] = RV_DATA_CONVERSION(value);
-            break;
-        case EVENT_ROTATION_VECTOR_A:
-            mPendingMask |= 1 << rv;
-            mPendingEvent[rv].data[0] = RV_DATA_CONVERSION(value);
-            break;
-        case EVENT_ROTATION_VECTOR_B:
-            mPendingMask |=  1 << rv;
-            mPendingEvent[rv].data[1] = RV_DATA_CONVERSION(value);
-            break;
-		 case EVENT_ROTATION_VECTOR_C:
-            mPendingMask |=  1 << rv;
-            mPendingEvent[rv].data[2] = RV_DATA_CONVERSION(value);
-            break;
-	  }
 	}
 }
 
@@ -495,20 +498,7 @@ int FSLSensorsHub::disable_sensor(int what) {
 	return writeEnable(what,0);
 }
 int FSLSensorsHub::getEnable(int32_t handle) {
-	int what = accel;
-	switch(handle){
-		case ID_A : what = accel; break;
-		case ID_M : what = mag;   break;
-		case ID_O : what = orn;   break;
-		case ID_GY: what = gyro;  break; 
-		case ID_RV: what = rv;	  break;
-		case ID_LA: what = la;	  break;
-		case ID_GR: what = gravt; break;
-		case ID_SD: what = sd;	  break;
-		case ID_SC: what = sc;    break;
-    }
-
-	return mEnabled[what];
+	return mEnabled[handleToWhat(handle)];
 }
 
 /*****************************************************************************/
@@ -38,6 +38,7 @@ public:
     virtual int setEnable(int32_t handle, int enabled);
     virtual int getEnable(int32_t handle);
     virtual int readEvents(sensors_event_t* data, int count);
+    virtual bool hasPendingEvents() const;
     void processEvent(int code, int value);
 	void processEvent(int type ,int code, int value);
 
@@ -52,8 +53,12 @@ private:
         gravt		= 7,
         sd 			= 8,
 		sc			= 9,
+		sd_wake		= 10,
+		sc_wake		= 11,
+		sigmo		= 12,
         sensors,			
     };
+	static int handleToWhat(int32_t handle);
 	int is_sensor_enabled();
 	int enable_sensor(int what);
 	int disable_sensor(int what);
@@ -61,8 +66,22 @@ private:
 	int readDisable();
 	int writeEnable(int what,int isEnable);
 	int writeDelay(int what,int64_t ns);
+	// pending event field an input code writes, filled once in
+	// constructor. codes with no field go to processEvent().
+	struct EventField {
+		float* dest;
+		float scale;
+		int mask;
+	};
+	void mapEvent(EventField* fields, int code, int what, int index, float scale);
+	EventField mRelFields[REL_CNT];
+	EventField mAbsFields[ABS_CNT];
 	int mEnabled[sensors];
+	// bit per sensor with mEnabled > 0.
+	int mEnabledMask;
 	int mPendingMask;
+	// steps since significant motion was enabled.
+	int mSigmoSteps;
 	char mClassPath[sensors][PATH_MAX];
 	InputEventCircularReader mInputReader;
 	sensors_event_t mPendingEvent[sensors];
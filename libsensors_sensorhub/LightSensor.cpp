@@ -42,7 +42,10 @@ LightSensor::LightSensor()
       mEnabled(0),
       mInputReader(4),
       mHasPendingEvent(false),
-      mThresholdLux(10)
+      mThresholdLux(10),
+      mHysteresis(LIGHT_HYSTERESIS),
+      mMinInterval(LIGHT_MIN_INTERVAL * 1000000LL),
+      mLastReport(0)
 {
     char  buffer[PROPERTY_VALUE_MAX];
 
@@ -62,6 +65,13 @@ LightSensor::LightSensor()
        isn't set */
     property_get("ro.lightsensor.threshold", buffer, "10");
     mThresholdLux = atoi(buffer);
+
+    /* noise within hysteresis of last reported lux is dropped, and
+       changes are reported at most once per min interval */
+    if (property_get("ro.lightsensor.hysteresis", buffer, NULL) > 0)
+        mHysteresis = atoi(buffer);
+    if (property_get("ro.lightsensor.min_interval", buffer, NULL) > 0)
+        mMinInterval = atoi(buffer) * 1000000LL;
 }
 
 LightSensor::~LightSensor() {
@@ -83,6 +93,8 @@ int LightSensor::enable(int32_t handle, int en)
     int flags = en ? 1 : 0;
 
     mPreviousLight = -1;
+    mHasPendingEvent = false;
+    mLastReport = 0;
     if (flags != mEnabled) {
         FILE *fd = NULL;
         strcpy(&ls_sysfs_path[ls_sysfs_path_len], "mode");
@@ -100,7 +112,7 @@ int LightSensor::enable(int32_t handle, int en)
             fclose(fd);
             mEnabled = flags;
             if (flags)
-                setIntLux();
+                setIntLux(-1);
             return 0;
         }
         return -1;
@@ -108,29 +120,46 @@ int LightSensor::enable(int32_t handle, int en)
     return 0;
 }
 
-int LightSensor::setIntLux()
+/* lux change of reported value which is not noise */
+float LightSensor::changeBand(float lux) const
+{
+    float band = lux * mHysteresis / 100;
+    return band > mThresholdLux ? band : mThresholdLux;
+}
+
+bool LightSensor::isChanged(float lux) const
+{
+    return mPreviousLight < 0 ||
+           fabsf(lux - mPreviousLight) >= changeBand(mPreviousLight);
+}
+
+/* program chip interrupt window around lux, it stays quiet while light
+   keeps within the band. lux < 0 reads current value from chip. */
+int LightSensor::setIntLux(int lux)
 {
     FILE *fd = NULL;
     char buf[6];
-    int n, lux, int_ht_lux, int_lt_lux;
+    int n, int_ht_lux, int_lt_lux;
 
     /* Read current lux value firstly, then change Delta value */
-    strcpy(&ls_sysfs_path[ls_sysfs_path_len], "lux");
-    if ((fd = fopen(ls_sysfs_path, "r")) == NULL) {
-        ALOGE("Unable to open %s\n", ls_sysfs_path);
-        return -1;
-    }
-    memset(buf, 0, 6);
-    if ((n = fread(buf, 1, 6, fd)) < 0) {
-        ALOGE("Unable to read %s\n", ls_sysfs_path);
+    if (lux < 0) {
+        strcpy(&ls_sysfs_path[ls_sysfs_path_len], "lux");
+        if ((fd = fopen(ls_sysfs_path, "r")) == NULL) {
+            ALOGE("Unable to open %s\n", ls_sysfs_path);
+            return -1;
+        }
+        memset(buf, 0, 6);
+        if ((n = fread(buf, 1, 6, fd)) < 0) {
+            ALOGE("Unable to read %s\n", ls_sysfs_path);
+            fclose(fd);
+            return -1;
+        }
         fclose(fd);
-	return -1;
+        lux = atoi(buf);
     }
-    fclose(fd);
 
-    lux = atoi(buf);
-    int_ht_lux = lux + mThresholdLux;
-    int_lt_lux = lux - mThresholdLux;
+    int_ht_lux = lux + (int)changeBand(lux);
+    int_lt_lux = lux - (int)changeBand(lux);
 
     if (int_lt_lux < 0)
 	    int_lt_lux = 0;
@@ -160,7 +189,25 @@ int LightSensor::setIntLux()
     return 0;
 }
 bool LightSensor::hasPendingEvents() const {
-    return mHasPendingEvent;
+    return mHasPendingEvent && getTimestamp() >= mLastReport + mMinInterval;
+}
+
+int64_t LightSensor::getBatchDeadline() const {
+    int64_t deadline = SensorBase::getBatchDeadline();
+    if (mHasPendingEvent && (!deadline || mLastReport + mMinInterval < deadline))
+        deadline = mLastReport + mMinInterval;
+    return deadline;
+}
+
+/* report mPendingEvent as new light, returns events put in data */
+int LightSensor::reportEvent(sensors_event_t* data)
+{
+    mHasPendingEvent = false;
+    mPreviousLight = mPendingEvent.light;
+    mLastReport = getTimestamp();
+    setIntLux((int)mPendingEvent.light);
+    *data = mPendingEvent;
+    return 1;
 }
 
 int LightSensor::readEvents(sensors_event_t* data, int count)
@@ -168,11 +215,12 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
     if (count < 1)
         return -EINVAL;
 
-    if (mHasPendingEvent) {
+    if (mHasPendingEvent && getTimestamp() >= mLastReport + mMinInterval) {
+        /* held change may have settled back within the band */
         mHasPendingEvent = false;
-        mPendingEvent.timestamp = getTimestamp();
-        *data = mPendingEvent;
-        return mEnabled ? 1 : 0;
+        if (mEnabled && isChanged(mPendingEvent.light))
+            return reportEvent(data);
+        return 0;
     }
 
     ssize_t n = mInputReader.fill(data_fd);
@@ -185,17 +233,20 @@ int LightSensor::readEvents(sensors_event_t* data, int count)
     while (count && mInputReader.readEvent(&event)) {
         int type = event->type;
         if (type == EV_ABS) {
-            if (event->code == EVENT_TYPE_LIGHT) {
+            if (event->code == EVENT_TYPE_LIGHT)
                 mPendingEvent.light = event->value;
-                setIntLux();
-            }
         } else if (type == EV_SYN) {
             mPendingEvent.timestamp = timevalToNano(event->time);
-            if (mEnabled && (mPendingEvent.light != mPreviousLight)) {
-                *data++ = mPendingEvent;
-                count--;
-                numEventReceived++;
-                mPreviousLight = mPendingEvent.light;
+            if (mEnabled && isChanged(mPendingEvent.light)) {
+                if (getTimestamp() < mLastReport + mMinInterval) {
+                    /* too soon, latest change goes out when interval ends */
+                    mHasPendingEvent = true;
+                } else {
+                    int nb = reportEvent(data);
+                    data += nb;
+                    count -= nb;
+                    numEventReceived += nb;
+                }
             }
         } else {
             ALOGE("LightSensor: unknown event (type=%d, code=%d)",
@@ -28,6 +28,10 @@
 #include "InputEventReader.h"
 
 #define ISL29023_ALS_CONT_MODE   5
+/* defaults of ro.lightsensor.hysteresis (percent of reported lux) and
+ * ro.lightsensor.min_interval (ms between two reports) */
+#define LIGHT_HYSTERESIS         10
+#define LIGHT_MIN_INTERVAL       200
 
 /*****************************************************************************/
 
@@ -47,13 +51,22 @@ public:
     virtual ~LightSensor();
     virtual int readEvents(sensors_event_t* data, int count);
     virtual bool hasPendingEvents() const;
+    virtual int64_t getBatchDeadline() const;
     virtual int setDelay(int32_t handle, int64_t ns);
     virtual int enable(int32_t handle, int enabled);
     virtual void processEvent(int code, int value);
 
 private:
     int mThresholdLux;
-    int setIntLux();
+    int mHysteresis;
+    int64_t mMinInterval;
+    /* time of last reported event, a change held in mPendingEvent
+     * is reported mMinInterval after it */
+    int64_t mLastReport;
+    float changeBand(float lux) const;
+    bool isChanged(float lux) const;
+    int reportEvent(sensors_event_t* data);
+    int setIntLux(int lux);
 };
 
 /*****************************************************************************/
@@ -40,8 +40,11 @@
 PressSensor::PressSensor()
 : SensorBase(NULL, PRESS_DATA_NAME),
   mPendingMask(0),
+  mReportedMask(0),
   mInputReader(4)
 {
+    char buffer[PROPERTY_VALUE_MAX];
+
     ALOGD("sendrolon press sensor init");
     memset(&mPendingEvent[0], 0, sensors *sizeof(sensors_event_t));
 	memset(mClassPath, '\0', sizeof(mClassPath));
@@ -60,6 +63,11 @@ PressSensor::PressSensor()
     mPendingEvent[temperature].type    = SENSOR_TYPE_AMBIENT_TEMPERATURE;
     mPendingEvent[temperature].orientation.status = SENSOR_STATUS_ACCURACY_HIGH;
 	mPendingEvent[temperature].version = sizeof(sensors_event_t);
+
+	/* pressure is continuous, every sample is reported */
+	mHysteresis[press] = 0;
+	property_get("ro.tempsensor.hysteresis", buffer, TEMPERATURE_HYSTERESIS);
+	mHysteresis[temperature] = atof(buffer);
 	
 	if(sensor_get_class_path(mClassPath))
 	{
@@ -80,6 +88,8 @@ int PressSensor::setEnable(int32_t handle, int en)
 		case ID_T : what = temperature; break;
     }
 
+    /* first sample after enable is always reported */
+    mReportedMask &= ~(1 << what);
     if(en)
 		mEnabled[what]++;
 	else
@@ -144,11 +154,13 @@ int PressSensor::readEvents(sensors_event_t* data, int count)
 			  	 	if(mPendingMask & (1 << i)){
 						mPendingMask &= ~(1 << i);
 						mPendingEvent[i].timestamp = time;
-						if (mEnabled[i]) {
-							*data++ = mPendingEvent[i];
-							count--;
-							numEventReceived++;
-						}
+						if (!mEnabled[i] || !isChanged(i))
+							continue;
+						mReported[i] = mPendingEvent[i].data[0];
+						mReportedMask |= 1 << i;
+						*data++ = mPendingEvent[i];
+						count--;
+						numEventReceived++;
 			  	 	}
 	       }
 		   if (!mPendingMask) {
@@ -162,6 +174,12 @@ int PressSensor::readEvents(sensors_event_t* data, int count)
     return numEventReceived;
 }
 
+bool PressSensor::isChanged(int what) const
+{
+	return !(mReportedMask & (1 << what)) ||
+		fabsf(mPendingEvent[what].data[0] - mReported[what]) >= mHysteresis[what];
+}
+
 void PressSensor::processEvent(int code, int value)
 {
 
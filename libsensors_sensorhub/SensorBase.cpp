@@ -28,6 +28,11 @@
 #include <linux/input.h>
 
 #include "SensorBase.h"
+
+/* android evdev keeps a wakelock while events are queued */
+#ifndef EVIOCSSUSPENDBLOCK
+#define EVIOCSSUSPENDBLOCK _IOW('E', 0x91, int)
+#endif
 SensorBase::SensorBase(
         const char* dev_name,
         const char* data_name)
@@ -42,6 +47,13 @@ SensorBase::SensorBase(
 	fifo_fd = -1;
 	fifo_name = NULL;
 	mBatchEnabled = false;
+	mFlushed = 0;
+	mHalBatch = false;
+	memset(mReportLatency, 0, sizeof(mReportLatency));
+	memset(mBatchPeriod, 0, sizeof(mBatchPeriod));
+	memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
+	memset(mBatch, 0, sizeof(mBatch));
+	mSuspendBlock = false;
 }
 
 SensorBase::SensorBase(
@@ -60,6 +72,13 @@ SensorBase::SensorBase(
 		open_fifo_device();
 	}
 	mBatchEnabled = false;
+	mFlushed = 0;
+	mHalBatch = false;
+	memset(mReportLatency, 0, sizeof(mReportLatency));
+	memset(mBatchPeriod, 0, sizeof(mBatchPeriod));
+	memset(mLastTimestamp, 0, sizeof(mLastTimestamp));
+	memset(mBatch, 0, sizeof(mBatch));
+	mSuspendBlock = false;
 }
 
 SensorBase::~SensorBase() {
@@ -73,6 +92,8 @@ SensorBase::~SensorBase() {
 	{
 		close(fifo_fd);
 	}
+	for(int i = 0; i < BATCH_FIFOS; i++)
+		free(mBatch[i].events);
 }
 
 int SensorBase::open_device() {
@@ -137,7 +158,7 @@ void  processEvent(int code, int value)
 int64_t SensorBase::getTimestamp() {
     struct timespec t;
     t.tv_sec = t.tv_nsec = 0;
-    clock_gettime(CLOCK_MONOTONIC, &t);
+    clock_gettime(CLOCK_BOOTTIME, &t);
     return int64_t(t.tv_sec)*1000000000LL + t.tv_nsec;
 }
 
@@ -182,6 +203,16 @@ int SensorBase::openInput(const char* inputName) {
     }
     closedir(dir);
     ALOGE_IF(fd<0, "couldn't find '%s' input device", inputName);
+    if (fd >= 0) {
+        /* framework expects elapsedRealtimeNanos, have evdev stamp
+           SYN with it so kernel time is passed through unchanged */
+        int clockid = CLOCK_BOOTTIME;
+        if (ioctl(fd, EVIOCSCLOCKID, &clockid) < 0) {
+            clockid = CLOCK_MONOTONIC;
+            ALOGW("input clock CLOCK_BOOTTIME not supported, using CLOCK_MONOTONIC (%s)", strerror(errno));
+            ioctl(fd, EVIOCSCLOCKID, &clockid);
+        }
+    }
     return fd;
 }
 int SensorBase::readEvents(sensors_event_t* data, int count)
@@ -189,17 +220,149 @@ int SensorBase::readEvents(sensors_event_t* data, int count)
   	return 0;
 }
 int SensorBase::batch(int handle, int flags, int64_t period_ns, int64_t timeout){
-	
 	/*default , not support batch mode or SENSORS_BATCH_WAKE_UPON_FIFO_FULL */
-	if(timeout > 0 || flags & SENSORS_BATCH_WAKE_UPON_FIFO_FULL) 
+	if(flags & SENSORS_BATCH_WAKE_UPON_FIFO_FULL)
+		return -EINVAL;
+	if(timeout > 0 && (!mHalBatch || handle < 0 || handle >= SENSORS_MAX))
 		return -EINVAL;
 	if(!(flags & SENSORS_BATCH_DRY_RUN)){
+		if(timeout > 0){
+			BatchFifo& fifo = mBatch[batchFifo(handle)];
+			if(fifo.events == NULL)
+				fifo.events = (sensors_event_t *)calloc(SENSOR_BATCH_EVENTS, sizeof(sensors_event_t));
+			if(fifo.events == NULL)
+				return -ENOMEM;
+		}
+		if(mHalBatch && handle >= 0 && handle < SENSORS_MAX){
+			mReportLatency[handle] = timeout;
+			mBatchPeriod[handle] = period_ns;
+			/* release held events at once when leaving batch mode */
+			if(timeout == 0)
+				mBatch[batchFifo(handle)].deadline = getTimestamp();
+		}
 		setDelay(handle,period_ns);
 	}
 	return 0;
 }
 int SensorBase::flush(int handle){
-	return  -EINVAL;
+	if(mHalBatch && handle >= 0 && handle < SENSORS_MAX && getEnable(handle)){
+		mFlushed |= (0x01 << handle);
+		return 0;
+	}
+	return -EINVAL;
+}
+
+bool SensorBase::batchEvent(sensors_event_t const& event){
+	int handle = event.sensor;
+	if(handle < 0 || handle >= SENSORS_MAX || mReportLatency[handle] <= 0)
+		return false;
+	BatchFifo& fifo = mBatch[batchFifo(handle)];
+	if(fifo.events == NULL)
+		return false;
+
+	sensors_event_t* slot;
+	if(fifo.count == SENSOR_BATCH_EVENTS){
+		/* full and not read yet, oldest is lost as in a hardware fifo */
+		slot = &fifo.events[fifo.head];
+		fifo.head = (fifo.head + 1) % SENSOR_BATCH_EVENTS;
+	}else{
+		slot = &fifo.events[(fifo.head + fifo.count) % SENSOR_BATCH_EVENTS];
+		fifo.count++;
+	}
+	*slot = event;
+	/* hub may sync several samples at once, step them by the
+	 * requested period so timestamps keep increasing. */
+	if(mLastTimestamp[handle] && slot->timestamp <= mLastTimestamp[handle])
+		slot->timestamp = mLastTimestamp[handle] + mBatchPeriod[handle];
+	mLastTimestamp[handle] = slot->timestamp;
+
+	int64_t deadline = getTimestamp() + mReportLatency[handle];
+	if(fifo.count == 1 || deadline < fifo.deadline)
+		fifo.deadline = deadline;
+	return true;
+}
+
+bool SensorBase::batchFifoDue(BatchFifo const& fifo, int64_t now) const{
+	if(fifo.count == 0)
+		return false;
+	return fifo.count == SENSOR_BATCH_EVENTS || now >= fifo.deadline;
+}
+
+bool SensorBase::batchDue() const{
+	if(mFlushed)
+		return true;
+	int64_t now = getTimestamp();
+	for(int i = 0; i < BATCH_FIFOS; i++){
+		if(batchFifoDue(mBatch[i], now))
+			return true;
+	}
+	return false;
+}
+
+int64_t SensorBase::getBatchDeadline() const{
+	int64_t deadline = 0;
+	for(int i = 0; i < BATCH_FIFOS; i++){
+		if(mBatch[i].count && (!deadline || mBatch[i].deadline < deadline))
+			deadline = mBatch[i].deadline;
+	}
+	return deadline;
+}
+
+int64_t SensorBase::getWakeupDeadline() const{
+	return mBatch[BATCH_WAKEUP].count ? mBatch[BATCH_WAKEUP].deadline : 0;
+}
+
+int SensorBase::readBatch(sensors_event_t* data, int count){
+	int numEventReceived = 0;
+	if(!batchDue())
+		return 0;
+
+	/* fifo not due yet keeps its events, a flush takes both */
+	int64_t now = getTimestamp();
+	for(int i = 0; i < BATCH_FIFOS; i++){
+		BatchFifo& fifo = mBatch[i];
+		if(!mFlushed && !batchFifoDue(fifo, now))
+			continue;
+		while(count && fifo.count){
+			*data++ = fifo.events[fifo.head];
+			fifo.head = (fifo.head + 1) % SENSOR_BATCH_EVENTS;
+			fifo.count--;
+			count--;
+			numEventReceived++;
+		}
+		if(fifo.count){
+			/* rest is still due on next read */
+			fifo.deadline = now;
+			return numEventReceived;
+		}
+	}
+
+	/* flush completes after every event held before it */
+	for(int i = 0; count && mFlushed && i < SENSORS_MAX; i++){
+		if(!(mFlushed & (0x01 << i)))
+			continue;
+		memset(data, 0, sizeof(*data));
+		data->version = META_DATA_VERSION;
+		data->type = SENSOR_TYPE_META_DATA;
+		data->meta_data.sensor = i;
+		data->meta_data.what = META_DATA_FLUSH_COMPLETE;
+		data++;
+		count--;
+		numEventReceived++;
+		mFlushed &= ~(0x01 << i);
+	}
+	return numEventReceived;
+}
+
+void SensorBase::setSuspendBlock(bool block){
+	if(data_fd < 0 || block == mSuspendBlock)
+		return;
+	int enable = block ? 1 : 0;
+	if(ioctl(data_fd, EVIOCSSUSPENDBLOCK, &enable) < 0){
+		ALOGW("input suspend block not supported (%s)", strerror(errno));
+		return;
+	}
+	mSuspendBlock = block;
 }
 
 
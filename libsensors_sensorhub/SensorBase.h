@@ -22,10 +22,27 @@
 #include <errno.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <string.h>
 #include "InputEventReader.h"
 #include "sensors.h"
 
 #define SENSORS_MAX  20
+/* events held by HAL side batching, hub has no fifo for them */
+#define SENSOR_BATCH_EVENTS  128
+
+/* HAL side batch fifo, wake-up sensors have their own one so their
+ * events neither push out nor wait for non-wakeup ones. */
+struct BatchFifo {
+	sensors_event_t* events;
+	int head;
+	int count;
+	int64_t deadline;
+};
+enum {
+	BATCH_NON_WAKEUP = 0,
+	BATCH_WAKEUP,
+	BATCH_FIFOS,
+};
 
 /*****************************************************************************/
 class SensorBase {
@@ -38,6 +55,15 @@ protected:
     int         data_fd;
 	int 		fifo_fd;
 	bool 		mBatchEnabled;
+	int 		mFlushed;
+	/* HAL side batching, samples are held until report latency of
+	 * oldest one expires, the buffer fills or the sensor is flushed. */
+	bool		mHalBatch;
+	int64_t		mReportLatency[SENSORS_MAX];
+	int64_t		mBatchPeriod[SENSORS_MAX];
+	int64_t		mLastTimestamp[SENSORS_MAX];
+	BatchFifo	mBatch[BATCH_FIFOS];
+	bool		mSuspendBlock;
     int openInput(const char* inputName);
     static int64_t getTimestamp();
 
@@ -50,6 +76,17 @@ protected:
     int close_device();
 	int open_fifo_device();
     int close_fifo_device();
+	static int batchFifo(int handle) {
+		return (WAKEUP_SENSORS & (1 << handle)) ? BATCH_WAKEUP : BATCH_NON_WAKEUP;
+	}
+	bool batchFifoDue(BatchFifo const& fifo, int64_t now) const;
+	/* queue event of a batched sensor, false if it must be reported now */
+	bool batchEvent(sensors_event_t const& event);
+	/* held events once due, then flush complete events */
+	int readBatch(sensors_event_t* data, int count);
+	/* keep AP awake from input interrupt until its events are read,
+	 * while wake-up sensors run. */
+	void setSuspendBlock(bool block);
     
 public:
     SensorBase(const char* dev_name,const char* data_name);
@@ -64,6 +101,13 @@ public:
     virtual void processEvent(int code, int value) = 0;
 	virtual int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
 	virtual int flush(int handle);
+	/* batch is due for report or a flush is pending */
+	bool batchDue() const;
+	/* monotonic time held events are due, 0 if none */
+	virtual int64_t getBatchDeadline() const;
+	/* monotonic time held wake-up events are due, 0 if none, AP
+	 * must be awake for it. */
+	int64_t getWakeupDeadline() const;
 };
 
 /*****************************************************************************/
@@ -24,7 +24,11 @@
 #include <math.h>
 #include <poll.h>
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
 
 #include <linux/input.h>
 
@@ -37,6 +41,7 @@
 #include "FSLSensorsHub.h"
 
 #include "LightSensor.h"
+#include "DirectChannel.h"
 
 /*****************************************************************************/
 
@@ -57,6 +62,15 @@
 #define SENSORS_ROTATION_VECTOR_HANDLE  ID_RV
 #define SENSORS_STEP_DETECTOR_HANDLE  	ID_SD
 #define SENSORS_STEP_COUNTER_HANDLE  	ID_SC
+#define SENSORS_STEP_DETECTOR_WAKEUP_HANDLE	ID_SD_W
+#define SENSORS_STEP_COUNTER_WAKEUP_HANDLE	ID_SC_W
+#define SENSORS_SIGNIFICANT_MOTION_HANDLE	ID_SM
+
+/* wake-up events are handed to the framework under a timed wakelock,
+ * it takes its own before the lock expires. */
+#define WAKE_LOCK_PATH     "/sys/power/wake_lock"
+#define WAKE_LOCK_NAME     "SensorsHAL_WAKEUP"
+#define WAKE_LOCK_TIMEOUT  1000000000LL
 
 
 /*****************************************************************************/
@@ -78,7 +92,9 @@ static const struct sensor_t sSensorList[] = {
     .stringType =             SENSOR_STRING_TYPE_ACCELEROMETER,
     .requiredPermission =     0,
     .maxDelay =               640000,
-    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE |
+                  SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                  (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT),
     .reserved =   {}
     },
     {
@@ -96,7 +112,9 @@ static const struct sensor_t sSensorList[] = {
     .stringType =             SENSOR_STRING_TYPE_MAGNETIC_FIELD,
     .requiredPermission =     0,
     .maxDelay =               640000,
-    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE |
+                  SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                  (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT),
     .reserved =   {}
     },
     {
@@ -132,7 +150,9 @@ static const struct sensor_t sSensorList[] = {
     .stringType =             SENSOR_STRING_TYPE_GYROSCOPE,
     .requiredPermission =     0,
     .maxDelay =               640000,
-    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE |
+                  SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                  (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT),
     .reserved =   {}
     },
     {
@@ -150,7 +170,9 @@ static const struct sensor_t sSensorList[] = {
     .stringType =             SENSOR_STRING_TYPE_ROTATION_VECTOR,
     .requiredPermission =     0,
     .maxDelay =               640000,
-    .flags =      SENSOR_FLAG_CONTINUOUS_MODE,
+    .flags =      SENSOR_FLAG_CONTINUOUS_MODE |
+                  SENSOR_FLAG_DIRECT_CHANNEL_ASHMEM |
+                  (SENSOR_DIRECT_RATE_FAST << SENSOR_FLAG_SHIFT_DIRECT_REPORT),
     .reserved =   {}
     },
     {
@@ -190,6 +212,99 @@ static const struct sensor_t sSensorList[] = {
     .reserved =   {}
     },
     {
+    .name =       "Freescale Sensor Hub Step Detector",
+    .vendor =     "Freescale Semiconductor Inc.",
+    .version=     1,
+    .handle =     SENSORS_STEP_DETECTOR_HANDLE,
+    .type =       SENSOR_TYPE_STEP_DETECTOR,
+    .maxRange =   1.0f,
+    .resolution = 1.0f,
+    .power =      0.30f,
+    .minDelay =   0,
+    .fifoReservedEventCount = 0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
+    .stringType =             SENSOR_STRING_TYPE_STEP_DETECTOR,
+    .requiredPermission =     0,
+    .maxDelay =               0,
+    .flags =      SENSOR_FLAG_SPECIAL_REPORTING_MODE,
+    .reserved =   {}
+    },
+    {
+    .name =       "Freescale Sensor Hub Step Counter",
+    .vendor =     "Freescale Semiconductor Inc.",
+    .version=     1,
+    .handle =     SENSORS_STEP_COUNTER_HANDLE,
+    .type =       SENSOR_TYPE_STEP_COUNTER,
+    .maxRange =   4294967295.0f,
+    .resolution = 1.0f,
+    .power =      0.30f,
+    .minDelay =   0,
+    .fifoReservedEventCount = 0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
+    .stringType =             SENSOR_STRING_TYPE_STEP_COUNTER,
+    .requiredPermission =     0,
+    .maxDelay =               0,
+    .flags =      SENSOR_FLAG_ON_CHANGE_MODE,
+    .reserved =   {}
+    },
+    {
+    .name =       "Freescale Sensor Hub Step Detector (wake-up)",
+    .vendor =     "Freescale Semiconductor Inc.",
+    .version=     1,
+    .handle =     SENSORS_STEP_DETECTOR_WAKEUP_HANDLE,
+    .type =       SENSOR_TYPE_STEP_DETECTOR,
+    .maxRange =   1.0f,
+    .resolution = 1.0f,
+    .power =      0.30f,
+    .minDelay =   0,
+    .fifoReservedEventCount = 0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
+    .stringType =             SENSOR_STRING_TYPE_STEP_DETECTOR,
+    .requiredPermission =     0,
+    .maxDelay =               0,
+    .flags =      SENSOR_FLAG_SPECIAL_REPORTING_MODE |
+                  SENSOR_FLAG_WAKE_UP,
+    .reserved =   {}
+    },
+    {
+    .name =       "Freescale Sensor Hub Step Counter (wake-up)",
+    .vendor =     "Freescale Semiconductor Inc.",
+    .version=     1,
+    .handle =     SENSORS_STEP_COUNTER_WAKEUP_HANDLE,
+    .type =       SENSOR_TYPE_STEP_COUNTER,
+    .maxRange =   4294967295.0f,
+    .resolution = 1.0f,
+    .power =      0.30f,
+    .minDelay =   0,
+    .fifoReservedEventCount = 0,
+    .fifoMaxEventCount =      SENSOR_BATCH_EVENTS,
+    .stringType =             SENSOR_STRING_TYPE_STEP_COUNTER,
+    .requiredPermission =     0,
+    .maxDelay =               0,
+    .flags =      SENSOR_FLAG_ON_CHANGE_MODE |
+                  SENSOR_FLAG_WAKE_UP,
+    .reserved =   {}
+    },
+    {
+    .name =       "Freescale Sensor Hub Significant Motion",
+    .vendor =     "Freescale Semiconductor Inc.",
+    .version=     1,
+    .handle =     SENSORS_SIGNIFICANT_MOTION_HANDLE,
+    .type =       SENSOR_TYPE_SIGNIFICANT_MOTION,
+    .maxRange =   1.0f,
+    .resolution = 1.0f,
+    .power =      0.30f,
+    .minDelay =   -1,
+    .fifoReservedEventCount = 0,
+    .fifoMaxEventCount =      0,
+    .stringType =             SENSOR_STRING_TYPE_SIGNIFICANT_MOTION,
+    .requiredPermission =     0,
+    .maxDelay =               0,
+    .flags =      SENSOR_FLAG_ONE_SHOT_MODE |
+                  SENSOR_FLAG_WAKE_UP,
+    .reserved =   {}
+    },
+    {
     .name =       "ISL29023 Light sensor",
     .vendor =     "Intersil",
     .version=     1,
@@ -213,6 +328,17 @@ static const struct sensor_t sSensorList[] = {
 static int open_sensors(const struct hw_module_t* module, const char* id,
                         struct hw_device_t** device);
 
+/* highest SENSOR_DIRECT_RATE_* of sensor, 0 if it has no direct report */
+static int getDirectRateLevel(int handle)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sSensorList); i++) {
+        if (sSensorList[i].handle == handle)
+            return (sSensorList[i].flags & SENSOR_FLAG_MASK_DIRECT_REPORT) >>
+                    SENSOR_FLAG_SHIFT_DIRECT_REPORT;
+    }
+    return 0;
+}
+
 
 static int sensors__get_sensors_list(struct sensors_module_t* module,
                                      struct sensor_t const** list)
@@ -237,6 +363,11 @@ struct sensors_module_t HAL_MODULE_INFO_SYM = {
         },
         get_sensors_list: sensors__get_sensors_list,
 };
+struct BatchParameter{
+		int flags;
+		int64_t period_ns;
+		int64_t timeout;
+};
 struct sensors_poll_context_t {
     struct sensors_poll_device_1 device; // must be first
 
@@ -248,6 +379,9 @@ struct sensors_poll_context_t {
     int pollEvents(sensors_event_t* data, int count);
 	int batch(int handle, int flags, int64_t period_ns, int64_t timeout);
 	int flush(int handle);
+	int registerDirectChannel(const struct sensors_direct_mem_t* mem, int channel_handle);
+	int configDirectReport(int sensor_handle, int channel_handle,
+			const struct sensors_direct_cfg_t* config);
 	int magRunTimes;
 private:
     enum {
@@ -256,14 +390,37 @@ private:
         temperature,
         light,
         numSensorDrivers,
+        alarm = numSensorDrivers,
+        wake,
         numFds,
     };
-    static const size_t wake = numFds - 1;
     static const char WAKE_MESSAGE = 'W';
     struct pollfd mPollFds[numFds];
     int mWritePipeFd;
+    int mWakeLockFd;
+    // wake-up events held in a batch wake AP from suspend when due.
+    int64_t mAlarmDeadline;
     SensorBase* mSensors[numSensorDrivers];
 
+    // direct report. a sensor runs while the framework or any channel
+    // uses it, events of sensors the framework has not activated are
+    // kept out of poll. mDirectLock guards channels and masks.
+    pthread_mutex_t mDirectLock;
+    DirectChannel* mDirectChannels[DIRECT_CHANNEL_MAX];
+    uint32_t mActiveSensors;
+    uint32_t mDirectSensors;
+    int64_t mDirectPeriod[SENSORS_MAX];
+    // last framework batch parameters, restored when direct stops.
+    struct BatchParameter mBatchParameter[SENSORS_MAX];
+    int enableDriver(int handle, int enabled);
+    int batchDriver(int handle, int flags, int64_t period_ns, int64_t timeout);
+    void updateDirectReport(int handle);
+    void stopDirectChannel(DirectChannel* channel);
+    int reportDirect(sensors_event_t* data, int count);
+    void wakePoll();
+    void holdWakeLock(sensors_event_t const* data, int count);
+    void setWakeupAlarm(int64_t deadline);
+
     int handleToDriver(int handle) const {
         switch (handle) {
             case ID_P:
@@ -285,6 +442,9 @@ private:
 			case ID_RV:
 			case ID_SD:
 			case ID_SC:
+			case ID_SD_W:
+			case ID_SC_W:
+			case ID_SM:
 			  return fsl_sens;
         }
         return -EINVAL;
@@ -311,6 +471,12 @@ sensors_poll_context_t::sensors_poll_context_t()
 
 	fillPollFd();
 	magRunTimes = 0;
+    pthread_mutex_init(&mDirectLock, NULL);
+    memset(mDirectChannels, 0, sizeof(mDirectChannels));
+    mActiveSensors = 0;
+    mDirectSensors = 0;
+    memset(mDirectPeriod, 0, sizeof(mDirectPeriod));
+    memset(mBatchParameter, 0, sizeof(mBatchParameter));
     int wakeFds[2];
     int result = pipe(wakeFds);
     ALOGE_IF(result<0, "error creating wake pipe (%s)", strerror(errno));
@@ -321,39 +487,132 @@ sensors_poll_context_t::sensors_poll_context_t()
     mPollFds[wake].fd = wakeFds[0];
     mPollFds[wake].events = POLLIN;
     mPollFds[wake].revents = 0;
+
+    mWakeLockFd = open(WAKE_LOCK_PATH, O_WRONLY | O_CLOEXEC);
+    ALOGE_IF(mWakeLockFd<0, "error opening %s (%s)", WAKE_LOCK_PATH, strerror(errno));
+
+    mAlarmDeadline = 0;
+    mPollFds[alarm].fd = timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_NONBLOCK | TFD_CLOEXEC);
+    ALOGW_IF(mPollFds[alarm].fd<0, "no wake-up alarm, held wake-up events keep wakelock (%s)",
+             strerror(errno));
+    mPollFds[alarm].events = POLLIN;
+    mPollFds[alarm].revents = 0;
 }
 
 sensors_poll_context_t::~sensors_poll_context_t() {
     for (int i=0 ; i<numSensorDrivers ; i++) {
         delete mSensors[i];
     }
+    for (int i=0 ; i<DIRECT_CHANNEL_MAX ; i++) {
+        delete mDirectChannels[i];
+    }
+    pthread_mutex_destroy(&mDirectLock);
     close(mPollFds[wake].fd);
     close(mWritePipeFd);
+    if (mPollFds[alarm].fd >= 0)
+        close(mPollFds[alarm].fd);
+    if (mWakeLockFd >= 0)
+        close(mWakeLockFd);
+}
+
+void sensors_poll_context_t::wakePoll() {
+    const char wakeMessage(WAKE_MESSAGE);
+    int result = write(mWritePipeFd, &wakeMessage, 1);
+    ALOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
+}
+
+/* wake-up events stay awake until the framework has them, a timed lock
+ * needs no release when it is done. */
+void sensors_poll_context_t::holdWakeLock(sensors_event_t const* data, int count) {
+    if (mWakeLockFd < 0)
+        return;
+    for (int i=0 ; i<count ; i++) {
+        int handle = data[i].type == SENSOR_TYPE_META_DATA ?
+                     data[i].meta_data.sensor : data[i].sensor;
+        if (handle >= 0 && handle < SENSORS_MAX && (WAKEUP_SENSORS & (1 << handle))) {
+            char buf[64];
+            int len = snprintf(buf, sizeof(buf), "%s %lld", WAKE_LOCK_NAME,
+                               (long long)WAKE_LOCK_TIMEOUT);
+            int result = write(mWakeLockFd, buf, len);
+            ALOGE_IF(result<0, "error taking wakelock (%s)", strerror(errno));
+            return;
+        }
+    }
+}
+
+/* wake-up events held in a batch are due even if AP suspends meanwhile,
+ * alarm wakes it at deadline, without alarm a wakelock runs until then. */
+void sensors_poll_context_t::setWakeupAlarm(int64_t deadline) {
+    if (deadline == mAlarmDeadline)
+        return;
+    mAlarmDeadline = deadline;
+    if (mPollFds[alarm].fd >= 0) {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_sec = deadline / 1000000000LL;
+        spec.it_value.tv_nsec = deadline % 1000000000LL;
+        int result = timerfd_settime(mPollFds[alarm].fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        ALOGE_IF(result<0, "error setting wake-up alarm (%s)", strerror(errno));
+        return;
+    }
+    if (mWakeLockFd < 0 || !deadline)
+        return;
+    struct timespec t;
+    clock_gettime(CLOCK_BOOTTIME, &t);
+    int64_t wait = deadline - (int64_t(t.tv_sec)*1000000000LL + t.tv_nsec);
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "%s %lld", WAKE_LOCK_NAME,
+                       (long long)(wait > 0 ? wait + WAKE_LOCK_TIMEOUT : WAKE_LOCK_TIMEOUT));
+    int result = write(mWakeLockFd, buf, len);
+    ALOGE_IF(result<0, "error taking wakelock (%s)", strerror(errno));
 }
 
 int sensors_poll_context_t::activate(int handle, int enabled) {
     int index = handleToDriver(handle);
     if (index < 0) return index;
+    int err = 0;
+    pthread_mutex_lock(&mDirectLock);
+    bool active = mActiveSensors & (1 << handle);
+    // direct report keeps driver running without framework
+    if ((enabled ? 1 : 0) != active && !(mDirectSensors & (1 << handle)))
+        err = enableDriver(handle, enabled);
+    if (!err) {
+        if (enabled)
+            mActiveSensors |= 1 << handle;
+        else
+            mActiveSensors &= ~(1 << handle);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return err;
+}
+
+int sensors_poll_context_t::enableDriver(int handle, int enabled) {
+    int index = handleToDriver(handle);
     int err = 0 ;
 	err =  mSensors[index]->setEnable(handle, enabled);
-    if (enabled && !err) {
-        const char wakeMessage(WAKE_MESSAGE);
-        int result = write(mWritePipeFd, &wakeMessage, 1);
-        ALOGE_IF(result<0, "error sending wake message (%s)", strerror(errno));
-    }
+    if (enabled && !err)
+        wakePoll();
     return err;
 }
 
 int sensors_poll_context_t::setDelay(int handle, int64_t ns) {
     int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->setDelay(handle, ns);
+    pthread_mutex_lock(&mDirectLock);
+    mBatchParameter[handle].period_ns = ns;
+    if (mDirectPeriod[handle] && mDirectPeriod[handle] < ns)
+        ns = mDirectPeriod[handle];
+    int err = mSensors[index]->setDelay(handle, ns);
+    pthread_mutex_unlock(&mDirectLock);
+    return err;
 }
 
 int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 {
+    sensors_event_t* const first = data;
     int nbEvents = 0;
     int n = 0;
+    bool batchWait;
     do {
         // see if we have some leftover from the last poll()
         for (int i=0 ; count && i<numSensorDrivers ; i++) {
@@ -365,20 +624,52 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
                     // no more data for this sensor
                     mPollFds[i].revents = 0;
                 }
+                if (nb > 0 && mDirectSensors)
+                    nb = reportDirect(data, nb);
+                for (int j=0 ; j<nb ; j++) {
+                    if (data[j].type == SENSOR_TYPE_SIGNIFICANT_MOTION) {
+                        /* one-shot, next activate enables it again */
+                        pthread_mutex_lock(&mDirectLock);
+                        mActiveSensors &= ~(1 << ID_SM);
+                        pthread_mutex_unlock(&mDirectLock);
+                    }
+                }
                 count -= nb;
                 nbEvents += nb;
                 data += nb;
             }
         }
 
+        batchWait = false;
         if (count) {
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
-            // anything to return
-            //n = poll(mPollFds, numFds, nbEvents ? 0 : -1);
+            // anything to return, held batches bound the wait.
+            int timeout = -1;
+            if (nbEvents) {
+                timeout = 0;
+            } else {
+                int64_t deadline = 0;
+                int64_t wakeup = 0;
+                for (int i=0 ; i<numSensorDrivers ; i++) {
+                    int64_t d = mSensors[i]->getBatchDeadline();
+                    if (d && (!deadline || d < deadline))
+                        deadline = d;
+                    d = mSensors[i]->getWakeupDeadline();
+                    if (d && (!wakeup || d < wakeup))
+                        wakeup = d;
+                }
+                setWakeupAlarm(wakeup);
+                if (deadline) {
+                    struct timespec t;
+                    clock_gettime(CLOCK_BOOTTIME, &t);
+                    int64_t wait = deadline - (int64_t(t.tv_sec)*1000000000LL + t.tv_nsec);
+                    timeout = wait > 0 ? (wait + 999999) / 1000000 : 0;
+                    batchWait = true;
+                }
+            }
 			do {
-				//fillPollFd(); /*reset poll fd , if sensor change between batch mode and continuous mode*/
-			 	n = poll(mPollFds, numFds, nbEvents ? 0 : -1);            
+			 	n = poll(mPollFds, numFds, timeout);
 			} while (n < 0 && errno == EINTR);
             if (n<0) {
                 ALOGE("poll() failed (%s)", strerror(errno));
@@ -391,26 +682,190 @@ int sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
                 ALOGE_IF(msg != WAKE_MESSAGE, "unknown message on wake queue (0x%02x)", int(msg));
                 mPollFds[wake].revents = 0;
             }
+            if (mPollFds[alarm].revents & POLLIN) {
+                uint64_t expirations;
+                int result = read(mPollFds[alarm].fd, &expirations, sizeof(expirations));
+                ALOGE_IF(result<0, "error reading wake-up alarm (%s)", strerror(errno));
+                mPollFds[alarm].revents = 0;
+            }
         }
-        // if we have events and space, go read them
-    } while (n && count);
+        // if we have events and space, go read them, or the batch
+        // which timed out the wait
+    } while ((n || batchWait) && count);
 
+    holdWakeLock(first, nbEvents);
     return nbEvents;
 }
 int sensors_poll_context_t::batch(int handle, int flags, int64_t period_ns, int64_t timeout){
 	 int ret;
 	 int index = handleToDriver(handle);
      if (index < 0) return index;
+     if (flags & SENSORS_BATCH_DRY_RUN)
+         return mSensors[index]->batch(handle,flags,period_ns,timeout);
+
+     pthread_mutex_lock(&mDirectLock);
+     mBatchParameter[handle].flags = flags;
+     mBatchParameter[handle].period_ns = period_ns;
+     mBatchParameter[handle].timeout = timeout;
+     if (mDirectPeriod[handle]) {
+         /* direct channel needs every sample as it comes */
+         if (mDirectPeriod[handle] < period_ns)
+             period_ns = mDirectPeriod[handle];
+         timeout = 0;
+     }
+     ret = batchDriver(handle, flags, period_ns, timeout);
+     pthread_mutex_unlock(&mDirectLock);
+	 return ret;
+}
+
+int sensors_poll_context_t::batchDriver(int handle, int flags, int64_t period_ns, int64_t timeout){
+	 int ret;
+	 int index = handleToDriver(handle);
 	 ret = mSensors[index]->batch(handle,flags,period_ns,timeout);
-	 const char wakeMessage(WAKE_MESSAGE); 
-     int result = write(mWritePipeFd, &wakeMessage, 1);
-     ALOGE_IF(result<0, "error batch sending wake message (%s)", strerror(errno));
+	 wakePoll();
 	 return ret;
 }
 int sensors_poll_context_t::flush(int handle){
 	int index = handleToDriver(handle);
     if (index < 0) return index;
-    return mSensors[index]->flush(handle);
+    /* one-shot sensors have nothing to flush */
+    if (handle == ID_SM)
+        return -EINVAL;
+    int err = mSensors[index]->flush(handle);
+    // complete event is sent by poll thread, may be blocked
+    if (!err)
+        wakePoll();
+    return err;
+}
+
+/* called with mDirectLock held */
+void sensors_poll_context_t::updateDirectReport(int handle) {
+    int64_t period = 0;
+    for (int i=0 ; i<DIRECT_CHANNEL_MAX ; i++) {
+        int64_t p = mDirectChannels[i] ? mDirectChannels[i]->getPeriod(handle) : 0;
+        if (p && (!period || p < period))
+            period = p;
+    }
+    if (period == mDirectPeriod[handle])
+        return;
+
+    bool active = mActiveSensors & (1 << handle);
+    struct BatchParameter& param = mBatchParameter[handle];
+    if (period) {
+        int64_t ns = period;
+        if (active && param.period_ns && param.period_ns < ns)
+            ns = param.period_ns;
+        if (!mDirectPeriod[handle] && !active)
+            enableDriver(handle, 1);
+        mDirectSensors |= 1 << handle;
+        batchDriver(handle, 0, ns, 0);
+    } else {
+        mDirectSensors &= ~(1 << handle);
+        if (!active)
+            enableDriver(handle, 0);
+        else if (param.period_ns)
+            batchDriver(handle, param.flags, param.period_ns, param.timeout);
+    }
+    mDirectPeriod[handle] = period;
+}
+
+/* called with mDirectLock held */
+void sensors_poll_context_t::stopDirectChannel(DirectChannel* channel) {
+    for (int handle=0 ; handle<SENSORS_MAX ; handle++) {
+        if (channel->getPeriod(handle)) {
+            channel->config(handle, SENSOR_DIRECT_RATE_STOP);
+            updateDirectReport(handle);
+        }
+    }
+}
+
+int sensors_poll_context_t::registerDirectChannel(const struct sensors_direct_mem_t* mem,
+        int channel_handle) {
+    int ret = -ENOMEM;
+    if (mem == NULL) {
+        int i = channel_handle - 1;
+        if (i < 0 || i >= DIRECT_CHANNEL_MAX)
+            return -EINVAL;
+        pthread_mutex_lock(&mDirectLock);
+        if (mDirectChannels[i] != NULL) {
+            stopDirectChannel(mDirectChannels[i]);
+            delete mDirectChannels[i];
+            mDirectChannels[i] = NULL;
+        }
+        pthread_mutex_unlock(&mDirectLock);
+        return 0;
+    }
+
+    DirectChannel* channel = new DirectChannel(mem);
+    if (!channel->isValid()) {
+        delete channel;
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&mDirectLock);
+    for (int i=0 ; i<DIRECT_CHANNEL_MAX ; i++) {
+        if (mDirectChannels[i] == NULL) {
+            mDirectChannels[i] = channel;
+            ret = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    if (ret < 0)
+        delete channel;
+    return ret;
+}
+
+int sensors_poll_context_t::configDirectReport(int sensor_handle, int channel_handle,
+        const struct sensors_direct_cfg_t* config) {
+    int rate = config->rate_level;
+    int i = channel_handle - 1;
+    int ret;
+    if (i < 0 || i >= DIRECT_CHANNEL_MAX)
+        return -EINVAL;
+    if (sensor_handle == -1) {
+        if (rate != SENSOR_DIRECT_RATE_STOP)
+            return -EINVAL;
+    } else if (sensor_handle < 0 || sensor_handle >= SENSORS_MAX ||
+            rate > getDirectRateLevel(sensor_handle)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&mDirectLock);
+    DirectChannel* channel = mDirectChannels[i];
+    if (channel == NULL) {
+        ret = -EINVAL;
+    } else if (sensor_handle == -1) {
+        stopDirectChannel(channel);
+        ret = 0;
+    } else {
+        ret = channel->config(sensor_handle, rate);
+        updateDirectReport(sensor_handle);
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return ret;
+}
+
+/* write events to direct channels, returns number left for poll */
+int sensors_poll_context_t::reportDirect(sensors_event_t* data, int count) {
+    int kept = 0;
+    pthread_mutex_lock(&mDirectLock);
+    for (int i=0 ; i<count ; i++) {
+        int handle = data[i].sensor;
+        if (data[i].type != SENSOR_TYPE_META_DATA && handle >= 0 &&
+                handle < SENSORS_MAX && (mDirectSensors & (1 << handle))) {
+            for (int j=0 ; j<DIRECT_CHANNEL_MAX ; j++) {
+                if (mDirectChannels[j] != NULL)
+                    mDirectChannels[j]->report(data[i]);
+            }
+            if (!(mActiveSensors & (1 << handle)))
+                continue;
+        }
+        if (kept != i)
+            data[kept] = data[i];
+        kept++;
+    }
+    pthread_mutex_unlock(&mDirectLock);
+    return kept;
 }
 
 /*****************************************************************************/
@@ -451,6 +906,18 @@ static int poll__flush(struct sensors_poll_device_1* dev, int handle){
 	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
 	return ctx->flush(handle);
 }
+
+static int poll__register_direct_channel(struct sensors_poll_device_1* dev,
+            const struct sensors_direct_mem_t* mem, int channel_handle){
+	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+	return ctx->registerDirectChannel(mem, channel_handle);
+}
+
+static int poll__config_direct_report(struct sensors_poll_device_1* dev,
+            int sensor_handle, int channel_handle, const struct sensors_direct_cfg_t* config){
+	sensors_poll_context_t *ctx = (sensors_poll_context_t *)dev;
+	return ctx->configDirectReport(sensor_handle, channel_handle, config);
+}
 /*****************************************************************************/
 
 /** Open a new instance of a sensor device using name */
@@ -471,6 +938,8 @@ static int open_sensors(const struct hw_module_t* module, const char* id,
         dev->device.poll            = poll__poll;
 		dev->device.batch			= poll__batch;
 		dev->device.flush			= poll__flush;
+		dev->device.register_direct_channel	= poll__register_direct_channel;
+		dev->device.config_direct_report	= poll__config_direct_report;
         *device = &dev->device.common;
         status = 0;
 
@@ -48,6 +48,12 @@ __BEGIN_DECLS
 #define ID_RV (11)
 #define ID_SD (12)		/*step detect*/
 #define ID_SC (13)	    /*step count*/
+/* wake-up variants, their events keep AP awake until read */
+#define ID_SD_W (14)
+#define ID_SC_W (15)
+#define ID_SM   (16)	    /*significant motion, from step detect*/
+
+#define WAKEUP_SENSORS ((1 << ID_SD_W) | (1 << ID_SC_W) | (1 << ID_SM))
 
 
 #define HWROTATION_0   (0)
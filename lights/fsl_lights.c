@@ -20,7 +20,11 @@
 #include <hardware/lights.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <cutils/log.h>
 #include <cutils/atomic.h>
 #include <cutils/properties.h>
@@ -29,6 +33,8 @@
 #define MAX_BRIGHTNESS 255
 #define DEF_BACKLIGHT_DEV "pwm-backlight"
 #define DEF_BACKLIGHT_PATH "/sys/class/backlight/"
+/* default ramp of a brightness change, 0 writes it at once */
+#define BACKLIGHT_RAMP_PROP "hw.backlight.ramp_ms"
 
 /*****************************************************************************/
 struct lights_module_t {
@@ -55,31 +61,137 @@ struct lights_module_t HAL_MODULE_INFO_SYM = {
 };
 
 static char max_path[256], path[256];
+
+/*
+ * backlight device keeps brightness node open and max_brightness read
+ * at open, a slider animation is one write per changed value.
+ *
+ * with a ramp, ramp thread moves brightness linearly from ramp_from to
+ * target between ramp_start and ramp_end. it sleeps until the time the
+ * next level is due, so a ramp costs one wakeup per level written, and
+ * a new request during a ramp just replans from the current level.
+ */
+struct backlight_device_t {
+    struct light_device_t dev; /* must be first */
+    pthread_mutex_t lock;
+    int fd;
+    unsigned int max_brightness;
+    /* last value written, -1 before first one */
+    int brightness;
+
+    pthread_t ramp_thread;
+    pthread_cond_t ramp_cond;
+    int ramp_ms;
+    int ramp_running;
+    int ramp_exit;
+    int ramp_from;
+    int target;
+    int64_t ramp_start;
+    int64_t ramp_end;
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* called with lock held */
+static int write_brightness(struct backlight_device_t *backlight, int brightness)
+{
+    char value[16];
+    int len;
+
+    if (brightness == backlight->brightness)
+        return 0;
+    len = snprintf(value, sizeof(value), "%d", brightness);
+    if (pwrite(backlight->fd, value, len, 0) != len) {
+        ALOGE("can not write file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    backlight->brightness = brightness;
+    return 0;
+}
+
+static void *ramp_loop(void *arg)
+{
+    struct backlight_device_t *backlight = arg;
+    struct timespec ts;
+
+    pthread_mutex_lock(&backlight->lock);
+    while (!backlight->ramp_exit) {
+        int64_t now, duration, wake;
+        int delta, level, next;
+
+        if (backlight->brightness == backlight->target) {
+            pthread_cond_wait(&backlight->ramp_cond, &backlight->lock);
+            continue;
+        }
+
+        now = now_ns();
+        duration = backlight->ramp_end - backlight->ramp_start;
+        delta = backlight->target - backlight->ramp_from;
+        if (now >= backlight->ramp_end || duration <= 0 || delta == 0) {
+            write_brightness(backlight, backlight->target);
+            continue;
+        }
+        level = backlight->ramp_from +
+                (int)(delta * (now - backlight->ramp_start) / duration);
+        if (write_brightness(backlight, level) < 0) {
+            /* give up the ramp, next request starts another */
+            backlight->target = backlight->brightness;
+            continue;
+        }
+
+        /* time the level after this one is due */
+        next = level + (delta > 0 ? 1 : -1);
+        wake = backlight->ramp_start +
+               duration * (next - backlight->ramp_from) / delta;
+        ts.tv_sec = wake / 1000000000LL;
+        ts.tv_nsec = wake % 1000000000LL;
+        pthread_cond_timedwait(&backlight->ramp_cond, &backlight->lock, &ts);
+    }
+    pthread_mutex_unlock(&backlight->lock);
+    return NULL;
+}
+
+static void ramp_init(struct backlight_device_t *backlight)
+{
+    char value[PROPERTY_VALUE_MAX];
+    pthread_condattr_t attr;
+
+    property_get(BACKLIGHT_RAMP_PROP, value, "0");
+    backlight->ramp_ms = atoi(value);
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&backlight->ramp_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    backlight->target = -1;
+    if (pthread_create(&backlight->ramp_thread, NULL, ramp_loop, backlight) == 0)
+        backlight->ramp_running = 1;
+    else
+        ALOGE("cannot start backlight ramp thread\n");
+}
 // ****************************************************************************
 // module
 // ****************************************************************************
 static int set_light_backlight(struct light_device_t* dev,
                                struct light_state_t const* state)
 {
-    int result = -1;
+    struct backlight_device_t *backlight = (struct backlight_device_t *)dev;
+    int result = 0;
     unsigned int color = state->color;
-    unsigned int brightness = 0, max_brightness = 0;
-    unsigned int i = 0;
-    FILE *file;
+    unsigned int brightness = 0, max_brightness = backlight->max_brightness;
+    int ramp_ms;
 
     brightness = ((77*((color>>16)&0x00ff)) + (150*((color>>8)&0x00ff)) +
                  (29*(color&0x00ff))) >> 8;
     ALOGV("set_light, get brightness=%d", brightness);
 
-    file = fopen(max_path, "r");
-    if (!file) {
-        ALOGE("can not open file %s\n", max_path);
-        return result;
-    }
-    fread(&max_brightness, 1, 3, file);
-    fclose(file);
-
-    max_brightness = atoi((char *) &max_brightness);
     /* any brightness greater than 0, should have at least backlight on */
     if (max_brightness < MAX_BRIGHTNESS)
         brightness = max_brightness *(brightness + MAX_BRIGHTNESS / max_brightness - 1) / MAX_BRIGHTNESS;
@@ -95,23 +207,42 @@ static int set_light_backlight(struct light_device_t* dev,
     ALOGV("set_light, max_brightness=%d, target brightness=%d",
         max_brightness, brightness);
 
-    file = fopen(path, "w");
-    if (!file) {
-        ALOGE("can not open file %s\n", path);
-        return result;
+    /* timed flash on backlight asks a ramp over flashOnMS */
+    ramp_ms = state->flashMode == LIGHT_FLASH_TIMED ? state->flashOnMS
+                                                     : backlight->ramp_ms;
+
+    pthread_mutex_lock(&backlight->lock);
+    if (ramp_ms <= 0 || !backlight->ramp_running || backlight->brightness < 0) {
+        backlight->target = brightness;
+        result = write_brightness(backlight, brightness);
+    } else if ((int)brightness != backlight->target) {
+        backlight->ramp_from = backlight->brightness;
+        backlight->target = brightness;
+        backlight->ramp_start = now_ns();
+        backlight->ramp_end = backlight->ramp_start + (int64_t)ramp_ms * 1000000LL;
+        pthread_cond_signal(&backlight->ramp_cond);
     }
-    fprintf(file, "%d", brightness);
-    fclose(file);
+    pthread_mutex_unlock(&backlight->lock);
 
-    result = 0;
     return result;
 }
 
 static int light_close_backlight(struct hw_device_t *dev)
 {
-    struct light_device_t *device = (struct light_device_t*)dev;
-    if (device)
+    struct backlight_device_t *device = (struct backlight_device_t*)dev;
+    if (device) {
+        if (device->ramp_running) {
+            pthread_mutex_lock(&device->lock);
+            device->ramp_exit = 1;
+            pthread_cond_signal(&device->ramp_cond);
+            pthread_mutex_unlock(&device->lock);
+            pthread_join(device->ramp_thread, NULL);
+        }
+        pthread_cond_destroy(&device->ramp_cond);
+        close(device->fd);
+        pthread_mutex_destroy(&device->lock);
         free(device);
+    }
     return 0;
 }
 
@@ -122,24 +253,18 @@ static int lights_device_open(const struct hw_module_t* module,
     int status = -EINVAL;
     ALOGV("lights_device_open\n");
     if (!strcmp(name, LIGHT_ID_BACKLIGHT)) {
+        struct backlight_device_t *backlight;
         struct light_device_t *dev;
         char value[PROPERTY_VALUE_MAX];
         FILE *file;
 
-        dev = malloc(sizeof(*dev));
+        backlight = malloc(sizeof(*backlight));
+        if (!backlight)
+            return -ENOMEM;
 
         /* initialize our state here */
-        memset(dev, 0, sizeof(*dev));
-
-        /* initialize the procs */
-        dev->common.tag = HARDWARE_DEVICE_TAG;
-        dev->common.version = 0;
-        dev->common.module = (struct hw_module_t*) module;
-        dev->common.close = light_close_backlight;
-
-        dev->set_light = set_light_backlight;
-
-        *device = &dev->common;
+        memset(backlight, 0, sizeof(*backlight));
+        dev = &backlight->dev;
 
         property_get("hw.backlight.dev", value, DEF_BACKLIGHT_DEV);
         strcpy(path, DEF_BACKLIGHT_PATH);
@@ -150,13 +275,41 @@ static int lights_device_open(const struct hw_module_t* module,
 
         file = fopen(max_path, "r");
         if (!file) {
-            free(dev);
+            free(backlight);
             ALOGE("cannot open backlight file %s\n", max_path);
             return status;
         }
+        if (fscanf(file, "%u", &backlight->max_brightness) != 1 ||
+            backlight->max_brightness == 0) {
+            fclose(file);
+            free(backlight);
+            ALOGE("cannot read backlight file %s\n", max_path);
+            return status;
+        }
         fclose(file);
 
-        ALOGI("max backlight file is %s\n", max_path);
+        backlight->fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (backlight->fd < 0) {
+            free(backlight);
+            ALOGE("cannot open backlight file %s\n", path);
+            return status;
+        }
+        backlight->brightness = -1;
+        pthread_mutex_init(&backlight->lock, NULL);
+        ramp_init(backlight);
+
+        /* initialize the procs */
+        dev->common.tag = HARDWARE_DEVICE_TAG;
+        dev->common.version = 0;
+        dev->common.module = (struct hw_module_t*) module;
+        dev->common.close = light_close_backlight;
+
+        dev->set_light = set_light_backlight;
+
+        *device = &dev->common;
+
+        ALOGI("max backlight file is %s, max brightness %u\n", max_path,
+              backlight->max_brightness);
         ALOGI("backlight brightness file is %s\n", path);
 
         status = 0;
@@ -14,12 +14,72 @@
  * limitations under the License.
  */
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <hardware/memtrack.h>
 
 //#define LOG_NDEBUG 0
 #include <utils/Log.h>
 
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* per client totals, one file per heap */
+#define ION_HEAPS_PATH "/sys/kernel/debug/ion/heaps"
+/* galcore video memory of the process whose pid was written to it */
+#define GC_VIDMEM_PATH "/sys/kernel/debug/gc/vidmem"
+
+/*
+ * GPU memory is reserved or contiguous memory galcore maps itself, ION
+ * buffers are mapped as pfn ranges, neither shows up in smaps.
+ */
+static const struct memtrack_record gl_record_templates[] = {
+    {
+        .flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                 MEMTRACK_FLAG_PRIVATE |
+                 MEMTRACK_FLAG_NONSECURE,
+    },
+};
+
+static const struct memtrack_record graphics_record_templates[] = {
+    {
+        .flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+                 MEMTRACK_FLAG_SHARED |
+                 MEMTRACK_FLAG_NONSECURE,
+    },
+};
+
+/*
+ * meminfo asks for every pid in a row. ION tables of all clients are
+ * read once per window into a snapshot, galcore can only be asked per
+ * pid so its answers are kept for the window. snapshot_lock guards
+ * both, and keeps vidmem write and read paired.
+ */
+#define SNAPSHOT_WINDOW_NS 1000000000LL
+
+struct pid_usage {
+    pid_t pid;
+    size_t bytes;
+};
+
+struct usage_table {
+    struct pid_usage *entries;
+    size_t count;
+    size_t capacity;
+    int64_t time;
+};
+
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct usage_table ion_table;
+static struct usage_table gc_table;
+
 int memtrack_init(const struct memtrack_module *module)
 {
     if(!module)
@@ -27,6 +87,176 @@ int memtrack_init(const struct memtrack_module *module)
     return 0;
 }
 
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct pid_usage *usage_find(struct usage_table *table, pid_t pid)
+{
+    size_t i;
+
+    for (i = 0; i < table->count; i++) {
+        if (table->entries[i].pid == pid)
+            return &table->entries[i];
+    }
+    return NULL;
+}
+
+static void usage_add(struct usage_table *table, pid_t pid, size_t bytes)
+{
+    struct pid_usage *usage = usage_find(table, pid);
+
+    if (usage != NULL) {
+        usage->bytes += bytes;
+        return;
+    }
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 64;
+        struct pid_usage *entries =
+                realloc(table->entries, capacity * sizeof(*entries));
+        if (entries == NULL)
+            return;
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+    table->entries[table->count].pid = pid;
+    table->entries[table->count].bytes = bytes;
+    table->count++;
+}
+
+/* starts a new window once the old one is over, true if it did */
+static int usage_expire(struct usage_table *table, int64_t now)
+{
+    if (table->time && now - table->time < SNAPSHOT_WINDOW_NS)
+        return 0;
+    table->count = 0;
+    table->time = now;
+    return 1;
+}
+
+/* bytes of ION buffers of every client, summed over heaps */
+static void ion_snapshot(struct usage_table *table)
+{
+    char path[PATH_MAX];
+    char line[256];
+    struct dirent *ep;
+    DIR *dp;
+
+    dp = opendir(ION_HEAPS_PATH);
+    if (dp == NULL)
+        return;
+
+    while ((ep = readdir(dp)) != NULL) {
+        FILE *fp;
+
+        if (ep->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", ION_HEAPS_PATH, ep->d_name);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        /* "<client> <pid> <size>" rows, headers and orphan summary don't parse */
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            char client[64];
+            int client_pid;
+            size_t size;
+
+            if (sscanf(line, "%63s %d %zu", client, &client_pid, &size) == 3)
+                usage_add(table, client_pid, size);
+        }
+        fclose(fp);
+    }
+    closedir(dp);
+}
+
+/* current bytes of "All-Types" counter in galcore usage of pid */
+static size_t gc_read(pid_t pid)
+{
+    char buf[32];
+    char line[256];
+    size_t total = 0;
+    FILE *fp;
+    int fd;
+
+    fd = open(GC_VIDMEM_PATH, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    snprintf(buf, sizeof(buf), "%d", pid);
+    if (write(fd, buf, strlen(buf)) < 0) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    fp = fopen(GC_VIDMEM_PATH, "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            unsigned long long current;
+
+            if (sscanf(line, " All-Types %llu", &current) == 1) {
+                total = current;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    return total;
+}
+
+static size_t ion_get_memory(pid_t pid)
+{
+    struct pid_usage *usage;
+    size_t bytes;
+
+    pthread_mutex_lock(&snapshot_lock);
+    if (usage_expire(&ion_table, now_ns()))
+        ion_snapshot(&ion_table);
+    usage = usage_find(&ion_table, pid);
+    bytes = usage ? usage->bytes : 0;
+    pthread_mutex_unlock(&snapshot_lock);
+    return bytes;
+}
+
+static size_t gc_get_memory(pid_t pid)
+{
+    struct pid_usage *usage;
+    size_t bytes;
+
+    pthread_mutex_lock(&snapshot_lock);
+    usage_expire(&gc_table, now_ns());
+    usage = usage_find(&gc_table, pid);
+    if (usage != NULL) {
+        bytes = usage->bytes;
+    } else {
+        bytes = gc_read(pid);
+        usage_add(&gc_table, pid, bytes);
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    return bytes;
+}
+
+/*
+ * fills up to *num_records records, *num_records is set to the number
+ * the type has so that caller can size its array.
+ */
+static int fill_records(const struct memtrack_record *templates, size_t count,
+                        size_t size, struct memtrack_record *records,
+                        size_t *num_records)
+{
+    size_t allocated = *num_records < count ? *num_records : count;
+
+    *num_records = count;
+    if (allocated == 0)
+        return 0;
+    memcpy(records, templates, allocated * sizeof(*records));
+    records[0].size_in_bytes = size;
+    return 0;
+}
+
 int memtrack_get_memory(const struct memtrack_module *module,
                               pid_t pid,
                               int type,
@@ -36,8 +266,23 @@ int memtrack_get_memory(const struct memtrack_module *module,
     if(!module)
         return -1;
 
-    ALOGV("memtrack_get_memory: pid(%d), type(%d) records (%x), &num_records(%x)",
-          pid, type, (unsigned int)records, (unsigned int)num_records);
+    ALOGV("memtrack_get_memory: pid(%d), type(%d) records (%p), &num_records(%p)",
+          pid, type, records, num_records);
+
+    switch (type) {
+    case MEMTRACK_TYPE_GL:
+        /* size read only when caller has room, first call sizes array */
+        return fill_records(gl_record_templates, ARRAY_SIZE(gl_record_templates),
+                            *num_records ? gc_get_memory(pid) : 0,
+                            records, num_records);
+    case MEMTRACK_TYPE_GRAPHICS:
+        return fill_records(graphics_record_templates,
+                            ARRAY_SIZE(graphics_record_templates),
+                            *num_records ? ion_get_memory(pid) : 0,
+                            records, num_records);
+    default:
+        break;
+    }
 
     return -EINVAL;
 }
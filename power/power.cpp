@@ -15,8 +15,16 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -27,9 +35,22 @@
 #include <hardware/power.h>
 #include <utils/StrongPointer.h>
 #include <cutils/properties.h>
+#include <power_workload_ext.h>
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
 
 #define GOVERNOR_PATH "/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor"
 #define BOOSTPULSE_PATH "/sys/devices/system/cpu/cpufreq/interactive/boostpulse"
+#define BOOST_PATH "/sys/devices/system/cpu/cpufreq/interactive/boost"
+#define CPUFREQ_PATH "/sys/devices/system/cpu/cpufreq"
+#define DEVFREQ_PATH "/sys/class/devfreq"
+#define THERMAL_PATH "/sys/class/thermal"
+#define CPU_PATH "/sys/devices/system/cpu"
+#define CPU_DMA_LATENCY_PATH "/dev/cpu_dma_latency"
+#define PROP_SCREEN_OFF_CORES "ro.vendor.power.screen_off_cores"
+#define PROP_LOW_POWER_CORES "ro.vendor.power.low_power_cores"
+/* i.MX busfreq, 0 holds bus high, 1 lets it drop to low-bus mode */
+#define BUSFREQ_PATH "/sys/bus/platform/drivers/imx_busfreq/busfreq/enable"
 #define PROP_CPUFREQGOV "sys.interactive"
 #define PROP_VAL "active"
 
@@ -38,106 +59,718 @@
 #define POWERSAVE    "powersave"
 #define PERFORMANCE  "performance"
 
+#define GOVERNOR_NAME_MAX 32
+#define CPU_DOMAIN_MAX 4
+#define DOMAIN_FREQ_MAX 32
+
+/*
+ * sustained performance caps cpu and gpu below the passive trip so the
+ * kernel never throttles. cap moves one step at a time, down when
+ * temperature is within SUSTAINED_HOT of the trip, up when it is more
+ * than SUSTAINED_COOL below, the band between keeps it steady.
+ */
+#define SUSTAINED_PERIOD_MS 2000
+#define SUSTAINED_HOT 5000      /* millicelsius */
+#define SUSTAINED_COOL 15000
+#define SUSTAINED_CAP_START 80  /* percent of highest frequency */
+#define SUSTAINED_CAP_MIN 30
+#define SUSTAINED_CAP_STEP 10
+
+/*
+ * screen off and low power park secondary cores by hotplug, leaving
+ * PROP_SCREEN_OFF_CORES (default 1) and PROP_LOW_POWER_CORES (default
+ * half) online. interaction brings them all back for PARK_WAKE_MS and
+ * holds cpu_dma_latency at PARK_WAKE_LATENCY_US meanwhile, so cores
+ * skip idle states too slow to exit for touch response.
+ */
+#define CPU_NUM_MAX 8
+#define PARK_WAKE_MS 3000
+#define PARK_WAKE_LATENCY_US 100
+
 static int interactive_mode = 0;
 
-static void getcpu_gov(char *s, int size)
+/*
+ * sysfs nodes are kept open, a hint is one write. governor node is
+ * opened in init, interactive tunables while that governor runs as
+ * they go away with it. power_lock guards nodes and boost state,
+ * hints come from several binder threads and the boost timer.
+ */
+static pthread_mutex_t power_lock = PTHREAD_MUTEX_INITIALIZER;
+static int gov_fd = -1;
+static int boostpulse_fd = -1;
+static int boost_fd = -1;
+/* open failure of interactive nodes was logged since governor change */
+static int interactive_open_logged = 0;
+static char cur_gov[GOVERNOR_NAME_MAX];
+
+/* boost held for the duration of an interaction hint */
+static timer_t boost_timer;
+static int boost_timer_valid = 0;
+static int boosted = 0;
+
+/*
+ * frequency domain whose floor a hint profile raises and sustained
+ * mode caps: cpufreq policy scaling_min/max_freq, devfreq min/max_freq
+ * of DDR (i.MX8 busfreq), NOC and GPU.
+ */
+struct freq_domain {
+    char path[PATH_MAX];
+    char max_path[PATH_MAX];
+    int min_fd;
+    int max_fd;
+    /* available frequencies, ascending */
+    unsigned long freqs[DOMAIN_FREQ_MAX];
+    int num_freqs;
+    unsigned long floor;
+    unsigned long cap;
+};
+
+static struct freq_domain cpu_domains[CPU_DOMAIN_MAX];
+static int num_cpu_domains = 0;
+static struct freq_domain ddr_domain;
+static struct freq_domain noc_domain;
+static struct freq_domain gpu_domain;
+/* kernels without DDR devfreq only switch low-bus mode of busfreq */
+static int busfreq_fd = -1;
+static int bus_held = 0;
+
+/*
+ * floors in percent of the highest frequency, 0 leaves the domain at
+ * its lowest one. active profiles combine to the highest floor.
+ * profiles come from framework hints, or from workloads display and
+ * camera HALs request through power_workload_ext.h properties.
+ */
+enum {
+    PROFILE_LAUNCH,
+    PROFILE_SUSTAINED,
+    PROFILE_VR,
+    PROFILE_VIDEO_ENCODE,
+    PROFILE_VIDEO_DECODE,
+    PROFILE_DISPLAY_4K,
+    PROFILE_CAMERA,
+    PROFILE_NUM,
+};
+
+struct hint_profile {
+    const char *name;
+    int cpu_floor;
+    int ddr_floor;
+    int noc_floor;
+    int gpu_floor;
+};
+
+static const struct hint_profile profiles[PROFILE_NUM] = {
+    /* cold start is cpu and memory bound */
+    { "launch",       100, 100, 50, 50 },
+    /* clocks pinned at the thermal cap, floors are clamped to it */
+    { "sustained",    100, 100, 100, 100 },
+    { "vr",            80, 100, 100, 100 },
+    /* camera recording, sensor frames and encoder need bus bandwidth */
+    { "video_encode",  50, 100, 100, 0 },
+    { "video_decode",  30, 100, 100, 0 },
+    /* 4K scanout underruns in low-bus mode, it needs no cpu */
+    { "display_4k",     0, 100, 100, 0 },
+    /* MIPI CSI DMA of preview and capture */
+    { "camera",         0, 50, 50, 0 },
+};
+
+/* profiles requested by workload properties, the rest by hints */
+static const struct {
+    const char *prop;
+    int profile;
+} workloads[] = {
+    { POWER_WORKLOAD_DISPLAY_4K, PROFILE_DISPLAY_4K },
+    { POWER_WORKLOAD_CAMERA, PROFILE_CAMERA },
+    { POWER_WORKLOAD_VIDEO_DECODE, PROFILE_VIDEO_DECODE },
+};
+
+static unsigned int hint_profiles = 0;
+static unsigned int workload_profiles = 0;
+static unsigned int active_profiles = 0;
+static pthread_t workload_thread;
+static int workload_thread_valid = 0;
+/* floors of active profiles and sustained cap, in percent */
+static int cpu_floor = 0, ddr_floor = 0, noc_floor = 0, gpu_floor = 0;
+static int sustained_cap = 100;
+
+/* passive trip of the SoC thermal zone, 0 if none was found */
+static int thermal_fd = -1;
+static long thermal_trip = 0;
+static timer_t sustained_timer;
+static int sustained_timer_valid = 0;
+
+/* online node of each cpu, -1 for cpu0 and cpus without hotplug */
+static int cpu_online_fd[CPU_NUM_MAX];
+static int cpu_online[CPU_NUM_MAX];
+static int num_cpus = 0;
+static int screen_off_cores = 0, low_power_cores = 0;
+static int screen_off = 0, low_power = 0, park_woken = 0;
+static int qos_fd = -1;
+static timer_t park_timer;
+static int park_timer_valid = 0;
+
+static int sysfs_open(const char *path, int flags)
 {
-    int len;
-    int fd = open(GOVERNOR_PATH, O_RDONLY);
+    int fd = open(path, flags | O_CLOEXEC);
 
-    if (fd < 0) {
-        ALOGE("Error opening %s: %s\n", GOVERNOR_PATH, strerror(errno));
-        return;
+    if (fd < 0)
+        ALOGE("Error opening %s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+static int sysfs_write(int fd, const char *path, const char *s)
+{
+    if (fd < 0)
+        return -1;
+
+    /* sysfs store takes whole buffer at offset 0 */
+    if (pwrite(fd, s, strlen(s), 0) < 0) {
+        ALOGE("Error writing to %s: %s\n", path, strerror(errno));
+        return -1;
     }
+    return 0;
+}
 
-    len = read(fd, s, size);
-    if (len < 0) {
-        ALOGE("Error read %s: %s\n", GOVERNOR_PATH, strerror(errno));
+/*
+ * init chowns the nodes of a new governor after the property is set,
+ * so they are opened on first use rather than right after the change.
+ */
+static int interactive_open(int *fd, const char *path)
+{
+    if (*fd < 0) {
+        *fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (*fd < 0 && !interactive_open_logged) {
+            ALOGE("Error opening %s: %s\n", path, strerror(errno));
+            interactive_open_logged = 1;
+        }
     }
-    close(fd);
+    return *fd;
 }
 
-static void sysfs_write(const char *path, const char *s)
+static void close_interactive_nodes()
 {
-    int len;
-    int fd = open(path, O_WRONLY);
+    if (boostpulse_fd >= 0)
+        close(boostpulse_fd);
+    if (boost_fd >= 0)
+        close(boost_fd);
+    boostpulse_fd = -1;
+    boost_fd = -1;
+    interactive_open_logged = 0;
+}
 
-    if (fd < 0) {
-        ALOGE("Error opening %s: %s\n", path, strerror(errno));
+/* called with power_lock held */
+static void boost_stop()
+{
+    struct itimerspec its;
+
+    if (boost_timer_valid) {
+        memset(&its, 0, sizeof(its));
+        timer_settime(boost_timer, 0, &its, NULL);
+    }
+    if (boosted)
+        sysfs_write(boost_fd, BOOST_PATH, "0");
+    boosted = 0;
+}
+
+static void boost_timeout(union sigval)
+{
+    pthread_mutex_lock(&power_lock);
+    /* a later hint may have stopped or extended it meanwhile */
+    if (boosted) {
+        struct itimerspec its;
+        timer_gettime(boost_timer, &its);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            sysfs_write(boost_fd, BOOST_PATH, "0");
+            boosted = 0;
+        }
+    }
+    pthread_mutex_unlock(&power_lock);
+}
+
+/*
+ * a pulse boosts for the governor's boostpulse_duration, a hint with
+ * a duration holds boost until the timer releases it. called with
+ * power_lock held.
+ */
+static void do_boost(int duration_ms)
+{
+    struct itimerspec its;
+
+    if (duration_ms > 0)
+        interactive_open(&boost_fd, BOOST_PATH);
+    if (duration_ms <= 0 || boost_fd < 0 || !boost_timer_valid) {
+        interactive_open(&boostpulse_fd, BOOSTPULSE_PATH);
+        sysfs_write(boostpulse_fd, BOOSTPULSE_PATH, "1");
         return;
     }
 
-    len = write(fd, s, strlen(s));
-    if (len < 0) {
-        ALOGE("Error writing to %s: %s\n", path, strerror(errno));
+    /* extend a running boost, never shorten it */
+    if (boosted) {
+        timer_gettime(boost_timer, &its);
+        if (its.it_value.tv_sec * 1000 + its.it_value.tv_nsec / 1000000 >= duration_ms)
+            return;
+    } else if (sysfs_write(boost_fd, BOOST_PATH, "1") < 0) {
+        return;
     }
+    boosted = 1;
 
-    close(fd);
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = duration_ms / 1000;
+    its.it_value.tv_nsec = (duration_ms % 1000) * 1000000L;
+    timer_settime(boost_timer, 0, &its, NULL);
 }
 
-static ssize_t sysfs_read(char *path, char *s, int num_bytes)
+static int domain_init(struct freq_domain *d, const char *dir,
+                       const char *avail, const char *min, const char *max)
 {
+    char buf[512];
+    char *p, *end;
     ssize_t n;
-    int fd = open(path, O_RDONLY);
+    int fd;
+
+    memset(d, 0, sizeof(*d));
+    d->min_fd = -1;
+    d->max_fd = -1;
+    snprintf(d->path, sizeof(d->path), "%s/%s", dir, min);
+    snprintf(d->max_path, sizeof(d->max_path), "%s/%s", dir, max);
 
-    if (fd < 0) {
-        ALOGE("Error reading from %s: %s\n", path, strerror(errno));
+    snprintf(buf, sizeof(buf), "%s/%s", dir, avail);
+    fd = open(buf, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
         return -1;
+    buf[n] = '\0';
+
+    for (p = buf; d->num_freqs < DOMAIN_FREQ_MAX; p = end) {
+        unsigned long f = strtoul(p, &end, 10);
+        if (end == p)
+            break;
+        /* insertion keeps list ascending whatever order node has */
+        int i = d->num_freqs++;
+        while (i > 0 && d->freqs[i - 1] > f) {
+            d->freqs[i] = d->freqs[i - 1];
+            i--;
+        }
+        d->freqs[i] = f;
     }
+    if (d->num_freqs == 0)
+        return -1;
 
-    if ((n = read(fd, s, (num_bytes - 1))) < 0) {
-        ALOGE("Error reading from  %s: %s\n", path, strerror(errno));
-    } else {
-        if ((n >= 1) && (s[n-1] == '\n')) {
-            s[n-1] = '\0';
-        } else {
-            s[n] = '\0';
+    d->min_fd = sysfs_open(d->path, O_WRONLY);
+    if (d->min_fd < 0)
+        return -1;
+    d->max_fd = sysfs_open(d->max_path, O_WRONLY);
+    d->floor = d->freqs[0];
+    d->cap = d->freqs[d->num_freqs - 1];
+    return 0;
+}
+
+/*
+ * first devfreq device named like one of DDR, NOC or GPU controllers,
+ * alt is the name of mainline kernels, or NULL.
+ */
+static void devfreq_init(struct freq_domain *d, const char *match,
+                         const char *alt)
+{
+    DIR *dp = opendir(DEVFREQ_PATH);
+    struct dirent *ep;
+    char dir[PATH_MAX];
+
+    memset(d, 0, sizeof(*d));
+    d->min_fd = -1;
+    d->max_fd = -1;
+    if (dp == NULL)
+        return;
+    while ((ep = readdir(dp)) != NULL) {
+        if (strstr(ep->d_name, match) == NULL &&
+            (alt == NULL || strstr(ep->d_name, alt) == NULL))
+            continue;
+        snprintf(dir, sizeof(dir), "%s/%s", DEVFREQ_PATH, ep->d_name);
+        if (domain_init(d, dir, "available_frequencies", "min_freq",
+                        "max_freq") == 0) {
+            ALOGI("%s floor by %s", match, dir);
+            break;
         }
     }
+    closedir(dp);
+}
 
-    close(fd);
-    ALOGV("read '%s' from %s", s, path);
+static void cpu_domains_init()
+{
+    DIR *dp = opendir(CPUFREQ_PATH);
+    struct dirent *ep;
+    char dir[PATH_MAX];
 
-    return n;
+    num_cpu_domains = 0;
+    if (dp == NULL)
+        return;
+    while ((ep = readdir(dp)) != NULL && num_cpu_domains < CPU_DOMAIN_MAX) {
+        if (strncmp(ep->d_name, "policy", strlen("policy")) != 0)
+            continue;
+        snprintf(dir, sizeof(dir), "%s/%s", CPUFREQ_PATH, ep->d_name);
+        if (domain_init(&cpu_domains[num_cpu_domains], dir,
+                        "scaling_available_frequencies", "scaling_min_freq",
+                        "scaling_max_freq") == 0)
+            num_cpu_domains++;
+    }
+    closedir(dp);
 }
-int do_setproperty(const char *propname, const char *propval)
+
+/*
+ * floor is the lowest frequency reaching floor_pct of the highest one,
+ * cap the highest one within cap_pct, floor never above cap. nodes are
+ * written in the order keeping min <= max at every step.
+ */
+static void domain_set(struct freq_domain *d, int floor_pct, int cap_pct)
 {
-    char prop_cpugov[PROPERTY_VALUE_MAX];
-    int ret;
+    unsigned long top = d->freqs[d->num_freqs - 1];
+    unsigned long floor = d->freqs[0];
+    unsigned long cap = d->freqs[0];
+    char buf[32];
 
-    property_set(propname, propval);
-    if ( property_get(propname, prop_cpugov, NULL) &&
-                     (strcmp(prop_cpugov, propval) == 0) ) {
-	ret = 0;
-        ALOGV("setprop: %s = %s ", propname, propval);
-    } else {
-        ret = -1;
-        ALOGE("setprop: %s = %s fail\n", propname, propval);
+    if (d->min_fd < 0)
+        return;
+    if (floor_pct > 0) {
+        for (int i = 0; i < d->num_freqs; i++) {
+            floor = d->freqs[i];
+            if (floor >= top / 100 * floor_pct)
+                break;
+        }
+    }
+    for (int i = 0; i < d->num_freqs; i++) {
+        if (d->freqs[i] <= top / 100 * cap_pct)
+            cap = d->freqs[i];
+    }
+    if (d->max_fd < 0)
+        cap = top;
+    if (floor > cap)
+        floor = cap;
+
+    if (floor > d->cap && cap != d->cap) {
+        snprintf(buf, sizeof(buf), "%lu", cap);
+        if (sysfs_write(d->max_fd, d->max_path, buf) == 0)
+            d->cap = cap;
+    }
+    if (floor != d->floor) {
+        snprintf(buf, sizeof(buf), "%lu", floor);
+        if (sysfs_write(d->min_fd, d->path, buf) == 0)
+            d->floor = floor;
+    }
+    if (cap != d->cap) {
+        snprintf(buf, sizeof(buf), "%lu", cap);
+        if (sysfs_write(d->max_fd, d->max_path, buf) == 0)
+            d->cap = cap;
     }
-    return ret;
 }
 
-int do_changecpugov(const char *gov)
+/* called with power_lock held, ddr and noc are not capped */
+static void apply_domains()
 {
-    int fd = open(GOVERNOR_PATH, O_WRONLY);
-    if (fd < 0) {
-        ALOGE("Error opening %s: %s\n", GOVERNOR_PATH, strerror(errno));
+    for (int i = 0; i < num_cpu_domains; i++)
+        domain_set(&cpu_domains[i], cpu_floor, sustained_cap);
+    domain_set(&ddr_domain, ddr_floor, 100);
+    domain_set(&noc_domain, noc_floor, 100);
+    domain_set(&gpu_domain, gpu_floor, sustained_cap);
+
+    /* low-bus mode only while no profile needs bus bandwidth */
+    int hold = ddr_domain.min_fd < 0 && ddr_floor > 0;
+    if (hold != bus_held &&
+        sysfs_write(busfreq_fd, BUSFREQ_PATH, hold ? "0" : "1") == 0)
+        bus_held = hold;
+}
+
+/* first thermal zone with a passive trip, the one cpufreq cooling acts on */
+static void thermal_init()
+{
+    DIR *dp = opendir(THERMAL_PATH);
+    struct dirent *ep;
+    char path[PATH_MAX];
+    char buf[32];
+
+    if (dp == NULL)
+        return;
+    while (thermal_trip == 0 && (ep = readdir(dp)) != NULL) {
+        if (strncmp(ep->d_name, "thermal_zone", strlen("thermal_zone")) != 0)
+            continue;
+        for (int trip = 0; ; trip++) {
+            snprintf(path, sizeof(path), "%s/%s/trip_point_%d_type",
+                     THERMAL_PATH, ep->d_name, trip);
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                break;
+            ssize_t n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            if (n <= 0 || strncmp(buf, "passive", strlen("passive")) != 0)
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s/trip_point_%d_temp",
+                     THERMAL_PATH, ep->d_name, trip);
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                break;
+            n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            if (n <= 0)
+                break;
+            buf[n] = '\0';
+            snprintf(path, sizeof(path), "%s/%s/temp", THERMAL_PATH, ep->d_name);
+            thermal_fd = sysfs_open(path, O_RDONLY);
+            if (thermal_fd >= 0) {
+                thermal_trip = strtol(buf, NULL, 10);
+                ALOGI("sustained cap follows %s trip %ld", ep->d_name, thermal_trip);
+            }
+            break;
+        }
+    }
+    closedir(dp);
+}
+
+static long thermal_read()
+{
+    char buf[32];
+    ssize_t n = pread(thermal_fd, buf, sizeof(buf) - 1, 0);
+
+    if (n <= 0)
         return -1;
+    buf[n] = '\0';
+    return strtol(buf, NULL, 10);
+}
+
+static void sustained_timeout(union sigval)
+{
+    pthread_mutex_lock(&power_lock);
+    long temp = thermal_read();
+    if ((active_profiles & (1 << PROFILE_SUSTAINED)) && temp >= 0) {
+        int cap = sustained_cap;
+        if (temp > thermal_trip - SUSTAINED_HOT && cap > SUSTAINED_CAP_MIN)
+            cap -= SUSTAINED_CAP_STEP;
+        else if (temp < thermal_trip - SUSTAINED_COOL && cap < 100)
+            cap += SUSTAINED_CAP_STEP;
+        if (cap != sustained_cap) {
+            ALOGV("sustained cap %d%% at %ld", cap, temp);
+            sustained_cap = cap;
+            apply_domains();
+        }
+    }
+    pthread_mutex_unlock(&power_lock);
+}
+
+/* called with power_lock held */
+static void sustained_start(int on)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (on && thermal_trip) {
+        its.it_value.tv_sec = SUSTAINED_PERIOD_MS / 1000;
+        its.it_value.tv_nsec = (SUSTAINED_PERIOD_MS % 1000) * 1000000L;
+        its.it_interval = its.it_value;
+    }
+    if (sustained_timer_valid)
+        timer_settime(sustained_timer, 0, &its, NULL);
+    sustained_cap = on ? SUSTAINED_CAP_START : 100;
+}
+
+static void hotplug_init()
+{
+    char path[PATH_MAX];
+
+    for (num_cpus = 0; num_cpus < CPU_NUM_MAX; num_cpus++) {
+        snprintf(path, sizeof(path), "%s/cpu%d", CPU_PATH, num_cpus);
+        if (access(path, F_OK) != 0)
+            break;
+        cpu_online_fd[num_cpus] = -1;
+        snprintf(path, sizeof(path), "%s/cpu%d/online", CPU_PATH, num_cpus);
+        if (num_cpus > 0 && access(path, W_OK) == 0)
+            cpu_online_fd[num_cpus] = sysfs_open(path, O_WRONLY);
+        /* unknown after a HAL restart, first apply_park writes it */
+        cpu_online[num_cpus] = cpu_online_fd[num_cpus] < 0;
+    }
+
+    screen_off_cores = property_get_int32(PROP_SCREEN_OFF_CORES, 1);
+    low_power_cores = property_get_int32(PROP_LOW_POWER_CORES, (num_cpus + 1) / 2);
+    if (screen_off_cores < 1 || screen_off_cores > num_cpus)
+        screen_off_cores = num_cpus;
+    if (low_power_cores < 1 || low_power_cores > num_cpus)
+        low_power_cores = num_cpus;
+    ALOGI("%d cpus, %d online at screen off, %d at low power", num_cpus,
+          screen_off_cores, low_power_cores);
+}
+
+/* called with power_lock held */
+static void apply_park()
+{
+    int target = num_cpus;
+    char path[PATH_MAX];
+
+    /* profiles needing cpu, like video recording, keep every core */
+    if (!park_woken && cpu_floor == 0) {
+        if (screen_off && screen_off_cores < target)
+            target = screen_off_cores;
+        if (low_power && low_power_cores < target)
+            target = low_power_cores;
     }
 
-    if (write(fd, gov, strlen(gov)) < 0) {
-        ALOGE("Error writing to %s: %s\n", GOVERNOR_PATH, strerror(errno));
-        close(fd);
+    /* bring up in ascending order, park from the highest cpu */
+    for (int i = 1; i < num_cpus; i++) {
+        if (i < target && !cpu_online[i] && cpu_online_fd[i] >= 0) {
+            snprintf(path, sizeof(path), "%s/cpu%d/online", CPU_PATH, i);
+            if (sysfs_write(cpu_online_fd[i], path, "1") == 0)
+                cpu_online[i] = 1;
+        }
+    }
+    for (int i = num_cpus - 1; i >= target && i > 0; i--) {
+        if (cpu_online[i] && cpu_online_fd[i] >= 0) {
+            snprintf(path, sizeof(path), "%s/cpu%d/online", CPU_PATH, i);
+            if (sysfs_write(cpu_online_fd[i], path, "0") == 0)
+                cpu_online[i] = 0;
+        }
+    }
+}
+
+static int cores_parked()
+{
+    for (int i = 1; i < num_cpus; i++) {
+        if (!cpu_online[i])
+            return 1;
+    }
+    return 0;
+}
+
+/* called with power_lock held, request goes away with its fd */
+static void park_release()
+{
+    struct itimerspec its;
+
+    if (park_timer_valid) {
+        memset(&its, 0, sizeof(its));
+        timer_settime(park_timer, 0, &its, NULL);
+    }
+    if (qos_fd >= 0)
+        close(qos_fd);
+    qos_fd = -1;
+    park_woken = 0;
+}
+
+static void park_timeout(union sigval)
+{
+    pthread_mutex_lock(&power_lock);
+    park_release();
+    apply_park();
+    pthread_mutex_unlock(&power_lock);
+}
+
+/* interaction while parked, called with power_lock held */
+static void park_wake()
+{
+    struct itimerspec its;
+    int32_t latency = PARK_WAKE_LATENCY_US;
+
+    if (!park_timer_valid)
+        return;
+    if (qos_fd < 0) {
+        qos_fd = sysfs_open(CPU_DMA_LATENCY_PATH, O_WRONLY);
+        if (qos_fd >= 0 && write(qos_fd, &latency, sizeof(latency)) < 0)
+            ALOGE("Error writing to %s: %s\n", CPU_DMA_LATENCY_PATH, strerror(errno));
+    }
+    park_woken = 1;
+    apply_park();
+
+    /* a later interaction extends the window */
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = PARK_WAKE_MS / 1000;
+    its.it_value.tv_nsec = (PARK_WAKE_MS % 1000) * 1000000L;
+    timer_settime(park_timer, 0, &its, NULL);
+}
+
+/*
+ * profile of hint or workload source, it is active while either one
+ * requests it. called with power_lock held.
+ */
+static void set_profile(unsigned int *source, int profile, int on)
+{
+    if (on)
+        *source |= 1 << profile;
+    else
+        *source &= ~(1 << profile);
+
+    unsigned int profiles_now = hint_profiles | workload_profiles;
+    if (profiles_now == active_profiles)
+        return;
+    active_profiles = profiles_now;
+    ALOGV("profile %s %s", profiles[profile].name, on ? "on" : "off");
+    if (profile == PROFILE_SUSTAINED)
+        sustained_start(on);
+
+    cpu_floor = ddr_floor = noc_floor = gpu_floor = 0;
+    for (int i = 0; i < PROFILE_NUM; i++) {
+        if (!(active_profiles & (1 << i)))
+            continue;
+        if (profiles[i].cpu_floor > cpu_floor)
+            cpu_floor = profiles[i].cpu_floor;
+        if (profiles[i].ddr_floor > ddr_floor)
+            ddr_floor = profiles[i].ddr_floor;
+        if (profiles[i].noc_floor > noc_floor)
+            noc_floor = profiles[i].noc_floor;
+        if (profiles[i].gpu_floor > gpu_floor)
+            gpu_floor = profiles[i].gpu_floor;
+    }
+    apply_domains();
+    apply_park();
+}
+
+/*
+ * workload properties of display and camera HALs are read again on
+ * every property change, HALs only write them on transitions.
+ */
+static void *workload_loop(void *)
+{
+    uint32_t serial = 0;
+
+    while (true) {
+        pthread_mutex_lock(&power_lock);
+        for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+            set_profile(&workload_profiles, workloads[i].profile,
+                        property_get_bool(workloads[i].prop, false));
+        pthread_mutex_unlock(&power_lock);
+
+        __system_property_wait(NULL, serial, &serial, NULL);
+    }
+    return NULL;
+}
+
+/* called with power_lock held */
+int do_changecpugov(const char *gov)
+{
+    int interactive = strncmp(INTERACTIVE, gov, strlen(INTERACTIVE)) == 0;
+
+    /* framework repeats hints, governor restart would drop its state */
+    if (strcmp(cur_gov, gov) == 0)
+        return 0;
+
+    if (!interactive) {
+        boost_stop();
+        close_interactive_nodes();
+    }
+    if (sysfs_write(gov_fd, GOVERNOR_PATH, gov) < 0) {
+        cur_gov[0] = '\0';
         return -1;
     }
-    if (strncmp(INTERACTIVE, gov, strlen(INTERACTIVE)) == 0) {
-        do_setproperty(PROP_CPUFREQGOV, PROP_VAL);
+    strlcpy(cur_gov, gov, sizeof(cur_gov));
+
+    if (interactive) {
+        if (!interactive_mode && property_set(PROP_CPUFREQGOV, PROP_VAL) < 0)
+            ALOGE("setprop: %s = %s fail\n", PROP_CPUFREQGOV, PROP_VAL);
+        /* boost nodes are opened by the first hint */
+        interactive_open_logged = 0;
         interactive_mode = 1;
     } else {
         interactive_mode = 0;
     }
 
-    close(fd);
     return 0;
 }
 
@@ -149,8 +782,59 @@ static void fsl_power_init(struct power_module *module)
      * the params is initialized in init.rc
      */
     (void)module;
+    struct sigevent sev;
+
+    pthread_mutex_lock(&power_lock);
+    if (gov_fd < 0) {
+        gov_fd = sysfs_open(GOVERNOR_PATH, O_WRONLY);
+        cpu_domains_init();
+        devfreq_init(&ddr_domain, "ddr", "memory-controller");
+        devfreq_init(&noc_domain, "noc", "interconnect");
+        devfreq_init(&gpu_domain, "gpu", NULL);
+        if (ddr_domain.min_fd < 0 && access(BUSFREQ_PATH, F_OK) == 0)
+            busfreq_fd = sysfs_open(BUSFREQ_PATH, O_WRONLY);
+        thermal_init();
+        hotplug_init();
+        apply_park();
+    }
+
+    if (!boost_timer_valid) {
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD;
+        sev.sigev_notify_function = boost_timeout;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &boost_timer) == 0)
+            boost_timer_valid = 1;
+        else
+            ALOGE("Error creating boost timer: %s\n", strerror(errno));
+    }
+    if (!park_timer_valid) {
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD;
+        sev.sigev_notify_function = park_timeout;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &park_timer) == 0)
+            park_timer_valid = 1;
+        else
+            ALOGE("Error creating park timer: %s\n", strerror(errno));
+    }
+    if (!sustained_timer_valid) {
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD;
+        sev.sigev_notify_function = sustained_timeout;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &sustained_timer) == 0)
+            sustained_timer_valid = 1;
+        else
+            ALOGE("Error creating sustained timer: %s\n", strerror(errno));
+    }
+
+    if (!workload_thread_valid) {
+        if (pthread_create(&workload_thread, NULL, workload_loop, NULL) == 0)
+            workload_thread_valid = 1;
+        else
+            ALOGE("Error creating workload thread: %s\n", strerror(errno));
+    }
 
     do_changecpugov(INTERACTIVE);
+    pthread_mutex_unlock(&power_lock);
 }
 
 static void fsl_power_set_interactive(struct power_module *module, int on)
@@ -160,10 +844,15 @@ static void fsl_power_set_interactive(struct power_module *module, int on)
      */
     (void)module;
 
+    pthread_mutex_lock(&power_lock);
     if (on)
         do_changecpugov(INTERACTIVE);
     else
         do_changecpugov(CONSERVATIVE);
+    screen_off = !on;
+    park_release();
+    apply_park();
+    pthread_mutex_unlock(&power_lock);
 }
 
 static void fsl_power_hint(struct power_module *module, power_hint_t hint,
@@ -171,12 +860,16 @@ static void fsl_power_hint(struct power_module *module, power_hint_t hint,
 {
     (void)module;
 
+    pthread_mutex_lock(&power_lock);
     switch (hint) {
     case POWER_HINT_VSYNC:
         break;
     case POWER_HINT_INTERACTION:
+        /* data is duration in ms, if any */
+        if (cores_parked() || park_woken)
+            park_wake();
         if (interactive_mode)
-            sysfs_write(BOOSTPULSE_PATH, "1");
+            do_boost(data ? *(int *)data : 0);
         else
             do_changecpugov(INTERACTIVE);
         break;
@@ -185,11 +878,30 @@ static void fsl_power_hint(struct power_module *module, power_hint_t hint,
             do_changecpugov(POWERSAVE);
         else
             do_changecpugov(INTERACTIVE);
+        low_power = data != NULL;
+        apply_park();
+        break;
+    /* data is non-NULL when the hint starts, NULL when it ends */
+    case POWER_HINT_LAUNCH:
+        set_profile(&hint_profiles, PROFILE_LAUNCH, data != NULL);
+        break;
+    case POWER_HINT_SUSTAINED_PERFORMANCE:
+        set_profile(&hint_profiles, PROFILE_SUSTAINED, data != NULL);
+        break;
+    case POWER_HINT_VR_MODE:
+        set_profile(&hint_profiles, PROFILE_VR, data != NULL);
+        break;
+    case POWER_HINT_VIDEO_ENCODE:
+        set_profile(&hint_profiles, PROFILE_VIDEO_ENCODE, data != NULL);
+        break;
+    case POWER_HINT_VIDEO_DECODE:
+        set_profile(&hint_profiles, PROFILE_VIDEO_DECODE, data != NULL);
         break;
  
     default:
         break;
     }
+    pthread_mutex_unlock(&power_lock);
 }
 
 static struct hw_module_methods_t power_module_methods = {
@@ -0,0 +1,50 @@
+#/*
+# * Copyright (C) 2018 The Android Open Source Project
+# * Copyright 2018 NXP
+# *
+# * Licensed under the Apache License, Version 2.0 (the "License");
+# * you may not use this file except in compliance with the License.
+# * You may obtain a copy of the License at
+# *
+# *      http://www.apache.org/licenses/LICENSE-2.0
+# *
+# * Unless required by applicable law or agreed to in writing, software
+# * distributed under the License is distributed on an "AS IS" BASIS,
+# * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# * See the License for the specific language governing permissions and
+# * limitations under the License.
+# */
+
+# Sensors 2.0 service over the sensors.$(TARGET_BOARD_PLATFORM) module
+# of libsensors or libsensors_sensorhub, boards opt in and declare
+# android.hardware.sensors@2.0 in their manifest.
+ifeq ($(BOARD_USE_SENSORS_HAL_2_0),true)
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE_RELATIVE_PATH := hw
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE := android.hardware.sensors@2.0-service.imx
+LOCAL_INIT_RC := android.hardware.sensors@2.0-service.imx.rc
+LOCAL_SRC_FILES := \
+    service.cpp \
+    Sensors.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    libfmq \
+    libhardware \
+    libhardware_legacy \
+    libhidlbase \
+    libhidltransport \
+    liblog \
+    libutils \
+    android.hardware.sensors@1.0 \
+    android.hardware.sensors@2.0
+
+LOCAL_STATIC_LIBRARIES := \
+    android.hardware.sensors@1.0-convert
+
+include $(BUILD_EXECUTABLE)
+
+endif
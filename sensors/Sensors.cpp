@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ * Copyright 2018 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.sensors@2.0-service.imx"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <hardware_legacy/power.h>
+#include <sensors/convert.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include "Sensors.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::implementation::convertFromSensor;
+using ::android::hardware::sensors::V1_0::implementation::convertFromSensorEvent;
+using ::android::hardware::sensors::V1_0::implementation::convertRateLevel;
+using ::android::hardware::sensors::V1_0::implementation::convertSharedMemInfo;
+using ::android::hardware::sensors::V1_0::implementation::convertToSensorEvent;
+
+// legacy HALs return -errno, same values as status_t.
+static Result resultFromStatus(int err) {
+    switch (err) {
+        case OK:
+            return Result::OK;
+        case PERMISSION_DENIED:
+            return Result::PERMISSION_DENIED;
+        case NO_MEMORY:
+            return Result::NO_MEMORY;
+        case BAD_VALUE:
+            return Result::BAD_VALUE;
+        default:
+            return Result::INVALID_OPERATION;
+    }
+}
+
+Sensors::Sensors()
+    : mModule(NULL),
+      mDevice(NULL),
+      mSensorList(NULL),
+      mSensorCount(0),
+      mWakeUpSensors(0),
+      mEventQueueFlag(NULL),
+      mOutstandingWakeUps(0),
+      mWakeLockHeld(false),
+      mLastWakeUpTime(0),
+      mThreadsStarted(false) {
+    // the module of libsensors or libsensors_sensorhub built for board.
+    int err = hw_get_module(SENSORS_HARDWARE_MODULE_ID,
+                            (const hw_module_t **)&mModule);
+    if (err || mModule == NULL) {
+        ALOGE("Couldn't load sensors module (%s)", strerror(-err));
+        mModule = NULL;
+        return;
+    }
+
+    err = sensors_open_1(&mModule->common, &mDevice);
+    if (err || mDevice == NULL) {
+        ALOGE("Couldn't open sensors device (%s)", strerror(-err));
+        mDevice = NULL;
+        return;
+    }
+    if (mDevice->common.version < SENSORS_DEVICE_API_VERSION_1_3) {
+        ALOGE("Sensors device version 0x%x has no batch and flush",
+              mDevice->common.version);
+        sensors_close_1(mDevice);
+        mDevice = NULL;
+        return;
+    }
+
+    mSensorCount = mModule->get_sensors_list(mModule, &mSensorList);
+    for (int i = 0; i < mSensorCount; i++) {
+        int handle = mSensorList[i].handle;
+        if ((mSensorList[i].flags & SENSOR_FLAG_WAKE_UP) &&
+            handle >= 0 && handle < 64) {
+            mWakeUpSensors |= 1ULL << handle;
+        }
+    }
+    mEvents.resize(SENSORS_POLL_EVENTS);
+}
+
+Sensors::~Sensors() {
+    // reader threads run for the life of the service process.
+    if (mDevice != NULL) {
+        sensors_close_1(mDevice);
+    }
+}
+
+bool Sensors::initCheck() const {
+    return mDevice != NULL;
+}
+
+Return<void> Sensors::getSensorsList(getSensorsList_cb _hidl_cb) {
+    hidl_vec<SensorInfo> out;
+    out.resize(mSensorCount);
+
+    for (int i = 0; i < mSensorCount; i++) {
+        convertFromSensor(mSensorList[i], &out[i]);
+    }
+
+    _hidl_cb(out);
+    return Void();
+}
+
+Return<Result> Sensors::setOperationMode(OperationMode mode) {
+    if (mModule->set_operation_mode == NULL) {
+        return mode == OperationMode::NORMAL ? Result::OK : Result::BAD_VALUE;
+    }
+
+    return resultFromStatus(mModule->set_operation_mode((uint32_t)mode));
+}
+
+Return<Result> Sensors::activate(int32_t sensorHandle, bool enabled) {
+    return resultFromStatus(mDevice->activate(
+            reinterpret_cast<sensors_poll_device_t *>(mDevice),
+            sensorHandle, enabled));
+}
+
+Return<Result> Sensors::initialize(
+        const MQDescriptorSync<Event>& eventQueueDescriptor,
+        const MQDescriptorSync<uint32_t>& wakeLockDescriptor,
+        const sp<ISensorsCallback>& sensorsCallback) {
+    Result result = Result::OK;
+
+    // framework restarted, it expects every sensor off.
+    for (int i = 0; i < mSensorCount; i++) {
+        activate(mSensorList[i].handle, false);
+    }
+
+    pthread_mutex_lock(&mLock);
+    if (mEventQueueFlag != NULL) {
+        EventFlag::deleteEventFlag(&mEventQueueFlag);
+    }
+    mEventQueue.reset(new EventMessageQueue(eventQueueDescriptor,
+                                            true /* resetPointers */));
+    mWakeLockQueue.reset(new WakeLockMessageQueue(wakeLockDescriptor,
+                                                  true /* resetPointers */));
+    if (!mEventQueue->isValid() || !mWakeLockQueue->isValid() ||
+        EventFlag::createEventFlag(mEventQueue->getEventFlagWord(),
+                                   &mEventQueueFlag) != OK) {
+        ALOGE("%s invalid event or wake lock queue", __func__);
+        mEventQueue.reset();
+        mWakeLockQueue.reset();
+        mEventQueueFlag = NULL;
+        result = Result::BAD_VALUE;
+    }
+    mCallback = sensorsCallback;
+
+    // wake-up events of previous framework will never be acknowledged.
+    mOutstandingWakeUps = 0;
+    updateWakeLockLocked(0, 0);
+
+    if (result == Result::OK && !mThreadsStarted) {
+        if (pthread_create(&mReader, NULL, readerThread, this) ||
+            pthread_create(&mWakeLockReader, NULL, wakeLockThread, this)) {
+            ALOGE("%s couldn't start reader threads", __func__);
+            result = Result::NO_MEMORY;
+        } else {
+            mThreadsStarted = true;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+
+    return result;
+}
+
+Return<Result> Sensors::batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                              int64_t maxReportLatencyNs) {
+    return resultFromStatus(mDevice->batch(mDevice, sensorHandle, 0,
+                                           samplingPeriodNs, maxReportLatencyNs));
+}
+
+Return<Result> Sensors::flush(int32_t sensorHandle) {
+    return resultFromStatus(mDevice->flush(mDevice, sensorHandle));
+}
+
+Return<Result> Sensors::injectSensorData(const Event& event) {
+    if (mDevice->common.version < SENSORS_DEVICE_API_VERSION_1_4 ||
+        mDevice->inject_sensor_data == NULL) {
+        return Result::INVALID_OPERATION;
+    }
+
+    sensors_event_t out;
+    convertToSensorEvent(event, &out);
+    return resultFromStatus(mDevice->inject_sensor_data(mDevice, &out));
+}
+
+Return<void> Sensors::registerDirectChannel(const SharedMemInfo& mem,
+                                            registerDirectChannel_cb _hidl_cb) {
+    if (mDevice->register_direct_channel == NULL) {
+        _hidl_cb(Result::INVALID_OPERATION, -1);
+        return Void();
+    }
+
+    sensors_direct_mem_t m;
+    if (!convertSharedMemInfo(mem, &m)) {
+        _hidl_cb(Result::BAD_VALUE, -1);
+        return Void();
+    }
+
+    int ret = mDevice->register_direct_channel(mDevice, &m, -1);
+    if (ret < 0) {
+        _hidl_cb(resultFromStatus(ret), -1);
+    } else {
+        _hidl_cb(Result::OK, ret);
+    }
+    return Void();
+}
+
+Return<Result> Sensors::unregisterDirectChannel(int32_t channelHandle) {
+    if (mDevice->register_direct_channel == NULL) {
+        return Result::INVALID_OPERATION;
+    }
+
+    mDevice->register_direct_channel(mDevice, NULL, channelHandle);
+    return Result::OK;
+}
+
+Return<void> Sensors::configDirectReport(int32_t sensorHandle, int32_t channelHandle,
+                                         RateLevel rate,
+                                         configDirectReport_cb _hidl_cb) {
+    if (mDevice->config_direct_report == NULL) {
+        _hidl_cb(Result::INVALID_OPERATION, -1);
+        return Void();
+    }
+
+    sensors_direct_cfg_t cfg = {
+        .rate_level = convertRateLevel(rate)
+    };
+    if (cfg.rate_level < 0) {
+        _hidl_cb(Result::BAD_VALUE, -1);
+        return Void();
+    }
+
+    int ret = mDevice->config_direct_report(mDevice, sensorHandle,
+                                            channelHandle, &cfg);
+    if (rate == RateLevel::STOP) {
+        _hidl_cb(resultFromStatus(ret), 0);
+    } else {
+        _hidl_cb(ret > 0 ? Result::OK : resultFromStatus(ret), ret);
+    }
+    return Void();
+}
+
+void* Sensors::readerThread(void* arg) {
+    static_cast<Sensors *>(arg)->readEvents();
+    return NULL;
+}
+
+void* Sensors::wakeLockThread(void* arg) {
+    static_cast<Sensors *>(arg)->readWakeLockAcks();
+    return NULL;
+}
+
+void Sensors::readEvents() {
+    sensors_event_t buffer[SENSORS_POLL_EVENTS];
+
+    while (true) {
+        int n = mDevice->poll(reinterpret_cast<sensors_poll_device_t *>(mDevice),
+                              buffer, SENSORS_POLL_EVENTS);
+        if (n < 0) {
+            ALOGE("%s poll failed (%s)", __func__, strerror(-n));
+            continue;
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&mLock);
+        writeEventsLocked(buffer, n);
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+uint32_t Sensors::countWakeUpEvents(const sensors_event_t* data, size_t count) const {
+    uint32_t wakeUps = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        int handle = data[i].type == SENSOR_TYPE_META_DATA ?
+                     data[i].meta_data.sensor : data[i].sensor;
+        if (handle >= 0 && handle < 64 && (mWakeUpSensors & (1ULL << handle))) {
+            wakeUps++;
+        }
+    }
+
+    return wakeUps;
+}
+
+void Sensors::writeEventsLocked(const sensors_event_t* data, size_t count) {
+    if (mEventQueue == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        convertFromSensorEvent(data[i], &mEvents[i]);
+    }
+
+    // count them before the write, framework may acknowledge at once.
+    uint32_t wakeUps = countWakeUpEvents(data, count);
+    if (wakeUps > 0) {
+        updateWakeLockLocked(wakeUps, 0);
+    }
+
+    if (!mEventQueue->write(mEvents.data(), count)) {
+        ALOGW("%s event queue full, %zu events dropped", __func__, count);
+        if (wakeUps > 0) {
+            updateWakeLockLocked(0, wakeUps);
+        }
+        return;
+    }
+    mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+}
+
+void Sensors::readWakeLockAcks() {
+    while (true) {
+        pthread_mutex_lock(&mLock);
+        std::shared_ptr<WakeLockMessageQueue> queue = mWakeLockQueue;
+        pthread_mutex_unlock(&mLock);
+        if (queue == NULL) {
+            // last initialize failed, wait for framework to retry.
+            usleep(SENSORS_WAKE_LOCK_TIMEOUT / 1000);
+            continue;
+        }
+
+        // timeout lets lock expire if framework stops acknowledging.
+        uint32_t acked = 0;
+        bool read = queue->readBlocking(&acked, 1, 0,
+                static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN),
+                SENSORS_WAKE_LOCK_TIMEOUT);
+
+        pthread_mutex_lock(&mLock);
+        // events of a replaced queue belong to the previous framework.
+        if (queue != mWakeLockQueue) {
+            read = false;
+        }
+        updateWakeLockLocked(0, read ? acked : 0);
+        pthread_mutex_unlock(&mLock);
+    }
+}
+
+void Sensors::updateWakeLockLocked(uint32_t added, uint32_t acked) {
+    nsecs_t now = systemTime(SYSTEM_TIME_BOOTTIME);
+
+    mOutstandingWakeUps += added;
+    mOutstandingWakeUps -= acked < mOutstandingWakeUps ? acked : mOutstandingWakeUps;
+    if (added > 0) {
+        mLastWakeUpTime = now;
+    } else if (mOutstandingWakeUps > 0 &&
+               now - mLastWakeUpTime >= SENSORS_WAKE_LOCK_TIMEOUT) {
+        ALOGW("%s %u wake-up events not acknowledged", __func__,
+              mOutstandingWakeUps);
+        mOutstandingWakeUps = 0;
+    }
+
+    if (mOutstandingWakeUps > 0 && !mWakeLockHeld) {
+        acquire_wake_lock(PARTIAL_WAKE_LOCK, SENSORS_WAKE_LOCK_NAME);
+        mWakeLockHeld = true;
+    } else if (mOutstandingWakeUps == 0 && mWakeLockHeld) {
+        release_wake_lock(SENSORS_WAKE_LOCK_NAME);
+        mWakeLockHeld = false;
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
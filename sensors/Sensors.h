@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ * Copyright 2018 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_SENSORS_V2_0_SENSORS_H
+#define ANDROID_HARDWARE_SENSORS_V2_0_SENSORS_H
+
+#include <android/hardware/sensors/2.0/ISensors.h>
+#include <android/hardware/sensors/2.0/types.h>
+#include <fmq/EventFlag.h>
+#include <fmq/MessageQueue.h>
+#include <hardware/sensors.h>
+#include <hidl/Status.h>
+#include <pthread.h>
+#include <utils/Log.h>
+
+#include <memory>
+#include <vector>
+
+// events read from poll device at once, also the largest FMQ write.
+#define SENSORS_POLL_EVENTS 128
+// wake-up events not acknowledged by framework within this time are
+// dropped from the outstanding count, so suspend can't be kept off.
+#define SENSORS_WAKE_LOCK_TIMEOUT 1000000000LL
+#define SENSORS_WAKE_LOCK_NAME "SensorsHAL_WAKEUP_FMQ"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::Event;
+using ::android::hardware::sensors::V1_0::OperationMode;
+using ::android::hardware::sensors::V1_0::RateLevel;
+using ::android::hardware::sensors::V1_0::Result;
+using ::android::hardware::sensors::V1_0::SensorInfo;
+using ::android::hardware::sensors::V1_0::SharedMemInfo;
+using ::android::hardware::sensors::V2_0::ISensors;
+using ::android::hardware::sensors::V2_0::ISensorsCallback;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::MQDescriptorSync;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::sp;
+
+// Sensors 2.0 on top of the legacy poll device of libsensors or
+// libsensors_sensorhub, loaded in process. A reader thread polls it and
+// writes events straight into the framework's event FMQ, a second one
+// takes acknowledgements of wake-up events from the wake lock FMQ.
+struct Sensors : public ISensors {
+    typedef MessageQueue<Event, kSynchronizedReadWrite> EventMessageQueue;
+    typedef MessageQueue<uint32_t, kSynchronizedReadWrite> WakeLockMessageQueue;
+
+    Sensors();
+    ~Sensors();
+
+    // false if no legacy sensors module could be opened.
+    bool initCheck() const;
+
+    Return<void> getSensorsList(getSensorsList_cb _hidl_cb) override;
+    Return<Result> setOperationMode(OperationMode mode) override;
+    Return<Result> activate(int32_t sensorHandle, bool enabled) override;
+    Return<Result> initialize(
+            const MQDescriptorSync<Event>& eventQueueDescriptor,
+            const MQDescriptorSync<uint32_t>& wakeLockDescriptor,
+            const sp<ISensorsCallback>& sensorsCallback) override;
+    Return<Result> batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                         int64_t maxReportLatencyNs) override;
+    Return<Result> flush(int32_t sensorHandle) override;
+    Return<Result> injectSensorData(const Event& event) override;
+    Return<void> registerDirectChannel(const SharedMemInfo& mem,
+                                       registerDirectChannel_cb _hidl_cb) override;
+    Return<Result> unregisterDirectChannel(int32_t channelHandle) override;
+    Return<void> configDirectReport(int32_t sensorHandle, int32_t channelHandle,
+                                    RateLevel rate,
+                                    configDirectReport_cb _hidl_cb) override;
+
+  private:
+    static void* readerThread(void* arg);
+    static void* wakeLockThread(void* arg);
+    void readEvents();
+    void readWakeLockAcks();
+    // write converted events of one poll to event FMQ, mLock held.
+    void writeEventsLocked(const sensors_event_t* data, size_t count);
+    // wake-up events in data, including flush complete of wake-up sensors.
+    uint32_t countWakeUpEvents(const sensors_event_t* data, size_t count) const;
+    // hold wake lock while wake-up events are not acknowledged.
+    void updateWakeLockLocked(uint32_t added, uint32_t acked);
+
+    sensors_module_t* mModule;
+    sensors_poll_device_1_t* mDevice;
+    const sensor_t* mSensorList;
+    int mSensorCount;
+    // handle bits of wake-up sensors.
+    uint64_t mWakeUpSensors;
+
+    // Protects queues, flags, callback and wake lock state.
+    pthread_mutex_t mLock = PTHREAD_MUTEX_INITIALIZER;
+    std::unique_ptr<EventMessageQueue> mEventQueue;
+    EventFlag* mEventQueueFlag;
+    // wake lock thread keeps its own reference while it blocks on read.
+    std::shared_ptr<WakeLockMessageQueue> mWakeLockQueue;
+    sp<ISensorsCallback> mCallback;
+    // converted events of one poll, only touched by the reader thread.
+    std::vector<Event> mEvents;
+
+    uint32_t mOutstandingWakeUps;
+    bool mWakeLockHeld;
+    int64_t mLastWakeUpTime;
+
+    pthread_t mReader;
+    pthread_t mWakeLockReader;
+    bool mThreadsStarted;
+};
+
+}  // namespace implementation
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_SENSORS_V2_0_SENSORS_H
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ * Copyright 2018 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.sensors@2.0-service.imx"
+
+#include <hidl/HidlTransportSupport.h>
+#include "Sensors.h"
+
+using android::sp;
+
+// libhwbinder:
+using android::hardware::configureRpcThreadpool;
+using android::hardware::joinRpcThreadpool;
+
+// Generated HIDL files
+using android::hardware::sensors::V2_0::ISensors;
+using android::hardware::sensors::V2_0::implementation::Sensors;
+
+using android::status_t;
+using android::OK;
+
+int main() {
+    android::sp<Sensors> service = new Sensors();
+    if (!service->initCheck()) {
+        ALOGE("Cannot open legacy sensors device");
+        return 1;
+    }
+
+    configureRpcThreadpool(1, true /*callerWillJoin*/);
+    status_t status = service->registerAsService();
+
+    if (status != OK) {
+        ALOGE("Cannot register Sensors HAL service");
+        return 1;
+    }
+
+    ALOGI("Sensors HAL Ready.");
+    joinRpcThreadpool();
+    // Under normal cases, execution will not reach this line.
+    ALOGI("Sensors HAL failed to join thread pool.");
+    return 1;
+}
@@ -22,6 +22,7 @@ LOCAL_MODULE_RELATIVE_PATH := hw
 LOCAL_PROPRIETARY_MODULE := true
 LOCAL_MODULE := android.hardware.usb@1.1-service.imx
 LOCAL_INIT_RC := android.hardware.usb@1.1-service.imx.rc
+LOCAL_REQUIRED_MODULES := usb_autosuspend.conf
 LOCAL_SRC_FILES := \
     service.cpp \
     Usb.cpp
@@ -37,3 +38,10 @@ LOCAL_SHARED_LIBRARIES := \
     android.hardware.usb@1.1
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := usb_autosuspend.conf
+LOCAL_MODULE_CLASS := ETC
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := usb_autosuspend.conf
+include $(BUILD_PREBUILT)
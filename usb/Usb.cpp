@@ -22,14 +22,17 @@
 #include <chrono>
 #include <dirent.h>
 #include <pthread.h>
-#include <regex>
 #include <stdio.h>
 #include <sys/types.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <cutils/properties.h>
 #include <cutils/uevent.h>
+#include <sched.h>
 #include <sys/epoll.h>
 #include <utils/Errors.h>
 #include <utils/StrongPointer.h>
@@ -49,6 +52,9 @@ const char GOOGLE_USBC_35_ADAPTER_UNPLUGGED_ID_STR[] = "5029";
 volatile bool destroyThread;
 
 static void checkUsbDeviceAutoSuspend(const std::string& devicePath);
+static void forgetUsbDeviceAutoSuspend(const std::string& devicePath);
+static void loadAutoSuspendRules();
+static void setWorkAffinity();
 
 static int32_t readFile(const std::string &filename, std::string *contents) {
   FILE *fp;
@@ -171,6 +177,16 @@ bool switchMode(const hidl_string &portName,
     return false;
   }
 
+  // Kernel ignores a write of the current port type and sends no
+  // uevent, nothing to wait for.
+  if (!readFile(filename, &written)) {
+    extractRole(&written);
+    if (written == convertRoletoString(newRole)) {
+      ALOGI("port type already %s", written.c_str());
+      return true;
+    }
+  }
+
   fp = fopen(filename.c_str(), "w");
   if (fp != NULL) {
     // Hold the lock here to prevent loosing connected signals
@@ -178,6 +194,11 @@ bool switchMode(const hidl_string &portName,
     // can arrive anytime.
     pthread_mutex_lock(&usb->mPartnerLock);
     usb->mPartnerUp = false;
+    usb->mDataRoleUp = false;
+    usb->mPendingPort = portName.c_str();
+    usb->mPendingDataRole =
+        newRole.role == static_cast<uint32_t>(PortMode_1_1::DFP)
+            ? PortDataRole::HOST : PortDataRole::DEVICE;
     int ret = fputs(convertRoletoString(newRole).c_str(), fp);
     fclose(fp);
 
@@ -185,25 +206,26 @@ bool switchMode(const hidl_string &portName,
       struct timespec   to;
       struct timeval    tp;
 
-wait_again:
+      // Uevent thread signals partner add and data role change as
+      // they come, timeout only bounds a failed swap.
       gettimeofday(&tp, NULL);
       to.tv_sec = tp.tv_sec + PORT_TYPE_TIMEOUT;
-      to.tv_nsec = tp.tv_usec * 1000;;
-
-      int err = pthread_cond_timedwait(&usb->mPartnerCV, &usb->mPartnerLock, &to);
-      // There are no uevent signals which implies role swap timed out.
-      if (err == ETIMEDOUT) {
-        ALOGI("uevents wait timedout");
-      // Sanity check.
-      } else if (!usb->mPartnerUp) {
-        goto wait_again;
-      // Role switch succeeded since usb->mPartnerUp is true.
-      } else {
-        roleSwitch = true;
+      to.tv_nsec = tp.tv_usec * 1000;
+
+      while (!(usb->mPartnerUp && usb->mDataRoleUp)) {
+        int err = pthread_cond_timedwait(&usb->mPartnerCV, &usb->mPartnerLock, &to);
+        // There are no uevent signals which implies role swap timed out.
+        if (err == ETIMEDOUT) {
+          ALOGI("uevents wait timedout partner:%d data role:%d",
+                usb->mPartnerUp, usb->mDataRoleUp);
+          break;
+        }
       }
+      roleSwitch = usb->mPartnerUp && usb->mDataRoleUp;
     } else {
       ALOGI("Role switch failed while wrting to file");
     }
+    usb->mPendingPort.clear();
     pthread_mutex_unlock(&usb->mPartnerLock);
   }
 
@@ -397,6 +419,72 @@ bool canSwitchRoleHelper(const std::string &portName, PortRoleType /*type*/) {
   return false;
 }
 
+/*
+ * Status of one port as reported to a V1_1 callback.
+ */
+static Status getPortStatus(const std::string &portName, bool connected,
+    PortStatus_1_1 *portStatus) {
+  uint32_t currentRole;
+
+  ALOGI("%s", portName.c_str());
+  portStatus->status.portName = portName;
+
+  if (getCurrentRoleHelper(portName, connected, PortRoleType::POWER_ROLE,
+                           &currentRole) == Status::SUCCESS) {
+    portStatus->status.currentPowerRole =
+        static_cast<PortPowerRole>(currentRole);
+  } else {
+    ALOGE("Error while retreiving portNames");
+    return Status::ERROR;
+  }
+
+  if (getCurrentRoleHelper(portName, connected, PortRoleType::DATA_ROLE,
+                           &currentRole) == Status::SUCCESS) {
+    portStatus->status.currentDataRole =
+        static_cast<PortDataRole>(currentRole);
+  } else {
+    ALOGE("Error while retreiving current port role");
+    return Status::ERROR;
+  }
+
+  if (getCurrentRoleHelper(portName, connected, PortRoleType::MODE,
+                           &currentRole) == Status::SUCCESS) {
+    portStatus->currentMode = static_cast<PortMode_1_1>(currentRole);
+  } else {
+    ALOGE("Error while retreiving current data role");
+    return Status::ERROR;
+  }
+
+  portStatus->status.canChangeMode = true;
+  portStatus->status.canChangeDataRole =
+      connected ? canSwitchRoleHelper(portName, PortRoleType::DATA_ROLE)
+                : false;
+  portStatus->status.canChangePowerRole =
+      connected ? canSwitchRoleHelper(portName, PortRoleType::POWER_ROLE)
+                : false;
+
+  ALOGI("connected:%d canChangeMode:%d canChagedata:%d canChangePower:%d",
+        connected, portStatus->status.canChangeMode,
+        portStatus->status.canChangeDataRole,
+        portStatus->status.canChangePowerRole);
+
+  portStatus->supportedModes = PortMode_1_1::UFP | PortMode_1_1::DFP;
+  portStatus->status.supportedModes = V1_0::PortMode::NONE;
+  portStatus->status.currentMode = V1_0::PortMode::NONE;
+  return Status::SUCCESS;
+}
+
+/*
+ * V1_0 callbacks read the mode from the V1_0 part of the status.
+ */
+static void convertPortStatusToV1_0(hidl_vec<PortStatus_1_1> *currentPortStatus_1_1) {
+  for (unsigned long i = 0; i < currentPortStatus_1_1->size(); i++) {
+    PortStatus_1_1 &port = (*currentPortStatus_1_1)[i];
+    port.status.supportedModes = V1_0::PortMode::DFP;
+    port.status.currentMode = static_cast<V1_0::PortMode>(port.currentMode);
+  }
+}
+
 /*
  * Reuse the same method for both V1_0 and V1_1 callback objects.
  * The caller of this method would reconstruct the V1_0::PortStatus
@@ -412,94 +500,94 @@ Status getPortStatusHelper(hidl_vec<PortStatus_1_1> *currentPortStatus_1_1,
     currentPortStatus_1_1->resize(names.size());
     for (std::pair<std::string, bool> port : names) {
       i++;
-      ALOGI("%s", port.first.c_str());
-      (*currentPortStatus_1_1)[i].status.portName = port.first;
-
-      uint32_t currentRole;
-      if (getCurrentRoleHelper(port.first, port.second,
-                               PortRoleType::POWER_ROLE,
-                               &currentRole) == Status::SUCCESS) {
-        (*currentPortStatus_1_1)[i].status.currentPowerRole =
-            static_cast<PortPowerRole>(currentRole);
-      } else {
-        ALOGE("Error while retreiving portNames");
-        goto done;
-      }
-
-      if (getCurrentRoleHelper(port.first, port.second, PortRoleType::DATA_ROLE,
-                               &currentRole) == Status::SUCCESS) {
-        (*currentPortStatus_1_1)[i].status.currentDataRole =
-            static_cast<PortDataRole>(currentRole);
-      } else {
-        ALOGE("Error while retreiving current port role");
-        goto done;
-      }
-
-      if (getCurrentRoleHelper(port.first, port.second, PortRoleType::MODE,
-                               &currentRole) == Status::SUCCESS) {
-        (*currentPortStatus_1_1)[i].currentMode =
-            static_cast<PortMode_1_1>(currentRole);
-        (*currentPortStatus_1_1)[i].status.currentMode =
-            static_cast<V1_0::PortMode>(currentRole);
-      } else {
-        ALOGE("Error while retreiving current data role");
-        goto done;
-      }
-
-      (*currentPortStatus_1_1)[i].status.canChangeMode = true;
-      (*currentPortStatus_1_1)[i].status.canChangeDataRole =
-          port.second ? canSwitchRoleHelper(port.first, PortRoleType::DATA_ROLE)
-                      : false;
-      (*currentPortStatus_1_1)[i].status.canChangePowerRole =
-          port.second
-              ? canSwitchRoleHelper(port.first, PortRoleType::POWER_ROLE)
-              : false;
-
-      ALOGI("connected:%d canChangeMode:%d canChagedata:%d canChangePower:%d",
-            port.second, (*currentPortStatus_1_1)[i].status.canChangeMode,
-            (*currentPortStatus_1_1)[i].status.canChangeDataRole,
-            (*currentPortStatus_1_1)[i].status.canChangePowerRole);
-
-      if (V1_0) {
-        (*currentPortStatus_1_1)[i].status.supportedModes = V1_0::PortMode::DFP;
-      } else {
-        (*currentPortStatus_1_1)[i].supportedModes = PortMode_1_1::UFP | PortMode_1_1::DFP;
-        (*currentPortStatus_1_1)[i].status.supportedModes = V1_0::PortMode::NONE;
-        (*currentPortStatus_1_1)[i].status.currentMode = V1_0::PortMode::NONE;
-      }
+      if (getPortStatus(port.first, port.second,
+                        &(*currentPortStatus_1_1)[i]) != Status::SUCCESS)
+        return Status::ERROR;
     }
+    if (V1_0)
+      convertPortStatusToV1_0(currentPortStatus_1_1);
     return Status::SUCCESS;
   }
-done:
   return Status::ERROR;
 }
 
-Return<void> Usb::queryPortStatus() {
-  hidl_vec<PortStatus_1_1> currentPortStatus_1_1;
-  hidl_vec<V1_0::PortStatus> currentPortStatus;
-  Status status;
-  sp<IUsbCallback> callback_V1_1 = IUsbCallback::castFrom(mCallback_1_0);
+/*
+ * Port a typec uevent is about, "port0" for port0, port0-partner,
+ * port0-cable and so on, taken from the action@devpath line.
+ */
+static std::string getUeventPortName(const char *msg) {
+  const char *name = strrchr(msg, '/');
+  if (name == NULL) return "";
+  name++;
+  const char *end = strchr(name, '-');
+  return end != NULL ? std::string(name, end - name) : std::string(name);
+}
 
-  pthread_mutex_lock(&mLock);
-  if (mCallback_1_0 != NULL) {
-    if (callback_V1_1 != NULL) {
-      status = getPortStatusHelper(&currentPortStatus_1_1, false);
-    } else {
-      status = getPortStatusHelper(&currentPortStatus_1_1, true);
-      currentPortStatus.resize(currentPortStatus_1_1.size());
-      for (unsigned long i = 0; i < currentPortStatus_1_1.size(); i++)
-        currentPortStatus[i] = currentPortStatus_1_1[i].status;
+bool Usb::updatePortStatusLocked(const std::string &portName) {
+  if (mPortStatusValid && !portName.empty()) {
+    for (unsigned long i = 0; i < mPortStatus.size(); i++) {
+      if (mPortStatus[i].status.portName != portName) continue;
+
+      PortStatus_1_1 portStatus;
+      std::string partner("/sys/class/typec/" + portName + "-partner");
+      if (getPortStatus(portName, access(partner.c_str(), F_OK) == 0,
+                        &portStatus) != Status::SUCCESS)
+        break;
+      if (portStatus == mPortStatus[i] && mPortStatusResult == Status::SUCCESS)
+        return false;
+      mPortStatus[i] = portStatus;
+      mPortStatusResult = Status::SUCCESS;
+      return true;
     }
+  }
 
-    Return<void> ret;
+  // first query, new port or port failed to read, rescan all
+  hidl_vec<PortStatus_1_1> portStatus;
+  Status result = getPortStatusHelper(&portStatus, false);
+  bool changed = !mPortStatusValid || result != mPortStatusResult ||
+                 portStatus.size() != mPortStatus.size();
+  for (unsigned long i = 0; !changed && i < portStatus.size(); i++)
+    changed = !(portStatus[i] == mPortStatus[i]);
+  mPortStatus = portStatus;
+  mPortStatusResult = result;
+  mPortStatusValid = true;
+  return changed;
+}
 
-    if (callback_V1_1 != NULL)
-      ret = callback_V1_1->notifyPortStatusChange_1_1(currentPortStatus_1_1, status);
-    else
-      ret = mCallback_1_0->notifyPortStatusChange(currentPortStatus, status);
+void Usb::notifyPortStatusLocked() {
+  hidl_vec<PortStatus_1_1> currentPortStatus_1_1(mPortStatus);
+  sp<IUsbCallback> callback_V1_1 = IUsbCallback::castFrom(mCallback_1_0);
+  Return<void> ret;
 
-    if (!ret.isOk())
-      ALOGE("queryPortStatus_1_1 error %s", ret.description().c_str());
+  if (callback_V1_1 != NULL) {
+    ret = callback_V1_1->notifyPortStatusChange_1_1(currentPortStatus_1_1,
+                                                    mPortStatusResult);
+  } else {
+    /*
+     * Copying the cached status into V1_0::PortStatus to pass back
+     * through the V1_0 callback object.
+     */
+    hidl_vec<V1_0::PortStatus> currentPortStatus;
+    convertPortStatusToV1_0(&currentPortStatus_1_1);
+    currentPortStatus.resize(currentPortStatus_1_1.size());
+    for (unsigned long i = 0; i < currentPortStatus_1_1.size(); i++)
+      currentPortStatus[i] = currentPortStatus_1_1[i].status;
+    ret = mCallback_1_0->notifyPortStatusChange(currentPortStatus,
+                                                mPortStatusResult);
+  }
+
+  if (!ret.isOk())
+    ALOGE("notifyPortStatusChange error %s", ret.description().c_str());
+}
+
+Return<void> Usb::queryPortStatus() {
+  pthread_mutex_lock(&mLock);
+  if (mCallback_1_0 != NULL) {
+    // cache follows uevents while callback is set, read sysfs only
+    // until it is filled.
+    if (!mPortStatusValid)
+      updatePortStatusLocked("");
+    notifyPortStatusLocked();
   } else {
     ALOGI("Notifying userspace skipped. Callback is NULL");
   }
@@ -513,10 +601,50 @@ struct data {
   android::hardware::usb::V1_1::implementation::Usb *usb;
 };
 
+// uevents of devices outside class typec and bus usb are dropped
+// unparsed.
+static const char kTypecSubsystem[] = "SUBSYSTEM=typec";
+static const char kUsbSubsystem[] = "SUBSYSTEM=usb";
+static const char kDevtype[] = "DEVTYPE=";
+static const char kPartnerAction[] = "add";
+static const char kPartnerSuffix[] = "-partner";
+
+// "add@<devpath>-partner" line, what (add)(.*)(-partner) matched.
+static bool isPartnerAdd(const char *line, size_t len) {
+  size_t suffix = sizeof(kPartnerSuffix) - 1;
+  return len >= sizeof(kPartnerAction) - 1 + suffix &&
+         !strncmp(line, kPartnerAction, sizeof(kPartnerAction) - 1) &&
+         !memcmp(line + len - suffix, kPartnerSuffix, suffix);
+}
+
+/*
+ * Autosuspend policy of usb devices. Interfaces of a device show up
+ * after the device itself, so the policy is checked again on each new
+ * interface.
+ */
+static void usb_uevent_event(const char *msg, const char *devtype) {
+  const char *devpath = strchr(msg, '@');
+  if (devpath == NULL || devtype == NULL) return;
+
+  std::string path = std::string("/sys") + (devpath + 1);
+  bool add = !strncmp(msg, "add@", strlen("add@"));
+  if (!strcmp(devtype, "usb_interface")) {
+    if (add) checkUsbDeviceAutoSuspend(path.substr(0, path.rfind('/')));
+  } else if (!strcmp(devtype, "usb_device")) {
+    if (add)
+      checkUsbDeviceAutoSuspend(path);
+    else if (!strncmp(msg, "remove@", strlen("remove@")))
+      forgetUsbDeviceAutoSuspend(path);
+  }
+}
+
 static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
   char msg[UEVENT_MSG_LEN + 2];
   char *cp;
   int n;
+  bool typec = false;
+  bool usb = false;
+  const char *devtype = NULL;
 
   n = uevent_kernel_multicast_recv(payload->uevent_fd, msg, UEVENT_MSG_LEN);
   if (n <= 0) return;
@@ -525,11 +653,25 @@ static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
 
   msg[n] = '\0';
   msg[n + 1] = '\0';
-  cp = msg;
 
+  for (cp = msg; *cp; cp += strlen(cp) + 1) {
+    if (!strcmp(cp, kTypecSubsystem))
+      typec = true;
+    else if (!strcmp(cp, kUsbSubsystem))
+      usb = true;
+    else if (!strncmp(cp, kDevtype, sizeof(kDevtype) - 1))
+      devtype = cp + sizeof(kDevtype) - 1;
+  }
+  if (usb) {
+    usb_uevent_event(msg, devtype);
+    return;
+  }
+  if (!typec) return;
+
+  cp = msg;
   while (*cp) {
-    std::cmatch match;
-    if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
+    size_t len = strlen(cp);
+    if (isPartnerAdd(cp, len)) {
        ALOGI("partner added");
        pthread_mutex_lock(&payload->usb->mPartnerLock);
        payload->usb->mPartnerUp = true;
@@ -539,37 +681,30 @@ static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
       hidl_vec<PortStatus_1_1> currentPortStatus_1_1;
       ALOGI("uevent received %s", cp);
       pthread_mutex_lock(&payload->usb->mLock);
-      if (payload->usb->mCallback_1_0 != NULL) {
-        sp<IUsbCallback> callback_V1_1 = IUsbCallback::castFrom(payload->usb->mCallback_1_0);
-        Return<void> ret;
-
-        // V1_1 callback
-        if (callback_V1_1 != NULL) {
-          Status status = getPortStatusHelper(&currentPortStatus_1_1, false);
-          ret = callback_V1_1->notifyPortStatusChange_1_1(
-              currentPortStatus_1_1, status);
-        } else { // V1_0 callback
-          Status status = getPortStatusHelper(&currentPortStatus_1_1, true);
-
-          /*
-           * Copying the result from getPortStatusHelper
-           * into V1_0::PortStatus to pass back through
-           * the V1_0 callback object.
-           */
-          hidl_vec<V1_0::PortStatus> currentPortStatus;
-          currentPortStatus.resize(currentPortStatus_1_1.size());
-          for (unsigned long i = 0; i < currentPortStatus_1_1.size(); i++)
-            currentPortStatus[i] = currentPortStatus_1_1[i].status;
-
-          ret = payload->usb->mCallback_1_0->notifyPortStatusChange(
-              currentPortStatus, status);
-        }
-        if (!ret.isOk()) ALOGE("error %s", ret.description().c_str());
-      } else {
-        ALOGI("Notifying userspace skipped. Callback is NULL");
+      // only the port of this uevent is read again, callback is
+      // skipped when its status did not change.
+      if (payload->usb->updatePortStatusLocked(getUeventPortName(msg))) {
+        if (payload->usb->mCallback_1_0 != NULL)
+          payload->usb->notifyPortStatusLocked();
+        else
+          ALOGI("Notifying userspace skipped. Callback is NULL");
       }
+      currentPortStatus_1_1 = payload->usb->mPortStatus;
       pthread_mutex_unlock(&payload->usb->mLock);
 
+      // Mode switch in progress waits for the data role of its port.
+      pthread_mutex_lock(&payload->usb->mPartnerLock);
+      for (unsigned long i = 0; i < currentPortStatus_1_1.size(); i++) {
+        if (!payload->usb->mPendingPort.empty() &&
+            currentPortStatus_1_1[i].status.portName == payload->usb->mPendingPort &&
+            currentPortStatus_1_1[i].status.currentDataRole ==
+                payload->usb->mPendingDataRole) {
+          payload->usb->mDataRoleUp = true;
+          pthread_cond_signal(&payload->usb->mPartnerCV);
+        }
+      }
+      pthread_mutex_unlock(&payload->usb->mPartnerLock);
+
       //Role switch is not in progress and port is in disconnected state
       if (!pthread_mutex_trylock(&payload->usb->mRoleSwitchLock)) {
         for (unsigned long i = 0; i < currentPortStatus_1_1.size(); i++) {
@@ -589,7 +724,7 @@ static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
     }
 
     /* advance to after the next \0 */
-    while (*cp++) {}
+    cp += len + 1;
   }
 }
 
@@ -601,6 +736,9 @@ void *work(void *param) {
 
   ALOGE("creating thread");
 
+  // uevents aren't time critical, only cpu mask is applied.
+  setWorkAffinity();
+
   uevent_fd = uevent_open_socket(64 * 1024, true);
 
   if (uevent_fd < 0) {
@@ -608,6 +746,8 @@ void *work(void *param) {
     return NULL;
   }
 
+  loadAutoSuspendRules();
+
   payload.uevent_fd = uevent_fd;
   payload.usb = (android::hardware::usb::V1_1::implementation::Usb *)param;
 
@@ -704,6 +844,8 @@ Return<void> Usb::setCallback(const sp<V1_0::IUsbCallback> &callback) {
 
   destroyThread = false;
   signal(SIGUSR1, sighandler);
+  // uevents were not followed while no callback was set
+  mPortStatusValid = false;
 
   /*
    * Create a background thread if the old callback value is NULL
@@ -719,25 +861,149 @@ Return<void> Usb::setCallback(const sp<V1_0::IUsbCallback> &callback) {
 }
 
 /*
- * whitelisting USB device idProduct and idVendor to allow auto suspend.
+ * Autosuspend policy, one rule per line of AUTOSUSPEND_CONFIG:
+ *   product <idVendor> <idProduct> <delay_ms>
+ *   class <bInterfaceClass> <delay_ms>
+ * ids and class in hex as sysfs shows them, delay -1 keeps the kernel
+ * default. A device may autosuspend when its product is listed or when
+ * every interface has a listed class, the longest delay of those is set.
+ */
+#define AUTOSUSPEND_CONFIG "/vendor/etc/usb_autosuspend.conf"
+
+struct AutoSuspendRule {
+  std::string vendor;
+  std::string product;
+  // -1 for product rules.
+  int32_t interfaceClass;
+  int32_t delayMs;
+};
+
+// Used by the worker thread only.
+static std::vector<AutoSuspendRule> sAutoSuspendRules;
+// Devices this policy switched to auto, reverted if a later interface
+// is not covered.
+static std::unordered_set<std::string> sAutoSuspended;
+
+/*
+ * Keep the worker thread on cpus of usb.work.cpus mask, e.g. 0xf for
+ * the little cluster, 0 or unset runs it on any cpu.
+ */
+static void setWorkAffinity() {
+  char value[PROPERTY_VALUE_MAX];
+  property_get("usb.work.cpus", value, "0");
+  uint32_t cpus = (uint32_t)strtoul(value, NULL, 0);
+  if (cpus == 0) return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < 32; i++) {
+    if (cpus & (1U << i)) CPU_SET(i, &set);
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    ALOGE("set worker cpus 0x%x failed; errno=%d", cpus, errno);
+  }
+}
+
+static void loadAutoSuspendRules() {
+  FILE *fp;
+  char line[128];
+
+  sAutoSuspendRules.clear();
+  fp = fopen(AUTOSUSPEND_CONFIG, "r");
+  if (fp == NULL) {
+    ALOGI("%s not found, using built-in autosuspend list", AUTOSUSPEND_CONFIG);
+    sAutoSuspendRules.push_back({GOOGLE_USB_VENDOR_ID_STR,
+                                 GOOGLE_USBC_35_ADAPTER_UNPLUGGED_ID_STR, -1, -1});
+    return;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char vendor[8], product[8];
+    unsigned int interfaceClass;
+    int delayMs;
+
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "product %7s %7s %d", vendor, product, &delayMs) == 3) {
+      sAutoSuspendRules.push_back({vendor, product, -1, delayMs});
+    } else if (sscanf(line, "class %x %d", &interfaceClass, &delayMs) == 2) {
+      sAutoSuspendRules.push_back({"", "", (int32_t)interfaceClass, delayMs});
+    } else {
+      ALOGE("bad autosuspend rule: %s", line);
+    }
+  }
+  fclose(fp);
+  ALOGI("%zu autosuspend rules loaded", sAutoSuspendRules.size());
+}
+
+/*
+ * Matching product rule, NULL if the product is not listed.
  */
-static bool canProductAutoSuspend(const std::string &deviceIdVendor,
+static const AutoSuspendRule *canProductAutoSuspend(const std::string &deviceIdVendor,
     const std::string &deviceIdProduct) {
-  if (deviceIdVendor == GOOGLE_USB_VENDOR_ID_STR &&
-      deviceIdProduct == GOOGLE_USBC_35_ADAPTER_UNPLUGGED_ID_STR) {
-    return true;
+  for (const AutoSuspendRule &rule : sAutoSuspendRules) {
+    if (rule.interfaceClass < 0 && deviceIdVendor == rule.vendor &&
+        deviceIdProduct == rule.product) {
+      return &rule;
+    }
   }
-  return false;
+  return NULL;
+}
+
+static const AutoSuspendRule *canClassAutoSuspend(int32_t interfaceClass) {
+  for (const AutoSuspendRule &rule : sAutoSuspendRules) {
+    if (rule.interfaceClass == interfaceClass) return &rule;
+  }
+  return NULL;
+}
+
+/*
+ * Every interface present must be covered by a class rule, *delayMs is
+ * the longest delay asked by them.
+ */
+static bool canInterfacesAutoSuspend(const std::string &devicePath, int32_t *delayMs) {
+  DIR *dp = opendir(devicePath.c_str());
+  struct dirent *ep;
+  int32_t interfaces = 0;
+  bool allowed = true;
+
+  if (dp == NULL) return false;
+  *delayMs = -1;
+  // interface directories are named <port>:<config>.<interface>
+  while (allowed && (ep = readdir(dp))) {
+    if (strchr(ep->d_name, ':') == NULL) continue;
+
+    std::string interfaceClass;
+    if (readFile(devicePath + "/" + ep->d_name + "/bInterfaceClass",
+                 &interfaceClass)) {
+      allowed = false;
+      break;
+    }
+    const AutoSuspendRule *rule =
+        canClassAutoSuspend(strtol(interfaceClass.c_str(), NULL, 16));
+    if (rule == NULL) {
+      allowed = false;
+    } else {
+      interfaces++;
+      if (rule->delayMs > *delayMs) *delayMs = rule->delayMs;
+    }
+  }
+  closedir(dp);
+  return allowed && interfaces > 0;
 }
 
-static bool canUsbDeviceAutoSuspend(const std::string &devicePath) {
+static bool canUsbDeviceAutoSuspend(const std::string &devicePath, int32_t *delayMs) {
   std::string deviceIdVendor;
   std::string deviceIdProduct;
   readFile(devicePath + "/idVendor", &deviceIdVendor);
   readFile(devicePath + "/idProduct", &deviceIdProduct);
 
   // deviceIdVendor and deviceIdProduct will be empty strings if readFile fails
-  return canProductAutoSuspend(deviceIdVendor, deviceIdProduct);
+  const AutoSuspendRule *rule = canProductAutoSuspend(deviceIdVendor, deviceIdProduct);
+  if (rule != NULL) {
+    *delayMs = rule->delayMs;
+    return true;
+  }
+  return canInterfacesAutoSuspend(devicePath, delayMs);
 }
 
 /*
@@ -746,16 +1012,29 @@ static bool canUsbDeviceAutoSuspend(const std::string &devicePath) {
  * necessary.
  */
 void checkUsbDeviceAutoSuspend(const std::string& devicePath) {
+  int32_t delayMs = -1;
+
   /*
-   * Currently we only actively enable devices that should be autosuspended, and leave others
-   * to the defualt.
+   * Devices allowed by the policy are autosuspended, the others are left
+   * to the defualt unless the policy enabled them for an earlier
+   * interface.
    */
-  if (canUsbDeviceAutoSuspend(devicePath)) {
-    ALOGI("auto suspend usb device %s", devicePath.c_str());
+  if (canUsbDeviceAutoSuspend(devicePath, &delayMs)) {
+    ALOGI("auto suspend usb device %s delay %d", devicePath.c_str(), delayMs);
+    if (delayMs >= 0)
+      writeFile(devicePath + "/power/autosuspend_delay_ms", std::to_string(delayMs));
     writeFile(devicePath + "/power/control", "auto");
+    sAutoSuspended.insert(devicePath);
+  } else if (sAutoSuspended.erase(devicePath)) {
+    ALOGI("usb device %s no longer allowed to auto suspend", devicePath.c_str());
+    writeFile(devicePath + "/power/control", "on");
   }
 }
 
+static void forgetUsbDeviceAutoSuspend(const std::string& devicePath) {
+  sAutoSuspended.erase(devicePath);
+}
+
 }  // namespace implementation
 }  // namespace V1_0
 }  // namespace usb
@@ -73,6 +73,22 @@ struct Usb : public IUsb {
     pthread_mutex_t mPartnerLock = PTHREAD_MUTEX_INITIALIZER;
     // Variable to signal partner coming back online after type switch
     bool mPartnerUp;
+    // Port whose mode switch waits, and the data role it waits for.
+    // Protected by mPartnerLock like mPartnerUp.
+    std::string mPendingPort;
+    PortDataRole mPendingDataRole;
+    bool mDataRoleUp;
+    // Last status of each port, refreshed per port from uevents while
+    // the worker thread runs. Protected by mLock.
+    hidl_vec<PortStatus_1_1> mPortStatus;
+    Status mPortStatusResult = Status::ERROR;
+    bool mPortStatusValid = false;
+
+    // Re-read port named by uevent, or all ports when it is not cached.
+    // Called with mLock held, returns true if any status changed.
+    bool updatePortStatusLocked(const std::string &portName);
+    // Send cached status to callback, called with mLock held.
+    void notifyPortStatusLocked();
 
     private:
         pthread_t mPoll;